@@ -0,0 +1,79 @@
+//******************************************************************************
+/**
+ * @file CommandTable.cpp
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief CommandTable class implementation
+ * @version 0.1
+ * @date 2024-02-28
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#include "CommandTable.h"
+
+#include <string.h>
+#include <strings.h>
+
+//******************************************************************************
+CommandTable::CommandTable(void) {
+    memset(this->entries, 0, sizeof(this->entries));
+}
+
+//******************************************************************************
+/**
+ * @brief Add a command.
+ *
+ * @param name  Kept, not copied.
+ * @return int  Its index, -1 if the table is full or the name is taken,
+ *              whatever the case.
+ */
+int CommandTable::add(const char* name) {
+    size_t length = strlen(name);
+    if (this->count == COMMAND_TABLE_MAX_COMMANDS || this->find(name, length) >= 0) {
+        return -1;
+    }
+
+    int index = (int) this->count++;
+    auto& entry = this->entries[index];
+    entry.name = name;
+    entry.length = length;
+    entry.hash = fnv1a_hash_nocase(name, length);
+    this->slots.insert(entry.hash, index);
+    return index;
+}
+
+//******************************************************************************
+/**
+ * @brief Index of a command, -1 if unknown.  Any case.
+ */
+int CommandTable::find(const char* name, size_t length) const {
+    if (name == nullptr) {
+        return -1;
+    }
+
+    uint32_t h = fnv1a_hash_nocase(name, length);
+    return this->slots.find(h, [&](int index) {
+        const auto& entry = this->entries[index];
+        return entry.hash == h && entry.length == length && strncasecmp(entry.name, name, length) == 0;
+    });
+}
+
+//******************************************************************************
+/**
+ * @brief Count a call and the time it took.
+ */
+void CommandTable::record(int index, uint32_t elapsed_us, bool ok) {
+    if (index < 0 || index >= (int) this->count) {
+        return;
+    }
+
+    command_stats_t& stats = this->entries[index].stats;
+    stats.calls++;
+    if (!ok) {
+        stats.errors++;
+    }
+    stats.total_us += elapsed_us;
+    if (elapsed_us > stats.max_us) {
+        stats.max_us = elapsed_us;
+    }
+}
@@ -0,0 +1,66 @@
+//******************************************************************************
+/**
+ * @file CommandTable.h
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief CommandTable class definition
+ * @version 0.1
+ * @date 2024-02-28
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#pragma once
+
+#include "Utils/NoCopy.h"
+#include "Utils/HashSlots.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define COMMAND_TABLE_MAX_COMMANDS  (24)
+#define COMMAND_TABLE_HASH_SLOTS    (32)
+
+typedef struct {
+    uint32_t calls;
+    uint32_t errors;
+    uint64_t total_us;
+    uint32_t max_us;
+} command_stats_t;
+
+//******************************************************************************
+/**
+ * @brief Command names to indexes, with the time spent in each command.
+ *
+ * Names are matched whole and without case, the udp clients have always
+ * been free to send "GET-INFO".  One hash and one compare per lookup, the
+ * same HashSlots as MqttTopics.  The index is the order the commands were
+ * added in, the caller keeps its handlers in that order.
+ *
+ * @note Not thread safe, owned by the task that dispatches the commands.
+ */
+class CommandTable : public NoCopy {
+public:
+    CommandTable(void);
+    ~CommandTable(void) = default;
+
+public:
+    int add(const char* name);
+    int find(const char* name, size_t length) const;
+
+    void record(int index, uint32_t elapsed_us, bool ok);
+
+    inline size_t size(void) const { return this->count; }
+    inline const char* get_name(int index) const { return this->entries[index].name; }
+    inline const command_stats_t& get_stats(int index) const { return this->entries[index].stats; }
+
+private:
+    struct {
+        const char* name;
+        size_t length;
+        uint32_t hash;
+        command_stats_t stats;
+    } entries[COMMAND_TABLE_MAX_COMMANDS];
+    size_t count = 0;
+
+    HashSlots<COMMAND_TABLE_HASH_SLOTS> slots;
+};
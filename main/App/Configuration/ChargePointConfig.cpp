@@ -3,9 +3,14 @@
 #include "esp_log.h"
 
 #include "Utils/KeyStore.h"
+#include "Utils/ConfigBlob.h"
 
 static const char *TAG = "ChargePointConfig";
 
+// Layout of the blob, bumped when a field changes meaning.
+#define CHARGEPOINT_CONFIG_VERSION (1)
+#define CHARGEPOINT_CONFIG_FIELDS  (5)
+
 /* #region helper macros */
 #define ESP_SET_VALUE(key, value, commit)             \
     res = store.setKeyValue(key, value, commit);      \
@@ -16,6 +21,7 @@ static const char *TAG = "ChargePointConfig";
     }
 
 #define ESP_GET_STR_VALUE(key, value, length)         \
+    FREE_MEMBER(value);                               \
     res = store.getKeyValueAlloc(key, value, length); \
     if (res != ESP_OK)                                \
     {                                                 \
@@ -38,6 +44,8 @@ static const char *TAG = "ChargePointConfig";
         m = nullptr;   \
     }
 
+#define LENGTH_OF(m) ((m) != nullptr ? strlen(m) : 0)
+
 /* #endregion */
 
 //******************************************************************************
@@ -90,7 +98,8 @@ void ChargePointConfig::set_chargepoint_info(
 esp_err_t ChargePointConfig::load(void)
 {
     ESP_LOGD(TAG, "ChargePointConfig::Load()");
-    size_t valueLength = 0;
+    uint8_t* blob = nullptr;
+    size_t blobLength = 0;
     esp_err_t res = ESP_OK;
 
     KeyStore store;
@@ -102,11 +111,30 @@ esp_err_t ChargePointConfig::load(void)
 
     ESP_LOGI(TAG, "Loading chargepoint config");
 
-    ESP_GET_STR_VALUE("group_id", this->group_id, valueLength);
-    ESP_GET_STR_VALUE("l1_cp_sid", this->led_1_chargepoint_station_id, valueLength);
-    ESP_GET_STR_VALUE("l2_cp_sid", this->led_2_chargepoint_station_id, valueLength);
-    ESP_GET_NUM_VALUE("l1_port_number", this->led_1_chargepoint_port_number);
-    ESP_GET_NUM_VALUE("l2_port_number", this->led_2_chargepoint_port_number);
+    res = store.getKeyBlobAlloc(CONFIG_BLOB_KEY, blob, blobLength);
+    if (res == ESP_OK) {
+        res = this->unpack(blob, blobLength);
+        free(blob);
+        if (res != ESP_OK) {
+            ESP_LOGW(TAG, "Chargepoint config blob rejected (%s), trying the keys", esp_err_to_name(res));
+        } else if (this->keys_differ(store)) {
+            ESP_LOGW(TAG, "Chargepoint config changed by older firmware, taking the keys");
+            res = ESP_ERR_INVALID_STATE;
+        }
+    }
+
+    // Saved by older firmware, one key per field, or changed by it since the
+    // blob was.  Copied to the blob, the keys stay for a downgrade.
+    if (res != ESP_OK) {
+        res = this->load_keys(store);
+        if (res != ESP_OK) {
+            goto err;
+        }
+        ESP_LOGI(TAG, "Copying chargepoint config to one blob");
+        if (this->save() != ESP_OK) {
+            ESP_LOGW(TAG, "Failed to copy chargepoint config, will try again next boot");
+        }
+    }
 
     ESP_LOGD(TAG, "group_id: %s", this->group_id);
     ESP_LOGD(TAG, "led_1_chargepoint_station_id: %s", this->led_1_chargepoint_station_id);
@@ -119,6 +147,92 @@ err:
     return res;
 }
 
+//******************************************************************************
+/**
+ * @brief Read the fields from the blob, the ones not known are skipped.
+ */
+esp_err_t ChargePointConfig::unpack(const uint8_t* blob, size_t length)
+{
+    ConfigBlobReader reader;
+    char field[CONFIG_BLOB_FIELD_MAX_LENGTH + 1];
+
+    esp_err_t res = reader.open(blob, length, CHARGEPOINT_CONFIG_VERSION);
+    if (res != ESP_OK) {
+        return res;
+    }
+
+    while (reader.next_field(field, sizeof(field))) {
+        if (strcmp(field, "group_id") == 0) { reader.read_str(this->group_id); }
+        else if (strcmp(field, "l1_cp_sid") == 0) { reader.read_str(this->led_1_chargepoint_station_id); }
+        else if (strcmp(field, "l2_cp_sid") == 0) { reader.read_str(this->led_2_chargepoint_station_id); }
+        else if (strcmp(field, "l1_port_number") == 0) { reader.read_u8(this->led_1_chargepoint_port_number); }
+        else if (strcmp(field, "l2_port_number") == 0) { reader.read_u8(this->led_2_chargepoint_port_number); }
+        else { reader.skip(); }
+    }
+
+    return reader.finish();
+}
+
+//******************************************************************************
+/**
+ * @brief Read the per key layout of older firmware.
+ */
+esp_err_t ChargePointConfig::load_keys(KeyStore& store)
+{
+    size_t valueLength = 0;
+    esp_err_t res = ESP_OK;
+
+    ESP_GET_STR_VALUE("group_id", this->group_id, valueLength);
+    ESP_GET_STR_VALUE("l1_cp_sid", this->led_1_chargepoint_station_id, valueLength);
+    ESP_GET_STR_VALUE("l2_cp_sid", this->led_2_chargepoint_station_id, valueLength);
+    ESP_GET_NUM_VALUE("l1_port_number", this->led_1_chargepoint_port_number);
+    ESP_GET_NUM_VALUE("l2_port_number", this->led_2_chargepoint_port_number);
+
+    return ESP_OK;
+}
+
+//******************************************************************************
+/**
+ * @brief True if the keys hold another mapping than the one loaded.
+ *
+ * Missing keys don't count, they were never written or are gone.
+ */
+bool ChargePointConfig::keys_differ(KeyStore& store)
+{
+    ChargePointConfig keys;
+    if (keys.load_keys(store) != ESP_OK) {
+        return false;
+    }
+
+    return !config_blob_same_str(this->group_id, keys.group_id) ||
+        !config_blob_same_str(this->led_1_chargepoint_station_id, keys.led_1_chargepoint_station_id) ||
+        !config_blob_same_str(this->led_2_chargepoint_station_id, keys.led_2_chargepoint_station_id) ||
+        this->led_1_chargepoint_port_number != keys.led_1_chargepoint_port_number ||
+        this->led_2_chargepoint_port_number != keys.led_2_chargepoint_port_number;
+}
+
+//******************************************************************************
+/**
+ * @brief Write the per key layout of older firmware next to the blob.
+ *
+ * Kept up to date so going back to older firmware keeps the mapping.  Every
+ * key is written, a station not set as "", so the keys only differ from the
+ * blob once older firmware changed them.  To be dropped once no release
+ * before the blob is in the field.
+ */
+esp_err_t ChargePointConfig::save_keys(KeyStore& store)
+{
+    esp_err_t res = ESP_OK;
+
+    ESP_SET_VALUE("group_id", this->group_id ? this->group_id : "", false);
+    ESP_SET_VALUE("l1_cp_sid", this->led_1_chargepoint_station_id ? this->led_1_chargepoint_station_id : "", false);
+    ESP_SET_VALUE("l1_port_number", this->led_1_chargepoint_port_number, false);
+    ESP_SET_VALUE("l2_cp_sid", this->led_2_chargepoint_station_id ? this->led_2_chargepoint_station_id : "", false);
+    ESP_SET_VALUE("l2_port_number", this->led_2_chargepoint_port_number, false);
+
+    return ESP_OK;
+}
+
 //******************************************************************************
 /**
  * @brief Save the chargepoint config to NVS
@@ -129,6 +243,11 @@ esp_err_t ChargePointConfig::save(void)
 {
     ESP_LOGD(TAG, "ChargePointConfig::Save()");
     esp_err_t res = ESP_OK;
+    uint8_t* blob = nullptr;
+    size_t size = 0;
+    size_t length = 0;
+
+    config_blob_changed();
 
     KeyStore store;
     res = store.openKeyStore("chargepoint", e_rw);
@@ -144,17 +263,38 @@ esp_err_t ChargePointConfig::save(void)
     ESP_LOGD(TAG, "led_1_port_number: %d", this->led_1_chargepoint_port_number);
     ESP_LOGD(TAG, "led_2_port_number: %d", this->led_2_chargepoint_port_number);
 
-    ESP_SET_VALUE("group_id", this->group_id, false);
-    if (nullptr != this->led_1_chargepoint_station_id)
-    {
-        ESP_SET_VALUE("l1_cp_sid", this->led_1_chargepoint_station_id, false);
-        ESP_SET_VALUE("l1_port_number", this->led_1_chargepoint_port_number, false);
+    size = ConfigBlobWriter::get_size(CHARGEPOINT_CONFIG_FIELDS,
+        LENGTH_OF(this->group_id) + LENGTH_OF(this->led_1_chargepoint_station_id) +
+        LENGTH_OF(this->led_2_chargepoint_station_id));
+    blob = (uint8_t*) malloc(size);
+    if (blob == nullptr) {
+        ESP_LOGE(TAG, "No memory for the chargepoint config blob");
+        res = ESP_ERR_NO_MEM;
+        goto err;
     }
 
-    if (nullptr != this->led_2_chargepoint_station_id)
     {
-        ESP_SET_VALUE("l2_cp_sid", this->led_2_chargepoint_station_id, false);
-        ESP_SET_VALUE("l2_port_number", this->led_2_chargepoint_port_number, false);
+        ConfigBlobWriter writer(blob, size, CHARGEPOINT_CONFIG_VERSION);
+        writer.begin(CHARGEPOINT_CONFIG_FIELDS);
+        writer.str("group_id", this->group_id);
+        writer.str("l1_cp_sid", this->led_1_chargepoint_station_id);
+        writer.str("l2_cp_sid", this->led_2_chargepoint_station_id);
+        writer.integer("l1_port_number", this->led_1_chargepoint_port_number);
+        writer.integer("l2_port_number", this->led_2_chargepoint_port_number);
+        res = writer.finish(length);
+    }
+    if (res == ESP_OK) {
+        res = store.setKeyBlob(CONFIG_BLOB_KEY, blob, length, false);
+    }
+    free(blob);
+    if (res != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to save chargepoint config blob");
+        goto err;
+    }
+
+    res = this->save_keys(store);
+    if (res != ESP_OK) {
+        goto err;
     }
 
     res = store.commit();
@@ -200,23 +340,11 @@ esp_err_t ChargePointConfig::reset(void)
     ESP_LOGD(TAG, "ChargePointConfig::Reset()");
     esp_err_t res = ESP_OK;
 
-    KeyStore store;
-    res = store.openKeyStore("chargepoint", e_rw);
-    if (res != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to open chargepoint config store");
-        goto err;
-    }
-
     ESP_LOGI(TAG, "Resetting chargepoint config");
 
-    ESP_SET_VALUE("group_id", "", false);
-    ESP_SET_VALUE("l1_cp_sid", "", false);
-    ESP_SET_VALUE("l2_cp_sid", "", false);
-    ESP_SET_VALUE("l1_port_number", (uint8_t)0, false);
-    ESP_SET_VALUE("l2_port_number", (uint8_t)0, false);
-
-    res =  store.commit();
+    // Saved empty, it still loads.
+    this->set_chargepoint_info("", "", 0, "", 0);
+    res = this->save();
     this->isConfigured = false;
-err:
     return res;
-}
+}
\ No newline at end of file
@@ -19,6 +19,8 @@
 
 #include "Utils/NoCopy.h"
 
+class KeyStore;
+
 //******************************************************************************
 /**
  * @brief Chargepoint Config class.
@@ -60,6 +62,12 @@ public:
 
     inline bool is_configured(void) { return this->isConfigured; }
 
+private:
+    esp_err_t unpack(const uint8_t* blob, size_t length);
+    esp_err_t load_keys(KeyStore& store);
+    esp_err_t save_keys(KeyStore& store);
+    bool keys_differ(KeyStore& store);
+
 private:
     char*   group_id = nullptr;
     char*   led_1_chargepoint_station_id = nullptr;
@@ -15,11 +15,16 @@
 #include "esp_log.h"
 
 #include "Utils/KeyStore.h"
+#include "Utils/ConfigBlob.h"
 
 #include <string.h>
 
 static const char* TAG = "SiteConfig";
 
+// Layout of the blob, bumped when a field changes meaning.
+#define SITE_CONFIG_VERSION (1)
+#define SITE_CONFIG_FIELDS  (2)
+
 #define ESP_SET_VALUE(key, value, commit) \
     res = store.setKeyValue(key, value, commit); \
     if (res != ESP_OK) { \
@@ -28,6 +33,7 @@ static const char* TAG = "SiteConfig";
     }
 
 #define ESP_GET_VALUE(key, value, length) \
+    FREE_MEMBER(value); \
     res = store.getKeyValueAlloc(key, value, length); \
     if (res != ESP_OK) { \
         ESP_LOGE(TAG, "Failed to get " key " value"); \
@@ -72,26 +78,131 @@ esp_err_t SiteConfig::load(void)
 
     KeyStore store;
     esp_err_t res = ESP_OK;
-    size_t valueLength = 0;
+    uint8_t* blob = nullptr;
+    size_t blobLength = 0;
 
     if (store.openKeyStore("site_config", e_ro) != ESP_OK) {
         ESP_LOGE(TAG, "Failed to open site config store");
         return false;
     }
 
-    ESP_GET_VALUE("site_name", this->site_name, valueLength);
-    ESP_GET_VALUE_INT_OR_DEFAULT("led_length", this->led_length, LED_FULL_SIZE);
+    res = store.getKeyBlobAlloc(CONFIG_BLOB_KEY, blob, blobLength);
+    if (res == ESP_OK) {
+        res = this->unpack(blob, blobLength);
+        free(blob);
+        if (res != ESP_OK) {
+            ESP_LOGW(TAG, "Site config blob rejected (%s), trying the keys", esp_err_to_name(res));
+        } else if (this->keys_differ(store)) {
+            ESP_LOGW(TAG, "Site config changed by older firmware, taking the keys");
+            res = ESP_ERR_INVALID_STATE;
+        }
+    }
+
+    // Saved by older firmware, one key per field, or changed by it since the
+    // blob was.  Copied to the blob, the keys stay for a downgrade.
+    if (res != ESP_OK) {
+        res = this->load_keys(store);
+        if (res != ESP_OK) {
+            return res;
+        }
+        ESP_LOGI(TAG, "Copying site config to one blob");
+        if (this->save() != ESP_OK) {
+            ESP_LOGW(TAG, "Failed to copy site config, will try again next boot");
+        }
+    }
 
     this->isConfigured = true;
     return res;
 }
 
+//******************************************************************************
+/**
+ * @brief Read the fields from the blob, the ones not known are skipped.
+ */
+esp_err_t SiteConfig::unpack(const uint8_t* blob, size_t length)
+{
+    ConfigBlobReader reader;
+    char field[CONFIG_BLOB_FIELD_MAX_LENGTH + 1];
+
+    esp_err_t res = reader.open(blob, length, SITE_CONFIG_VERSION);
+    if (res != ESP_OK) {
+        return res;
+    }
+
+    this->led_length = LED_FULL_SIZE;
+    while (reader.next_field(field, sizeof(field))) {
+        if (strcmp(field, "site_name") == 0) { reader.read_str(this->site_name); }
+        else if (strcmp(field, "led_length") == 0) { reader.read_u8(this->led_length); }
+        else { reader.skip(); }
+    }
+
+    return reader.finish();
+}
+
+//******************************************************************************
+/**
+ * @brief Read the per key layout of older firmware.
+ */
+esp_err_t SiteConfig::load_keys(KeyStore& store)
+{
+    esp_err_t res = ESP_OK;
+    size_t valueLength = 0;
+
+    ESP_GET_VALUE("site_name", this->site_name, valueLength);
+    ESP_GET_VALUE_INT_OR_DEFAULT("led_length", this->led_length, LED_FULL_SIZE);
+
+    return ESP_OK;
+}
+
+//******************************************************************************
+/**
+ * @brief True if the keys hold another site than the one loaded.
+ *
+ * Missing keys don't count, they were never written or are gone.
+ */
+bool SiteConfig::keys_differ(KeyStore& store)
+{
+    SiteConfig keys;
+    if (keys.load_keys(store) != ESP_OK) {
+        return false;
+    }
+
+    return !config_blob_same_str(this->site_name, keys.site_name) || this->led_length != keys.led_length;
+}
+
+//******************************************************************************
+/**
+ * @brief Write the per key layout of older firmware next to the blob.
+ *
+ * Kept up to date so going back to older firmware keeps the site.  To be
+ * dropped once no release before the blob is in the field.
+ */
+esp_err_t SiteConfig::save_keys(KeyStore& store)
+{
+    esp_err_t res = ESP_OK;
+
+    ESP_SET_VALUE("site_name", this->site_name ? this->site_name : "", false);
+    ESP_SET_VALUE("led_length", this->led_length, false);
+
+    return ESP_OK;
+}
+
+//******************************************************************************
+void SiteConfig::erase_keys(KeyStore& store)
+{
+    store.eraseKey("site_name", false);
+    store.eraseKey("led_length", false);
+}
+
 esp_err_t SiteConfig::save(void)
 {
     ESP_LOGI(TAG, "SiteConfig::save()");
 
     KeyStore store;
     esp_err_t res = ESP_OK;
+    size_t length = 0;
+
+    config_blob_changed();
 
     ESP_LOGI(TAG, "Saving site config");
     if (store.openKeyStore("site_config", e_rw) != ESP_OK) {
@@ -99,8 +210,33 @@ esp_err_t SiteConfig::save(void)
         return false;
     }
 
-    ESP_SET_VALUE("site_name", this->site_name ? this->site_name : "", false);
-    ESP_SET_VALUE("led_length", this->led_length, false);
+    size_t size = ConfigBlobWriter::get_size(SITE_CONFIG_FIELDS, this->site_name ? strlen(this->site_name) : 0);
+    uint8_t* blob = (uint8_t*) malloc(size);
+    if (blob == nullptr) {
+        ESP_LOGE(TAG, "No memory for the site config blob");
+        return ESP_ERR_NO_MEM;
+    }
+
+    ConfigBlobWriter writer(blob, size, SITE_CONFIG_VERSION);
+    writer.begin(SITE_CONFIG_FIELDS);
+    writer.str("site_name", this->site_name ? this->site_name : "");
+    writer.integer("led_length", this->led_length);
+
+    res = writer.finish(length);
+    if (res == ESP_OK) {
+        res = store.setKeyBlob(CONFIG_BLOB_KEY, blob, length, false);
+    }
+    free(blob);
+    if (res != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to save site config blob");
+        return res;
+    }
+
+    res = this->save_keys(store);
+    if (res != ESP_OK) {
+        return res;
+    }
+
     return store.commit();
 }
 
@@ -126,14 +262,16 @@ esp_err_t SiteConfig::reset(void)
 {
     ESP_LOGD(TAG, "SiteConfig::reset()");
 
+    config_blob_changed();
+
     KeyStore store;
     if (store.openKeyStore("site_config", e_rw) != ESP_OK) {
         ESP_LOGE(TAG, "Failed to open site config store");
         return false;
     }
 
-    store.eraseKey("site_name");
-    store.eraseKey("led_length");
+    store.eraseKey(CONFIG_BLOB_KEY, false);
+    this->erase_keys(store);
 
     FREE_MEMBER(this->site_name);
     this->led_length = LED_STRIP_PIXEL_COUNT;
@@ -18,6 +18,8 @@
 
 #include "esp_err.h"
 
+class KeyStore;
+
 //******************************************************************************
 /**
  * @brief Site configuration
@@ -47,6 +49,13 @@ public:
     void set_site_name(const char* name);
     inline void set_led_length(uint8_t count) { led_length = count; }
 
+private:
+    esp_err_t unpack(const uint8_t* blob, size_t length);
+    esp_err_t load_keys(KeyStore& store);
+    esp_err_t save_keys(KeyStore& store);
+    bool keys_differ(KeyStore& store);
+    void erase_keys(KeyStore& store);
+
 private:
     char *site_name = nullptr;
     uint8_t led_length = LED_FULL_SIZE;
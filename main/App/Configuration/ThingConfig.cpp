@@ -3,9 +3,15 @@
 #include "esp_log.h"
 
 #include "Utils/KeyStore.h"
+#include "Utils/ConfigBlob.h"
+#include "Utils/CertStore.h"
 
 static const char* TAG = "ThingConfig";
 
+// Layout of the blob, bumped when a field changes meaning.
+#define THING_CONFIG_VERSION (1)
+#define THING_CONFIG_FIELDS  (4)
+
 static const char root_ca[] = 
 "-----BEGIN CERTIFICATE-----\n"
 "MIIDQTCCAimgAwIBAgITBmyfz5m/jAo54vB4ikPmljZbyjANBgkqhkiG9w0BAQsF\n"
@@ -29,13 +35,14 @@ static const char root_ca[] =
 "-----END CERTIFICATE-----\n";
 
 #define ESP_SET_VALUE(key, value, commit) \
-    res = store.setKeyValue(key, value, commit); \
+    res = value == nullptr ? ESP_OK : store.setKeyValue(key, value, commit); \
     if (res != ESP_OK) { \
         ESP_LOGE(TAG, "Failed to set " key " value"); \
         return res; \
     }
 
 #define ESP_GET_VALUE(key, value, length) \
+    FREE_MEMBER(value); \
     res = store.getKeyValueAlloc(key, value, length); \
     if (res != ESP_OK) { \
         ESP_LOGE(TAG, "Failed to get " key " value"); \
@@ -48,6 +55,8 @@ static const char root_ca[] =
         m = nullptr; \
     }
 
+#define LENGTH_OF(m) ((m) != nullptr ? strlen(m) : 0)
+
 ThingConfig::~ThingConfig()
 {
     ESP_LOGD(TAG, "ThingConfig::~ThingConfig()");
@@ -163,7 +172,9 @@ void ThingConfig::set_endpoint_address(const char* endpointAddress)
 // Load/Save from NVS
 esp_err_t ThingConfig::load(void) {
     ESP_LOGD(TAG, "ThingConfig::Load()");
-    size_t valueLength = 0;
+    uint8_t* blob = nullptr;
+    size_t blobLength = 0;
+    bool pemsInBlob = false;
     esp_err_t res = ESP_OK;
 
     KeyStore store;
@@ -174,13 +185,52 @@ esp_err_t ThingConfig::load(void) {
     
     ESP_LOGI(TAG, "Loading thing config");
 
-    ESP_GET_VALUE("thingName", this->thingName, valueLength);
-    ESP_GET_VALUE("certificateArn", this->certificateArn, valueLength);
-    ESP_GET_VALUE("certificateId", this->certificateId, valueLength);
-    ESP_GET_VALUE("certificatePem", this->certificatePem, valueLength);
-    ESP_GET_VALUE("privateKey", this->privateKey, valueLength);
-    ESP_GET_VALUE("publicKey", this->publicKey, valueLength);
-    ESP_GET_VALUE("endpointAddress", this->endpointAddress, valueLength);
+    res = store.getKeyBlobAlloc(CONFIG_BLOB_KEY, blob, blobLength);
+    if (res == ESP_OK) {
+        res = this->unpack(blob, blobLength);
+        free(blob);
+        pemsInBlob = res == ESP_OK &&
+            (this->certificatePem != nullptr || this->privateKey != nullptr || this->publicKey != nullptr);
+        if (res != ESP_OK) {
+            ESP_LOGW(TAG, "Thing config blob rejected (%s), trying the keys", esp_err_to_name(res));
+        } else if (this->keys_differ(store)) {
+            ESP_LOGW(TAG, "Thing config changed by older firmware, taking the keys");
+            res = ESP_ERR_INVALID_STATE;
+        }
+    }
+
+    // Saved by older firmware, one key per field, or changed by it since the
+    // blob was.  Copied to the blob, the keys stay for a downgrade.
+    if (res != ESP_OK) {
+        res = this->load_keys(store);
+        if (res == ESP_OK) {
+            res = this->load_certificate_keys(store);
+        }
+        if (res != ESP_OK) {
+            return res;
+        }
+        ESP_LOGI(TAG, "Copying thing config to one blob");
+        if (this->save() != ESP_OK) {
+            ESP_LOGW(TAG, "Failed to copy thing config, will try again next boot");
+        }
+    }
+
+    // Not in the blob, they are in their partition or still in the keys.
+    CertStore& certs = CertStore::instance();
+    bool hasPartition = certs.setup() == ESP_OK;
+    bool inHeap = this->certificatePem != nullptr || this->privateKey != nullptr || this->publicKey != nullptr;
+    if (!inHeap && !certs.has_certificates()) {
+        inHeap = this->load_certificate_keys(store) == ESP_OK;
+    }
+
+    // Saving moves them to the certificate partition, and drops them from a
+    // blob saved with them.
+    if (inHeap && (hasPartition || pemsInBlob) && this->save() != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to move certificates, will try again next boot");
+    }
+    if (certs.has_certificates()) {
+        ESP_LOGI(TAG, "Certificates mapped from flash, %d bytes of heap saved", certs.get_heap_saved());
+    }
 
     ESP_LOGD(TAG, "thingName: %s", this->thingName);
     ESP_LOGD(TAG, "certificateArn: %s", this->certificateArn);
@@ -194,9 +244,128 @@ esp_err_t ThingConfig::load(void) {
     return ESP_OK;
 }
 
+//******************************************************************************
+/**
+ * @brief Read the fields from the blob, the ones not known are skipped.
+ *
+ * The certificate and keys are only in blobs saved before they were left
+ * to the keys.
+ */
+esp_err_t ThingConfig::unpack(const uint8_t* blob, size_t length) {
+    ConfigBlobReader reader;
+    char field[CONFIG_BLOB_FIELD_MAX_LENGTH + 1];
+
+    esp_err_t res = reader.open(blob, length, THING_CONFIG_VERSION);
+    if (res != ESP_OK) {
+        return res;
+    }
+
+    while (reader.next_field(field, sizeof(field))) {
+        if (strcmp(field, "thingName") == 0) { reader.read_str(this->thingName); }
+        else if (strcmp(field, "certificateArn") == 0) { reader.read_str(this->certificateArn); }
+        else if (strcmp(field, "certificateId") == 0) { reader.read_str(this->certificateId); }
+        else if (strcmp(field, "certificatePem") == 0) { reader.read_str(this->certificatePem); }
+        else if (strcmp(field, "privateKey") == 0) { reader.read_str(this->privateKey); }
+        else if (strcmp(field, "publicKey") == 0) { reader.read_str(this->publicKey); }
+        else if (strcmp(field, "endpointAddress") == 0) { reader.read_str(this->endpointAddress); }
+        else { reader.skip(); }
+    }
+
+    return reader.finish();
+}
+
+//******************************************************************************
+/**
+ * @brief Read the per key layout of older firmware, the certificates aside.
+ */
+esp_err_t ThingConfig::load_keys(KeyStore& store) {
+    size_t valueLength = 0;
+    esp_err_t res = ESP_OK;
+
+    ESP_GET_VALUE("thingName", this->thingName, valueLength);
+    ESP_GET_VALUE("certificateArn", this->certificateArn, valueLength);
+    ESP_GET_VALUE("certificateId", this->certificateId, valueLength);
+    ESP_GET_VALUE("endpointAddress", this->endpointAddress, valueLength);
+
+    return ESP_OK;
+}
+
+//******************************************************************************
+/**
+ * @brief Read the certificate and keys from the keys of older firmware.
+ */
+esp_err_t ThingConfig::load_certificate_keys(KeyStore& store) {
+    size_t valueLength = 0;
+    esp_err_t res = ESP_OK;
+
+    ESP_GET_VALUE("certificatePem", this->certificatePem, valueLength);
+    ESP_GET_VALUE("privateKey", this->privateKey, valueLength);
+    ESP_GET_VALUE("publicKey", this->publicKey, valueLength);
+
+    return ESP_OK;
+}
+
+//******************************************************************************
+/**
+ * @brief True if the keys hold another thing than the one loaded.
+ *
+ * A new certificate comes with a new id, the PEMs are not compared.  Missing
+ * keys don't count, they were never written or are gone.
+ */
+bool ThingConfig::keys_differ(KeyStore& store) {
+    ThingConfig keys;
+    if (keys.load_keys(store) != ESP_OK) {
+        return false;
+    }
+
+    return !config_blob_same_str(this->thingName, keys.thingName) ||
+        !config_blob_same_str(this->certificateArn, keys.certificateArn) ||
+        !config_blob_same_str(this->certificateId, keys.certificateId) ||
+        !config_blob_same_str(this->endpointAddress, keys.endpointAddress);
+}
+
+//******************************************************************************
+/**
+ * @brief Write the per key layout of older firmware next to the blob.
+ *
+ * Older firmware only reads these.  They are kept up to date, certificates
+ * included, so going back to it keeps the device reachable.  A field not in
+ * heap, a certificate already in flash, keeps the key written with it.  The
+ * certificates are only here, not in the blob.  To be dropped, the
+ * certificates moved to the blob, once no release before the blob is in the
+ * field.
+ */
+esp_err_t ThingConfig::save_keys(KeyStore& store) {
+    esp_err_t res = ESP_OK;
+
+    ESP_SET_VALUE("thingName", this->thingName, false);
+    ESP_SET_VALUE("certificateArn", this->certificateArn, false);
+    ESP_SET_VALUE("certificateId", this->certificateId, false);
+    ESP_SET_VALUE("certificatePem", this->certificatePem, false);
+    ESP_SET_VALUE("privateKey", this->privateKey, false);
+    ESP_SET_VALUE("publicKey", this->publicKey, false);
+    ESP_SET_VALUE("endpointAddress", this->endpointAddress, false);
+
+    return ESP_OK;
+}
+
+//******************************************************************************
+void ThingConfig::erase_keys(KeyStore& store) {
+    store.eraseKey("thingName", false);
+    store.eraseKey("certificateArn", false);
+    store.eraseKey("certificateId", false);
+    store.eraseKey("certificatePem", false);
+    store.eraseKey("privateKey", false);
+    store.eraseKey("publicKey", false);
+    store.eraseKey("endpointAddress", false);
+}
+
 esp_err_t ThingConfig::save(void) {
     ESP_LOGD(TAG, "ThingConfig::Save()");
     esp_err_t res = ESP_OK;
+    size_t length = 0;
+
+    config_blob_changed();
 
     KeyStore store;
     if (store.openKeyStore("iot", e_rw) != ESP_OK) {
@@ -213,17 +382,109 @@ esp_err_t ThingConfig::save(void) {
     ESP_LOGD(TAG, "publicKey: %s", this->publicKey);
     ESP_LOGD(TAG, "endpointAddress: %s", this->endpointAddress);
 
-    ESP_SET_VALUE("thingName", this->thingName, false);
-    ESP_SET_VALUE("certificateArn", this->certificateArn, false);
-    ESP_SET_VALUE("certificateId", this->certificateId, false);
-    ESP_SET_VALUE("certificatePem", this->certificatePem, false);
-    ESP_SET_VALUE("privateKey", this->privateKey, false);
-    ESP_SET_VALUE("publicKey", this->publicKey, false);
-    ESP_SET_VALUE("endpointAddress", this->endpointAddress, false);
+    // Before the certificates leave the heap, older firmware reads them
+    // from the keys.
+    res = this->save_keys(store);
+    if (res != ESP_OK) {
+        return res;
+    }
+
+    // Without a certificate partition they stay in heap and in the keys.
+    res = this->move_certificates();
+    if (res != ESP_OK && res != ESP_ERR_NOT_FOUND) {
+        ESP_LOGW(TAG, "Certificates kept in nvs (%s)", esp_err_to_name(res));
+    }
+
+    // The certificates are already in the keys, a copy in the same nvs
+    // partition would take a second 4 KB or so of it.
+    size_t size = ConfigBlobWriter::get_size(THING_CONFIG_FIELDS,
+        LENGTH_OF(this->thingName) + LENGTH_OF(this->certificateArn) + LENGTH_OF(this->certificateId) +
+        LENGTH_OF(this->endpointAddress));
+    uint8_t* blob = (uint8_t*) malloc(size);
+    if (blob == nullptr) {
+        ESP_LOGE(TAG, "No memory for the thing config blob");
+        return ESP_ERR_NO_MEM;
+    }
+
+    ConfigBlobWriter writer(blob, size, THING_CONFIG_VERSION);
+    writer.begin(THING_CONFIG_FIELDS);
+    writer.str("thingName", this->thingName);
+    writer.str("certificateArn", this->certificateArn);
+    writer.str("certificateId", this->certificateId);
+    writer.str("endpointAddress", this->endpointAddress);
+
+    res = writer.finish(length);
+    if (res == ESP_OK) {
+        res = store.setKeyBlob(CONFIG_BLOB_KEY, blob, length, false);
+    }
+    free(blob);
+    if (res != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to save thing config blob");
+        return res;
+    }
 
     return store.commit();
 }
 
+//******************************************************************************
+/**
+ * @brief Write the certificate and keys to their partition, free the PEM.
+ *
+ * Nothing to do when they are not in heap.
+ *
+ * @return esp_err_t    ESP_ERR_NOT_FOUND without a certificate partition.
+ */
+esp_err_t ThingConfig::move_certificates(void) {
+    if (this->certificatePem == nullptr && this->privateKey == nullptr && this->publicKey == nullptr) {
+        return ESP_OK;
+    }
+
+    CertStore& certs = CertStore::instance();
+    esp_err_t res = certs.setup();
+    if (res != ESP_OK) {
+        return res;
+    }
+
+    const char* pem[e_cert_slot_count] = { this->certificatePem, this->privateKey, this->publicKey };
+    res = certs.store(pem);
+    if (res != ESP_OK) {
+        return res;
+    }
+
+    ESP_LOGI(TAG, "Certificates moved to flash, %d bytes of heap saved", certs.get_heap_saved());
+    FREE_MEMBER(this->certificatePem);
+    FREE_MEMBER(this->privateKey);
+    FREE_MEMBER(this->publicKey);
+    return ESP_OK;
+}
+
+//******************************************************************************
+static esp_err_t get_credential(const char* pem, cert_slot_t slot, const char*& data, size_t& length) {
+    const uint8_t* der = nullptr;
+
+    if (pem != nullptr) {
+        data = pem;
+        length = strlen(pem) + 1;
+        return ESP_OK;
+    }
+
+    esp_err_t res = CertStore::instance().get(slot, der, length);
+    if (res == ESP_OK) {
+        data = (const char*) der;
+    }
+    return res;
+}
+
+//******************************************************************************
+esp_err_t ThingConfig::get_client_certificate(const char*& data, size_t& length) {
+    return get_credential(this->certificatePem, e_cert_client_certificate, data, length);
+}
+
+//******************************************************************************
+esp_err_t ThingConfig::get_client_key(const char*& data, size_t& length) {
+    return get_credential(this->privateKey, e_cert_private_key, data, length);
+}
+
 const char* ThingConfig::get_root_ca(void) {
     return root_ca;
 }
@@ -236,24 +497,33 @@ esp_err_t ThingConfig::dump(void) {
     if (nullptr != privateKey) { printf("privateKey: %s\n", privateKey); }
     if (nullptr != publicKey) { printf("publicKey: %s\n", publicKey); }
     if (nullptr != endpointAddress) { printf("endpointAddress: %s\n", endpointAddress); }
+
+    CertStore& certs = CertStore::instance();
+    const uint8_t* der;
+    size_t length;
+    if (nullptr == certificatePem && certs.get(e_cert_client_certificate, der, length) == ESP_OK) { printf("certificate: %d bytes DER in flash\n", length); }
+    if (nullptr == privateKey && certs.get(e_cert_private_key, der, length) == ESP_OK) { printf("privateKey: %d bytes DER in flash\n", length); }
+    if (nullptr == publicKey && certs.get(e_cert_public_key, der, length) == ESP_OK) { printf("publicKey: %d bytes DER in flash\n", length); }
     
     return ESP_OK;
 }
 
 esp_err_t ThingConfig::reset(void) {
+    config_blob_changed();
+
     KeyStore store;
     if (store.openKeyStore("iot", e_rw) != ESP_OK) {
         ESP_LOGE(TAG, "Failed to open iot config store");
         return false;
     }
 
-    store.eraseKey("thingName", false);
-    store.eraseKey("certificateArn", false);
-    store.eraseKey("certificateId", false);
-    store.eraseKey("certificatePem", false);
-    store.eraseKey("privateKey", false);
-    store.eraseKey("publicKey", false);
-    store.eraseKey("endpointAddress", false);
+    store.eraseKey(CONFIG_BLOB_KEY, false);
+    this->erase_keys(store);
+
+    CertStore& certs = CertStore::instance();
+    if (certs.setup() == ESP_OK) {
+        certs.erase();
+    }
 
     // Don't care if this fails.
     store.commit();
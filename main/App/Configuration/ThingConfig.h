@@ -7,6 +7,8 @@
 
 #include "Utils/NoCopy.h"
 
+class KeyStore;
+
 class ThingConfig : public NoCopy {
 public:
     ThingConfig() = default;
@@ -37,9 +39,23 @@ public:
     inline const char* get_public_key(void) { return this->publicKey; }
     inline const char* get_endpoint_address(void) { return this->endpointAddress; }
 
+    // For TLS: DER mapped from the certificate partition, or the PEM kept
+    // in heap on a device without one.
+    esp_err_t get_client_certificate(const char*& data, size_t& length);
+    esp_err_t get_client_key(const char*& data, size_t& length);
+
     inline bool is_configured(void) { return this->isConfigured; }
 
 
+private:
+    esp_err_t unpack(const uint8_t* blob, size_t length);
+    esp_err_t load_keys(KeyStore& store);
+    esp_err_t load_certificate_keys(KeyStore& store);
+    esp_err_t save_keys(KeyStore& store);
+    bool keys_differ(KeyStore& store);
+    void erase_keys(KeyStore& store);
+    esp_err_t move_certificates(void);
+
 private:
     char *thingName = nullptr;
     char *certificateArn = nullptr;
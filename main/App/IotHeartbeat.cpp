@@ -1,8 +1,11 @@
 #include "IotHeartbeat.h"
-#include "MN8StateMachine.h"
+#include "App/MqttAgent/MqttAgent.h"
+#include "App/MqttAgent/IotThing.h"
+#include "App/LedStateSequencer.h"
 
 #include "Utils/FuseMacAddress.h"
 #include "Utils/KeyStore.h"
+#include "Utils/Time.h"
 
 #include "esp_log.h"
 #include "esp_err.h"
@@ -20,60 +23,122 @@ static const char* TAG = "iot_heartbeat";
 
 //******************************************************************************
 esp_err_t IotHeartbeat::setup(
-    MN8Context* mn8_context, 
-    ThingConfig* thing_config,
-    MN8StateMachine *state_machine
+    MqttAgent* mqtt_agent,
+    IotThing* iot_thing,
+    LedStateSequencer* ledstate_sequencer,
+    heartbeat_status_fn_t status_fn,
+    void* status_context
 ) {
-    this->mn8_context = mn8_context;
-    this->thing_config = thing_config;
-    this->state_machine = state_machine;
+    this->mqtt_agent = mqtt_agent;
+    this->iot_thing = iot_thing;
+    this->ledstate_sequencer = ledstate_sequencer;
+    this->status_fn = status_fn;
+    this->status_context = status_context;
 
     KeyStore key_store;
     key_store.openKeyStore("config", e_ro);
     key_store.getKeyValue("heartbeat_frequency", this->heartbeat_frequency);
 
-    this->message_queue = xQueueCreate(10, sizeof(iot_heartbeat_command_t));
+    this->message_queue = xQueueCreate(16, sizeof(iot_heartbeat_message_t));
 
     return ESP_OK;
 }
 
 //******************************************************************************
+/**
+ * @brief Publish the heartbeat along with the events collected since the
+ *        last one.
+ *
+ * Events are kept if we can't publish, they go out with the next heartbeat.
+ */
 void IotHeartbeat::send_heartbeat(void) {
     ESP_LOGI(TAG, "Sending heartbeat");
-    if (this->mn8_context->get_mqtt_agent().is_connected()) {
-        this->mn8_context->get_iot_thing().send_heartbeat(
-            this->state_machine->get_current_state_name(),
-            this->mn8_context->get_led_task_0().get_state_as_string(),
-            this->mn8_context->get_led_task_1().get_state_as_string(),
-            this->mn8_context->is_night_mode(),
-            this->mn8_context->has_night_sensor()
+    if (this->mqtt_agent->is_connected()) {
+        heartbeat_status_t status = {};
+        this->status_fn(&status, this->status_context);
+
+        esp_err_t ret = this->iot_thing->send_heartbeat(
+            status.current_state,
+            status.led1_state,
+            status.led2_state,
+            status.night_mode,
+            status.has_night_sensor,
+            this->ledstate_sequencer->get_counters(),
+            this->mqtt_agent->get_ingress_limiter().get_counters(),
+            this->telemetry,
+            this->mqtt_agent->get_connection_stats()
         );
-        
-        if (this->mn8_context->has_night_sensor()) {
-            this->mn8_context->get_iot_thing().send_night_mode(this->mn8_context->is_night_mode());
+
+        if (ret == ESP_OK) {
+            this->telemetry.clear();
         }
     }
 }
 
-void IotHeartbeat::set_night_mode(bool night_mode) {
-    this->mn8_context->set_night_mode(night_mode);
-    iot_heartbeat_command_t command = e_iot_night_mode_changed;
-    xQueueSend(this->message_queue, &command, 0);
+//******************************************************************************
+/**
+ * @brief Ask the heartbeat task to send a heartbeat now.
+ */
+void IotHeartbeat::request_heartbeat(void) {
+    iot_heartbeat_message_t message = {};
+    message.command = e_iot_heartbeat_send;
+    xQueueSend(this->message_queue, &message, 0);
+}
+
+//******************************************************************************
+void IotHeartbeat::record_night_mode(bool night_mode) {
+    this->record_event(e_telemetry_night_mode, night_mode ? 1 : 0, "night_mode");
+}
+
+//******************************************************************************
+/**
+ * @brief Record a state machine transition.
+ *
+ * @param state_name    Static string, it is published later.
+ */
+void IotHeartbeat::record_state(const char* state_name) {
+    this->record_event(e_telemetry_state, 0, state_name);
+}
+
+//******************************************************************************
+void IotHeartbeat::record_event(telemetry_event_type_t type, int32_t value, const char* name) {
+    if (this->message_queue == nullptr) {
+        return;
+    }
+
+    iot_heartbeat_message_t message = {};
+    message.command = e_iot_telemetry_event;
+    message.event.time_s = (uint32_t) Time::instance().upTimeS();
+    message.event.type = type;
+    message.event.value = value;
+    message.event.name = name;
+    xQueueSend(this->message_queue, &message, 0);
 }
 
 //******************************************************************************
 void IotHeartbeat::taskFunction(void) {
     ESP_LOGI(TAG, "Starting IotHeartbeat task");
-    iot_heartbeat_command_t command;
+    iot_heartbeat_message_t message;
     TickType_t wait_time = this->heartbeat_frequency * 60 * 1000 / portTICK_PERIOD_MS;
+    TickType_t last_heartbeat = xTaskGetTickCount();
 
     while (1) {
         ESP_LOGI(TAG, "Waiting for command or timeout");
-        if (xQueueReceive(this->message_queue, &command, wait_time) == pdTRUE) {
-            switch (command) {
-                case e_iot_night_mode_changed:
+        TickType_t elapsed = xTaskGetTickCount() - last_heartbeat;
+        TickType_t timeout = elapsed < wait_time ? wait_time - elapsed : 0;
+
+        if (xQueueReceive(this->message_queue, &message, timeout) == pdTRUE) {
+            switch (message.command) {
+                case e_iot_telemetry_event:
+                    // Sent with the next heartbeat, or now if the ring is
+                    // filling up.
+                    if (!this->telemetry.push(message.event)) {
+                        break;
+                    }
+                    // fall through
                 case e_iot_heartbeat_send:
                     this->send_heartbeat();
+                    last_heartbeat = xTaskGetTickCount();
                     break;
                 default:
                     ESP_LOGE(TAG, "Unknown command received");
@@ -81,6 +146,7 @@ void IotHeartbeat::taskFunction(void) {
             }
         } else {
             this->send_heartbeat();
+            last_heartbeat = xTaskGetTickCount();
         }
     }
-}
\ No newline at end of file
+}
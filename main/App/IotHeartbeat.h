@@ -1,12 +1,13 @@
 #pragma once
 
 #include "Utils/FreeRTOSTask.h"
-#include "App/Configuration/ThingConfig.h"
+#include "App/TelemetryRing.h"
 
 #include "freertos/queue.h"
 
-class MN8StateMachine;
-class MN8Context;
+class MqttAgent;
+class IotThing;
+class LedStateSequencer;
 
 #define IOT_HEARTBEAT_TASK_STACK_SIZE 4096
 #define IOT_HEARTBEAT_TASK_PRIORITY 7
@@ -16,9 +17,25 @@ class MN8Context;
 
 typedef enum {
     e_iot_heartbeat_send,
-    e_iot_night_mode_changed
+    e_iot_telemetry_event
 } iot_heartbeat_command_t;
 
+typedef struct {
+    iot_heartbeat_command_t command;
+    telemetry_event_t event;        // e_iot_telemetry_event only
+} iot_heartbeat_message_t;
+
+// What the heartbeat reports about the station, filled in by MN8App.
+typedef struct {
+    const char* current_state;
+    const char* led1_state;
+    const char* led2_state;
+    bool night_mode;
+    bool has_night_sensor;
+} heartbeat_status_t;
+
+typedef void (*heartbeat_status_fn_t)(heartbeat_status_t* status, void* context);
+
 class IotHeartbeat : public FreeRTOSTask {
 public:
     IotHeartbeat(void) : FreeRTOSTask(
@@ -29,20 +46,32 @@ public:
     ~IotHeartbeat(void) = default;
 
 public:
-    esp_err_t setup(MN8Context* mn8_context, ThingConfig* thing_config, MN8StateMachine *state_machine);
+    esp_err_t setup(
+        MqttAgent* mqtt_agent,
+        IotThing* iot_thing,
+        LedStateSequencer* ledstate_sequencer,
+        heartbeat_status_fn_t status_fn,
+        void* status_context
+    );
     uint16_t get_heartbeat_frequency(void) { return this->heartbeat_frequency; }
     void set_heartbeat_frequency(uint16_t heartbeat_frequency) { this->heartbeat_frequency = heartbeat_frequency; }
-    void send_heartbeat(void);
+    void request_heartbeat(void);
     virtual const char* task_name(void) override { return IOT_HEARTBEAT_TASK_NAME; }
-    void set_night_mode(bool night_mode);
+    void record_night_mode(bool night_mode);
+    void record_state(const char* state_name);
 
 protected:
     virtual void taskFunction(void) override;
-    
+    void send_heartbeat(void);
+    void record_event(telemetry_event_type_t type, int32_t value, const char* name);
+
 private:
-    MN8Context* mn8_context = nullptr;
-    ThingConfig* thing_config = nullptr;
+    MqttAgent* mqtt_agent = nullptr;
+    IotThing* iot_thing = nullptr;
+    LedStateSequencer* ledstate_sequencer = nullptr;
+    heartbeat_status_fn_t status_fn = nullptr;
+    void* status_context = nullptr;
     uint16_t heartbeat_frequency = HEARTBEAT_FREQUENCY_MINUTES;
-    MN8StateMachine *state_machine = nullptr;
     QueueHandle_t message_queue = nullptr;
+    TelemetryRing telemetry;
 };
\ No newline at end of file
@@ -0,0 +1,144 @@
+//******************************************************************************
+/**
+ * @file LanAuth.cpp
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief LanAuth class implementation
+ * @version 0.1
+ * @date 2024-02-23
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#include "LanAuth.h"
+
+#include "Utils/KeyStore.h"
+
+#include "esp_log.h"
+
+#include "mbedtls/md.h"
+
+#include <string.h>
+
+static const char* TAG = "lan_auth";
+
+//******************************************************************************
+static int hex_digit(char ch) {
+    if (ch >= '0' && ch <= '9') return ch - '0';
+    if (ch >= 'a' && ch <= 'f') return ch - 'a' + 10;
+    if (ch >= 'A' && ch <= 'F') return ch - 'A' + 10;
+    return -1;
+}
+
+//******************************************************************************
+static bool hex_to_bytes(const char* hex, size_t hex_length, uint8_t* bytes, size_t length) {
+    if (hex == nullptr || hex_length != length * 2) {
+        return false;
+    }
+
+    for (size_t i = 0; i < length; i++) {
+        int high = hex_digit(hex[2 * i]);
+        int low = hex_digit(hex[2 * i + 1]);
+        if (high < 0 || low < 0) {
+            return false;
+        }
+        bytes[i] = (uint8_t)((high << 4) | low);
+    }
+    return true;
+}
+
+//******************************************************************************
+LanAuth::~LanAuth(void) {
+    memset(this->key, 0, sizeof(this->key));
+}
+
+//******************************************************************************
+/**
+ * @brief Load the key from the key store, no key if there is none.
+ */
+esp_err_t LanAuth::load(void) {
+    KeyStore key_store;
+    char hex[LAN_KEY_LENGTH * 2 + 1] = {0};
+
+    this->key_set = false;
+    if (key_store.openKeyStore("config", e_ro) != ESP_OK ||
+        key_store.getKeyValue("lan_key", hex, sizeof(hex)) != ESP_OK
+    ) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    this->key_set = hex_to_bytes(hex, strlen(hex), this->key, sizeof(this->key));
+    memset(hex, 0, sizeof(hex));
+    return this->key_set ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+//******************************************************************************
+/**
+ * @brief Set and save the key.
+ *
+ * @param hex           64 hex digits, empty to remove the key and close the
+ *                      lan path.
+ * @return esp_err_t    ESP_ERR_INVALID_ARG if not a key, the old one is kept.
+ */
+esp_err_t LanAuth::set_key(const char* hex) {
+    KeyStore key_store;
+    esp_err_t ret = key_store.openKeyStore("config", e_rw);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    if (hex == nullptr || hex[0] == '\0') {
+        memset(this->key, 0, sizeof(this->key));
+        this->key_set = false;
+        key_store.eraseKey("lan_key");
+        return ESP_OK;
+    }
+
+    uint8_t key[LAN_KEY_LENGTH];
+    if (!hex_to_bytes(hex, strlen(hex), key, sizeof(key))) {
+        ESP_LOGE(TAG, "lan key must be %d hex digits", LAN_KEY_LENGTH * 2);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    memcpy(this->key, key, sizeof(this->key));
+    memset(key, 0, sizeof(key));
+    this->key_set = true;
+    return key_store.setKeyValue("lan_key", hex);
+}
+
+//******************************************************************************
+/**
+ * @brief Check the hmac of a lan ledstate.
+ */
+bool LanAuth::verify(const char* thing_name, const ledstate_lan_envelope_t& envelope) const {
+    uint8_t expected[LAN_KEY_LENGTH];
+    uint8_t received[LAN_KEY_LENGTH];
+
+    if (!this->key_set || thing_name == nullptr) {
+        return false;
+    }
+
+    if (!hex_to_bytes(envelope.hmac, envelope.hmac_length, received, sizeof(received))) {
+        return false;
+    }
+
+    mbedtls_md_context_t md;
+    mbedtls_md_init(&md);
+    int err = mbedtls_md_setup(&md, mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), 1);
+    if (err == 0) err = mbedtls_md_hmac_starts(&md, this->key, sizeof(this->key));
+    if (err == 0) err = mbedtls_md_hmac_update(&md, (const uint8_t*) thing_name, strlen(thing_name));
+    if (err == 0) err = mbedtls_md_hmac_update(&md, (const uint8_t*) envelope.ledstate, envelope.ledstate_length);
+    if (err == 0) err = mbedtls_md_hmac_finish(&md, expected);
+    mbedtls_md_free(&md);
+
+    if (err != 0) {
+        ESP_LOGE(TAG, "hmac failed: -0x%04x", -err);
+        return false;
+    }
+
+    // Constant time, don't tell how many bytes were right.
+    uint8_t diff = 0;
+    for (size_t i = 0; i < sizeof(expected); i++) {
+        diff |= expected[i] ^ received[i];
+    }
+    return diff == 0;
+}
@@ -0,0 +1,56 @@
+//******************************************************************************
+/**
+ * @file LanAuth.h
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief LanAuth class definition
+ * @version 0.1
+ * @date 2024-02-23
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#pragma once
+
+#include "Utils/NoCopy.h"
+#include "App/MqttAgent/LedStateParser.h"
+
+#include "esp_err.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define LAN_KEY_LENGTH      (32)
+
+//******************************************************************************
+/**
+ * @brief Authenticate the ledstates a site gateway sends on the udp port.
+ *
+ * The gateway signs the "ledstate" object with HMAC-SHA256 over
+ *
+ *     <thing_name><ledstate object as sent>
+ *
+ * so a datagram meant for one device is no good for another.  Replays on the
+ * same device are caught by the session and the seq the ledstate object
+ * carries, see LedStateSequencer.
+ *
+ * The key comes from the cloud with set-config, never from the udp port
+ * itself, and is kept in the "config" key store.
+ *
+ * @note Not thread safe, MN8App holds its ledstate lock around it.
+ */
+class LanAuth : public NoCopy {
+public:
+    LanAuth(void) = default;
+    ~LanAuth(void);
+
+public:
+    esp_err_t load(void);
+    esp_err_t set_key(const char* hex);
+    inline bool has_key(void) const { return this->key_set; }
+
+    bool verify(const char* thing_name, const ledstate_lan_envelope_t& envelope) const;
+
+private:
+    uint8_t key[LAN_KEY_LENGTH] = {};
+    bool key_set = false;
+};
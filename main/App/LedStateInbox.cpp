@@ -0,0 +1,216 @@
+//******************************************************************************
+/**
+ * @file LedStateInbox.cpp
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief LedStateInbox class implementation
+ * @version 0.1
+ * @date 2024-02-21
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#include "LedStateInbox.h"
+
+#include "App/MqttAgent/MqttAgent.h"
+#include "App/MqttAgent/IotThing.h"
+#include "Utils/Time.h"
+
+#include "esp_log.h"
+
+static const char* TAG = "ledstate_inbox";
+
+//******************************************************************************
+esp_err_t LedStateInbox::setup(
+    LedStateSequencer* sequencer,
+    IotThing* iot_thing,
+    requested_fn_t requested_fn,
+    apply_fn_t apply_fn,
+    void* context
+) {
+    this->sequencer = sequencer;
+    this->iot_thing = iot_thing;
+    this->requested_fn = requested_fn;
+    this->apply_fn = apply_fn;
+    this->context = context;
+
+    this->mutex = xSemaphoreCreateMutex();
+    if (this->mutex == nullptr) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    this->mark_received();
+    return ESP_OK;
+}
+
+//******************************************************************************
+/**
+ * @brief Take the thing ledstate topics, and apply once the loop drained.
+ *
+ * The group topic needs the slot and the station ids, MN8App parses it and
+ * calls accept().
+ */
+void LedStateInbox::register_handlers(MqttAgent& mqtt_agent) {
+    mqtt_agent.register_topic_handler(e_mqtt_topic_ledstate, this->sOn_ledstate, this);
+    mqtt_agent.register_topic_handler(e_mqtt_topic_ledstate_mp, this->sOn_ledstate_mp, this);
+    mqtt_agent.register_drained_callback(this->sOn_mqtt_drained, this);
+    mqtt_agent.register_subscribed_callback(this->sOn_mqtt_subscribed, this);
+}
+
+//******************************************************************************
+void LedStateInbox::on_ledstate(const char* pPayload, size_t payloadLength) {
+    ESP_LOGI(TAG, "ledstate received : %.*s", payloadLength, pPayload);
+
+    ledstate_message_t message;
+    if (ledstate_parse(pPayload, payloadLength, &message) != ESP_OK) {
+        return;
+    }
+
+    this->accept(message, pPayload, payloadLength, e_payload_encoding_json);
+}
+
+//******************************************************************************
+void LedStateInbox::on_ledstate_mp(const char* pPayload, size_t payloadLength) {
+    ESP_LOGI(TAG, "msgpack ledstate received : %d bytes", payloadLength);
+
+    ledstate_message_t message;
+    if (ledstate_parse_msgpack((const uint8_t*) pPayload, payloadLength, &message) != ESP_OK) {
+        return;
+    }
+
+    this->accept(message, pPayload, payloadLength, e_payload_encoding_msgpack);
+}
+
+//******************************************************************************
+// Called from the mqtt task once the inbound publishes have been handled.
+void LedStateInbox::on_mqtt_drained(void) {
+    this->apply_pending();
+    this->iot_thing->flush_acks();
+}
+
+//******************************************************************************
+/**
+ * @brief Forget the proxy seqs before asking for the latest state.
+ *
+ * The proxy may have restarted while we were away and counts from anywhere,
+ * what it sends for the latest state is the new reference.
+ */
+void LedStateInbox::on_mqtt_subscribed(void) {
+    this->lock();
+    this->sequencer->reset();
+    this->unlock();
+}
+
+//******************************************************************************
+/**
+ * @brief Accept a parsed ledstate and ack it.
+ *
+ * Stale messages are dropped and only the ports that changed are kept, see
+ * LedStateSequencer.  What is left waits in the pending ledstate.  Even a
+ * stale message tells us the proxy is alive.
+ *
+ * @param message   The parsed message, ports already applied are cleared.
+ * @param pPayload  The received payload, echoed back in the ack.
+ * @param encoding  Encoding of the received payload, the ack uses the same.
+ * @param stream    Thing or group topic, each has its own seq.
+ */
+ledstate_verdict_t LedStateInbox::accept(
+    ledstate_message_t& message,
+    const char* pPayload,
+    size_t payloadLength,
+    payload_encoding_t encoding,
+    ledstate_stream_t stream
+) {
+    this->lock();
+    ledstate_message_t current = this->get_requested_locked();
+    ledstate_verdict_t verdict = this->sequencer->check(message, current, stream);
+    if (verdict == e_ledstate_apply) {
+        this->add_pending_locked(message);
+    }
+    this->unlock();
+
+    this->mark_received();
+    if (verdict == e_ledstate_stale) {
+        return verdict;
+    }
+
+    bool duplicate = verdict == e_ledstate_duplicate;
+    if (duplicate) {
+        ESP_LOGI(TAG, "ledstate unchanged");
+    }
+
+    if (stream == e_ledstate_stream_group) {
+        this->iot_thing->ack_group_led_state(pPayload, payloadLength, message, duplicate);
+    } else {
+        this->iot_thing->ack_led_state(pPayload, payloadLength, message, duplicate, encoding);
+    }
+    return verdict;
+}
+
+//******************************************************************************
+/**
+ * @brief Accept a ledstate and apply it without waiting for the mqtt loop.
+ *
+ * @note Call with the lock held, the caller acks.
+ */
+ledstate_verdict_t LedStateInbox::accept_and_apply_locked(ledstate_message_t& message, ledstate_stream_t stream) {
+    ledstate_message_t current = this->get_requested_locked();
+    ledstate_verdict_t verdict = this->sequencer->check(message, current, stream);
+    if (verdict == e_ledstate_apply) {
+        this->add_pending_locked(message);
+        this->apply_pending_locked();
+    }
+    return verdict;
+}
+
+//******************************************************************************
+/**
+ * @brief Send the pending ledstate to the LED tasks.
+ */
+void LedStateInbox::apply_pending(void) {
+    this->lock();
+    this->apply_pending_locked();
+    this->unlock();
+}
+
+//******************************************************************************
+void LedStateInbox::mark_received(void) {
+    this->last_received_s = Time::instance().upTimeS();
+}
+
+//******************************************************************************
+/**
+ * @brief What the leds will show once the pending ledstate is applied.
+ */
+ledstate_message_t LedStateInbox::get_requested_locked(void) {
+    ledstate_message_t current = this->requested_fn(this->context);
+    if (this->has_pending) {
+        ledstate_merge(&current, this->pending);
+    }
+    return current;
+}
+
+//******************************************************************************
+/**
+ * @brief Fold an accepted ledstate into the pending one.
+ */
+void LedStateInbox::add_pending_locked(const ledstate_message_t& message) {
+    if (this->has_pending) {
+        this->sequencer->count_coalesced();
+        ledstate_merge(&this->pending, message);
+    } else {
+        this->pending = message;
+        this->has_pending = true;
+    }
+}
+
+//******************************************************************************
+void LedStateInbox::apply_pending_locked(void) {
+    if (!this->has_pending) {
+        return;
+    }
+
+    this->apply_fn(this->pending, this->context);
+
+    this->pending = {};
+    this->has_pending = false;
+}
@@ -0,0 +1,113 @@
+//******************************************************************************
+/**
+ * @file LedStateInbox.h
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief LedStateInbox class definition
+ * @version 0.1
+ * @date 2024-02-21
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#pragma once
+
+#include "Utils/NoCopy.h"
+#include "App/LedStateSequencer.h"
+#include "App/MqttAgent/LedStateParser.h"
+#include "App/MqttAgent/IotPayloads.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "esp_err.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+class IotThing;
+class MqttAgent;
+
+//******************************************************************************
+/**
+ * @brief The ledstates on their way to the LED tasks.
+ *
+ * Parsed messages go through the LedStateSequencer.  What is left is folded
+ * into the pending ledstate, which is applied once the mqtt loop has handled
+ * everything it received.  When the proxy floods us, the LED tasks only get
+ * the newest state of each port.  The lan path (udp task) applies right
+ * away, the lock keeps the sequencer and the pending ledstate consistent
+ * between the two.
+ *
+ * The LEDs themselves are behind two callbacks, so the same code runs on the
+ * host tools.
+ */
+class LedStateInbox : public NoCopy {
+public:
+    LedStateInbox(void) = default;
+    ~LedStateInbox(void) = default;
+
+    // What the leds are asked to show, without the pending ledstate.
+    typedef ledstate_message_t (*requested_fn_t)(void* context);
+    // Send the ports set in message, and night mode if set, to the leds.
+    typedef void (*apply_fn_t)(const ledstate_message_t& message, void* context);
+
+public:
+    esp_err_t setup(
+        LedStateSequencer* sequencer,
+        IotThing* iot_thing,
+        requested_fn_t requested_fn,
+        apply_fn_t apply_fn,
+        void* context
+    );
+    void register_handlers(MqttAgent& mqtt_agent);
+
+    ledstate_verdict_t accept(
+        ledstate_message_t& message,
+        const char* pPayload,
+        size_t payloadLength,
+        payload_encoding_t encoding,
+        ledstate_stream_t stream = e_ledstate_stream_thing
+    );
+    ledstate_verdict_t accept_and_apply_locked(ledstate_message_t& message, ledstate_stream_t stream);
+    void apply_pending(void);
+
+    inline void lock(void) { xSemaphoreTake(this->mutex, portMAX_DELAY); }
+    inline void unlock(void) { xSemaphoreGive(this->mutex); }
+
+    // Uptime in seconds of the last ledstate, even a duplicate or a stale one
+    // tells us the proxy is alive.
+    inline uint64_t get_last_received_s(void) const { return this->last_received_s; }
+    void mark_received(void);
+
+protected:
+    void on_ledstate(const char* pPayload, size_t payloadLength);
+    void on_ledstate_mp(const char* pPayload, size_t payloadLength);
+    void on_mqtt_drained(void);
+    void on_mqtt_subscribed(void);
+
+    static void sOn_ledstate(const char* pPayload, size_t payloadLength, uint16_t packetIdentifier, void* context) {
+        ((LedStateInbox*)context)->on_ledstate(pPayload, payloadLength);
+    }
+    static void sOn_ledstate_mp(const char* pPayload, size_t payloadLength, uint16_t packetIdentifier, void* context) {
+        ((LedStateInbox*)context)->on_ledstate_mp(pPayload, payloadLength);
+    }
+    static void sOn_mqtt_drained(void* context) { ((LedStateInbox*)context)->on_mqtt_drained(); }
+    static void sOn_mqtt_subscribed(void* context) { ((LedStateInbox*)context)->on_mqtt_subscribed(); }
+
+private:
+    ledstate_message_t get_requested_locked(void);
+    void add_pending_locked(const ledstate_message_t& message);
+    void apply_pending_locked(void);
+
+private:
+    LedStateSequencer* sequencer = nullptr;
+    IotThing* iot_thing = nullptr;
+    requested_fn_t requested_fn = nullptr;
+    apply_fn_t apply_fn = nullptr;
+    void* context = nullptr;
+
+    SemaphoreHandle_t mutex = nullptr;
+    ledstate_message_t pending = {};
+    bool has_pending = false;
+    volatile uint64_t last_received_s = 0;
+};
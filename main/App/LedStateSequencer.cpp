@@ -0,0 +1,121 @@
+//******************************************************************************
+/**
+ * @file LedStateSequencer.cpp
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief LedStateSequencer class implementation
+ * @version 0.1
+ * @date 2024-02-12
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#include "LedStateSequencer.h"
+
+#include "esp_log.h"
+
+static const char* TAG = "ledstate_seq";
+
+//******************************************************************************
+/**
+ * @brief Check a ledstate message.
+ *
+ * @param message   Message to check, ports and night mode that are already
+ *                  applied are cleared.
+ * @param current   What the leds are currently asked to show.
+ * @param stream    Which topic the message came on, for its seq.
+ * @return ledstate_verdict_t
+ */
+ledstate_verdict_t LedStateSequencer::check(
+    ledstate_message_t& message,
+    const ledstate_message_t& current,
+    ledstate_stream_t stream
+) {
+    if (stream == e_ledstate_stream_lan &&
+        (this->lan_session == 0 || !message.has_session || message.session != this->lan_session)
+    ) {
+        ESP_LOGW(TAG, "Dropping lan ledstate %u of another session", message.seq);
+        this->counters.dropped_stale++;
+        return e_ledstate_wrong_session;
+    }
+
+    if (message.has_seq) {
+        bool& has_last_seq = this->has_last_seq[stream];
+        uint32_t& last_seq = this->last_seq[stream];
+
+        int32_t delta = (int32_t)(message.seq - last_seq);
+        bool strict = stream == e_ledstate_stream_lan;
+        bool restart = !strict && (message.seq == 0 || delta < -LEDSTATE_SEQ_RESTART_WINDOW);
+
+        if (has_last_seq && !restart && (delta < 0 || (strict && delta == 0))) {
+            ESP_LOGW(TAG, "Dropping stale ledstate %u, last applied %u", message.seq, last_seq);
+            this->counters.dropped_stale++;
+            return e_ledstate_stale;
+        }
+
+        if (has_last_seq && restart && message.seq != last_seq) {
+            ESP_LOGI(TAG, "Proxy restarted, seq %u after %u", message.seq, last_seq);
+        }
+
+        has_last_seq = true;
+        last_seq = message.seq;
+    }
+
+    bool changed = false;
+
+    if (message.has_night_mode) {
+        if (message.night_mode == current.night_mode) {
+            message.has_night_mode = false;
+        } else {
+            changed = true;
+        }
+    }
+
+    for (int i = 0; i < LEDSTATE_PORT_COUNT; i++) {
+        ledstate_port_t& port = message.port[i];
+        if (!port.has_state) {
+            continue;
+        }
+
+        if (port.state == current.port[i].state && port.charge_percent == current.port[i].charge_percent) {
+            port.has_state = false;
+        } else {
+            changed = true;
+        }
+    }
+
+    if (!changed) {
+        this->counters.dropped_duplicate++;
+        return e_ledstate_duplicate;
+    }
+
+    this->counters.applied++;
+    return e_ledstate_apply;
+}
+
+//******************************************************************************
+/**
+ * @brief Forget the last seqs, the next messages are taken as the reference.
+ *
+ * Not the lan one, it only starts over with a new session.
+ */
+void LedStateSequencer::reset(void) {
+    for (int i = 0; i < e_ledstate_stream_count; i++) {
+        if (i == e_ledstate_stream_lan) {
+            continue;
+        }
+        this->has_last_seq[i] = false;
+        this->last_seq[i] = 0;
+    }
+}
+
+//******************************************************************************
+/**
+ * @brief Start a lan session, the lan seq starts over.
+ *
+ * @param session   Never 0, and never one used before.
+ */
+void LedStateSequencer::start_lan_session(uint64_t session) {
+    this->lan_session = session;
+    this->has_last_seq[e_ledstate_stream_lan] = false;
+    this->last_seq[e_ledstate_stream_lan] = 0;
+}
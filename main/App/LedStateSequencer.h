@@ -0,0 +1,104 @@
+//******************************************************************************
+/**
+ * @file LedStateSequencer.h
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief LedStateSequencer class definition
+ * @version 0.1
+ * @date 2024-02-12
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#pragma once
+
+#include "Utils/NoCopy.h"
+#include "App/MqttAgent/LedStateParser.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// A seq this far behind the last one is a proxy that restarted, not a late
+// delivery.
+#define LEDSTATE_SEQ_RESTART_WINDOW     (1024)
+
+typedef enum {
+    e_ledstate_apply,           // something changed, apply what is left in the message
+    e_ledstate_duplicate,       // same as what the leds are already showing
+    e_ledstate_stale,           // older than the last applied message
+    e_ledstate_wrong_session,   // lan, signed for another session, or none
+} ledstate_verdict_t;
+
+// Each topic the proxy numbers on its own.
+typedef enum {
+    e_ledstate_stream_thing,    // <thing_name>/ledstate, json and msgpack
+    e_ledstate_stream_group,    // <group_id>/ledstate
+    e_ledstate_stream_lan,      // site gateway on the udp port
+    e_ledstate_stream_count
+} ledstate_stream_t;
+
+typedef struct {
+    uint32_t applied;
+    uint32_t dropped_stale;
+    uint32_t dropped_duplicate;
+    uint32_t coalesced;         // applied, but folded into a newer one before reaching the leds
+} ledstate_counters_t;
+
+//******************************************************************************
+/**
+ * @brief Decide which ledstate messages reach the LED tasks.
+ *
+ * The proxy re-publishes the state on every poll and may deliver out of
+ * order after a reconnect.
+ *
+ * When the message carries a "seq", anything older than the last applied seq
+ * is stale and dropped.  Seq uses serial number arithmetic so it can wrap.
+ * A seq of 0, or a jump back of more than LEDSTATE_SEQ_RESTART_WINDOW, means
+ * the proxy restarted and the message is taken as the new reference.  The
+ * seqs are also forgotten on each mqtt connection (reset()), a proxy that
+ * restarted from 1 while we were away is the reference again with the
+ * latest state it sends.  The thing and the group ledstates are numbered
+ * separately, each stream keeps its own last seq.  The lan stream is
+ * strict: a seq that isn't newer than the last one is stale and there is no
+ * restart, so a captured datagram can't be replayed.
+ *
+ * The lan seq is only kept in ram.  What keeps a datagram from being replayed
+ * after a reboot is the session: a random number the device draws at boot,
+ * that the gateway puts in the ledstate it signs.  A message of another
+ * session is refused before its seq is looked at.  A gateway that restarts
+ * its counter asks for a new session (lan-session on the udp port) and
+ * starts over from any seq, the datagrams of the sessions before are
+ * refused for good.
+ *
+ * Then, with or without a seq, the message is compared against what the
+ * leds are currently asked to show.  Ports and night mode that already match
+ * are removed from the message.  If nothing is left the message is a
+ * duplicate.  Comparing against the leds, and not the last message, means a
+ * local override (no connection, offline, repl console...) never hides a
+ * state we need to re-apply.
+ *
+ * @note Not thread safe, MN8App serializes the mqtt and udp tasks.
+ */
+class LedStateSequencer : public NoCopy {
+public:
+    LedStateSequencer(void) = default;
+    ~LedStateSequencer(void) = default;
+
+public:
+    ledstate_verdict_t check(
+        ledstate_message_t& message,
+        const ledstate_message_t& current,
+        ledstate_stream_t stream = e_ledstate_stream_thing
+    );
+    void reset(void);
+    void start_lan_session(uint64_t session);
+    inline uint64_t get_lan_session(void) const { return this->lan_session; }
+    inline void count_coalesced(void) { this->counters.coalesced++; }
+
+    inline const ledstate_counters_t& get_counters(void) const { return this->counters; }
+
+private:
+    bool has_last_seq[e_ledstate_stream_count] = {};
+    uint32_t last_seq[e_ledstate_stream_count] = {};
+    uint64_t lan_session = 0;       // 0, none started, the lan stream is closed
+    ledstate_counters_t counters = {};
+};
@@ -11,6 +11,7 @@
 //*****************************************************************************
 
 #include "MN8App.h"
+#include "App/udp_server.h"
 #include "LED/Led.h"
 #include "pin_def.h"
 #include "rev.h"
@@ -18,6 +19,7 @@
 #include "Utils/FuseMacAddress.h"
 #include "Utils/Colors.h"
 #include "Utils/KeyStore.h"
+#include "Utils/ScratchArena.h"
 
 #include "ArduinoJson.h"
 
@@ -26,6 +28,7 @@
 #include "esp_mac.h"
 #include "esp_vfs_fat.h"
 #include "esp_check.h"
+#include "esp_random.h"
 
 
 #include "nvs.h"
@@ -118,12 +121,20 @@ esp_err_t MN8App::setup(void) {
     configure_gpio_for_light_sensor();
 
     this->context.setup();
+    ESP_GOTO_ON_ERROR(ScratchArena::instance().setup(), err, TAG, "Failed to setup the scratch arena");
 
     // Do this as early as possible to have feedback.
     ESP_GOTO_ON_ERROR(this->setup_and_start_led_tasks(reseted_due_to_network_error), err, TAG, "Failed to setup and start led tasks");;
 
     // This has to be done early as well.
     ESP_GOTO_ON_ERROR(initialize_nvs(), err, TAG, "Failed to initialize NVS");
+    this->context.get_animation_library().load();
+
+    // Picks up a pull update persisted before the reboot, it waits for the
+    // network like any other run.
+    this->context.get_ota_pull_agent().register_status_callback(this->sOn_ota_status, this);
+    ESP_GOTO_ON_ERROR(this->context.get_ota_pull_agent().setup(), err, TAG, "Failed to setup the ota pull agent");
+    this->context.get_ota_pull_agent().start();
 
     // We need this to have our event loop.  Without this, we can't get the
     // network events or any other events.
@@ -131,9 +142,40 @@ esp_err_t MN8App::setup(void) {
 
     configure_gpio_for_demo();
 
+    {
+        uint16_t group_slot;
+        key_store.openKeyStore("config", e_ro);
+        if (key_store.getKeyValue("group_slot", group_slot) == ESP_OK && group_slot != UINT16_MAX) {
+            this->group_slot = group_slot;
+        }
+    }
+
     this->context.get_network_connection_agent().register_event_callback(this->sOn_network_event, this);
     this->context.get_mqtt_agent().register_event_callback(this->sOn_mqtt_event, this);
-    this->context.get_mqtt_agent().register_handle_incoming_mqtt(this->sOn_incoming_mqtt, this);
+
+    ESP_GOTO_ON_ERROR(
+        this->context.get_ledstate_inbox().setup(
+            &this->context.get_ledstate_sequencer(),
+            &this->context.get_iot_thing(),
+            this->sGet_requested_ledstate,
+            this->sApply_ledstate,
+            this
+        ),
+        err, TAG, "Failed to setup the ledstate inbox"
+    );
+    this->lan_auth.load();
+    this->new_lan_session();
+    udp_server_register_ledstate_handler(this->sOn_lan_ledstate, this);
+    udp_server_register_lan_session_handler(this->sNew_lan_session, this);
+
+    auto& mqtt_agent = this->context.get_mqtt_agent();
+    this->context.get_ledstate_inbox().register_handlers(mqtt_agent);
+    mqtt_agent.register_topic_handler(e_mqtt_topic_group_ledstate, this->sOn_group_ledstate, this);
+    mqtt_agent.register_topic_handler(e_mqtt_topic_ping, this->sOn_ping, this);
+    mqtt_agent.register_topic_handler(e_mqtt_topic_reboot, this->sOn_reboot, this);
+    mqtt_agent.register_topic_handler(e_mqtt_topic_set_config, this->sOn_set_config, this);
+    mqtt_agent.register_topic_handler(e_mqtt_topic_get_config, this->sOn_get_config, this);
+    mqtt_agent.register_topic_handler(e_mqtt_topic_ota, this->sOn_ota, this);
 
     ESP_GOTO_ON_ERROR(
         context.get_network_connection_agent().setup(), 
@@ -145,11 +187,17 @@ esp_err_t MN8App::setup(void) {
     
     // MQTT starter config stuff. Only start mqtt stack if thing is configured.
     if (thing_config.is_configured()) {
-        this->context.get_mqtt_agent().setup(&thing_config);
+        this->context.get_mqtt_agent().setup(&thing_config, &this->context.get_charge_point_config());
         this->context.get_iot_thing().setup(&thing_config, &this->context.get_mqtt_agent());
         this->context.get_mqtt_agent().start();
 
-        this->context.get_iot_heartbeat().setup(&this->context, &thing_config, &this->state_machine);
+        this->context.get_iot_heartbeat().setup(
+            &this->context.get_mqtt_agent(),
+            &this->context.get_iot_thing(),
+            &this->context.get_ledstate_sequencer(),
+            this->sGet_heartbeat_status,
+            this
+        );
         this->context.get_iot_heartbeat().start();
     }
 
@@ -177,6 +225,20 @@ esp_err_t MN8App::setup_and_start_led_tasks(bool disable_connecting_leds) {
     int led_count = site_config.get_led_length() == LED_FULL_SIZE ? LED_STRIP_PIXEL_COUNT : LED_STRIP_SHORT_PIXEL_COUNT;
     ESP_LOGI(TAG, "LED count : %d", led_count);
 
+    // Both strips are one display for a lighting controller.
+    if (this->context.get_pixel_stream().setup(2, led_count) == ESP_OK) {
+        led_task_0.set_pixel_stream(&this->context.get_pixel_stream());
+        led_task_1.set_pixel_stream(&this->context.get_pixel_stream());
+    } else {
+        ESP_LOGE(TAG, "Failed to setup the pixel stream");
+    }
+
+    // Empty until the key store is up, see setup().
+    if (this->context.get_animation_library().setup() == ESP_OK) {
+        led_task_0.set_animation_library(&this->context.get_animation_library());
+        led_task_1.set_animation_library(&this->context.get_animation_library());
+    }
+
     ESP_GOTO_ON_ERROR(led_task_0.setup(0, RMT_LED_STRIP0_GPIO_NUM, HSPI_HOST, led_count, disable_connecting_leds), err, TAG, "Failed to setup led task 0");
     ESP_GOTO_ON_ERROR(led_task_0.start(), err, TAG, "Failed to start led task 0");
 
@@ -187,116 +249,376 @@ err:
     return ret;
 }
 
-static char topic[64] = {0};
 static char payload[2048] = {0};
 
 //*****************************************************************************
-void MN8App::on_incoming_mqtt( 
-    const char* pTopicName,
-    uint16_t topicNameLength,
-    const char* pPayload,
-    size_t payloadLength,
-    uint16_t packetIdentifier
-) {
-    ESP_LOGI(TAG, "Incoming publish received : %.*s %.*s", topicNameLength, pTopicName, payloadLength, pPayload);
-    KeyStore key_store;
-
-    StaticJsonDocument<512> doc;
+/**
+ * @brief Parse an inbound payload into doc and return its root object.
+ * 
+ * @return JsonObject   null object if the payload is not a json object.
+ */
+template<size_t N>
+static JsonObject parse_payload(StaticJsonDocument<N>& doc, const char* pPayload, size_t payloadLength) {
     DeserializationError error = deserializeJson(doc, pPayload, payloadLength);
     if (error) {
         ESP_LOGE(TAG, "deserializeJson() failed: %s", error.c_str());
-        return;
+        return JsonObject();
     }
 
     JsonObject root = doc.as<JsonObject>();
     if (root.isNull()) {
-        ESP_LOGE(TAG, "deserializeJson() failed: %s", error.c_str());
+        ESP_LOGE(TAG, "payload is not a json object");
+    }
+    return root;
+}
+
+//*****************************************************************************
+/**
+ * @brief A ledstate for the whole group, only our part of it is kept.
+ */
+void MN8App::on_group_ledstate(const char* pPayload, size_t payloadLength) {
+    ESP_LOGD(TAG, "group ledstate received : %d bytes", payloadLength);
+
+    auto& cp_config = this->context.get_charge_point_config();
+
+    ledstate_address_t address = {};
+    address.thing_name = this->context.get_thing_config().get_thing_name();
+    address.slot = this->group_slot;
+    address.station_id[0] = cp_config.get_led_1_station_id(address.port_number[0]);
+    address.station_id[1] = cp_config.get_led_2_station_id(address.port_number[1]);
+
+    ledstate_message_t message;
+    if (ledstate_parse_group(pPayload, payloadLength, address, &message) != ESP_OK) {
         return;
     }
 
-    char mac_address[13] = {0};
-    get_fuse_mac_address_string(mac_address);
-    memset(topic, 0, sizeof(topic));
-    memset(payload, 0, sizeof(payload));
+    this->context.get_ledstate_inbox().accept(message, pPayload, payloadLength, e_payload_encoding_json, e_ledstate_stream_group);
+}
 
-    if (strnstr(pTopicName, "ledstate", topicNameLength) != NULL) {
-        last_received_led_state = Time::instance().upTimeS();
+//*****************************************************************************
+/**
+ * @brief What the LED tasks were last asked to show.
+ * 
+ * @note Called with the ledstate lock held.
+ */
+ledstate_message_t MN8App::get_requested_ledstate(void) {
+    LedTaskSpi* led_tasks[LEDSTATE_PORT_COUNT] = {
+        &this->get_context().get_led_task_0(),
+        &this->get_context().get_led_task_1()
+    };
+
+    ledstate_message_t current = {};
+    current.night_mode = this->context.is_night_mode();
+    for (int i = 0; i < LEDSTATE_PORT_COUNT; i++) {
+        led_state_info_t requested = led_tasks[i]->get_requested_state();
+        current.port[i].state = requested.state;
+        current.port[i].charge_percent = requested.charge_percent;
+    }
+    return current;
+}
+
+//*****************************************************************************
+/**
+ * @brief A ledstate from a site gateway on the udp port.
+ * 
+ * Called from the udp task.  Same sequencer as mqtt, so a state that came
+ * both ways is applied once, but applied right away instead of waiting for
+ * the mqtt loop.  The udp response is the ack.
+ * 
+ * @return esp_err_t    ESP_ERR_INVALID_STATE without a lan key,
+ *                      ESP_ERR_INVALID_CRC if the hmac is wrong,
+ *                      ESP_ERR_INVALID_ARG without a seq.
+ */
+esp_err_t MN8App::on_lan_ledstate(
+    const ledstate_lan_envelope_t& envelope,
+    ledstate_message_t& message,
+    ledstate_verdict_t* verdict
+) {
+    if (!message.has_seq) {
+        ESP_LOGE(TAG, "lan ledstate without seq");
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_err_t ret = ESP_OK;
+    LedStateInbox& ledstate_inbox = this->context.get_ledstate_inbox();
+    ledstate_inbox.lock();
+
+    if (!this->lan_auth.has_key()) {
+        ret = ESP_ERR_INVALID_STATE;
+    } else if (!this->lan_auth.verify(this->context.get_thing_config().get_thing_name(), envelope)) {
+        ret = ESP_ERR_INVALID_CRC;
+    } else {
+        *verdict = ledstate_inbox.accept_and_apply_locked(message, e_ledstate_stream_lan);
+    }
+
+    ledstate_inbox.unlock();
+
+    if (ret == ESP_ERR_INVALID_CRC) {
+        ESP_LOGW(TAG, "lan ledstate with a bad hmac");
+    } else if (ret == ESP_OK && (*verdict == e_ledstate_apply || *verdict == e_ledstate_duplicate)) {
+        ledstate_inbox.mark_received();
+    }
+    return ret;
+}
+
+//*****************************************************************************
+/**
+ * @brief Start a new lan session, the lan seq starts over.
+ * 
+ * Once at boot, and each time a gateway asks (it restarted its counter, or
+ * was told its session is gone).  The datagrams signed for any session
+ * before are refused from now on.  Anyone on the lan can ask, which only
+ * makes the gateway ask again.
+ * 
+ * @return uint64_t     The session the gateway signs its ledstates for.
+ */
+uint64_t MN8App::new_lan_session(void) {
+    this->context.get_ledstate_inbox().lock();
+
+    LedStateSequencer& sequencer = this->context.get_ledstate_sequencer();
+    uint64_t session;
+    do {
+        session = ((uint64_t) esp_random() << 32) | esp_random();
+    } while (session == 0 || session == sequencer.get_lan_session());
+    sequencer.start_lan_session(session);
 
-        if (root.containsKey("night_mode")) {
-            bool night_mode = root["night_mode"];
-            this->context.set_night_mode(night_mode);
-            Colors::instance().setMode(night_mode ? LED_INTENSITY_LOW : LED_INTENSITY_HIGH);
+    this->context.get_ledstate_inbox().unlock();
+
+    ESP_LOGI(TAG, "lan session %016llx", (unsigned long long) session);
+    return session;
+}
+
+//*****************************************************************************
+/**
+ * @brief Send an accepted ledstate to the LED tasks.
+ * 
+ * @note Called with the ledstate lock held.
+ */
+void MN8App::apply_ledstate(const ledstate_message_t& message) {
+    LedTaskSpi* led_tasks[LEDSTATE_PORT_COUNT] = {
+        &this->get_context().get_led_task_0(),
+        &this->get_context().get_led_task_1()
+    };
+
+    if (message.has_night_mode) {
+        this->context.set_night_mode(message.night_mode);
+        Colors::instance().setMode(message.night_mode ? LED_INTENSITY_LOW : LED_INTENSITY_HIGH);
+    }
+
+    for (int i = 0; i < LEDSTATE_PORT_COUNT; i++) {
+        const ledstate_port_t& port = message.port[i];
+        if (port.has_state) {
+            ESP_LOGI(TAG, "port %d new state : %s", i, led_state_to_string(port.state));
+            led_tasks[i]->set_pattern(port.state, port.charge_percent);
         }
+    }
 
-        if (root.containsKey("port0")) {
-            JsonObject port0 = root["port0"];
-            if (port0.containsKey("state")) {
-                const char* state = port0["state"];
-                int charge_percent = port0["charge_percent"];
-                ESP_LOGI(TAG, "port 0 new state : %s", state);
-                this->get_context().get_led_task_0().set_state(state, charge_percent);
-            }
+    // Right here we could send a message to state machine to pet a watchdog
+    // in the state maching if watch dog hasn't been pet in a while we would
+    // go to proxy connection lost.
+}
+
+//*****************************************************************************
+void MN8App::on_ping(const char* pPayload, size_t payloadLength) {
+    ESP_LOGI(TAG, "ping received");
+    this->get_context().get_iot_thing().send_pong(
+        this->state_machine.get_current_state_name(),
+        this->get_context().get_led_task_0().get_state_as_string(),
+        this->get_context().get_led_task_1().get_state_as_string(),
+        this->get_context().is_night_mode(),
+        this->get_context().has_night_sensor()
+    );
+}
+
+//*****************************************************************************
+void MN8App::on_reboot(const char* pPayload, size_t payloadLength) {
+    ESP_LOGI(TAG, "reboot received");
+    esp_restart();
+}
+
+//*****************************************************************************
+void MN8App::on_set_config(const char* pPayload, size_t payloadLength) {
+    ESP_LOGI(TAG, "set-config received : %.*s", payloadLength, pPayload);
+
+    // Room for an animation program or two, they are copied in.
+    StaticJsonDocument<1024> doc;
+    JsonObject root = parse_payload(doc, pPayload, payloadLength);
+    if (root.isNull()) {
+        return;
+    }
+
+    KeyStore key_store;
+    key_store.openKeyStore("config", e_rw);
+
+    if (root.containsKey("heartbeat_frequency")) {
+        uint16_t heartbeat_frequency = root["heartbeat_frequency"];
+        ESP_LOGI(TAG, "heartbeat_frequency : %d", heartbeat_frequency);
+        key_store.setKeyValue("heartbeat_frequency", heartbeat_frequency);
+        this->context.get_iot_heartbeat().set_heartbeat_frequency(heartbeat_frequency);
+    }
+
+    if (root.containsKey("ack_mode")) {
+        ack_mode_t ack_mode;
+        const char* ack_mode_name = root["ack_mode"];
+        if (IotThing::ack_mode_from_string(ack_mode_name, ack_mode) == ESP_OK) {
+            ESP_LOGI(TAG, "ack_mode : %s", ack_mode_name);
+            this->context.get_iot_thing().set_ack_mode(ack_mode);
+        } else {
+            ESP_LOGE(TAG, "Unknown ack mode %s", ack_mode_name ? ack_mode_name : "(null)");
         }
+    }
 
-        if (root.containsKey("port1")) {
-            JsonObject port1 = root["port1"];
-            if (port1.containsKey("state")) {
-                const char* state = port1["state"];
-                int charge_percent = port1["charge_percent"];
-                ESP_LOGI(TAG, "port 1 new state : %s", state);
-                this->get_context().get_led_task_1().set_state(state, charge_percent);
-            }
+    if (root.containsKey("group_slot")) {
+        int group_slot = root["group_slot"] | -1;
+        if (group_slot < 0 || group_slot >= UINT16_MAX) {
+            group_slot = -1;
         }
+        ESP_LOGI(TAG, "group_slot : %d", group_slot);
+        key_store.setKeyValue("group_slot", group_slot < 0 ? (uint16_t) UINT16_MAX : (uint16_t) group_slot);
+        this->group_slot = group_slot;
+    }
 
-        memcpy(payload, pPayload, payloadLength);
-        this->get_context().get_iot_thing().ack_led_state_change(payload);
-
-        // Right here we could send a message to state machine to pet a watchdog
-        // in the state maching if watch dog hasn't been pet in a while we would
-        // go to proxy connection lost.
-    } else if (strnstr(pTopicName, "ping", topicNameLength) != NULL) {
-        ESP_LOGI(TAG, "ping received");
-        this->get_context().get_iot_thing().send_pong(
-            this->state_machine.get_current_state_name(),
-            this->get_context().get_led_task_0().get_state_as_string(),
-            this->get_context().get_led_task_1().get_state_as_string(),
-            this->get_context().is_night_mode(),
-            this->get_context().has_night_sensor()
-        );
-    } else if (strnstr(pTopicName, "reboot", topicNameLength) != NULL) {
-        ESP_LOGI(TAG, "reboot received");
-        esp_restart();
-    } else if (strnstr(pTopicName, "set-config", topicNameLength) != NULL) {
-        key_store.openKeyStore("config", e_rw);
-
-        if (root.containsKey("heartbeat_frequency")) {
-            uint16_t heartbeat_frequency = root["heartbeat_frequency"];
-            ESP_LOGI(TAG, "heartbeat_frequency : %d", heartbeat_frequency);
-            key_store.setKeyValue("heartbeat_frequency", heartbeat_frequency);
-            this->context.get_iot_heartbeat().set_heartbeat_frequency(heartbeat_frequency);
+    if (root.containsKey("lan_key")) {
+        const char* lan_key = root["lan_key"];
+        this->context.get_ledstate_inbox().lock();
+        esp_err_t err = this->lan_auth.set_key(lan_key);
+        this->context.get_ledstate_inbox().unlock();
+        ESP_LOGI(TAG, "lan_key : %s", err != ESP_OK ? "rejected" : this->lan_auth.has_key() ? "set" : "removed");
+    }
+
+    if (root.containsKey("animations")) {
+        // {"<led state>":"<program as hex>"}, empty for the built-in animation.
+        JsonObject animations = root["animations"];
+        for (JsonPair animation : animations) {
+            const char* state_name = animation.key().c_str();
+            const char* program = animation.value().as<const char*>();
+            led_state_t state = led_state_from_string(state_name, strlen(state_name));
+            esp_err_t err = this->context.get_animation_library().set_program(state, program != nullptr ? program : "");
+            ESP_LOGI(TAG, "animation %s : %s", state_name, err != ESP_OK ? "rejected" : program != nullptr && program[0] != '\0' ? "set" : "removed");
         }
-    } else if (strnstr(pTopicName, "get-config", topicNameLength) != NULL) {
-        key_store.openKeyStore("config", e_ro);
+    }
 
-        uint16_t heartbeat_frequency = this->context.get_iot_heartbeat().get_heartbeat_frequency();
+    if (root.containsKey("encoding")) {
+        payload_encoding_t encoding;
+        const char* encoding_name = root["encoding"];
+        if (IotThing::encoding_from_string(encoding_name, encoding) == ESP_OK) {
+            ESP_LOGI(TAG, "encoding : %s", encoding_name);
+            this->context.get_iot_thing().set_encoding(encoding);
+        } else {
+            ESP_LOGE(TAG, "Unknown encoding %s", encoding_name ? encoding_name : "(null)");
+        }
+    }
+}
 
-        snprintf((char *) topic, 64, "%s/config", mac_address);
-        snprintf(
-            payload, sizeof(payload),
-            R"({
-                "heartbeat_frequency":"%d",
-            })",
-            heartbeat_frequency
-        );
+//*****************************************************************************
+void MN8App::on_get_config(const char* pPayload, size_t payloadLength) {
+    ESP_LOGI(TAG, "get-config received");
+
+    uint16_t heartbeat_frequency = this->context.get_iot_heartbeat().get_heartbeat_frequency();
+
+    memset(payload, 0, sizeof(payload));
+    snprintf(
+        payload, sizeof(payload),
+        R"({"heartbeat_frequency":"%d","encoding":"%s","ack_mode":"%s","group_slot":%d,"lan_key":%s})",
+        heartbeat_frequency,
+        IotThing::encoding_to_string(this->context.get_iot_thing().get_encoding()),
+        IotThing::ack_mode_to_string(this->context.get_iot_thing().get_ack_mode()),
+        this->group_slot,
+        this->lan_auth.has_key() ? "true" : "false"
+    );
+
+    this->get_context().get_mqtt_agent().publish_message(e_mqtt_topic_config, payload, 3);
+}
+
+//*****************************************************************************
+/**
+ * @brief A pull update job, or its cancellation.
+ *
+ *     {"job_id":"...","url":"https://...","size":1234567,"sha256":"<64 hex>"}
+ *     {"job_id":"...","cancel":true}
+ *
+ * The same job sent again, with a fresh url, carries on where it was.
+ */
+void MN8App::on_ota(const char* pPayload, size_t payloadLength) {
+    ESP_LOGI(TAG, "ota received : %.*s", payloadLength, pPayload);
+
+    StaticJsonDocument<768> doc;
+    JsonObject root = parse_payload(doc, pPayload, payloadLength);
+    if (root.isNull()) {
+        return;
+    }
+
+    auto& ota_pull_agent = this->context.get_ota_pull_agent();
+    if (root["cancel"] | false) {
+        ota_pull_agent.cancel();
+        return;
+    }
+
+    ota_job_t job = {};
+    const char* job_id = root["job_id"] | "";
+    const char* url = root["url"] | "";
+    const char* sha256 = root["sha256"] | "";
+    job.size = root["size"] | 0;
 
-        this->get_context().get_mqtt_agent().publish_message(topic, payload, 3);
+    if (strlen(job_id) > OTA_JOB_ID_MAX_LENGTH || strlen(url) > OTA_URL_MAX_LENGTH ||
+        strlen(sha256) != OTA_JOB_SHA256_LENGTH * 2
+    ) {
+        ESP_LOGE(TAG, "ota job rejected, bad job_id, url or sha256");
+        return;
     }
+
+    strcpy(job.job_id, job_id);
+    strcpy(job.url, url);
+    for (int i = 0; i < OTA_JOB_SHA256_LENGTH; i++) {
+        unsigned int byte;
+        if (sscanf(&sha256[i * 2], "%2x", &byte) != 1) {
+            ESP_LOGE(TAG, "ota job rejected, bad sha256");
+            return;
+        }
+        job.sha256[i] = (uint8_t) byte;
+    }
+
+    if (ota_pull_agent.submit(job) != ESP_OK) {
+        ESP_LOGE(TAG, "ota job dropped, jobs already waiting");
+    }
+}
+
+//*****************************************************************************
+void MN8App::on_ota_status(ota_pull_status_t status, const ota_job_t& job, const ota_block_stats_t& stats, esp_err_t error) {
+    char status_payload[256];
+    snprintf(
+        status_payload, sizeof(status_payload),
+        R"({"job_id":"%s","status":"%s","blocks":%lu,"total":%lu,"resumed":%lu,"requests":%lu,"failed_requests":%lu,"error":"%s"})",
+        job.job_id,
+        OtaPullAgent::status_to_string(status),
+        (unsigned long) stats.blocks_done,
+        (unsigned long) stats.block_count,
+        (unsigned long) stats.blocks_resumed,
+        (unsigned long) stats.requests,
+        (unsigned long) stats.failed_requests,
+        error == ESP_OK ? "" : esp_err_to_name(error)
+    );
+
+    if (this->context.get_mqtt_agent().is_connected()) {
+        this->context.get_mqtt_agent().publish_message(e_mqtt_topic_ota_status, status_payload);
+    }
+}
+
+//*****************************************************************************
+// What the heartbeat reports, called from the heartbeat task.
+void MN8App::get_heartbeat_status(heartbeat_status_t* status) {
+    status->current_state = this->state_machine.get_current_state_name();
+    status->led1_state = this->context.get_led_task_0().get_state_as_string();
+    status->led2_state = this->context.get_led_task_1().get_state_as_string();
+    status->night_mode = this->context.is_night_mode();
+    status->has_night_sensor = this->context.has_night_sensor();
 }
 
 //*****************************************************************************
 // callback for the network connection state machine.
 void MN8App::on_network_event(NetworkConnectionAgent::event_t event) {
     ESP_LOGI(TAG, "Network event : %d", event);
+    udp_server_invalidate_cache();
     switch (event) {
         case NetworkConnectionAgent::event_t::e_net_agent_connection_error: {
             mn8_event_t event = e_mn8_event_lost_network_connection;
@@ -329,6 +651,9 @@ void MN8App::on_mqtt_event(MqttAgent::event_t event) {
             break;
         }
         case MqttAgent::event_t::e_mqtt_agent_disconnected: {
+            // What was accepted is still the newest state we know of.
+            this->context.get_ledstate_inbox().apply_pending();
+            this->context.get_iot_thing().reset_acks();
             mn8_event_t event = e_mn8_event_mqtt_disconnected;
             xQueueSend(this->message_queue, &event, 0);
             break;
@@ -352,7 +677,7 @@ void MN8App::loop(void) {
     this->state_machine.turn_on();
 
     bool new_night_mode = false;
-    last_received_led_state = Time::instance().upTimeS();
+    this->context.get_ledstate_inbox().mark_received();
 
     while(1) {
         if (xQueueReceive(this->message_queue, &event, xTicksToWait) == pdTRUE) {
@@ -364,7 +689,7 @@ void MN8App::loop(void) {
       // ESP_LOGI(TAG, "Last received led state : %llu", last_received_led_state);
         // ESP_LOGI(TAG, "Now is : %llu", Time::instance().upTimeS());
         //ESP_LOGI(TAG, "Timeout : %llu", timeout_no_comm_from_proxy.count());
-        if (Time::instance().upTimeS() - last_received_led_state >= timeout_no_comm_from_proxy.count()) {
+        if (Time::instance().upTimeS() - this->context.get_ledstate_inbox().get_last_received_s() >= timeout_no_comm_from_proxy.count()) {
             // Turn off LED.
             ESP_LOGE(TAG, "No communication from proxy");
             this->context.get_led_task_0().set_state("no_connection", 0);
@@ -383,7 +708,8 @@ void MN8App::loop(void) {
                 this->context.set_has_night_sensor(true);
                 night_mode = new_night_mode;
                 ESP_LOGI(TAG, "Night mode : %d", night_mode);
-                this->context.get_iot_heartbeat().set_night_mode(night_mode);
+                this->context.set_night_mode(night_mode);
+                this->context.get_iot_heartbeat().record_night_mode(night_mode);
             }
         }
     }
@@ -15,11 +15,15 @@
 #include "App/MN8Context.h"
 #include "App/MN8StateMachine.h"
 #include "App/IotHeartbeat.h"
+#include "App/MqttAgent/LedStateParser.h"
+#include "App/LedStateSequencer.h"
+#include "App/LanAuth.h"
 
 #include "Utils/Singleton.h"
 #include "Utils/NoCopy.h"
 
 #include "freertos/queue.h"
+#include "freertos/semphr.h"
 
 #include "Utils/Time.h"
 
@@ -66,30 +70,74 @@ protected:
     static void sOn_network_event(NetworkConnectionAgent::event_t event, void* context) { ((MN8App*)context)->on_network_event(event); }
     static void sOn_mqtt_event(MqttAgent::event_t event, void* context) { ((MN8App*)context)->on_mqtt_event(event); }
 
-    void on_incoming_mqtt( 
-        const char* pTopicName, uint16_t topicNameLength,
-        const char* pPayload, size_t payloadLength,
-        uint16_t packetIdentifier
-    );
-
-    static void sOn_incoming_mqtt( 
-        const char* pTopicName, uint16_t topicNameLength,
-        const char* pPayload, size_t payloadLength,
-        uint16_t packetIdentifier,
-        void* context
-    ) {
-        ((MN8App*)context)->on_incoming_mqtt(pTopicName, topicNameLength, pPayload, payloadLength, packetIdentifier);
+    void get_heartbeat_status(heartbeat_status_t* status);
+    static void sGet_heartbeat_status(heartbeat_status_t* status, void* context) { ((MN8App*)context)->get_heartbeat_status(status); }
+
+    // Inbound mqtt topic handlers, routed by MqttTopics.  The thing ledstate
+    // goes to the LedStateInbox directly.
+    void on_group_ledstate(const char* pPayload, size_t payloadLength);
+    void on_ping(const char* pPayload, size_t payloadLength);
+    void on_reboot(const char* pPayload, size_t payloadLength);
+    void on_set_config(const char* pPayload, size_t payloadLength);
+    void on_get_config(const char* pPayload, size_t payloadLength);
+    void on_ota(const char* pPayload, size_t payloadLength);
+
+#define MN8_TOPIC_HANDLER(name) \
+    static void sOn_##name(const char* pPayload, size_t payloadLength, uint16_t packetIdentifier, void* context) { \
+        ((MN8App*)context)->on_##name(pPayload, payloadLength); \
     }
 
+    MN8_TOPIC_HANDLER(group_ledstate)
+    MN8_TOPIC_HANDLER(ping)
+    MN8_TOPIC_HANDLER(reboot)
+    MN8_TOPIC_HANDLER(set_config)
+    MN8_TOPIC_HANDLER(get_config)
+    MN8_TOPIC_HANDLER(ota)
+#undef MN8_TOPIC_HANDLER
+
+    // Called from the ota pull task.
+    void on_ota_status(ota_pull_status_t status, const ota_job_t& job, const ota_block_stats_t& stats, esp_err_t error);
+    static void sOn_ota_status(ota_pull_status_t status, const ota_job_t& job, const ota_block_stats_t& stats, esp_err_t error, void* context) {
+        ((MN8App*)context)->on_ota_status(status, job, stats, error);
+    }
 
 private:
     esp_err_t setup_and_start_led_tasks(bool disable_connecting_leds);
 
+    // The LED tasks behind the LedStateInbox.
+    ledstate_message_t get_requested_ledstate(void);
+    void apply_ledstate(const ledstate_message_t& message);
+    static ledstate_message_t sGet_requested_ledstate(void* context) { return ((MN8App*)context)->get_requested_ledstate(); }
+    static void sApply_ledstate(const ledstate_message_t& message, void* context) { ((MN8App*)context)->apply_ledstate(message); }
+
+    esp_err_t on_lan_ledstate(
+        const ledstate_lan_envelope_t& envelope,
+        ledstate_message_t& message,
+        ledstate_verdict_t* verdict
+    );
+    static esp_err_t sOn_lan_ledstate(
+        const ledstate_lan_envelope_t& envelope,
+        ledstate_message_t& message,
+        ledstate_verdict_t* verdict,
+        void* context
+    ) {
+        return ((MN8App*)context)->on_lan_ledstate(envelope, message, verdict);
+    }
+
+    uint64_t new_lan_session(void);
+    static uint64_t sNew_lan_session(void* context) { return ((MN8App*)context)->new_lan_session(); }
+
 private:
-    uint64_t last_received_led_state = Time::instance().now();
     std::chrono::seconds timeout_no_comm_from_proxy = std::chrono::minutes(5);
 
     bool night_mode = false;
+
+    // Our element in the "slots" of the group ledstate, -1 if none assigned.
+    int group_slot = -1;
+
+    // Under the lock of the LedStateInbox, with the lan sequencer state.
+    LanAuth lan_auth;
+
     MN8Context context;
     MN8StateMachine state_machine;
     QueueHandle_t message_queue;
@@ -6,15 +6,22 @@
 #include "esp_mac.h"
 #include "esp_vfs_fat.h"
 #include "esp_check.h"
+#include "esp_timer.h"
+
+static const char *TAG = "mn8_context";
 
 esp_err_t MN8Context::setup(void) {
     // get mac
     get_fuse_mac_address_string(this->mac_address);
 
     // If load fails it is because there is no information in NVS
+    // The first boot after an update also moves each one to its blob.
+    int64_t start = esp_timer_get_time();
     thing_config.load();
     site_config.load();
     charge_point_config.load();
+    this->config_load_us = esp_timer_get_time() - start;
+    ESP_LOGI(TAG, "Configuration loaded in %lld us", this->config_load_us);
 
     return ESP_OK;
 }
\ No newline at end of file
@@ -6,12 +6,17 @@
 #include "App/MqttAgent/MqttAgent.h"
 #include "App/MqttAgent/IotThing.h"
 #include "App/IotHeartbeat.h"
+#include "App/OtaPullAgent.h"
+#include "App/LedStateSequencer.h"
+#include "App/LedStateInbox.h"
 
 #include "App/Configuration/ThingConfig.h"
 #include "App/Configuration/ChargePointConfig.h"
 #include "App/Configuration/SiteConfig.h"
 
 #include "LED/LedTaskSpi.h"
+#include "LED/PixelStream.h"
+#include "LED/AnimationLibrary.h"
 
 class MN8Context : NoCopy {
 public:
@@ -28,13 +33,18 @@ public:
 
     inline LedTaskSpi& get_led_task_0(void) { return this->led_task_0; }
     inline LedTaskSpi& get_led_task_1(void) { return this->led_task_1; }
+    inline PixelStream& get_pixel_stream(void) { return this->pixel_stream; }
+    inline AnimationLibrary& get_animation_library(void) { return this->animation_library; }
 
     inline ThingConfig& get_thing_config(void) { return this->thing_config; }
     inline SiteConfig& get_site_config(void) { return this->site_config; }
     inline ChargePointConfig& get_charge_point_config(void) { return this->charge_point_config; }
 
     inline IotHeartbeat& get_iot_heartbeat(void) { return this->iot_heartbeat; }
+    inline OtaPullAgent& get_ota_pull_agent(void) { return this->ota_pull_agent; }
     inline IotThing& get_iot_thing(void) { return this->iot_thing; }
+    inline LedStateSequencer& get_ledstate_sequencer(void) { return this->ledstate_sequencer; }
+    inline LedStateInbox& get_ledstate_inbox(void) { return this->ledstate_inbox; }
 
     inline bool is_night_mode(void) { return this->night_mode; }
     inline void set_night_mode(bool night_mode) { this->night_mode = night_mode; }
@@ -43,6 +53,7 @@ public:
     inline void set_has_night_sensor(bool has_night_sensor) { this->night_sensor_present = has_night_sensor; }
 
     inline const char* get_mac_address(void) { return this->mac_address; }
+    inline int64_t get_config_load_us(void) const { return this->config_load_us; }
 
 private:
     NetworkConnectionAgent network_connection_agent;
@@ -54,12 +65,18 @@ private:
 
     LedTaskSpi led_task_0;
     LedTaskSpi led_task_1;
+    PixelStream pixel_stream;
+    AnimationLibrary animation_library;
 
     IotHeartbeat iot_heartbeat;
+    OtaPullAgent ota_pull_agent;
 
     IotThing iot_thing;
+    LedStateSequencer ledstate_sequencer;
+    LedStateInbox ledstate_inbox;
 
     char mac_address[13] = {0};
+    int64_t config_load_us = 0;
 
     bool night_mode = false;
     bool night_sensor_present = false;
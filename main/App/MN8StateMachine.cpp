@@ -2,6 +2,7 @@
 
 #include "mdns_broadcaster.h"
 #include "udp_server.h"
+#include "ddp_server.h"
 #include "web_server.h"
 
 #include "esp_log.h"
@@ -73,7 +74,8 @@ esp_err_t MN8StateMachine::setup(MN8Context *context)
 
     initialise_mdns();
     start_udp_server(this->context);
-    start_webserver();
+    start_ddp_server(this->context);
+    start_webserver(this->context);
 
     return ret;
 }
@@ -160,6 +162,8 @@ void MN8StateMachine::handle_event(mn8_event_t event)
         // We do not support transient state, therefore the returned state should
         // be the same as the next state.
         std::invoke(state_handler, this, event);
+
+        this->context->get_iot_heartbeat().record_state(this->get_current_state_name());
     }
     ESP_LOGI(TAG, "Handled event %d now in state %d", event, this->state);
 }
@@ -318,7 +322,7 @@ mn8_state_t MN8StateMachine::connected_state(mn8_event_t event)
     {
         ESP_LOGI(TAG, "Entering connected state");
         this->state = e_mn8_connected;
-        this->context->get_iot_heartbeat().send_heartbeat();
+        this->context->get_iot_heartbeat().request_heartbeat();
 
         // turn off breathing pattern, we will get a new one from the broker.
         this->context->get_led_task_0().set_state("waiting_4_first_state", 0);
@@ -0,0 +1,85 @@
+//******************************************************************************
+/**
+ * @file AckCoalescer.cpp
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief AckCoalescer class implementation
+ * @version 0.1
+ * @date 2024-02-14
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#include "AckCoalescer.h"
+
+//******************************************************************************
+/**
+ * @brief Add an ack.
+ *
+ * @param ack       The ack for the ledstate we just handled.
+ * @param now_ms    Current time.
+ * @param to_send   Set to the ack to send if we return true.
+ * @return true     The ack must be sent now.
+ * @return false    The ack is held until poll() says otherwise.
+ */
+bool AckCoalescer::add(const ledstate_ack_t& ack, uint64_t now_ms, ledstate_ack_t* to_send) {
+    if (!this->window_open || now_ms - this->window_start_ms >= this->window_ms) {
+        // If something was still held, the new ack supersedes it.
+        uint16_t count = this->pending ? this->pending_ack.count + 1 : 1;
+        if (this->pending) {
+            this->coalesced++;
+        }
+
+        this->pending = false;
+        this->window_open = true;
+        this->window_start_ms = now_ms;
+
+        *to_send = ack;
+        to_send->count = count;
+        return true;
+    }
+
+    if (this->pending) {
+        this->coalesced++;
+        uint16_t count = this->pending_ack.count;
+        this->pending_ack = ack;
+        this->pending_ack.count = count < UINT16_MAX ? count + 1 : count;
+    } else {
+        this->pending = true;
+        this->pending_ack = ack;
+        this->pending_ack.count = 1;
+    }
+
+    return false;
+}
+
+//******************************************************************************
+/**
+ * @brief Check if the held ack is due.
+ *
+ * @return true     to_send is set and must be sent.
+ */
+bool AckCoalescer::poll(uint64_t now_ms, ledstate_ack_t* to_send) {
+    if (!this->window_open || now_ms - this->window_start_ms < this->window_ms) {
+        return false;
+    }
+
+    if (!this->pending) {
+        this->window_open = false;
+        return false;
+    }
+
+    // Sending starts a new window, a burst that goes on keeps being coalesced.
+    *to_send = this->pending_ack;
+    this->pending = false;
+    this->window_start_ms = now_ms;
+    return true;
+}
+
+//******************************************************************************
+/**
+ * @brief Forget anything held, on disconnect.
+ */
+void AckCoalescer::reset(void) {
+    this->pending = false;
+    this->window_open = false;
+}
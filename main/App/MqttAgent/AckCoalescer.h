@@ -0,0 +1,73 @@
+//******************************************************************************
+/**
+ * @file AckCoalescer.h
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief AckCoalescer class definition
+ * @version 0.1
+ * @date 2024-02-14
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#pragma once
+
+#include "Utils/NoCopy.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define ACK_COALESCE_WINDOW_MS      (250)
+
+//******************************************************************************
+/**
+ * @brief A compact ledstate ack.
+ *
+ * Carries the seq of the ledstate when it had one, a hash of the payload
+ * otherwise, so the proxy can still tell which state we applied.
+ */
+typedef struct {
+    bool has_seq;
+    uint32_t id;            // seq, or hash of the payload
+    bool duplicate;         // the state was already applied
+    uint8_t encoding;       // payload_encoding_t of the ledstate
+    uint16_t count;         // number of ledstates this ack covers
+    bool group;             // the ledstate came on the group topic
+} ledstate_ack_t;
+
+//******************************************************************************
+/**
+ * @brief Coalesce ledstate acks over a short window.
+ *
+ * The first ack of a burst goes out right away.  Acks that come in during
+ * the following ACK_COALESCE_WINDOW_MS are held, only the newest one is kept,
+ * and it is sent when the window closes with the number of ledstates it
+ * covers.  A single ledstate is acked with no added latency.
+ *
+ * Time is passed in so this can be tested on the host.
+ *
+ * @note Not thread safe, used from the mqtt task only.
+ */
+class AckCoalescer : public NoCopy {
+public:
+    AckCoalescer(uint32_t window_ms = ACK_COALESCE_WINDOW_MS) : window_ms(window_ms) {}
+    ~AckCoalescer(void) = default;
+
+public:
+    bool add(const ledstate_ack_t& ack, uint64_t now_ms, ledstate_ack_t* to_send);
+    bool poll(uint64_t now_ms, ledstate_ack_t* to_send);
+    void reset(void);
+
+    inline bool has_pending(void) const { return this->pending; }
+    inline uint32_t get_coalesced(void) const { return this->coalesced; }
+
+private:
+    uint32_t window_ms;
+    bool window_open = false;
+    uint64_t window_start_ms = 0;
+
+    bool pending = false;
+    ledstate_ack_t pending_ack = {};
+
+    uint32_t coalesced = 0;
+};
@@ -0,0 +1,34 @@
+//******************************************************************************
+/**
+ * @file ConnectionStats.h
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief Broker connection counters
+ * @version 0.1
+ * @date 2024-02-22
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Kept out of MqttConnection.h so the heartbeat payload can be built without
+// esp_tls.
+typedef struct {
+    uint32_t attempts;
+    uint32_t dns_lookups;
+    uint32_t last_handshake_ms;     // tcp connect and tls handshake
+    bool last_session_offered;      // we tried to resume the last session
+} connection_stats_t;
+
+// Publishes to and from the broker, payload bytes.
+typedef struct {
+    uint32_t messages_in;
+    uint32_t bytes_in;
+    uint32_t messages_out;
+    uint32_t bytes_out;
+    uint32_t publish_failures;
+    uint32_t connects;              // sessions established, the first one included
+} mqtt_traffic_counters_t;
@@ -0,0 +1,58 @@
+//******************************************************************************
+/**
+ * @file EndpointCache.cpp
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief EndpointCache class implementation
+ * @version 0.1
+ * @date 2024-02-20
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#include "EndpointCache.h"
+
+#include <string.h>
+
+//******************************************************************************
+/**
+ * @brief Remember a freshly resolved address.
+ */
+void EndpointCache::store(const char* address, uint64_t now_ms) {
+    if (address == nullptr || strlen(address) >= sizeof(this->address)) {
+        return;
+    }
+
+    strcpy(this->address, address);
+    this->resolved_ms = now_ms;
+    this->expired = false;
+}
+
+//******************************************************************************
+/**
+ * @brief Get the cached address.
+ *
+ * @param allow_expired     Return the address even if it expired, as a
+ *                          fallback when dns fails.
+ * @return true             address is set.
+ */
+bool EndpointCache::get(uint64_t now_ms, bool allow_expired, char* address, size_t size) const {
+    if (!this->has_address() || size <= strlen(this->address)) {
+        return false;
+    }
+
+    bool valid = !this->expired && now_ms - this->resolved_ms < this->ttl_ms;
+    if (!valid && !allow_expired) {
+        return false;
+    }
+
+    strcpy(address, this->address);
+    return true;
+}
+
+//******************************************************************************
+/**
+ * @brief Resolve again next time, the address is kept as a fallback.
+ */
+void EndpointCache::expire(void) {
+    this->expired = true;
+}
@@ -0,0 +1,56 @@
+//******************************************************************************
+/**
+ * @file EndpointCache.h
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief EndpointCache class definition
+ * @version 0.1
+ * @date 2024-02-20
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#pragma once
+
+#include "Utils/NoCopy.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Room for an ipv6 address in text form.
+#define ENDPOINT_ADDRESS_MAX_LENGTH     (46)
+
+// lwip doesn't give us the dns ttl, the AWS IoT endpoints are stable enough
+// for an hour.
+#define ENDPOINT_CACHE_TTL_MS           (60 * 60 * 1000)
+
+//******************************************************************************
+/**
+ * @brief Last resolved address of the broker.
+ *
+ * Reconnects use the cached address and skip the dns lookup until the ttl
+ * runs out, or until a connection to it fails.  An expired address is kept
+ * as a fallback for when dns itself is down.
+ *
+ * Time is passed in so this can be tested on the host.
+ *
+ * @note Not thread safe, used from the mqtt task only.
+ */
+class EndpointCache : public NoCopy {
+public:
+    EndpointCache(uint32_t ttl_ms = ENDPOINT_CACHE_TTL_MS) : ttl_ms(ttl_ms) {}
+    ~EndpointCache(void) = default;
+
+public:
+    void store(const char* address, uint64_t now_ms);
+    bool get(uint64_t now_ms, bool allow_expired, char* address, size_t size) const;
+    void expire(void);
+
+    inline bool has_address(void) const { return this->address[0] != '\0'; }
+
+private:
+    uint32_t ttl_ms;
+    char address[ENDPOINT_ADDRESS_MAX_LENGTH] = {0};
+    uint64_t resolved_ms = 0;
+    bool expired = true;
+};
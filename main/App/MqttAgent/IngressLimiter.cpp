@@ -0,0 +1,112 @@
+//******************************************************************************
+/**
+ * @file IngressLimiter.cpp
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief IngressLimiter class implementation
+ * @version 0.1
+ * @date 2024-02-15
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#include "IngressLimiter.h"
+
+#include "esp_log.h"
+
+static const char* TAG = "ingress";
+
+typedef struct {
+    mqtt_topic_t topic;
+    uint16_t burst;
+    uint32_t refill_ms;
+} ingress_default_t;
+
+// Enough for the proxy and a human on the console, not for a storm.
+static const ingress_default_t ingress_defaults[] = {
+    { e_mqtt_topic_ping,        3,  2000 },
+    { e_mqtt_topic_set_config,  5,  1000 },
+    { e_mqtt_topic_get_config,  3,  2000 },
+    { e_mqtt_topic_reboot,      1, 60000 },
+    { e_mqtt_topic_ota,         3, 10000 },
+};
+
+//******************************************************************************
+IngressLimiter::IngressLimiter(void) {
+    for (int i = 0; i < MQTT_TOPIC_INBOUND_COUNT; i++) {
+        this->buckets[i] = {};
+    }
+
+    for (const auto& limit : ingress_defaults) {
+        this->set_limit(limit.topic, limit.burst, limit.refill_ms);
+    }
+}
+
+//******************************************************************************
+/**
+ * @brief Set the limit of a topic, its bucket starts full.
+ *
+ * @param burst         Publishes accepted back to back, 0 for no limit.
+ * @param refill_ms     Time to earn one publish back.
+ */
+void IngressLimiter::set_limit(mqtt_topic_t topic, uint16_t burst, uint32_t refill_ms) {
+    if (!MqttTopics::is_inbound(topic)) {
+        return;
+    }
+
+    bucket_t& bucket = this->buckets[topic - MQTT_TOPIC_FIRST_INBOUND];
+    bucket.burst = refill_ms == 0 ? 0 : burst;
+    bucket.refill_ms = refill_ms;
+    bucket.tokens = bucket.burst;
+    bucket.last_refill_ms = 0;
+}
+
+//******************************************************************************
+/**
+ * @brief Take a token for an inbound publish.
+ *
+ * @return true     The publish can be dispatched.
+ * @return false    The publish must be dropped.
+ */
+bool IngressLimiter::admit(mqtt_topic_t topic, uint64_t now_ms) {
+    if (!MqttTopics::is_inbound(topic)) {
+        return true;
+    }
+
+    int index = topic - MQTT_TOPIC_FIRST_INBOUND;
+    bucket_t& bucket = this->buckets[index];
+    if (bucket.burst == 0) {
+        this->counters.admitted++;
+        return true;
+    }
+
+    if (now_ms > bucket.last_refill_ms) {
+        uint64_t earned = (now_ms - bucket.last_refill_ms) / bucket.refill_ms;
+        if (bucket.tokens + earned >= bucket.burst) {
+            bucket.tokens = bucket.burst;
+            bucket.last_refill_ms = now_ms;
+        } else if (earned > 0) {
+            // Keep the remainder so a steady rate isn't rounded down.
+            bucket.tokens += earned;
+            bucket.last_refill_ms += earned * bucket.refill_ms;
+        }
+    }
+
+    if (bucket.tokens == 0) {
+        if (this->counters.throttled[index]++ == 0) {
+            ESP_LOGW(TAG, "Throttling %s", MqttTopics::get_suffix(topic));
+        }
+        return false;
+    }
+
+    bucket.tokens--;
+    this->counters.admitted++;
+    return true;
+}
+
+//******************************************************************************
+uint32_t IngressLimiter::get_throttled(mqtt_topic_t topic) const {
+    if (!MqttTopics::is_inbound(topic)) {
+        return 0;
+    }
+    return this->counters.throttled[topic - MQTT_TOPIC_FIRST_INBOUND];
+}
@@ -0,0 +1,65 @@
+//******************************************************************************
+/**
+ * @file IngressLimiter.h
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief IngressLimiter class definition
+ * @version 0.1
+ * @date 2024-02-15
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#pragma once
+
+#include "Utils/NoCopy.h"
+#include "App/MqttAgent/MqttTopics.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct {
+    uint32_t admitted;
+    uint32_t throttled[MQTT_TOPIC_INBOUND_COUNT];   // indexed from MQTT_TOPIC_FIRST_INBOUND
+} ingress_counters_t;
+
+//******************************************************************************
+/**
+ * @brief Token bucket per inbound topic.
+ *
+ * Each topic gets a bucket of `burst` tokens and earns one token back every
+ * `refill_ms`.  A publish that finds its bucket empty is dropped before it
+ * reaches the handler, so a proxy stuck re-publishing can't keep the mqtt
+ * task busy parsing, rebooting or answering pings.
+ *
+ * A burst of 0 means no limit.  The ledstate topics have no limit by default,
+ * dropping one could drop the newest state; MN8App coalesces them instead.
+ *
+ * Time is passed in so this can be tested on the host.
+ *
+ * @note admit() is called from the mqtt task only.  The counters are read
+ *       from the heartbeat task without locking, they are only telemetry.
+ */
+class IngressLimiter : public NoCopy {
+public:
+    IngressLimiter(void);
+    ~IngressLimiter(void) = default;
+
+public:
+    void set_limit(mqtt_topic_t topic, uint16_t burst, uint32_t refill_ms);
+    bool admit(mqtt_topic_t topic, uint64_t now_ms);
+
+    uint32_t get_throttled(mqtt_topic_t topic) const;
+    inline const ingress_counters_t& get_counters(void) const { return this->counters; }
+
+private:
+    typedef struct {
+        uint16_t burst;         // 0 for no limit
+        uint32_t refill_ms;
+        uint16_t tokens;
+        uint64_t last_refill_ms;
+    } bucket_t;
+
+    bucket_t buckets[MQTT_TOPIC_INBOUND_COUNT];
+    ingress_counters_t counters = {};
+};
@@ -0,0 +1,310 @@
+//******************************************************************************
+/**
+ * @file IotPayloads.cpp
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief Payloads published by the thing
+ * @version 0.1
+ * @date 2024-02-22
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#include "IotPayloads.h"
+#include "App/MqttAgent/MqttTopics.h"
+
+#include "Utils/MsgPack.h"
+
+#include "rev.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+
+//******************************************************************************
+/**
+ * @brief Append to a payload buffer.
+ *
+ * @return int  The new length, -1 once the buffer is full so that a chain of
+ *              appends only needs to be checked at the end.
+ */
+static int append_payload(char* buffer, size_t size, int length, const char* format, ...) {
+    if (length < 0) {
+        return length;
+    }
+
+    va_list args;
+    va_start(args, format);
+    int written = vsnprintf(buffer + length, size - length, format, args);
+    va_end(args);
+
+    if (written < 0 || written >= (int) size - length) {
+        return -1;
+    }
+    return length + written;
+}
+
+//******************************************************************************
+static esp_err_t finish_json(int written, size_t* length) {
+    if (written < 0) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    *length = (size_t) written;
+    return ESP_OK;
+}
+
+//******************************************************************************
+static esp_err_t finish_msgpack(const MsgPackWriter& writer, size_t* length) {
+    if (!writer.ok()) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    *length = writer.length();
+    return ESP_OK;
+}
+
+//******************************************************************************
+/**
+ * @brief The heartbeat.
+ *
+ * Carries the current state, the counters and the events collected since the
+ * last heartbeat, all in one message.  Only the topics that were throttled
+ * are reported.
+ */
+esp_err_t iot_payload_heartbeat(
+    payload_encoding_t encoding,
+    const heartbeat_info_t& info,
+    char* buffer, size_t size, size_t* length
+) {
+    const ledstate_counters_t& ledstate_counters = *info.ledstate_counters;
+    const ingress_counters_t& ingress_counters = *info.ingress_counters;
+    const TelemetryRing& telemetry = *info.telemetry;
+    const connection_stats_t& connection_stats = *info.connection_stats;
+
+    int throttled_topics = 0;
+    for (int i = 0; i < MQTT_TOPIC_INBOUND_COUNT; i++) {
+        if (ingress_counters.throttled[i] != 0) {
+            throttled_topics++;
+        }
+    }
+
+    if (encoding == e_payload_encoding_msgpack) {
+        MsgPackWriter writer((uint8_t*) buffer, size);
+        writer.map(11);
+        writer.str("version");
+        writer.str(VERSION_STRING);
+        writer.str("current_state");
+        writer.str(info.current_state);
+        writer.str("led1_state");
+        writer.str(info.led1_state);
+        writer.str("led2_state");
+        writer.str(info.led2_state);
+        writer.str("night_mode");
+        writer.boolean(info.night_mode);
+        writer.str("has_night_sensor");
+        writer.boolean(info.has_night_sensor);
+        writer.str("ledstate");
+        writer.map(4);
+        writer.str("applied");
+        writer.integer(ledstate_counters.applied);
+        writer.str("stale");
+        writer.integer(ledstate_counters.dropped_stale);
+        writer.str("duplicate");
+        writer.integer(ledstate_counters.dropped_duplicate);
+        writer.str("coalesced");
+        writer.integer(ledstate_counters.coalesced);
+        writer.str("throttled");
+        writer.map(throttled_topics);
+        for (int i = 0; i < MQTT_TOPIC_INBOUND_COUNT; i++) {
+            if (ingress_counters.throttled[i] != 0) {
+                writer.str(MqttTopics::get_suffix((mqtt_topic_t)(MQTT_TOPIC_FIRST_INBOUND + i)));
+                writer.integer(ingress_counters.throttled[i]);
+            }
+        }
+        writer.str("events");
+        writer.array(telemetry.size());
+        for (size_t i = 0; i < telemetry.size(); i++) {
+            const telemetry_event_t& event = telemetry.at(i);
+            writer.map(2);
+            writer.str("t");
+            writer.integer(event.time_s);
+            if (event.type == e_telemetry_state) {
+                writer.str("state");
+                writer.str(event.name);
+            } else {
+                writer.str(event.name);
+                writer.boolean(event.value != 0);
+            }
+        }
+        writer.str("events_dropped");
+        writer.integer(telemetry.get_dropped());
+        writer.str("tls");
+        writer.map(4);
+        writer.str("attempts");
+        writer.integer(connection_stats.attempts);
+        writer.str("dns");
+        writer.integer(connection_stats.dns_lookups);
+        writer.str("handshake_ms");
+        writer.integer(connection_stats.last_handshake_ms);
+        writer.str("resume_offered");
+        writer.boolean(connection_stats.last_session_offered);
+
+        return finish_msgpack(writer, length);
+    }
+
+    int written = append_payload(buffer, size, 0,
+        R"({"version":"%d.%d.%d","current_state":"%s","led1_state":"%s","led2_state":"%s","night_mode":%s,"has_night_sensor":%s,)"
+        R"("ledstate":{"applied":%lu,"stale":%lu,"duplicate":%lu,"coalesced":%lu},"throttled":{)",
+        VERSION_MAJOR, VERSION_MINOR, VERSION_PATCH,
+        info.current_state,
+        info.led1_state,
+        info.led2_state,
+        info.night_mode ? "true" : "false",
+        info.has_night_sensor ? "true" : "false",
+        (unsigned long) ledstate_counters.applied,
+        (unsigned long) ledstate_counters.dropped_stale,
+        (unsigned long) ledstate_counters.dropped_duplicate,
+        (unsigned long) ledstate_counters.coalesced
+    );
+
+    const char* separator = "";
+    for (int i = 0; i < MQTT_TOPIC_INBOUND_COUNT; i++) {
+        if (ingress_counters.throttled[i] != 0) {
+            written = append_payload(buffer, size, written, R"(%s"%s":%lu)",
+                separator,
+                MqttTopics::get_suffix((mqtt_topic_t)(MQTT_TOPIC_FIRST_INBOUND + i)),
+                (unsigned long) ingress_counters.throttled[i]
+            );
+            separator = ",";
+        }
+    }
+
+    written = append_payload(buffer, size, written, R"(},"events":[)");
+    for (size_t i = 0; i < telemetry.size(); i++) {
+        const telemetry_event_t& event = telemetry.at(i);
+        if (event.type == e_telemetry_state) {
+            written = append_payload(buffer, size, written, R"(%s{"t":%lu,"state":"%s"})",
+                i == 0 ? "" : ",", (unsigned long) event.time_s, event.name);
+        } else {
+            written = append_payload(buffer, size, written, R"(%s{"t":%lu,"%s":%s})",
+                i == 0 ? "" : ",", (unsigned long) event.time_s, event.name, event.value ? "true" : "false");
+        }
+    }
+    written = append_payload(buffer, size, written, R"(],"events_dropped":%lu,)", (unsigned long) telemetry.get_dropped());
+    written = append_payload(buffer, size, written, R"("tls":{"attempts":%lu,"dns":%lu,"handshake_ms":%lu,"resume_offered":%s}})",
+        (unsigned long) connection_stats.attempts,
+        (unsigned long) connection_stats.dns_lookups,
+        (unsigned long) connection_stats.last_handshake_ms,
+        connection_stats.last_session_offered ? "true" : "false"
+    );
+
+    return finish_json(written, length);
+}
+
+//******************************************************************************
+/**
+ * @brief A compact ledstate ack, the seq or the payload hash and a count.
+ *
+ * Group ledstates are flagged, their seq is not the one of the thing topic.
+ */
+esp_err_t iot_payload_compact_ack(
+    const ledstate_ack_t& ack,
+    char* buffer, size_t size, size_t* length
+) {
+    if (ack.encoding == e_payload_encoding_msgpack) {
+        MsgPackWriter writer((uint8_t*) buffer, size);
+        writer.map(2 + (ack.duplicate ? 1 : 0) + (ack.group ? 1 : 0));
+        if (ack.has_seq) {
+            writer.str("seq");
+            writer.integer(ack.id);
+        } else {
+            char hash[9];
+            snprintf(hash, sizeof(hash), "%08lx", (unsigned long) ack.id);
+            writer.str("hash");
+            writer.str(hash, 8);
+        }
+        writer.str("count");
+        writer.integer(ack.count);
+        if (ack.duplicate) {
+            writer.str("dup");
+            writer.boolean(true);
+        }
+        if (ack.group) {
+            writer.str("group");
+            writer.boolean(true);
+        }
+        return finish_msgpack(writer, length);
+    }
+
+    int written = append_payload(buffer, size, 0,
+        ack.has_seq ? R"({"seq":%lu,"count":%u%s%s})" : R"({"hash":"%08lx","count":%u%s%s})",
+        (unsigned long) ack.id,
+        ack.count,
+        ack.duplicate ? R"(,"dup":true)" : "",
+        ack.group ? R"(,"group":true)" : ""
+    );
+    return finish_json(written, length);
+}
+
+//******************************************************************************
+/**
+ * @brief Ack of a ledstate we already had, in full ack mode.
+ */
+esp_err_t iot_payload_duplicate_ack(
+    uint32_t seq,
+    payload_encoding_t encoding,
+    char* buffer, size_t size, size_t* length
+) {
+    if (encoding == e_payload_encoding_msgpack) {
+        MsgPackWriter writer((uint8_t*) buffer, size);
+        writer.map(2);
+        writer.str("seq");
+        writer.integer(seq);
+        writer.str("dup");
+        writer.boolean(true);
+        return finish_msgpack(writer, length);
+    }
+
+    int written = append_payload(buffer, size, 0, R"({"seq":%lu,"dup":true})", (unsigned long) seq);
+    return finish_json(written, length);
+}
+
+//******************************************************************************
+esp_err_t iot_payload_pong(
+    const char* current_state,
+    const char* led1_state,
+    const char* led2_state,
+    bool night_mode,
+    bool has_night_sensor,
+    char* buffer, size_t size, size_t* length
+) {
+    int written = append_payload(buffer, size, 0,
+        R"({"version":"%d.%d.%d","current_state":"%s","led1_state":"%s","led2_state":"%s","night_mode":%s,"has_night_sensor":%s})",
+        VERSION_MAJOR, VERSION_MINOR, VERSION_PATCH,
+        current_state,
+        led1_state,
+        led2_state,
+        night_mode ? "true" : "false",
+        has_night_sensor ? "true" : "false"
+    );
+    return finish_json(written, length);
+}
+
+//******************************************************************************
+/**
+ * @brief Register both leds with the proxy of the group.
+ */
+esp_err_t iot_payload_register_station(
+    const char* thing_id,
+    const char* group_id,
+    uint8_t port_number_1, const char* station_id_1,
+    uint8_t port_number_2, const char* station_id_2,
+    char* buffer, size_t size, size_t* length
+) {
+    int written = append_payload(buffer, size, 0,
+        R"({"thing_id":"%s","group_id":"%s","leds":[)"
+        R"({"port":%d,"station":"%s","led":0,"last_state":"unknown","last_charge":0},)"
+        R"({"port":%d,"station":"%s","led":1,"last_state":"unknown","last_charge":0}]})",
+        thing_id, group_id,
+        port_number_1, station_id_1,
+        port_number_2, station_id_2
+    );
+    return finish_json(written, length);
+}
@@ -0,0 +1,94 @@
+//******************************************************************************
+/**
+ * @file IotPayloads.h
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief Payloads published by the thing
+ * @version 0.1
+ * @date 2024-02-22
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#pragma once
+
+#include "App/LedStateSequencer.h"
+#include "App/TelemetryRing.h"
+#include "App/MqttAgent/AckCoalescer.h"
+#include "App/MqttAgent/IngressLimiter.h"
+#include "App/MqttAgent/ConnectionStats.h"
+
+#include "esp_err.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+//******************************************************************************
+/**
+ * @brief Encoding of the ledstate, ack and heartbeat payloads.
+ *
+ * Json is the default.  MessagePack goes on the "/mp" topics.
+ */
+typedef enum {
+    e_payload_encoding_json,
+    e_payload_encoding_msgpack,
+} payload_encoding_t;
+
+//******************************************************************************
+/**
+ * @brief Everything that goes in a heartbeat.
+ */
+typedef struct {
+    const char* current_state;
+    const char* led1_state;
+    const char* led2_state;
+    bool night_mode;
+    bool has_night_sensor;
+    const ledstate_counters_t* ledstate_counters;
+    const ingress_counters_t* ingress_counters;
+    const TelemetryRing* telemetry;
+    const connection_stats_t* connection_stats;
+} heartbeat_info_t;
+
+//******************************************************************************
+// Payload builders.
+//
+// IotThing publishes what these produce, the fleet simulator (main/host) uses
+// them too so its load is byte for byte what the controllers send.  They
+// write into the caller's buffer, set length, and return
+// ESP_ERR_INVALID_SIZE if the payload does not fit.
+//******************************************************************************
+
+esp_err_t iot_payload_heartbeat(
+    payload_encoding_t encoding,
+    const heartbeat_info_t& info,
+    char* buffer, size_t size, size_t* length
+);
+
+esp_err_t iot_payload_compact_ack(
+    const ledstate_ack_t& ack,
+    char* buffer, size_t size, size_t* length
+);
+
+esp_err_t iot_payload_duplicate_ack(
+    uint32_t seq,
+    payload_encoding_t encoding,
+    char* buffer, size_t size, size_t* length
+);
+
+esp_err_t iot_payload_pong(
+    const char* current_state,
+    const char* led1_state,
+    const char* led2_state,
+    bool night_mode,
+    bool has_night_sensor,
+    char* buffer, size_t size, size_t* length
+);
+
+esp_err_t iot_payload_register_station(
+    const char* thing_id,
+    const char* group_id,
+    uint8_t port_number_1, const char* station_id_1,
+    uint8_t port_number_2, const char* station_id_2,
+    char* buffer, size_t size, size_t* length
+);
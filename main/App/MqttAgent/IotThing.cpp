@@ -4,8 +4,8 @@
 #include "App/MqttAgent/MqttAgent.h"
 
 #include "Utils/FuseMacAddress.h"
-
-#include "rev.h"
+#include "Utils/KeyStore.h"
+#include "Utils/Time.h"
 
 #include "esp_check.h"
 #include "esp_err.h"
@@ -18,81 +18,271 @@
 
 static const char* TAG = "iot_thing";
 
-static char topic[64] = {0};
-static char payload[4096] = {0};
 
 
 esp_err_t IotThing::setup(ThingConfig* thing_config, MqttAgent* mqtt_agent) {
     this->mqtt_agent = mqtt_agent;
     this->thing_config = thing_config;
 
+    // The fuse never changes, read it once.
+    get_fuse_mac_address_string(this->mac_address);
+
+    uint8_t encoding = e_payload_encoding_json;
+    KeyStore key_store;
+    key_store.openKeyStore("config", e_ro);
+    if (key_store.getKeyValue("encoding", encoding) == ESP_OK && encoding <= e_payload_encoding_msgpack) {
+        this->encoding = (payload_encoding_t) encoding;
+    }
+
+    uint8_t ack_mode = e_ack_mode_compact;
+    if (key_store.getKeyValue("ack_mode", ack_mode) == ESP_OK && ack_mode <= e_ack_mode_full) {
+        this->ack_mode = (ack_mode_t) ack_mode;
+    }
+
     return ESP_OK;
 }
 
-esp_err_t IotThing::send_night_mode(bool night_mode) {
-    ESP_LOGI(TAG, "Sending light sensor reading");
+//******************************************************************************
+/**
+ * @brief Set and persist the encoding used for the heartbeat.
+ * 
+ * Acks always go back in the encoding of the ledstate they acknowledge.
+ */
+esp_err_t IotThing::set_encoding(payload_encoding_t encoding) {
+    esp_err_t ret = ESP_OK;
+    KeyStore key_store;
+
+    ESP_GOTO_ON_ERROR(key_store.openKeyStore("config", e_rw), err, TAG, "Failed to open config key store");
+    ESP_GOTO_ON_ERROR(key_store.setKeyValue("encoding", (uint8_t) encoding), err, TAG, "Failed to save encoding");
+    this->encoding = encoding;
+
+err:
+    return ret;
+}
 
-    char mac_address[13] = {0};
-    get_fuse_mac_address_string(mac_address);
+//******************************************************************************
+esp_err_t IotThing::set_ack_mode(ack_mode_t ack_mode) {
+    esp_err_t ret = ESP_OK;
+    KeyStore key_store;
 
-    memset(topic, 0, sizeof(topic));
-    memset(payload, 0, sizeof(payload));
-    snprintf((char *) topic, sizeof(topic), "%s/light_sensor", mac_address);
-    snprintf((char *) payload, sizeof(payload), 
-      R"({
-        "night_mode": %s
-      })", 
-      night_mode ? "true" : "false"
-    );
+    ESP_GOTO_ON_ERROR(key_store.openKeyStore("config", e_rw), err, TAG, "Failed to open config key store");
+    ESP_GOTO_ON_ERROR(key_store.setKeyValue("ack_mode", (uint8_t) ack_mode), err, TAG, "Failed to save ack mode");
+    this->ack_mode = ack_mode;
+    this->ack_coalescer.reset();
 
-    return this->mqtt_agent->publish_message(topic, payload, 3);
+err:
+    return ret;
 }
 
+//******************************************************************************
+const char* IotThing::ack_mode_to_string(ack_mode_t ack_mode) {
+    return ack_mode == e_ack_mode_full ? "full" : "compact";
+}
+
+//******************************************************************************
+esp_err_t IotThing::ack_mode_from_string(const char* name, ack_mode_t& ack_mode) {
+    if (name == nullptr) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (strcmp(name, "compact") == 0) {
+        ack_mode = e_ack_mode_compact;
+    } else if (strcmp(name, "full") == 0) {
+        ack_mode = e_ack_mode_full;
+    } else {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    return ESP_OK;
+}
+
+//******************************************************************************
+const char* IotThing::encoding_to_string(payload_encoding_t encoding) {
+    return encoding == e_payload_encoding_msgpack ? "msgpack" : "json";
+}
+
+//******************************************************************************
+esp_err_t IotThing::encoding_from_string(const char* name, payload_encoding_t& encoding) {
+    if (name == nullptr) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (strcmp(name, "json") == 0) {
+        encoding = e_payload_encoding_json;
+    } else if (strcmp(name, "msgpack") == 0) {
+        encoding = e_payload_encoding_msgpack;
+    } else {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    return ESP_OK;
+}
+
+//******************************************************************************
+/**
+ * @brief Send the heartbeat, see iot_payload_heartbeat.
+ */
 esp_err_t IotThing::send_heartbeat(
     const char* current_state,
     const char* led1_state,
     const char* led2_state,
     bool night_mode,
-    bool has_night_sensor
+    bool has_night_sensor,
+    const ledstate_counters_t& ledstate_counters,
+    const ingress_counters_t& ingress_counters,
+    const TelemetryRing& telemetry,
+    const connection_stats_t& connection_stats
 ) {
-    ESP_LOGI(TAG, "Sending heartbeat");
-
-    char mac_address[13] = {0};
-    get_fuse_mac_address_string(mac_address);
-
-    memset(topic, 0, sizeof(topic));
-    memset(payload, 0, sizeof(payload));
-    snprintf((char *) topic, sizeof(topic), "%s/heartbeat", mac_address);
-    snprintf((char *) payload, sizeof(payload), 
-        R"({
-            "version":"%d.%d.%d",
-            "current_state":"%s",
-            "led1_state":"%s",
-            "led2_state":"%s",
-            "night_mode": %s,
-            "has_night_sensor": %s
-        })", 
-        VERSION_MAJOR, VERSION_MINOR, VERSION_PATCH,
-        current_state,
-        led1_state,
-        led2_state,
-        night_mode ? "true" : "false",
-        has_night_sensor ? "true" : "false"
+    ESP_LOGI(TAG, "Sending heartbeat, %d events", telemetry.size());
+
+    heartbeat_info_t info = {};
+    info.current_state = current_state;
+    info.led1_state = led1_state;
+    info.led2_state = led2_state;
+    info.night_mode = night_mode;
+    info.has_night_sensor = has_night_sensor;
+    info.ledstate_counters = &ledstate_counters;
+    info.ingress_counters = &ingress_counters;
+    info.telemetry = &telemetry;
+    info.connection_stats = &connection_stats;
+
+    size_t length = 0;
+    if (iot_payload_heartbeat(this->encoding, info, this->payload, sizeof(this->payload), &length) != ESP_OK) {
+        ESP_LOGE(TAG, "Heartbeat does not fit");
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    return this->mqtt_agent->publish_message(
+        this->encoding == e_payload_encoding_msgpack ? e_mqtt_topic_heartbeat_mp : e_mqtt_topic_heartbeat,
+        this->payload, length, 3
     );
+}
 
-    return this->mqtt_agent->publish_message(topic, payload, 3);
+//******************************************************************************
+/**
+ * @brief Ack a ledstate.
+ * 
+ * @param received_payload  The ledstate as received, echoed in full mode.
+ * @param message           The parsed ledstate.
+ * @param duplicate         The ledstate didn't change anything.
+ * @param encoding          Encoding of the ledstate, the ack uses the same.
+ */
+esp_err_t IotThing::ack_led_state(
+    const char* received_payload,
+    size_t received_payload_length,
+    const ledstate_message_t& message,
+    bool duplicate,
+    payload_encoding_t encoding
+) {
+    if (this->ack_mode == e_ack_mode_full) {
+        if (duplicate && message.has_seq) {
+            return this->ack_led_state_duplicate(message.seq, encoding);
+        }
+        return this->ack_led_state_change(received_payload, received_payload_length, encoding);
+    }
+
+    ledstate_ack_t ack = {};
+    ack.has_seq = message.has_seq;
+    ack.id = message.has_seq ? message.seq : MqttTopics::hash(received_payload, received_payload_length);
+    ack.duplicate = duplicate;
+    ack.encoding = encoding;
+
+    ledstate_ack_t to_send;
+    if (!this->ack_coalescer.add(ack, Time::instance().upTimeMS(), &to_send)) {
+        ESP_LOGD(TAG, "Holding ack for led state change");
+        return ESP_OK;
+    }
+
+    return this->send_compact_ack(to_send);
 }
 
-esp_err_t IotThing::ack_led_state_change(const char* received_payload) {
-    ESP_LOGI(TAG, "Sending ack for led state change");
+//******************************************************************************
+/**
+ * @brief Ack a group ledstate.
+ *
+ * Always compact, echoing a message meant for a whole site would send it
+ * back once per device.  Not coalesced either, the coalescer keeps only the
+ * newest ack and a group seq would hide the thing seq, or the other way
+ * around.
+ */
+esp_err_t IotThing::ack_group_led_state(
+    const char* received_payload,
+    size_t received_payload_length,
+    const ledstate_message_t& message,
+    bool duplicate
+) {
+    ledstate_ack_t ack = {};
+    ack.has_seq = message.has_seq;
+    ack.id = message.has_seq ? message.seq : MqttTopics::hash(received_payload, received_payload_length);
+    ack.duplicate = duplicate;
+    ack.encoding = e_payload_encoding_json;
+    ack.count = 1;
+    ack.group = true;
+
+    return this->send_compact_ack(ack);
+}
+
+//******************************************************************************
+/**
+ * @brief Send the held ack once its coalescing window is over.
+ * 
+ * Called from the mqtt task after each pass of the mqtt loop.
+ */
+esp_err_t IotThing::flush_acks(void) {
+    ledstate_ack_t to_send;
+    if (!this->ack_coalescer.poll(Time::instance().upTimeMS(), &to_send)) {
+        return ESP_OK;
+    }
+
+    return this->send_compact_ack(to_send);
+}
+
+//******************************************************************************
+esp_err_t IotThing::send_compact_ack(const ledstate_ack_t& ack) {
+    ESP_LOGI(TAG, "Sending compact ack for %u led state change(s)", ack.count);
+
+    size_t length = 0;
+    if (iot_payload_compact_ack(ack, this->payload, sizeof(this->payload), &length) != ESP_OK) {
+        ESP_LOGE(TAG, "Ack does not fit");
+        return ESP_ERR_INVALID_SIZE;
+    }
+    return this->mqtt_agent->publish_message(
+        ack.encoding == e_payload_encoding_msgpack ? e_mqtt_topic_ack_ledstate_mp : e_mqtt_topic_ack_ledstate,
+        this->payload, length, 3
+    );
+}
 
-    char mac_address[13] = {0};
-    get_fuse_mac_address_string(mac_address);
+esp_err_t IotThing::ack_led_state_change(
+    const char* received_payload,
+    size_t received_payload_length,
+    payload_encoding_t encoding
+) {
+    ESP_LOGI(TAG, "Sending ack for led state change");
 
-    memset(topic, 0, sizeof(topic));
-    snprintf((char *) topic, sizeof(topic), "%s/ack_ledstate", mac_address);
+    // Echo the payload straight from the mqtt receive buffer, on the topic
+    // matching the encoding it came in.
+    return this->mqtt_agent->publish_message(
+        encoding == e_payload_encoding_msgpack ? e_mqtt_topic_ack_ledstate_mp : e_mqtt_topic_ack_ledstate,
+        received_payload, received_payload_length, 3
+    );
+}
 
-    return this->mqtt_agent->publish_message(topic, received_payload, 3);
+//******************************************************************************
+/**
+ * @brief Ack a ledstate we already had, only the seq goes back.
+ */
+esp_err_t IotThing::ack_led_state_duplicate(uint32_t seq, payload_encoding_t encoding) {
+    ESP_LOGI(TAG, "Sending ack for duplicate led state %lu", (unsigned long) seq);
+
+    size_t length = 0;
+    if (iot_payload_duplicate_ack(seq, encoding, this->payload, sizeof(this->payload), &length) != ESP_OK) {
+        ESP_LOGE(TAG, "Ack does not fit");
+        return ESP_ERR_INVALID_SIZE;
+    }
+    return this->mqtt_agent->publish_message(
+        encoding == e_payload_encoding_msgpack ? e_mqtt_topic_ack_ledstate_mp : e_mqtt_topic_ack_ledstate,
+        this->payload, length, 3
+    );
 }
 
 esp_err_t IotThing::send_pong(
@@ -104,123 +294,76 @@ esp_err_t IotThing::send_pong(
 ) {
     ESP_LOGI(TAG, "Sending pong");
 
-    char mac_address[13] = {0};
-    get_fuse_mac_address_string(mac_address);
-
-    memset(topic, 0, sizeof(topic));
-    memset(payload, 0, sizeof(payload));
-    snprintf((char *) topic, sizeof(topic), "%s/pong", mac_address);
-    snprintf((char *) payload, sizeof(payload), 
-        R"({
-            "version":"%d.%d.%d",
-            "current_state":"%s",
-            "led1_state":"%s",
-            "led2_state":"%s",
-            "night_mode": %s,
-            "has_night_sensor": %s
-        })", 
-        VERSION_MAJOR, VERSION_MINOR, VERSION_PATCH,
-        current_state,
-        led1_state,
-        led2_state,
-        night_mode ? "true" : "false",
-        has_night_sensor ? "true" : "false"
-    );
-
-    return this->mqtt_agent->publish_message(topic, payload, 3);
+    size_t length = 0;
+    if (iot_payload_pong(current_state, led1_state, led2_state, night_mode, has_night_sensor, this->payload, sizeof(this->payload), &length) != ESP_OK) {
+        ESP_LOGE(TAG, "Pong does not fit");
+        return ESP_ERR_INVALID_SIZE;
+    }
+    return this->mqtt_agent->publish_message(e_mqtt_topic_pong, this->payload, length, 3);
 }
 
 esp_err_t IotThing::force_refresh_proxy(ChargePointConfig* cp_config) {
     ESP_LOGI(TAG, "Sending refresh to proxy");
 
-    char mac_address[13] = {0};
-    get_fuse_mac_address_string(mac_address);
-
-    memset(topic, 0, sizeof(topic));
-    memset(payload, 0, sizeof(payload));
-    snprintf((char *)topic, 64, "%s/refresh", cp_config->get_group_id());
-    snprintf((char *) payload, sizeof(payload), 
-        R"({
-            "thing_id":"%s"
-        })", 
-        mac_address
+    memset(this->topic, 0, sizeof(this->topic));
+    memset(this->payload, 0, sizeof(this->payload));
+    snprintf((char *)this->topic, 64, "%s/refresh", cp_config->get_group_id());
+    snprintf((char *) this->payload, sizeof(this->payload), 
+        R"({"thing_id":"%s"})",
+        this->mac_address
     );
 
-    return this->mqtt_agent->publish_message(topic, payload, 3);
+    return this->mqtt_agent->publish_message(this->topic, this->payload, 3);
 }
 
 esp_err_t IotThing::request_latest_from_proxy(ChargePointConfig* cp_config) {
     ESP_LOGI(TAG, "Sending request latest from proxy");
 
-    char mac_address[13] = {0};
-    get_fuse_mac_address_string(mac_address);
-
-    memset(topic, 0, sizeof(topic));
-    memset(payload, 0, sizeof(payload));
-    snprintf((char *)topic, 64, "%s/latest", mac_address);
-    snprintf((char *) payload, sizeof(payload), "{}");
+    memset(this->payload, 0, sizeof(this->payload));
+    snprintf((char *) this->payload, sizeof(this->payload), "{}");
 
-    return this->mqtt_agent->publish_message(topic, payload, 3);
+    return this->mqtt_agent->publish_message(e_mqtt_topic_latest, this->payload, 3);
 }
 
 esp_err_t IotThing::register_cp_station(ChargePointConfig* cp_config) {
     ESP_LOGI(TAG, "Sending cp provision");
 
-    char mac_address[13] = {0};
-    get_fuse_mac_address_string(mac_address);
-
     uint8_t port_number_1 = 0;
     const char* station_id_1 = cp_config->get_led_1_station_id(port_number_1);
 
     uint8_t port_number_2 = 0;
     const char* station_id_2 = cp_config->get_led_2_station_id(port_number_2);
 
-    memset(topic, 0, sizeof(topic));
-    memset(payload, 0, sizeof(payload));
-    snprintf((char *)topic, 64, "%s/register_station", cp_config->get_group_id());
-    snprintf((char *) payload, sizeof(payload), 
-        R"({
-            "thing_id":"%s",
-            "group_id":"%s",
-            "leds": [{
-                "port": %d,
-                "station": "%s",
-                "led": 0,
-                "last_state": "unknown",
-                "last_charge": 0
-            },{
-                "port": %d,
-                "station": "%s",
-                "led": 1,
-                "last_state": "unknown",
-                "last_charge": 0
-            }]
-        })",
-        mac_address, cp_config->get_group_id(),
+    memset(this->topic, 0, sizeof(this->topic));
+    memset(this->payload, 0, sizeof(this->payload));
+    snprintf((char *)this->topic, 64, "%s/register_station", cp_config->get_group_id());
+
+    size_t length = 0;
+    esp_err_t ret = iot_payload_register_station(
+        this->mac_address, cp_config->get_group_id(),
         port_number_1, station_id_1,
-        port_number_2, station_id_2
+        port_number_2, station_id_2,
+        this->payload, sizeof(this->payload), &length
     );
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Registration does not fit");
+        return ret;
+    }
 
-    return this->mqtt_agent->publish_message(topic, payload, 3);
+    return this->mqtt_agent->publish_message(this->topic, this->payload, 3);
 }
 
 esp_err_t IotThing::unregister_cp_station(ChargePointConfig* cp_config) {
     ESP_LOGI(TAG, "Sending cp unprovisioned");
 
-    char mac_address[13] = {0};
-    get_fuse_mac_address_string(mac_address);
-
-    memset(topic, 0, sizeof(topic));
-    memset(payload, 0, sizeof(payload));
-    snprintf((char *) topic, sizeof(topic), "%s/unregister_station", cp_config->is_configured() ? cp_config->get_group_id(): "unknown");
-    snprintf((char *) payload, sizeof(payload), 
-        R"({
-            "thing_id":"%s",
-            "group_id":"%s"
-        })", 
-        mac_address,
+    memset(this->topic, 0, sizeof(this->topic));
+    memset(this->payload, 0, sizeof(this->payload));
+    snprintf((char *) this->topic, sizeof(this->topic), "%s/unregister_station", cp_config->is_configured() ? cp_config->get_group_id(): "unknown");
+    snprintf((char *) this->payload, sizeof(this->payload), 
+        R"({"thing_id":"%s","group_id":"%s"})",
+        this->mac_address,
         cp_config->is_configured() ? cp_config->get_group_id(): "unknown"
     );
 
-    return this->mqtt_agent->publish_message(topic, payload, 3);
+    return this->mqtt_agent->publish_message(this->topic, this->payload, 3);
 }
\ No newline at end of file
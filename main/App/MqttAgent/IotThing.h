@@ -1,8 +1,28 @@
 #pragma once
 
 #include "Utils/NoCopy.h"
+#include "App/LedStateSequencer.h"
+#include "App/TelemetryRing.h"
+#include "App/MqttAgent/AckCoalescer.h"
+#include "App/MqttAgent/IngressLimiter.h"
+#include "App/MqttAgent/IotPayloads.h"
+#include "App/MqttAgent/MqttConnection.h"
 #include "esp_err.h"
 #include <stdbool.h>
+#include <stddef.h>
+
+//******************************************************************************
+/**
+ * @brief How ledstate messages are acked.
+ * 
+ * Compact acks carry the seq, or a hash of the payload, and are coalesced
+ * when ledstates come in bursts.  Full acks echo the whole payload back for
+ * proxies that need it.
+ */
+typedef enum {
+    e_ack_mode_compact,
+    e_ack_mode_full,
+} ack_mode_t;
 
 class ThingConfig;
 class MqttAgent;
@@ -15,15 +35,32 @@ class IotThing : public NoCopy {
 
     public:
         esp_err_t setup(ThingConfig* thing_config, MqttAgent* mqtt_agent);
-        esp_err_t send_night_mode(bool night_mode);
         esp_err_t send_heartbeat(
             const char* current_state,
             const char* led1_state,
             const char* led2_state,
             bool night_mode,
-            bool has_night_sensor
+            bool has_night_sensor,
+            const ledstate_counters_t& ledstate_counters,
+            const ingress_counters_t& ingress_counters,
+            const TelemetryRing& telemetry,
+            const connection_stats_t& connection_stats
+        );
+        esp_err_t ack_led_state(
+            const char* received_payload,
+            size_t received_payload_length,
+            const ledstate_message_t& message,
+            bool duplicate,
+            payload_encoding_t encoding
         );
-        esp_err_t ack_led_state_change(const char* received_payload);
+        esp_err_t ack_group_led_state(
+            const char* received_payload,
+            size_t received_payload_length,
+            const ledstate_message_t& message,
+            bool duplicate
+        );
+        esp_err_t flush_acks(void);
+        inline void reset_acks(void) { this->ack_coalescer.reset(); }
         esp_err_t send_pong(
             const char* current_state,
             const char* led1_state,
@@ -37,7 +74,38 @@ class IotThing : public NoCopy {
         esp_err_t register_cp_station(ChargePointConfig* cp_config);
         esp_err_t unregister_cp_station(ChargePointConfig* cp_config);
 
+        inline payload_encoding_t get_encoding(void) const { return this->encoding; }
+        esp_err_t set_encoding(payload_encoding_t encoding);
+
+        static const char* encoding_to_string(payload_encoding_t encoding);
+        static esp_err_t encoding_from_string(const char* name, payload_encoding_t& encoding);
+
+        inline ack_mode_t get_ack_mode(void) const { return this->ack_mode; }
+        esp_err_t set_ack_mode(ack_mode_t ack_mode);
+        inline uint32_t get_acks_coalesced(void) const { return this->ack_coalescer.get_coalesced(); }
+
+        static const char* ack_mode_to_string(ack_mode_t ack_mode);
+        static esp_err_t ack_mode_from_string(const char* name, ack_mode_t& ack_mode);
+
+    private:
+        esp_err_t ack_led_state_change(
+            const char* received_payload,
+            size_t received_payload_length,
+            payload_encoding_t encoding
+        );
+        esp_err_t ack_led_state_duplicate(uint32_t seq, payload_encoding_t encoding);
+        esp_err_t send_compact_ack(const ledstate_ack_t& ack);
+
     private:
         ThingConfig* thing_config = nullptr;
         MqttAgent* mqtt_agent = nullptr;
+        char mac_address[13] = {0};
+        payload_encoding_t encoding = e_payload_encoding_json;
+        ack_mode_t ack_mode = e_ack_mode_compact;
+        AckCoalescer ack_coalescer;
+
+        // Where the outbound messages are built, one per thing so the host
+        // tools can run many.
+        char topic[64] = {0};
+        char payload[4096] = {0};
 };
\ No newline at end of file
@@ -0,0 +1,924 @@
+//******************************************************************************
+/**
+ * @file LedStateParser.cpp
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief ledstate message parser implementation
+ * @version 0.1
+ * @date 2024-02-07
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#include "LedStateParser.h"
+
+#include "Utils/MsgPack.h"
+
+#include "esp_log.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+
+static const char* TAG = "ledstate_parser";
+
+typedef struct {
+    const char* p;
+    const char* end;
+} cursor_t;
+
+#define KEY_IS(key, length, literal) \
+    ((length) == sizeof(literal) - 1 && memcmp((key), (literal), (length)) == 0)
+
+//******************************************************************************
+static void skip_whitespace(cursor_t& c) {
+    while (c.p < c.end && (*c.p == ' ' || *c.p == '\t' || *c.p == '\n' || *c.p == '\r')) {
+        c.p++;
+    }
+}
+
+//******************************************************************************
+static bool expect(cursor_t& c, char ch) {
+    skip_whitespace(c);
+    if (c.p < c.end && *c.p == ch) {
+        c.p++;
+        return true;
+    }
+    return false;
+}
+
+//******************************************************************************
+/**
+ * @brief Scan a string, the cursor must be on the opening quote.
+ *
+ * The string is returned raw, escapes are not decoded.  None of the values we
+ * care about need escaping.
+ */
+static bool scan_string(cursor_t& c, const char** str, size_t* length) {
+    if (c.p >= c.end || *c.p != '"') {
+        return false;
+    }
+
+    const char* start = ++c.p;
+    while (c.p < c.end && *c.p != '"') {
+        if (*c.p == '\\') {
+            c.p++;
+        }
+        c.p++;
+    }
+
+    if (c.p >= c.end) {
+        return false;
+    }
+
+    *str = start;
+    *length = c.p - start;
+    c.p++;
+    return true;
+}
+
+//******************************************************************************
+static bool scan_literal(cursor_t& c, const char* literal, size_t length) {
+    if ((size_t)(c.end - c.p) < length || memcmp(c.p, literal, length) != 0) {
+        return false;
+    }
+    c.p += length;
+    return true;
+}
+
+//******************************************************************************
+/**
+ * @brief Scan a number, keeping the integer value.
+ *
+ * Fractions are truncated, like the ArduinoJson conversion we used to do, and
+ * the magnitude is clamped to UINT32_MAX.
+ */
+static bool scan_number(cursor_t& c, long long* value) {
+    bool negative = false;
+    long long v = 0;
+    int exponent = 0;
+
+    if (c.p < c.end && *c.p == '-') {
+        negative = true;
+        c.p++;
+    }
+
+    const char* digits = c.p;
+    while (c.p < c.end && *c.p >= '0' && *c.p <= '9') {
+        if (v <= UINT32_MAX) {
+            v = v * 10 + (*c.p - '0');
+        }
+        c.p++;
+    }
+    if (c.p == digits) {
+        return false;
+    }
+
+    if (c.p < c.end && *c.p == '.') {
+        c.p++;
+        while (c.p < c.end && *c.p >= '0' && *c.p <= '9') {
+            c.p++;
+        }
+    }
+
+    if (c.p < c.end && (*c.p == 'e' || *c.p == 'E')) {
+        bool negative_exponent = false;
+        c.p++;
+        if (c.p < c.end && (*c.p == '+' || *c.p == '-')) {
+            negative_exponent = *c.p == '-';
+            c.p++;
+        }
+        while (c.p < c.end && *c.p >= '0' && *c.p <= '9') {
+            if (exponent < 100) {
+                exponent = exponent * 10 + (*c.p - '0');
+            }
+            c.p++;
+        }
+        for (int i = 0; i < exponent && v != 0; i++) {
+            if (negative_exponent) {
+                v /= 10;
+            } else if (v <= UINT32_MAX) {
+                v *= 10;
+            }
+        }
+    }
+
+    if (v > UINT32_MAX) {
+        v = UINT32_MAX;
+    }
+    *value = negative ? -v : v;
+    return true;
+}
+
+static bool skip_value(cursor_t& c, int depth);
+
+//******************************************************************************
+/**
+ * @brief Move to the next member of an object.
+ *
+ * @param first     Must be true on the first call for an object.
+ * @param done      Set when the end of the object is reached.
+ * @return false    If the object is malformed.
+ */
+static bool next_member(cursor_t& c, bool& first, bool& done, const char** key, size_t* key_length) {
+    skip_whitespace(c);
+    if (c.p < c.end && *c.p == '}') {
+        c.p++;
+        done = true;
+        return true;
+    }
+
+    if (!first && !expect(c, ',')) {
+        return false;
+    }
+    first = false;
+
+    skip_whitespace(c);
+    if (!scan_string(c, key, key_length)) {
+        return false;
+    }
+
+    if (!expect(c, ':')) {
+        return false;
+    }
+
+    skip_whitespace(c);
+    return true;
+}
+
+//******************************************************************************
+static bool skip_container(cursor_t& c, char close, int depth) {
+    if (depth >= LEDSTATE_PARSER_MAX_DEPTH) {
+        return false;
+    }
+
+    c.p++;
+    skip_whitespace(c);
+    if (c.p < c.end && *c.p == close) {
+        c.p++;
+        return true;
+    }
+
+    while (c.p < c.end) {
+        if (close == '}') {
+            const char* key;
+            size_t key_length;
+            skip_whitespace(c);
+            if (!scan_string(c, &key, &key_length) || !expect(c, ':')) {
+                return false;
+            }
+        }
+
+        if (!skip_value(c, depth + 1)) {
+            return false;
+        }
+
+        skip_whitespace(c);
+        if (c.p < c.end && *c.p == close) {
+            c.p++;
+            return true;
+        }
+        if (!expect(c, ',')) {
+            return false;
+        }
+    }
+
+    return false;
+}
+
+//******************************************************************************
+static bool skip_value(cursor_t& c, int depth) {
+    const char* str;
+    size_t length;
+    long long number;
+
+    skip_whitespace(c);
+    if (c.p >= c.end) {
+        return false;
+    }
+
+    switch (*c.p) {
+        case '"': return scan_string(c, &str, &length);
+        case '{': return skip_container(c, '}', depth);
+        case '[': return skip_container(c, ']', depth);
+        case 't': return scan_literal(c, "true", 4);
+        case 'f': return scan_literal(c, "false", 5);
+        case 'n': return scan_literal(c, "null", 4);
+        default:  return scan_number(c, &number);
+    }
+}
+
+//******************************************************************************
+/**
+ * @brief Read a value as a bool, anything but true or a non zero number is
+ *        false.
+ */
+static bool scan_bool(cursor_t& c, bool* value) {
+    long long number;
+
+    if (scan_literal(c, "true", 4)) {
+        *value = true;
+        return true;
+    }
+
+    if (c.p < c.end && (*c.p == '-' || (*c.p >= '0' && *c.p <= '9'))) {
+        if (!scan_number(c, &number)) {
+            return false;
+        }
+        *value = number != 0;
+        return true;
+    }
+
+    *value = false;
+    return skip_value(c, 0);
+}
+
+//******************************************************************************
+/**
+ * @brief Read a value as an int, anything but a number is 0.
+ */
+static bool scan_int(cursor_t& c, int* value) {
+    long long number;
+
+    if (c.p < c.end && (*c.p == '-' || (*c.p >= '0' && *c.p <= '9'))) {
+        if (!scan_number(c, &number)) {
+            return false;
+        }
+        *value = number > INT_MAX ? INT_MAX : number < INT_MIN ? INT_MIN : (int) number;
+        return true;
+    }
+
+    *value = 0;
+    return skip_value(c, 0);
+}
+
+//******************************************************************************
+/**
+ * @brief Read the sequence number, anything but a positive integer is
+ *        ignored.
+ */
+static bool scan_seq(cursor_t& c, ledstate_message_t* message) {
+    long long number;
+
+    if (c.p < c.end && *c.p >= '0' && *c.p <= '9') {
+        if (!scan_number(c, &number)) {
+            return false;
+        }
+        message->has_seq = true;
+        message->seq = (uint32_t) number;
+        return true;
+    }
+
+    return skip_value(c, 0);
+}
+
+//******************************************************************************
+/**
+ * @brief Read a lan session, 16 hex digits.
+ */
+static bool scan_session(cursor_t& c, ledstate_message_t* message) {
+    const char* hex;
+    size_t hex_length;
+
+    if (!scan_string(c, &hex, &hex_length) || hex_length != 16) {
+        return false;
+    }
+
+    uint64_t session = 0;
+    for (size_t i = 0; i < hex_length; i++) {
+        char ch = hex[i];
+        int digit = ch >= '0' && ch <= '9' ? ch - '0' :
+                    ch >= 'a' && ch <= 'f' ? ch - 'a' + 10 :
+                    ch >= 'A' && ch <= 'F' ? ch - 'A' + 10 : -1;
+        if (digit < 0) {
+            return false;
+        }
+        session = (session << 4) | (uint64_t) digit;
+    }
+
+    message->has_session = true;
+    message->session = session;
+    return true;
+}
+
+//******************************************************************************
+static void clear_message(ledstate_message_t* message) {
+    memset(message, 0, sizeof(ledstate_message_t));
+    for (int i = 0; i < LEDSTATE_PORT_COUNT; i++) {
+        message->port[i].state = e_station_unknown;
+    }
+}
+
+//******************************************************************************
+static void set_port_state(int index, ledstate_port_t* port, const char* state, size_t state_length) {
+    port->state = led_state_from_string(state, state_length);
+    port->has_state = port->state != e_station_unknown || KEY_IS(state, state_length, "unknown");
+    if (!port->has_state) {
+        ESP_LOGE(TAG, "%d: Unknown state %.*s", index, (int) state_length, state);
+    }
+}
+
+//******************************************************************************
+static bool parse_port(cursor_t& c, int index, ledstate_port_t* port) {
+    const char* key;
+    size_t key_length;
+    bool first = true;
+    bool done = false;
+
+    // Like before, a port that isn't an object is ignored.
+    if (c.p >= c.end || *c.p != '{') {
+        return skip_value(c, 1);
+    }
+    c.p++;
+
+    while (next_member(c, first, done, &key, &key_length)) {
+        if (done) {
+            return true;
+        }
+
+        if (KEY_IS(key, key_length, "state") && c.p < c.end && *c.p == '"') {
+            const char* state;
+            size_t state_length;
+            if (!scan_string(c, &state, &state_length)) {
+                return false;
+            }
+
+            set_port_state(index, port, state, state_length);
+        } else if (KEY_IS(key, key_length, "charge_percent")) {
+            if (!scan_int(c, &port->charge_percent)) {
+                return false;
+            }
+        } else if (!skip_value(c, 1)) {
+            return false;
+        }
+    }
+
+    return false;
+}
+
+//******************************************************************************
+/**
+ * @brief Parse the members of a ledstate, the cursor must be past the '{'.
+ */
+static bool parse_ledstate_object(cursor_t& c, ledstate_message_t* message) {
+    const char* key;
+    size_t key_length;
+    bool first = true;
+    bool done = false;
+
+    while (next_member(c, first, done, &key, &key_length)) {
+        if (done) {
+            return true;
+        }
+
+        if (KEY_IS(key, key_length, "night_mode")) {
+            message->has_night_mode = true;
+            if (!scan_bool(c, &message->night_mode)) {
+                break;
+            }
+        } else if (KEY_IS(key, key_length, "seq")) {
+            if (!scan_seq(c, message)) {
+                break;
+            }
+        } else if (KEY_IS(key, key_length, "session")) {
+            if (!scan_session(c, message)) {
+                break;
+            }
+        } else if (KEY_IS(key, key_length, "port0")) {
+            if (!parse_port(c, 0, &message->port[0])) {
+                break;
+            }
+        } else if (KEY_IS(key, key_length, "port1")) {
+            if (!parse_port(c, 1, &message->port[1])) {
+                break;
+            }
+        } else if (!skip_value(c, 0)) {
+            break;
+        }
+    }
+
+    return false;
+}
+
+//******************************************************************************
+esp_err_t ledstate_parse(const char* payload, size_t length, ledstate_message_t* message) {
+    cursor_t c = { payload, payload + length };
+
+    if (payload == nullptr || message == nullptr) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    clear_message(message);
+
+    if (!expect(c, '{')) {
+        ESP_LOGE(TAG, "ledstate is not a json object");
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (parse_ledstate_object(c, message)) {
+        return ESP_OK;
+    }
+
+    ESP_LOGE(TAG, "Malformed ledstate at offset %d", (int)(c.p - payload));
+    return ESP_ERR_INVALID_ARG;
+}
+
+//******************************************************************************
+esp_err_t ledstate_parse_lan(
+    const char* payload, size_t length,
+    ledstate_lan_envelope_t* envelope,
+    ledstate_message_t* message
+) {
+    cursor_t c = { payload, payload + length };
+    const char* key;
+    size_t key_length;
+    bool first = true;
+    bool done = false;
+    bool is_ledstate = false;
+
+    if (payload == nullptr || envelope == nullptr || message == nullptr) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    memset(envelope, 0, sizeof(ledstate_lan_envelope_t));
+    clear_message(message);
+
+    if (!expect(c, '{')) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    while (next_member(c, first, done, &key, &key_length)) {
+        if (done) {
+            if (!is_ledstate) {
+                return ESP_ERR_NOT_FOUND;
+            }
+            if (envelope->ledstate == nullptr || envelope->hmac == nullptr) {
+                ESP_LOGE(TAG, "lan ledstate without ledstate or hmac");
+                return ESP_ERR_INVALID_ARG;
+            }
+            return ESP_OK;
+        }
+
+        if (KEY_IS(key, key_length, "command")) {
+            const char* command;
+            size_t command_length;
+            if (!scan_string(c, &command, &command_length)) {
+                break;
+            }
+            if (!KEY_IS(command, command_length, "ledstate")) {
+                return ESP_ERR_NOT_FOUND;
+            }
+            is_ledstate = true;
+        } else if (KEY_IS(key, key_length, "ledstate")) {
+            const char* start = c.p;
+            if (!expect(c, '{') || !parse_ledstate_object(c, message)) {
+                break;
+            }
+            envelope->ledstate = start;
+            envelope->ledstate_length = c.p - start;
+        } else if (KEY_IS(key, key_length, "hmac")) {
+            if (!scan_string(c, &envelope->hmac, &envelope->hmac_length)) {
+                break;
+            }
+        } else if (!skip_value(c, 0)) {
+            break;
+        }
+    }
+
+    if (!is_ledstate) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    ESP_LOGE(TAG, "Malformed lan ledstate at offset %d", (int)(c.p - payload));
+    return ESP_ERR_INVALID_ARG;
+}
+
+//******************************************************************************
+/**
+ * @brief Parse the ports of one device in a group ledstate.
+ *
+ * Anything but an object, null in the slots for instance, is skipped and
+ * does not address us.
+ */
+static bool parse_device(cursor_t& c, ledstate_message_t* message, bool* addressed) {
+    const char* key;
+    size_t key_length;
+    bool first = true;
+    bool done = false;
+
+    if (c.p >= c.end || *c.p != '{') {
+        return skip_value(c, 1);
+    }
+    c.p++;
+    *addressed = true;
+
+    while (next_member(c, first, done, &key, &key_length)) {
+        if (done) {
+            return true;
+        }
+
+        if (KEY_IS(key, key_length, "port0")) {
+            if (!parse_port(c, 0, &message->port[0])) {
+                return false;
+            }
+        } else if (KEY_IS(key, key_length, "port1")) {
+            if (!parse_port(c, 1, &message->port[1])) {
+                return false;
+            }
+        } else if (!skip_value(c, 2)) {
+            return false;
+        }
+    }
+
+    return false;
+}
+
+//******************************************************************************
+/**
+ * @brief Parse our element of "slots", the others are skipped unparsed.
+ */
+static bool parse_slots(cursor_t& c, int slot, ledstate_message_t* message, bool* addressed) {
+    if (c.p >= c.end || *c.p != '[') {
+        return skip_value(c, 0);
+    }
+    c.p++;
+
+    skip_whitespace(c);
+    if (c.p < c.end && *c.p == ']') {
+        c.p++;
+        return true;
+    }
+
+    for (int index = 0; c.p < c.end; index++) {
+        skip_whitespace(c);
+        if (index == slot) {
+            if (!parse_device(c, message, addressed)) {
+                return false;
+            }
+        } else if (!skip_value(c, 1)) {
+            return false;
+        }
+
+        skip_whitespace(c);
+        if (c.p < c.end && *c.p == ']') {
+            c.p++;
+            return true;
+        }
+        if (!expect(c, ',')) {
+            return false;
+        }
+    }
+
+    return false;
+}
+
+//******************************************************************************
+static bool parse_things(cursor_t& c, const char* thing_name, ledstate_message_t* message, bool* addressed) {
+    const char* key;
+    size_t key_length;
+    bool first = true;
+    bool done = false;
+
+    if (c.p >= c.end || *c.p != '{') {
+        return skip_value(c, 0);
+    }
+    c.p++;
+
+    size_t thing_name_length = thing_name != nullptr ? strlen(thing_name) : 0;
+
+    while (next_member(c, first, done, &key, &key_length)) {
+        if (done) {
+            return true;
+        }
+
+        if (thing_name_length != 0 && key_length == thing_name_length && memcmp(key, thing_name, key_length) == 0) {
+            if (!parse_device(c, message, addressed)) {
+                return false;
+            }
+        } else if (!skip_value(c, 1)) {
+            return false;
+        }
+    }
+
+    return false;
+}
+
+//******************************************************************************
+/**
+ * @brief Which of our leds shows this port of this station.
+ *
+ * @return int  The led, -1 if neither.
+ */
+static int station_led(
+    const ledstate_address_t& address,
+    const char* station, size_t station_length,
+    const char* port, size_t port_length
+) {
+    for (int i = 0; i < LEDSTATE_PORT_COUNT; i++) {
+        const char* station_id = address.station_id[i];
+        if (station_id == nullptr || strlen(station_id) != station_length || memcmp(station_id, station, station_length) != 0) {
+            continue;
+        }
+
+        char number[4];
+        int number_length = snprintf(number, sizeof(number), "%u", address.port_number[i]);
+        if (number_length == (int) port_length && memcmp(number, port, port_length) == 0) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+//******************************************************************************
+static bool parse_station(
+    cursor_t& c,
+    const ledstate_address_t& address,
+    const char* station, size_t station_length,
+    ledstate_message_t* message, bool* addressed
+) {
+    const char* key;
+    size_t key_length;
+    bool first = true;
+    bool done = false;
+
+    if (c.p >= c.end || *c.p != '{') {
+        return skip_value(c, 1);
+    }
+    c.p++;
+
+    while (next_member(c, first, done, &key, &key_length)) {
+        if (done) {
+            return true;
+        }
+
+        int led = station_led(address, station, station_length, key, key_length);
+        if (led < 0) {
+            if (!skip_value(c, 2)) {
+                return false;
+            }
+            continue;
+        }
+
+        *addressed = true;
+        if (!parse_port(c, led, &message->port[led])) {
+            return false;
+        }
+    }
+
+    return false;
+}
+
+//******************************************************************************
+static bool parse_stations(cursor_t& c, const ledstate_address_t& address, ledstate_message_t* message, bool* addressed) {
+    const char* key;
+    size_t key_length;
+    bool first = true;
+    bool done = false;
+
+    if (c.p >= c.end || *c.p != '{') {
+        return skip_value(c, 0);
+    }
+    c.p++;
+
+    while (next_member(c, first, done, &key, &key_length)) {
+        if (done) {
+            return true;
+        }
+
+        if (!parse_station(c, address, key, key_length, message, addressed)) {
+            return false;
+        }
+    }
+
+    return false;
+}
+
+//******************************************************************************
+esp_err_t ledstate_parse_group(
+    const char* payload, size_t length,
+    const ledstate_address_t& address,
+    ledstate_message_t* message
+) {
+    cursor_t c = { payload, payload + length };
+    const char* key;
+    size_t key_length;
+    bool first = true;
+    bool done = false;
+    bool addressed = false;
+
+    if (payload == nullptr || message == nullptr) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    clear_message(message);
+
+    if (!expect(c, '{')) {
+        ESP_LOGE(TAG, "group ledstate is not a json object");
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    while (next_member(c, first, done, &key, &key_length)) {
+        if (done) {
+            return addressed ? ESP_OK : ESP_ERR_NOT_FOUND;
+        }
+
+        if (KEY_IS(key, key_length, "night_mode")) {
+            message->has_night_mode = true;
+            addressed = true;
+            if (!scan_bool(c, &message->night_mode)) {
+                break;
+            }
+        } else if (KEY_IS(key, key_length, "seq")) {
+            if (!scan_seq(c, message)) {
+                break;
+            }
+        } else if (KEY_IS(key, key_length, "slots")) {
+            if (!parse_slots(c, address.slot, message, &addressed)) {
+                break;
+            }
+        } else if (KEY_IS(key, key_length, "things")) {
+            if (!parse_things(c, address.thing_name, message, &addressed)) {
+                break;
+            }
+        } else if (KEY_IS(key, key_length, "stations")) {
+            if (!parse_stations(c, address, message, &addressed)) {
+                break;
+            }
+        } else if (!skip_value(c, 0)) {
+            break;
+        }
+    }
+
+    ESP_LOGE(TAG, "Malformed group ledstate at offset %d", (int)(c.p - payload));
+    return ESP_ERR_INVALID_ARG;
+}
+
+//******************************************************************************
+static bool parse_port_msgpack(MsgPackReader& reader, int index, ledstate_port_t* port) {
+    uint32_t count;
+    const char* key;
+    size_t key_length;
+
+    if (!reader.read_map(&count)) {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        if (!reader.read_str(&key, &key_length)) {
+            return false;
+        }
+
+        if (KEY_IS(key, key_length, "state") && reader.next_is_str()) {
+            const char* state;
+            size_t state_length;
+            if (!reader.read_str(&state, &state_length)) {
+                return false;
+            }
+            set_port_state(index, port, state, state_length);
+        } else if (KEY_IS(key, key_length, "charge_percent") && reader.next_is_int()) {
+            int64_t charge_percent;
+            if (!reader.read_int(&charge_percent)) {
+                return false;
+            }
+            port->charge_percent = charge_percent > INT_MAX ? INT_MAX : charge_percent < INT_MIN ? INT_MIN : (int) charge_percent;
+        } else if (!reader.skip(LEDSTATE_PARSER_MAX_DEPTH - 1)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+//******************************************************************************
+esp_err_t ledstate_parse_msgpack(const uint8_t* payload, size_t length, ledstate_message_t* message) {
+    uint32_t count;
+    const char* key;
+    size_t key_length;
+
+    if (payload == nullptr || message == nullptr) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    clear_message(message);
+
+    MsgPackReader reader(payload, length);
+    if (!reader.read_map(&count)) {
+        ESP_LOGE(TAG, "ledstate is not a msgpack map");
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        if (!reader.read_str(&key, &key_length)) {
+            goto malformed;
+        }
+
+        if (KEY_IS(key, key_length, "night_mode")) {
+            message->has_night_mode = true;
+            if (reader.next_is_bool()) {
+                if (!reader.read_bool(&message->night_mode)) {
+                    goto malformed;
+                }
+            } else if (reader.next_is_int()) {
+                int64_t night_mode;
+                if (!reader.read_int(&night_mode)) {
+                    goto malformed;
+                }
+                message->night_mode = night_mode != 0;
+            } else if (!reader.skip(LEDSTATE_PARSER_MAX_DEPTH)) {
+                goto malformed;
+            }
+        } else if (KEY_IS(key, key_length, "seq") && reader.next_is_int()) {
+            int64_t seq;
+            if (!reader.read_int(&seq)) {
+                goto malformed;
+            }
+            if (seq >= 0) {
+                message->has_seq = true;
+                message->seq = seq > UINT32_MAX ? UINT32_MAX : (uint32_t) seq;
+            }
+        } else if (KEY_IS(key, key_length, "port0") || KEY_IS(key, key_length, "port1")) {
+            // Like the json path, a port that isn't a map is ignored.
+            int index = key[4] - '0';
+            if (!reader.next_is_map()) {
+                if (!reader.skip(LEDSTATE_PARSER_MAX_DEPTH - 1)) {
+                    goto malformed;
+                }
+            } else if (!parse_port_msgpack(reader, index, &message->port[index])) {
+                goto malformed;
+            }
+        } else if (!reader.skip(LEDSTATE_PARSER_MAX_DEPTH)) {
+            goto malformed;
+        }
+    }
+
+    return ESP_OK;
+
+malformed:
+    ESP_LOGE(TAG, "Malformed msgpack ledstate");
+    return ESP_ERR_INVALID_ARG;
+}
+
+//******************************************************************************
+/**
+ * @brief Fold a newer ledstate into an older one.
+ *
+ * Fields the newer message has replace the older ones, the others are kept,
+ * so each port ends up with the newest state it was sent.
+ */
+void ledstate_merge(ledstate_message_t* into, const ledstate_message_t& from) {
+    if (from.has_seq) {
+        into->has_seq = true;
+        into->seq = from.seq;
+    }
+
+    if (from.has_night_mode) {
+        into->has_night_mode = true;
+        into->night_mode = from.night_mode;
+    }
+
+    for (int i = 0; i < LEDSTATE_PORT_COUNT; i++) {
+        if (from.port[i].has_state) {
+            into->port[i] = from.port[i];
+        }
+    }
+}
@@ -0,0 +1,152 @@
+//******************************************************************************
+/**
+ * @file LedStateParser.h
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief ledstate message parser
+ * @version 0.1
+ * @date 2024-02-07
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#pragma once
+
+#include "LED/LedState.h"
+
+#include "esp_err.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define LEDSTATE_PORT_COUNT         (2)
+
+// Nesting allowed in the fields we skip over.
+#define LEDSTATE_PARSER_MAX_DEPTH   (8)
+
+typedef struct {
+    bool has_state;         // port had a known "state"
+    led_state_t state;
+    int charge_percent;
+} ledstate_port_t;
+
+typedef struct {
+    bool has_seq;           // optional, set by proxies that number their states
+    uint32_t seq;
+    bool has_session;       // lan only, the session of the device it was signed for
+    uint64_t session;
+    bool has_night_mode;
+    bool night_mode;
+    ledstate_port_t port[LEDSTATE_PORT_COUNT];
+} ledstate_message_t;
+
+// A ledstate sent by a site gateway on the udp port.
+typedef struct {
+    const char* ledstate;       // the "ledstate" object as received, what the hmac covers
+    size_t ledstate_length;
+    const char* hmac;           // hex, not null terminated
+    size_t hmac_length;
+} ledstate_lan_envelope_t;
+
+// Where this device is in a group ledstate.
+typedef struct {
+    const char* thing_name;
+    int slot;                                       // index in "slots", -1 if none assigned
+    const char* station_id[LEDSTATE_PORT_COUNT];    // station of each led, nullptr if none
+    uint8_t port_number[LEDSTATE_PORT_COUNT];       // port of that station
+} ledstate_address_t;
+
+//******************************************************************************
+/**
+ * @brief Parse a ledstate message.
+ *
+ * The parser only knows about the ledstate schema:
+ *
+ *   {
+ *     "seq": 1234,
+ *     "night_mode": true,
+ *     "port0": { "state": "charging", "charge_percent": 50 },
+ *     "port1": { "state": "available" }
+ *   }
+ *
+ * It reads straight from the payload, which does not need to be null
+ * terminated, so it can be called on the coreMQTT receive buffer.  Nothing
+ * is copied and nothing is allocated.  Unknown fields are skipped.
+ *
+ * @param payload       The json payload.
+ * @param length        Length of the payload.
+ * @param message       Parsed message, only valid if ESP_OK is returned.
+ * @return esp_err_t    ESP_OK, ESP_ERR_INVALID_ARG if the payload is not a
+ *                      json object.
+ */
+esp_err_t ledstate_parse(const char* payload, size_t length, ledstate_message_t* message);
+
+//******************************************************************************
+/**
+ * @brief Parse a MessagePack ledstate message.
+ *
+ * Same schema and same rules as ledstate_parse, the payload is a map.
+ */
+esp_err_t ledstate_parse_msgpack(const uint8_t* payload, size_t length, ledstate_message_t* message);
+
+//******************************************************************************
+/**
+ * @brief Parse a ledstate command received on the udp port.
+ *
+ *   {
+ *     "command": "ledstate",
+ *     "ledstate": { "session": "<16 hex>", "seq": 1234, "port0": {...} },
+ *     "hmac": "<hex>"
+ *   }
+ *
+ * "ledstate" is parsed like a ledstate message.  The envelope points at it,
+ * as received, so the hmac can be checked without copying anything.  The
+ * hmac covers the session, see LedStateSequencer.
+ *
+ * @return esp_err_t    ESP_OK, ESP_ERR_NOT_FOUND if this is another command
+ *                      (or not json at all), ESP_ERR_INVALID_ARG if it is a
+ *                      malformed ledstate command.
+ */
+esp_err_t ledstate_parse_lan(
+    const char* payload, size_t length,
+    ledstate_lan_envelope_t* envelope,
+    ledstate_message_t* message
+);
+
+//******************************************************************************
+/**
+ * @brief Parse a group ledstate, keep only what is addressed to us.
+ *
+ * One message for every device of a site:
+ *
+ *   {
+ *     "seq": 1234,
+ *     "night_mode": true,
+ *     "slots": [ { "port0": {...}, "port1": {...} }, null, ... ],
+ *     "things": { "<thing_name>": { "port0": {...} } },
+ *     "stations": { "<station_id>": { "<port_number>": { "state": "charging" } } }
+ *   }
+ *
+ * "night_mode" applies to everyone.  "slots" is the compact index, the proxy
+ * puts a device at the slot it was assigned with set-config, we go straight
+ * to our element without comparing any name.  "things" and "stations" are
+ * for devices without a slot.  When a port is addressed more than once the
+ * last entry wins.
+ *
+ * @param address       Who we are in the group.
+ * @param message       Our part of the message, only valid if ESP_OK is
+ *                      returned.
+ * @return esp_err_t    ESP_OK, ESP_ERR_NOT_FOUND if nothing in the message
+ *                      is for us, ESP_ERR_INVALID_ARG if malformed.
+ */
+esp_err_t ledstate_parse_group(
+    const char* payload, size_t length,
+    const ledstate_address_t& address,
+    ledstate_message_t* message
+);
+
+//******************************************************************************
+/**
+ * @brief Fold a newer ledstate into an older one, port by port.
+ */
+void ledstate_merge(ledstate_message_t* into, const ledstate_message_t& from);
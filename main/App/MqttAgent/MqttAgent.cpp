@@ -1,5 +1,9 @@
 #include "MqttAgent.h"
 
+#include "Utils/FuseMacAddress.h"
+#include "Utils/ConfigBlob.h"
+#include "Utils/Time.h"
+
 #include "esp_err.h"
 #include "esp_log.h"
 #include "esp_check.h"
@@ -22,11 +26,12 @@ static const char *TAG = "mqtt_agent";
 #define MQTT_AGENT_DISCONNECTED_BIT    ( 1 << 3 )
 
 //******************************************************************************
-esp_err_t MqttAgent::setup(ThingConfig* thing_config) {
+esp_err_t MqttAgent::setup(ThingConfig* thing_config, ChargePointConfig* charge_point_config) {
     struct timespec tp;
 
     ESP_LOGI(TAG, "Setting this %p", this);
     this->thing_config = thing_config;
+    this->charge_point_config = charge_point_config;
     this->event_group = xEventGroupCreate();
 
     esp_err_t ret = ESP_OK;
@@ -59,6 +64,7 @@ esp_err_t MqttAgent::setup(ThingConfig* thing_config) {
     this->mqtt_context.initialize(this->mqtt_connection.get_network_context(), &MqttAgent::sOn_mqtt_pubsub_event, this);
 
     this->mqtt_mutex = xSemaphoreCreateMutex();
+    this->outbound_mutex = xSemaphoreCreateMutex();
 
     ( void ) clock_gettime( CLOCK_REALTIME, &tp );
     srand( tp.tv_nsec );
@@ -120,11 +126,65 @@ esp_err_t MqttAgent::subscribe(const char *topic, mqttCallbackFn callback, void*
     return ret;
 }
 
+//******************************************************************************
 esp_err_t MqttAgent::unsubscribe(const char *topic) {
-    return ESP_OK;
+    esp_err_t ret = ESP_OK;
+    MQTTStatus_t mqtt_status;
+    MQTTSubscribeInfo_t sub_info[1];
+    uint16_t packet_id = 0;
+
+    memset(&sub_info, 0x00, sizeof(MQTTSubscribeInfo_t));
+    sub_info[0].qos = MQTTQoS0;
+    sub_info[0].pTopicFilter = topic;
+    sub_info[0].topicFilterLength = strlen(topic);
+
+    // take mutex
+    if (!xSemaphoreTake(this->mqtt_mutex, portMAX_DELAY)) {
+        ESP_LOGE(TAG, "Failed to take mqtt mutex");
+        return ESP_FAIL;
+    }
+
+    packet_id = MQTT_GetPacketId( this->mqtt_context.get_mqtt_context() );
+    mqtt_status = MQTT_Unsubscribe( this->mqtt_context.get_mqtt_context(),
+                                   sub_info,
+                                   1,
+                                   packet_id );
+
+    if( mqtt_status != MQTTSuccess )
+    {
+        ESP_LOGE( TAG, "Failed to send UNSUBSCRIBE packet to broker with error = %s.",
+                    MQTT_Status_strerror( mqtt_status ) );
+        ret = ESP_FAIL;
+    }
+    else
+    {
+        ESP_LOGI( TAG, "UNSUBSCRIBE sent for topic %s to broker.", topic );
+    }
+
+    // give the mutex back
+    xSemaphoreGive(this->mqtt_mutex);
+
+    return ret;
 }
 
 esp_err_t MqttAgent::publish_message(const char *topic, const char *payload, uint8_t retry_count) {
+    return this->publish_message(topic, strlen(topic), payload, strlen(payload), retry_count);
+}
+
+//******************************************************************************
+/**
+ * @brief Publish a payload that is not null terminated.
+ * 
+ * The payload is sent from where it is, it is not copied.  With coreMQTT v2
+ * MQTT_Publish builds the header on the stack and doesn't touch the network
+ * buffer, so the payload can be the one we are handling in
+ * on_mqtt_pubsub_event.
+ */
+esp_err_t MqttAgent::publish_message(
+    const char *topic, uint16_t topic_length,
+    const char *payload, size_t payload_length,
+    uint8_t retry_count
+) {
     esp_err_t ret = ESP_OK;
     MQTTStatus mqtt_status = MQTTSuccess;
     uint16_t packet_id;
@@ -147,9 +207,9 @@ esp_err_t MqttAgent::publish_message(const char *topic, const char *payload, uin
 
     packet.qos = MQTTQoS0;
     packet.pTopicName = topic;
-    packet.topicNameLength = strlen(topic);
+    packet.topicNameLength = topic_length;
     packet.pPayload = (uint8_t*)payload;
-    packet.payloadLength = strlen(payload);
+    packet.payloadLength = payload_length;
     packet_id = MQTT_GetPacketId( this->mqtt_context.get_mqtt_context() );
 
     if (!xSemaphoreTake(this->mqtt_mutex, 5000/portTICK_PERIOD_MS)) {
@@ -163,11 +223,14 @@ esp_err_t MqttAgent::publish_message(const char *topic, const char *payload, uin
     {
         ESP_LOGE( TAG, "Failed to send PUBLISH packet to broker with error = %s.",
                     MQTT_Status_strerror( mqtt_status ) );
+        this->traffic.publish_failures++;
         ret = ESP_FAIL;
     }
     else
     {
-        ESP_LOGI( TAG, "PUBLISH sent for topic %s to broker.\n\n", topic );
+        ESP_LOGI( TAG, "PUBLISH sent for topic %.*s to broker.\n\n", topic_length, topic );
+        this->traffic.messages_out++;
+        this->traffic.bytes_out += payload_length;
     }
 
     // give mutex back
@@ -177,10 +240,153 @@ esp_err_t MqttAgent::publish_message(const char *topic, const char *payload, uin
     return ret;
 }
 
-void MqttAgent::register_handle_incoming_mqtt(handle_incoming_mqtt_fn callback, void* context) {
-    this->handle_incoming_mqtt = callback;
-    this->handle_incoming_mqtt_context = context;
-    ESP_LOGI(TAG, "<<<<<<<<<<<<< Registered handle_incoming_mqtt callback mn8app %p", this->handle_incoming_mqtt_context);
+//******************************************************************************
+/**
+ * @brief Publish to one of our own outbound topics.
+ */
+esp_err_t MqttAgent::publish_message(mqtt_topic_t topic, const char *payload, uint8_t retry_count) {
+    return this->publish_message(topic, payload, strlen(payload), retry_count);
+}
+
+//******************************************************************************
+/**
+ * @brief Publish to one of our own outbound topics.
+ * 
+ * While disconnected, or while older publishes are still being replayed,
+ * the publish is queued so the broker gets them in order.  Topics that are
+ * not worth sending late are dropped, see OutboundQueue.
+ * 
+ * @return esp_err_t    ESP_OK if sent or queued.
+ */
+esp_err_t MqttAgent::publish_message(mqtt_topic_t topic, const char *payload, size_t payload_length, uint8_t retry_count) {
+    esp_err_t ret = ESP_OK;
+
+    if (!this->connected || !this->topics.is_built()) {
+        return this->queue_outbound(topic, payload, payload_length);
+    }
+
+    if (xSemaphoreTake(this->outbound_mutex, portMAX_DELAY)) {
+        bool replaying = !this->outbound_queue.empty();
+        xSemaphoreGive(this->outbound_mutex);
+        if (replaying && this->outbound_queue.get_policy(topic) != e_outbound_drop) {
+            return this->queue_outbound(topic, payload, payload_length);
+        }
+    }
+
+    ret = this->publish_message(
+        this->topics.get(topic), this->topics.get_length(topic),
+        payload, payload_length,
+        retry_count
+    );
+
+    if (ret != ESP_OK && this->queue_outbound(topic, payload, payload_length) == ESP_OK) {
+        ret = ESP_OK;
+    }
+
+    return ret;
+}
+
+//******************************************************************************
+esp_err_t MqttAgent::queue_outbound(mqtt_topic_t topic, const char *payload, size_t payload_length) {
+    esp_err_t ret = ESP_OK;
+
+    if (!xSemaphoreTake(this->outbound_mutex, portMAX_DELAY)) {
+        ESP_LOGE(TAG, "Failed to take outbound mutex");
+        return ESP_FAIL;
+    }
+
+    ret = this->outbound_queue.push(topic, payload, payload_length);
+    xSemaphoreGive(this->outbound_mutex);
+
+    if (ret == ESP_OK) {
+        ESP_LOGI(TAG, "Not connected, queued %s", MqttTopics::get_suffix(topic));
+    } else if (ret == ESP_ERR_NOT_SUPPORTED) {
+        ESP_LOGW(TAG, "Not connected, dropped %s", MqttTopics::get_suffix(topic));
+    }
+
+    return ret;
+}
+
+//******************************************************************************
+/**
+ * @brief Send a few of the publishes queued while we were disconnected.
+ * 
+ * Called from the mqtt task on every pass, so the backlog drains at a pace
+ * the broker and the proxy can take, in between inbound messages.
+ */
+void MqttAgent::replay_outbound(void) {
+    mqtt_topic_t topic;
+    const char* payload;
+    size_t payload_length;
+
+    if (!xSemaphoreTake(this->outbound_mutex, portMAX_DELAY)) {
+        ESP_LOGE(TAG, "Failed to take outbound mutex");
+        return;
+    }
+
+    for (int i = 0; i < MQTT_AGENT_REPLAY_PER_LOOP; i++) {
+        if (!this->outbound_queue.peek(&topic, &payload, &payload_length)) {
+            break;
+        }
+
+        // Keep it queued if it fails, we'll be reconnecting anyway.
+        if (this->publish_message(
+            this->topics.get(topic), this->topics.get_length(topic),
+            payload, payload_length,
+            0) != ESP_OK
+        ) {
+            break;
+        }
+
+        this->outbound_queue.pop();
+    }
+
+    xSemaphoreGive(this->outbound_mutex);
+}
+
+//******************************************************************************
+/**
+ * @brief Follow the group id of the chargepoint config.
+ *
+ * The chargepoint is provisioned, moved to another group or unprovisioned
+ * without a reboot (udp server).  When a config was saved since the group
+ * topic was built, the topic is rebuilt and, when connected and the group
+ * changed, the old one is unsubscribed and the new one subscribed.
+ *
+ * Called from the mqtt task, before subscribing and on every pass.
+ */
+void MqttAgent::follow_group(void) {
+    uint32_t generation = config_blob_generation();
+    if (!this->topics.is_built() || generation == this->config_generation) {
+        return;
+    }
+    this->config_generation = generation;
+
+    char previous[MQTT_TOPIC_MAX_LENGTH];
+    memcpy(previous, this->topics.get(e_mqtt_topic_group_ledstate), sizeof(previous));
+
+    const char* group_id = this->charge_point_config->is_configured() ? this->charge_point_config->get_group_id() : nullptr;
+    if (this->topics.set_group(group_id) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to build the group topic for %s", group_id);
+    }
+
+    const char* current = this->topics.get(e_mqtt_topic_group_ledstate);
+    if (strcmp(previous, current) == 0) {
+        return;
+    }
+
+    ESP_LOGI(TAG, "Group topic changed from '%s' to '%s'", previous, current);
+    if (!this->connected) {
+        return;
+    }
+
+    if (previous[0] != '\0') {
+        this->unsubscribe(previous);
+    }
+    if (current[0] != '\0' && this->subscribe(current, NULL, NULL) != ESP_OK) {
+        // Subscribed again with everything else on the next connection.
+        ESP_LOGE(TAG, "Failed to subscribe to topic %s", current);
+    }
 }
 
 //******************************************************************************
@@ -189,29 +395,50 @@ void MqttAgent::on_mqtt_pubsub_event(
     struct MQTTPacketInfo * packet_info,
     struct MQTTDeserializedInfo * deserialized_info
 ) {
+    this->packets_received++;
+
     if ((packet_info->type & 0xF0U) == MQTT_PACKET_TYPE_PUBLISH) {
         ESP_LOGI(TAG, "Got publish event");
         assert( deserialized_info->pPublishInfo != NULL );
 
         // We have to give the mutex back in case the handler will try to 
-        // publish a message in the same task context.
+        // publish a message in the same task context.  Taken again before
+        // returning to coreMQTT, process_mqtt_loop may call it again.
         xSemaphoreGive(this->mqtt_mutex);
-
-        MQTTPublishInfo_t * pPublishInfo = deserialized_info->pPublishInfo;
-        handle_incoming_mqtt(
-            pPublishInfo->pTopicName,
-            pPublishInfo->topicNameLength,
-            (const char*)pPublishInfo->pPayload,
-            pPublishInfo->payloadLength,
-            deserialized_info->packetIdentifier,
-            this->handle_incoming_mqtt_context
-        );
+        this->dispatch_publish(deserialized_info);
+        xSemaphoreTake(this->mqtt_mutex, portMAX_DELAY);
     } else {
         ESP_LOGI(TAG, "Got other event");
         // pubsub_handler->handle_packet( packet_info, deserialized_info );
     }
 }
 
+//******************************************************************************
+void MqttAgent::dispatch_publish(struct MQTTDeserializedInfo * deserialized_info) {
+    MQTTPublishInfo_t * pPublishInfo = deserialized_info->pPublishInfo;
+    this->traffic.messages_in++;
+    this->traffic.bytes_in += pPublishInfo->payloadLength;
+
+    mqtt_topic_t topic = this->topics.lookup(pPublishInfo->pTopicName, pPublishInfo->topicNameLength);
+    if (topic == e_mqtt_topic_unknown) {
+        ESP_LOGE(TAG, "No route for topic %.*s", pPublishInfo->topicNameLength, pPublishInfo->pTopicName);
+        return;
+    }
+
+    // Drop storms here, before the handler parses anything.
+    if (!this->ingress_limiter.admit(topic, Time::instance().upTimeMS())) {
+        ESP_LOGD(TAG, "Throttled %s", MqttTopics::get_suffix(topic));
+        return;
+    }
+
+    this->topics.dispatch(
+        topic,
+        (const char*)pPublishInfo->pPayload,
+        pPublishInfo->payloadLength,
+        deserialized_info->packetIdentifier
+    );
+}
+
 //******************************************************************************
 esp_err_t MqttAgent::process_mqtt_loop(void) {
     MQTTStatus_t mqtt_status = MQTTSuccess;
@@ -224,19 +451,28 @@ esp_err_t MqttAgent::process_mqtt_loop(void) {
     ESP_LOGD(TAG, "!!!!!!!!!!!!!!! process_mqtt_loop Took mqtt mutex");
 
     // Only stay in the loop if there is more incoming data.  This under the hood
-    // ends up calling our subscribe callback.
-    do {
-        ESP_LOGD(TAG, "Calling MQTT_ProcessLoop");
-        mqtt_status = MQTT_ProcessLoop( this->mqtt_context.get_mqtt_context() );
-        ESP_LOGD(TAG, "MQTT_ProcessLoop returned %d", mqtt_status);
-
-        if (mqtt_status == MQTTNeedMoreBytes) {
-            // Need to wait a bit between calls to MQTT_ProcessLoop().
-            // This is per documentation in the header files where MQTTNeedMoreBytes
-            // is defined.
-            vTaskDelay(100 / portTICK_PERIOD_MS);
+    // ends up calling our subscribe callback.  One packet per MQTT_ProcessLoop,
+    // keep calling it while packets come in so a burst is dispatched before
+    // the drained callback, which then applies it once.
+    for (int i = 0; i < MQTT_AGENT_DRAIN_MAX_PACKETS; i++) {
+        uint32_t packets_received = this->packets_received;
+        do {
+            ESP_LOGD(TAG, "Calling MQTT_ProcessLoop");
+            mqtt_status = MQTT_ProcessLoop( this->mqtt_context.get_mqtt_context() );
+            ESP_LOGD(TAG, "MQTT_ProcessLoop returned %d", mqtt_status);
+
+            if (mqtt_status == MQTTNeedMoreBytes) {
+                // Need to wait a bit between calls to MQTT_ProcessLoop().
+                // This is per documentation in the header files where MQTTNeedMoreBytes
+                // is defined.
+                vTaskDelay(100 / portTICK_PERIOD_MS);
+            }
+        } while (mqtt_status == MQTTNeedMoreBytes);
+
+        if (mqtt_status != MQTTSuccess || this->packets_received == packets_received) {
+            break;
         }
-    } while (mqtt_status == MQTTNeedMoreBytes);
+    }
 
     if (mqtt_status != MQTTSuccess) {
         ESP_LOGE(TAG, "MQTT_ProcessLoop() failed with status %s.",
@@ -299,81 +535,59 @@ void MqttAgent::taskFunction(void) {
             // This should be in the main app state machine logic.
             // but for right now it is here.
 
-#define SUBSCRIBE_TOPIC(buf, t) \
-    memset(buf, 0x00, sizeof(buf)); \
-    snprintf(buf, sizeof(topic), "%s/%s", this->thing_config->get_thing_name(), t); \
-    if (this->subscribe(buf, NULL, NULL) != ESP_OK) { \
-        ESP_LOGE(TAG, "Failed to subscribe to topic %s", buf); \
-        this->mqtt_connection.disconnect(this->mqtt_context.get_mqtt_context()); \
-        vTaskDelay(1000 / portTICK_PERIOD_MS); \
-        continue; \
-    }
-
-            char topic[32];
-            SUBSCRIBE_TOPIC(topic, "ledstate");
-            SUBSCRIBE_TOPIC(topic, "ping");
-            SUBSCRIBE_TOPIC(topic, "set-config");
-            SUBSCRIBE_TOPIC(topic, "get-config");
-            SUBSCRIBE_TOPIC(topic, "reboot");
-            
-            // memset(topic, 0x00, sizeof(topic));
-            // snprintf(topic, sizeof(topic), "%s/ledstate", this->thing_config->get_thing_name());
-            // if (this->subscribe(topic, NULL, NULL) != ESP_OK) {
-            //     ESP_LOGE(TAG, "Failed to subscribe to topic %s", topic);
-            //     this->event_callback(e_mqtt_agent_disconnected, this->event_callback_context);
-            //     this->mqtt_connection.disconnect(this->mqtt_context.get_mqtt_context());
-            //     vTaskDelay(1000 / portTICK_PERIOD_MS);
-            //     continue;
-            // }
-
-            // snprintf(topic, sizeof(topic), "%s/ping", this->thing_config->get_thing_name());
-            // if (this->subscribe(topic, NULL, NULL) != ESP_OK) {
-            //     ESP_LOGE(TAG, "Failed to subscribe to topic %s", topic);
-            //     this->event_callback(e_mqtt_agent_disconnected, this->event_callback_context);
-            //     this->mqtt_connection.disconnect(this->mqtt_context.get_mqtt_context());
-            //     vTaskDelay(1000 / portTICK_PERIOD_MS);
-            //     continue;
-            // }
-
-            // snprintf(topic, sizeof(topic), "%s/set-config", this->thing_config->get_thing_name());
-            // if (this->subscribe(topic, NULL, NULL) != ESP_OK) {
-            //     ESP_LOGE(TAG, "Failed to subscribe to topic %s", topic);
-            //     this->event_callback(e_mqtt_agent_disconnected, this->event_callback_context);
-            //     this->mqtt_connection.disconnect(this->mqtt_context.get_mqtt_context());
-            //     vTaskDelay(1000 / portTICK_PERIOD_MS);
-            //     continue;
-            // }
-
-            // snprintf(topic, sizeof(topic), "%s/get-config", this->thing_config->get_thing_name());
-            // if (this->subscribe(topic, NULL, NULL) != ESP_OK) {
-            //     ESP_LOGE(TAG, "Failed to subscribe to topic %s", topic);
-            //     this->event_callback(e_mqtt_agent_disconnected, this->event_callback_context);
-            //     this->mqtt_connection.disconnect(this->mqtt_context.get_mqtt_context());
-            //     vTaskDelay(1000 / portTICK_PERIOD_MS);
-            //     continue;
-            // }
-
-            // snprintf(topic, sizeof(topic), "%s/reboot", this->thing_config->get_thing_name());
-            // if (this->subscribe(topic, NULL, NULL) != ESP_OK) {
-            //     ESP_LOGE(TAG, "Failed to subscribe to topic %s", topic);
-            //     this->event_callback(e_mqtt_agent_disconnected, this->event_callback_context);
-            //     this->mqtt_connection.disconnect(this->mqtt_context.get_mqtt_context());
-            //     vTaskDelay(1000 / portTICK_PERIOD_MS);
-            //     continue;
-            // }
+            if (!this->topics.is_built()) {
+                char mac_address[13] = {0};
+                get_fuse_mac_address_string(mac_address);
+                this->config_generation = config_blob_generation();
+                const char* group_id = this->charge_point_config->is_configured() ? this->charge_point_config->get_group_id() : nullptr;
+                if (this->topics.build(this->thing_config->get_thing_name(), mac_address, group_id) != ESP_OK) {
+                    ESP_LOGE(TAG, "Failed to build mqtt topics");
+                    this->mqtt_connection.disconnect(this->mqtt_context.get_mqtt_context());
+                    vTaskDelay(1000 / portTICK_PERIOD_MS);
+                    continue;
+                }
+            }
+            this->follow_group();
+
+            bool subscribed = true;
+            for (int topic = MQTT_TOPIC_FIRST_INBOUND; topic <= MQTT_TOPIC_LAST_INBOUND; topic++) {
+                const char* topic_name = this->topics.get((mqtt_topic_t) topic);
+                if (this->topics.get_length((mqtt_topic_t) topic) == 0) {
+                    continue;
+                }
+                if (this->subscribe(topic_name, NULL, NULL) != ESP_OK) {
+                    ESP_LOGE(TAG, "Failed to subscribe to topic %s", topic_name);
+                    subscribed = false;
+                    break;
+                }
+            }
+
+            if (!subscribed) {
+                this->mqtt_connection.disconnect(this->mqtt_context.get_mqtt_context());
+                vTaskDelay(1000 / portTICK_PERIOD_MS);
+                continue;
+            }
 
             // todo this should be more stateful. use a delay for now to make
             // sure the subscribe happened before we publish we need data.
             vTaskDelay(2000 / portTICK_PERIOD_MS);
 
+            if (this->subscribed_callback != nullptr) {
+                this->subscribed_callback(this->subscribed_callback_context);
+            }
+
             // Force refreshing the state in case it has changed since we
-            // last connected.
-            memset(topic, 0x00, sizeof(topic));
-            snprintf(topic, sizeof(topic), "%s/%s", this->thing_config->get_thing_name(), "latest");
-            this->publish_message(topic, "{}", 0);
+            // last connected.  Straight to the broker, this one is never
+            // queued.
+            this->publish_message(
+                this->topics.get(e_mqtt_topic_latest), this->topics.get_length(e_mqtt_topic_latest),
+                "{}", 2,
+                0
+            );
 
             // xEventGroupSetBits( this->event_group, MQTT_AGENT_CONNECTED_BIT );
             connected = true;
+            this->traffic.connects++;
 
             this->event_callback(e_mqtt_agent_connected, this->event_callback_context);
         }
@@ -386,10 +600,16 @@ void MqttAgent::taskFunction(void) {
             this->event_callback(e_mqtt_agent_disconnected, this->event_callback_context);
             this->mqtt_connection.disconnect(this->mqtt_context.get_mqtt_context());
             connected = false;
+        } else {
+            if (this->drained_callback != nullptr) {
+                this->drained_callback(this->drained_callback_context);
+            }
+            this->replay_outbound();
+            this->follow_group();
         }
 
         // Pause for a sec to give time for publish message to grab hold of the mutex.
-        vTaskDelay(100 / portTICK_PERIOD_MS);
+        vTaskDelay(MQTT_AGENT_LOOP_DELAY_MS / portTICK_PERIOD_MS);
     }
 
     vTaskDelete(NULL);
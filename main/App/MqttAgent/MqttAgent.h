@@ -14,7 +14,11 @@
 #include "Utils/FreeRTOSTask.h"
 #include "App/MqttAgent/MqttContext.h"
 #include "App/MqttAgent/MqttConnection.h"
+#include "App/MqttAgent/MqttTopics.h"
+#include "App/MqttAgent/IngressLimiter.h"
+#include "App/MqttAgent/OutboundQueue.h"
 #include "App/Configuration/ThingConfig.h"
+#include "App/Configuration/ChargePointConfig.h"
 
 #include "esp_err.h"
 #include "esp_event.h"
@@ -28,6 +32,19 @@
 #define MQTT_AGENT_TASK_CORE_NUM 0
 #define MQTT_AGENT_TASK_NAME "mqtt_agent"
 
+// Queued publishes sent per pass of the mqtt loop after a reconnect.
+#define MQTT_AGENT_REPLAY_PER_LOOP  (2)
+
+// Pause between passes of the mqtt loop, so publishes from other tasks get
+// the mutex.  The host tools lower it to measure the loop itself.
+#ifndef MQTT_AGENT_LOOP_DELAY_MS
+#define MQTT_AGENT_LOOP_DELAY_MS    (100)
+#endif
+
+// MQTT_ProcessLoop handles one packet per call, a pass of the mqtt loop
+// calls it until nothing more comes in, at most this many times.
+#define MQTT_AGENT_DRAIN_MAX_PACKETS    (32)
+
 typedef void (*mqttCallbackFn)(char *, unsigned int, uint8_t *, unsigned int);
 
 //******************************************************************************
@@ -46,7 +63,7 @@ public:
     ~MqttAgent(void) = default;
 
 public:
-    esp_err_t setup(ThingConfig* thing_config);
+    esp_err_t setup(ThingConfig* thing_config, ChargePointConfig* charge_point_config);
     void connect(void);
     void disconnect(void);
     inline bool is_connected(void) { return this->connected; }
@@ -54,6 +71,20 @@ public:
     esp_err_t subscribe(const char *topic, mqttCallbackFn callback, void* context);
     esp_err_t unsubscribe(const char *topic);
     esp_err_t publish_message(const char *topic, const char *payload, uint8_t retry_count = 0);
+    esp_err_t publish_message(mqtt_topic_t topic, const char *payload, uint8_t retry_count = 0);
+    esp_err_t publish_message(
+        const char *topic, uint16_t topic_length,
+        const char *payload, size_t payload_length,
+        uint8_t retry_count
+    );
+    esp_err_t publish_message(mqtt_topic_t topic, const char *payload, size_t payload_length, uint8_t retry_count);
+
+    inline MqttTopics& get_topics(void) { return this->topics; }
+    inline IngressLimiter& get_ingress_limiter(void) { return this->ingress_limiter; }
+    inline uint32_t get_outbound_dropped(void) const { return this->outbound_queue.get_dropped(); }
+    inline const connection_stats_t& get_connection_stats(void) const { return this->mqtt_connection.get_stats(); }
+    inline const MetricHistogram& get_handshake_ms(void) const { return this->mqtt_connection.get_handshake_ms(); }
+    inline const mqtt_traffic_counters_t& get_traffic_counters(void) const { return this->traffic; }
 
     typedef enum {
         e_mqtt_agent_connected,
@@ -66,15 +97,25 @@ public:
         this->event_callback_context = context;
     }
 
-    typedef void (*handle_incoming_mqtt_fn)(
-        const char* pTopicName,
-        uint16_t topicNameLength,
-        const char* pPayload,
-        size_t payloadLength,
-        uint16_t packetIdentifier,
-        void* context
-    );
-    void register_handle_incoming_mqtt(handle_incoming_mqtt_fn callback, void* context);
+    // Called from the mqtt task each time the inbound publishes received so
+    // far have all been dispatched.
+    typedef void(*drained_callback_t)(void* context);
+    inline void register_drained_callback(drained_callback_t callback, void* context) {
+        this->drained_callback = callback;
+        this->drained_callback_context = context;
+    }
+
+    // Called from the mqtt task on each connection, once subscribed and
+    // before the latest state is requested from the proxy.
+    typedef void(*subscribed_callback_t)(void* context);
+    inline void register_subscribed_callback(subscribed_callback_t callback, void* context) {
+        this->subscribed_callback = callback;
+        this->subscribed_callback_context = context;
+    }
+
+    inline esp_err_t register_topic_handler(mqtt_topic_t topic, mqtt_topic_handler_fn handler, void* context) {
+        return this->topics.register_handler(topic, handler, context);
+    }
 
 protected:
     virtual void taskFunction(void) override;
@@ -88,6 +129,7 @@ protected:
         struct MQTTContext * context,
         struct MQTTPacketInfo * packet_info,
         struct MQTTDeserializedInfo * deserialized_info);
+    void dispatch_publish(struct MQTTDeserializedInfo * deserialized_info);
 
     static void sOnEthEvent(void* arg, esp_event_base_t event_base, int32_t event_id, void *event_data) { ((MqttAgent*)arg)->onEthEvent(event_base, event_id, event_data); }
     static void sOnWifiEvent(void* arg, esp_event_base_t event_base, int32_t event_id, void *event_data) { ((MqttAgent*)arg)->onWifiEvent(event_base, event_id, event_data); }
@@ -104,22 +146,34 @@ protected:
 
 private:
     esp_err_t process_mqtt_loop(void);
+    esp_err_t queue_outbound(mqtt_topic_t topic, const char *payload, size_t payload_length);
+    void replay_outbound(void);
+    void follow_group(void);
 
 private:
 
     ThingConfig* thing_config;
+    ChargePointConfig* charge_point_config;
+    uint32_t config_generation = 0;     // config_blob_generation() the group topic was built at
     QueueHandle_t queue;
     EventGroupHandle_t event_group;
 
     MqttConnection mqtt_connection;
     MqttContext mqtt_context;
+    MqttTopics topics;
+    IngressLimiter ingress_limiter;
+    OutboundQueue outbound_queue;
+    SemaphoreHandle_t outbound_mutex;
 
     event_callback_t event_callback;
     void* event_callback_context;
-
-    handle_incoming_mqtt_fn handle_incoming_mqtt;
-    void* handle_incoming_mqtt_context;
+    drained_callback_t drained_callback = nullptr;
+    void* drained_callback_context = nullptr;
+    subscribed_callback_t subscribed_callback = nullptr;
+    void* subscribed_callback_context = nullptr;
 
     bool connected = false;
     SemaphoreHandle_t mqtt_mutex;
+    uint32_t packets_received = 0;
+    mqtt_traffic_counters_t traffic = {};
 };
\ No newline at end of file
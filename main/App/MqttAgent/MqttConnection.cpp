@@ -1,9 +1,15 @@
 #include "MqttConnection.h"
 #include "MqttConfig.h"
 
+#include "Utils/Time.h"
+
 #include "backoff_algorithm.h"
 #include "esp_err.h"
 
+#include "lwip/inet.h"
+#include "lwip/netdb.h"
+#include "lwip/sockets.h"
+
 #include <memory.h>
 
 static const char* TAG = "MqttConnection";
@@ -22,10 +28,19 @@ esp_err_t MqttConnection::initialize(ThingConfig* thing_config) {
     this->network_context.pcServerRootCA = this->thing_config->get_root_ca();
     this->network_context.pcServerRootCASize = strlen(this->network_context.pcServerRootCA) + 1;
 
-    this->network_context.pcClientCert = this->thing_config->get_certificate_pem();
-    this->network_context.pcClientCertSize = strlen(this->network_context.pcClientCert)+1;
-    this->network_context.pcClientKey = this->thing_config->get_private_key();
-    this->network_context.pcClientKeySize = strlen(this->network_context.pcClientKey)+1;
+    // DER read in place from the mapped certificate partition, tls parses
+    // it at each handshake.
+    size_t length = 0;
+    if (this->thing_config->get_client_certificate(this->network_context.pcClientCert, length) != ESP_OK) {
+        ESP_LOGE(TAG, "No client certificate");
+        return ESP_ERR_NOT_FOUND;
+    }
+    this->network_context.pcClientCertSize = length;
+    if (this->thing_config->get_client_key(this->network_context.pcClientKey, length) != ESP_OK) {
+        ESP_LOGE(TAG, "No client key");
+        return ESP_ERR_NOT_FOUND;
+    }
+    this->network_context.pcClientKeySize = length;
 
     return ESP_OK;
 }
@@ -43,7 +58,7 @@ esp_err_t MqttConnection::connect_with_retries(MQTTContext_t* mqtt_context, uint
                                        retry_count );
 
     do {
-        ret = xTlsConnect ( &this->network_context ) == TLS_TRANSPORT_SUCCESS ? ESP_OK : ESP_FAIL;
+        ret = this->tls_connect();
         if (ret == ESP_OK) {
             ESP_LOGI( TAG, "TLS connection established." );
             ret = connect_mqtt_socket( mqtt_context );
@@ -78,6 +93,135 @@ esp_err_t MqttConnection::connect_with_retries(MQTTContext_t* mqtt_context, uint
     return ret;
 }
 
+//*****************************************************************************
+/**
+ * @brief Resolve the broker endpoint.
+ */
+esp_err_t MqttConnection::resolve_endpoint(char* address, size_t size) {
+    struct addrinfo hints = {};
+    struct addrinfo* result = nullptr;
+    esp_err_t ret = ESP_OK;
+
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+
+    this->stats.dns_lookups++;
+    if (getaddrinfo(this->network_context.pcHostname, NULL, &hints, &result) != 0 || result == nullptr) {
+        ESP_LOGE(TAG, "Failed to resolve %s", this->network_context.pcHostname);
+        return ESP_FAIL;
+    }
+
+    struct sockaddr_in* ipv4 = (struct sockaddr_in*) result->ai_addr;
+    if (inet_ntop(AF_INET, &ipv4->sin_addr, address, size) == NULL) {
+        ret = ESP_FAIL;
+    }
+
+    freeaddrinfo(result);
+    return ret;
+}
+
+//*****************************************************************************
+/**
+ * @brief Open the tls connection to the broker.
+ * 
+ * Does what xTlsConnect from the network transport does, except that we
+ * connect to the cached address, the certificate is still checked against
+ * the endpoint name, and we offer the session of the last connection.
+ */
+esp_err_t MqttConnection::tls_connect(void) {
+    esp_err_t ret = ESP_OK;
+    esp_tls_cfg_t tls_config = {};
+    char address[ENDPOINT_ADDRESS_MAX_LENGTH] = {0};
+    const char* endpoint = this->network_context.pcHostname;
+    uint64_t now_ms = Time::instance().upTimeMS();
+
+    bool cached = this->endpoint_cache.get(now_ms, false, address, sizeof(address));
+    if (!cached) {
+        if (this->resolve_endpoint(address, sizeof(address)) == ESP_OK) {
+            this->endpoint_cache.store(address, now_ms);
+        } else if (this->endpoint_cache.get(now_ms, true, address, sizeof(address))) {
+            ESP_LOGW(TAG, "DNS failed, trying last known address %s", address);
+            cached = true;
+        } else {
+            return ESP_FAIL;
+        }
+    }
+
+    tls_config.cacert_buf = (const unsigned char*) this->network_context.pcServerRootCA;
+    tls_config.cacert_bytes = this->network_context.pcServerRootCASize;
+    tls_config.clientcert_buf = (const unsigned char*) this->network_context.pcClientCert;
+    tls_config.clientcert_bytes = this->network_context.pcClientCertSize;
+    tls_config.clientkey_buf = (const unsigned char*) this->network_context.pcClientKey;
+    tls_config.clientkey_bytes = this->network_context.pcClientKeySize;
+    tls_config.alpn_protos = this->network_context.pAlpnProtos;
+    tls_config.common_name = endpoint;
+    tls_config.timeout_ms = TLS_CONNECT_TIMEOUT_MS;
+
+#ifdef CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+    tls_config.client_session = this->tls_session;
+    this->stats.last_session_offered = this->tls_session != nullptr;
+#endif
+
+    esp_tls_t* tls = esp_tls_init();
+    if (tls == nullptr) {
+        ESP_LOGE(TAG, "Failed to allocate tls context");
+        return ESP_ERR_NO_MEM;
+    }
+
+    this->stats.attempts++;
+    uint64_t start_ms = Time::instance().upTimeMS();
+
+    xSemaphoreTake(this->network_context.xTlsContextSemaphore, portMAX_DELAY);
+    if (esp_tls_conn_new_sync(address, strlen(address), this->network_context.xPort, &tls_config, tls) <= 0) {
+        esp_tls_conn_destroy(tls);
+        this->network_context.pxTls = NULL;
+        ret = ESP_FAIL;
+    } else {
+        this->network_context.pxTls = tls;
+    }
+    xSemaphoreGive(this->network_context.xTlsContextSemaphore);
+
+    this->stats.last_handshake_ms = (uint32_t)(Time::instance().upTimeMS() - start_ms);
+    if (ret == ESP_OK) {
+        this->handshake_ms.observe(this->stats.last_handshake_ms);
+    }
+    ESP_LOGI(TAG, "TLS connect to %s (%s%s) %s in %lu ms",
+        address,
+        cached ? "cached" : "resolved",
+        this->stats.last_session_offered ? ", resuming" : "",
+        ret == ESP_OK ? "done" : "failed",
+        (unsigned long) this->stats.last_handshake_ms
+    );
+
+    if (ret != ESP_OK) {
+        // The broker may have moved, resolve again next time.
+        if (cached) {
+            this->endpoint_cache.expire();
+        }
+
+#ifdef CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+        // Don't keep offering a session that may be the problem.
+        if (this->tls_session != nullptr) {
+            esp_tls_free_client_session(this->tls_session);
+            this->tls_session = nullptr;
+        }
+#endif
+        return ret;
+    }
+
+#ifdef CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+    esp_tls_client_session_t* session = esp_tls_get_client_session(tls);
+    if (session != nullptr) {
+        if (this->tls_session != nullptr) {
+            esp_tls_free_client_session(this->tls_session);
+        }
+        this->tls_session = session;
+    }
+#endif
+
+    return ret;
+}
+
 //*****************************************************************************
 esp_err_t MqttConnection::disconnect(MQTTContext_t* mqtt_context) {
     esp_err_t ret = ESP_OK;
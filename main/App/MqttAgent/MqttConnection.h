@@ -14,6 +14,9 @@
 #include "Utils/NoCopy.h"
 
 #include "App/Configuration/ThingConfig.h"
+#include "App/MqttAgent/EndpointCache.h"
+#include "App/MqttAgent/ConnectionStats.h"
+#include "Utils/Metrics.h"
 
 #include "core_mqtt.h"
 #include "core_mqtt_state.h"
@@ -21,8 +24,21 @@
 #include "network_transport.h"
 #include "backoff_algorithm.h"
 
+#include "esp_tls.h"
+
 #include <stdint.h>
 
+#define TLS_CONNECT_TIMEOUT_MS  (3000)
+
+//******************************************************************************
+/**
+ * @brief Connection to the broker.
+ * 
+ * Reconnecting after a wifi blip is made cheap: the broker address is cached
+ * (see EndpointCache) and the tls session ticket of the last connection is
+ * offered so the broker can resume it instead of a full handshake with the
+ * client certificate.
+ */
 
 class MqttConnection : public NoCopy {
 public:
@@ -38,8 +54,12 @@ public:
     inline bool is_broker_session_present(void) const { return broker_session_present; }
     
     inline NetworkContext_t* get_network_context(void) { return &network_context; }
+    inline const connection_stats_t& get_stats(void) const { return this->stats; }
+    inline const MetricHistogram& get_handshake_ms(void) const { return this->handshake_ms; }
 
 private:
+    esp_err_t tls_connect(void);
+    esp_err_t resolve_endpoint(char* address, size_t size);
     esp_err_t connect_mqtt_socket(MQTTContext_t* mqtt_context);
     esp_err_t disconnect_mqtt_socket(MQTTContext_t* mqtt_context);
 
@@ -49,4 +69,14 @@ private:
     bool client_session_present = false;
     bool broker_session_present = false;
     StaticSemaphore_t xTlsContextSemaphoreBuffer;
+
+    EndpointCache endpoint_cache;
+#ifdef CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+    esp_tls_client_session_t* tls_session = nullptr;
+#endif
+    connection_stats_t stats = {};
+
+    // A resumed session is a few hundred ms, a full handshake seconds.
+    static constexpr uint32_t handshake_bounds[] = { 100, 250, 500, 1000, 2000, 4000, 8000 };
+    MetricHistogram handshake_ms{ handshake_bounds, sizeof(handshake_bounds) / sizeof(handshake_bounds[0]) };
 };
\ No newline at end of file
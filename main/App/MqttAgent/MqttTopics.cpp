@@ -0,0 +1,233 @@
+//******************************************************************************
+/**
+ * @file MqttTopics.cpp
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief MqttTopics class implementation
+ * @version 0.1
+ * @date 2024-02-05
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#include "MqttTopics.h"
+
+#include "esp_log.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static const char* TAG = "mqtt_topics";
+
+static const char* topic_suffixes[e_mqtt_topic_count] = {
+    "ledstate",
+    "ping",
+    "set-config",
+    "get-config",
+    "reboot",
+    "ledstate/mp",
+    "ota",
+    "ledstate",
+    "heartbeat",
+    "ack_ledstate",
+    "pong",
+    "light_sensor",
+    "config",
+    "latest",
+    "heartbeat/mp",
+    "ack_ledstate/mp",
+    "ota_status",
+};
+
+//******************************************************************************
+MqttTopics::MqttTopics(void) {
+    memset(this->topics, 0x00, sizeof(this->topics));
+}
+
+//******************************************************************************
+/**
+ * @brief Build the full topic strings and the inbound hash table.
+ *
+ * @param thing_name    Prefix for the topics we subscribe to.
+ * @param mac_address   Prefix for the topics we publish to.
+ * @param group_id      Prefix for the group ledstate, nullptr or empty if the
+ *                      chargepoint is not provisioned.
+ * @return esp_err_t    ESP_OK, or ESP_ERR_INVALID_SIZE if a topic does not fit.
+ */
+esp_err_t MqttTopics::build(const char* thing_name, const char* mac_address, const char* group_id) {
+    if (this->built) {
+        return ESP_OK;
+    }
+
+    if (thing_name == nullptr || mac_address == nullptr) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    for (int i = 0; i < e_mqtt_topic_count; i++) {
+        const char* prefix = is_inbound((mqtt_topic_t) i) || i == e_mqtt_topic_latest ? thing_name : mac_address;
+        if (i == e_mqtt_topic_group_ledstate) {
+            prefix = group_id;
+        }
+
+        esp_err_t ret = this->build_entry((mqtt_topic_t) i, prefix);
+        if (ret != ESP_OK) {
+            return ret;
+        }
+    }
+
+    this->index_inbound();
+    this->built = true;
+    return ESP_OK;
+}
+
+//******************************************************************************
+/**
+ * @brief Rebuild the group ledstate topic for a new group id.
+ *
+ * The chargepoint can be provisioned, moved or unprovisioned while we are
+ * connected.  The caller unsubscribes from the old topic and subscribes to
+ * the new one.
+ *
+ * @note Only from the mqtt task, the one routing the inbound publishes.
+ *
+ * @param group_id      nullptr or empty if the chargepoint is not provisioned.
+ * @return esp_err_t    ESP_ERR_INVALID_SIZE if the topic does not fit, the
+ *                      group topic is then empty.
+ */
+esp_err_t MqttTopics::set_group(const char* group_id) {
+    esp_err_t ret = this->build_entry(e_mqtt_topic_group_ledstate, group_id);
+    if (ret != ESP_OK) {
+        this->build_entry(e_mqtt_topic_group_ledstate, nullptr);
+    }
+
+    this->index_inbound();
+    return ret;
+}
+
+//******************************************************************************
+/**
+ * @brief Build the full name of one topic.
+ *
+ * @param prefix    nullptr or empty leaves the topic empty, never matched.
+ */
+esp_err_t MqttTopics::build_entry(mqtt_topic_t topic, const char* prefix) {
+    topic_entry_t& entry = this->topics[topic];
+
+    if (prefix == nullptr || prefix[0] == '\0') {
+        entry.name[0] = '\0';
+        entry.length = 0;
+        return ESP_OK;
+    }
+
+    int length = snprintf(entry.name, sizeof(entry.name), "%s/%s", prefix, topic_suffixes[topic]);
+    if (length < 0 || length >= (int) sizeof(entry.name)) {
+        ESP_LOGE(TAG, "Topic %s/%s is too long", prefix, topic_suffixes[topic]);
+        entry.name[0] = '\0';
+        entry.length = 0;
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    entry.length = (uint16_t) length;
+    entry.hash = hash(entry.name, entry.length);
+    return ESP_OK;
+}
+
+//******************************************************************************
+/**
+ * @brief Fill the hash table with the inbound topics that have a name.
+ */
+void MqttTopics::index_inbound(void) {
+    this->slots.clear();
+
+    for (int i = MQTT_TOPIC_FIRST_INBOUND; i <= MQTT_TOPIC_LAST_INBOUND; i++) {
+        if (this->topics[i].length > 0) {
+            this->slots.insert(this->topics[i].hash, i);
+        }
+    }
+}
+
+//******************************************************************************
+esp_err_t MqttTopics::register_handler(mqtt_topic_t topic, mqtt_topic_handler_fn handler, void* context) {
+    if (!is_inbound(topic)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    this->topics[topic].handler = handler;
+    this->topics[topic].context = context;
+    return ESP_OK;
+}
+
+//******************************************************************************
+/**
+ * @brief Find which of our inbound topics this is.
+ *
+ * @return mqtt_topic_t     e_mqtt_topic_unknown if not one of ours.
+ */
+mqtt_topic_t MqttTopics::lookup(const char* topic_name, uint16_t topic_length) const {
+    if (!this->built || topic_name == nullptr) {
+        return e_mqtt_topic_unknown;
+    }
+
+    uint32_t h = hash(topic_name, topic_length);
+    int index = this->slots.find(h, [&](int i) {
+        const topic_entry_t& entry = this->topics[i];
+        return entry.hash == h && entry.length == topic_length &&
+            memcmp(entry.name, topic_name, topic_length) == 0;
+    });
+
+    return index < 0 ? e_mqtt_topic_unknown : (mqtt_topic_t) index;
+}
+
+//******************************************************************************
+/**
+ * @brief Route an inbound publish to its handler.
+ *
+ * @return mqtt_topic_t     The topic that was matched, e_mqtt_topic_unknown
+ *                          if the topic isn't ours.
+ */
+mqtt_topic_t MqttTopics::dispatch(
+    const char* topic_name, uint16_t topic_length,
+    const char* payload, size_t payload_length,
+    uint16_t packet_id
+) const {
+    mqtt_topic_t topic = this->lookup(topic_name, topic_length);
+    if (topic == e_mqtt_topic_unknown) {
+        ESP_LOGE(TAG, "No route for topic %.*s", topic_length, topic_name);
+        return topic;
+    }
+
+    return this->dispatch(topic, payload, payload_length, packet_id);
+}
+
+//******************************************************************************
+/**
+ * @brief Route an inbound publish already looked up.
+ */
+mqtt_topic_t MqttTopics::dispatch(
+    mqtt_topic_t topic,
+    const char* payload, size_t payload_length,
+    uint16_t packet_id
+) const {
+    if (!is_inbound(topic)) {
+        return e_mqtt_topic_unknown;
+    }
+
+    const topic_entry_t& entry = this->topics[topic];
+    if (entry.handler == nullptr) {
+        ESP_LOGE(TAG, "No handler registered for topic %s", entry.name);
+        return topic;
+    }
+
+    entry.handler(payload, payload_length, packet_id, entry.context);
+    return topic;
+}
+
+//******************************************************************************
+/**
+ * @brief Topic name without the prefix, e.g. "ledstate".
+ */
+const char* MqttTopics::get_suffix(mqtt_topic_t topic) {
+    if (topic >= e_mqtt_topic_count) {
+        return "unknown";
+    }
+    return topic_suffixes[topic];
+}
@@ -0,0 +1,149 @@
+//******************************************************************************
+/**
+ * @file MqttTopics.h
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief MqttTopics class definition
+ * @version 0.1
+ * @date 2024-02-05
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#pragma once
+
+#include "Utils/NoCopy.h"
+#include "Utils/HashSlots.h"
+
+#include "esp_err.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MQTT_TOPIC_MAX_LENGTH   (64)
+
+// Must be a power of 2 and larger than the number of inbound topics.
+#define MQTT_TOPIC_HASH_SLOTS   (16)
+
+//******************************************************************************
+/**
+ * @brief Topics used by the device.
+ *
+ * Inbound topics are prefixed with the thing name, they are the ones we
+ * subscribe to.  Outbound topics are prefixed with the fuse mac address,
+ * except "latest" which the proxy has always listened for under the thing
+ * name.
+ * The group ledstate is prefixed with the chargepoint group id, one publish
+ * reaches every device of a site.
+ *
+ * Topics ending in "/mp" carry MessagePack instead of json.
+ */
+typedef enum {
+    // Inbound "<thing_name>/<suffix>"
+    e_mqtt_topic_ledstate,
+    e_mqtt_topic_ping,
+    e_mqtt_topic_set_config,
+    e_mqtt_topic_get_config,
+    e_mqtt_topic_reboot,
+    e_mqtt_topic_ledstate_mp,
+    e_mqtt_topic_ota,
+
+    // Inbound "<group_id>/<suffix>", not subscribed when not provisioned
+    e_mqtt_topic_group_ledstate,
+
+    // Outbound "<mac_address>/<suffix>"
+    e_mqtt_topic_heartbeat,
+    e_mqtt_topic_ack_ledstate,
+    e_mqtt_topic_pong,
+    e_mqtt_topic_light_sensor,
+    e_mqtt_topic_config,
+    e_mqtt_topic_latest,            // "<thing_name>/latest"
+    e_mqtt_topic_heartbeat_mp,
+    e_mqtt_topic_ack_ledstate_mp,
+    e_mqtt_topic_ota_status,
+
+    e_mqtt_topic_count,
+    e_mqtt_topic_unknown = e_mqtt_topic_count
+} mqtt_topic_t;
+
+#define MQTT_TOPIC_FIRST_INBOUND    e_mqtt_topic_ledstate
+#define MQTT_TOPIC_LAST_INBOUND     e_mqtt_topic_group_ledstate
+#define MQTT_TOPIC_INBOUND_COUNT    (MQTT_TOPIC_LAST_INBOUND - MQTT_TOPIC_FIRST_INBOUND + 1)
+
+typedef void (*mqtt_topic_handler_fn)(
+    const char* pPayload,
+    size_t payloadLength,
+    uint16_t packetIdentifier,
+    void* context
+);
+
+//******************************************************************************
+/**
+ * @brief Topic registry and inbound router.
+ *
+ * The full topic strings are built once, when we first connect, from the
+ * thing name, the mac address and the group id.  After that, publishing is just a lookup
+ * and routing an inbound publish is one hash and one memcmp, no matter how
+ * many topics we subscribe to.
+ *
+ * Handlers can be registered before the topics are built.
+ *
+ * Without a group id the group topic is left empty, get_length() returns 0
+ * and it is never matched.  The group topic follows the chargepoint config,
+ * set_group() rebuilds it.
+ *
+ * @note The outbound topics are never rebuilt once built, they are read
+ *       from several tasks without locking.  The inbound ones are only
+ *       read from the mqtt task, which is the one calling set_group().
+ */
+class MqttTopics : public NoCopy {
+public:
+    MqttTopics(void);
+    ~MqttTopics(void) = default;
+
+public:
+    esp_err_t build(const char* thing_name, const char* mac_address, const char* group_id = nullptr);
+    inline bool is_built(void) const { return this->built; }
+    esp_err_t set_group(const char* group_id);
+
+    inline const char* get(mqtt_topic_t topic) const { return this->topics[topic].name; }
+    inline uint16_t get_length(mqtt_topic_t topic) const { return this->topics[topic].length; }
+    static inline bool is_inbound(mqtt_topic_t topic) {
+        return topic >= MQTT_TOPIC_FIRST_INBOUND && topic <= MQTT_TOPIC_LAST_INBOUND;
+    }
+
+    esp_err_t register_handler(mqtt_topic_t topic, mqtt_topic_handler_fn handler, void* context);
+
+    mqtt_topic_t lookup(const char* topic_name, uint16_t topic_length) const;
+    mqtt_topic_t dispatch(
+        const char* topic_name, uint16_t topic_length,
+        const char* payload, size_t payload_length,
+        uint16_t packet_id
+    ) const;
+    mqtt_topic_t dispatch(
+        mqtt_topic_t topic,
+        const char* payload, size_t payload_length,
+        uint16_t packet_id
+    ) const;
+
+    static const char* get_suffix(mqtt_topic_t topic);
+    static inline uint32_t hash(const char* data, size_t length) { return fnv1a_hash(data, length); }
+
+private:
+    esp_err_t build_entry(mqtt_topic_t topic, const char* prefix);
+    void index_inbound(void);
+
+private:
+    typedef struct {
+        char name[MQTT_TOPIC_MAX_LENGTH];
+        uint16_t length;
+        uint32_t hash;
+        mqtt_topic_handler_fn handler;
+        void* context;
+    } topic_entry_t;
+
+    topic_entry_t topics[e_mqtt_topic_count];
+
+    // Indexes into topics, the inbound ones.
+    HashSlots<MQTT_TOPIC_HASH_SLOTS> slots;
+    bool built = false;
+};
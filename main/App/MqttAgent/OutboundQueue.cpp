@@ -0,0 +1,152 @@
+//******************************************************************************
+/**
+ * @file OutboundQueue.cpp
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief OutboundQueue class implementation
+ * @version 0.1
+ * @date 2024-02-19
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#include "OutboundQueue.h"
+
+#include "esp_log.h"
+
+#include <string.h>
+
+static const char* TAG = "outbound_queue";
+
+//******************************************************************************
+OutboundQueue::OutboundQueue(void) {
+    for (int i = 0; i < e_mqtt_topic_count; i++) {
+        this->policies[i] = e_outbound_drop;
+    }
+
+    this->policies[e_mqtt_topic_heartbeat] = e_outbound_keep_latest;
+    this->policies[e_mqtt_topic_heartbeat_mp] = e_outbound_keep_latest;
+    this->policies[e_mqtt_topic_light_sensor] = e_outbound_keep_latest;
+    this->policies[e_mqtt_topic_config] = e_outbound_keep_latest;
+    this->policies[e_mqtt_topic_ota_status] = e_outbound_keep_latest;
+    this->policies[e_mqtt_topic_ack_ledstate] = e_outbound_keep_all;
+    this->policies[e_mqtt_topic_ack_ledstate_mp] = e_outbound_keep_all;
+}
+
+//******************************************************************************
+void OutboundQueue::set_policy(mqtt_topic_t topic, outbound_policy_t policy) {
+    if (topic < e_mqtt_topic_count && !MqttTopics::is_inbound(topic)) {
+        this->policies[topic] = policy;
+    }
+}
+
+//******************************************************************************
+outbound_policy_t OutboundQueue::get_policy(mqtt_topic_t topic) const {
+    if (topic >= e_mqtt_topic_count) {
+        return e_outbound_drop;
+    }
+    return this->policies[topic];
+}
+
+//******************************************************************************
+/**
+ * @brief Queue a publish.
+ *
+ * @return esp_err_t    ESP_OK if queued.
+ *                      ESP_ERR_NOT_SUPPORTED if the topic is never queued.
+ *                      ESP_ERR_INVALID_SIZE if it can't fit even when empty.
+ */
+esp_err_t OutboundQueue::push(mqtt_topic_t topic, const char* payload, size_t length) {
+    outbound_policy_t policy = this->get_policy(topic);
+    if (policy == e_outbound_drop) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    size_t needed = sizeof(entry_header_t) + length;
+    if (length > UINT16_MAX || needed > sizeof(this->buffer)) {
+        this->dropped++;
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    if (policy == e_outbound_keep_latest) {
+        size_t offset = this->find(topic);
+        if (offset != SIZE_MAX) {
+            this->remove(offset);
+        }
+    }
+
+    // Make room by dropping the oldest.
+    while (sizeof(this->buffer) - this->used < needed) {
+        entry_header_t header;
+        memcpy(&header, this->buffer, sizeof(header));
+        ESP_LOGW(TAG, "Queue full, dropping %s", MqttTopics::get_suffix((mqtt_topic_t) header.topic));
+        this->remove(0);
+        this->dropped++;
+    }
+
+    entry_header_t header = { (uint8_t) topic, 0, (uint16_t) length };
+    memcpy(this->buffer + this->used, &header, sizeof(header));
+    memcpy(this->buffer + this->used + sizeof(header), payload, length);
+    this->used += needed;
+    this->entries++;
+    return ESP_OK;
+}
+
+//******************************************************************************
+/**
+ * @brief Oldest publish in the queue.
+ *
+ * The payload points into the queue, it is valid until the next push or pop.
+ */
+bool OutboundQueue::peek(mqtt_topic_t* topic, const char** payload, size_t* length) const {
+    if (this->entries == 0) {
+        return false;
+    }
+
+    entry_header_t header;
+    memcpy(&header, this->buffer, sizeof(header));
+    *topic = (mqtt_topic_t) header.topic;
+    *payload = (const char*) this->buffer + sizeof(header);
+    *length = header.length;
+    return true;
+}
+
+//******************************************************************************
+void OutboundQueue::pop(void) {
+    if (this->entries > 0) {
+        this->remove(0);
+    }
+}
+
+//******************************************************************************
+void OutboundQueue::clear(void) {
+    this->used = 0;
+    this->entries = 0;
+}
+
+//******************************************************************************
+/**
+ * @brief Offset of the queued entry for topic, SIZE_MAX if none.
+ */
+size_t OutboundQueue::find(mqtt_topic_t topic) const {
+    size_t offset = 0;
+    while (offset < this->used) {
+        entry_header_t header;
+        memcpy(&header, this->buffer + offset, sizeof(header));
+        if (header.topic == topic) {
+            return offset;
+        }
+        offset += sizeof(header) + header.length;
+    }
+    return SIZE_MAX;
+}
+
+//******************************************************************************
+void OutboundQueue::remove(size_t offset) {
+    entry_header_t header;
+    memcpy(&header, this->buffer + offset, sizeof(header));
+
+    size_t size = sizeof(header) + header.length;
+    memmove(this->buffer + offset, this->buffer + offset + size, this->used - offset - size);
+    this->used -= size;
+    this->entries--;
+}
@@ -0,0 +1,81 @@
+//******************************************************************************
+/**
+ * @file OutboundQueue.h
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief OutboundQueue class definition
+ * @version 0.1
+ * @date 2024-02-19
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#pragma once
+
+#include "Utils/NoCopy.h"
+#include "App/MqttAgent/MqttTopics.h"
+
+#include "esp_err.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define OUTBOUND_QUEUE_SIZE     (8192)
+
+typedef enum {
+    e_outbound_drop,            // not worth sending late
+    e_outbound_keep_latest,     // only the newest one is kept
+    e_outbound_keep_all,        // all kept, oldest dropped when full
+} outbound_policy_t;
+
+//******************************************************************************
+/**
+ * @brief Outbound publishes waiting for the broker.
+ *
+ * While we are disconnected, publishes to our outbound topics are queued
+ * here instead of being lost, and replayed in order once we reconnect.
+ *
+ * What is kept depends on the topic:
+ *   - heartbeat, config: keep the latest, an old one is of no use.
+ *   - ack_ledstate: keep all, the proxy wants to know what we applied.
+ *   - pong, latest: drop, they only mean something while connected.
+ *
+ * Entries are packed back to back in one buffer, in order.  The queue is a
+ * few KB so moving it down on pop costs less than managing a wrap around.
+ *
+ * @note Not thread safe, MqttAgent locks around it.
+ */
+class OutboundQueue : public NoCopy {
+public:
+    OutboundQueue(void);
+    ~OutboundQueue(void) = default;
+
+public:
+    void set_policy(mqtt_topic_t topic, outbound_policy_t policy);
+    outbound_policy_t get_policy(mqtt_topic_t topic) const;
+
+    esp_err_t push(mqtt_topic_t topic, const char* payload, size_t length);
+    bool peek(mqtt_topic_t* topic, const char** payload, size_t* length) const;
+    void pop(void);
+    void clear(void);
+
+    inline size_t size(void) const { return this->entries; }
+    inline bool empty(void) const { return this->entries == 0; }
+    inline uint32_t get_dropped(void) const { return this->dropped; }
+
+private:
+    typedef struct {
+        uint8_t topic;
+        uint8_t reserved;
+        uint16_t length;
+    } entry_header_t;
+
+    size_t find(mqtt_topic_t topic) const;
+    void remove(size_t offset);
+
+    uint8_t buffer[OUTBOUND_QUEUE_SIZE];
+    size_t used = 0;
+    size_t entries = 0;
+    uint32_t dropped = 0;
+    outbound_policy_t policies[e_mqtt_topic_count];
+};
@@ -0,0 +1,182 @@
+//******************************************************************************
+/**
+ * @file OtaPullAgent.cpp
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief OtaPullAgent class implementation
+ * @version 0.1
+ * @date 2024-03-01
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#include "OtaPullAgent.h"
+
+#include "Utils/Updater.h"
+
+#include "esp_log.h"
+#include "esp_system.h"
+
+#include <sys/param.h>
+
+// Time for the status to go out before the reboot.
+#define OTA_PULL_REBOOT_DELAY_MS    (3000)
+
+static const char* TAG = "ota_pull";
+
+static const char* status_names[] = {
+    "accepted",
+    "resumed",
+    "retrying",
+    "succeeded",
+    "failed",
+    "rejected",
+    "cancelled",
+};
+
+//******************************************************************************
+const char* OtaPullAgent::status_to_string(ota_pull_status_t status) {
+    if (status < 0 || status >= (int)(sizeof(status_names) / sizeof(status_names[0]))) {
+        return "unknown";
+    }
+    return status_names[status];
+}
+
+//******************************************************************************
+esp_err_t OtaPullAgent::setup(void) {
+    this->message_queue = xQueueCreate(2, sizeof(ota_pull_message_t));
+    return this->message_queue != nullptr ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+//******************************************************************************
+/**
+ * @brief Hand a job to the task.
+ *
+ * @return esp_err_t    ESP_ERR_NO_MEM if jobs are already waiting.
+ */
+esp_err_t OtaPullAgent::submit(const ota_job_t& job) {
+    if (this->message_queue == nullptr) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    ota_pull_message_t message = {};
+    message.command = e_ota_pull_job;
+    message.job = job;
+    return xQueueSend(this->message_queue, &message, 0) == pdTRUE ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+//******************************************************************************
+/**
+ * @brief Stop the job, a run in progress stops after the block it is on.
+ */
+esp_err_t OtaPullAgent::cancel(void) {
+    if (this->message_queue == nullptr) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    this->engine.cancel();
+
+    ota_pull_message_t message = {};
+    message.command = e_ota_pull_cancel;
+    return xQueueSend(this->message_queue, &message, 0) == pdTRUE ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+//******************************************************************************
+void OtaPullAgent::report(ota_pull_status_t status, esp_err_t error) {
+    ESP_LOGI(TAG, "Job %s %s, %lu of %lu blocks", this->engine.get_job().job_id, status_to_string(status),
+        this->engine.get_stats().blocks_done, this->engine.get_stats().block_count);
+    if (this->status_callback != nullptr) {
+        this->status_callback(status, this->engine.get_job(), this->engine.get_stats(), error, this->status_context);
+    }
+}
+
+//******************************************************************************
+void OtaPullAgent::open_job(const ota_job_t& job) {
+    esp_err_t ret = this->engine.open(job);
+    if (ret != ESP_OK) {
+        // Report against the job received, the engine may hold another.
+        ota_block_stats_t stats = {};
+        ESP_LOGE(TAG, "Job %s rejected (%s)", job.job_id, esp_err_to_name(ret));
+        if (this->status_callback != nullptr) {
+            this->status_callback(e_ota_pull_rejected, job, stats, ret, this->status_context);
+        }
+        return;
+    }
+
+    FwUpdater::instance().set_pull_active(true);
+    this->retry_ms = OTA_PULL_RETRY_MIN_MS;
+    this->failed_runs = 0;
+    this->report(this->engine.get_stats().blocks_resumed != 0 ? e_ota_pull_resumed : e_ota_pull_accepted);
+}
+
+//******************************************************************************
+void OtaPullAgent::close_job(void) {
+    if (this->engine.is_open()) {
+        this->engine.close();
+    }
+    FwUpdater::instance().set_pull_active(false);
+}
+
+//******************************************************************************
+/**
+ * @brief One run of the job, reboots into the image once it is in.
+ */
+void OtaPullAgent::run_job(void) {
+    uint32_t blocks_before = this->engine.get_stats().blocks_done;
+
+    esp_err_t ret = this->engine.run();
+    if (ret == ESP_OK) {
+        this->report(e_ota_pull_succeeded);
+        FwUpdater::instance().set_pull_active(false);
+        vTaskDelay(pdMS_TO_TICKS(OTA_PULL_REBOOT_DELAY_MS));
+        esp_restart();
+    }
+
+    if (!this->engine.is_open()) {
+        this->report(ret == ESP_ERR_INVALID_STATE ? e_ota_pull_cancelled : e_ota_pull_failed, ret);
+        this->close_job();
+        return;
+    }
+
+    if (this->engine.get_stats().blocks_done != blocks_before) {
+        this->failed_runs = 0;
+        this->retry_ms = OTA_PULL_RETRY_MIN_MS;
+    } else if (++this->failed_runs >= OTA_PULL_MAX_FAILED_RUNS) {
+        this->report(e_ota_pull_failed, ret);
+        this->close_job();
+        return;
+    } else {
+        this->retry_ms = MIN(this->retry_ms * 2, (uint32_t) OTA_PULL_RETRY_MAX_MS);
+    }
+
+    this->report(e_ota_pull_retrying, ret);
+}
+
+//******************************************************************************
+void OtaPullAgent::taskFunction(void) {
+    ESP_LOGI(TAG, "Starting OtaPullAgent task");
+    ota_pull_message_t message;
+
+    if (this->engine.resume() == ESP_OK) {
+        FwUpdater::instance().set_pull_active(true);
+        this->report(e_ota_pull_resumed);
+    }
+
+    while (1) {
+        // Runs right after a job comes in, then waits between tries.
+        TickType_t wait = this->engine.is_open() ? pdMS_TO_TICKS(this->retry_ms) : portMAX_DELAY;
+        if (xQueueReceive(this->message_queue, &message, wait) == pdTRUE) {
+            if (message.command == e_ota_pull_cancel) {
+                if (this->engine.is_open()) {
+                    this->report(e_ota_pull_cancelled);
+                    this->close_job();
+                }
+                continue;
+            }
+            this->open_job(message.job);
+        }
+
+        if (this->engine.is_open()) {
+            this->run_job();
+        }
+    }
+}
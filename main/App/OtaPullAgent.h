@@ -0,0 +1,112 @@
+//******************************************************************************
+/**
+ * @file OtaPullAgent.h
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief OtaPullAgent class definition
+ * @version 0.1
+ * @date 2024-03-01
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#pragma once
+
+#include "Utils/FreeRTOSTask.h"
+#include "Utils/OtaBlockEngine.h"
+#include "Utils/OtaBlockDevice.h"
+
+#include "freertos/queue.h"
+
+#define OTA_PULL_TASK_STACK_SIZE    8192
+#define OTA_PULL_TASK_PRIORITY      4
+#define OTA_PULL_TASK_CORE_NUM      0
+#define OTA_PULL_TASK_NAME          "ota_pull"
+
+// Wait between runs that gave up, doubled each time.
+#define OTA_PULL_RETRY_MIN_MS       (10 * 1000)
+#define OTA_PULL_RETRY_MAX_MS       (5 * 60 * 1000)
+
+// Runs in a row without a block before the job is dropped.
+#define OTA_PULL_MAX_FAILED_RUNS    (20)
+
+typedef enum {
+    e_ota_pull_accepted,
+    e_ota_pull_resumed,
+    e_ota_pull_retrying,
+    e_ota_pull_succeeded,
+    e_ota_pull_failed,
+    e_ota_pull_rejected,
+    e_ota_pull_cancelled,
+} ota_pull_status_t;
+
+typedef void (*ota_pull_status_fn)(
+    ota_pull_status_t status,
+    const ota_job_t& job,
+    const ota_block_stats_t& stats,
+    esp_err_t error,
+    void* context
+);
+
+//******************************************************************************
+/**
+ * @brief Runs the pull update jobs received over mqtt.
+ *
+ * A job persisted before a reboot is picked up when the task starts.  When
+ * a run gives up, the network is down or the server is gone, it is tried
+ * again later.  Once the image is in, the status is reported and the device
+ * reboots into it.
+ *
+ * A job received while one runs is handled once that run stops.
+ */
+class OtaPullAgent : public FreeRTOSTask {
+public:
+    OtaPullAgent(void) : FreeRTOSTask(
+        OTA_PULL_TASK_STACK_SIZE,
+        OTA_PULL_TASK_PRIORITY,
+        OTA_PULL_TASK_CORE_NUM
+    ), engine(source, store) {};
+    ~OtaPullAgent(void) = default;
+
+public:
+    esp_err_t setup(void);
+    inline void register_status_callback(ota_pull_status_fn callback, void* context) {
+        this->status_callback = callback;
+        this->status_context = context;
+    }
+
+    esp_err_t submit(const ota_job_t& job);
+    esp_err_t cancel(void);
+
+    virtual const char* task_name(void) override { return OTA_PULL_TASK_NAME; }
+
+    static const char* status_to_string(ota_pull_status_t status);
+
+protected:
+    virtual void taskFunction(void) override;
+    void open_job(const ota_job_t& job);
+    void run_job(void);
+    void close_job(void);
+    void report(ota_pull_status_t status, esp_err_t error = ESP_OK);
+
+private:
+    typedef enum {
+        e_ota_pull_job,
+        e_ota_pull_cancel,
+    } ota_pull_command_t;
+
+    typedef struct {
+        ota_pull_command_t command;
+        ota_job_t job;                  // e_ota_pull_job only
+    } ota_pull_message_t;
+
+    HttpBlockSource source;
+    PartitionBlockStore store;
+    OtaBlockEngine engine;
+
+    QueueHandle_t message_queue = nullptr;
+    uint32_t retry_ms = OTA_PULL_RETRY_MIN_MS;
+    uint32_t failed_runs = 0;
+
+    ota_pull_status_fn status_callback = nullptr;
+    void* status_context = nullptr;
+};
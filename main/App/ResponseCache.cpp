@@ -0,0 +1,73 @@
+//******************************************************************************
+/**
+ * @file ResponseCache.cpp
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief ResponseCache class implementation
+ * @version 0.1
+ * @date 2024-02-28
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#include "ResponseCache.h"
+
+#include "Utils/ConfigBlob.h"
+
+#include <string.h>
+
+//******************************************************************************
+/**
+ * @brief Ours and the configurations', both only go up.
+ */
+uint32_t ResponseCache::get_generation(void) const {
+    return this->generation + config_blob_generation();
+}
+
+//******************************************************************************
+/**
+ * @brief Copy a cached response, null terminated.
+ *
+ * @param out_len   In the size of out, out the length of the response.
+ * @return true     Hit.
+ */
+bool ResponseCache::get(int slot, uint32_t key, char* out, int& out_len) {
+    if (slot < 0 || slot >= RESPONSE_CACHE_SLOTS) {
+        return false;
+    }
+
+    const auto& entry = this->entries[slot];
+    if (!entry.valid || entry.generation != this->get_generation() || entry.key != key || entry.length >= out_len) {
+        this->misses++;
+        return false;
+    }
+
+    memcpy(out, entry.data, entry.length);
+    out[entry.length] = '\0';
+    out_len = entry.length;
+    this->hits++;
+    return true;
+}
+
+//******************************************************************************
+/**
+ * @brief Keep a response.
+ *
+ * @param generation    get_generation() from before the response was built.
+ */
+void ResponseCache::put(int slot, uint32_t key, uint32_t generation, const char* data, size_t length) {
+    if (slot < 0 || slot >= RESPONSE_CACHE_SLOTS) {
+        return;
+    }
+
+    auto& entry = this->entries[slot];
+    if (length > sizeof(entry.data)) {
+        entry.valid = false;
+        return;
+    }
+
+    memcpy(entry.data, data, length);
+    entry.length = (uint16_t) length;
+    entry.key = key;
+    entry.generation = generation;
+    entry.valid = true;
+}
@@ -0,0 +1,65 @@
+//******************************************************************************
+/**
+ * @file ResponseCache.h
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief ResponseCache class definition
+ * @version 0.1
+ * @date 2024-02-28
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#pragma once
+
+#include "Utils/NoCopy.h"
+
+#include <atomic>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define RESPONSE_CACHE_SLOTS    (2)
+#define RESPONSE_CACHE_SIZE     (1024)
+
+//******************************************************************************
+/**
+ * @brief Serialized responses kept until what they report changes.
+ *
+ * A response is stored with the generation taken before it was built and a
+ * key for what it shows that is not covered by the generation (the led
+ * states for get-info).  The generation moves with every configuration
+ * save() or reset(), whoever does it (udp server, console, mqtt), and with
+ * invalidate() for the rest.  A response built while it was being
+ * invalidated is never served.
+ *
+ * @note get() and put() from the udp task only, invalidate() from any task.
+ */
+class ResponseCache : public NoCopy {
+public:
+    ResponseCache(void) = default;
+    ~ResponseCache(void) = default;
+
+public:
+    inline void invalidate(void) { this->generation++; }
+    uint32_t get_generation(void) const;
+
+    bool get(int slot, uint32_t key, char* out, int& out_len);
+    void put(int slot, uint32_t key, uint32_t generation, const char* data, size_t length);
+
+    inline uint32_t get_hits(void) const { return this->hits; }
+    inline uint32_t get_misses(void) const { return this->misses; }
+
+private:
+    struct {
+        bool valid;
+        uint32_t generation;
+        uint32_t key;
+        uint16_t length;
+        char data[RESPONSE_CACHE_SIZE];
+    } entries[RESPONSE_CACHE_SLOTS] = {};
+
+    std::atomic<uint32_t> generation{1};
+    uint32_t hits = 0;
+    uint32_t misses = 0;
+};
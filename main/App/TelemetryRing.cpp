@@ -0,0 +1,48 @@
+//******************************************************************************
+/**
+ * @file TelemetryRing.cpp
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief TelemetryRing class implementation
+ * @version 0.1
+ * @date 2024-02-16
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#include "TelemetryRing.h"
+
+//******************************************************************************
+/**
+ * @brief Add an event, overwriting the oldest one if the ring is full.
+ *
+ * @return true     The ring reached the flush threshold.
+ */
+bool TelemetryRing::push(const telemetry_event_t& event) {
+    if (this->count == TELEMETRY_RING_SIZE) {
+        this->head = (this->head + 1) % TELEMETRY_RING_SIZE;
+        this->count--;
+        this->dropped++;
+    }
+
+    this->events[(this->head + this->count) % TELEMETRY_RING_SIZE] = event;
+    this->count++;
+
+    return this->should_flush();
+}
+
+//******************************************************************************
+/**
+ * @brief Event by age, 0 is the oldest.
+ */
+const telemetry_event_t& TelemetryRing::at(size_t index) const {
+    return this->events[(this->head + index) % TELEMETRY_RING_SIZE];
+}
+
+//******************************************************************************
+/**
+ * @brief Forget the events once they are published, dropped is kept.
+ */
+void TelemetryRing::clear(void) {
+    this->head = 0;
+    this->count = 0;
+}
@@ -0,0 +1,67 @@
+//******************************************************************************
+/**
+ * @file TelemetryRing.h
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief TelemetryRing class definition
+ * @version 0.1
+ * @date 2024-02-16
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#pragma once
+
+#include "Utils/NoCopy.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define TELEMETRY_RING_SIZE             (32)
+
+// Flush before the ring is full so nothing is lost while we publish.
+#define TELEMETRY_FLUSH_THRESHOLD       (24)
+
+typedef enum {
+    e_telemetry_state,          // state machine transition, name is the new state
+    e_telemetry_night_mode,     // light sensor edge, value is 1 for night
+} telemetry_event_type_t;
+
+typedef struct {
+    uint32_t time_s;            // uptime
+    telemetry_event_type_t type;
+    int32_t value;
+    const char* name;           // static string, never freed
+} telemetry_event_t;
+
+//******************************************************************************
+/**
+ * @brief Events waiting for the next heartbeat.
+ *
+ * Events are sent with the heartbeat instead of one message each.  When the
+ * ring is full the oldest event is overwritten and counted as dropped.
+ *
+ * @note Not thread safe, only used from the heartbeat task.  Other tasks
+ *       post their events through the heartbeat queue.
+ */
+class TelemetryRing : public NoCopy {
+public:
+    TelemetryRing(size_t flush_threshold = TELEMETRY_FLUSH_THRESHOLD) : flush_threshold(flush_threshold) {}
+    ~TelemetryRing(void) = default;
+
+public:
+    bool push(const telemetry_event_t& event);
+    void clear(void);
+
+    const telemetry_event_t& at(size_t index) const;
+    inline size_t size(void) const { return this->count; }
+    inline bool should_flush(void) const { return this->count >= this->flush_threshold; }
+    inline uint32_t get_dropped(void) const { return this->dropped; }
+
+private:
+    size_t flush_threshold;
+    telemetry_event_t events[TELEMETRY_RING_SIZE] = {};
+    size_t head = 0;            // oldest event
+    size_t count = 0;
+    uint32_t dropped = 0;
+};
@@ -0,0 +1,102 @@
+//******************************************************************************
+/**
+ * @file ddp_server.cpp
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief Pixel stream receiver, DDP over udp
+ * @version 0.1
+ * @date 2024-02-26
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#include "ddp_server.h"
+
+#include "LED/PixelStream.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "lwip/sockets.h"
+
+#include <string.h>
+
+//*****************************************************************************
+// Static variables
+//*****************************************************************************
+
+static const char *TAG = "ddp_server";
+
+// One packet, the largest DDP payload with the timecode.
+static uint8_t rx_buffer[DDP_HEADER_LENGTH + DDP_TIMECODE_LENGTH + 1440];
+
+static MN8Context *context = nullptr;
+
+//*****************************************************************************
+/**
+ * @brief Receive the frames of a lighting controller.
+ *
+ * Nothing is logged per packet, a controller sends up to a few thousand a
+ * second.  The LED tasks are woken up when a frame is complete.
+ */
+static void ddp_server_task(void *pvParameters)
+{
+    PixelStream& pixel_stream = context->get_pixel_stream();
+    LedTaskSpi& led_task_0 = context->get_led_task_0();
+    LedTaskSpi& led_task_1 = context->get_led_task_1();
+
+    while (1)
+    {
+        int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
+        if (sock < 0)
+        {
+            ESP_LOGE(TAG, "Unable to create socket: errno %d", errno);
+            break;
+        }
+
+        struct sockaddr_in dest_addr = {};
+        dest_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        dest_addr.sin_family = AF_INET;
+        dest_addr.sin_port = htons(DDP_PORT);
+
+        if (bind(sock, (struct sockaddr *)&dest_addr, sizeof(dest_addr)) < 0)
+        {
+            ESP_LOGE(TAG, "Socket unable to bind: errno %d", errno);
+            close(sock);
+            vTaskDelay(pdMS_TO_TICKS(1000));
+            continue;
+        }
+        ESP_LOGI(TAG, "Socket bound, port %d", DDP_PORT);
+
+        while (1)
+        {
+            int len = recv(sock, rx_buffer, sizeof(rx_buffer), 0);
+            if (len < 0)
+            {
+                ESP_LOGE(TAG, "recv failed: errno %d", errno);
+                break;
+            }
+
+            uint32_t now_ms = esp_timer_get_time() / 1000;
+            if (pixel_stream.receive(rx_buffer, len, now_ms) == e_pixel_stream_frame)
+            {
+                led_task_0.notify_frame();
+                led_task_1.notify_frame();
+            }
+        }
+
+        ESP_LOGE(TAG, "Shutting down socket and restarting...");
+        shutdown(sock, 0);
+        close(sock);
+    }
+    vTaskDelete(NULL);
+}
+
+//*****************************************************************************
+esp_err_t start_ddp_server(MN8Context *context)
+{
+    ::context = context;
+    xTaskCreate(ddp_server_task, "ddp_server", 4096, NULL, 6, NULL);
+    return ESP_OK;
+}
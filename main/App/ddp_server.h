@@ -0,0 +1,7 @@
+#pragma once
+
+#include "MN8Context.h"
+
+#include "esp_err.h"
+
+esp_err_t start_ddp_server(MN8Context* context);
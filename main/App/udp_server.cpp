@@ -8,6 +8,8 @@
 */
 
 #include "udp_server.h"
+#include "CommandTable.h"
+#include "ResponseCache.h"
 
 #include "App/Configuration/ChargePointConfig.h"
 #include "App/Configuration/ThingConfig.h"
@@ -16,6 +18,7 @@
 #include "Utils/FuseMacAddress.h"
 #include "Utils/iot_provisioning.h"
 #include "Utils/KeyStore.h"
+#include "Utils/ScratchArena.h"
 
 #include "rev.h"
 
@@ -29,16 +32,43 @@
 #include "esp_wifi.h"
 #include "esp_event.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_random.h"
 #include "nvs_flash.h"
 #include "esp_netif.h"
 
 #include "lwip/sockets.h"
 #include "lwip/sys.h"
 #include <lwip/netdb.h>
+#include "lwip/netif.h"
 
 #define PORT 23269
 
-#define STR_IS_EQUAL(str1, str2) (strncasecmp(str1, str2, strlen(str2)) == 0)
+// Commands in one datagram.
+#define UDP_MAX_BATCH 16
+
+// Leased from the scratch arena, the receive buffer for the life of the task,
+// the documents and the reply for each request.
+#define UDP_RX_BUFFER_SIZE          4096
+#define UDP_REQUEST_JSON_CAPACITY   2048
+#define UDP_RESPONSE_JSON_CAPACITY  4096
+#define UDP_SCRATCH_WAIT_MS         1000
+
+// Reply to a lan ledstate, on the stack.
+#define UDP_LEDSTATE_ACK_SIZE       128
+
+// Replies to a broadcast are spread over this window so that a discovery
+// sweep is not answered by the whole site in the same millisecond.
+#define UDP_BROADCAST_JITTER_MS 250
+
+// A reboot or a factory reset restarts once its reply had time to get out.
+#define UDP_RESTART_DELAY_MS    100
+
+// Cached responses.
+#define UDP_CACHE_NONE                  (-1)
+#define UDP_CACHE_GET_INFO              (0)
+#define UDP_CACHE_CHARGEPOINT_CONFIG    (1)
+
 #define STR_IS_NULL_OR_EMPTY(str) (str == nullptr || strlen(str) == 0)
 
 //*****************************************************************************
@@ -47,15 +77,41 @@
 
 static const char *TAG = "udp_server";
 
-static char rx_buffer[4096];
-static char tx_buffer[8192];
-
 static MN8Context *context = nullptr;
 
+static udp_ledstate_handler_fn ledstate_handler = nullptr;
+static void *ledstate_handler_context = nullptr;
+
+static udp_lan_session_fn lan_session_handler = nullptr;
+static void *lan_session_handler_context = nullptr;
+
+static ResponseCache response_cache;
+
+// One reply to a broadcast waiting for its turn, a second broadcast sends it
+// right away.
+static struct {
+    bool pending;
+    int64_t due_us;
+    struct sockaddr_storage address;
+    int length;
+    ScratchLease reply;
+} deferred_reply;
+
+// Set by reboot and factory-reset, the task restarts after the reply.
+static bool restart_pending = false;
+
+typedef BasicJsonDocument<ScratchJsonAllocator> ScratchJsonDocument;
+
 //*****************************************************************************
 // Forward declarations
 //*****************************************************************************
-static void udp_server_callback(char *data, int len, char *out, int &out_len);
+static void setup_command_table(void);
+static int udp_server_callback(char *data, int len, ScratchLease &reply);
+static bool is_broadcast(struct msghdr *msg);
+static void defer_reply(int sock, const struct sockaddr_storage &address, ScratchLease &reply, int len);
+static int send_deferred_reply(int sock, bool now);
+static void restart_after_reply(int sock);
+static bool handle_lan_ledstate(const char *data, int len, char *out, int &out_len);
 static void handle_get_charge_point_config(JsonObject &root, JsonObject &response);
 static void handle_set_chargepoint_config(JsonObject &root, JsonObject &response);
 static void handle_unprovision_chargepoint(JsonObject &root, JsonObject &response);
@@ -67,6 +123,9 @@ static void handle_refresh_proxy(JsonObject &root, JsonObject &response);
 static void handle_factory_reset(JsonObject &root, JsonObject &response);
 static void handle_set_site_info(JsonObject &root, JsonObject &response);
 static void handle_set_led_length(JsonObject &root, JsonObject &response);
+static void handle_set_animation(JsonObject &root, JsonObject &response);
+static void handle_get_command_stats(JsonObject &root, JsonObject &response);
+static void handle_lan_session(JsonObject &root, JsonObject &response);
 
 // Not sure how to handle this one yet, or if we even need to trouble shoot from
 // the device.  We could go through the back door and have a specific rest endpoint
@@ -109,12 +168,20 @@ static void handle_get_latest_from_proxy(JsonObject &root, JsonObject &response)
  */
 static void udp_server_task(void *pvParameters)
 {
-    int tx_len = 0;
     char addr_str[128];
+    char ack[UDP_LEDSTATE_ACK_SIZE];
     int addr_family = (int)pvParameters;
     int ip_protocol = 0;
     struct sockaddr_in6 dest_addr;
 
+    ScratchLease rx;
+    if (!rx.lease(UDP_RX_BUFFER_SIZE, UDP_SCRATCH_WAIT_MS))
+    {
+        ESP_LOGE(TAG, "No receive buffer");
+        vTaskDelete(NULL);
+    }
+    char *rx_buffer = rx.data();
+
     while (1)
     {
 
@@ -135,11 +202,12 @@ static void udp_server_task(void *pvParameters)
         }
         ESP_LOGI(TAG, "Socket created");
 
-        // Set timeout
-        // struct timeval timeout;
-        // timeout.tv_sec = 10;
-        // timeout.tv_usec = 0;
-        // setsockopt (sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+        // Destination of each datagram, to tell the broadcasts apart.
+        int pktinfo = 1;
+        setsockopt(sock, IPPROTO_IP, IP_PKTINFO, &pktinfo, sizeof(pktinfo));
+        int receive_timeout_ms = 0;
+        deferred_reply.pending = false;
+        deferred_reply.reply.release();
 
         int err = bind(sock, (struct sockaddr *)&dest_addr, sizeof(dest_addr));
         if (err < 0)
@@ -149,16 +217,42 @@ static void udp_server_task(void *pvParameters)
         ESP_LOGI(TAG, "Socket bound, port %d", PORT);
 
         struct sockaddr_storage source_addr; // Large enough for both IPv4 or IPv6
-        socklen_t socklen = sizeof(source_addr);
+        struct iovec iov = { rx_buffer, rx.size() - 1 };
+        char control[CMSG_SPACE(sizeof(struct in_pktinfo))];
+        struct msghdr msg = {};
 
         while (1)
         {
-            ESP_LOGI(TAG, "Waiting for data");
-            memset(rx_buffer, 0, sizeof(rx_buffer));
-            int len = recvfrom(sock, rx_buffer, sizeof(rx_buffer) - 1, 0, (struct sockaddr *)&source_addr, &socklen);
+            // The reply of a reboot or a factory reset was sent.
+            if (restart_pending)
+            {
+                restart_after_reply(sock);
+            }
+
+            // Wake up when the deferred reply is due.
+            int wait_ms = send_deferred_reply(sock, false);
+            if (wait_ms != receive_timeout_ms)
+            {
+                struct timeval timeout = { wait_ms / 1000, (wait_ms % 1000) * 1000 };
+                setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+                receive_timeout_ms = wait_ms;
+            }
 
+            ESP_LOGI(TAG, "Waiting for data");
+            msg.msg_name = &source_addr;
+            msg.msg_namelen = sizeof(source_addr);
+            msg.msg_iov = &iov;
+            msg.msg_iovlen = 1;
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+            int len = recvmsg(sock, &msg, 0);
+
+            if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            {
+                continue;
+            }
             // Error occurred during receiving
-            if (len < 0)
+            else if (len < 0)
             {
                 ESP_LOGE(TAG, "recvfrom failed: errno %d", errno);
                 break;
@@ -166,6 +260,19 @@ static void udp_server_task(void *pvParameters)
             // Data received
             else
             {
+                // Live state from a site gateway, answered before anything
+                // gets logged, latency is the whole point.
+                int ack_len = sizeof(ack);
+                if (handle_lan_ledstate(rx_buffer, len, ack, ack_len))
+                {
+                    if (sendto(sock, ack, ack_len, 0, (struct sockaddr *)&source_addr, sizeof(source_addr)) < 0)
+                    {
+                        ESP_LOGE(TAG, "Error occurred during sending: errno %d", errno);
+                        break;
+                    }
+                    continue;
+                }
+
                 // Get the sender's ip address as string
                 if (source_addr.ss_family == PF_INET)
                 {
@@ -178,19 +285,29 @@ static void udp_server_task(void *pvParameters)
 
                 rx_buffer[len] = 0; // Null-terminate whatever we received and treat like a string...
                 ESP_LOGI(TAG, "Received %d bytes from %s:", len, addr_str);
-                ESP_LOGI(TAG, "%s: %d", rx_buffer, strlen(rx_buffer));
+                ESP_LOGI(TAG, "%s", rx_buffer);
 
-                if (strlen(rx_buffer) > 1)
+                ScratchLease reply;
+                int reply_len = 0;
+                if (len > 1)
+                {
+                    reply_len = udp_server_callback(rx_buffer, len, reply);
+                }
+                if (!reply.is_leased())
                 {
-                    memset(tx_buffer, 0, sizeof(tx_buffer));
-                    tx_len = sizeof(tx_buffer);
-                    udp_server_callback(rx_buffer, len, tx_buffer, tx_len);
+                    continue;
                 }
 
-                // add carriage return
-                tx_buffer[strlen(tx_buffer)] = '\n';
+                // add carriage return, the reply has room for it
+                reply.data()[reply_len++] = '\n';
 
-                int err = sendto(sock, tx_buffer, strlen(tx_buffer), 0, (struct sockaddr *)&source_addr, sizeof(source_addr));
+                if (is_broadcast(&msg))
+                {
+                    defer_reply(sock, source_addr, reply, reply_len);
+                    continue;
+                }
+
+                int err = sendto(sock, reply.data(), reply_len, 0, (struct sockaddr *)&source_addr, sizeof(source_addr));
                 if (err < 0)
                 {
                     ESP_LOGE(TAG, "Error occurred during sending: errno %d", errno);
@@ -209,25 +326,394 @@ static void udp_server_task(void *pvParameters)
     vTaskDelete(NULL);
 }
 
+//*****************************************************************************
+/**
+ * @brief Was the datagram sent to the subnet or the limited broadcast.
+ */
+static bool is_broadcast(struct msghdr *msg)
+{
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(msg, cmsg))
+    {
+        if (cmsg->cmsg_level != IPPROTO_IP || cmsg->cmsg_type != IP_PKTINFO)
+        {
+            continue;
+        }
+
+        struct in_pktinfo *info = (struct in_pktinfo *)CMSG_DATA(cmsg);
+        struct netif *netif = netif_get_by_index(info->ipi_ifindex);
+        return netif != nullptr && ip4_addr_isbroadcast_u32(info->ipi_addr.s_addr, netif);
+    }
+    return false;
+}
+
+//*****************************************************************************
+/**
+ * @brief Hold a reply to a broadcast for a random part of the jitter window.
+ */
+static void defer_reply(int sock, const struct sockaddr_storage &address, ScratchLease &reply, int len)
+{
+    send_deferred_reply(sock, true);
+
+    uint32_t delay_ms = esp_random() % UDP_BROADCAST_JITTER_MS;
+    deferred_reply.due_us = esp_timer_get_time() + delay_ms * 1000;
+    deferred_reply.address = address;
+    deferred_reply.length = len;
+    deferred_reply.reply.swap(reply);
+    deferred_reply.pending = true;
+}
+
+//*****************************************************************************
+/**
+ * @brief Send the deferred reply once it is due.
+ *
+ * @param now   Send it even if it is not due.
+ * @return int  Milliseconds until it is due, 0 when there is none.
+ */
+static int send_deferred_reply(int sock, bool now)
+{
+    if (!deferred_reply.pending)
+    {
+        return 0;
+    }
+
+    int64_t remaining_us = deferred_reply.due_us - esp_timer_get_time();
+    if (!now && remaining_us > 0)
+    {
+        return (int)((remaining_us + 999) / 1000);
+    }
+
+    deferred_reply.pending = false;
+    if (sendto(sock, deferred_reply.reply.data(), deferred_reply.length, 0, (struct sockaddr *)&deferred_reply.address, sizeof(deferred_reply.address)) < 0)
+    {
+        ESP_LOGE(TAG, "Error occurred during sending: errno %d", errno);
+    }
+    deferred_reply.reply.release();
+    return 0;
+}
+
+//*****************************************************************************
+/**
+ * @brief Restart the device, a reply to a broadcast is sent first.
+ */
+static void restart_after_reply(int sock)
+{
+    send_deferred_reply(sock, true);
+    ESP_LOGI(TAG, "Restarting");
+    vTaskDelay(pdMS_TO_TICKS(UDP_RESTART_DELAY_MS));
+    esp_restart();
+}
+
 //*****************************************************************************
 esp_err_t start_udp_server(MN8Context *context)
 {
     ::context = context;
+    setup_command_table();
     xTaskCreate(udp_server_task, "udp_server", 16536, (void *)AF_INET, 5, NULL);
     return ESP_OK;
 }
 
 //*****************************************************************************
-void udp_server_callback(char *data, int len, char *out, int &out_len)
+void udp_server_register_ledstate_handler(udp_ledstate_handler_fn handler, void *handler_context)
+{
+    ledstate_handler_context = handler_context;
+    ledstate_handler = handler;
+}
+
+//*****************************************************************************
+void udp_server_register_lan_session_handler(udp_lan_session_fn handler, void *handler_context)
+{
+    lan_session_handler_context = handler_context;
+    lan_session_handler = handler;
+}
+
+//*****************************************************************************
+void udp_server_invalidate_cache(void)
+{
+    response_cache.invalidate();
+}
+
+//*****************************************************************************
+/**
+ * @brief Fast path for the ledstate command.
+ * 
+ * Parsed in place, no json document, and handed to the app which checks the
+ * hmac and the seq and applies it right away.
+ * 
+ * @return true     If this was a ledstate command, out holds the response.
+ * @return false    Any other command, goes through udp_server_callback.
+ */
+static bool handle_lan_ledstate(const char *data, int len, char *out, int &out_len)
+{
+    ledstate_lan_envelope_t envelope;
+    ledstate_message_t message;
+    ledstate_verdict_t verdict = e_ledstate_stale;
+    const char *error = nullptr;
+
+    esp_err_t err = ledstate_parse_lan(data, len, &envelope, &message);
+    if (err == ESP_ERR_NOT_FOUND)
+    {
+        return false;
+    }
+
+    if (err != ESP_OK)
+    {
+        error = "malformed ledstate";
+    }
+    else if (ledstate_handler == nullptr)
+    {
+        error = "not ready";
+    }
+    else
+    {
+        err = ledstate_handler(envelope, message, &verdict, ledstate_handler_context);
+        switch (err)
+        {
+        case ESP_OK:
+            break;
+        case ESP_ERR_INVALID_STATE:
+            error = "no lan key";
+            break;
+        case ESP_ERR_INVALID_CRC:
+            error = "bad hmac";
+            break;
+        case ESP_ERR_INVALID_ARG:
+            error = "seq required";
+            break;
+        default:
+            error = "failed";
+            break;
+        }
+
+        // The gateway asks for a new session with lan-session.
+        if (err == ESP_OK && verdict == e_ledstate_wrong_session)
+        {
+            error = "wrong session";
+        }
+    }
+
+    int written;
+    if (error != nullptr)
+    {
+        written = snprintf(out, out_len,
+            R"({"response":{"command":"ledstate","status":"err","message":"%s"}})" "\n", error);
+    }
+    else
+    {
+        written = snprintf(out, out_len,
+            R"({"response":{"command":"ledstate","status":"ok","seq":%lu,"result":"%s"}})" "\n",
+            (unsigned long) message.seq,
+            verdict == e_ledstate_apply ? "applied" : verdict == e_ledstate_duplicate ? "duplicate" : "stale");
+    }
+
+    out_len = (written > 0 && written < out_len) ? written : 0;
+    return true;
+}
+
+//*****************************************************************************
+// Command table
+//*****************************************************************************
+
+typedef void (*udp_command_fn)(JsonObject &root, JsonObject &response);
+
+typedef struct {
+    const char *name;
+    udp_command_fn handler;
+    int cache_slot;
+    bool restarts;      // only as the last command of a batch
+} udp_command_t;
+
+static const udp_command_t commands[] = {
+    { "get-chargepoint-config",     handle_get_charge_point_config,    UDP_CACHE_CHARGEPOINT_CONFIG,  false },
+    { "set-chargepoint-config",     handle_set_chargepoint_config,     UDP_CACHE_NONE,                false },
+    { "unprovision-chargepoint",    handle_unprovision_chargepoint,    UDP_CACHE_NONE,                false },
+    { "provision-aws",              handle_provision_aws,              UDP_CACHE_NONE,                false },
+    { "get-info",                   handle_get_info,                   UDP_CACHE_GET_INFO,            false },
+    { "reboot",                     handle_reboot,                     UDP_CACHE_NONE,                true },
+    { "set-led-debug-state",        handle_set_led_debug_state,        UDP_CACHE_NONE,                false },
+    { "refresh-proxy",              handle_refresh_proxy,              UDP_CACHE_NONE,                false },
+    { "get-latest-from-proxy",      handle_get_latest_from_proxy,      UDP_CACHE_NONE,                false },
+    { "factory-reset",              handle_factory_reset,              UDP_CACHE_NONE,                true },
+    { "set-site-info",              handle_set_site_info,              UDP_CACHE_NONE,                false },
+    { "set-led-length",             handle_set_led_length,             UDP_CACHE_NONE,                false },
+    { "set-animation",              handle_set_animation,              UDP_CACHE_NONE,                false },
+    { "get-command-stats",          handle_get_command_stats,          UDP_CACHE_NONE,                false },
+    { "lan-session",                handle_lan_session,                UDP_CACHE_NONE,                false },
+};
+
+static CommandTable command_table;
+
+//*****************************************************************************
+static void setup_command_table(void)
+{
+    for (size_t i = 0; i < sizeof(commands) / sizeof(commands[0]); i++)
+    {
+        if (command_table.add(commands[i].name) != (int)i)
+        {
+            ESP_LOGE(TAG, "Failed to add command %s", commands[i].name);
+        }
+    }
+}
+
+//*****************************************************************************
+/**
+ * @brief Run one command, its handler fills the response.
+ * 
+ * @return true     The command ran and reported "ok".
+ */
+static bool run_command(JsonObject &root, JsonObject &response)
+{
+    const char *name = root["command"];
+    response["status"] = "err";
+
+    if (name == nullptr)
+    {
+        ESP_LOGE(TAG, "no cmd specified");
+        response["message"] = "deserializeJson failed no cmd";
+        return false;
+    }
+
+    response["command"] = name;
+
+    int index = command_table.find(name, strlen(name));
+    if (index < 0)
+    {
+        ESP_LOGI(TAG, "unknown command: %s", name);
+        response["message"] = "err:unknown command";
+        return false;
+    }
+
+    ESP_LOGI(TAG, "%s requested", name);
+    int64_t start = esp_timer_get_time();
+    commands[index].handler(root, response);
+    uint32_t elapsed_us = (uint32_t)(esp_timer_get_time() - start);
+
+    // The handlers always set the status.
+    const char *status = response["status"];
+    bool ok = status != nullptr && strcmp(status, "ok") == 0;
+    command_table.record(index, elapsed_us, ok);
+    return ok;
+}
+
+//*****************************************************************************
+/**
+ * @brief Does the command restart the device.
+ */
+static bool restarts(JsonObject &root)
+{
+    const char *name = root["command"];
+    int index = name == nullptr ? -1 : command_table.find(name, strlen(name));
+    return index >= 0 && commands[index].restarts;
+}
+
+//*****************************************************************************
+/**
+ * @brief What a cached response shows that invalidating does not cover.
+ *
+ * get-info reports the led states, they change far too often to invalidate
+ * the cache each time.
+ */
+static uint32_t response_cache_key(int cache_slot)
 {
-    StaticJsonDocument<2048> doc;
-    StaticJsonDocument<2048> docResponse;
+    if (cache_slot != UDP_CACHE_GET_INFO)
+    {
+        return 0;
+    }
+    return (uint32_t)context->get_led_task_0().get_state() | ((uint32_t)context->get_led_task_1().get_state() << 8);
+}
+
+//*****************************************************************************
+/**
+ * @brief Answer a single discovery command from the cache.
+ *
+ * @return true     out holds the response.
+ */
+static bool get_cached_response(JsonObject &root, int &cache_slot, uint32_t &cache_key, ScratchLease &reply, int &reply_len)
+{
+    const char *name = root["command"];
+    int index = name == nullptr ? -1 : command_table.find(name, strlen(name));
+    if (index < 0 || commands[index].cache_slot == UDP_CACHE_NONE)
+    {
+        return false;
+    }
+
+    int64_t start = esp_timer_get_time();
+    cache_slot = commands[index].cache_slot;
+    cache_key = response_cache_key(cache_slot);
+
+    // Room for any cached response and the carriage return.
+    if (!reply.lease(RESPONSE_CACHE_SIZE + 1, UDP_SCRATCH_WAIT_MS))
+    {
+        return false;
+    }
+
+    reply_len = reply.size();
+    if (!response_cache.get(cache_slot, cache_key, reply.data(), reply_len))
+    {
+        reply.release();
+        return false;
+    }
+
+    command_table.record(index, (uint32_t)(esp_timer_get_time() - start), true);
+    return true;
+}
+
+//*****************************************************************************
+/**
+ * @brief Handle a datagram, one command or a batch.
+ * 
+ * One command:
+ *     {"command":"get-info"}
+ *     {"response":{"status":"ok","command":"get-info",...}}
+ * 
+ * A batch, run in order, one response each, "ok" if they all are:
+ *     {"commands":[{"command":"set-site-info","data":{...}},{"command":"get-info"}]}
+ *     {"response":{"status":"ok","responses":[{...},{...}]}}
+ * 
+ * A reboot or a factory reset restarts the device once the reply is sent.
+ * In a batch it must be the last command, the batch is rejected otherwise.
+ * 
+ * get-info and get-chargepoint-config are sent as they were serialized the
+ * last time until a configuration is saved or reset, or
+ * udp_server_invalidate_cache() is called.
+ * 
+ * The request is parsed in place, its strings stay in data.  The response is
+ * serialized in a reply leased to its size, with room for a carriage return.
+ * 
+ * @return int  The length of the reply, nothing to send if it is not leased.
+ */
+static int udp_server_callback(char *data, int len, ScratchLease &reply)
+{
+    // Only the udp task gets here, the pools come from the scratch arena.
+    ScratchJsonDocument doc(UDP_REQUEST_JSON_CAPACITY);
+    ScratchJsonDocument docResponse(UDP_RESPONSE_JSON_CAPACITY);
     char handling_error[512] = {0};
     char mac_address[13] = {0};
-    bool handled = true;
+    int cache_slot = UDP_CACHE_NONE;
+    uint32_t cache_key = 0;
+    uint32_t cache_generation = response_cache.get_generation();
+    int reply_len = 0;
+    size_t length = 0;
 
     ESP_LOGI(TAG, "udp_server_callback: %s", data);
 
+    if (docResponse.capacity() == 0)
+    {
+        ESP_LOGE(TAG, "No room for the response");
+        return 0;
+    }
+
+    // Deser the payload. If it fails, return an error
+    DeserializationError error = deserializeJson(doc, data, len);
+    if (!error && doc["command"].is<const char *>())
+    {
+        JsonObject root = doc.as<JsonObject>();
+        if (get_cached_response(root, cache_slot, cache_key, reply, reply_len))
+        {
+            ESP_LOGI(TAG, "udp_server_callback: cached %d", reply_len);
+            return reply_len;
+        }
+    }
+
     get_fuse_mac_address_string(mac_address);
 
     // Create json response and assume it will be not be successful
@@ -235,64 +721,130 @@ void udp_server_callback(char *data, int len, char *out, int &out_len)
     response["status"] = "err";
     response["mac_address"] = mac_address;
 
-    // Deser the payload. If it fails, return an error
-    DeserializationError error = deserializeJson(doc, data, len);
     if (error)
     {
         ESP_LOGE(TAG, "deserializeJson() failed: %s", error.c_str());
         snprintf(handling_error, sizeof(handling_error), "deserializeJson failed %s", error.c_str());
         response["message"] = handling_error;
-        goto done;
+    }
+    else if (doc["commands"].is<JsonArray>())
+    {
+        JsonArray batch = doc["commands"];
+        if (batch.size() > UDP_MAX_BATCH)
+        {
+            response["message"] = "too many commands";
+            goto done;
+        }
+
+        size_t position = 0;
+        for (JsonObject root : batch)
+        {
+            if (++position < batch.size() && restarts(root))
+            {
+                response["message"] = "reboot and factory-reset must be the last command";
+                goto done;
+            }
+        }
+
+        JsonArray responses = response.createNestedArray("responses");
+        bool all_ok = true;
+        for (JsonObject root : batch)
+        {
+            JsonObject command_response = responses.createNestedObject();
+            all_ok = run_command(root, command_response) && all_ok;
+        }
+        response["status"] = all_ok ? "ok" : "err";
     }
     else
     {
-        // Payload is valid json, check if it contains a command
         JsonObject root = doc.as<JsonObject>();
-        if (!root.containsKey("command"))
+        if (!run_command(root, response))
         {
-            ESP_LOGE(TAG, "deserializeJson() failed: no cmd specified");
-            snprintf(handling_error, sizeof(handling_error), "deserializeJson failed no cmd");
-            response["message"] = handling_error;
-            goto done;
+            cache_slot = UDP_CACHE_NONE;
         }
+    }
 
-        ESP_LOGI(TAG, "cmd: %s", (const char *)root["command"]);
+done:
+    if (docResponse.overflowed())
+    {
+        ESP_LOGE(TAG, "response too large");
+        cache_slot = UDP_CACHE_NONE;
+    }
 
-        response["command"] = root["command"];
+    // The carriage return and the null terminator.
+    length = measureJson(docResponse);
+    if (!reply.lease(length + 2, UDP_SCRATCH_WAIT_MS))
+    {
+        return 0;
+    }
 
-#define HANDLE_COMMAND(cmd, fn) \
-        if (STR_IS_EQUAL(root["command"], cmd)) { \
-            ESP_LOGI(TAG, #cmd " requested"); \
-            fn(root, response); \
-            handled = true; \
-        }
+    reply_len = serializeJson(docResponse, reply.data(), reply.size());
+    if (cache_slot != UDP_CACHE_NONE)
+    {
+        response_cache.put(cache_slot, cache_key, cache_generation, reply.data(), reply_len);
+    }
+    ESP_LOGI(TAG, "udp_server_callback: %.*s %d", reply_len, reply.data(), reply_len);
+    return reply_len;
+}
 
-        HANDLE_COMMAND("get-chargepoint-config", handle_get_charge_point_config);
-        HANDLE_COMMAND("set-chargepoint-config", handle_set_chargepoint_config);
-        HANDLE_COMMAND("unprovision-chargepoint", handle_unprovision_chargepoint);
-        HANDLE_COMMAND("provision-aws", handle_provision_aws);
-        HANDLE_COMMAND("get-info", handle_get_info);
-        HANDLE_COMMAND("reboot", handle_reboot);
-        HANDLE_COMMAND("set-led-debug-state", handle_set_led_debug_state);
-        HANDLE_COMMAND("refresh-proxy", handle_refresh_proxy);
-        HANDLE_COMMAND("get-latest-from-proxy", handle_get_latest_from_proxy);
-        HANDLE_COMMAND("factory-reset", handle_factory_reset);
-        HANDLE_COMMAND("set-site-info", handle_set_site_info);
-        HANDLE_COMMAND("set-led-length", handle_set_led_length);
-
-        if (!handled) {
-            ESP_LOGI(TAG, "unknown command: %s", (const char *)root["command"]);
-            snprintf(handling_error, sizeof(handling_error), "err:unknown command");
-            response["message"] = handling_error;
-            goto done;
+//*****************************************************************************
+/**
+ * @brief Calls, errors and time spent per command since boot.
+ */
+static void handle_get_command_stats(JsonObject &root, JsonObject &response)
+{
+    JsonObject data = response.createNestedObject("data");
+    for (size_t i = 0; i < command_table.size(); i++)
+    {
+        const command_stats_t &stats = command_table.get_stats(i);
+        if (stats.calls == 0)
+        {
+            continue;
         }
 
-        response["status"] = "ok";
+        JsonObject entry = data.createNestedObject(command_table.get_name(i));
+        entry["calls"] = stats.calls;
+        entry["errors"] = stats.errors;
+        entry["avg_us"] = (uint32_t)(stats.total_us / stats.calls);
+        entry["max_us"] = stats.max_us;
     }
 
-done:
-    out_len = serializeJson(docResponse, out, out_len);
-    ESP_LOGI(TAG, "udp_server_callback: %s %d", out, out_len);
+    JsonObject cache = response.createNestedObject("cache");
+    cache["hits"] = response_cache.get_hits();
+    cache["misses"] = response_cache.get_misses();
+
+    ScratchArena &arena = ScratchArena::instance();
+    JsonObject memory = response.createNestedObject("memory");
+    memory["stack_free"] = uxTaskGetStackHighWaterMark(NULL);
+    memory["scratch_size"] = SCRATCH_ARENA_SIZE;
+    memory["scratch_peak"] = arena.get_peak();
+    memory["scratch_failed"] = arena.get_failed();
+    response["status"] = "ok";
+}
+
+//*****************************************************************************
+/**
+ * @brief Start a new lan session, for a gateway that starts its seq over.
+ *
+ *     {"command":"lan-session"}
+ *     {"response":{"status":"ok","command":"lan-session","session":"<16 hex>"}}
+ *
+ * The gateway puts the session in each ledstate it signs, see
+ * LedStateSequencer.
+ */
+static void handle_lan_session(JsonObject &root, JsonObject &response)
+{
+    char session[17];
+
+    if (lan_session_handler == nullptr)
+    {
+        response["message"] = "not ready";
+        return;
+    }
+
+    snprintf(session, sizeof(session), "%016llx", (unsigned long long)lan_session_handler(lan_session_handler_context));
+    response["session"] = session;
+    response["status"] = "ok";
 }
 
 //*****************************************************************************
@@ -491,7 +1043,9 @@ static void handle_reboot(JsonObject &root, JsonObject &response)
 {
     ESP_LOGI(TAG, "reboot requested");
 
-    esp_restart();
+    restart_pending = true;
+    response["status"] = "ok";
+    response["message"] = "Rebooting";
 }
 
 //*****************************************************************************
@@ -589,6 +1143,7 @@ static void handle_factory_reset(JsonObject &root, JsonObject &response)
         goto err;
     }
 
+    restart_pending = true;
     response["status"] = "ok";
     response["message"] = "Factory reset";
     return;
@@ -665,3 +1220,35 @@ static void handle_set_led_length(JsonObject &root, JsonObject &response)
 err:
     response["status"] = "err";
 }
+
+//*****************************************************************************
+/**
+ * @brief Bind an animation program to a led state.
+ * 
+ * {"command":"set-animation","data":{"state":"charging","program":"a5010032..."}}
+ * 
+ * An empty program goes back to the built-in animation.
+ */
+static void handle_set_animation(JsonObject &root, JsonObject &response)
+{
+    JsonObject data = root["data"];
+    const char *state_name = data["state"];
+    const char *program = data["program"];
+    led_state_t state = e_station_unknown;
+    esp_err_t err = ESP_OK;
+
+    VALIDATE_COND(!STR_IS_NULL_OR_EMPTY(state_name), "state is required");
+    VALIDATE_COND(program != nullptr, "program is required");
+
+    state = led_state_from_string(state_name, strlen(state_name));
+    VALIDATE_COND(state != e_station_unknown, "unknown state");
+
+    err = context->get_animation_library().set_program(state, program);
+    VALIDATE_COND(err == ESP_OK, "invalid program");
+
+    response["status"] = "ok";
+    response["message"] = program[0] != '\0' ? "Animation set" : "Animation removed";
+    return;
+err:
+    response["status"] = "err";
+}
@@ -1,7 +1,27 @@
 #pragma once
 
 #include "MN8Context.h"
+#include "App/MqttAgent/LedStateParser.h"
+#include "App/LedStateSequencer.h"
 
 #include "esp_err.h"
 
-esp_err_t start_udp_server(MN8Context* context);
\ No newline at end of file
+// Called from the udp task for each ledstate command a site gateway sends.
+typedef esp_err_t (*udp_ledstate_handler_fn)(
+    const ledstate_lan_envelope_t& envelope,
+    ledstate_message_t& message,
+    ledstate_verdict_t* verdict,
+    void* context
+);
+
+// Called from the udp task for lan-session, starts a new session and returns
+// it.
+typedef uint64_t (*udp_lan_session_fn)(void* context);
+
+esp_err_t start_udp_server(MN8Context* context);
+void udp_server_register_ledstate_handler(udp_ledstate_handler_fn handler, void* handler_context);
+void udp_server_register_lan_session_handler(udp_lan_session_fn handler, void* handler_context);
+
+// The cached get-info and get-chargepoint-config responses are rebuilt on
+// the next request.
+void udp_server_invalidate_cache(void);
@@ -5,7 +5,17 @@
 #include "esp_log.h"
 #include "esp_err.h"
 #include "LED/Animations/ChargingAnimation.h"
-#include "Utils/Updater.h"
+#include "Utils/OtaPipeline.h"
+#include "Utils/Metrics.h"
+#include "Utils/CertStore.h"
+
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include <stdio.h>
+#include <sys/param.h>
 
 static const char *TAG = "web_server";
 
@@ -74,66 +84,235 @@ esp_err_t post_handler(httpd_req_t *req)
     return ESP_OK;
 }
 
-#define ONE_KB (1024)
-#define ONE_MB (ONE_KB)
-uint8_t update_buffer[16*ONE_KB];
+// Retries of a receive that timed out before the update is given up.
+#define UPDATE_RECV_RETRIES (3)
+
+static OtaPipeline ota_pipeline;
+
+//*****************************************************************************
+/**
+ * @brief Parse the X-Image-SHA256 header, 64 hex digits.
+ *
+ * @return true     The header is there and well formed.
+ */
+static bool get_expected_sha256(httpd_req_t *req, uint8_t *sha256)
+{
+    char hex[OTA_SHA256_LENGTH * 2 + 1] = {0};
+    if (httpd_req_get_hdr_value_str(req, "X-Image-SHA256", hex, sizeof(hex)) != ESP_OK) {
+        return false;
+    }
+
+    for (int i = 0; i < OTA_SHA256_LENGTH; i++) {
+        unsigned int byte;
+        if (sscanf(&hex[i * 2], "%2x", &byte) != 1) {
+            return false;
+        }
+        sha256[i] = (uint8_t) byte;
+    }
+    return true;
+}
 
+//*****************************************************************************
+/**
+ * @brief Receive the image, the pipeline writes it to flash behind us.
+ *
+ * The hash is checked when the request carries X-Image-SHA256, it is
+ * returned with the statistics either way:
+ *     {"status":"ok","sha256":"...","bytes":...,"elapsed_ms":...,
+ *      "kbps":...,"flash_ms":...,"receive_stall_ms":...,"write_stall_ms":...}
+ */
 esp_err_t update_handler(httpd_req_t *req)
 {
-    char* ptr = (char*) update_buffer;
     esp_err_t ret = ESP_OK;
-    bool done = false;
-    
+    uint8_t expected_sha256[OTA_SHA256_LENGTH];
+    bool has_sha256 = get_expected_sha256(req, expected_sha256);
+    int retries = UPDATE_RECV_RETRIES;
+
     uint32_t total_size = req->content_len;
     uint32_t left_to_recv = req->content_len;
-    uint32_t bytes_written = 0;
-
-    FwUpdater& updater = FwUpdater::instance();
 
-    ret = updater.begin(total_size);
+    ret = ota_pipeline.begin(total_size, has_sha256 ? expected_sha256 : nullptr);
+    if ( ret == ESP_ERR_INVALID_STATE) {
+        ESP_LOGE(TAG, "Update already running");
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Update already running");
+        return ESP_FAIL;
+    }
     if ( ret != ESP_OK) {
         ESP_LOGE(TAG, "Failed to begin update");
-        goto err;
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed");
+        return ESP_FAIL;
     }
 
-    ESP_LOGI(TAG, "Content length: %ld", total_size);
-    while (bytes_written < total_size) {
-        size_t to_recv = MIN(left_to_recv, sizeof(update_buffer));
-        int ret = httpd_req_recv(req, ptr, to_recv);
-        if (ret <= 0) {
-            if (ret == HTTPD_SOCK_ERR_TIMEOUT) {
-                ESP_LOGE(TAG, "Socket timeout, retrying");
+    ESP_LOGI(TAG, "Content length: %ld%s", total_size, has_sha256 ? ", sha256 given" : "");
+    while (left_to_recv > 0) {
+        uint8_t *buffer = ota_pipeline.get_buffer();
+        if (buffer == nullptr) {
+            ret = ESP_FAIL;
+            goto err;
+        }
+
+        size_t to_recv = MIN(left_to_recv, OTA_PIPELINE_BUFFER_SIZE);
+        int received = httpd_req_recv(req, (char *) buffer, to_recv);
+        if (received == HTTPD_SOCK_ERR_TIMEOUT && retries-- > 0) {
+            ESP_LOGE(TAG, "Socket timeout, retrying");
+            continue;
+        }
+        if (received <= 0) {
+            ota_pipeline.abort();
+            if (received == HTTPD_SOCK_ERR_TIMEOUT) {
                 httpd_resp_send_408(req);
             }
             return ESP_FAIL;
         }
 
-        updater.write(update_buffer, ret);
-
-        left_to_recv -= ret;
-        bytes_written += ret;
+        retries = UPDATE_RECV_RETRIES;
+        left_to_recv -= received;
+        ret = ota_pipeline.push(received);
+        if (ret != ESP_OK) {
+            goto err;
+        }
     }
-    ESP_LOGI(TAG, "bytes_written: %ld", bytes_written);
 
-    ret = updater.end();
+    ret = ota_pipeline.end();
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "Failed to end update");
-        goto err;
+        goto err_ended;
     }
 
     {
-        const char resp[] = "OK";
+        const ota_pipeline_stats_t stats = ota_pipeline.get_stats();
+        char sha256[OTA_SHA256_LENGTH * 2 + 1];
+        for (int i = 0; i < OTA_SHA256_LENGTH; i++) {
+            snprintf(&sha256[i * 2], 3, "%02x", ota_pipeline.get_sha256()[i]);
+        }
+
+        char resp[320];
+        snprintf(resp, sizeof(resp),
+            R"({"status":"ok","sha256":"%s","bytes":%lu,"image_bytes":%lu,"compressed":%s,"elapsed_ms":%lu,"kbps":%lu,"flash_ms":%lu,"receive_stall_ms":%lu,"write_stall_ms":%lu})",
+            sha256, stats.written, stats.image, stats.compressed ? "true" : "false", stats.elapsed_ms,
+            stats.elapsed_ms != 0 ? stats.written / stats.elapsed_ms : 0,
+            stats.flash_ms, stats.receive_stall_ms, stats.write_stall_ms);
         ESP_LOGI(TAG, "Update complete");
+        httpd_resp_set_type(req, "application/json");
         httpd_resp_send(req, resp, HTTPD_RESP_USE_STRLEN);
         return ESP_OK;
     }
 
 err:
-    const char resp[] = "Failed";
-    updater.abort();
+    ota_pipeline.abort();
+err_ended:
     ESP_LOGI(TAG, "Update failed");
-    httpd_resp_send(req, resp, HTTPD_RESP_USE_STRLEN);
-    return ret;
+    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, ret == ESP_ERR_INVALID_CRC ? "SHA-256 mismatch" : "Failed");
+    return ESP_FAIL;
+}
+
+// Chunks of the /metrics response, a few lines each.
+#define METRICS_CHUNK_SIZE  (1024)
+#define METRICS_MAX_TASKS   (32)
+
+static_assert(METRICS_CHUNK_SIZE >= METRICS_LINE_MAX_LENGTH, "a metrics line must fit in a chunk");
+
+// The http server runs one handler at a time, these are only used by it.
+static char metrics_chunk[METRICS_CHUNK_SIZE];
+static TaskStatus_t metrics_tasks[METRICS_MAX_TASKS];
+
+static esp_err_t send_metrics_chunk(const char* data, size_t length, void* context)
+{
+    return httpd_resp_send_chunk((httpd_req_t *) context, data, length);
+}
+
+//*****************************************************************************
+/**
+ * @brief Runtime counters in the prometheus text format.
+ *
+ * Heap, task stacks and cpu time, mqtt traffic and the frames of each strip.
+ * Built in a static chunk sent as it fills, nothing is allocated.  The cpu
+ * share is since boot, in percent of one core.
+ */
+esp_err_t metrics_handler(httpd_req_t *req)
+{
+    MN8Context *context = (MN8Context *) req->user_ctx;
+    MetricsWriter writer(metrics_chunk, sizeof(metrics_chunk), send_metrics_chunk, req);
+    char labels[64];
+
+    httpd_resp_set_type(req, "text/plain; version=0.0.4");
+
+    writer.family("mn8_uptime_seconds", "gauge", "Time since boot.");
+    writer.sample("mn8_uptime_seconds", nullptr, esp_timer_get_time() / 1000000);
+    writer.family("mn8_config_load_us", "gauge", "Time to load the configuration at boot.");
+    writer.sample("mn8_config_load_us", nullptr, context->get_config_load_us());
+
+    writer.family("mn8_heap_free_bytes", "gauge", "Free heap.");
+    writer.sample("mn8_heap_free_bytes", nullptr, heap_caps_get_free_size(MALLOC_CAP_DEFAULT));
+    writer.family("mn8_heap_min_free_bytes", "gauge", "Lowest free heap since boot.");
+    writer.sample("mn8_heap_min_free_bytes", nullptr, heap_caps_get_minimum_free_size(MALLOC_CAP_DEFAULT));
+    writer.family("mn8_heap_largest_free_block_bytes", "gauge", "Largest block that can be allocated.");
+    writer.sample("mn8_heap_largest_free_block_bytes", nullptr, heap_caps_get_largest_free_block(MALLOC_CAP_DEFAULT));
+    writer.family("mn8_cert_heap_saved_bytes", "gauge", "Heap the certificate and keys took before they were mapped from flash.");
+    writer.sample("mn8_cert_heap_saved_bytes", nullptr, CertStore::instance().get_heap_saved());
+
+    uint32_t total_runtime = 0;
+    UBaseType_t task_count = uxTaskGetSystemState(metrics_tasks, METRICS_MAX_TASKS, &total_runtime);
+    writer.family("mn8_task_stack_high_water_bytes", "gauge", "Stack never used by the task.");
+    for (UBaseType_t i = 0; i < task_count; i++) {
+        snprintf(labels, sizeof(labels), "task=\"%s\"", metrics_tasks[i].pcTaskName);
+        writer.sample("mn8_task_stack_high_water_bytes", labels, metrics_tasks[i].usStackHighWaterMark);
+    }
+    writer.family("mn8_task_cpu_percent", "gauge", "Cpu time of the task since boot.");
+    for (UBaseType_t i = 0; i < task_count; i++) {
+        snprintf(labels, sizeof(labels), "task=\"%s\"", metrics_tasks[i].pcTaskName);
+        writer.sample("mn8_task_cpu_percent", labels,
+            total_runtime != 0 ? (uint64_t) metrics_tasks[i].ulRunTimeCounter * 100 / total_runtime : 0);
+    }
+
+    MqttAgent &mqtt_agent = context->get_mqtt_agent();
+    const mqtt_traffic_counters_t &traffic = mqtt_agent.get_traffic_counters();
+    writer.family("mn8_mqtt_messages_total", "counter", "Publishes to and from the broker.");
+    writer.sample("mn8_mqtt_messages_total", "direction=\"in\"", traffic.messages_in);
+    writer.sample("mn8_mqtt_messages_total", "direction=\"out\"", traffic.messages_out);
+    writer.family("mn8_mqtt_bytes_total", "counter", "Payload bytes to and from the broker.");
+    writer.sample("mn8_mqtt_bytes_total", "direction=\"in\"", traffic.bytes_in);
+    writer.sample("mn8_mqtt_bytes_total", "direction=\"out\"", traffic.bytes_out);
+    writer.family("mn8_mqtt_publish_failures_total", "counter", "Publishes the broker connection refused.");
+    writer.sample("mn8_mqtt_publish_failures_total", nullptr, traffic.publish_failures);
+    writer.family("mn8_mqtt_outbound_dropped_total", "counter", "Publishes dropped while disconnected.");
+    writer.sample("mn8_mqtt_outbound_dropped_total", nullptr, mqtt_agent.get_outbound_dropped());
+    writer.family("mn8_mqtt_reconnects_total", "counter", "Sessions established after the first one.");
+    writer.sample("mn8_mqtt_reconnects_total", nullptr, traffic.connects > 0 ? traffic.connects - 1 : 0);
+    writer.family("mn8_mqtt_connected", "gauge", "Connected to the broker.");
+    writer.sample("mn8_mqtt_connected", nullptr, mqtt_agent.is_connected() ? 1 : 0);
+    writer.family("mn8_mqtt_connect_attempts_total", "counter", "Tls connections attempted.");
+    writer.sample("mn8_mqtt_connect_attempts_total", nullptr, mqtt_agent.get_connection_stats().attempts);
+    writer.family("mn8_mqtt_handshake_ms", "histogram", "Tcp connect and tls handshake of the connections made.");
+    writer.histogram("mn8_mqtt_handshake_ms", nullptr, mqtt_agent.get_handshake_ms());
+
+    LedTaskSpi *strips[] = { &context->get_led_task_0(), &context->get_led_task_1() };
+    const pixel_stream_counters_t &stream = context->get_pixel_stream().get_counters();
+    writer.family("mn8_led_frames_total", "counter", "Frames of each strip, rendered, late or suppressed by a newer pixel stream frame.");
+    for (LedTaskSpi *strip : strips) {
+        const led_frame_counters_t &counters = strip->get_frame_counters();
+        int bar = strip->get_led_bar_number();
+        snprintf(labels, sizeof(labels), "strip=\"%d\",result=\"rendered\"", bar);
+        writer.sample("mn8_led_frames_total", labels, counters.rendered);
+        snprintf(labels, sizeof(labels), "strip=\"%d\",result=\"late\"", bar);
+        writer.sample("mn8_led_frames_total", labels, counters.late);
+        snprintf(labels, sizeof(labels), "strip=\"%d\",result=\"suppressed\"", bar);
+        writer.sample("mn8_led_frames_total", labels, bar >= 0 && bar < PIXEL_STREAM_MAX_STRIPS ? stream.suppressed[bar] : 0);
+    }
+    writer.family("mn8_pixel_stream_frames_total", "counter", "Frames pushed by the pixel stream.");
+    writer.sample("mn8_pixel_stream_frames_total", nullptr, stream.frames);
+    writer.family("mn8_led_render_us", "histogram", "Time to compute an animation frame.");
+    for (LedTaskSpi *strip : strips) {
+        snprintf(labels, sizeof(labels), "strip=\"%d\"", strip->get_led_bar_number());
+        writer.histogram("mn8_led_render_us", labels, strip->get_render_us());
+    }
+
+    esp_err_t ret = writer.finish();
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to send the metrics (%s)", esp_err_to_name(ret));
+        return ESP_FAIL;
+    }
+    return httpd_resp_send_chunk(req, NULL, 0);
 }
 
 /* URI handler structure for GET /uri */
@@ -149,8 +328,14 @@ httpd_uri_t uri_update = {
     .handler = update_handler,
     .user_ctx = NULL};
 
+httpd_uri_t uri_metrics = {
+    .uri = "/metrics",
+    .method = HTTP_GET,
+    .handler = metrics_handler,
+    .user_ctx = NULL};
+
 /* Function for starting the webserver */
-httpd_handle_t start_webserver(void)
+httpd_handle_t start_webserver(MN8Context* context)
 {
     /* Generate default configuration */
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
@@ -164,6 +349,9 @@ httpd_handle_t start_webserver(void)
         /* Register URI handlers */
         httpd_register_uri_handler(server, &uri_get);
         httpd_register_uri_handler(server, &uri_update);
+
+        uri_metrics.user_ctx = context;
+        httpd_register_uri_handler(server, &uri_metrics);
     }
     /* If server failed to start, handle will be NULL */
     return server;
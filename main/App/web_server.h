@@ -1,5 +1,7 @@
 #pragma once
 #include <esp_http_server.h>
 
-httpd_handle_t start_webserver(void);
+#include "MN8Context.h"
+
+httpd_handle_t start_webserver(MN8Context* context);
 void stop_webserver(httpd_handle_t server);
\ No newline at end of file
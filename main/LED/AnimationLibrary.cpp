@@ -0,0 +1,165 @@
+//******************************************************************************
+/**
+ * @file AnimationLibrary.cpp
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief AnimationLibrary class implementation
+ * @version 0.1
+ * @date 2024-02-27
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#include "AnimationLibrary.h"
+
+#include "Utils/KeyStore.h"
+
+#include "esp_log.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static const char* TAG = "anim_lib";
+
+//******************************************************************************
+static int hex_digit(char ch) {
+    if (ch >= '0' && ch <= '9') return ch - '0';
+    if (ch >= 'a' && ch <= 'f') return ch - 'a' + 10;
+    if (ch >= 'A' && ch <= 'F') return ch - 'A' + 10;
+    return -1;
+}
+
+//******************************************************************************
+/**
+ * @brief Decode and validate a program.
+ */
+static esp_err_t program_from_hex(const char* hex, animation_program_t& program) {
+    size_t hex_length = strlen(hex);
+    if (hex_length % 2 != 0 || hex_length / 2 > ANIMATION_PROGRAM_MAX_LENGTH) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    for (size_t i = 0; i < hex_length / 2; i++) {
+        int high = hex_digit(hex[2 * i]);
+        int low = hex_digit(hex[2 * i + 1]);
+        if (high < 0 || low < 0) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        program.data[i] = (uint8_t)((high << 4) | low);
+    }
+    program.length = hex_length / 2;
+
+    return BytecodeAnimation::validate(program.data, program.length);
+}
+
+//******************************************************************************
+static void state_key(led_state_t state, char* key, size_t size) {
+    snprintf(key, size, "state_%d", (int) state);
+}
+
+//******************************************************************************
+esp_err_t AnimationLibrary::setup(void) {
+    this->mutex = xSemaphoreCreateMutex();
+    return this->mutex != nullptr ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+//******************************************************************************
+/**
+ * @brief Load the stored programs, the ones that no longer validate are
+ *        ignored.
+ */
+esp_err_t AnimationLibrary::load(void) {
+    KeyStore key_store;
+    if (key_store.openKeyStore("anim", e_ro) != ESP_OK) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    char key[16];
+    char hex[ANIMATION_PROGRAM_MAX_LENGTH * 2 + 1];
+    animation_program_t program;
+
+    for (int state = 0; state < e_station_unknown; state++) {
+        state_key((led_state_t) state, key, sizeof(key));
+        if (key_store.getKeyValue(key, hex, sizeof(hex)) != ESP_OK) {
+            continue;
+        }
+        if (program_from_hex(hex, program) != ESP_OK) {
+            ESP_LOGE(TAG, "Ignoring the program of %s", led_state_to_string((led_state_t) state));
+            continue;
+        }
+
+        xSemaphoreTake(this->mutex, portMAX_DELAY);
+        this->programs[state] = program;
+        xSemaphoreGive(this->mutex);
+        ESP_LOGI(TAG, "%s : program of %d bytes", led_state_to_string((led_state_t) state), program.length);
+    }
+
+    this->generation++;
+    return ESP_OK;
+}
+
+//******************************************************************************
+/**
+ * @brief Bind and save a program.
+ *
+ * @param hex           The program, empty to go back to the built-in
+ *                      animation.
+ * @return esp_err_t    BytecodeAnimation::validate() errors, the program in
+ *                      place is kept.
+ */
+esp_err_t AnimationLibrary::set_program(led_state_t state, const char* hex) {
+    if (state < 0 || state >= e_station_unknown || hex == nullptr) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    animation_program_t program = {};
+    if (hex[0] != '\0') {
+        esp_err_t err = program_from_hex(hex, program);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Rejected the program of %s : %d", led_state_to_string(state), err);
+            return err;
+        }
+    }
+
+    KeyStore key_store;
+    esp_err_t ret = key_store.openKeyStore("anim", e_rw);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    char key[16];
+    state_key(state, key, sizeof(key));
+    ret = program.length == 0 ? key_store.eraseKey(key) : key_store.setKeyValue(key, hex);
+    if (program.length == 0 && ret == ESP_ERR_NVS_NOT_FOUND) {
+        ret = ESP_OK;
+    }
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    xSemaphoreTake(this->mutex, portMAX_DELAY);
+    this->programs[state] = program;
+    xSemaphoreGive(this->mutex);
+
+    this->generation++;
+    return ESP_OK;
+}
+
+//******************************************************************************
+/**
+ * @brief Copy the program bound to a state.
+ *
+ * @return true     There is one.
+ */
+bool AnimationLibrary::get_program(led_state_t state, animation_program_t& program) {
+    if (state < 0 || state >= e_station_unknown || this->mutex == nullptr) {
+        return false;
+    }
+
+    xSemaphoreTake(this->mutex, portMAX_DELAY);
+    bool bound = this->programs[state].length != 0;
+    if (bound) {
+        program = this->programs[state];
+    }
+    xSemaphoreGive(this->mutex);
+    return bound;
+}
@@ -0,0 +1,56 @@
+//******************************************************************************
+/**
+ * @file AnimationLibrary.h
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief AnimationLibrary class definition
+ * @version 0.1
+ * @date 2024-02-27
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#pragma once
+
+#include "Utils/NoCopy.h"
+#include "LedState.h"
+#include "Animations/BytecodeAnimation.h"
+
+#include "esp_err.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include <atomic>
+
+#include <stdint.h>
+
+//******************************************************************************
+/**
+ * @brief Animation programs uploaded by the proxy, bound to led states.
+ *
+ * A state with a program shows it instead of its built-in animation.  The
+ * programs are kept in the "anim" key store as hex, one key per state.
+ *
+ * Set from the mqtt and udp tasks, read by the LED tasks when they change
+ * animation.  The generation changes with every set so the LED tasks pick
+ * up a new program for the state they are showing.
+ */
+class AnimationLibrary : public NoCopy {
+public:
+    AnimationLibrary(void) = default;
+    ~AnimationLibrary(void) = default;
+
+public:
+    esp_err_t setup(void);
+    esp_err_t load(void);
+
+    esp_err_t set_program(led_state_t state, const char* hex);
+    bool get_program(led_state_t state, animation_program_t& program);
+
+    inline uint32_t get_generation(void) const { return this->generation; }
+
+private:
+    SemaphoreHandle_t mutex = nullptr;
+    animation_program_t programs[e_station_unknown] = {};
+    std::atomic<uint32_t> generation{0};
+};
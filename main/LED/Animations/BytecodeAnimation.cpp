@@ -0,0 +1,312 @@
+//******************************************************************************
+/**
+ * @file BytecodeAnimation.cpp
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief BytecodeAnimation class implementation
+ * @version 0.1
+ * @date 2024-02-27
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#include "BytecodeAnimation.h"
+
+#include "esp_log.h"
+
+#include <string.h>
+
+static const char* TAG = "BA";  // Bytecode Animation
+
+// Refresh rate bounds, one tick to a minute.
+#define MIN_RATE_MS     (10)
+#define MAX_RATE_MS     (60000)
+
+//******************************************************************************
+/**
+ * @brief Length of an instruction with its operands, 0 if not an opcode.
+ */
+static size_t instruction_length(uint8_t op) {
+    switch (op) {
+        case e_anim_op_end:         return 1;
+        case e_anim_op_loadi:       return 4;
+        case e_anim_op_input:       return 3;
+        case e_anim_op_add:
+        case e_anim_op_sub:
+        case e_anim_op_mul:
+        case e_anim_op_div:
+        case e_anim_op_mod:
+        case e_anim_op_scale:       return 4;
+        case e_anim_op_jmp:         return 3;
+        case e_anim_op_jz:          return 4;
+        case e_anim_op_jlt:         return 5;
+        case e_anim_op_fill:        return 4;
+        case e_anim_op_segment:     return 6;
+        case e_anim_op_gradient:    return 9;
+        case e_anim_op_pulse:       return 6;
+        case e_anim_op_chase:       return 7;
+        default:                    return 0;
+    }
+}
+
+//******************************************************************************
+/**
+ * @brief Number of register operands, they come right after the opcode.
+ */
+static int register_operands(uint8_t op) {
+    switch (op) {
+        case e_anim_op_loadi:
+        case e_anim_op_input:
+        case e_anim_op_jz:
+        case e_anim_op_pulse:       return 1;
+        case e_anim_op_jlt:
+        case e_anim_op_segment:
+        case e_anim_op_gradient:
+        case e_anim_op_chase:       return 2;
+        case e_anim_op_add:
+        case e_anim_op_sub:
+        case e_anim_op_mul:
+        case e_anim_op_div:
+        case e_anim_op_mod:
+        case e_anim_op_scale:       return 3;
+        default:                    return 0;
+    }
+}
+
+//******************************************************************************
+static inline uint16_t read_u16(const uint8_t* data) {
+    return (uint16_t)((data[0] << 8) | data[1]);
+}
+
+//******************************************************************************
+/**
+ * @brief Check a program before it is stored.
+ *
+ * Every instruction complete, registers and inputs in range, jumps landing
+ * on an instruction.
+ *
+ * @return esp_err_t    ESP_ERR_INVALID_SIZE, ESP_ERR_INVALID_VERSION or
+ *                      ESP_ERR_INVALID_ARG.
+ */
+esp_err_t BytecodeAnimation::validate(const uint8_t* data, size_t length) {
+    if (data == nullptr || length <= ANIMATION_PROGRAM_HEADER_LENGTH || length > ANIMATION_PROGRAM_MAX_LENGTH) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (data[0] != ANIMATION_PROGRAM_MAGIC || data[1] != ANIMATION_PROGRAM_VERSION) {
+        return ESP_ERR_INVALID_VERSION;
+    }
+    uint16_t rate = read_u16(data + 2);
+    if (rate < MIN_RATE_MS || rate > MAX_RATE_MS) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    const uint8_t* code = data + ANIMATION_PROGRAM_HEADER_LENGTH;
+    size_t code_length = length - ANIMATION_PROGRAM_HEADER_LENGTH;
+    uint8_t starts[ANIMATION_PROGRAM_MAX_LENGTH / 8] = {};
+
+    for (size_t pc = 0; pc < code_length; ) {
+        uint8_t op = code[pc];
+        size_t op_length = instruction_length(op);
+        if (op_length == 0 || pc + op_length > code_length) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        for (int i = 0; i < register_operands(op); i++) {
+            if (code[pc + 1 + i] >= ANIMATION_REGISTER_COUNT) {
+                return ESP_ERR_INVALID_ARG;
+            }
+        }
+        if (op == e_anim_op_input && code[pc + 2] >= e_anim_input_count) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        starts[pc / 8] |= 1 << (pc % 8);
+        pc += op_length;
+    }
+
+    for (size_t pc = 0; pc < code_length; pc += instruction_length(code[pc])) {
+        uint8_t op = code[pc];
+        if (op != e_anim_op_jmp && op != e_anim_op_jz && op != e_anim_op_jlt) {
+            continue;
+        }
+        uint16_t target = read_u16(code + pc + instruction_length(op) - 2);
+        if (target >= code_length || (starts[target / 8] & (1 << (target % 8))) == 0) {
+            return ESP_ERR_INVALID_ARG;
+        }
+    }
+
+    return ESP_OK;
+}
+
+//******************************************************************************
+/**
+ * @brief Start a validated program over.
+ */
+void BytecodeAnimation::reset(const animation_program_t& program, int charge_percent, bool night) {
+    this->BaseAnimation::reset();
+
+    memcpy(&this->program, &program, sizeof(this->program));
+    memset(this->registers, 0, sizeof(this->registers));
+    this->frame = 0;
+    this->charge_percent = charge_percent;
+    this->night = night;
+    this->set_rate(read_u16(this->program.data + 2));
+}
+
+//******************************************************************************
+static inline void set_pixel(uint8_t* pixel, const uint8_t* rgb) {
+    // The strip is GRB.
+    pixel[0] = rgb[1];
+    pixel[1] = rgb[0];
+    pixel[2] = rgb[2];
+}
+
+//******************************************************************************
+/**
+ * @brief Run the program for one frame.
+ */
+int BytecodeAnimation::refresh(uint8_t* led_pixels, int start_pixel, int led_count) {
+    if (led_pixels == nullptr || led_count <= 0 || this->program.length <= ANIMATION_PROGRAM_HEADER_LENGTH) {
+        return 0;
+    }
+
+    const uint8_t* code = this->program.data + ANIMATION_PROGRAM_HEADER_LENGTH;
+    size_t code_length = this->program.length - ANIMATION_PROGRAM_HEADER_LENGTH;
+    uint8_t* pixels = led_pixels + start_pixel * 3;
+    int32_t* r = this->registers;
+
+    const int32_t inputs[e_anim_input_count] = {
+        (int32_t) this->frame,
+        led_count,
+        this->charge_percent,
+        this->night ? 1 : 0,
+    };
+
+    // Clip a register range to the strip, false if nothing is left.
+    auto clip = [led_count](int32_t start, int32_t length, int32_t& first, int32_t& last) {
+        first = start < 0 ? 0 : start;
+        last = length <= 0 ? first : (start > INT32_MAX - length ? INT32_MAX : start + length);
+        if (last > led_count) {
+            last = led_count;
+        }
+        return first < last;
+    };
+
+    size_t pc = 0;
+    int budget = ANIMATION_INSTRUCTION_BUDGET;
+    while (pc < code_length) {
+        if (budget-- == 0) {
+            this->budget_exceeded++;
+            break;
+        }
+
+        const uint8_t* ins = code + pc;
+        size_t next = pc + instruction_length(ins[0]);
+        int32_t first, last;
+
+        switch (ins[0]) {
+            case e_anim_op_end:
+                next = code_length;
+                break;
+            case e_anim_op_loadi:
+                r[ins[1]] = (int16_t) read_u16(ins + 2);
+                break;
+            case e_anim_op_input:
+                r[ins[1]] = inputs[ins[2]];
+                break;
+            case e_anim_op_add:
+                r[ins[1]] = (int32_t)((uint32_t) r[ins[2]] + (uint32_t) r[ins[3]]);
+                break;
+            case e_anim_op_sub:
+                r[ins[1]] = (int32_t)((uint32_t) r[ins[2]] - (uint32_t) r[ins[3]]);
+                break;
+            case e_anim_op_mul:
+                r[ins[1]] = (int32_t)((uint32_t) r[ins[2]] * (uint32_t) r[ins[3]]);
+                break;
+            case e_anim_op_div:
+                r[ins[1]] = (r[ins[3]] == 0 || (r[ins[2]] == INT32_MIN && r[ins[3]] == -1)) ? 0 : r[ins[2]] / r[ins[3]];
+                break;
+            case e_anim_op_mod:
+                r[ins[1]] = (r[ins[3]] == 0 || r[ins[3]] == -1) ? 0 : r[ins[2]] % r[ins[3]];
+                break;
+            case e_anim_op_scale:
+                r[ins[1]] = (int32_t)((int64_t) r[ins[2]] * r[ins[3]] / 100);
+                break;
+            case e_anim_op_jmp:
+                next = read_u16(ins + 1);
+                break;
+            case e_anim_op_jz:
+                if (r[ins[1]] == 0) {
+                    next = read_u16(ins + 2);
+                }
+                break;
+            case e_anim_op_jlt:
+                if (r[ins[1]] < r[ins[2]]) {
+                    next = read_u16(ins + 3);
+                }
+                break;
+            case e_anim_op_fill:
+                for (int i = 0; i < led_count; i++) {
+                    set_pixel(pixels + i * 3, ins + 1);
+                }
+                break;
+            case e_anim_op_segment:
+                if (clip(r[ins[1]], r[ins[2]], first, last)) {
+                    for (int32_t i = first; i < last; i++) {
+                        set_pixel(pixels + i * 3, ins + 3);
+                    }
+                }
+                break;
+            case e_anim_op_gradient:
+                if (clip(r[ins[1]], r[ins[2]], first, last)) {
+                    const uint8_t* from = ins + 3;
+                    const uint8_t* to = ins + 6;
+                    int32_t span = r[ins[2]] > 1 ? r[ins[2]] - 1 : 1;
+                    for (int32_t i = first; i < last; i++) {
+                        int64_t t = (int64_t)(i - r[ins[1]]) * 255 / span;
+                        uint8_t rgb[3];
+                        for (int c = 0; c < 3; c++) {
+                            rgb[c] = (uint8_t)(from[c] + (to[c] - from[c]) * t / 255);
+                        }
+                        set_pixel(pixels + i * 3, rgb);
+                    }
+                }
+                break;
+            case e_anim_op_pulse: {
+                // Triangle from min to full and back over the period.
+                uint32_t period = r[ins[1]] < 2 ? 2 : (uint32_t) r[ins[1]];
+                uint32_t phase = this->frame % period;
+                uint32_t half = period / 2;
+                uint32_t wave = phase <= half ? phase * 255 / half : (period - phase) * 255 / (period - half);
+                int level = ins[2] + (255 - ins[2]) * (int) wave / 255;
+                uint8_t rgb[3];
+                for (int c = 0; c < 3; c++) {
+                    rgb[c] = (uint8_t)(ins[3 + c] * level / 255);
+                }
+                for (int i = 0; i < led_count; i++) {
+                    set_pixel(pixels + i * 3, rgb);
+                }
+                break;
+            }
+            case e_anim_op_chase:
+                if (r[ins[2]] > 0 && clip(r[ins[1]], r[ins[2]], first, last)) {
+                    int32_t start = r[ins[1]];
+                    int32_t length = r[ins[2]];
+                    int32_t head = (int32_t)(this->frame % (uint32_t) length);
+                    for (int w = 0; w < ins[3] && w < length; w++) {
+                        int32_t i = start + (head + w) % length;
+                        if (i >= first && i < last) {
+                            set_pixel(pixels + i * 3, ins + 4);
+                        }
+                    }
+                }
+                break;
+            default:
+                // validate() let it through, can't happen.
+                ESP_LOGE(TAG, "bad opcode 0x%02x at %d", ins[0], (int) pc);
+                next = code_length;
+                break;
+        }
+        pc = next;
+    }
+
+    this->frame++;
+    return led_count;
+}
@@ -0,0 +1,100 @@
+//******************************************************************************
+/**
+ * @file BytecodeAnimation.h
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief BytecodeAnimation class definition
+ * @version 0.1
+ * @date 2024-02-27
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#pragma once
+
+#include "BaseAnimation.h"
+
+#include "esp_err.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define ANIMATION_PROGRAM_MAX_LENGTH    (128)
+#define ANIMATION_PROGRAM_HEADER_LENGTH (4)
+#define ANIMATION_PROGRAM_MAGIC         (0xA5)
+#define ANIMATION_PROGRAM_VERSION       (1)
+
+// Instructions run per refresh, a program that loops past it stops drawing
+// for that frame.
+#define ANIMATION_INSTRUCTION_BUDGET    (256)
+#define ANIMATION_REGISTER_COUNT        (8)
+
+//******************************************************************************
+/**
+ * @brief Opcodes, followed by their operands.
+ *
+ * r is a register index, rgb is 3 bytes, imm16 and addr16 are big endian.
+ * Addresses are byte offsets in the code, after the header.  Pixel ranges
+ * are clipped to the strip.
+ */
+typedef enum {
+    e_anim_op_end       = 0x00, //                          done for this frame
+    e_anim_op_loadi     = 0x01, // r imm16                  r = signed imm16
+    e_anim_op_input     = 0x02, // r input                  r = animation_input_t
+    e_anim_op_add       = 0x03, // r a b                    r = a + b
+    e_anim_op_sub       = 0x04, // r a b                    r = a - b
+    e_anim_op_mul       = 0x05, // r a b                    r = a * b
+    e_anim_op_div       = 0x06, // r a b                    r = a / b, 0 if b is 0
+    e_anim_op_mod       = 0x07, // r a b                    r = a % b, 0 if b is 0
+    e_anim_op_scale     = 0x08, // r a b                    r = a * b / 100
+    e_anim_op_jmp       = 0x09, // addr16
+    e_anim_op_jz        = 0x0A, // r addr16                 jump if r == 0
+    e_anim_op_jlt       = 0x0B, // a b addr16               jump if a < b
+    e_anim_op_fill      = 0x10, // rgb                      whole strip
+    e_anim_op_segment   = 0x11, // start len rgb            start, len are registers
+    e_anim_op_gradient  = 0x12, // start len rgb rgb
+    e_anim_op_pulse     = 0x13, // period min rgb           whole strip, period register in frames, min 0-255
+    e_anim_op_chase     = 0x14, // start len width rgb      width pixels moving one pixel a frame
+} animation_op_t;
+
+typedef enum {
+    e_anim_input_frame,         // refresh count since reset
+    e_anim_input_led_count,
+    e_anim_input_charge,        // charge percent
+    e_anim_input_night,         // 1 in night mode
+    e_anim_input_count
+} animation_input_t;
+
+typedef struct {
+    uint16_t length;
+    uint8_t data[ANIMATION_PROGRAM_MAX_LENGTH];
+} animation_program_t;
+
+//******************************************************************************
+/**
+ * @brief Animation defined by a program the proxy uploads.
+ *
+ * Program: magic, version, refresh rate in ms (16 bit big endian), code.
+ * The code runs once per refresh, integer math only, no allocation, and at
+ * most ANIMATION_INSTRUCTION_BUDGET instructions.  Colors are RGB.
+ *
+ * Programs are checked by validate() before they are stored, refresh()
+ * trusts them.
+ */
+class BytecodeAnimation : public BaseAnimation {
+public:
+    static esp_err_t validate(const uint8_t* data, size_t length);
+
+    void reset(const animation_program_t& program, int charge_percent = 0, bool night = false);
+    int refresh(uint8_t* led_pixels, int start_pixel = 0, int led_count = 0) override;
+
+    inline void set_charge_percent(int charge_percent) { this->charge_percent = charge_percent; }
+    inline uint32_t get_budget_exceeded(void) const { return this->budget_exceeded; }
+
+private:
+    animation_program_t program = {};
+    int32_t registers[ANIMATION_REGISTER_COUNT] = {};
+    uint32_t frame = 0;
+    int charge_percent = 0;
+    bool night = false;
+    uint32_t budget_exceeded = 0;
+};
@@ -69,4 +69,7 @@ private:
     uint32_t bubble_anim_max = 0;	// Animation state (from 0 to charge indicator)
     
     bool simulate_charge = false;
+#ifdef UNIT_TEST
+    bool quiet = false;
+#endif
 };
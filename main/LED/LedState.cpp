@@ -0,0 +1,76 @@
+//******************************************************************************
+/**
+ * @file LedState.cpp
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief LED state string mapping
+ * @version 0.1
+ * @date 2024-02-07
+ * 
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+
+#include "LedState.h"
+
+#include <string.h>
+
+//******************************************************************************
+/**
+ * @brief Map a state name to the led_state_t enum.
+ * 
+ * @param name      State name, not necessarily null terminated.
+ * @param length    Length of the name.
+ * @return led_state_t  e_station_unknown if the name is not a known state.
+ */
+led_state_t led_state_from_string(const char* name, size_t length) {
+    #define MAP_TO_ENUM(x) \
+        if (length == sizeof(#x) - 1 && memcmp(name, #x, length) == 0) { \
+            return e_station_##x; \
+        }
+
+    MAP_TO_ENUM(available);
+    MAP_TO_ENUM(waiting_for_power);
+    MAP_TO_ENUM(charging);
+    MAP_TO_ENUM(charging_complete);
+    MAP_TO_ENUM(out_of_service);
+    MAP_TO_ENUM(disable);
+    MAP_TO_ENUM(booting_up);
+    MAP_TO_ENUM(offline);
+    MAP_TO_ENUM(reserved);
+    MAP_TO_ENUM(iot_unprovisioned);
+    MAP_TO_ENUM(cp_unprovisioned);
+    MAP_TO_ENUM(waiting_4_first_state);
+    MAP_TO_ENUM(no_connection);
+    MAP_TO_ENUM(debug_on);
+    MAP_TO_ENUM(debug_off);
+
+    #undef MAP_TO_ENUM
+    return e_station_unknown;
+}
+
+//******************************************************************************
+const char* led_state_to_string(led_state_t state) {
+    #define ENUM_TO_STRING(x) case e_station_##x: return #x;
+
+    switch (state) {
+        ENUM_TO_STRING(available);
+        ENUM_TO_STRING(waiting_for_power);
+        ENUM_TO_STRING(charging);
+        ENUM_TO_STRING(charging_complete);
+        ENUM_TO_STRING(out_of_service);
+        ENUM_TO_STRING(disable);
+        ENUM_TO_STRING(booting_up);
+        ENUM_TO_STRING(offline);
+        ENUM_TO_STRING(reserved);
+        ENUM_TO_STRING(iot_unprovisioned);
+        ENUM_TO_STRING(cp_unprovisioned);
+        ENUM_TO_STRING(waiting_4_first_state);
+        ENUM_TO_STRING(no_connection);
+        ENUM_TO_STRING(debug_on);
+        ENUM_TO_STRING(debug_off);
+        ENUM_TO_STRING(unknown);
+        default: return "unknown";
+    }
+
+    #undef ENUM_TO_STRING
+}
@@ -0,0 +1,59 @@
+//******************************************************************************
+/**
+ * @file LedState.h
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief LED state definitions
+ * @version 0.1
+ * @date 2024-02-07
+ * 
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#pragma once
+
+#include <stddef.h>
+
+//******************************************************************************
+/**
+ * @brief LED state
+ * 
+ * This enum defines the LED state.
+ */
+typedef enum {
+    e_station_available,           // 00 green   (s)  - Available and ready to charge
+    e_station_waiting_for_power,   // 01 cyan    (s)  - Waiting for power to be available
+    e_station_charging,            // 02 blue    (p)  - Charging a vehicle
+    e_station_charging_complete,   // 03 blue    (s)  - Charging complete, or preparing for vehicle communication after plugging a vehicle in 
+    e_station_out_of_service,      // 04 red     (s)  - Out of service
+    e_station_disable,             // 05 red     (s)  - Disabled
+    e_station_booting_up,          // 06 yellow  (p)  - Station booting up / Not ready yet
+    e_station_offline,             // 07 white   (s)  - Station offline
+    e_station_reserved,            // 08 orange  (s)  - Station reserved
+    e_station_iot_unprovisioned,   // 09 purple  (s)  - Station not provisioned with AWS
+    e_station_debug_on,            // 10 fushia  (s)  - Debug mode on
+    e_station_debug_off,           // 11 black   (s)  - Debug mode off
+    e_station_cp_unprovisioned,    // 12 purple  (p)  - ChargePoint not provisioned with AWS
+    e_station_waiting_4_first_state, // 13 white  (s)  - Waiting for first state
+    e_station_no_connection,       // 14 black   (s)  - No connection
+    e_debug_charging,              // 14 blue    (p)  - Debug charging
+    e_station_unknown              // Error state
+} led_state_t;
+
+//******************************************************************************
+/**
+ * @brief LED state info
+ * 
+ * This struct defines the LED state info.
+ * 
+ * @note This struct is used to pass the LED state info to the LedTaskSpi task.
+ * @note The members could have been part of the LedTask class.
+ */
+typedef struct {
+    led_state_t state;
+    int charge_percent;
+} led_state_info_t;
+
+// Map the state names used by the proxy to led_state_t and back.  The name
+// does not need to be null terminated.
+led_state_t led_state_from_string(const char* name, size_t length);
+const char* led_state_to_string(led_state_t state);
@@ -18,10 +18,12 @@
 #include "esp_log.h"
 #include "esp_check.h"
 #include "esp_rom_gpio.h"
+#include "esp_timer.h"
 #include "soc/spi_periph.h"
 #include "hal/gpio_types.h"
 
 #include <memory.h>
+#include <string.h>
 #include <math.h>
 
 static const char *TAG = "LedTaskSpi";
@@ -56,8 +58,14 @@ void LedTaskSpi::vTaskCodeLed()
 
     do
     {
+        if (this->show_stream()) {
+            // Back to the station state, whatever it is now.
+            state_changed = true;
+        }
+
         if (state_changed)
         {
+            this->frame_due_us = 0;
             Colors& colors = Colors::instance();
             ESP_LOGI(TAG, "%d: State changed", this->led_bar_number);
             ESP_LOGI(TAG, "New state is %d", this->state_info.state);
@@ -110,6 +118,11 @@ void LedTaskSpi::vTaskCodeLed()
                 break;
             }
 
+            // A program from the proxy wins over the built-in animation.
+            if (this->load_program()) {
+                ESP_LOGI(TAG, "%d: Showing the program of state %d", this->led_bar_number, state_info.state);
+            }
+
             state_changed = false;
 
             // TODO: FIGURE OUT WHAT TO DO IF WE CAN'T CHANGE THE LED STATE
@@ -119,8 +132,17 @@ void LedTaskSpi::vTaskCodeLed()
         }
 
         if (this->animation != NULL) {
+            int64_t start_us = esp_timer_get_time();
+            uint32_t rate_us = this->animation->get_rate() * 1000;
+            if (this->frame_due_us != 0 && start_us > this->frame_due_us + rate_us) {
+                this->frame_counters.late++;
+            }
+
             this->animation->refresh(this->led_pixels, 0, this->led_count);
-            this->rmt_over_spi.write_led_value_to_strip(this->led_pixels);
+            this->render_us.observe((uint32_t)(esp_timer_get_time() - start_us));
+            this->show_frame();
+
+            this->frame_due_us = esp_timer_get_time() + rate_us;
             queue_timeout = this->animation->get_rate() / portTICK_PERIOD_MS;
             ESP_LOGD(TAG, "%d: Queue timeout: %ld", this->led_bar_number, queue_timeout);
         }
@@ -148,6 +170,11 @@ void LedTaskSpi::vTaskCodeLed()
             if (current_intensity != this->intensity) {
                 this->intensity = current_intensity;
                 state_changed = true;
+            } else if (this->animation_library != nullptr &&
+                this->animation_library->get_generation() != this->animation_generation
+            ) {
+                // A program was uploaded or removed, maybe for this state.
+                state_changed = true;
             } else {
                 state_changed = false;
             }
@@ -155,6 +182,89 @@ void LedTaskSpi::vTaskCodeLed()
     } while(true);
 }
 
+//******************************************************************************
+/**
+ * @brief Switch to the program bound to the current state, if any.
+ * 
+ * @return true     The program is the animation now.
+ */
+bool LedTaskSpi::load_program(void)
+{
+    if (this->animation_library == nullptr) {
+        return false;
+    }
+
+    this->animation_generation = this->animation_library->get_generation();
+
+    animation_program_t program;
+    if (!this->animation_library->get_program(this->state_info.state, program)) {
+        return false;
+    }
+
+    this->bytecode_animation.reset(program, this->state_info.charge_percent, this->intensity == LED_INTENSITY_LOW);
+    this->animation = &this->bytecode_animation;
+    return true;
+}
+
+//******************************************************************************
+/**
+ * @brief Show the frames of the pixel stream while it is active.
+ * 
+ * The station states received meanwhile are kept, not shown.  The task
+ * sleeps until the udp task notifies it of a new frame, with a timeout to
+ * notice that the stream stopped.
+ * 
+ * @return true     The stream was shown and stopped.
+ */
+bool LedTaskSpi::show_stream(void)
+{
+    if (this->pixel_stream == nullptr || !this->pixel_stream->is_active(esp_timer_get_time() / 1000)) {
+        return false;
+    }
+
+    ESP_LOGI(TAG, "%d: Pixel stream started", this->led_bar_number);
+    int strip = this->led_bar_number;
+
+    led_state_info_t updated_state;
+    while (this->pixel_stream->is_active(esp_timer_get_time() / 1000)) {
+        const uint8_t* frame = this->pixel_stream->take_frame(strip);
+        if (frame != nullptr) {
+            memcpy(this->led_pixels, frame, this->led_count * 3);
+            this->show_frame();
+        }
+
+        while (xQueueReceive(this->state_update_queue, &updated_state, 0) == pdTRUE) {
+            this->state_info = updated_state;
+        }
+
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(PIXEL_STREAM_TIMEOUT_MS / 5) + 1);
+    }
+
+    ESP_LOGI(TAG, "%d: Pixel stream stopped", this->led_bar_number);
+    return true;
+}
+
+//******************************************************************************
+/**
+ * @brief Write led_pixels to the strip and count it.
+ */
+void LedTaskSpi::show_frame(void)
+{
+    this->rmt_over_spi.write_led_value_to_strip(this->led_pixels);
+    this->frame_counters.rendered++;
+}
+
+//******************************************************************************
+/**
+ * @brief A frame of the pixel stream is ready, wake up the task.
+ */
+void LedTaskSpi::notify_frame(void)
+{
+    if (this->task_handle != nullptr) {
+        xTaskNotifyGive(this->task_handle);
+    }
+}
+
 //******************************************************************************
 /**
  * @brief Setup the LED task
@@ -261,6 +371,7 @@ esp_err_t LedTaskSpi::set_pattern(led_state_t pattern, int charge_percent)
     led_state_info_t state_info;
     state_info.state = pattern;
     state_info.charge_percent = charge_percent;
+    this->requested_state_info = state_info;
     xQueueSend(this->state_update_queue, &state_info, portMAX_DELAY);
     return ESP_OK;
 
@@ -282,75 +393,15 @@ esp_err_t LedTaskSpi::set_pattern(led_state_t pattern, int charge_percent)
  */
 esp_err_t LedTaskSpi::set_state(const char *new_state, int charge_percent)
 {
-    led_state_t state = e_station_unknown;
-    #define MAP_TO_ENUM(x) if (strcmp(new_state, #x) == 0) {\
-            state = e_station_##x; \
-            goto mapped; \
-        }
-    
-    MAP_TO_ENUM(available);
-    MAP_TO_ENUM(waiting_for_power);
-    MAP_TO_ENUM(charging);
-    MAP_TO_ENUM(charging_complete);
-    MAP_TO_ENUM(out_of_service);
-    MAP_TO_ENUM(disable);
-    MAP_TO_ENUM(booting_up);
-    MAP_TO_ENUM(offline);
-    MAP_TO_ENUM(reserved);
-    MAP_TO_ENUM(iot_unprovisioned);
-    MAP_TO_ENUM(cp_unprovisioned);
-    MAP_TO_ENUM(waiting_4_first_state);
-    MAP_TO_ENUM(no_connection);
-    MAP_TO_ENUM(debug_on);
-    MAP_TO_ENUM(debug_off);
-    MAP_TO_ENUM(unknown);
-    
-    if (state == e_station_unknown) {
+    led_state_t state = led_state_from_string(new_state, strlen(new_state));
+    if (state == e_station_unknown && strcmp(new_state, "unknown") != 0) {
         ESP_LOGE(TAG, "%d: Unknown state %s", this->led_bar_number, new_state);
         return ESP_FAIL;
     }
 
-mapped:
     return this->set_pattern(state, charge_percent);
 }
 
 const char* LedTaskSpi::get_state_as_string(void) {
-    #define ENUM_TO_STRING(x) case e_station_##x: return #x;
-    
-    switch (this->state_info.state) {
-        ENUM_TO_STRING(available);
-        ENUM_TO_STRING(waiting_for_power);
-        ENUM_TO_STRING(charging);
-        ENUM_TO_STRING(charging_complete);
-        ENUM_TO_STRING(out_of_service);
-        ENUM_TO_STRING(disable);
-        ENUM_TO_STRING(booting_up);
-        ENUM_TO_STRING(offline);
-        ENUM_TO_STRING(reserved);
-        ENUM_TO_STRING(iot_unprovisioned);
-        ENUM_TO_STRING(cp_unprovisioned);
-        ENUM_TO_STRING(waiting_4_first_state);
-        ENUM_TO_STRING(no_connection);
-        ENUM_TO_STRING(debug_on);
-        ENUM_TO_STRING(debug_off);
-        ENUM_TO_STRING(unknown);
-        default: return "unknown";
-        // case e_station_available:           return "available";
-        // case e_station_waiting_for_power:   return "waiting_for_power";
-        // case e_station_charging:            return "charging";
-        // case e_station_charging_complete:   return "charging_complete";
-        // case e_station_out_of_service:      return "out_of_service";
-        // case e_station_disable:             return "disable";
-        // case e_station_booting_up:          return "booting_up";
-        // case e_station_offline:             return "offline";
-        // case e_station_reserved:            return "reserved";
-        // case e_station_iot_unprovisioned:   return "iot_unprovisioned";
-        // case e_station_cp_unprovisioned:    return "cp_unprovisioned";
-        // case e_station_debug_on:            return "debug_on";
-        // case e_station_debug_off:           return "debug_off";
-        // case e_station_no_connection:       return "no_connection";
-        // case e_station_waiting_4_first_state: return "waiting_4_first_state";
-        // case e_station_unknown:             return "unknown";
-        // default:                            return "unknown";
-    }
+    return led_state_to_string(this->state_info.state);
 }
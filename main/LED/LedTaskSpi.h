@@ -13,7 +13,11 @@
 
 #include "Utils/NoCopy.h"
 #include "Utils/Colors.h"
+#include "Utils/Metrics.h"
 #include "RmtOverSpi.h"
+#include "LedState.h"
+#include "PixelStream.h"
+#include "AnimationLibrary.h"
 
 #include "esp_err.h"
 #include "driver/spi_master.h"
@@ -27,46 +31,12 @@
 #include "Animations/SmoothRatePulseCurve.h"
 #include "Animations/PulsingAnimation.h"
 #include "Animations/ChargingAnimationWhiteBubble.h"
+#include "Animations/BytecodeAnimation.h"
 
-//******************************************************************************
-/**
- * @brief LED state
- * 
- * This enum defines the LED state.
- */
-typedef enum {
-    e_station_available,           // 00 green   (s)  - Available and ready to charge
-    e_station_waiting_for_power,   // 01 cyan    (s)  - Waiting for power to be available
-    e_station_charging,            // 02 blue    (p)  - Charging a vehicle
-    e_station_charging_complete,   // 03 blue    (s)  - Charging complete, or preparing for vehicle communication after plugging a vehicle in 
-    e_station_out_of_service,      // 04 red     (s)  - Out of service
-    e_station_disable,             // 05 red     (s)  - Disabled
-    e_station_booting_up,          // 06 yellow  (p)  - Station booting up / Not ready yet
-    e_station_offline,             // 07 white   (s)  - Station offline
-    e_station_reserved,            // 08 orange  (s)  - Station reserved
-    e_station_iot_unprovisioned,   // 09 purple  (s)  - Station not provisioned with AWS
-    e_station_debug_on,            // 10 fushia  (s)  - Debug mode on
-    e_station_debug_off,           // 11 black   (s)  - Debug mode off
-    e_station_cp_unprovisioned,    // 12 purple  (p)  - ChargePoint not provisioned with AWS
-    e_station_waiting_4_first_state, // 13 white  (s)  - Waiting for first state
-    e_station_no_connection,       // 14 black   (s)  - No connection
-    e_debug_charging,              // 14 blue    (p)  - Debug charging
-    e_station_unknown              // Error state
-} led_state_t;
-
-//******************************************************************************
-/**
- * @brief LED state info
- * 
- * This struct defines the LED state info.
- * 
- * @note This struct is used to pass the LED state info to the LedTaskSpi task.
- * @note The members could have been part of the LedTask class.
- */
 typedef struct {
-    led_state_t state;
-    int charge_percent;
-} led_state_info_t;
+    uint32_t rendered;      // written to the strip
+    uint32_t late;          // rendered a frame period or more after it was due
+} led_frame_counters_t;
 
 //******************************************************************************
 /**
@@ -100,9 +70,29 @@ public:
     esp_err_t set_state(const char* new_state, int charge_percent);
 
     const char* get_state_as_string(void);
+    inline led_state_t get_state(void) const { return this->state_info.state; }
+
+    // Frames streamed by a lighting controller override the station state
+    // while they keep coming.
+    inline void set_pixel_stream(PixelStream* pixel_stream) { this->pixel_stream = pixel_stream; }
+    void notify_frame(void);
+
+    // Programs uploaded by the proxy replace the built-in animation of
+    // their state.
+    inline void set_animation_library(AnimationLibrary* animation_library) { this->animation_library = animation_library; }
+
+    // Last state asked for, it may not be showing yet.
+    inline led_state_info_t get_requested_state(void) const { return this->requested_state_info; }
+
+    inline int get_led_bar_number(void) const { return this->led_bar_number; }
+    inline const led_frame_counters_t& get_frame_counters(void) const { return this->frame_counters; }
+    inline const MetricHistogram& get_render_us(void) const { return this->render_us; }
 
 protected:
     void vTaskCodeLed(void);
+    bool show_stream(void);
+    bool load_program(void);
+    void show_frame(void);
     static void svTaskCodeLed( void * pvParameters ) { ((LedTaskSpi*)pvParameters)->vTaskCodeLed(); }
 
 private:
@@ -113,9 +103,10 @@ private:
 
     uint8_t* led_pixels;
     led_state_info_t state_info;
+    led_state_info_t requested_state_info = { e_station_unknown, 0 };
     LED_INTENSITY intensity = LED_INTENSITY_HIGH;
 
-    TaskHandle_t task_handle;
+    TaskHandle_t task_handle = nullptr;
     QueueHandle_t state_update_queue;
 
     BaseAnimation* animation = nullptr;
@@ -124,8 +115,18 @@ private:
     SmoothRatePulseCurve smooth_rate_pulse_curve;
     PulsingAnimation pulsing_animation;
     ChargingAnimationWhiteBubble charging_animation_white_bubble;
+    BytecodeAnimation bytecode_animation;
     bool disable_connecting_leds = false;
 
+    PixelStream* pixel_stream = nullptr;
+    AnimationLibrary* animation_library = nullptr;
+    uint32_t animation_generation = 0;
+
     RmtOverSpi rmt_over_spi;
+
+    led_frame_counters_t frame_counters = {};
+    int64_t frame_due_us = 0;           // 0, no frame of the animation yet
+    static constexpr uint32_t render_bounds[] = { 50, 100, 250, 500, 1000, 2500, 5000, 10000 };
+    MetricHistogram render_us{ render_bounds, sizeof(render_bounds) / sizeof(render_bounds[0]) };
 };
 
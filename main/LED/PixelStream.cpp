@@ -0,0 +1,226 @@
+//******************************************************************************
+/**
+ * @file PixelStream.cpp
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief PixelStream class implementation
+ * @version 0.1
+ * @date 2024-02-26
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#include "PixelStream.h"
+
+#include "esp_log.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static const char* TAG = "pixel_stream";
+
+#define PIXEL_STREAM_FRESH      (0x80)
+
+// DDP header, byte 0.
+#define DDP_FLAGS_VERSION_MASK  (0xC0)
+#define DDP_FLAGS_VERSION_1     (0x40)
+#define DDP_FLAGS_TIMECODE      (0x10)
+#define DDP_FLAGS_STORAGE       (0x08)
+#define DDP_FLAGS_REPLY         (0x04)
+#define DDP_FLAGS_QUERY         (0x02)
+#define DDP_FLAGS_PUSH          (0x01)
+
+// DDP header, byte 3.
+#define DDP_ID_DISPLAY          (1)
+
+//******************************************************************************
+PixelStream::~PixelStream(void) {
+    for (int i = 0; i < this->strip_count; i++) {
+        for (int j = 0; j < 3; j++) {
+            free(this->strips[i].buffers[j]);
+        }
+    }
+}
+
+//******************************************************************************
+/**
+ * @brief Allocate the frame buffers, all strips are the same length.
+ */
+esp_err_t PixelStream::setup(int strip_count, int led_count) {
+    if (strip_count <= 0 || strip_count > PIXEL_STREAM_MAX_STRIPS || led_count <= 0 || this->strip_count != 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    for (int i = 0; i < strip_count; i++) {
+        strip_buffers_t& strip = this->strips[i];
+        for (int j = 0; j < 3; j++) {
+            strip.buffers[j] = (uint8_t*) calloc(led_count, 3);
+            if (strip.buffers[j] == nullptr) {
+                ESP_LOGE(TAG, "Failed to allocate frame buffers");
+                this->strip_count = i + 1;
+                return ESP_ERR_NO_MEM;
+            }
+        }
+        strip.back = 0;
+        strip.middle = 1;
+        strip.front = 2;
+    }
+
+    this->strip_count = strip_count;
+    this->led_count = led_count;
+    return ESP_OK;
+}
+
+//******************************************************************************
+/**
+ * @brief Handle one DDP packet.
+ */
+pixel_stream_result_t PixelStream::receive(const uint8_t* packet, size_t length, uint32_t now_ms) {
+    if (packet == nullptr || length < DDP_HEADER_LENGTH || (packet[0] & DDP_FLAGS_VERSION_MASK) != DDP_FLAGS_VERSION_1) {
+        this->counters.invalid++;
+        return e_pixel_stream_invalid;
+    }
+
+    uint8_t flags = packet[0];
+    uint8_t seq = packet[1] & 0x0F;
+    uint8_t id = packet[3];
+    uint32_t offset = ((uint32_t) packet[4] << 24) | ((uint32_t) packet[5] << 16) | ((uint32_t) packet[6] << 8) | packet[7];
+    size_t data_length = ((size_t) packet[8] << 8) | packet[9];
+    size_t header_length = DDP_HEADER_LENGTH + ((flags & DDP_FLAGS_TIMECODE) ? DDP_TIMECODE_LENGTH : 0);
+
+    if (length < header_length || length - header_length < data_length) {
+        this->counters.invalid++;
+        return e_pixel_stream_invalid;
+    }
+
+    if ((flags & (DDP_FLAGS_QUERY | DDP_FLAGS_REPLY | DDP_FLAGS_STORAGE)) != 0 || id != DDP_ID_DISPLAY || this->strip_count == 0) {
+        return e_pixel_stream_ignored;
+    }
+
+    this->counters.packets++;
+
+    if (seq != 0) {
+        // Serial number arithmetic over 4 bits, half the range is behind us.
+        uint8_t delta = (uint8_t)(seq - this->last_seq) & 0x0F;
+        if (this->has_seq && (delta == 0 || delta > 8)) {
+            this->counters.late++;
+            return e_pixel_stream_late;
+        }
+        this->has_seq = true;
+        this->last_seq = seq;
+    }
+
+    this->store(offset, packet + header_length, data_length);
+
+    if ((flags & DDP_FLAGS_PUSH) == 0) {
+        return e_pixel_stream_data;
+    }
+
+    this->push();
+    this->last_frame_ms = now_ms;
+    this->has_frame = true;
+    return e_pixel_stream_frame;
+}
+
+//******************************************************************************
+/**
+ * @brief Copy RGB data at a byte offset of the display into the back buffers.
+ */
+void PixelStream::store(uint32_t offset, const uint8_t* data, size_t length) {
+    // RGB in, GRB out.
+    static const uint8_t channel_map[3] = { 1, 0, 2 };
+
+    size_t strip_bytes = (size_t) this->led_count * 3;
+    size_t display_bytes = strip_bytes * this->strip_count;
+    if (offset >= display_bytes) {
+        return;
+    }
+    if (length > display_bytes - offset) {
+        length = display_bytes - offset;
+    }
+
+    // The offset doesn't have to fall on a pixel, track the start of the
+    // pixel being written so the strip change is found.
+    int strip = (int)(offset / strip_bytes);
+    int channel = (int)(offset % 3);
+    size_t in_strip = offset % strip_bytes - channel;
+    uint8_t* pixel = this->strips[strip].buffers[this->strips[strip].back] + in_strip;
+    this->touched |= 1 << strip;
+
+    for (size_t i = 0; i < length; i++) {
+        pixel[channel_map[channel]] = data[i];
+        if (++channel == 3) {
+            channel = 0;
+            pixel += 3;
+            in_strip += 3;
+            if (in_strip == strip_bytes && i + 1 < length) {
+                strip++;
+                in_strip = 0;
+                pixel = this->strips[strip].buffers[this->strips[strip].back];
+                this->touched |= 1 << strip;
+            }
+        }
+    }
+}
+
+//******************************************************************************
+/**
+ * @brief Hand the frame to the LED tasks.
+ */
+void PixelStream::push(void) {
+    bool overrun = false;
+
+    for (int i = 0; i < this->strip_count; i++) {
+        if ((this->touched & (1 << i)) == 0) {
+            continue;
+        }
+
+        strip_buffers_t& strip = this->strips[i];
+        uint8_t previous = strip.middle.exchange(strip.back | PIXEL_STREAM_FRESH);
+        if (previous & PIXEL_STREAM_FRESH) {
+            this->counters.suppressed[i]++;
+            overrun = true;
+        }
+
+        // Start the next frame from this one, a sender that only updates
+        // part of the display keeps the rest.
+        uint8_t next = previous & ~PIXEL_STREAM_FRESH;
+        memcpy(strip.buffers[next], strip.buffers[strip.back], (size_t) this->led_count * 3);
+        strip.back = next;
+    }
+
+    this->touched = 0;
+    this->counters.frames++;
+    if (overrun) {
+        this->counters.overrun++;
+    }
+}
+
+//******************************************************************************
+/**
+ * @brief A controller is streaming, the LED tasks show its frames.
+ */
+bool PixelStream::is_active(uint32_t now_ms) const {
+    return this->has_frame && (uint32_t)(now_ms - this->last_frame_ms) < PIXEL_STREAM_TIMEOUT_MS;
+}
+
+//******************************************************************************
+/**
+ * @brief The newest frame of a strip, GRB, if there is one we haven't taken.
+ *
+ * @return const uint8_t*   nullptr if no new frame.  Valid until the next
+ *                          call for the same strip.
+ */
+const uint8_t* PixelStream::take_frame(int strip) {
+    if (strip < 0 || strip >= this->strip_count) {
+        return nullptr;
+    }
+
+    strip_buffers_t& buffers = this->strips[strip];
+    if ((buffers.middle.load() & PIXEL_STREAM_FRESH) == 0) {
+        return nullptr;
+    }
+
+    uint8_t previous = buffers.middle.exchange(buffers.front);
+    buffers.front = previous & ~PIXEL_STREAM_FRESH;
+    return buffers.buffers[buffers.front];
+}
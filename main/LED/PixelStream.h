@@ -0,0 +1,112 @@
+//******************************************************************************
+/**
+ * @file PixelStream.h
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief PixelStream class definition
+ * @version 0.1
+ * @date 2024-02-26
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#pragma once
+
+#include "Utils/NoCopy.h"
+
+#include "esp_err.h"
+
+#include <atomic>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define PIXEL_STREAM_MAX_STRIPS     (2)
+
+// Back to the station state when no frame came in for this long.
+#define PIXEL_STREAM_TIMEOUT_MS     (2500)
+
+#define DDP_PORT                    (4048)
+#define DDP_HEADER_LENGTH           (10)
+#define DDP_TIMECODE_LENGTH         (4)
+
+typedef enum {
+    e_pixel_stream_ignored,     // not a pixel packet for us (query, other device...)
+    e_pixel_stream_invalid,     // not ddp
+    e_pixel_stream_late,        // older than what we already have, dropped
+    e_pixel_stream_data,        // pixels stored, the frame isn't complete
+    e_pixel_stream_frame,       // frame complete, handed to the LED tasks
+} pixel_stream_result_t;
+
+typedef struct {
+    uint32_t packets;
+    uint32_t frames;            // complete frames handed to the LED tasks
+    uint32_t late;              // packets dropped for being out of order
+    uint32_t overrun;           // frames replaced by a newer one before being shown
+    uint32_t suppressed[PIXEL_STREAM_MAX_STRIPS];   // the same, per strip
+    uint32_t invalid;
+} pixel_stream_counters_t;
+
+//******************************************************************************
+/**
+ * @brief Pixels streamed by a lighting controller, DDP over udp.
+ *
+ * The strips are one display, strip 0 first: byte offset 0 is the red of the
+ * first pixel of strip 0.  Frames are RGB, stored in the strip order (GRB)
+ * so the LED task writes them to the strip as is.  A frame is shown when
+ * the packet with the push flag comes in.
+ *
+ * Sequencing: a packet whose 4 bit seq is behind the newest one we saw is
+ * late and dropped, it belongs to a frame that was already pushed or
+ * skipped.  Seq 0 means the sender doesn't number its packets.
+ *
+ * Each strip is triple buffered.  The receiver fills the back buffer, the
+ * push swaps it with the middle one, the LED task swaps the middle one with
+ * its front buffer when it has a fresh frame.  A frame pushed before the LED
+ * task took the previous one replaces it: the display shows the newest
+ * frame it can keep up with, never a queue of old ones.
+ *
+ * Time is passed in so this can be tested on the host.
+ *
+ * @note receive() is called from one task, take_frame() from one task per
+ *       strip.  No lock, the buffer swaps are atomic.
+ */
+class PixelStream : public NoCopy {
+public:
+    PixelStream(void) = default;
+    ~PixelStream(void);
+
+public:
+    esp_err_t setup(int strip_count, int led_count);
+
+    pixel_stream_result_t receive(const uint8_t* packet, size_t length, uint32_t now_ms);
+
+    bool is_active(uint32_t now_ms) const;
+    const uint8_t* take_frame(int strip);
+
+    inline const pixel_stream_counters_t& get_counters(void) const { return this->counters; }
+
+private:
+    typedef struct {
+        uint8_t* buffers[3];
+        uint8_t back;                   // receiver only
+        uint8_t front;                  // LED task only
+        std::atomic<uint8_t> middle;    // index, | PIXEL_STREAM_FRESH once pushed
+    } strip_buffers_t;
+
+    void store(uint32_t offset, const uint8_t* data, size_t length);
+    void push(void);
+
+    int strip_count = 0;
+    int led_count = 0;
+    strip_buffers_t strips[PIXEL_STREAM_MAX_STRIPS] = {};
+    uint8_t touched = 0;            // strips written since the last push
+
+    bool has_seq = false;
+    uint8_t last_seq = 0;
+
+    std::atomic<bool> has_frame{false};
+    std::atomic<uint32_t> last_frame_ms{0};
+
+    pixel_stream_counters_t counters = {};
+};
@@ -1,11 +1,19 @@
 #include "NetworkConfiguration.h"
 
 #include "Utils/KeyStore.h"
+#include "Utils/ConfigBlob.h"
 
 #include "esp_log.h"
 
+#include <stdlib.h>
+#include <string.h>
+
 static const char *TAG = "NetworkConfiguration";
 
+// Layout of the blob, bumped when a field changes meaning.
+#define NETWORK_CONFIG_VERSION (1)
+#define NETWORK_CONFIG_FIELDS  (6)
+
 //******************************************************************************
 /**
  * @brief Reset the network configuration to the default values.
@@ -21,18 +29,8 @@ esp_err_t NetworkConfiguration::reset_config() {
         return false;
     }
 
-    ESP_ERASE_KEY("enabled", false);
-    ESP_ERASE_KEY("dhcp", false);
-    ESP_ERASE_KEY("ip", false);
-    ESP_ERASE_KEY("netmask", false);
-    ESP_ERASE_KEY("gateway", false);
-    ESP_ERASE_KEY("dns", false);
-
-    res = this->on_reset_config(store);
-    if (res != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to reset extra");
-        return res;
-    }
+    ESP_ERASE_KEY(CONFIG_BLOB_KEY, false);
+    this->erase_keys(store);
 
     res = store.commit();
     if (res != ESP_OK) {
@@ -80,12 +78,18 @@ esp_err_t NetworkConfiguration::dump_config() {
 /**
  * @brief Load the ethernet configuration from flash.
  * 
+ * One read of the blob.  The keys of older firmware are read instead when
+ * there is no blob, and copied to one.  The keys are still written, see
+ * save_keys().
+ * 
  * @return true   load successful
  * @return false  load failed  -- 
  */
 esp_err_t NetworkConfiguration::load() {
     KeyStore store;
     esp_err_t res;
+    uint8_t blob[NETWORK_CONFIG_BLOB_SIZE];
+    size_t blobLength = sizeof(blob);
 
     if (store.openKeyStore(this->get_store_section_name(), e_ro) != ESP_OK) {
         ESP_LOGE(TAG, "Failed to open %s config store", this->get_store_section_name());
@@ -100,6 +104,117 @@ esp_err_t NetworkConfiguration::load() {
     this->gateway.addr = 0;
     this->dns.addr = 0;
 
+    res = store.getKeyBlob(CONFIG_BLOB_KEY, blob, blobLength);
+    if (res == ESP_OK) {
+        res = this->unpack(blob, blobLength);
+        if (res != ESP_OK) {
+            ESP_LOGW(TAG, "%s config blob rejected (%s), trying the keys", this->get_store_section_name(), esp_err_to_name(res));
+        } else if (this->keys_differ(store)) {
+            ESP_LOGW(TAG, "%s config changed by older firmware, taking the keys", this->get_store_section_name());
+            res = ESP_ERR_INVALID_STATE;
+        }
+    }
+
+    if (res != ESP_OK) {
+        res = this->load_keys(store);
+        if (res != ESP_OK) {
+            return res;
+        }
+        ESP_LOGI(TAG, "Copying %s config to one blob", this->get_store_section_name());
+        if (this->save() != ESP_OK) {
+            ESP_LOGW(TAG, "Failed to copy %s config, will try again next boot", this->get_store_section_name());
+        }
+    }
+
+    this->isConfigured = true;
+
+    return ESP_OK;
+}
+
+//******************************************************************************
+/**
+ * @brief Read the fields from the blob, the ones not known are skipped.
+ */
+esp_err_t NetworkConfiguration::unpack(const uint8_t* blob, size_t length) {
+    ConfigBlobReader reader;
+    char field[CONFIG_BLOB_FIELD_MAX_LENGTH + 1];
+
+    esp_err_t res = reader.open(blob, length, NETWORK_CONFIG_VERSION);
+    if (res != ESP_OK) {
+        return res;
+    }
+
+    while (reader.next_field(field, sizeof(field))) {
+        if (strcmp(field, "enabled") == 0) { reader.read_bool(this->isEnabled); }
+        else if (strcmp(field, "dhcp") == 0) { reader.read_bool(this->useDHCP); }
+        else if (strcmp(field, "ip") == 0) { reader.read_u32(this->ipAddress.addr); }
+        else if (strcmp(field, "netmask") == 0) { reader.read_u32(this->netmask.addr); }
+        else if (strcmp(field, "gateway") == 0) { reader.read_u32(this->gateway.addr); }
+        else if (strcmp(field, "dns") == 0) { reader.read_u32(this->dns.addr); }
+        else if (!this->on_unpack(field, reader)) { reader.skip(); }
+    }
+
+    return reader.finish();
+}
+
+//******************************************************************************
+/**
+ * @brief Write the fields to a blob of size bytes.
+ */
+esp_err_t NetworkConfiguration::pack(uint8_t* blob, size_t size, size_t& length) {
+    ConfigBlobWriter writer(blob, size, NETWORK_CONFIG_VERSION);
+    writer.begin(NETWORK_CONFIG_FIELDS + this->on_pack_fields());
+    writer.boolean("enabled", this->isEnabled);
+    writer.boolean("dhcp", this->useDHCP);
+    writer.integer("ip", this->ipAddress.addr);
+    writer.integer("netmask", this->netmask.addr);
+    writer.integer("gateway", this->gateway.addr);
+    writer.integer("dns", this->dns.addr);
+    this->on_pack(writer);
+
+    return writer.finish(length);
+}
+
+//******************************************************************************
+/**
+ * @brief True if the keys hold another configuration than the one loaded.
+ *
+ * Both are packed and compared, the fields of the subclass included.  When
+ * they differ the keys are left loaded.  Missing keys don't count, they
+ * were never written or are gone.
+ */
+bool NetworkConfiguration::keys_differ(KeyStore& store) {
+    size_t loadedLength = 0;
+    size_t keysLength = 0;
+    bool differ = false;
+
+    // Off the stack, load() already holds a blob.
+    uint8_t* loaded = (uint8_t*) malloc(2 * NETWORK_CONFIG_BLOB_SIZE);
+    if (loaded == nullptr) {
+        return false;
+    }
+    uint8_t* keys = loaded + NETWORK_CONFIG_BLOB_SIZE;
+
+    if (this->pack(loaded, NETWORK_CONFIG_BLOB_SIZE, loadedLength) == ESP_OK) {
+        differ = this->load_keys(store) == ESP_OK &&
+            this->pack(keys, NETWORK_CONFIG_BLOB_SIZE, keysLength) == ESP_OK &&
+            (keysLength != loadedLength || memcmp(keys, loaded, loadedLength) != 0);
+        if (!differ) {
+            this->unpack(loaded, loadedLength);
+        }
+    }
+
+    free(loaded);
+    return differ;
+}
+
+//******************************************************************************
+/**
+ * @brief Read the per key layout of older firmware.
+ */
+esp_err_t NetworkConfiguration::load_keys(KeyStore& store) {
+    esp_err_t res;
+
     ESP_GET_VALUE("enabled", this->isEnabled);
     ESP_GET_VALUE("dhcp", this->useDHCP);
     ESP_GET_VALUE("ip", this->ipAddress);
@@ -113,11 +228,53 @@ esp_err_t NetworkConfiguration::load() {
         return res;
     }
 
-    this->isConfigured = true;
+    return ESP_OK;
+}
+
+//******************************************************************************
+/**
+ * @brief Write the per key layout of older firmware next to the blob.
+ *
+ * Kept up to date so going back to older firmware keeps the network, Wi-Fi
+ * credentials included.  To be dropped once no release before the blob is in
+ * the field.
+ */
+esp_err_t NetworkConfiguration::save_keys(KeyStore& store) {
+    esp_err_t res;
+
+    ESP_SET_VALUE("enabled", this->isEnabled, false);
+    ESP_SET_VALUE("dhcp", this->useDHCP, false);
+    ESP_SET_VALUE("ip", this->ipAddress, false);
+    ESP_SET_VALUE("netmask", this->netmask, false);
+    ESP_SET_VALUE("gateway", this->gateway, false);
+    ESP_SET_VALUE("dns", this->dns, false);
+
+    res = this->on_save(store);
+    if (res != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to save extra");
+        return res;
+    }
 
     return ESP_OK;
 }
 
+//******************************************************************************
+void NetworkConfiguration::erase_keys(KeyStore& store) {
+    esp_err_t res;
+
+    ESP_ERASE_KEY("enabled", false);
+    ESP_ERASE_KEY("dhcp", false);
+    ESP_ERASE_KEY("ip", false);
+    ESP_ERASE_KEY("netmask", false);
+    ESP_ERASE_KEY("gateway", false);
+    ESP_ERASE_KEY("dns", false);
+
+    res = this->on_reset_config(store);
+    if (res != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to reset extra");
+    }
+}
+
 //******************************************************************************
 /**
  * @brief Save the ethernet configuration to flash.
@@ -127,23 +284,29 @@ esp_err_t NetworkConfiguration::load() {
 esp_err_t NetworkConfiguration::save() {
     KeyStore store;
     esp_err_t res;
+    uint8_t blob[NETWORK_CONFIG_BLOB_SIZE];
+    size_t length = 0;
 
     if (store.openKeyStore(this->get_store_section_name(), e_rw) != ESP_OK) {
         ESP_LOGE(TAG, "Failed to open eth config store");
         return false;
     }
 
+    res = this->pack(blob, sizeof(blob), length);
+    if (res != ESP_OK) {
+        ESP_LOGE(TAG, "%s config does not fit its blob", this->get_store_section_name());
+        return res;
+    }
+
     // No commit until we are all done.
-    ESP_SET_VALUE("enabled", this->isEnabled, false);
-    ESP_SET_VALUE("dhcp", this->useDHCP, false);
-    ESP_SET_VALUE("ip", this->ipAddress, false);
-    ESP_SET_VALUE("netmask", this->netmask, false);
-    ESP_SET_VALUE("gateway", this->gateway, false);
-    ESP_SET_VALUE("dns", this->dns, false);
+    res = store.setKeyBlob(CONFIG_BLOB_KEY, blob, length, false);
+    if (res != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to save %s config blob", this->get_store_section_name());
+        return res;
+    }
 
-    res = this->on_save(store);
+    res = this->save_keys(store);
     if (res != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to save extra");
         return res;
     }
 
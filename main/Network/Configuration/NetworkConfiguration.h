@@ -5,6 +5,11 @@
 #include "Utils/NoCopy.h"
 
 class KeyStore;
+class ConfigBlobWriter;
+class ConfigBlobReader;
+
+// Room for the blob, wifi credentials included.
+#define NETWORK_CONFIG_BLOB_SIZE (384)
 
 class NetworkConfiguration : public NoCopy{
 public:
@@ -40,6 +45,20 @@ protected:
     virtual esp_err_t on_reset_config(KeyStore& store) { return ESP_OK; };
     virtual esp_err_t on_dump_config(KeyStore& store) { return ESP_OK; };
 
+    // The extra fields in the blob, on_unpack returns false for a field
+    // it doesn't know.
+    virtual uint32_t on_pack_fields(void) { return 0; };
+    virtual void on_pack(ConfigBlobWriter& writer) {};
+    virtual bool on_unpack(const char* field, ConfigBlobReader& reader) { return false; };
+
+private:
+    esp_err_t pack(uint8_t* blob, size_t size, size_t& length);
+    esp_err_t unpack(const uint8_t* blob, size_t length);
+    esp_err_t load_keys(KeyStore& store);
+    esp_err_t save_keys(KeyStore& store);
+    bool keys_differ(KeyStore& store);
+    void erase_keys(KeyStore& store);
+
 protected:
     bool useDHCP = true;
     bool isEnabled = false;
@@ -1,6 +1,7 @@
 #include "WifiConfiguration.h"
 
 #include "Utils/KeyStore.h"
+#include "Utils/ConfigBlob.h"
 
 #include "esp_log.h"
 
@@ -80,7 +81,7 @@ esp_err_t WifiConfiguration::on_load(KeyStore& store) {
 
 //******************************************************************************
 /**
- * @brief Save the ethernet configuration to flash.
+ * @brief Save the credentials in the keys of older firmware.
  * 
  * @return esp_err_t ESP_OK on success.
  */
@@ -91,4 +92,33 @@ esp_err_t WifiConfiguration::on_save(KeyStore& store) {
     ESP_SET_VALUE("password", this->wifi_creds.password, false);
 
     return ESP_OK;    
+}
+
+//******************************************************************************
+/**
+ * @brief Add the credentials to the blob.
+ * 
+ * @param writer 
+ */
+void WifiConfiguration::on_pack(ConfigBlobWriter& writer) {
+    writer.str("ssid", this->wifi_creds.ssid);
+    writer.str("password", this->wifi_creds.password);
+}
+
+//******************************************************************************
+/**
+ * @brief Read the credentials from the blob.
+ * 
+ * @return true   the field is one of ours
+ */
+bool WifiConfiguration::on_unpack(const char* field, ConfigBlobReader& reader) {
+    if (strcmp(field, "ssid") == 0) {
+        reader.read_str(this->wifi_creds.ssid, sizeof(this->wifi_creds.ssid));
+        return true;
+    }
+    if (strcmp(field, "password") == 0) {
+        reader.read_str(this->wifi_creds.password, sizeof(this->wifi_creds.password));
+        return true;
+    }
+    return false;
 }
\ No newline at end of file
@@ -22,6 +22,10 @@ protected:
     virtual esp_err_t on_load(KeyStore& store) override;
     virtual esp_err_t on_save(KeyStore& store) override;
 
+    virtual uint32_t on_pack_fields(void) override { return 2; }
+    virtual void on_pack(ConfigBlobWriter& writer) override;
+    virtual bool on_unpack(const char* field, ConfigBlobReader& reader) override;
+
     virtual esp_err_t on_reset_config(KeyStore& store) override;
     virtual esp_err_t on_dump_config(KeyStore& store) override;
 
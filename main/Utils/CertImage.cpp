@@ -0,0 +1,190 @@
+//******************************************************************************
+/**
+ * @file CertImage.cpp
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief Layout of the certificate partition implementation
+ * @version 0.1
+ * @date 2024-03-07
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#include "CertImage.h"
+#include "ConfigBlob.h"
+
+#include <string.h>
+
+//******************************************************************************
+static int base64_value(char c) {
+    if (c >= 'A' && c <= 'Z') return c - 'A';
+    if (c >= 'a' && c <= 'z') return c - 'a' + 26;
+    if (c >= '0' && c <= '9') return c - '0' + 52;
+    if (c == '+') return 62;
+    if (c == '/') return 63;
+    return -1;
+}
+
+//******************************************************************************
+/**
+ * @return esp_err_t    ESP_ERR_INVALID_ARG not a PEM block,
+ *                      ESP_ERR_INVALID_SIZE der too small.
+ */
+esp_err_t cert_pem_to_der(const char* pem, uint8_t* der, size_t size, size_t& length) {
+    const char* begin = pem != nullptr ? strstr(pem, "-----BEGIN ") : nullptr;
+    const char* p = begin != nullptr ? strchr(begin, '\n') : nullptr;
+    const char* end = p != nullptr ? strstr(p, "-----END ") : nullptr;
+    if (end == nullptr) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    uint32_t bits = 0;
+    int bit_count = 0;
+    bool padded = false;
+    length = 0;
+
+    for (p++; p < end; p++) {
+        if (*p == '\n' || *p == '\r' || *p == ' ' || *p == '\t') {
+            continue;
+        }
+        if (*p == '=') {
+            padded = true;
+            continue;
+        }
+
+        int value = base64_value(*p);
+        if (value < 0 || padded) {
+            return ESP_ERR_INVALID_ARG;
+        }
+
+        bits = (bits << 6) | value;
+        bit_count += 6;
+        if (bit_count >= 8) {
+            bit_count -= 8;
+            if (length == size) {
+                return ESP_ERR_INVALID_SIZE;
+            }
+            der[length++] = (uint8_t)(bits >> bit_count);
+        }
+    }
+
+    return length > 0 ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+//******************************************************************************
+size_t CertImage::get_size(const char* const pem[e_cert_slot_count]) {
+    size_t size = sizeof(cert_image_header_t);
+    for (int i = 0; i < e_cert_slot_count; i++) {
+        if (pem[i] != nullptr) {
+            size += strlen(pem[i]) * 3 / 4 + 3;
+        }
+    }
+    return size;
+}
+
+//******************************************************************************
+/**
+ * @brief The header then the DER of each PEM given.
+ *
+ * @param length    The size of the image.
+ */
+esp_err_t CertImage::build(const char* const pem[e_cert_slot_count], uint8_t* image, size_t size, size_t& length) {
+    cert_image_header_t header = {};
+    size_t pos = sizeof(header);
+
+    if (size < pos) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    for (int i = 0; i < e_cert_slot_count; i++) {
+        if (pem[i] == nullptr) {
+            continue;
+        }
+
+        size_t der_length = 0;
+        esp_err_t ret = cert_pem_to_der(pem[i], image + pos, size - pos, der_length);
+        if (ret != ESP_OK) {
+            return ret;
+        }
+
+        header.entries[i].offset = pos;
+        header.entries[i].length = der_length;
+        header.entries[i].pem_length = strlen(pem[i]) + 1;
+        pos += der_length;
+    }
+
+    header.magic = CERT_IMAGE_MAGIC;
+    header.version = CERT_IMAGE_VERSION;
+    header.count = e_cert_slot_count;
+    header.length = pos;
+    memcpy(image, &header, sizeof(header));
+
+    header.crc = config_blob_crc32(image, pos);
+    memcpy(image + offsetof(cert_image_header_t, crc), &header.crc, sizeof(header.crc));
+
+    length = pos;
+    return ESP_OK;
+}
+
+//******************************************************************************
+esp_err_t CertImage::check(void) const {
+    cert_image_header_t header;
+
+    if (this->image == nullptr || this->size < sizeof(header)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    memcpy(&header, this->image, sizeof(header));
+    if (header.magic == 0xffffffff) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (header.magic != CERT_IMAGE_MAGIC || header.version != CERT_IMAGE_VERSION || header.count != e_cert_slot_count) {
+        return ESP_ERR_INVALID_VERSION;
+    }
+    if (header.length < sizeof(header) || header.length > this->size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    for (int i = 0; i < e_cert_slot_count; i++) {
+        const cert_image_entry_t& entry = header.entries[i];
+        if (entry.length > 0 && (entry.offset < sizeof(header) || entry.offset > header.length ||
+                                 entry.length > header.length - entry.offset)) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+    }
+
+    uint32_t crc = header.crc;
+    header.crc = 0;
+    uint32_t computed = config_blob_crc32((const uint8_t*) &header, sizeof(header));
+    computed = config_blob_crc32(this->image + sizeof(header), header.length - sizeof(header), computed);
+    return crc == computed ? ESP_OK : ESP_ERR_INVALID_CRC;
+}
+
+//******************************************************************************
+esp_err_t CertImage::get(cert_slot_t slot, const uint8_t*& der, size_t& length) const {
+    cert_image_header_t header;
+
+    if (slot >= e_cert_slot_count) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    memcpy(&header, this->image, sizeof(header));
+    if (header.entries[slot].length == 0) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    der = this->image + header.entries[slot].offset;
+    length = header.entries[slot].length;
+    return ESP_OK;
+}
+
+//******************************************************************************
+size_t CertImage::get_pem_length(void) const {
+    cert_image_header_t header;
+    size_t length = 0;
+
+    memcpy(&header, this->image, sizeof(header));
+    for (int i = 0; i < e_cert_slot_count; i++) {
+        length += header.entries[i].pem_length;
+    }
+    return length;
+}
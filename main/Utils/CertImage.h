@@ -0,0 +1,78 @@
+//******************************************************************************
+/**
+ * @file CertImage.h
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief Layout of the certificate partition
+ * @version 0.1
+ * @date 2024-03-07
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#pragma once
+
+#include "esp_err.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CERT_IMAGE_MAGIC    (0x44384e4d)    // "MN8D"
+#define CERT_IMAGE_VERSION  (1)
+
+typedef enum {
+    e_cert_client_certificate,
+    e_cert_private_key,
+    e_cert_public_key,
+    e_cert_slot_count
+} cert_slot_t;
+
+//******************************************************************************
+/**
+ * @brief In front of the DER, little endian.
+ */
+typedef struct __attribute__((packed)) {
+    uint32_t offset;        // from the start of the image
+    uint32_t length;        // 0 when the slot is empty
+    uint32_t pem_length;    // the heap the PEM took, nul included
+} cert_image_entry_t;
+
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t count;
+    uint32_t length;        // of the image, header included
+    uint32_t crc;           // crc32 of the image, this field as 0
+    cert_image_entry_t entries[e_cert_slot_count];
+} cert_image_header_t;
+
+// The DER of the PEM block, the armour lines and whitespace are dropped.
+esp_err_t cert_pem_to_der(const char* pem, uint8_t* der, size_t size, size_t& length);
+
+//******************************************************************************
+/**
+ * @brief The certificates as DER, one after the other behind a header.
+ *
+ * Built in ram once at provisioning, then read in place from the mapped
+ * partition.  TLS takes DER as well as PEM, and DER is a third smaller.
+ */
+class CertImage {
+public:
+    CertImage(const uint8_t* image, size_t size) : image(image), size(size) {}
+    ~CertImage(void) = default;
+
+    // Room needed for these, nullptr for an empty slot.
+    static size_t get_size(const char* const pem[e_cert_slot_count]);
+    static esp_err_t build(const char* const pem[e_cert_slot_count], uint8_t* image, size_t size, size_t& length);
+
+public:
+    // ESP_ERR_NOT_FOUND when erased, ESP_ERR_INVALID_xxx when damaged.
+    esp_err_t check(void) const;
+
+    // After check(), ESP_ERR_NOT_FOUND for an empty slot.
+    esp_err_t get(cert_slot_t slot, const uint8_t*& der, size_t& length) const;
+    size_t get_pem_length(void) const;
+
+private:
+    const uint8_t* image;
+    size_t size;
+};
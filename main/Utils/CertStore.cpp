@@ -0,0 +1,148 @@
+//******************************************************************************
+/**
+ * @file CertStore.cpp
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief CertStore class implementation
+ * @version 0.1
+ * @date 2024-03-07
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#include "CertStore.h"
+
+#include "esp_log.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static const char* TAG = "CertStore";
+
+//******************************************************************************
+CertStore::~CertStore(void) {
+    if (this->mapped != nullptr) {
+        esp_partition_munmap(this->mmap_handle);
+    }
+}
+
+//******************************************************************************
+/**
+ * @return esp_err_t    ESP_ERR_NOT_FOUND if there is no certs partition.
+ */
+esp_err_t CertStore::setup(void) {
+    if (this->partition != nullptr) {
+        return ESP_OK;
+    }
+
+    const esp_partition_t* partition = esp_partition_find_first(
+        ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, CERT_STORE_PARTITION_NAME);
+    if (partition == nullptr) {
+        ESP_LOGW(TAG, "No %s partition, certificates stay in nvs", CERT_STORE_PARTITION_NAME);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    const void* mapped = nullptr;
+    esp_err_t ret = esp_partition_mmap(partition, 0, partition->size, ESP_PARTITION_MMAP_DATA, &mapped, &this->mmap_handle);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to map %s (%s)", CERT_STORE_PARTITION_NAME, esp_err_to_name(ret));
+        return ret;
+    }
+
+    this->partition = partition;
+    this->mapped = (const uint8_t*) mapped;
+
+    ret = CertImage(this->mapped, this->partition->size).check();
+    this->valid = ret == ESP_OK;
+    if (ret != ESP_OK && ret != ESP_ERR_NOT_FOUND) {
+        ESP_LOGE(TAG, "Certificates damaged (%s)", esp_err_to_name(ret));
+    }
+    return ESP_OK;
+}
+
+//******************************************************************************
+/**
+ * @brief Replace what the partition holds with the DER of these PEM.
+ *
+ * The image is built in heap, written, then checked through the mapping.
+ */
+esp_err_t CertStore::store(const char* const pem[e_cert_slot_count]) {
+    esp_err_t ret = ESP_OK;
+    size_t length = 0;
+
+    if (this->partition == nullptr) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    size_t size = CertImage::get_size(pem);
+    if (size > this->partition->size) {
+        ESP_LOGE(TAG, "%d bytes of certificates do not fit %s", size, CERT_STORE_PARTITION_NAME);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    uint8_t* image = (uint8_t*) malloc(size);
+    if (image == nullptr) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    ret = CertImage::build(pem, image, size, length);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Certificates are not PEM (%s)", esp_err_to_name(ret));
+        goto err;
+    }
+
+    this->valid = false;
+    ret = esp_partition_erase_range(this->partition, 0, this->partition->size);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to erase %s (%s)", CERT_STORE_PARTITION_NAME, esp_err_to_name(ret));
+        goto err;
+    }
+
+    ret = esp_partition_write(this->partition, 0, image, length);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to write %s (%s)", CERT_STORE_PARTITION_NAME, esp_err_to_name(ret));
+        goto err;
+    }
+
+    // The cache of the mapping is flushed by the write.
+    if (memcmp(this->mapped, image, length) != 0 || CertImage(this->mapped, this->partition->size).check() != ESP_OK) {
+        ESP_LOGE(TAG, "Certificates read back differ");
+        ret = ESP_FAIL;
+        goto err;
+    }
+
+    this->valid = true;
+    ESP_LOGI(TAG, "%d bytes of certificates written", length);
+
+err:
+    free(image);
+    return ret;
+}
+
+//******************************************************************************
+esp_err_t CertStore::erase(void) {
+    if (this->partition == nullptr) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    this->valid = false;
+    return esp_partition_erase_range(this->partition, 0, this->partition->size);
+}
+
+//******************************************************************************
+/**
+ * @brief Where the DER is in the mapping, valid until store() or erase().
+ */
+esp_err_t CertStore::get(cert_slot_t slot, const uint8_t*& der, size_t& length) const {
+    if (!this->valid) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    return CertImage(this->mapped, this->partition->size).get(slot, der, length);
+}
+
+//******************************************************************************
+size_t CertStore::get_heap_saved(void) const {
+    if (!this->valid) {
+        return 0;
+    }
+    return CertImage(this->mapped, this->partition->size).get_pem_length();
+}
@@ -0,0 +1,62 @@
+//******************************************************************************
+/**
+ * @file CertStore.h
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief CertStore class definition
+ * @version 0.1
+ * @date 2024-03-07
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#pragma once
+
+#include "Utils/Singleton.h"
+#include "Utils/CertImage.h"
+
+#include "esp_err.h"
+#include "esp_partition.h"
+
+#define CERT_STORE_PARTITION_NAME "certs"
+
+//******************************************************************************
+/**
+ * @brief The device certificate and keys, DER in their own partition.
+ *
+ * The partition is mapped read only once; TLS is handed pointers into the
+ * mapping, nothing is copied to ram.  It is written at provisioning only.
+ *
+ * A device updated over the air keeps its old partition table and has no
+ * such partition.  is_available() is then false and the certificates stay
+ * where they were.
+ *
+ * @note Not thread safe, store() and erase() must not run while a
+ *       connection is being made.
+ */
+class CertStore : public Singleton<CertStore> {
+public:
+    CertStore(token) {}
+    ~CertStore(void);
+
+public:
+    // Find and map the partition, once.
+    esp_err_t setup(void);
+
+    inline bool is_available(void) const { return this->partition != nullptr; }
+    inline bool has_certificates(void) const { return this->valid; }
+
+    // nullptr for a slot left empty.
+    esp_err_t store(const char* const pem[e_cert_slot_count]);
+    esp_err_t erase(void);
+
+    esp_err_t get(cert_slot_t slot, const uint8_t*& der, size_t& length) const;
+
+    // What the PEM took in heap when it was kept there.
+    size_t get_heap_saved(void) const;
+
+private:
+    const esp_partition_t* partition = nullptr;
+    const uint8_t* mapped = nullptr;
+    esp_partition_mmap_handle_t mmap_handle = 0;
+    bool valid = false;
+};
@@ -0,0 +1,274 @@
+//******************************************************************************
+/**
+ * @file ConfigBlob.cpp
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief Versioned configuration blob reader and writer implementation
+ * @version 0.1
+ * @date 2024-03-06
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#include "ConfigBlob.h"
+
+#include <atomic>
+
+#include <stdlib.h>
+#include <string.h>
+
+// Key, then the largest value header: an int64 or a str32.
+#define CONFIG_BLOB_FIELD_OVERHEAD  (1 + CONFIG_BLOB_FIELD_MAX_LENGTH + 9)
+
+static std::atomic<uint32_t> generation{0};
+
+//******************************************************************************
+uint32_t config_blob_generation(void) {
+    return generation;
+}
+
+//******************************************************************************
+void config_blob_changed(void) {
+    generation++;
+}
+
+//******************************************************************************
+/**
+ * @brief crc32 (ieee 802.3), a nibble at a time to keep the table small.
+ */
+uint32_t config_blob_crc32(const uint8_t* data, size_t length, uint32_t crc) {
+    static const uint32_t nibbles[16] = {
+        0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac,
+        0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+        0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
+        0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c,
+    };
+
+    crc = ~crc;
+    for (size_t i = 0; i < length; i++) {
+        crc ^= data[i];
+        crc = (crc >> 4) ^ nibbles[crc & 0x0f];
+        crc = (crc >> 4) ^ nibbles[crc & 0x0f];
+    }
+    return ~crc;
+}
+
+//******************************************************************************
+ConfigBlobWriter::ConfigBlobWriter(uint8_t* buffer, size_t size, uint16_t version)
+    : buffer(buffer)
+    , size(size)
+    , version(version)
+    , payload(buffer + CONFIG_BLOB_HEADER_SIZE, size > CONFIG_BLOB_HEADER_SIZE ? size - CONFIG_BLOB_HEADER_SIZE : 0)
+{
+}
+
+//******************************************************************************
+size_t ConfigBlobWriter::get_size(uint32_t field_count, size_t strings_length) {
+    return CONFIG_BLOB_HEADER_SIZE + 5 + field_count * CONFIG_BLOB_FIELD_OVERHEAD + strings_length;
+}
+
+//******************************************************************************
+void ConfigBlobWriter::begin(uint32_t field_count) {
+    this->payload.map(field_count);
+}
+
+//******************************************************************************
+void ConfigBlobWriter::str(const char* name, const char* value) {
+    this->payload.str(name);
+    if (value == nullptr) {
+        this->payload.nil();
+    } else {
+        this->payload.str(value);
+    }
+}
+
+//******************************************************************************
+void ConfigBlobWriter::integer(const char* name, int64_t value) {
+    this->payload.str(name);
+    this->payload.integer(value);
+}
+
+//******************************************************************************
+void ConfigBlobWriter::boolean(const char* name, bool value) {
+    this->payload.str(name);
+    this->payload.boolean(value);
+}
+
+//******************************************************************************
+/**
+ * @return esp_err_t    ESP_ERR_INVALID_SIZE if the buffer was too small.
+ */
+esp_err_t ConfigBlobWriter::finish(size_t& length) {
+    if (!this->payload.ok() || this->size < CONFIG_BLOB_HEADER_SIZE) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    config_blob_header_t header = {};
+    header.magic = CONFIG_BLOB_MAGIC;
+    header.version = this->version;
+    header.length = this->payload.length();
+    header.crc = config_blob_crc32(this->buffer + CONFIG_BLOB_HEADER_SIZE, this->payload.length());
+    memcpy(this->buffer, &header, sizeof(header));
+
+    length = CONFIG_BLOB_HEADER_SIZE + this->payload.length();
+    return ESP_OK;
+}
+
+//******************************************************************************
+/**
+ * @return esp_err_t    ESP_ERR_INVALID_SIZE truncated, ESP_ERR_INVALID_CRC
+ *                      corrupted, ESP_ERR_INVALID_VERSION not a blob or one
+ *                      written by newer firmware.
+ */
+esp_err_t ConfigBlobReader::open(const uint8_t* blob, size_t length, uint16_t max_version) {
+    config_blob_header_t header;
+
+    this->error = ESP_ERR_INVALID_SIZE;
+    if (blob == nullptr || length < CONFIG_BLOB_HEADER_SIZE) {
+        return this->error;
+    }
+
+    memcpy(&header, blob, sizeof(header));
+    const uint8_t* data = blob + CONFIG_BLOB_HEADER_SIZE;
+    if (header.magic != CONFIG_BLOB_MAGIC || header.version == 0 || header.version > max_version) {
+        this->error = ESP_ERR_INVALID_VERSION;
+    } else if (header.length != length - CONFIG_BLOB_HEADER_SIZE) {
+        this->error = ESP_ERR_INVALID_SIZE;
+    } else if (header.crc != config_blob_crc32(data, header.length)) {
+        this->error = ESP_ERR_INVALID_CRC;
+    } else {
+        this->payload = MsgPackReader(data, header.length);
+        this->version = header.version;
+        this->error = this->payload.read_map(&this->remaining) ? ESP_OK : ESP_ERR_INVALID_RESPONSE;
+    }
+    return this->error;
+}
+
+//******************************************************************************
+bool ConfigBlobReader::next_field(char* name, size_t size) {
+    const char* key;
+    size_t length;
+
+    if (this->error != ESP_OK || this->remaining == 0) {
+        return false;
+    }
+
+    if (!this->payload.read_str(&key, &length) || length >= size) {
+        this->error = ESP_ERR_INVALID_RESPONSE;
+        return false;
+    }
+
+    memcpy(name, key, length);
+    name[length] = '\0';
+    this->remaining--;
+    return true;
+}
+
+//******************************************************************************
+void ConfigBlobReader::read_str(char*& value) {
+    const char* data;
+    size_t length;
+
+    if (this->error != ESP_OK) {
+        return;
+    }
+
+    if (this->payload.read_nil()) {
+        free(value);
+        value = nullptr;
+        return;
+    }
+
+    if (!this->payload.read_str(&data, &length)) {
+        this->error = ESP_ERR_INVALID_RESPONSE;
+        return;
+    }
+
+    char* copy = (char*) malloc(length + 1);
+    if (copy == nullptr) {
+        this->error = ESP_ERR_NO_MEM;
+        return;
+    }
+    memcpy(copy, data, length);
+    copy[length] = '\0';
+
+    free(value);
+    value = copy;
+}
+
+//******************************************************************************
+void ConfigBlobReader::read_str(char* value, size_t size) {
+    const char* data;
+    size_t length = 0;
+
+    if (this->error != ESP_OK) {
+        return;
+    }
+
+    if (!this->payload.read_nil()) {
+        if (!this->payload.read_str(&data, &length)) {
+            this->error = ESP_ERR_INVALID_RESPONSE;
+            return;
+        }
+        if (length >= size) {
+            this->error = ESP_ERR_INVALID_SIZE;
+            return;
+        }
+        memcpy(value, data, length);
+    }
+    value[length] = '\0';
+}
+
+//******************************************************************************
+bool ConfigBlobReader::read_int(int64_t& value, int64_t max) {
+    if (this->error != ESP_OK) {
+        return false;
+    }
+
+    if (!this->payload.read_int(&value) || value < 0 || value > max) {
+        this->error = ESP_ERR_INVALID_RESPONSE;
+        return false;
+    }
+    return true;
+}
+
+//******************************************************************************
+void ConfigBlobReader::read_u8(uint8_t& value) {
+    int64_t raw;
+    if (this->read_int(raw, UINT8_MAX)) {
+        value = (uint8_t) raw;
+    }
+}
+
+//******************************************************************************
+void ConfigBlobReader::read_u32(uint32_t& value) {
+    int64_t raw;
+    if (this->read_int(raw, UINT32_MAX)) {
+        value = (uint32_t) raw;
+    }
+}
+
+//******************************************************************************
+void ConfigBlobReader::read_bool(bool& value) {
+    if (this->error == ESP_OK && !this->payload.read_bool(&value)) {
+        this->error = ESP_ERR_INVALID_RESPONSE;
+    }
+}
+
+//******************************************************************************
+void ConfigBlobReader::skip(void) {
+    if (this->error == ESP_OK && !this->payload.skip()) {
+        this->error = ESP_ERR_INVALID_RESPONSE;
+    }
+}
+
+//******************************************************************************
+/**
+ * @return esp_err_t    The first error, ESP_ERR_INVALID_RESPONSE if fields
+ *                      were left unread or bytes follow the last one.
+ */
+esp_err_t ConfigBlobReader::finish(void) {
+    if (this->error == ESP_OK && (this->remaining != 0 || !this->payload.at_end())) {
+        this->error = ESP_ERR_INVALID_RESPONSE;
+    }
+    return this->error;
+}
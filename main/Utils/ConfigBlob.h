@@ -0,0 +1,135 @@
+//******************************************************************************
+/**
+ * @file ConfigBlob.h
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief Versioned configuration blob reader and writer
+ * @version 0.1
+ * @date 2024-03-06
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#pragma once
+
+#include "Utils/MsgPack.h"
+
+#include "esp_err.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// The key the blob is stored under, in the section of the configuration.
+//
+// Firmware before the blob only reads one key per field.  Those keys are
+// still written with the blob and only a reset erases them, so an older image
+// flashed through /update boots with its configuration.  What changes while
+// it runs only goes to the keys: back on this firmware, keys that differ from
+// the blob win and the blob is written again from them.
+#define CONFIG_BLOB_KEY                 "blob"
+
+#define CONFIG_BLOB_MAGIC               (0x43384e4d)    // "MN8C"
+#define CONFIG_BLOB_FIELD_MAX_LENGTH    (15)            // same as a nvs key
+
+//******************************************************************************
+/**
+ * @brief In front of the payload, little endian.
+ */
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint16_t version;       // of the payload layout, per configuration
+    uint16_t reserved;
+    uint32_t length;        // of the payload
+    uint32_t crc;           // crc32 of the payload
+} config_blob_header_t;
+
+#define CONFIG_BLOB_HEADER_SIZE         (sizeof(config_blob_header_t))
+
+// crc is the crc of the data before, to compute it piecewise.
+uint32_t config_blob_crc32(const uint8_t* data, size_t length, uint32_t crc = 0);
+
+// Bumped by the save() and reset() of every configuration, whichever task or
+// instance.  What is built from a configuration (udp responses, the group
+// topic) is stale once it moved.
+uint32_t config_blob_generation(void);
+void config_blob_changed(void);
+
+// A string of the blob against its key, nullptr and "" are the same.
+inline bool config_blob_same_str(const char* a, const char* b) {
+    return strcmp(a != nullptr ? a : "", b != nullptr ? b : "") == 0;
+}
+
+//******************************************************************************
+/**
+ * @brief Write a configuration as one blob.
+ *
+ * The payload is a MessagePack map of named fields, a nullptr string is
+ * written as nil.  A field added later is skipped by older firmware, the
+ * version is only bumped when a field changes meaning.
+ *
+ * Writes past the end of the buffer are flagged, finish() reports them.
+ */
+class ConfigBlobWriter {
+public:
+    ConfigBlobWriter(uint8_t* buffer, size_t size, uint16_t version);
+    ~ConfigBlobWriter(void) = default;
+
+    // Room needed for field_count fields holding strings_length bytes.
+    static size_t get_size(uint32_t field_count, size_t strings_length);
+
+public:
+    void begin(uint32_t field_count);
+    void str(const char* name, const char* value);
+    void integer(const char* name, int64_t value);
+    void boolean(const char* name, bool value);
+
+    // The header is filled in, length is the size of the blob.
+    esp_err_t finish(size_t& length);
+
+private:
+    uint8_t* buffer;
+    size_t size;
+    uint16_t version;
+    MsgPackWriter payload;
+};
+
+//******************************************************************************
+/**
+ * @brief Read a configuration blob in place.
+ *
+ * Every field is read with one of the read calls or skipped.  A value of
+ * the wrong type is an error; the first error sticks, the reads after it
+ * do nothing and finish() returns it.
+ */
+class ConfigBlobReader {
+public:
+    ConfigBlobReader(void) : payload(nullptr, 0) {}
+    ~ConfigBlobReader(void) = default;
+
+public:
+    // Magic, length and crc checked, a version above max_version refused.
+    esp_err_t open(const uint8_t* blob, size_t length, uint16_t max_version);
+    inline uint16_t get_version(void) const { return this->version; }
+
+    // The name of the next field, false once they were all read.
+    bool next_field(char* name, size_t size);
+
+    // The previous value is freed, nil reads as nullptr.
+    void read_str(char*& value);
+    // nil reads as an empty string.
+    void read_str(char* value, size_t size);
+    void read_u8(uint8_t& value);
+    void read_u32(uint32_t& value);
+    void read_bool(bool& value);
+    void skip(void);
+
+    esp_err_t finish(void);
+
+private:
+    bool read_int(int64_t& value, int64_t max);
+
+    MsgPackReader payload;
+    uint16_t version = 0;
+    uint32_t remaining = 0;
+    esp_err_t error = ESP_ERR_INVALID_STATE;
+};
@@ -27,6 +27,9 @@ protected:
     virtual esp_err_t on_resume(void) { return ESP_OK; }
     virtual esp_err_t on_suspend(void) { return ESP_OK; }
 
+    // nullptr until started.
+    inline TaskHandle_t get_task_handle(void) const { return this->task_handle; }
+
 private:
     TaskHandle_t task_handle = nullptr;
     uint32_t stack_size;
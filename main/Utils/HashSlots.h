@@ -0,0 +1,101 @@
+//******************************************************************************
+/**
+ * @file HashSlots.h
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief HashSlots class definition
+ * @version 0.1
+ * @date 2024-02-28
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#pragma once
+
+#include <ctype.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+//******************************************************************************
+/**
+ * @brief FNV-1a hash of a name, not null terminated.
+ *
+ * Names coming from coreMQTT or a datagram are not null terminated, so we
+ * always hash with an explicit length.
+ */
+inline uint32_t fnv1a_hash(const char* data, size_t length) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        h ^= (uint8_t) data[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+//******************************************************************************
+/**
+ * @brief Same, "GET-INFO" and "get-info" hash the same.
+ */
+inline uint32_t fnv1a_hash_nocase(const char* data, size_t length) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        h ^= (uint8_t) tolower((uint8_t) data[i]);
+        h *= 16777619u;
+    }
+    return h;
+}
+
+//******************************************************************************
+/**
+ * @brief Open addressing table of small indexes, linear probing.
+ *
+ * The names and their hashes stay with the owner (MqttTopics, CommandTable),
+ * the slots only hold indexes into them.  Sized for a handful of names
+ * known at boot: never more names than slots, no removal, clear() and
+ * insert again to change one.
+ *
+ * @tparam SLOTS    A power of 2, larger than the number of names.
+ */
+template<size_t SLOTS>
+class HashSlots {
+    static_assert((SLOTS & (SLOTS - 1)) == 0, "SLOTS must be a power of 2");
+
+public:
+    HashSlots(void) { this->clear(); }
+
+    inline void clear(void) { memset(this->slots, 0xFF, sizeof(this->slots)); }
+
+    // Never full, there are more slots than names.
+    void insert(uint32_t hash, int index) {
+        uint32_t slot = hash & (SLOTS - 1);
+        while (this->slots[slot] >= 0) {
+            slot = (slot + 1) & (SLOTS - 1);
+        }
+        this->slots[slot] = (int8_t) index;
+    }
+
+    /**
+     * @brief Index of the name with this hash for which matches(index) is true.
+     *
+     * @return int  -1 if none.
+     */
+    template<typename Matches>
+    int find(uint32_t hash, Matches matches) const {
+        uint32_t slot = hash & (SLOTS - 1);
+
+        for (size_t probe = 0; probe < SLOTS; probe++) {
+            int index = this->slots[slot];
+            if (index < 0) {
+                return -1;
+            }
+            if (matches(index)) {
+                return index;
+            }
+            slot = (slot + 1) & (SLOTS - 1);
+        }
+        return -1;
+    }
+
+private:
+    int8_t slots[SLOTS];
+};
@@ -0,0 +1,159 @@
+//******************************************************************************
+/**
+ * @file HeatshrinkDecoder.cpp
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief HeatshrinkDecoder class implementation
+ * @version 0.1
+ * @date 2024-02-29
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#include "HeatshrinkDecoder.h"
+
+#include <string.h>
+
+//******************************************************************************
+/**
+ * @brief Check the header of a compressed image.
+ *
+ * @return ESP_ERR_NOT_FOUND        Not a compressed image.
+ */
+esp_err_t fw_image_parse_header(const uint8_t* data, size_t length, fw_image_header_t* header) {
+    if (length < FW_IMAGE_MAGIC_LENGTH || memcmp(data, FW_IMAGE_MAGIC, FW_IMAGE_MAGIC_LENGTH) != 0) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    if (length < FW_IMAGE_HEADER_LENGTH) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    if (data[4] != FW_IMAGE_VERSION) {
+        return ESP_ERR_INVALID_VERSION;
+    }
+
+    header->window_bits = data[5];
+    header->lookahead_bits = data[6];
+    header->image_size = (uint32_t) data[8] | (uint32_t) data[9] << 8 | (uint32_t) data[10] << 16 | (uint32_t) data[11] << 24;
+    return ESP_OK;
+}
+
+//******************************************************************************
+esp_err_t HeatshrinkDecoder::reset(uint8_t window_bits, uint8_t lookahead_bits) {
+    if (window_bits < HEATSHRINK_MIN_WINDOW_BITS || window_bits > HEATSHRINK_MAX_WINDOW_BITS ||
+        lookahead_bits < HEATSHRINK_MIN_LOOKAHEAD_BITS || lookahead_bits >= window_bits) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    this->window_bits = window_bits;
+    this->lookahead_bits = lookahead_bits;
+    this->window_mask = (uint16_t)((1 << window_bits) - 1);
+    this->head = 0;
+    memset(this->window, 0, sizeof(this->window));
+
+    this->state = e_heatshrink_tag;
+    this->bit_buffer = 0;
+    this->bit_count = 0;
+    this->index = 0;
+    this->count = 0;
+    this->op_bits = 0;
+    this->op_ones = 0;
+    return ESP_OK;
+}
+
+//******************************************************************************
+/**
+ * @brief Pull count bits, most significant first.
+ *
+ * @return false    Not enough input yet, the bits read are kept.
+ */
+bool HeatshrinkDecoder::get_bits(uint8_t count, uint16_t& value, const uint8_t* in, size_t in_length, size_t& consumed) {
+    while (this->bit_count < count) {
+        if (consumed == in_length) {
+            return false;
+        }
+        this->bit_buffer = (this->bit_buffer << 8) | in[consumed++];
+        this->bit_count += 8;
+    }
+
+    this->bit_count -= count;
+    value = (uint16_t)((this->bit_buffer >> this->bit_count) & ((1u << count) - 1));
+    this->op_bits += count;
+    this->op_ones |= value;
+    return true;
+}
+
+//******************************************************************************
+/**
+ * @brief Decode what fits.
+ *
+ * @param consumed  Out, the input bytes taken, all of them unless out filled.
+ * @return size_t   The bytes written to out.
+ */
+size_t HeatshrinkDecoder::decode(const uint8_t* in, size_t in_length, size_t& consumed, uint8_t* out, size_t out_size) {
+    size_t produced = 0;
+    uint16_t value;
+    consumed = 0;
+
+    while (true) {
+        switch (this->state) {
+            case e_heatshrink_tag:
+                this->op_bits = 0;
+                this->op_ones = 0;
+                if (produced == out_size || !this->get_bits(1, value, in, in_length, consumed)) {
+                    return produced;
+                }
+                this->state = value ? e_heatshrink_literal : e_heatshrink_index;
+                break;
+
+            case e_heatshrink_literal:
+                if (!this->get_bits(8, value, in, in_length, consumed)) {
+                    return produced;
+                }
+                this->window[this->head++ & this->window_mask] = (uint8_t) value;
+                out[produced++] = (uint8_t) value;
+                this->state = e_heatshrink_tag;
+                break;
+
+            case e_heatshrink_index:
+                if (!this->get_bits(this->window_bits, value, in, in_length, consumed)) {
+                    return produced;
+                }
+                this->index = value + 1;
+                this->state = e_heatshrink_count;
+                break;
+
+            case e_heatshrink_count:
+                if (!this->get_bits(this->lookahead_bits, value, in, in_length, consumed)) {
+                    return produced;
+                }
+                this->count = value + 1;
+                this->state = e_heatshrink_copy;
+                break;
+
+            case e_heatshrink_copy:
+                while (this->count > 0) {
+                    if (produced == out_size) {
+                        return produced;
+                    }
+                    uint8_t byte = this->window[(this->head - this->index) & this->window_mask];
+                    this->window[this->head++ & this->window_mask] = byte;
+                    out[produced++] = byte;
+                    this->count--;
+                }
+                this->state = e_heatshrink_tag;
+                break;
+        }
+    }
+}
+
+//******************************************************************************
+bool HeatshrinkDecoder::is_finished(void) const {
+    // The encoder pads the last byte with zeros, less than a whole byte, they
+    // may have been read as the start of a back reference.
+    if (this->state == e_heatshrink_literal || this->state == e_heatshrink_copy) {
+        return false;
+    }
+    return this->op_bits + this->bit_count < 8 && this->op_ones == 0 &&
+        (this->bit_buffer & ((1u << this->bit_count) - 1)) == 0;
+}
@@ -0,0 +1,104 @@
+//******************************************************************************
+/**
+ * @file HeatshrinkDecoder.h
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief HeatshrinkDecoder class definition
+ * @version 0.1
+ * @date 2024-02-29
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#pragma once
+
+#include "Utils/NoCopy.h"
+
+#include "esp_err.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The window is the only memory the decoder needs, 2^window_bits bytes.
+#define HEATSHRINK_MIN_WINDOW_BITS      (4)
+#define HEATSHRINK_MAX_WINDOW_BITS      (12)
+#define HEATSHRINK_MIN_LOOKAHEAD_BITS   (3)
+
+//******************************************************************************
+/**
+ * @brief Compressed firmware image, the header and a heatshrink stream.
+ *
+ * All little endian.  A plain ESP image starts with 0xE9, never with the
+ * magic.
+ */
+#define FW_IMAGE_MAGIC              "MN8H"
+#define FW_IMAGE_MAGIC_LENGTH       (4)
+#define FW_IMAGE_VERSION            (1)
+#define FW_IMAGE_HEADER_LENGTH      (12)
+
+typedef struct {
+    uint8_t window_bits;
+    uint8_t lookahead_bits;
+    uint32_t image_size;            // once decompressed
+} fw_image_header_t;
+
+esp_err_t fw_image_parse_header(const uint8_t* data, size_t length, fw_image_header_t* header);
+
+//******************************************************************************
+/**
+ * @brief Streaming heatshrink (LZSS) decoder.
+ *
+ * Same bit stream as the heatshrink library, most significant bit first:
+ *
+ *     1 <8 bits literal>
+ *     0 <window_bits index> <lookahead_bits count>
+ *
+ * a back reference copies count + 1 bytes from index + 1 bytes back.
+ *
+ * Input is taken as it comes, output is handed out in pieces as large as
+ * the caller's buffer.  A back reference cut by the end of the output buffer
+ * carries on at the next call.
+ */
+class HeatshrinkDecoder : public NoCopy {
+public:
+    HeatshrinkDecoder(void) = default;
+    ~HeatshrinkDecoder(void) = default;
+
+public:
+    esp_err_t reset(uint8_t window_bits, uint8_t lookahead_bits);
+
+    size_t decode(const uint8_t* in, size_t in_length, size_t& consumed, uint8_t* out, size_t out_size);
+
+    // Nothing left but the padding of the last byte.
+    bool is_finished(void) const;
+
+private:
+    bool get_bits(uint8_t count, uint16_t& value, const uint8_t* in, size_t in_length, size_t& consumed);
+
+    typedef enum {
+        e_heatshrink_tag,
+        e_heatshrink_literal,
+        e_heatshrink_index,
+        e_heatshrink_count,
+        e_heatshrink_copy,
+    } heatshrink_state_t;
+
+private:
+    uint8_t window[1 << HEATSHRINK_MAX_WINDOW_BITS];
+    uint16_t window_mask = 0;
+    uint16_t head = 0;
+
+    uint8_t window_bits = 0;
+    uint8_t lookahead_bits = 0;
+
+    heatshrink_state_t state = e_heatshrink_tag;
+    uint32_t bit_buffer = 0;
+    uint8_t bit_count = 0;
+
+    uint16_t index = 0;
+    uint16_t count = 0;
+
+    // Read since the last complete literal or back reference, to tell the
+    // padding from a cut stream.
+    uint8_t op_bits = 0;
+    uint16_t op_ones = 0;
+};
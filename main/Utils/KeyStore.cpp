@@ -1,12 +1,26 @@
 #include "KeyStore.h"
+#include "Utils/FreeRTOSTask.h"
 
 #include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
 
 #include <memory.h>
+#include <string.h>
 
 static const char *TAG = "KeyStore";
 static const char *KEYSTORE_NAME = "storage";
 
+// Below the app tasks, the flush is never urgent.
+#define KEYSTORE_FLUSH_TASK_STACK_SIZE  3584
+#define KEYSTORE_FLUSH_TASK_PRIORITY    1
+#define KEYSTORE_FLUSH_TASK_CORE_NUM    0
+#define KEYSTORE_FLUSH_TASK_NAME        "keystore"
+
 #define NVS_CALL_WITH_ERROR_CHECK(call) \
     err = call; \
     if (err != ESP_OK) { \
@@ -14,6 +28,157 @@ static const char *KEYSTORE_NAME = "storage";
         return err; \
     }
 
+//******************************************************************************
+/**
+ * @brief The nvs calls on the storage partition.
+ */
+class NvsFlashBackend : public KeyStoreBackend {
+public:
+    esp_err_t init(void) override { return nvs_flash_init_partition(KEYSTORE_NAME); }
+    esp_err_t erase_all(void) override { return nvs_flash_erase_partition(KEYSTORE_NAME); }
+
+    esp_err_t open(const char* name, nvs_handle_t& handle) override {
+        // Passing NVS_READWRITE will create the section
+        return nvs_open_from_partition(KEYSTORE_NAME, name, NVS_READWRITE, &handle);
+    }
+    void close(nvs_handle_t handle) override { nvs_close(handle); }
+
+    esp_err_t get(nvs_handle_t handle, const char* key, keystore_type_t type, void* value, size_t& length) override {
+        switch (type) {
+        case e_keystore_u8:
+            length = sizeof(uint8_t);
+            return value == nullptr ? ESP_OK : nvs_get_u8(handle, key, (uint8_t*) value);
+        case e_keystore_u16:
+            length = sizeof(uint16_t);
+            return value == nullptr ? ESP_OK : nvs_get_u16(handle, key, (uint16_t*) value);
+        case e_keystore_u32:
+            length = sizeof(uint32_t);
+            return value == nullptr ? ESP_OK : nvs_get_u32(handle, key, (uint32_t*) value);
+        case e_keystore_str:
+            return nvs_get_str(handle, key, (char*) value, &length);
+        case e_keystore_blob:
+            return nvs_get_blob(handle, key, value, &length);
+        default:
+            return ESP_ERR_INVALID_ARG;
+        }
+    }
+
+    esp_err_t set(nvs_handle_t handle, const char* key, keystore_type_t type, const void* value, size_t length) override {
+        switch (type) {
+        case e_keystore_u8:   return nvs_set_u8(handle, key, *(const uint8_t*) value);
+        case e_keystore_u16:  return nvs_set_u16(handle, key, *(const uint16_t*) value);
+        case e_keystore_u32:  return nvs_set_u32(handle, key, *(const uint32_t*) value);
+        case e_keystore_str:  return nvs_set_str(handle, key, (const char*) value);
+        case e_keystore_blob: return nvs_set_blob(handle, key, value, length);
+        default:              return ESP_ERR_INVALID_ARG;
+        }
+    }
+
+    esp_err_t erase(nvs_handle_t handle, const char* key) override { return nvs_erase_key(handle, key); }
+    esp_err_t commit(nvs_handle_t handle) override { return nvs_commit(handle); }
+};
+
+//******************************************************************************
+/**
+ * @brief The cache shared by the KeyStore instances.
+ *
+ * Each write notifies a low priority task.  It flushes the cache once no
+ * write came for KEYSTORE_CACHE_QUIET_MS.  A commit can erase a flash page,
+ * tens to hundreds of ms, so it is never done from the esp_timer task where
+ * it would hold up every other timer.  It is flushed again on esp_restart().
+ */
+class KeyStoreService : public FreeRTOSTask {
+public:
+    KeyStoreService(void) : FreeRTOSTask(
+        KEYSTORE_FLUSH_TASK_STACK_SIZE,
+        KEYSTORE_FLUSH_TASK_PRIORITY,
+        KEYSTORE_FLUSH_TASK_CORE_NUM
+    ), cache(backend) {
+        this->mutex = xSemaphoreCreateMutex();
+
+        this->start();
+        if (this->get_task_handle() == nullptr) {
+            ESP_LOGE(TAG, "Failed to start the flush task, writes are committed as they come");
+        }
+
+        esp_register_shutdown_handler(&KeyStoreService::sOn_shutdown);
+    }
+
+    static KeyStoreService& instance(void) {
+        static KeyStoreService service;
+        return service;
+    }
+
+    inline void lock(void) { xSemaphoreTake(this->mutex, portMAX_DELAY); }
+    inline void unlock(void) { xSemaphoreGive(this->mutex); }
+
+    inline KeyStoreCache& get_cache(void) { return this->cache; }
+    inline uint32_t now_ms(void) const { return (uint32_t)(esp_timer_get_time() / 1000); }
+
+    // Called with the lock held.
+    esp_err_t schedule_flush(void) {
+        if (this->get_task_handle() == nullptr) {
+            return this->cache.flush();
+        }
+        xTaskNotifyGive(this->get_task_handle());
+        return ESP_OK;
+    }
+
+    esp_err_t flush(void) {
+        this->lock();
+        esp_err_t ret = this->cache.flush();
+        this->unlock();
+        return ret;
+    }
+
+protected:
+    virtual const char* task_name(void) override { return KEYSTORE_FLUSH_TASK_NAME; }
+
+    virtual void taskFunction(void) override {
+        while (1) {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+            // Wait for the writes to stop, each one restarts the wait.
+            while (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(KEYSTORE_CACHE_QUIET_MS)) != 0) {
+            }
+
+            if (this->flush() != ESP_OK) {
+                ESP_LOGE(TAG, "Failed to flush the key store");
+            }
+        }
+    }
+
+    static void sOn_shutdown(void) { KeyStoreService::instance().flush(); }
+
+private:
+    NvsFlashBackend backend;
+    KeyStoreCache cache;
+    SemaphoreHandle_t mutex = nullptr;
+};
+
+//******************************************************************************
+static esp_err_t cache_get(int section, const char *keyName, keystore_type_t type, void *value, size_t& length)
+{
+    KeyStoreService& service = KeyStoreService::instance();
+    service.lock();
+    esp_err_t ret = service.get_cache().get(section, keyName, type, value, length);
+    service.unlock();
+    return ret;
+}
+
+//******************************************************************************
+static esp_err_t cache_set(int section, const char *keyName, keystore_type_t type, const void *value, size_t length)
+{
+    KeyStoreService& service = KeyStoreService::instance();
+    service.lock();
+    esp_err_t ret = service.get_cache().set(section, keyName, type, value, length, service.now_ms());
+    if (ret == ESP_OK) {
+        ret = service.schedule_flush();
+    }
+    service.unlock();
+    return ret;
+}
+
 //******************************************************************************
 KeyStore::KeyStore()
 {
@@ -22,57 +187,58 @@ KeyStore::KeyStore()
 //******************************************************************************
 KeyStore::~KeyStore()
 {
-    if (0 != this->handle) {
-        nvs_close(this->handle);
-    }
 }
 
 //******************************************************************************
 esp_err_t KeyStore::erasePartition(void) {
-    return nvs_flash_erase_partition(KEYSTORE_NAME);
+    KeyStoreService& service = KeyStoreService::instance();
+    service.lock();
+    esp_err_t ret = service.get_cache().erase_all();
+    service.unlock();
+
+    this->section = -1;
+    return ret;
 }
 
 //******************************************************************************
+/**
+ * @brief Use the section, it is opened the first time.
+ *
+ * @param ksMode    Kept for the callers, sections are opened read write.
+ */
 esp_err_t KeyStore::openKeyStore(const char *sectionName, e_keyStoreMode ksMode)
 {
-    esp_err_t err = ESP_OK;
-    
-    if (0 != this->handle) {
-        nvs_close(this->handle);
-        this->handle = 0;
-    }
-
-    nvs_handle handle;
-    nvs_open_mode_t mode = ksMode == e_rw ? NVS_READWRITE : NVS_READONLY;
+    KeyStoreService& service = KeyStoreService::instance();
+    service.lock();
+    esp_err_t ret = service.get_cache().open(sectionName, this->section);
+    service.unlock();
 
-    NVS_CALL_WITH_ERROR_CHECK(nvs_flash_init_partition(KEYSTORE_NAME));
-    err = nvs_open_from_partition(KEYSTORE_NAME, sectionName, mode, &handle);
-    if (err == ESP_ERR_NVS_NOT_FOUND) {
-        // Passing NVS_READWRITE will create the partition
-        ESP_LOGI(TAG, "Creating key store partition %s", sectionName);
-        err = nvs_open_from_partition(KEYSTORE_NAME, sectionName, NVS_READWRITE, &handle);
-    }
-
-    if (err != ESP_OK) {
+    if (ret != ESP_OK) {
         ESP_LOGE(TAG, "Failed to open key store");
-        return err;
+        this->section = -1;
+        return ret;
     }
 
-    this->handle = handle;
     return ESP_OK;
 }
 
+//******************************************************************************
+esp_err_t KeyStore::flush(void)
+{
+    return KeyStoreService::instance().flush();
+}
+
 //******************************************************************************
 esp_err_t KeyStore::getKeyValueAlloc(const char *keyName, char *&value, size_t& valueLength)
 {
     esp_err_t err = ESP_OK;
     size_t valueSize = 0;
 
-    NVS_CALL_WITH_ERROR_CHECK(nvs_get_str(this->handle, keyName, NULL, &valueSize));
+    NVS_CALL_WITH_ERROR_CHECK(cache_get(this->section, keyName, e_keystore_str, NULL, valueSize));
 
     value = (char*)malloc(valueSize+1);
     memset(value, 0, valueSize+1);
-    NVS_CALL_WITH_ERROR_CHECK(nvs_get_str(handle, keyName, value, &valueSize));
+    NVS_CALL_WITH_ERROR_CHECK(cache_get(this->section, keyName, e_keystore_str, value, valueSize));
 
     valueLength = valueSize;
 
@@ -85,14 +251,14 @@ esp_err_t KeyStore::getKeyValue(const char *keyName, char *value, size_t maxValu
     esp_err_t err = ESP_OK;
     size_t valueSize = 0;
 
-    NVS_CALL_WITH_ERROR_CHECK(nvs_get_str(this->handle, keyName, NULL, &valueSize));
+    NVS_CALL_WITH_ERROR_CHECK(cache_get(this->section, keyName, e_keystore_str, NULL, valueSize));
 
     if (valueSize > maxValueLength) {
         ESP_LOGE(TAG, "%s: value size %d is larger than max value length %d", keyName, valueSize, maxValueLength);
         return ESP_ERR_NVS_INVALID_LENGTH;
     }
 
-    NVS_CALL_WITH_ERROR_CHECK(nvs_get_str(handle, keyName, value, &valueSize));
+    NVS_CALL_WITH_ERROR_CHECK(cache_get(this->section, keyName, e_keystore_str, value, valueSize));
 
     return ESP_OK;
 }
@@ -101,8 +267,70 @@ esp_err_t KeyStore::getKeyValue(const char *keyName, char *value, size_t maxValu
 esp_err_t KeyStore::setKeyValue(const char *keyName, const char *value, bool commit)
 {
     esp_err_t err = ESP_OK;
-    NVS_CALL_WITH_ERROR_CHECK(nvs_set_str(this->handle, keyName, value));
-    if (commit) { this->commit(); }
+    NVS_CALL_WITH_ERROR_CHECK(cache_set(this->section, keyName, e_keystore_str, value, strlen(value) + 1));
+
+    return ESP_OK;
+}
+
+//******************************************************************************
+/**
+ * @brief Read a blob.
+ *
+ * @param valueLength   In, the size of value.  Out, the size of the blob.
+ */
+esp_err_t KeyStore::getKeyBlob(const char *keyName, void *value, size_t &valueLength)
+{
+    esp_err_t err = ESP_OK;
+    size_t valueSize = 0;
+
+    NVS_CALL_WITH_ERROR_CHECK(cache_get(this->section, keyName, e_keystore_blob, NULL, valueSize));
+
+    if (valueSize > valueLength) {
+        ESP_LOGE(TAG, "%s: blob size %d is larger than max value length %d", keyName, valueSize, valueLength);
+        return ESP_ERR_NVS_INVALID_LENGTH;
+    }
+
+    NVS_CALL_WITH_ERROR_CHECK(cache_get(this->section, keyName, e_keystore_blob, value, valueSize));
+    valueLength = valueSize;
+
+    return ESP_OK;
+}
+
+//******************************************************************************
+/**
+ * @brief Read a blob into a buffer allocated to fit, the caller frees it.
+ */
+esp_err_t KeyStore::getKeyBlobAlloc(const char *keyName, uint8_t *&value, size_t &valueLength)
+{
+    esp_err_t err = ESP_OK;
+    size_t valueSize = 0;
+
+    value = nullptr;
+    NVS_CALL_WITH_ERROR_CHECK(cache_get(this->section, keyName, e_keystore_blob, NULL, valueSize));
+
+    value = (uint8_t*)malloc(valueSize);
+    if (value == nullptr) {
+        ESP_LOGE(TAG, "%s: no memory for a %d bytes blob", keyName, valueSize);
+        return ESP_ERR_NO_MEM;
+    }
+
+    err = cache_get(this->section, keyName, e_keystore_blob, value, valueSize);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "%s: %s", keyName, esp_err_to_name(err));
+        free(value);
+        value = nullptr;
+        return err;
+    }
+
+    valueLength = valueSize;
+    return ESP_OK;
+}
+
+//******************************************************************************
+esp_err_t KeyStore::setKeyBlob(const char *keyName, const void *value, size_t valueLength, bool commit)
+{
+    esp_err_t err = ESP_OK;
+    NVS_CALL_WITH_ERROR_CHECK(cache_set(this->section, keyName, e_keystore_blob, value, valueLength));
 
     return ESP_OK;
 }
@@ -111,7 +339,8 @@ esp_err_t KeyStore::setKeyValue(const char *keyName, const char *value, bool com
 esp_err_t KeyStore::getKeyValue(const char *keyName, esp_ip4_addr_t &value)
 {
     esp_err_t err = ESP_OK;
-    NVS_CALL_WITH_ERROR_CHECK(nvs_get_u32(handle, keyName, &value.addr));
+    size_t length = sizeof(value.addr);
+    NVS_CALL_WITH_ERROR_CHECK(cache_get(this->section, keyName, e_keystore_u32, &value.addr, length));
     return ESP_OK;
 }
 
@@ -119,8 +348,7 @@ esp_err_t KeyStore::getKeyValue(const char *keyName, esp_ip4_addr_t &value)
 esp_err_t KeyStore::setKeyValue(const char *keyName, esp_ip4_addr_t &value, bool commit)
 {
     esp_err_t err = ESP_OK;
-    NVS_CALL_WITH_ERROR_CHECK(nvs_set_u32(this->handle, keyName, value.addr));
-    if (commit) { this->commit(); }
+    NVS_CALL_WITH_ERROR_CHECK(cache_set(this->section, keyName, e_keystore_u32, &value.addr, sizeof(value.addr)));
     return ESP_OK;
 }
 
@@ -129,7 +357,8 @@ esp_err_t KeyStore::setKeyValue(const char *keyName, esp_ip4_addr_t &value, bool
 esp_err_t KeyStore::getKeyValue(const char *keyName, uint16_t &value)
 {
     esp_err_t err = ESP_OK;
-    NVS_CALL_WITH_ERROR_CHECK(nvs_get_u16(handle, keyName, &value));
+    size_t length = sizeof(value);
+    NVS_CALL_WITH_ERROR_CHECK(cache_get(this->section, keyName, e_keystore_u16, &value, length));
     return ESP_OK;
 }
 
@@ -137,7 +366,8 @@ esp_err_t KeyStore::getKeyValue(const char *keyName, uint16_t &value)
 esp_err_t KeyStore::getKeyValue(const char *keyName, uint8_t &value)
 {
     esp_err_t err = ESP_OK;
-    NVS_CALL_WITH_ERROR_CHECK(nvs_get_u8(handle, keyName, &value));
+    size_t length = sizeof(value);
+    NVS_CALL_WITH_ERROR_CHECK(cache_get(this->section, keyName, e_keystore_u8, &value, length));
     return ESP_OK;
 }
 
@@ -145,8 +375,7 @@ esp_err_t KeyStore::getKeyValue(const char *keyName, uint8_t &value)
 esp_err_t KeyStore::setKeyValue(const char *keyName, uint16_t value, bool commit)
 {
     esp_err_t err = ESP_OK;
-    NVS_CALL_WITH_ERROR_CHECK(nvs_set_u16(this->handle, keyName, value));
-    if (commit) { this->commit(); }
+    NVS_CALL_WITH_ERROR_CHECK(cache_set(this->section, keyName, e_keystore_u16, &value, sizeof(value)));
     return ESP_OK;
 }
 
@@ -154,8 +383,7 @@ esp_err_t KeyStore::setKeyValue(const char *keyName, uint16_t value, bool commit
 esp_err_t KeyStore::setKeyValue(const char *keyName, uint8_t value, bool commit)
 {
     esp_err_t err = ESP_OK;
-    NVS_CALL_WITH_ERROR_CHECK(nvs_set_u8(this->handle, keyName, value));
-    if (commit) { this->commit(); }
+    NVS_CALL_WITH_ERROR_CHECK(cache_set(this->section, keyName, e_keystore_u8, &value, sizeof(value)));
     return ESP_OK;
 }
 
@@ -211,16 +439,29 @@ esp_err_t KeyStore::setKeyValue(const char *keyName, wifi_auth_mode_t value, boo
 esp_err_t KeyStore::eraseKey(const char *keyName, bool commit)
 {
     esp_err_t err = ESP_OK;
-    NVS_CALL_WITH_ERROR_CHECK(nvs_erase_key(this->handle, keyName));
-    
-    if (commit) { return this->commit(); }
-    return ESP_OK;
+    KeyStoreService& service = KeyStoreService::instance();
+    service.lock();
+    err = service.get_cache().erase(this->section, keyName, service.now_ms());
+    if (err == ESP_OK) {
+        err = service.schedule_flush();
+    }
+    service.unlock();
+
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "%s: failed to erase (%s)", keyName, esp_err_to_name(err));
+    }
+    return err;
 }
 
 //******************************************************************************
+/**
+ * @brief The pending writes are committed once the writes stop.
+ */
 esp_err_t KeyStore::commit(void)
 {
-    esp_err_t err = ESP_OK;
-    NVS_CALL_WITH_ERROR_CHECK(nvs_commit(this->handle));
-    return ESP_OK;
+    KeyStoreService& service = KeyStoreService::instance();
+    service.lock();
+    esp_err_t ret = service.schedule_flush();
+    service.unlock();
+    return ret;
 }
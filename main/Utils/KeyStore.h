@@ -1,6 +1,7 @@
 #pragma once
 
 #include "Utils/NoCopy.h"
+#include "Utils/KeyStoreCache.h"
 
 #include "esp_wifi_types.h"
 #include "nvs_flash.h"
@@ -23,7 +24,13 @@ typedef enum {
  * It is used to store and retrieve key/value pairs.
  * The key/value pairs are stored in flash.
  * 
- * This class is not thread safe.  Be careful when using it.
+ * The instances share one KeyStoreCache: a section is opened once and
+ * stays open, so a KeyStore on the stack costs nothing.  Writes are kept
+ * in ram and committed together once nothing was written for
+ * KEYSTORE_CACHE_QUIET_MS, or on flush().  The commit arguments are kept
+ * for the callers, a commit only starts that wait.  esp_restart() flushes.
+ * 
+ * Thread safe, a KeyStore itself is used by one task.
  */
 class KeyStore : public NoCopy {
 public:
@@ -40,6 +47,8 @@ public:
     esp_err_t getKeyValue(const char *keyName, bool &value);
     esp_err_t getKeyValue(const char *keyName, wifi_mode_t &value);
     esp_err_t getKeyValue(const char *keyName, wifi_auth_mode_t &value);
+    esp_err_t getKeyBlob(const char *keyName, void *value, size_t &valueLength);
+    esp_err_t getKeyBlobAlloc(const char *keyName, uint8_t *&value, size_t &valueLength);
 
     esp_err_t setKeyValue(const char *keyName, const char *value, bool commit = true);
     esp_err_t setKeyValue(const char *keyName, esp_ip4_addr_t &value, bool commit = true);
@@ -48,13 +57,17 @@ public:
     esp_err_t setKeyValue(const char *keyName, bool value, bool commit = true);
     esp_err_t setKeyValue(const char *keyName, wifi_mode_t value, bool commit = true);
     esp_err_t setKeyValue(const char *keyName, wifi_auth_mode_t value, bool commit = true);
+    esp_err_t setKeyBlob(const char *keyName, const void *value, size_t valueLength, bool commit = true);
 
     esp_err_t eraseKey(const char *keyName, bool commit = true);
     esp_err_t erasePartition(void);
 
     esp_err_t commit(void);
 
+    // Write and commit the pending values now.
+    static esp_err_t flush(void);
+
 protected:
 private:
-    nvs_handle handle = 0;
+    int section = -1;
 };
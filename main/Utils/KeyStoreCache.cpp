@@ -0,0 +1,261 @@
+//******************************************************************************
+/**
+ * @file KeyStoreCache.cpp
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief KeyStoreCache class implementation
+ * @version 0.1
+ * @date 2024-03-05
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#include "KeyStoreCache.h"
+
+#include "esp_log.h"
+
+#include <string.h>
+
+static const char* TAG = "keystore_cache";
+
+//******************************************************************************
+/**
+ * @brief Index of the namespace, opened on first use.
+ *
+ * @return esp_err_t    ESP_ERR_NO_MEM when KEYSTORE_CACHE_MAX_NAMESPACES
+ *                      are open already, the backend errors.
+ */
+esp_err_t KeyStoreCache::open(const char* name, int& ns) {
+    esp_err_t ret = ESP_OK;
+
+    if (name == nullptr || strlen(name) > KEYSTORE_NAMESPACE_MAX_LENGTH) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (!this->initialized) {
+        ret = this->backend.init();
+        if (ret != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to init the key store (0x%x)", ret);
+            return ret;
+        }
+        this->initialized = true;
+    }
+
+    for (int i = 0; i < this->namespace_count; i++) {
+        if (strcmp(this->namespaces[i].name, name) == 0) {
+            ns = i;
+            return ESP_OK;
+        }
+    }
+
+    if (this->namespace_count == KEYSTORE_CACHE_MAX_NAMESPACES) {
+        ESP_LOGE(TAG, "No room to open %s", name);
+        return ESP_ERR_NO_MEM;
+    }
+
+    namespace_t& entry = this->namespaces[this->namespace_count];
+    ret = this->backend.open(name, entry.handle);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to open %s (0x%x)", name, ret);
+        return ret;
+    }
+
+    strcpy(entry.name, name);
+    entry.dirty = false;
+    ns = this->namespace_count++;
+    return ESP_OK;
+}
+
+//******************************************************************************
+/**
+ * @brief Read a value, the pending one if there is one.
+ *
+ * @param value     nullptr to get the length only.
+ * @param length    In, the size of value.  Out, the length of the value.
+ */
+esp_err_t KeyStoreCache::get(int ns, const char* key, keystore_type_t type, void* value, size_t& length) {
+    if (ns < 0 || ns >= this->namespace_count) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    const pending_t* pending = this->find_pending(ns, key);
+    if (pending == nullptr) {
+        return this->backend.get(this->namespaces[ns].handle, key, type, value, length);
+    }
+
+    if (pending->type != type) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    if (value != nullptr) {
+        if (length < pending->length) {
+            return ESP_ERR_NVS_INVALID_LENGTH;
+        }
+        memcpy(value, pending->value, pending->length);
+    }
+    length = pending->length;
+    return ESP_OK;
+}
+
+//******************************************************************************
+/**
+ * @brief Keep the value until the next flush.
+ *
+ * A value too long to be kept is written now, committed at the next flush.
+ */
+esp_err_t KeyStoreCache::set(int ns, const char* key, keystore_type_t type, const void* value, size_t length, uint32_t now_ms) {
+    esp_err_t ret = ESP_OK;
+
+    if (ns < 0 || ns >= this->namespace_count || strlen(key) > KEYSTORE_KEY_MAX_LENGTH) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    this->last_write_ms = now_ms;
+    pending_t* pending = this->find_pending(ns, key);
+
+    if (length > KEYSTORE_CACHE_VALUE_MAX_LENGTH) {
+        // The older pending write would land on top of this one.
+        if (pending != nullptr) {
+            *pending = this->pending[--this->pending_count];
+        }
+
+        ret = this->backend.set(this->namespaces[ns].handle, key, type, value, length);
+        if (ret == ESP_OK) {
+            this->namespaces[ns].dirty = true;
+        }
+        return ret;
+    }
+
+    if (pending == nullptr) {
+        if (this->pending_count == KEYSTORE_CACHE_MAX_PENDING) {
+            ret = this->flush();
+            if (ret != ESP_OK) {
+                return ret;
+            }
+        }
+        pending = &this->pending[this->pending_count++];
+        pending->ns = ns;
+        strcpy(pending->key, key);
+    }
+
+    pending->type = type;
+    pending->length = length;
+    memcpy(pending->value, value, length);
+    return ESP_OK;
+}
+
+//******************************************************************************
+esp_err_t KeyStoreCache::erase(int ns, const char* key, uint32_t now_ms) {
+    return this->set(ns, key, e_keystore_erased, nullptr, 0, now_ms);
+}
+
+//******************************************************************************
+/**
+ * @brief Write the pending values and commit the namespaces written to.
+ *
+ * A value that fails to be written is dropped, the others are still
+ * written.
+ *
+ * @return esp_err_t    The first error.
+ */
+esp_err_t KeyStoreCache::flush(void) {
+    esp_err_t ret = ESP_OK;
+
+    for (int i = 0; i < this->pending_count; i++) {
+        esp_err_t err = this->write(this->pending[i]);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to write %s (0x%x)", this->pending[i].key, err);
+            if (ret == ESP_OK) {
+                ret = err;
+            }
+        }
+    }
+    this->pending_count = 0;
+
+    esp_err_t err = this->commit();
+    return ret != ESP_OK ? ret : err;
+}
+
+//******************************************************************************
+/**
+ * @brief Flush once nothing was written for KEYSTORE_CACHE_QUIET_MS.
+ */
+esp_err_t KeyStoreCache::flush_if_quiet(uint32_t now_ms) {
+    if (now_ms - this->last_write_ms < KEYSTORE_CACHE_QUIET_MS) {
+        return ESP_OK;
+    }
+    return this->flush();
+}
+
+//******************************************************************************
+esp_err_t KeyStoreCache::erase_all(void) {
+    this->pending_count = 0;
+    for (int i = 0; i < this->namespace_count; i++) {
+        this->backend.close(this->namespaces[i].handle);
+    }
+    this->namespace_count = 0;
+    this->initialized = false;
+
+    return this->backend.erase_all();
+}
+
+//******************************************************************************
+KeyStoreCache::pending_t* KeyStoreCache::find_pending(int ns, const char* key) {
+    for (int i = 0; i < this->pending_count; i++) {
+        if (this->pending[i].ns == ns && strcmp(this->pending[i].key, key) == 0) {
+            return &this->pending[i];
+        }
+    }
+    return nullptr;
+}
+
+//******************************************************************************
+/**
+ * @brief Write one pending value, unless flash has it already.
+ */
+esp_err_t KeyStoreCache::write(const pending_t& pending) {
+    esp_err_t ret = ESP_OK;
+    namespace_t& entry = this->namespaces[pending.ns];
+
+    if (pending.type == e_keystore_erased) {
+        ret = this->backend.erase(entry.handle, pending.key);
+        if (ret == ESP_ERR_NVS_NOT_FOUND) {
+            return ESP_OK;
+        }
+    } else {
+        uint8_t stored[KEYSTORE_CACHE_VALUE_MAX_LENGTH];
+        size_t stored_length = sizeof(stored);
+        if (this->backend.get(entry.handle, pending.key, pending.type, stored, stored_length) == ESP_OK &&
+            stored_length == pending.length && memcmp(stored, pending.value, pending.length) == 0
+        ) {
+            return ESP_OK;
+        }
+        ret = this->backend.set(entry.handle, pending.key, pending.type, pending.value, pending.length);
+    }
+
+    if (ret == ESP_OK) {
+        entry.dirty = true;
+    }
+    return ret;
+}
+
+//******************************************************************************
+esp_err_t KeyStoreCache::commit(void) {
+    esp_err_t ret = ESP_OK;
+    bool committed = false;
+
+    for (int i = 0; i < this->namespace_count; i++) {
+        if (!this->namespaces[i].dirty) {
+            continue;
+        }
+        esp_err_t err = this->backend.commit(this->namespaces[i].handle);
+        if (err != ESP_OK && ret == ESP_OK) {
+            ret = err;
+        }
+        this->namespaces[i].dirty = false;
+        committed = true;
+    }
+
+    if (committed) {
+        this->flushes++;
+    }
+    return ret;
+}
@@ -0,0 +1,132 @@
+//******************************************************************************
+/**
+ * @file KeyStoreCache.h
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief KeyStoreCache class definition
+ * @version 0.1
+ * @date 2024-03-05
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#pragma once
+
+#include "Utils/NoCopy.h"
+
+#include "esp_err.h"
+#include "nvs.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define KEYSTORE_CACHE_MAX_NAMESPACES   (8)
+#define KEYSTORE_CACHE_MAX_PENDING      (24)
+
+// Longer strings and blobs are written through, certificates and the like
+// are written once anyway.
+#define KEYSTORE_CACHE_VALUE_MAX_LENGTH (96)
+
+// Writes are committed once nothing was written for this long.
+#define KEYSTORE_CACHE_QUIET_MS         (500)
+
+// Same limits as nvs.
+#define KEYSTORE_NAMESPACE_MAX_LENGTH   (15)
+#define KEYSTORE_KEY_MAX_LENGTH         (15)
+
+typedef enum {
+    e_keystore_u8,
+    e_keystore_u16,
+    e_keystore_u32,
+    e_keystore_str,     // length counts the terminating nul, as nvs does
+    e_keystore_blob,
+    e_keystore_erased,  // pending only, the key is to be erased
+} keystore_type_t;
+
+//******************************************************************************
+/**
+ * @brief The nvs calls, a mock on the host counts them.
+ */
+class KeyStoreBackend {
+public:
+    virtual ~KeyStoreBackend(void) = default;
+
+    virtual esp_err_t init(void) = 0;
+    virtual esp_err_t erase_all(void) = 0;
+
+    // Read write, the namespace is created if needed.
+    virtual esp_err_t open(const char* name, nvs_handle_t& handle) = 0;
+    virtual void close(nvs_handle_t handle) = 0;
+
+    // value nullptr, length is set to the size of the value.
+    virtual esp_err_t get(nvs_handle_t handle, const char* key, keystore_type_t type, void* value, size_t& length) = 0;
+    virtual esp_err_t set(nvs_handle_t handle, const char* key, keystore_type_t type, const void* value, size_t length) = 0;
+    virtual esp_err_t erase(nvs_handle_t handle, const char* key) = 0;
+    virtual esp_err_t commit(nvs_handle_t handle) = 0;
+};
+
+//******************************************************************************
+/**
+ * @brief Open namespaces and the writes not committed yet.
+ *
+ * A namespace is opened once and kept open.  A write is kept in ram until
+ * flush(), a key written again meanwhile costs nothing more.  At flush a
+ * value equal to the one in flash is not written again, each namespace
+ * written to is committed once.  Reads see the pending writes.
+ *
+ * Time is passed in so this can be tested on the host.
+ *
+ * @note Not thread safe, KeyStore locks around it.
+ */
+class KeyStoreCache : public NoCopy {
+public:
+    KeyStoreCache(KeyStoreBackend& backend) : backend(backend) {}
+    ~KeyStoreCache(void) = default;
+
+public:
+    // The namespace, by index, opened if it wasn't already.
+    esp_err_t open(const char* name, int& ns);
+
+    esp_err_t get(int ns, const char* key, keystore_type_t type, void* value, size_t& length);
+    esp_err_t set(int ns, const char* key, keystore_type_t type, const void* value, size_t length, uint32_t now_ms);
+    esp_err_t erase(int ns, const char* key, uint32_t now_ms);
+
+    esp_err_t flush(void);
+    esp_err_t flush_if_quiet(uint32_t now_ms);
+
+    // Pending writes are dropped, the namespaces are closed.
+    esp_err_t erase_all(void);
+
+    inline int get_pending(void) const { return this->pending_count; }
+    inline uint32_t get_flushes(void) const { return this->flushes; }
+
+private:
+    typedef struct {
+        char name[KEYSTORE_NAMESPACE_MAX_LENGTH + 1];
+        nvs_handle_t handle;
+        bool dirty;                 // written to since the last commit
+    } namespace_t;
+
+    typedef struct {
+        int ns;
+        char key[KEYSTORE_KEY_MAX_LENGTH + 1];
+        keystore_type_t type;
+        size_t length;
+        uint8_t value[KEYSTORE_CACHE_VALUE_MAX_LENGTH];
+    } pending_t;
+
+    pending_t* find_pending(int ns, const char* key);
+    esp_err_t write(const pending_t& pending);
+    esp_err_t commit(void);
+
+private:
+    KeyStoreBackend& backend;
+    bool initialized = false;
+
+    namespace_t namespaces[KEYSTORE_CACHE_MAX_NAMESPACES] = {};
+    int namespace_count = 0;
+
+    pending_t pending[KEYSTORE_CACHE_MAX_PENDING];
+    int pending_count = 0;
+    uint32_t last_write_ms = 0;
+    uint32_t flushes = 0;
+};
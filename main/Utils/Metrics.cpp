@@ -0,0 +1,140 @@
+//******************************************************************************
+/**
+ * @file Metrics.cpp
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief MetricHistogram and MetricsWriter class implementation
+ * @version 0.1
+ * @date 2024-03-04
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#include "Metrics.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+//******************************************************************************
+MetricHistogram::MetricHistogram(const uint32_t* bounds, uint8_t bound_count)
+    : bounds(bounds)
+    , bound_count(bound_count < METRIC_HISTOGRAM_MAX_BUCKETS ? bound_count : METRIC_HISTOGRAM_MAX_BUCKETS)
+{
+}
+
+//******************************************************************************
+void MetricHistogram::observe(uint32_t value) {
+    uint8_t bucket = 0;
+    while (bucket < this->bound_count && value > this->bounds[bucket]) {
+        bucket++;
+    }
+
+    this->buckets[bucket]++;
+    this->sum += value;
+    this->count++;
+}
+
+//******************************************************************************
+void MetricsWriter::family(const char* name, const char* type, const char* help) {
+    this->printf("# HELP %s %s\n", name, help);
+    this->printf("# TYPE %s %s\n", name, type);
+}
+
+//******************************************************************************
+void MetricsWriter::sample(const char* name, const char* labels, uint64_t value) {
+    if (labels == nullptr || labels[0] == '\0') {
+        this->printf("%s %llu\n", name, (unsigned long long) value);
+    } else {
+        this->printf("%s{%s} %llu\n", name, labels, (unsigned long long) value);
+    }
+}
+
+//******************************************************************************
+/**
+ * @brief The cumulative buckets, then the sum and the count.
+ */
+void MetricsWriter::histogram(const char* name, const char* labels, const MetricHistogram& histogram) {
+    const char* separator = labels == nullptr || labels[0] == '\0' ? "" : ",";
+    if (labels == nullptr) {
+        labels = "";
+    }
+
+    uint32_t cumulative = 0;
+    for (uint8_t bucket = 0; bucket < histogram.get_bound_count(); bucket++) {
+        cumulative += histogram.get_bucket(bucket);
+        this->printf("%s_bucket{%s%sle=\"%lu\"} %lu\n", name, labels, separator,
+            (unsigned long) histogram.get_bound(bucket), (unsigned long) cumulative);
+    }
+    cumulative += histogram.get_bucket(histogram.get_bound_count());
+    this->printf("%s_bucket{%s%sle=\"+Inf\"} %lu\n", name, labels, separator, (unsigned long) cumulative);
+
+    if (labels[0] == '\0') {
+        this->printf("%s_sum %llu\n", name, (unsigned long long) histogram.get_sum());
+        this->printf("%s_count %lu\n", name, (unsigned long) cumulative);
+    } else {
+        this->printf("%s_sum{%s} %llu\n", name, labels, (unsigned long long) histogram.get_sum());
+        this->printf("%s_count{%s} %lu\n", name, labels, (unsigned long) cumulative);
+    }
+}
+
+//******************************************************************************
+/**
+ * @brief Send what is left in the buffer.
+ *
+ * @return esp_err_t    The first error, ESP_ERR_INVALID_SIZE for a line
+ *                      longer than the buffer, the flush errors.
+ */
+esp_err_t MetricsWriter::finish(void) {
+    if (this->error == ESP_OK && this->length > 0) {
+        this->error = this->flush_buffer();
+    }
+    return this->error;
+}
+
+//******************************************************************************
+/**
+ * @brief Format a line in place, flush and format again if it didn't fit.
+ */
+void MetricsWriter::printf(const char* format, ...) {
+    if (this->error != ESP_OK) {
+        return;
+    }
+
+    for (int pass = 0; pass < 2; pass++) {
+        size_t room = this->size - this->length;
+
+        va_list args;
+        va_start(args, format);
+        int written = vsnprintf(this->buffer + this->length, room, format, args);
+        va_end(args);
+
+        if (written < 0) {
+            this->error = ESP_FAIL;
+            return;
+        }
+        if ((size_t) written < room) {
+            this->length += written;
+            this->total += written;
+            return;
+        }
+
+        // Doesn't fit even in an empty buffer.
+        if (this->length == 0) {
+            break;
+        }
+
+        this->error = this->flush_buffer();
+        if (this->error != ESP_OK) {
+            return;
+        }
+    }
+
+    this->error = ESP_ERR_INVALID_SIZE;
+}
+
+//******************************************************************************
+esp_err_t MetricsWriter::flush_buffer(void) {
+    esp_err_t ret = this->flush(this->buffer, this->length, this->context);
+    this->length = 0;
+    return ret;
+}
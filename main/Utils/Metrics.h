@@ -0,0 +1,102 @@
+//******************************************************************************
+/**
+ * @file Metrics.h
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief MetricHistogram and MetricsWriter class definition
+ * @version 0.1
+ * @date 2024-03-04
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#pragma once
+
+#include "Utils/NoCopy.h"
+
+#include "esp_err.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define METRIC_HISTOGRAM_MAX_BUCKETS    (12)
+
+// Longest metric line, name, labels and value.
+#define METRICS_LINE_MAX_LENGTH         (160)
+
+//******************************************************************************
+/**
+ * @brief Counts of observed values per bucket, plus their sum.
+ *
+ * The bounds are inclusive upper bounds, in increasing order, the last
+ * bucket (+Inf) is implied.  Observed from one task, read from another:
+ * a read may be one observation behind, never torn on 32 bits.
+ */
+class MetricHistogram : public NoCopy {
+public:
+    MetricHistogram(const uint32_t* bounds, uint8_t bound_count);
+    ~MetricHistogram(void) = default;
+
+public:
+    void observe(uint32_t value);
+
+    inline uint8_t get_bound_count(void) const { return this->bound_count; }
+    inline uint32_t get_bound(uint8_t bucket) const { return this->bounds[bucket]; }
+    inline uint32_t get_bucket(uint8_t bucket) const { return this->buckets[bucket]; }   // not cumulative
+    inline uint32_t get_count(void) const { return this->count; }
+    inline uint64_t get_sum(void) const { return this->sum; }
+
+private:
+    const uint32_t* bounds;
+    uint8_t bound_count;
+    uint32_t buckets[METRIC_HISTOGRAM_MAX_BUCKETS + 1] = {};
+    uint32_t count = 0;
+    uint64_t sum = 0;
+};
+
+//******************************************************************************
+/**
+ * @brief Writes metrics in the prometheus text format to a fixed buffer.
+ *
+ *     # HELP mn8_heap_free_bytes Free heap.
+ *     # TYPE mn8_heap_free_bytes gauge
+ *     mn8_heap_free_bytes 81236
+ *     mn8_led_frames_total{strip="0",result="rendered"} 1523
+ *
+ * The buffer is handed to flush whenever the next line doesn't fit, so a
+ * response of any size goes out in chunks without allocating.  The first
+ * error is kept, the calls after it do nothing, finish() returns it.
+ */
+class MetricsWriter : public NoCopy {
+public:
+    // Send length bytes, ESP_OK to carry on.
+    typedef esp_err_t (*flush_fn)(const char* data, size_t length, void* context);
+
+    MetricsWriter(char* buffer, size_t size, flush_fn flush, void* context)
+        : buffer(buffer), size(size), flush(flush), context(context) {}
+    ~MetricsWriter(void) = default;
+
+public:
+    void family(const char* name, const char* type, const char* help);
+
+    // labels without the braces, nullptr or "" for none.
+    void sample(const char* name, const char* labels, uint64_t value);
+    void histogram(const char* name, const char* labels, const MetricHistogram& histogram);
+
+    esp_err_t finish(void);
+
+    inline size_t get_total_length(void) const { return this->total; }
+
+private:
+    void printf(const char* format, ...) __attribute__((format(printf, 2, 3)));
+    esp_err_t flush_buffer(void);
+
+private:
+    char* buffer;
+    size_t size;
+    flush_fn flush;
+    void* context;
+
+    size_t length = 0;
+    size_t total = 0;
+    esp_err_t error = ESP_OK;
+};
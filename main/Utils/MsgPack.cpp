@@ -0,0 +1,402 @@
+//******************************************************************************
+/**
+ * @file MsgPack.cpp
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief Minimal MessagePack reader and writer implementation
+ * @version 0.1
+ * @date 2024-02-09
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#include "MsgPack.h"
+
+#include <string.h>
+
+//******************************************************************************
+void MsgPackWriter::put(uint8_t value) {
+    if (this->pos >= this->size) {
+        this->overflow = true;
+        return;
+    }
+    this->buffer[this->pos++] = value;
+}
+
+//******************************************************************************
+void MsgPackWriter::put(const void* data, size_t length) {
+    if (length > this->size - this->pos) {
+        this->overflow = true;
+        this->pos = this->size;
+        return;
+    }
+    memcpy(this->buffer + this->pos, data, length);
+    this->pos += length;
+}
+
+//******************************************************************************
+void MsgPackWriter::put_be(uint64_t value, int bytes) {
+    for (int i = bytes - 1; i >= 0; i--) {
+        this->put((uint8_t)(value >> (i * 8)));
+    }
+}
+
+//******************************************************************************
+void MsgPackWriter::map(uint32_t count) {
+    if (count < 16) {
+        this->put(0x80 | count);
+    } else if (count <= 0xFFFF) {
+        this->put(0xde);
+        this->put_be(count, 2);
+    } else {
+        this->put(0xdf);
+        this->put_be(count, 4);
+    }
+}
+
+//******************************************************************************
+void MsgPackWriter::array(uint32_t count) {
+    if (count < 16) {
+        this->put(0x90 | count);
+    } else if (count <= 0xFFFF) {
+        this->put(0xdc);
+        this->put_be(count, 2);
+    } else {
+        this->put(0xdd);
+        this->put_be(count, 4);
+    }
+}
+
+//******************************************************************************
+void MsgPackWriter::str(const char* value) {
+    this->str(value, value == nullptr ? 0 : strlen(value));
+}
+
+//******************************************************************************
+void MsgPackWriter::str(const char* value, size_t length) {
+    if (length < 32) {
+        this->put(0xa0 | length);
+    } else if (length <= 0xFF) {
+        this->put(0xd9);
+        this->put_be(length, 1);
+    } else if (length <= 0xFFFF) {
+        this->put(0xda);
+        this->put_be(length, 2);
+    } else {
+        this->put(0xdb);
+        this->put_be(length, 4);
+    }
+    this->put(value, length);
+}
+
+//******************************************************************************
+void MsgPackWriter::boolean(bool value) {
+    this->put(value ? 0xc3 : 0xc2);
+}
+
+//******************************************************************************
+void MsgPackWriter::nil(void) {
+    this->put(0xc0);
+}
+
+//******************************************************************************
+/**
+ * @brief Write an integer in the smallest encoding that holds it.
+ */
+void MsgPackWriter::integer(int64_t value) {
+    if (value >= 0) {
+        if (value < 128) {
+            this->put((uint8_t) value);
+        } else if (value <= 0xFF) {
+            this->put(0xcc);
+            this->put_be(value, 1);
+        } else if (value <= 0xFFFF) {
+            this->put(0xcd);
+            this->put_be(value, 2);
+        } else if (value <= 0xFFFFFFFFLL) {
+            this->put(0xce);
+            this->put_be(value, 4);
+        } else {
+            this->put(0xcf);
+            this->put_be(value, 8);
+        }
+    } else {
+        if (value >= -32) {
+            this->put((uint8_t)(int8_t) value);
+        } else if (value >= INT8_MIN) {
+            this->put(0xd0);
+            this->put_be((uint64_t) value, 1);
+        } else if (value >= INT16_MIN) {
+            this->put(0xd1);
+            this->put_be((uint64_t) value, 2);
+        } else if (value >= INT32_MIN) {
+            this->put(0xd2);
+            this->put_be((uint64_t) value, 4);
+        } else {
+            this->put(0xd3);
+            this->put_be((uint64_t) value, 8);
+        }
+    }
+}
+
+//******************************************************************************
+bool MsgPackReader::take(size_t bytes, const uint8_t** data) {
+    if ((size_t)(this->end - this->p) < bytes) {
+        return false;
+    }
+    if (data != nullptr) {
+        *data = this->p;
+    }
+    this->p += bytes;
+    return true;
+}
+
+//******************************************************************************
+bool MsgPackReader::read_be(int bytes, uint64_t* value) {
+    const uint8_t* data;
+    if (!this->take(bytes, &data)) {
+        return false;
+    }
+
+    *value = 0;
+    for (int i = 0; i < bytes; i++) {
+        *value = (*value << 8) | data[i];
+    }
+    return true;
+}
+
+//******************************************************************************
+bool MsgPackReader::next_is_map(void) const {
+    if (this->at_end()) {
+        return false;
+    }
+    uint8_t type = *this->p;
+    return (type & 0xf0) == 0x80 || type == 0xde || type == 0xdf;
+}
+
+//******************************************************************************
+bool MsgPackReader::next_is_str(void) const {
+    if (this->at_end()) {
+        return false;
+    }
+    uint8_t type = *this->p;
+    return (type & 0xe0) == 0xa0 || type == 0xd9 || type == 0xda || type == 0xdb;
+}
+
+//******************************************************************************
+bool MsgPackReader::next_is_int(void) const {
+    if (this->at_end()) {
+        return false;
+    }
+    uint8_t type = *this->p;
+    return type < 0x80 || type >= 0xe0 || (type >= 0xca && type <= 0xd3);
+}
+
+//******************************************************************************
+bool MsgPackReader::next_is_bool(void) const {
+    return !this->at_end() && (*this->p == 0xc2 || *this->p == 0xc3);
+}
+
+//******************************************************************************
+bool MsgPackReader::read_map(uint32_t* count) {
+    uint64_t value;
+    if (this->at_end()) {
+        return false;
+    }
+
+    uint8_t type = *this->p++;
+    if ((type & 0xf0) == 0x80) {
+        *count = type & 0x0f;
+        return true;
+    }
+
+    if (type == 0xde || type == 0xdf) {
+        if (!this->read_be(type == 0xde ? 2 : 4, &value)) {
+            return false;
+        }
+        *count = (uint32_t) value;
+        return true;
+    }
+
+    return false;
+}
+
+//******************************************************************************
+bool MsgPackReader::read_str(const char** value, size_t* length) {
+    uint64_t size;
+    const uint8_t* data;
+    if (this->at_end()) {
+        return false;
+    }
+
+    uint8_t type = *this->p++;
+    if ((type & 0xe0) == 0xa0) {
+        size = type & 0x1f;
+    } else if (type >= 0xd9 && type <= 0xdb) {
+        if (!this->read_be(1 << (type - 0xd9), &size)) {
+            return false;
+        }
+    } else {
+        return false;
+    }
+
+    if (!this->take(size, &data)) {
+        return false;
+    }
+
+    *value = (const char*) data;
+    *length = size;
+    return true;
+}
+
+//******************************************************************************
+bool MsgPackReader::read_bool(bool* value) {
+    if (!this->next_is_bool()) {
+        return false;
+    }
+    *value = *this->p++ == 0xc3;
+    return true;
+}
+
+//******************************************************************************
+/**
+ * @brief Read any number as an integer, floats are truncated.
+ */
+bool MsgPackReader::read_int(int64_t* value) {
+    uint64_t raw;
+    if (!this->next_is_int()) {
+        return false;
+    }
+
+    uint8_t type = *this->p++;
+    if (type < 0x80) {
+        *value = type;
+        return true;
+    }
+    if (type >= 0xe0) {
+        *value = (int8_t) type;
+        return true;
+    }
+
+    switch (type) {
+        case 0xca: {
+            float f;
+            uint32_t bits;
+            if (!this->read_be(4, &raw)) return false;
+            bits = (uint32_t) raw;
+            memcpy(&f, &bits, sizeof(f));
+            *value = (int64_t) f;
+            return true;
+        }
+        case 0xcb: {
+            double d;
+            if (!this->read_be(8, &raw)) return false;
+            memcpy(&d, &raw, sizeof(d));
+            *value = (int64_t) d;
+            return true;
+        }
+        case 0xcc: if (!this->read_be(1, &raw)) return false; *value = (uint8_t) raw; return true;
+        case 0xcd: if (!this->read_be(2, &raw)) return false; *value = (uint16_t) raw; return true;
+        case 0xce: if (!this->read_be(4, &raw)) return false; *value = (uint32_t) raw; return true;
+        case 0xcf: if (!this->read_be(8, &raw)) return false; *value = (int64_t) raw; return true;
+        case 0xd0: if (!this->read_be(1, &raw)) return false; *value = (int8_t) raw; return true;
+        case 0xd1: if (!this->read_be(2, &raw)) return false; *value = (int16_t) raw; return true;
+        case 0xd2: if (!this->read_be(4, &raw)) return false; *value = (int32_t) raw; return true;
+        case 0xd3: if (!this->read_be(8, &raw)) return false; *value = (int64_t) raw; return true;
+        default: return false;
+    }
+}
+
+//******************************************************************************
+bool MsgPackReader::read_nil(void) {
+    if (this->at_end() || *this->p != 0xc0) {
+        return false;
+    }
+    this->p++;
+    return true;
+}
+
+//******************************************************************************
+/**
+ * @brief Skip the next value, containers included.
+ *
+ * @param max_depth     How deep containers may nest before we give up.
+ */
+bool MsgPackReader::skip(int max_depth) {
+    uint64_t size;
+    if (this->at_end()) {
+        return false;
+    }
+
+    uint8_t type = *this->p++;
+
+    // fixint, nil, bool
+    if (type < 0x80 || type >= 0xe0 || type == 0xc0 || type == 0xc2 || type == 0xc3) {
+        return true;
+    }
+
+    // fixstr
+    if ((type & 0xe0) == 0xa0) {
+        return this->take(type & 0x1f, nullptr);
+    }
+
+    // fixmap, fixarray, map, array
+    uint64_t elements = 0;
+    bool container = true;
+    if ((type & 0xf0) == 0x80) {
+        elements = (type & 0x0f) * 2;
+    } else if ((type & 0xf0) == 0x90) {
+        elements = type & 0x0f;
+    } else if (type == 0xdc || type == 0xdd) {
+        if (!this->read_be(type == 0xdc ? 2 : 4, &elements)) return false;
+    } else if (type == 0xde || type == 0xdf) {
+        if (!this->read_be(type == 0xde ? 2 : 4, &elements)) return false;
+        elements *= 2;
+    } else {
+        container = false;
+    }
+
+    if (container) {
+        if (max_depth <= 0) {
+            return false;
+        }
+        for (uint64_t i = 0; i < elements; i++) {
+            if (!this->skip(max_depth - 1)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    switch (type) {
+        case 0xcc: case 0xd0: return this->take(1, nullptr);
+        case 0xcd: case 0xd1: return this->take(2, nullptr);
+        case 0xce: case 0xd2: case 0xca: return this->take(4, nullptr);
+        case 0xcf: case 0xd3: case 0xcb: return this->take(8, nullptr);
+
+        // fixext: type byte plus 1, 2, 4, 8 or 16 bytes
+        case 0xd4: return this->take(2, nullptr);
+        case 0xd5: return this->take(3, nullptr);
+        case 0xd6: return this->take(5, nullptr);
+        case 0xd7: return this->take(9, nullptr);
+        case 0xd8: return this->take(17, nullptr);
+
+        // str, bin
+        case 0xd9: case 0xc4:
+            return this->read_be(1, &size) && this->take(size, nullptr);
+        case 0xda: case 0xc5:
+            return this->read_be(2, &size) && this->take(size, nullptr);
+        case 0xdb: case 0xc6:
+            return this->read_be(4, &size) && this->take(size, nullptr);
+
+        // ext: length, type byte, data
+        case 0xc7:
+            return this->read_be(1, &size) && this->take(size + 1, nullptr);
+        case 0xc8:
+            return this->read_be(2, &size) && this->take(size + 1, nullptr);
+        case 0xc9:
+            return this->read_be(4, &size) && this->take(size + 1, nullptr);
+
+        default:
+            return false;
+    }
+}
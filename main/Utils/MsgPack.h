@@ -0,0 +1,89 @@
+//******************************************************************************
+/**
+ * @file MsgPack.h
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief Minimal MessagePack reader and writer
+ * @version 0.1
+ * @date 2024-02-09
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+//******************************************************************************
+/**
+ * @brief Write MessagePack into a caller supplied buffer.
+ *
+ * Only the types we publish are supported: maps, arrays, strings, bools,
+ * integers and nil.  Writes past the end of the buffer are dropped and
+ * flagged, check ok() once at the end instead of after every call.
+ */
+class MsgPackWriter {
+public:
+    MsgPackWriter(uint8_t* buffer, size_t size) : buffer(buffer), size(size) {}
+    ~MsgPackWriter(void) = default;
+
+public:
+    void map(uint32_t count);
+    void array(uint32_t count);
+    void str(const char* value);
+    void str(const char* value, size_t length);
+    void boolean(bool value);
+    void integer(int64_t value);
+    void nil(void);
+
+    inline bool ok(void) const { return !this->overflow; }
+    inline size_t length(void) const { return this->pos; }
+
+private:
+    void put(uint8_t value);
+    void put(const void* data, size_t length);
+    void put_be(uint64_t value, int bytes);
+
+    uint8_t* buffer;
+    size_t size;
+    size_t pos = 0;
+    bool overflow = false;
+};
+
+//******************************************************************************
+/**
+ * @brief Read MessagePack in place.
+ *
+ * Strings are returned as pointers into the buffer, nothing is copied.  Every
+ * read returns false on a type mismatch or if the buffer is too short; the
+ * reader is then in an undefined position and should be abandoned.
+ */
+class MsgPackReader {
+public:
+    MsgPackReader(const uint8_t* buffer, size_t length) : p(buffer), end(buffer + length) {}
+    ~MsgPackReader(void) = default;
+
+public:
+    bool read_map(uint32_t* count);
+    bool read_str(const char** value, size_t* length);
+    bool read_bool(bool* value);
+    bool read_int(int64_t* value);
+    bool read_nil(void);
+    bool skip(int max_depth = 8);
+
+    // Type of the next value without consuming it.
+    bool next_is_map(void) const;
+    bool next_is_str(void) const;
+    bool next_is_int(void) const;
+    bool next_is_bool(void) const;
+
+    inline bool at_end(void) const { return this->p >= this->end; }
+
+private:
+    bool take(size_t bytes, const uint8_t** data);
+    bool read_be(int bytes, uint64_t* value);
+
+    const uint8_t* p;
+    const uint8_t* end;
+};
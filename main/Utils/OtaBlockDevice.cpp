@@ -0,0 +1,243 @@
+//******************************************************************************
+/**
+ * @file OtaBlockDevice.cpp
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief The block engine source and store of the device
+ * @version 0.1
+ * @date 2024-03-01
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#include "OtaBlockDevice.h"
+#include "KeyStore.h"
+#include "Updater.h"
+
+#include "esp_crt_bundle.h"
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+
+#include "mbedtls/sha256.h"
+
+#include <string.h>
+#include <sys/param.h>
+
+#define OTA_HTTP_TIMEOUT_MS     (10000)
+
+#define OTA_KEYSTORE_SECTION    "ota"
+#define OTA_KEYSTORE_JOB        "job"
+
+static const char* TAG = "ota_block";
+
+//******************************************************************************
+HttpBlockSource::~HttpBlockSource(void) {
+    if (this->client != nullptr) {
+        esp_http_client_cleanup(this->client);
+    }
+}
+
+//******************************************************************************
+/**
+ * @brief Ask for the range and check the server gives us that range.
+ *
+ * @return esp_err_t    ESP_ERR_NOT_SUPPORTED if the answer is not a 206,
+ *                      ESP_ERR_INVALID_SIZE if it is not the range.
+ */
+esp_err_t HttpBlockSource::open(const ota_job_t& job, uint32_t offset, uint32_t length) {
+    esp_err_t ret = ESP_OK;
+
+    if (this->client != nullptr && strcmp(this->url, job.url) != 0) {
+        esp_http_client_cleanup(this->client);
+        this->client = nullptr;
+    }
+
+    if (this->client == nullptr) {
+        #pragma GCC diagnostic push
+        #pragma GCC diagnostic ignored "-Wmissing-field-initializers"
+        esp_http_client_config_t config = {
+            .url = job.url,
+            .timeout_ms = OTA_HTTP_TIMEOUT_MS,
+            .crt_bundle_attach = esp_crt_bundle_attach,
+        };
+        #pragma GCC diagnostic pop
+
+        this->client = esp_http_client_init(&config);
+        if (this->client == nullptr) {
+            return ESP_ERR_NO_MEM;
+        }
+        strcpy(this->url, job.url);
+    }
+
+    char range[32];
+    snprintf(range, sizeof(range), "bytes=%lu-%lu", (unsigned long) offset, (unsigned long)(offset + length - 1));
+    esp_http_client_set_header(this->client, "Range", range);
+
+    ret = esp_http_client_open(this->client, 0);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to connect (%s)", esp_err_to_name(ret));
+        return ret;
+    }
+
+    int64_t content_length = esp_http_client_fetch_headers(this->client);
+    int status = esp_http_client_get_status_code(this->client);
+    if (status != 206) {
+        ESP_LOGE(TAG, "Range %s, status %d", range, status);
+        ret = ESP_ERR_NOT_SUPPORTED;
+    } else if (content_length != length) {
+        ESP_LOGE(TAG, "Range %s, %lld bytes", range, content_length);
+        ret = ESP_ERR_INVALID_SIZE;
+    }
+
+    if (ret != ESP_OK) {
+        esp_http_client_close(this->client);
+    }
+    return ret;
+}
+
+//******************************************************************************
+esp_err_t HttpBlockSource::read(uint8_t* buffer, size_t length) {
+    size_t done = 0;
+    while (done < length) {
+        int count = esp_http_client_read(this->client, (char*) buffer + done, length - done);
+        if (count <= 0) {
+            ESP_LOGE(TAG, "Read failed after %d of %d bytes", done, length);
+            return ESP_FAIL;
+        }
+        done += count;
+    }
+    return ESP_OK;
+}
+
+//******************************************************************************
+void HttpBlockSource::close(void) {
+    if (this->client != nullptr) {
+        esp_http_client_close(this->client);
+    }
+}
+
+//******************************************************************************
+esp_err_t PartitionBlockStore::load_state(ota_job_state_t& state) {
+    KeyStore key_store;
+    if (key_store.openKeyStore(OTA_KEYSTORE_SECTION, e_ro) != ESP_OK) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    size_t length = sizeof(state);
+    if (key_store.getKeyBlob(OTA_KEYSTORE_JOB, &state, length) != ESP_OK || length != sizeof(state)) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    return ESP_OK;
+}
+
+//******************************************************************************
+esp_err_t PartitionBlockStore::save_state(const ota_job_state_t& state) {
+    KeyStore key_store;
+    esp_err_t ret = key_store.openKeyStore(OTA_KEYSTORE_SECTION, e_rw);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    return key_store.setKeyBlob(OTA_KEYSTORE_JOB, &state, sizeof(state));
+}
+
+//******************************************************************************
+esp_err_t PartitionBlockStore::clear_state(void) {
+    KeyStore key_store;
+    esp_err_t ret = key_store.openKeyStore(OTA_KEYSTORE_SECTION, e_rw);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    ret = key_store.eraseKey(OTA_KEYSTORE_JOB);
+    return ret == ESP_ERR_NVS_NOT_FOUND ? ESP_OK : ret;
+}
+
+//******************************************************************************
+/**
+ * @brief The address of the next ota partition, 0 if there is none.
+ */
+uint32_t PartitionBlockStore::get_location(void) {
+    const esp_partition_t* partition = esp_ota_get_next_update_partition(NULL);
+    return partition != nullptr ? partition->address : 0;
+}
+
+//******************************************************************************
+/**
+ * @brief The image must fit the next ota partition, and no push update may
+ *        be writing it.
+ *
+ * Nothing is erased, each block erases its sector.
+ */
+esp_err_t PartitionBlockStore::prepare(const ota_job_t& job, bool resume) {
+    if (FwUpdater::instance().is_running()) {
+        ESP_LOGE(TAG, "Push update running");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    this->partition = esp_ota_get_next_update_partition(NULL);
+    if (this->partition == nullptr) {
+        ESP_LOGE(TAG, "Partition could not be found");
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    if (job.size > this->partition->size) {
+        ESP_LOGE(TAG, "too large %lu > %lu", job.size, this->partition->size);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    ESP_LOGI(TAG, "%s %s at 0x%lx", resume ? "Resuming in" : "Writing to", this->partition->label, this->partition->address);
+    return ESP_OK;
+}
+
+//******************************************************************************
+esp_err_t PartitionBlockStore::write_block(uint32_t offset, const uint8_t* data, size_t length) {
+    esp_err_t ret = esp_partition_erase_range(this->partition, offset, OTA_BLOCK_SIZE);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Erase at 0x%lx failed (%s)", offset, esp_err_to_name(ret));
+        return ret;
+    }
+
+    ret = esp_partition_write(this->partition, offset, data, length);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Write at 0x%lx failed (%s)", offset, esp_err_to_name(ret));
+    }
+    return ret;
+}
+
+//******************************************************************************
+/**
+ * @brief Hash what is in flash, blocks may come from before a reboot, then
+ *        let esp_ota_set_boot_partition() check the image.
+ */
+esp_err_t PartitionBlockStore::finish(const ota_job_t& job) {
+    esp_err_t ret = ESP_OK;
+    uint8_t sha256[OTA_JOB_SHA256_LENGTH];
+    mbedtls_sha256_context context;
+
+    mbedtls_sha256_init(&context);
+    mbedtls_sha256_starts(&context, 0);
+    for (uint32_t offset = 0; offset < job.size && ret == ESP_OK; offset += sizeof(this->buffer)) {
+        size_t length = MIN(sizeof(this->buffer), job.size - offset);
+        ret = esp_partition_read(this->partition, offset, this->buffer, length);
+        if (ret == ESP_OK) {
+            mbedtls_sha256_update(&context, this->buffer, length);
+        }
+    }
+    mbedtls_sha256_finish(&context, sha256);
+    mbedtls_sha256_free(&context);
+
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Read back failed (%s)", esp_err_to_name(ret));
+        return ret;
+    }
+
+    if (memcmp(sha256, job.sha256, OTA_JOB_SHA256_LENGTH) != 0) {
+        ESP_LOGE(TAG, "SHA-256 mismatch");
+        return ESP_ERR_INVALID_CRC;
+    }
+
+    ret = esp_ota_set_boot_partition(this->partition);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "esp_ota_set_boot_partition failed (%s)!", esp_err_to_name(ret));
+    }
+    return ret;
+}
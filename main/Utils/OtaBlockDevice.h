@@ -0,0 +1,65 @@
+//******************************************************************************
+/**
+ * @file OtaBlockDevice.h
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief The block engine source and store of the device
+ * @version 0.1
+ * @date 2024-03-01
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#pragma once
+
+#include "Utils/OtaBlockEngine.h"
+
+#include "esp_http_client.h"
+#include "esp_partition.h"
+
+//******************************************************************************
+/**
+ * @brief Range requests with esp_http_client, http or https.
+ *
+ * The client is kept from one request to the next while the url stays the
+ * same.
+ */
+class HttpBlockSource : public OtaBlockSource {
+public:
+    HttpBlockSource(void) = default;
+    ~HttpBlockSource(void) override;
+
+public:
+    esp_err_t open(const ota_job_t& job, uint32_t offset, uint32_t length) override;
+    esp_err_t read(uint8_t* buffer, size_t length) override;
+    void close(void) override;
+
+private:
+    esp_http_client_handle_t client = nullptr;
+    char url[OTA_URL_MAX_LENGTH + 1] = {0};
+};
+
+//******************************************************************************
+/**
+ * @brief The next ota partition, written a sector at a time without
+ *        esp_ota_begin(), which would erase it all.  The job is kept in the
+ *        key store.
+ */
+class PartitionBlockStore : public OtaBlockStore {
+public:
+    PartitionBlockStore(void) = default;
+    ~PartitionBlockStore(void) override = default;
+
+public:
+    esp_err_t load_state(ota_job_state_t& state) override;
+    esp_err_t save_state(const ota_job_state_t& state) override;
+    esp_err_t clear_state(void) override;
+
+    uint32_t get_location(void) override;
+    esp_err_t prepare(const ota_job_t& job, bool resume) override;
+    esp_err_t write_block(uint32_t offset, const uint8_t* data, size_t length) override;
+    esp_err_t finish(const ota_job_t& job) override;
+
+private:
+    const esp_partition_t* partition = nullptr;
+    uint8_t buffer[1024];
+};
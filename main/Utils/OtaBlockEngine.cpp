@@ -0,0 +1,264 @@
+//******************************************************************************
+/**
+ * @file OtaBlockEngine.cpp
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief OtaBlockEngine class implementation
+ * @version 0.1
+ * @date 2024-03-01
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#include "OtaBlockEngine.h"
+
+#include "esp_log.h"
+
+#include <string.h>
+
+static const char* TAG = "ota_block";
+
+//******************************************************************************
+/**
+ * @brief Same image, the url may not be, presigned urls expire.
+ */
+static bool is_same_job(const ota_job_t& a, const ota_job_t& b) {
+    return strcmp(a.job_id, b.job_id) == 0 && a.size == b.size &&
+        memcmp(a.sha256, b.sha256, OTA_JOB_SHA256_LENGTH) == 0;
+}
+
+//******************************************************************************
+/**
+ * @brief Start a job, or pick it up where it was if it is the one persisted.
+ *
+ * Any other persisted job is dropped.
+ *
+ * @return esp_err_t    ESP_ERR_INVALID_ARG for a job without id or url,
+ *                      ESP_ERR_INVALID_SIZE if the image does not fit,
+ *                      the store errors.
+ */
+esp_err_t OtaBlockEngine::open(const ota_job_t& job) {
+    esp_err_t ret = ESP_OK;
+
+    if (job.job_id[0] == '\0' || job.url[0] == '\0') {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (job.size == 0 || get_block_count(job.size) > OTA_BLOCK_MAX_COUNT) {
+        ESP_LOGE(TAG, "Image of %lu bytes not supported", (unsigned long) job.size);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    if (this->opened && is_same_job(this->state.job, job)) {
+        strcpy(this->state.job.url, job.url);
+        return ESP_OK;
+    }
+
+    // The next partition changes once an update is booted, a bitmap saved
+    // before that describes the other one.
+    ota_job_state_t persisted;
+    uint32_t location = this->store.get_location();
+    bool resume = this->store.load_state(persisted) == ESP_OK &&
+        persisted.version == OTA_JOB_STATE_VERSION &&
+        persisted.location == location &&
+        is_same_job(persisted.job, job);
+
+    // A job rejected here leaves the one open as it was.
+    ret = this->store.prepare(job, resume);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Store rejected the job %s", job.job_id);
+        return ret;
+    }
+    this->opened = false;
+
+    if (resume) {
+        this->state = persisted;
+    } else {
+        memset(&this->state, 0, sizeof(this->state));
+        this->state.version = OTA_JOB_STATE_VERSION;
+        this->state.location = location;
+    }
+    this->state.job = job;
+
+    this->stats = {};
+    this->stats.block_count = get_block_count(job.size);
+    for (uint32_t block = 0; block < this->stats.block_count; block++) {
+        if (this->has_block(block)) {
+            this->stats.blocks_done++;
+        }
+    }
+    this->stats.blocks_resumed = this->stats.blocks_done;
+
+    ret = this->save();
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    this->cancelled = false;
+    this->opened = true;
+    ESP_LOGI(TAG, "Job %s, %lu bytes, %lu of %lu blocks already there", job.job_id,
+        (unsigned long) job.size, (unsigned long) this->stats.blocks_done, (unsigned long) this->stats.block_count);
+    return ESP_OK;
+}
+
+//******************************************************************************
+/**
+ * @brief Open the persisted job, if any.
+ *
+ * @return esp_err_t    ESP_ERR_NOT_FOUND when there is none.
+ */
+esp_err_t OtaBlockEngine::resume(void) {
+    ota_job_state_t persisted;
+    if (this->store.load_state(persisted) != ESP_OK) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    if (persisted.version != OTA_JOB_STATE_VERSION) {
+        ESP_LOGW(TAG, "Dropping a job saved by another version");
+        this->store.clear_state();
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    return this->open(persisted.job);
+}
+
+//******************************************************************************
+/**
+ * @brief Fetch the missing blocks, then finish the update.
+ *
+ * Gives up after OTA_BLOCK_ATTEMPTS requests in a row that brought nothing,
+ * the job stays open to be run again.  Once finished, failed or cancelled
+ * the job is closed.
+ *
+ * @return esp_err_t    ESP_OK the image is ready to boot, the source or
+ *                      store errors, ESP_ERR_INVALID_STATE if cancelled.
+ */
+esp_err_t OtaBlockEngine::run(void) {
+    esp_err_t ret = ESP_OK;
+    uint32_t attempts = 0;
+    uint32_t block = 0;
+
+    if (!this->opened) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    while (true) {
+        if (this->cancelled) {
+            ESP_LOGW(TAG, "Job %s cancelled", this->state.job.job_id);
+            this->close();
+            return ESP_ERR_INVALID_STATE;
+        }
+
+        while (block < this->stats.block_count && this->has_block(block)) {
+            block++;
+        }
+        if (block == this->stats.block_count) {
+            break;
+        }
+
+        uint32_t count = 1;
+        while (count < OTA_BLOCK_RUN_LENGTH && block + count < this->stats.block_count && !this->has_block(block + count)) {
+            count++;
+        }
+
+        bool progress = false;
+        ret = this->fetch_run(block, count, progress);
+        if (ret == ESP_OK || progress) {
+            attempts = 0;
+            continue;
+        }
+
+        if (++attempts >= OTA_BLOCK_ATTEMPTS) {
+            ESP_LOGE(TAG, "Giving up for now at block %lu (0x%x)", (unsigned long) block, ret);
+            this->save();
+            return ret;
+        }
+    }
+
+    this->save();
+    ret = this->store.finish(this->state.job);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Job %s failed (0x%x)", this->state.job.job_id, ret);
+    } else {
+        ESP_LOGI(TAG, "Job %s done, %lu blocks fetched, %lu resumed, %lu requests, %lu failed",
+            this->state.job.job_id,
+            (unsigned long) this->stats.blocks_fetched, (unsigned long) this->stats.blocks_resumed,
+            (unsigned long) this->stats.requests, (unsigned long) this->stats.failed_requests);
+    }
+
+    this->close();
+    return ret;
+}
+
+//******************************************************************************
+/**
+ * @brief Forget the job, persisted state included.
+ */
+void OtaBlockEngine::close(void) {
+    this->store.clear_state();
+    this->opened = false;
+    this->unsaved = 0;
+}
+
+//******************************************************************************
+/**
+ * @brief One range request for count blocks from first, all missing.
+ *
+ * @param progress  Out, at least one block was written.
+ */
+esp_err_t OtaBlockEngine::fetch_run(uint32_t first, uint32_t count, bool& progress) {
+    esp_err_t ret = ESP_OK;
+    uint32_t offset = first * OTA_BLOCK_SIZE;
+    uint32_t length = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        length += this->get_block_length(first + i);
+    }
+
+    this->stats.requests++;
+    ret = this->source.open(this->state.job, offset, length);
+    if (ret != ESP_OK) {
+        this->stats.failed_requests++;
+        return ret;
+    }
+
+    for (uint32_t i = 0; i < count && !this->cancelled; i++) {
+        uint32_t block = first + i;
+        uint32_t block_length = this->get_block_length(block);
+
+        ret = this->source.read(this->buffer, block_length);
+        if (ret != ESP_OK) {
+            break;
+        }
+
+        ret = this->store.write_block(block * OTA_BLOCK_SIZE, this->buffer, block_length);
+        if (ret != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to write block %lu", (unsigned long) block);
+            break;
+        }
+
+        this->set_block(block);
+        this->stats.blocks_done++;
+        this->stats.blocks_fetched++;
+        progress = true;
+
+        if (++this->unsaved >= OTA_BLOCK_SAVE_INTERVAL) {
+            this->save();
+        }
+    }
+
+    this->source.close();
+    if (ret != ESP_OK) {
+        this->stats.failed_requests++;
+    }
+    return ret;
+}
+
+//******************************************************************************
+esp_err_t OtaBlockEngine::save(void) {
+    esp_err_t ret = this->store.save_state(this->state);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to save the job state (0x%x)", ret);
+        return ret;
+    }
+    this->unsaved = 0;
+    return ESP_OK;
+}
@@ -0,0 +1,166 @@
+//******************************************************************************
+/**
+ * @file OtaBlockEngine.h
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief OtaBlockEngine class definition
+ * @version 0.1
+ * @date 2024-03-01
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#pragma once
+
+#include "Utils/NoCopy.h"
+
+#include "esp_err.h"
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+// A flash sector per block, a block is erased and written on its own.
+#define OTA_BLOCK_SIZE              (4096)
+
+// 4 MB, more than an ota partition.
+#define OTA_BLOCK_MAX_COUNT         (1024)
+#define OTA_BLOCK_BITMAP_LENGTH     (OTA_BLOCK_MAX_COUNT / 8)
+
+// Blocks asked for in one range request.
+#define OTA_BLOCK_RUN_LENGTH        (16)
+
+// Requests in a row that bring nothing before run() gives up.
+#define OTA_BLOCK_ATTEMPTS          (3)
+
+// The bitmap is saved every that many blocks.  A block written but not
+// saved yet is fetched again after a reboot, nothing worse.
+#define OTA_BLOCK_SAVE_INTERVAL     (16)
+
+#define OTA_JOB_ID_MAX_LENGTH       (64)
+#define OTA_URL_MAX_LENGTH          (256)
+#define OTA_JOB_SHA256_LENGTH       (32)
+
+#define OTA_JOB_STATE_VERSION       (2)
+
+typedef struct {
+    char job_id[OTA_JOB_ID_MAX_LENGTH + 1];
+    char url[OTA_URL_MAX_LENGTH + 1];
+    uint32_t size;
+    uint8_t sha256[OTA_JOB_SHA256_LENGTH];
+} ota_job_t;
+
+// What is persisted, as is.
+typedef struct {
+    uint8_t version;
+    ota_job_t job;
+    uint32_t location;                          // where the blocks went, the partition address
+    uint8_t bitmap[OTA_BLOCK_BITMAP_LENGTH];    // bit set, block in flash
+} ota_job_state_t;
+
+typedef struct {
+    uint32_t block_count;
+    uint32_t blocks_done;
+    uint32_t blocks_resumed;        // already there when the job was opened
+    uint32_t blocks_fetched;
+    uint32_t requests;
+    uint32_t failed_requests;
+} ota_block_stats_t;
+
+//******************************************************************************
+/**
+ * @brief Where the blocks come from, range requests to a file server.
+ */
+class OtaBlockSource {
+public:
+    virtual ~OtaBlockSource(void) = default;
+
+    // Ask for length bytes from offset of the image.
+    virtual esp_err_t open(const ota_job_t& job, uint32_t offset, uint32_t length) = 0;
+
+    // Fill the buffer, anything short of length is an error.
+    virtual esp_err_t read(uint8_t* buffer, size_t length) = 0;
+
+    virtual void close(void) = 0;
+};
+
+//******************************************************************************
+/**
+ * @brief Where the blocks go and where the state of the job is kept.
+ */
+class OtaBlockStore {
+public:
+    virtual ~OtaBlockStore(void) = default;
+
+    // ESP_ERR_NOT_FOUND when there is no job.
+    virtual esp_err_t load_state(ota_job_state_t& state) = 0;
+    virtual esp_err_t save_state(const ota_job_state_t& state) = 0;
+    virtual esp_err_t clear_state(void) = 0;
+
+    // Where the blocks of a job opened now would go.  Blocks saved for
+    // another place are not resumed.
+    virtual uint32_t get_location(void) = 0;
+
+    // Check the image fits, resume tells if blocks from before are kept.
+    virtual esp_err_t prepare(const ota_job_t& job, bool resume) = 0;
+    virtual esp_err_t write_block(uint32_t offset, const uint8_t* data, size_t length) = 0;
+
+    // Every block is there, check the image and make it the next boot.
+    virtual esp_err_t finish(const ota_job_t& job) = 0;
+};
+
+//******************************************************************************
+/**
+ * @brief Pull a firmware image block by block.
+ *
+ * Blocks still missing are asked for in runs of up to OTA_BLOCK_RUN_LENGTH
+ * and written as they arrive.  The block bitmap is persisted with the job,
+ * a job is picked up where it was after a dropped connection or a reboot.
+ *
+ *     engine.open(job);            // or resume() at boot
+ *     while (engine.run() != ESP_OK && engine.is_open()) {
+ *         wait, the network is down or the server is gone
+ *     }
+ *
+ * Not thread safe, only cancel() can be called from another task.
+ */
+class OtaBlockEngine : public NoCopy {
+public:
+    OtaBlockEngine(OtaBlockSource& source, OtaBlockStore& store) : source(source), store(store) {}
+    ~OtaBlockEngine(void) = default;
+
+public:
+    esp_err_t open(const ota_job_t& job);
+    esp_err_t resume(void);
+    esp_err_t run(void);
+    void cancel(void) { this->cancelled = true; }
+    void close(void);
+
+    inline bool is_open(void) const { return this->opened; }
+    inline const ota_job_t& get_job(void) const { return this->state.job; }
+    inline const ota_block_stats_t& get_stats(void) const { return this->stats; }
+
+    static uint32_t get_block_count(uint32_t size) { return (size + OTA_BLOCK_SIZE - 1) / OTA_BLOCK_SIZE; }
+
+protected:
+    inline bool has_block(uint32_t block) const { return (this->state.bitmap[block / 8] >> (block % 8)) & 1; }
+    inline void set_block(uint32_t block) { this->state.bitmap[block / 8] |= (uint8_t)(1 << (block % 8)); }
+    inline uint32_t get_block_length(uint32_t block) const {
+        uint32_t offset = block * OTA_BLOCK_SIZE;
+        return this->state.job.size - offset < OTA_BLOCK_SIZE ? this->state.job.size - offset : OTA_BLOCK_SIZE;
+    }
+
+    esp_err_t fetch_run(uint32_t first, uint32_t count, bool& progress);
+    esp_err_t save(void);
+
+private:
+    OtaBlockSource& source;
+    OtaBlockStore& store;
+
+    ota_job_state_t state = {};
+    ota_block_stats_t stats = {};
+    bool opened = false;
+    uint32_t unsaved = 0;
+    std::atomic<bool> cancelled{false};
+
+    uint8_t buffer[OTA_BLOCK_SIZE];
+};
@@ -0,0 +1,300 @@
+//******************************************************************************
+/**
+ * @file OtaPipeline.cpp
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief OtaPipeline class implementation
+ * @version 0.1
+ * @date 2024-02-29
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#include "OtaPipeline.h"
+#include "Updater.h"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include <string.h>
+#include <sys/param.h>
+
+// The flash keeps a buffer longer than this only if it is broken.
+#define OTA_PIPELINE_TIMEOUT_MS     (30000)
+
+static const char* TAG = "ota";
+
+static inline uint32_t elapsed_ms(int64_t since_us) {
+    return (uint32_t)((esp_timer_get_time() - since_us) / 1000);
+}
+
+//******************************************************************************
+/**
+ * @brief Start an update and its writer task.
+ *
+ * @param size              The image size.
+ * @param expected_sha256   Checked at the end, nullptr to only compute it.
+ */
+esp_err_t OtaPipeline::begin(uint32_t size, const uint8_t* expected_sha256) {
+    esp_err_t ret = ESP_OK;
+
+    if (this->writer != nullptr) {
+        ESP_LOGE(TAG, "Update already running");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (this->free_queue == nullptr) {
+        this->free_queue = xQueueCreate(OTA_PIPELINE_BUFFER_COUNT, sizeof(uint8_t));
+        this->full_queue = xQueueCreate(OTA_PIPELINE_BUFFER_COUNT + 1, sizeof(ota_chunk_t));
+        this->done = xSemaphoreCreateBinary();
+        if (this->free_queue == nullptr || this->full_queue == nullptr || this->done == nullptr) {
+            ESP_LOGE(TAG, "Failed to create queues");
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    xQueueReset(this->free_queue);
+    xQueueReset(this->full_queue);
+    for (uint8_t i = 0; i < OTA_PIPELINE_BUFFER_COUNT; i++) {
+        xQueueSend(this->free_queue, &i, 0);
+    }
+    // A writer deleted while stuck may have given done just before.
+    xSemaphoreTake(this->done, 0);
+    this->current = -1;
+    this->write_error = ESP_OK;
+    this->stuck = false;
+
+    this->check_sha256 = expected_sha256 != nullptr;
+    if (this->check_sha256) {
+        memcpy(this->expected_sha256, expected_sha256, OTA_SHA256_LENGTH);
+    }
+
+    this->stats = {};
+    this->stats.total = size;
+    this->written = 0;
+    this->flash_ms = 0;
+    this->write_stall_ms = 0;
+    this->progress_step = 0;
+    this->start_us = esp_timer_get_time();
+
+    ret = FwUpdater::instance().begin(size);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to begin update");
+        return ret;
+    }
+
+    mbedtls_sha256_init(&this->sha256_context);
+    mbedtls_sha256_starts(&this->sha256_context, 0);
+
+    if (xTaskCreate(this->svTaskCodeWriter, "ota_writer", 4096, this, 5, &this->writer) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to start writer task");
+        this->writer = nullptr;
+        mbedtls_sha256_free(&this->sha256_context);
+        FwUpdater::instance().abort();
+        return ESP_ERR_NO_MEM;
+    }
+
+    return ESP_OK;
+}
+
+//******************************************************************************
+/**
+ * @brief The buffer to fill next, OTA_PIPELINE_BUFFER_SIZE bytes.
+ *
+ * Waits for the writer to free one.
+ *
+ * @return uint8_t*     nullptr if a write failed or the writer is stuck.
+ */
+uint8_t* OtaPipeline::get_buffer(void) {
+    if (this->write_error != ESP_OK || this->writer == nullptr) {
+        return nullptr;
+    }
+
+    if (this->current < 0) {
+        uint8_t index;
+        int64_t wait_start_us = esp_timer_get_time();
+        BaseType_t received = xQueueReceive(this->free_queue, &index, pdMS_TO_TICKS(OTA_PIPELINE_TIMEOUT_MS));
+        this->stats.receive_stall_ms += elapsed_ms(wait_start_us);
+        if (received != pdTRUE) {
+            ESP_LOGE(TAG, "Writer stuck");
+            this->stuck = true;
+            return nullptr;
+        }
+        this->current = index;
+    }
+
+    return this->buffers[this->current];
+}
+
+//******************************************************************************
+/**
+ * @brief Hand length bytes of the buffer to the writer.
+ */
+esp_err_t OtaPipeline::push(size_t length) {
+    if (this->current < 0 || length > OTA_PIPELINE_BUFFER_SIZE) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (length == 0) {
+        return this->write_error;
+    }
+
+    ota_chunk_t chunk = { (uint8_t) this->current, (uint16_t) length };
+    if (xQueueSend(this->full_queue, &chunk, pdMS_TO_TICKS(OTA_PIPELINE_TIMEOUT_MS)) != pdTRUE) {
+        ESP_LOGE(TAG, "Writer stuck");
+        this->stuck = true;
+        return ESP_ERR_TIMEOUT;
+    }
+    this->current = -1;
+    return this->write_error;
+}
+
+//******************************************************************************
+/**
+ * @brief Wait for the writer to write what was pushed and stop.
+ *
+ * Gives up after OTA_PIPELINE_TIMEOUT_MS, or at once if the writer was
+ * already found stuck, and deletes it.
+ */
+esp_err_t OtaPipeline::drain(void) {
+    if (this->writer == nullptr) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    ota_chunk_t chunk = { 0, 0 };
+    if (this->stuck ||
+        xQueueSend(this->full_queue, &chunk, pdMS_TO_TICKS(OTA_PIPELINE_TIMEOUT_MS)) != pdTRUE ||
+        xSemaphoreTake(this->done, pdMS_TO_TICKS(OTA_PIPELINE_TIMEOUT_MS)) != pdTRUE) {
+        ESP_LOGE(TAG, "Writer stuck, deleting it");
+        this->stuck = true;
+        this->write_error = ESP_ERR_TIMEOUT;
+    }
+
+    this->stop_writer();
+    return this->write_error;
+}
+
+//******************************************************************************
+/**
+ * @brief Delete the writer, done or stuck.
+ *
+ * The writer never deletes itself, so the handle is good until here even if
+ * it gave done after drain() stopped waiting.
+ */
+void OtaPipeline::stop_writer(void) {
+    vTaskDelete(this->writer);
+    this->writer = nullptr;
+}
+
+//******************************************************************************
+/**
+ * @brief Finish the update, check the hash and make the image bootable.
+ */
+esp_err_t OtaPipeline::end(void) {
+    esp_err_t ret = this->drain();
+    mbedtls_sha256_finish(&this->sha256_context, this->sha256);
+    mbedtls_sha256_free(&this->sha256_context);
+    this->stats.elapsed_ms = elapsed_ms(this->start_us);
+
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Write failed (%s)", esp_err_to_name(ret));
+        goto err;
+    }
+
+    if (this->check_sha256 && memcmp(this->sha256, this->expected_sha256, OTA_SHA256_LENGTH) != 0) {
+        ESP_LOGE(TAG, "SHA-256 mismatch");
+        ret = ESP_ERR_INVALID_CRC;
+        goto err;
+    }
+
+    // end() flushes the decoder and checks the image, the total time and the
+    // image size are only final after it.
+    ret = FwUpdater::instance().end();
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to end update");
+        goto err;
+    }
+    this->stats.elapsed_ms = elapsed_ms(this->start_us);
+    this->stats.image = FwUpdater::instance().get_bytes_written();
+    this->stats.compressed = FwUpdater::instance().is_compressed();
+
+    ESP_LOGI(TAG, "%lu bytes (%s, %lu in flash) in %lu ms, %lu KB/s, flash %lu ms, receive stalled %lu ms, write stalled %lu ms",
+        (uint32_t) this->written, this->stats.compressed ? "compressed" : "raw", this->stats.image, this->stats.elapsed_ms,
+        this->stats.elapsed_ms != 0 ? this->written / this->stats.elapsed_ms : 0,
+        (uint32_t) this->flash_ms, this->stats.receive_stall_ms, (uint32_t) this->write_stall_ms);
+    return ESP_OK;
+
+err:
+    FwUpdater::instance().abort();
+    return ret;
+}
+
+//******************************************************************************
+/**
+ * @brief The stats so far, final after end().
+ */
+ota_pipeline_stats_t OtaPipeline::get_stats(void) const {
+    ota_pipeline_stats_t stats = this->stats;
+    stats.written = this->written;
+    stats.flash_ms = this->flash_ms;
+    stats.write_stall_ms = this->write_stall_ms;
+    return stats;
+}
+
+//******************************************************************************
+void OtaPipeline::abort(void) {
+    if (this->writer == nullptr) {
+        return;
+    }
+
+    this->drain();
+    mbedtls_sha256_free(&this->sha256_context);
+    FwUpdater::instance().abort();
+}
+
+//******************************************************************************
+/**
+ * @brief Hash and write the buffers in the order they were pushed.
+ *
+ * After a failed write the buffers are still given back, the receiver finds
+ * out on its next call.  Once done is given the task waits to be deleted.
+ */
+void OtaPipeline::vTaskCodeWriter(void) {
+    FwUpdater& updater = FwUpdater::instance();
+    ota_chunk_t chunk;
+
+    while (true) {
+        int64_t wait_start_us = esp_timer_get_time();
+        xQueueReceive(this->full_queue, &chunk, portMAX_DELAY);
+        this->write_stall_ms += elapsed_ms(wait_start_us);
+        if (chunk.length == 0) {
+            break;
+        }
+
+        if (this->write_error == ESP_OK) {
+            uint8_t* buffer = this->buffers[chunk.index];
+            mbedtls_sha256_update(&this->sha256_context, buffer, chunk.length);
+
+            int64_t write_start_us = esp_timer_get_time();
+            esp_err_t err = updater.write(buffer, chunk.length);
+            this->flash_ms += elapsed_ms(write_start_us);
+
+            if (err != ESP_OK) {
+                this->write_error = err;
+            } else {
+                uint32_t written = this->written += chunk.length;
+                uint8_t step = (uint8_t)((uint64_t) written * 10 / this->stats.total);
+                if (step != this->progress_step) {
+                    this->progress_step = step;
+                    ESP_LOGI(TAG, "%d%%, %lu KB/s", step * 10,
+                        written / MAX(elapsed_ms(this->start_us), 1));
+                }
+            }
+        }
+
+        // Never full, there are as many slots as buffers.
+        xQueueSend(this->free_queue, &chunk.index, 0);
+    }
+
+    xSemaphoreGive(this->done);
+    vTaskSuspend(NULL);
+}
@@ -0,0 +1,116 @@
+//******************************************************************************
+/**
+ * @file OtaPipeline.h
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief OtaPipeline class definition
+ * @version 0.1
+ * @date 2024-02-29
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#pragma once
+
+#include "Utils/NoCopy.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+#include "mbedtls/sha256.h"
+
+#include "esp_err.h"
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+// A flash sector per buffer, the receiver can run a ring ahead of the writer.
+#define OTA_PIPELINE_BUFFER_SIZE    (4096)
+#define OTA_PIPELINE_BUFFER_COUNT   (4)
+
+#define OTA_SHA256_LENGTH           (32)
+
+typedef struct {
+    uint32_t total;             // bytes announced
+    uint32_t written;           // bytes received and handed to FwUpdater
+    uint32_t image;             // bytes in flash, decompressed
+    bool compressed;
+    uint32_t elapsed_ms;
+    uint32_t flash_ms;          // in esp_ota_write
+    uint32_t receive_stall_ms;  // receiver waiting for a free buffer, the flash is behind
+    uint32_t write_stall_ms;    // writer waiting for data, the network is behind
+} ota_pipeline_stats_t;
+
+//******************************************************************************
+/**
+ * @brief Firmware update in two stages.
+ *
+ * The receiver, the http handler, fills buffers from the socket while a
+ * writer task hashes them and hands them to FwUpdater.  The socket is read
+ * while the flash is erased and written.
+ *
+ *     pipeline.begin(size, expected_sha256);
+ *     while (...) {
+ *         uint8_t* buffer = pipeline.get_buffer();
+ *         int length = recv(buffer, OTA_PIPELINE_BUFFER_SIZE);
+ *         pipeline.push(length);
+ *     }
+ *     pipeline.end();
+ *
+ * A failed write is reported by the next get_buffer(), push() or end().  A
+ * writer stuck in the flash for OTA_PIPELINE_TIMEOUT_MS is deleted by end()
+ * or abort(), neither waits longer than that.
+ */
+class OtaPipeline : public NoCopy {
+public:
+    OtaPipeline(void) = default;
+    ~OtaPipeline(void) = default;
+
+public:
+    esp_err_t begin(uint32_t size, const uint8_t* expected_sha256);
+    uint8_t* get_buffer(void);
+    esp_err_t push(size_t length);
+    esp_err_t end(void);
+    void abort(void);
+
+    ota_pipeline_stats_t get_stats(void) const;
+    inline const uint8_t* get_sha256(void) const { return this->sha256; }
+
+protected:
+    void vTaskCodeWriter(void);
+    static void svTaskCodeWriter(void* pvParameters) { ((OtaPipeline*)pvParameters)->vTaskCodeWriter(); }
+
+    esp_err_t drain(void);
+    void stop_writer(void);
+
+private:
+    typedef struct {
+        uint8_t index;
+        uint16_t length;        // 0 once the image is all pushed
+    } ota_chunk_t;
+
+    uint8_t buffers[OTA_PIPELINE_BUFFER_COUNT][OTA_PIPELINE_BUFFER_SIZE];
+    int current = -1;
+
+    QueueHandle_t free_queue = nullptr;
+    QueueHandle_t full_queue = nullptr;
+    SemaphoreHandle_t done = nullptr;
+    TaskHandle_t writer = nullptr;
+    std::atomic<esp_err_t> write_error{ESP_OK};
+    bool stuck = false;
+
+    mbedtls_sha256_context sha256_context;
+    uint8_t sha256[OTA_SHA256_LENGTH] = {};
+    uint8_t expected_sha256[OTA_SHA256_LENGTH] = {};
+    bool check_sha256 = false;
+
+    // The handler's part of the stats, the writer keeps its own.
+    ota_pipeline_stats_t stats = {};
+    std::atomic<uint32_t> written{0};
+    std::atomic<uint32_t> flash_ms{0};
+    std::atomic<uint32_t> write_stall_ms{0};
+    int64_t start_us = 0;
+    uint8_t progress_step = 0;
+};
@@ -0,0 +1,153 @@
+//******************************************************************************
+/**
+ * @file ScratchArena.cpp
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief ScratchArena class implementation
+ * @version 0.1
+ * @date 2024-02-28
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#include "ScratchArena.h"
+
+#include "esp_log.h"
+
+#ifndef UNIT_TEST
+#include "esp_timer.h"
+#endif
+
+static const char* TAG = "scratch";
+
+//******************************************************************************
+esp_err_t ScratchArena::setup(void) {
+#ifndef UNIT_TEST
+    if (this->mutex != nullptr) {
+        return ESP_OK;
+    }
+
+    this->mutex = xSemaphoreCreateMutex();
+    this->released = xSemaphoreCreateBinary();
+    if (this->mutex == nullptr || this->released == nullptr) {
+        ESP_LOGE(TAG, "Failed to create semaphores");
+        return ESP_ERR_NO_MEM;
+    }
+#endif
+    return ESP_OK;
+}
+
+//******************************************************************************
+/**
+ * @brief Lease size bytes, rounded up to whole blocks.
+ *
+ * @param wait_ms   How long to wait for room, 0 to fail right away.
+ * @return void*    nullptr if there was no room in time.
+ */
+void* ScratchArena::lease(size_t size, uint32_t wait_ms) {
+    int blocks = (int)((size + SCRATCH_ARENA_BLOCK_SIZE - 1) / SCRATCH_ARENA_BLOCK_SIZE);
+    if (blocks == 0 || blocks > SCRATCH_ARENA_BLOCK_COUNT) {
+        ESP_LOGE(TAG, "Can't lease %u bytes", (unsigned) size);
+        this->failed++;
+        return nullptr;
+    }
+
+#ifdef UNIT_TEST
+    (void) wait_ms;
+    void* data = this->try_lease(blocks);
+#else
+    if (this->mutex == nullptr) {
+        return nullptr;
+    }
+
+    int64_t deadline_us = esp_timer_get_time() + (int64_t) wait_ms * 1000;
+    void* data = nullptr;
+    while (true) {
+        xSemaphoreTake(this->mutex, portMAX_DELAY);
+        data = this->try_lease(blocks);
+        xSemaphoreGive(this->mutex);
+
+        int64_t remaining_us = deadline_us - esp_timer_get_time();
+        if (data != nullptr || remaining_us <= 0) {
+            break;
+        }
+        xSemaphoreTake(this->released, pdMS_TO_TICKS(remaining_us / 1000) + 1);
+    }
+#endif
+
+    if (data == nullptr) {
+        ESP_LOGE(TAG, "No room for %u bytes, %u leased", (unsigned) size, (unsigned) this->get_leased());
+        this->failed++;
+    }
+    return data;
+}
+
+//******************************************************************************
+void ScratchArena::release(void* data) {
+    if (data == nullptr) {
+        return;
+    }
+
+    int first = (int)(((uint8_t*) data - this->memory) / SCRATCH_ARENA_BLOCK_SIZE);
+    if (first < 0 || first >= SCRATCH_ARENA_BLOCK_COUNT || this->lease_length[first] == 0 ||
+        (uint8_t*) data != this->memory + first * SCRATCH_ARENA_BLOCK_SIZE) {
+        ESP_LOGE(TAG, "Releasing %p, not leased", data);
+        return;
+    }
+
+#ifndef UNIT_TEST
+    xSemaphoreTake(this->mutex, portMAX_DELAY);
+#endif
+    int blocks = this->lease_length[first];
+    this->leased_mask &= ~(((1ULL << blocks) - 1) << first);
+    this->lease_length[first] = 0;
+    this->leased_blocks -= blocks;
+#ifndef UNIT_TEST
+    xSemaphoreGive(this->mutex);
+    xSemaphoreGive(this->released);
+#endif
+}
+
+//******************************************************************************
+/**
+ * @brief First run of free blocks long enough.
+ */
+void* ScratchArena::try_lease(int blocks) {
+    uint64_t run = (1ULL << blocks) - 1;
+    for (int first = 0; first + blocks <= SCRATCH_ARENA_BLOCK_COUNT; first++) {
+        if ((this->leased_mask & (run << first)) == 0) {
+            this->leased_mask |= run << first;
+            this->lease_length[first] = (uint8_t) blocks;
+            this->leased_blocks += blocks;
+            if (this->leased_blocks > this->peak_blocks) {
+                this->peak_blocks = this->leased_blocks;
+            }
+            return this->memory + first * SCRATCH_ARENA_BLOCK_SIZE;
+        }
+    }
+    return nullptr;
+}
+
+//******************************************************************************
+bool ScratchLease::lease(size_t size, uint32_t wait_ms) {
+    this->release();
+    this->buffer = ScratchArena::instance().lease(size, wait_ms);
+    this->length = this->buffer != nullptr ? size : 0;
+    return this->buffer != nullptr;
+}
+
+//******************************************************************************
+void ScratchLease::release(void) {
+    ScratchArena::instance().release(this->buffer);
+    this->buffer = nullptr;
+    this->length = 0;
+}
+
+//******************************************************************************
+void ScratchLease::swap(ScratchLease& other) {
+    void* buffer = other.buffer;
+    size_t length = other.length;
+    other.buffer = this->buffer;
+    other.length = this->length;
+    this->buffer = buffer;
+    this->length = length;
+}
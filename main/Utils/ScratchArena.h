@@ -0,0 +1,116 @@
+//******************************************************************************
+/**
+ * @file ScratchArena.h
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief ScratchArena class definition
+ * @version 0.1
+ * @date 2024-02-28
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#pragma once
+
+#include "Utils/Singleton.h"
+
+#include "esp_err.h"
+
+#ifndef UNIT_TEST
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SCRATCH_ARENA_BLOCK_SIZE    (512)
+#define SCRATCH_ARENA_BLOCK_COUNT   (40)
+#define SCRATCH_ARENA_SIZE          (SCRATCH_ARENA_BLOCK_SIZE * SCRATCH_ARENA_BLOCK_COUNT)
+
+static_assert(SCRATCH_ARENA_BLOCK_COUNT < 64, "the leased blocks are a 64 bits mask");
+
+// How long a json document waits for its pool.
+#define SCRATCH_ARENA_JSON_WAIT_MS  (1000)
+
+//******************************************************************************
+/**
+ * @brief Large buffers that are only needed for a while, shared by the tasks.
+ *
+ * A lease is a run of whole blocks, the first fit.  A task that does not find
+ * room waits for a release up to the time it gave.
+ *
+ * Sized for the udp server at its worst: its receive buffer, a request and a
+ * response document, the reply, or the provisioning response in place of the
+ * reply while a provision-aws runs.
+ */
+class ScratchArena : public Singleton<ScratchArena> {
+public:
+    ScratchArena(token) {}
+    ~ScratchArena(void) = default;
+
+public:
+    esp_err_t setup(void);
+
+    void* lease(size_t size, uint32_t wait_ms);
+    void release(void* data);
+
+    inline size_t get_leased(void) const { return this->leased_blocks * SCRATCH_ARENA_BLOCK_SIZE; }
+    inline size_t get_peak(void) const { return this->peak_blocks * SCRATCH_ARENA_BLOCK_SIZE; }
+    inline uint32_t get_failed(void) const { return this->failed; }
+
+private:
+    void* try_lease(int blocks);
+
+private:
+    alignas(8) uint8_t memory[SCRATCH_ARENA_SIZE];
+
+    uint64_t leased_mask = 0;
+    uint8_t lease_length[SCRATCH_ARENA_BLOCK_COUNT] = {};
+    int leased_blocks = 0;
+    int peak_blocks = 0;
+    uint32_t failed = 0;
+
+#ifndef UNIT_TEST
+    SemaphoreHandle_t mutex = nullptr;
+    SemaphoreHandle_t released = nullptr;
+#endif
+};
+
+//******************************************************************************
+/**
+ * @brief A lease given back when it goes out of scope.
+ */
+class ScratchLease : public NoCopy {
+public:
+    ScratchLease(void) = default;
+    ScratchLease(size_t size, uint32_t wait_ms) { this->lease(size, wait_ms); }
+    ~ScratchLease(void) { this->release(); }
+
+    bool lease(size_t size, uint32_t wait_ms);
+    void release(void);
+
+    // Hand the lease over, to keep a buffer past the scope it was leased in.
+    void swap(ScratchLease& other);
+
+    inline char* data(void) { return (char*) this->buffer; }
+    inline size_t size(void) const { return this->length; }
+    inline bool is_leased(void) const { return this->buffer != nullptr; }
+
+private:
+    void* buffer = nullptr;
+    size_t length = 0;
+};
+
+//******************************************************************************
+/**
+ * @brief ArduinoJson allocator for the document pools.
+ *
+ *     BasicJsonDocument<ScratchJsonAllocator> doc(2048);
+ *
+ * The pool is never grown, shrinking keeps the lease as it is.
+ */
+struct ScratchJsonAllocator {
+    void* allocate(size_t size) { return ScratchArena::instance().lease(size, SCRATCH_ARENA_JSON_WAIT_MS); }
+    void deallocate(void* data) { ScratchArena::instance().release(data); }
+    void* reallocate(void* data, size_t size) { return data; }
+};
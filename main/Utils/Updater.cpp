@@ -8,6 +8,7 @@
 
 #include <memory.h>
 #include <esp_timer.h>
+#include <sys/param.h>
 
 static const char *TAG = "Updater";
 
@@ -18,37 +19,43 @@ esp_err_t FwUpdater::begin(uint32_t size)
 
     if (this->update_partition != nullptr) {
         ESP_LOGI(TAG, "Update already running");
-        return false;
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (this->pull_active) {
+        ESP_LOGI(TAG, "Pull update running");
+        return ESP_ERR_INVALID_STATE;
     }
 
     if (size == 0) {
         ESP_LOGE(TAG, "Size is 0 no updates possible");
-        return false;
+        return ESP_ERR_INVALID_SIZE;
     }
 
-    this->update_size = 0;
-    this->update_handle = 0;
-    this->bytes_written = 0;
+    this->clear();
 
-    this->update_partition = esp_ota_get_next_update_partition(NULL);
-    if (this->update_partition == nullptr) {
+    const esp_partition_t* partition = esp_ota_get_next_update_partition(NULL);
+    if (partition == nullptr) {
         ESP_LOGE(TAG, "Partition could not be found");
-        return false;
+        return ESP_ERR_NOT_FOUND;
     }
     ESP_LOGI(TAG,"Update firmware command");
 
-    err = esp_ota_begin(update_partition, OTA_WITH_SEQUENTIAL_WRITES, &this->update_handle);
+    if (size == UPDATE_SIZE_UNKNOWN) {
+        size = partition->size;
+    } else if (size > partition->size) {
+        ESP_LOGE(TAG, "too large %lu > %lu", size, partition->size);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    err = esp_ota_begin(partition, OTA_WITH_SEQUENTIAL_WRITES, &this->update_handle);
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "esp_ota_begin failed (%s)", esp_err_to_name(err));
-        esp_ota_abort(this->update_handle);
+        this->update_handle = 0;
+        return err;
     }
 
-    if (size == UPDATE_SIZE_UNKNOWN) {
-        size = this->update_partition->size;
-    } else if (size > this->update_partition->size) {
-        ESP_LOGE(TAG, "too large %lu > %lu", size, this->update_partition->size);
-        return ESP_ERR_INVALID_SIZE;
-    }
+    this->update_partition = partition;
     this->update_size = size;
     ESP_LOGI(TAG, "Updater beginned, size: %lu handle %ld", size, this->update_handle);
     return ESP_OK;
@@ -58,33 +65,140 @@ esp_err_t FwUpdater::begin(uint32_t size)
 esp_err_t FwUpdater::write(uint8_t *data, size_t len)
 {
     esp_err_t ret = ESP_OK;
-    uint8_t percentWritten = 0;
-    uint32_t usecTimeCount = 0;
-    uint32_t prev_usecTimeCount = 0;
+    size_t used = 0;
 
-    ESP_LOGI(TAG, "Byte written %lu, update size %lu", this->bytes_written, this->update_size);
+    if (this->update_partition == nullptr) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    this->bytes_received += len;
+
+    if (this->format == e_fw_format_unknown) {
+        ret = this->write_header(data, len, used);
+        if (ret != ESP_OK || this->format == e_fw_format_unknown) {
+            return ret;
+        }
+    }
+
+    if (this->format == e_fw_format_compressed) {
+        return this->write_compressed(data + used, len - used);
+    }
+    return this->write_flash(data + used, len - used);
+}
+
+//****************************************************************************************
+/**
+ * @brief Hold the first bytes until we know what the image is.
+ *
+ * The header can come split over several writes.  Once known, a raw image
+ * gets the bytes held written, a compressed one has its size checked and
+ * the decoder set up.
+ *
+ * @param used: out, the bytes of data taken for the header
+ */
+esp_err_t FwUpdater::write_header(uint8_t *data, size_t len, size_t &used)
+{
+    esp_err_t ret = ESP_OK;
+    fw_image_header_t image_header;
+
+    used = MIN(len, sizeof(this->header) - this->header_length);
+    memcpy(this->header + this->header_length, data, used);
+    this->header_length += used;
+
+    if (this->header_length < FW_IMAGE_MAGIC_LENGTH && memcmp(this->header, FW_IMAGE_MAGIC, this->header_length) == 0) {
+        return ESP_OK;
+    }
+
+    ret = fw_image_parse_header(this->header, this->header_length, &image_header);
+    if (ret == ESP_ERR_NOT_FOUND) {
+        // Not ours, hand back what was not needed to tell.
+        size_t held = MIN(this->header_length, (size_t) FW_IMAGE_MAGIC_LENGTH);
+        used -= this->header_length - held;
+        this->header_length = held;
+        this->format = e_fw_format_raw;
+        ESP_LOGI(TAG, "Raw image");
+        return this->write_flash(this->header, this->header_length);
+    }
+
+    if (ret == ESP_ERR_INVALID_SIZE) {
+        // Header not all there yet.
+        return ESP_OK;
+    }
+
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Bad image header (%s)", esp_err_to_name(ret));
+        return ret;
+    }
+
+    if (image_header.image_size == 0 || image_header.image_size > this->update_partition->size) {
+        ESP_LOGE(TAG, "Decompressed image too large %lu > %lu", image_header.image_size, this->update_partition->size);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    ret = this->decoder.reset(image_header.window_bits, image_header.lookahead_bits);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Unsupported window %d lookahead %d", image_header.window_bits, image_header.lookahead_bits);
+        return ret;
+    }
+
+    this->update_size = image_header.image_size;
+    this->format = e_fw_format_compressed;
+    ESP_LOGI(TAG, "Compressed image, %lu bytes, window %d", image_header.image_size, 1 << image_header.window_bits);
+    return ESP_OK;
+}
+
+//****************************************************************************************
+/**
+ * @brief Decompress into decode_buffer and flash it, a buffer at a time.
+ *
+ * A back reference left over when the input runs out with the buffer full
+ * is finished at the next write or at end().
+ */
+esp_err_t FwUpdater::write_compressed(const uint8_t *data, size_t len)
+{
+    esp_err_t ret = ESP_OK;
+    size_t used = 0;
+
+    do {
+        size_t consumed = 0;
+        size_t produced = this->decoder.decode(data + used, len - used, consumed, this->decode_buffer, sizeof(this->decode_buffer));
+        used += consumed;
+        if (produced == 0) {
+            break;
+        }
+
+        ret = this->write_flash(this->decode_buffer, produced);
+    } while (ret == ESP_OK && used < len);
+
+    return ret;
+}
+
+//****************************************************************************************
+esp_err_t FwUpdater::write_flash(const uint8_t *data, size_t len)
+{
+    esp_err_t ret = ESP_OK;
+
+    if (len == 0) {
+        return ESP_OK;
+    }
+
+    ESP_LOGD(TAG, "Byte written %lu, update size %lu", this->bytes_written, this->update_size);
     if (len > this->update_size - this->bytes_written) {
         ESP_LOGE(TAG, "too large %d > %lu", len, this->update_size - this->bytes_written);
         return ESP_ERR_INVALID_SIZE;
     }
 
-    prev_usecTimeCount = (uint32_t)(esp_timer_get_time() & 0x00000000ffffffff);
-
-    ESP_LOGI(TAG, "Writing %d bytes handle %ld", len, this->update_handle);
+    ESP_LOGD(TAG, "Writing %d bytes handle %ld", len, this->update_handle);
     ret = esp_ota_write( update_handle, data, len);
     if (ret != ESP_OK) {
-        esp_ota_abort(update_handle);
-        ESP_LOGE(TAG, "esp_ota_write failed");
+        ESP_LOGE(TAG, "esp_ota_write failed (%s)", esp_err_to_name(ret));
         goto err;
     }
 
     this->bytes_written += len;
 
-    // percentWritten = (this->bytes_written * 99) / this->update_size;
-    // usecTimeCount = (uint32_t)(esp_timer_get_time() & 0x00000000ffffffff);
-    // ESP_LOGI(TAG, "esp_ota_write time %lu percent written %u",
-    //                  usecTimeCount - prev_usecTimeCount, percentWritten);
-    // this->progress_callback(percentWritten);
+    if (this->progress_callback) {
+        this->progress_callback((uint8_t)(((uint64_t) this->bytes_written * 100) / this->update_size));
+    }
 
 err:
     return ret;
@@ -99,6 +213,27 @@ esp_err_t FwUpdater::end(bool evenIfRemaining)
         return ESP_ERR_INVALID_STATE;
     }
 
+    if (this->format == e_fw_format_unknown) {
+        // Shorter than a header, cannot be an image but let the checks say so.
+        this->format = e_fw_format_raw;
+        ret = this->write_flash(this->header, this->header_length);
+        if (ret != ESP_OK) {
+            return ret;
+        }
+    }
+
+    if (this->format == e_fw_format_compressed) {
+        ret = this->write_compressed(nullptr, 0);
+        if (ret != ESP_OK) {
+            return ret;
+        }
+
+        if (!this->decoder.is_finished()) {
+            ESP_LOGE(TAG, "Compressed image truncated");
+            return ESP_ERR_INVALID_SIZE;
+        }
+    }
+
     if (this->bytes_written != this->update_size) {
         if (!evenIfRemaining) {
             return ESP_ERR_INVALID_SIZE;
@@ -126,11 +261,9 @@ esp_err_t FwUpdater::end(bool evenIfRemaining)
     ESP_LOGI(TAG, "esp_ota_set_boot_partition succeeded");
 
 err:
-    // Clear the update
+    // Clear the update, the counters stay for the caller until the next begin
     this->update_partition = nullptr;
-    this->update_size = 0;
     this->update_handle = 0;
-    this->bytes_written = 0;
 
     return ret;
 }
@@ -143,8 +276,17 @@ void FwUpdater::abort()
     if (this->update_handle) {
         esp_ota_abort(this->update_handle);
     }
-    this->update_size = 0;
     this->update_handle = 0;
+    this->clear();
+}
+
+//****************************************************************************************
+void FwUpdater::clear(void)
+{
+    this->update_size = 0;
     this->bytes_written = 0;
+    this->bytes_received = 0;
+    this->format = e_fw_format_unknown;
+    this->header_length = 0;
 }
 
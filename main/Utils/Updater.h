@@ -1,7 +1,9 @@
 #pragma once
 
 #include "Singleton.h"
+#include "HeatshrinkDecoder.h"
 
+#include <atomic>
 #include <functional>
 
 #include "esp_partition.h"
@@ -12,6 +14,9 @@
 #define UPDATE_SIZE_UNKNOWN 0xFFFFFFFF
 #define ENCRYPTED_BLOCK_SIZE 16
 
+// Decompressed bytes per esp_ota_write.
+#define FW_UPDATER_DECODE_BUFFER_SIZE 2048
+
 class FwUpdater : public Singleton<FwUpdater>
 {
 public:
@@ -29,7 +34,7 @@ public:
      *
      * Call this to check the space needed for the update
      *
-     * @param  size: size of the update
+     * @param  size: size of the update as transferred, compressed or not
      *
      * @retval ESP_OK if the write was successful, ESP_FAIL if not
      */
@@ -41,6 +46,9 @@ public:
      *
      * Writes a buffer to the flash and increments the address, returns the amount written
      *
+     * A compressed image (FW_IMAGE_MAGIC header) is decompressed on the way,
+     * anything else is written as is.
+     *
      * @param  data: pointer to the data to write
      * @param  len: length of the data to write
      *
@@ -74,13 +82,38 @@ public:
      */
     void abort();
 
+    // A pull update owns the partition, begin() is refused until it is done.
+    inline void set_pull_active(bool active) { this->pull_active = active; }
+    inline bool is_running(void) const { return this->update_partition != nullptr; }
+
+    // Still valid after end(), until the next begin().
+    inline uint32_t get_bytes_received(void) const { return this->bytes_received; }
+    inline uint32_t get_bytes_written(void) const { return this->bytes_written; }
+    inline bool is_compressed(void) const { return this->format == e_fw_format_compressed; }
+
+protected:
+    esp_err_t write_header(uint8_t *data, size_t len, size_t &used);
+    esp_err_t write_compressed(const uint8_t *data, size_t len);
+    esp_err_t write_flash(const uint8_t *data, size_t len);
+    void clear(void);
+
 private:
+    typedef enum {
+        e_fw_format_unknown,            // header not seen yet
+        e_fw_format_raw,
+        e_fw_format_compressed,
+    } fw_format_t;
+
     const esp_partition_t * update_partition = nullptr;
-    uint32_t update_size = 0;
+    uint32_t update_size = 0;           // in flash, the image size once decompressed
     uint32_t bytes_written = 0;
+    uint32_t bytes_received = 0;
+    fw_format_t format = e_fw_format_unknown;
+    uint8_t header[FW_IMAGE_HEADER_LENGTH];
+    size_t header_length = 0;
+    HeatshrinkDecoder decoder;
+    uint8_t decode_buffer[FW_UPDATER_DECODE_BUFFER_SIZE];
     esp_ota_handle_t update_handle = 0;
     fn_progress_callback_t progress_callback = nullptr;
-
-    // String _target_md5;
-    // MD5Builder _md5;
+    std::atomic<bool> pull_active{false};
 };
@@ -13,6 +13,7 @@
 #include "iot_provisioning.h"
 
 #include "Utils/FuseMacAddress.h"
+#include "Utils/ScratchArena.h"
 #include "App/Configuration/ThingConfig.h"
 
 #include "ArduinoJson.h"
@@ -53,6 +54,10 @@
  * a buffer of 8,192 bytes to be safe.
  */
 #define MAX_HTTP_OUTPUT_BUFFER 8192
+
+// The response buffer is leased from the scratch arena while the udp server
+// may be using it.
+#define RESPONSE_BUFFER_WAIT_MS 5000
 #define PROVISION_URL "https://b98kqoy2h3.execute-api.us-east-1.amazonaws.com/dev/provision"
 #define UNPROVISION_URL "https://b98kqoy2h3.execute-api.us-east-1.amazonaws.com/dev/unprovision"
 #define STR_IS_EQUAL(str1, str2) (strncasecmp(str1, str2, strlen(str2)) == 0)
@@ -60,13 +65,12 @@
 
 static const char * TAG = "iot";
 
-static char response_buffer[MAX_HTTP_OUTPUT_BUFFER + 1] = {0};
-
 //*****************************************************************************
 // Local function prototypes
 
 static int make_http_call(const char* url, const char* username, const char* password, char* response_buffer);
 static bool register_thing_from_http_response(const char* response_buffer);
+static bool unprovision_device_with_buffer(const char* url, const char* username, const char* password, char* response_buffer);
 
 //*****************************************************************************
 // Public functions implementation
@@ -77,6 +81,12 @@ bool provision_device(const char* url, const char* username, const char* passwor
     ESP_LOGD(TAG, "username %s", username);
     ESP_LOGD(TAG, "password %s", password);
 
+    ScratchLease response(MAX_HTTP_OUTPUT_BUFFER + 1, RESPONSE_BUFFER_WAIT_MS);
+    if (!response.is_leased()) {
+        ESP_LOGE(TAG, "No room for the response");
+        return false;
+    }
+    char* response_buffer = response.data();
     memset(response_buffer, 0, MAX_HTTP_OUTPUT_BUFFER + 1);
 
     bool ret = false; // assume failure
@@ -93,11 +103,12 @@ bool provision_device(const char* url, const char* username, const char* passwor
         case 409:
             ESP_LOGI(TAG, "Looks like this board was previously provisioned");
             ESP_LOGI(TAG, "Lets try to unprovision it!!!");
-            if (!unprovision_device(url, username, password)) {
+            if (!unprovision_device_with_buffer(url, username, password, response_buffer)) {
                 ESP_LOGE(TAG, "Failed to unprovision");
             } else {
                 ESP_LOGI(TAG, "Unprovisioned successfully");
                 ESP_LOGI(TAG, "Trying to provision again");
+                memset(response_buffer, 0, MAX_HTTP_OUTPUT_BUFFER + 1);
                 status_code = make_http_call(
                     STR_IS_EMPTY(url) ? PROVISION_URL : url, 
                     username, password,
@@ -130,6 +141,22 @@ bool provision_device(const char* url, const char* username, const char* passwor
 
 //*****************************************************************************
 bool unprovision_device(const char* url, const char* username, const char* password) {
+    ScratchLease response(MAX_HTTP_OUTPUT_BUFFER + 1, RESPONSE_BUFFER_WAIT_MS);
+    if (!response.is_leased()) {
+        ESP_LOGE(TAG, "No room for the response");
+        return false;
+    }
+    return unprovision_device_with_buffer(url, username, password, response.data());
+}
+
+//*****************************************************************************
+// Local functions implementation
+
+//*****************************************************************************
+/**
+ * @brief Unprovision, the response goes in the caller's buffer.
+ */
+static bool unprovision_device_with_buffer(const char* url, const char* username, const char* password, char* response_buffer) {
     ESP_LOGD(TAG, "username %s", username);
     ESP_LOGD(TAG, "password %s", password);
 
@@ -150,9 +177,6 @@ bool unprovision_device(const char* url, const char* username, const char* passw
     return ret;
 }
 
-//*****************************************************************************
-// Local functions implementation
-
 //*****************************************************************************
 /**
  * @brief Process the response from the provisioning service
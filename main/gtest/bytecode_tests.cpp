@@ -0,0 +1,260 @@
+//******************************************************************************
+/**
+ * @file bytecode_tests.cpp
+ * @author pat laplante (plaplante@appliedlogix.com)
+ *
+ * @brief Unit testing and benchmark for the animation bytecode
+ * @version 0.1
+ * @date 2024-02-27
+ *
+ * The benchmark runs the charging bar as a program against the built-in
+ * ChargingAnimationWhiteBubble.
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+
+#include <gtest/gtest.h>
+#include "LED/Animations/BytecodeAnimation.h"
+#include "LED/Animations/ChargingAnimationWhiteBubble.h"
+
+#include <chrono>
+#include <vector>
+
+#define LED_COUNT   (32)
+
+#define RATE(ms)    ANIMATION_PROGRAM_MAGIC, ANIMATION_PROGRAM_VERSION, (uint8_t)((ms) >> 8), (uint8_t)(ms)
+#define BLUE        0x00, 0x00, 0xFF
+#define WHITE       0xFF, 0xFF, 0xFF
+#define RED         0xFF, 0x00, 0x00
+
+// The charging bar: blue up to the charge, white above, a white bubble
+// running up the blue part.
+static const uint8_t charging_bar[] = {
+    RATE(50),
+    e_anim_op_input, 0, e_anim_input_led_count,     // 0
+    e_anim_op_input, 1, e_anim_input_charge,        // 3
+    e_anim_op_scale, 2, 0, 1,                       // 6    r2 = leds lit
+    e_anim_op_loadi, 3, 0, 0,                       // 10   r3 = 0
+    e_anim_op_loadi, 4, 0, 1,                       // 14   r4 = 1
+    e_anim_op_jlt, 4, 2, 0, 27,                     // 18   at least one lit
+    e_anim_op_loadi, 2, 0, 1,                       // 23
+    e_anim_op_fill, WHITE,                          // 27
+    e_anim_op_segment, 3, 2, BLUE,                  // 31
+    e_anim_op_chase, 3, 2, 1, WHITE,                // 37
+    e_anim_op_end,                                  // 44
+};
+
+static animation_program_t make_program(const uint8_t* data, size_t length) {
+    animation_program_t program = {};
+    memcpy(program.data, data, length);
+    program.length = length;
+    return program;
+}
+
+static void expect_pixel(const uint8_t* pixels, int i, uint8_t r, uint8_t g, uint8_t b) {
+    EXPECT_EQ(g, pixels[i * 3 + 0]) << "pixel " << i;
+    EXPECT_EQ(r, pixels[i * 3 + 1]) << "pixel " << i;
+    EXPECT_EQ(b, pixels[i * 3 + 2]) << "pixel " << i;
+}
+
+//******************************************************************************
+/**
+ * @brief   Programs are checked before they are stored
+ *
+ */
+TEST(bytecode_animation, validate)
+{
+    EXPECT_EQ(ESP_OK, BytecodeAnimation::validate(charging_bar, sizeof(charging_bar)));
+
+    std::vector<uint8_t> program(charging_bar, charging_bar + sizeof(charging_bar));
+    EXPECT_EQ(ESP_ERR_INVALID_SIZE, BytecodeAnimation::validate(program.data(), ANIMATION_PROGRAM_HEADER_LENGTH));
+    EXPECT_EQ(ESP_ERR_INVALID_SIZE, BytecodeAnimation::validate(nullptr, 0));
+
+    std::vector<uint8_t> bad = program;
+    bad[0] = 0;
+    EXPECT_EQ(ESP_ERR_INVALID_VERSION, BytecodeAnimation::validate(bad.data(), bad.size()));
+    bad = program;
+    bad[1] = ANIMATION_PROGRAM_VERSION + 1;
+    EXPECT_EQ(ESP_ERR_INVALID_VERSION, BytecodeAnimation::validate(bad.data(), bad.size()));
+
+    // Refreshing faster than a tick.
+    bad = program;
+    bad[2] = 0;
+    bad[3] = 5;
+    EXPECT_EQ(ESP_ERR_INVALID_ARG, BytecodeAnimation::validate(bad.data(), bad.size()));
+
+    // Instruction cut short.
+    EXPECT_EQ(ESP_ERR_INVALID_ARG, BytecodeAnimation::validate(program.data(), program.size() - 3));
+
+    // Register out of range.
+    bad = program;
+    bad[ANIMATION_PROGRAM_HEADER_LENGTH + 1] = ANIMATION_REGISTER_COUNT;
+    EXPECT_EQ(ESP_ERR_INVALID_ARG, BytecodeAnimation::validate(bad.data(), bad.size()));
+
+    // Unknown input.
+    bad = program;
+    bad[ANIMATION_PROGRAM_HEADER_LENGTH + 2] = e_anim_input_count;
+    EXPECT_EQ(ESP_ERR_INVALID_ARG, BytecodeAnimation::validate(bad.data(), bad.size()));
+
+    // Unknown opcode.
+    bad = program;
+    bad[ANIMATION_PROGRAM_HEADER_LENGTH + 44] = 0x7F;
+    EXPECT_EQ(ESP_ERR_INVALID_ARG, BytecodeAnimation::validate(bad.data(), bad.size()));
+
+    // Jump into the middle of an instruction, past the end.
+    bad = program;
+    bad[ANIMATION_PROGRAM_HEADER_LENGTH + 22] = 28;
+    EXPECT_EQ(ESP_ERR_INVALID_ARG, BytecodeAnimation::validate(bad.data(), bad.size()));
+    bad[ANIMATION_PROGRAM_HEADER_LENGTH + 22] = 45;
+    EXPECT_EQ(ESP_ERR_INVALID_ARG, BytecodeAnimation::validate(bad.data(), bad.size()));
+
+    // Too long.
+    std::vector<uint8_t> longer = program;
+    longer.resize(ANIMATION_PROGRAM_MAX_LENGTH + 1, e_anim_op_end);
+    EXPECT_EQ(ESP_ERR_INVALID_SIZE, BytecodeAnimation::validate(longer.data(), longer.size()));
+}
+
+//******************************************************************************
+/**
+ * @brief   The charging bar, rate from the header, bubble moving up
+ *
+ */
+TEST(bytecode_animation, charging_bar)
+{
+    BytecodeAnimation animation;
+    animation.reset(make_program(charging_bar, sizeof(charging_bar)), 50);
+    EXPECT_EQ(50u, animation.get_rate());
+
+    uint8_t pixels[LED_COUNT * 3];
+    for (int frame = 0; frame < 20; frame++) {
+        ASSERT_EQ(LED_COUNT, animation.refresh(pixels, 0, LED_COUNT));
+        for (int i = 0; i < LED_COUNT; i++) {
+            if (i == frame % 16 || i >= 16) {
+                expect_pixel(pixels, i, WHITE);
+            } else {
+                expect_pixel(pixels, i, BLUE);
+            }
+        }
+    }
+
+    // Nothing charged still shows one pixel.
+    animation.reset(make_program(charging_bar, sizeof(charging_bar)), 0);
+    animation.refresh(pixels, 0, LED_COUNT);
+    expect_pixel(pixels, 0, WHITE);
+    expect_pixel(pixels, 1, WHITE);
+    EXPECT_EQ(0u, animation.get_budget_exceeded());
+}
+
+//******************************************************************************
+/**
+ * @brief   Gradient end points, pulse levels, clipping, start pixel
+ *
+ */
+TEST(bytecode_animation, primitives)
+{
+    const uint8_t gradient[] = {
+        RATE(100),
+        e_anim_op_loadi, 0, 0xFF, 0xFE,             // r0 = -2, clipped
+        e_anim_op_loadi, 1, 0, 6,                   // r1 = 6
+        e_anim_op_fill, 0, 0, 0,
+        e_anim_op_gradient, 0, 1, RED, BLUE,
+    };
+    ASSERT_EQ(ESP_OK, BytecodeAnimation::validate(gradient, sizeof(gradient)));
+
+    BytecodeAnimation animation;
+    animation.reset(make_program(gradient, sizeof(gradient)));
+
+    uint8_t pixels[(LED_COUNT + 2) * 3] = {};
+    animation.refresh(pixels, 2, 8);
+    expect_pixel(pixels, 0, 0, 0, 0);
+    expect_pixel(pixels, 1, 0, 0, 0);
+    expect_pixel(pixels, 2 + 0, 0x99, 0, 0x66);      // 3rd step of 5
+    expect_pixel(pixels, 2 + 3, 0, 0, 0xFF);
+    expect_pixel(pixels, 2 + 4, 0, 0, 0);
+
+    const uint8_t pulse[] = {
+        RATE(20),
+        e_anim_op_loadi, 0, 0, 10,                  // 10 frames
+        e_anim_op_pulse, 0, 51, RED,
+    };
+    ASSERT_EQ(ESP_OK, BytecodeAnimation::validate(pulse, sizeof(pulse)));
+    animation.reset(make_program(pulse, sizeof(pulse)));
+
+    int levels[10];
+    for (int frame = 0; frame < 10; frame++) {
+        animation.refresh(pixels, 0, LED_COUNT);
+        levels[frame] = pixels[1];
+        EXPECT_EQ(pixels[1], pixels[(LED_COUNT - 1) * 3 + 1]);
+    }
+    EXPECT_EQ(51, levels[0]);
+    EXPECT_EQ(255, levels[5]);
+    EXPECT_LT(levels[2], levels[3]);
+    EXPECT_GT(levels[7], levels[8]);
+}
+
+//******************************************************************************
+/**
+ * @brief   A program that never ends stops at the budget, math never traps
+ *
+ */
+TEST(bytecode_animation, budget)
+{
+    const uint8_t forever[] = {
+        RATE(10),
+        e_anim_op_loadi, 0, 0, 0,                   // 0
+        e_anim_op_div, 1, 1, 0,                     // 4    by 0
+        e_anim_op_mod, 2, 1, 0,                     // 8    by 0
+        e_anim_op_fill, RED,                        // 12
+        e_anim_op_jmp, 0, 4,                        // 16
+    };
+    ASSERT_EQ(ESP_OK, BytecodeAnimation::validate(forever, sizeof(forever)));
+
+    BytecodeAnimation animation;
+    animation.reset(make_program(forever, sizeof(forever)));
+
+    uint8_t pixels[LED_COUNT * 3] = {};
+    EXPECT_EQ(LED_COUNT, animation.refresh(pixels, 0, LED_COUNT));
+    EXPECT_EQ(1u, animation.get_budget_exceeded());
+    expect_pixel(pixels, LED_COUNT - 1, RED);
+}
+
+//******************************************************************************
+/**
+ * @brief   Time per frame, printed for comparison, not checked.
+ *
+ */
+TEST(bytecode_animation, benchmark)
+{
+    const int iterations = 100000;
+    uint8_t pixels[LED_COUNT * 3];
+    uint32_t checksum = 0;
+
+    BytecodeAnimation program;
+    program.reset(make_program(charging_bar, sizeof(charging_bar)), 50);
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        program.refresh(pixels, 0, LED_COUNT);
+        checksum += pixels[0];
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    double program_ns = std::chrono::duration<double, std::nano>(elapsed).count() / iterations;
+
+    ChargingAnimationWhiteBubble built_in;
+    built_in.reset(0x0000FF, 0xFFFFFF, 0xFFFFFF, 50);
+    built_in.set_charge_percent(50);
+
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        built_in.refresh(pixels, 0, LED_COUNT);
+        checksum += pixels[0];
+    }
+    elapsed = std::chrono::steady_clock::now() - start;
+    double built_in_ns = std::chrono::duration<double, std::nano>(elapsed).count() / iterations;
+
+    EXPECT_NE(0u, checksum);
+    EXPECT_EQ(0u, program.get_budget_exceeded());
+    printf("charging bar program         : %.0f ns/frame\n", program_ns);
+    printf("ChargingAnimationWhiteBubble : %.0f ns/frame (%.1fx)\n", built_in_ns, program_ns / built_in_ns);
+}
@@ -0,0 +1,144 @@
+//******************************************************************************
+/**
+ * @file cert_image_tests.cpp
+ * @author pat laplante (plaplante@appliedlogix.com)
+ *
+ * @brief Unit testing for the certificate partition layout
+ * @version 0.1
+ * @date 2024-03-07
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+
+#include <gtest/gtest.h>
+#include "Utils/CertImage.h"
+
+#include <string>
+#include <vector>
+
+// PEM of the bytes, 64 characters a line as AWS sends them.
+static std::string make_pem(const char* label, const std::vector<uint8_t>& der) {
+    static const char* alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string body;
+    for (size_t i = 0; i < der.size(); i += 3) {
+        uint32_t bits = der[i] << 16;
+        if (i + 1 < der.size()) bits |= der[i + 1] << 8;
+        if (i + 2 < der.size()) bits |= der[i + 2];
+        body += alphabet[(bits >> 18) & 0x3f];
+        body += alphabet[(bits >> 12) & 0x3f];
+        body += i + 1 < der.size() ? alphabet[(bits >> 6) & 0x3f] : '=';
+        body += i + 2 < der.size() ? alphabet[bits & 0x3f] : '=';
+    }
+
+    std::string pem = std::string("-----BEGIN ") + label + "-----\n";
+    for (size_t i = 0; i < body.size(); i += 64) {
+        pem += body.substr(i, 64) + "\n";
+    }
+    return pem + "-----END " + label + "-----\n";
+}
+
+static std::vector<uint8_t> make_der(size_t length, uint8_t seed) {
+    std::vector<uint8_t> der(length);
+    for (size_t i = 0; i < length; i++) {
+        der[i] = (uint8_t)(i * 31 + seed);
+    }
+    return der;
+}
+
+//******************************************************************************
+/**
+ * @brief   The armour and whitespace are dropped, the rest decoded
+ *
+ */
+TEST(cert_image, pem_to_der)
+{
+    uint8_t der[16];
+    size_t length = 0;
+    ASSERT_EQ(ESP_OK, cert_pem_to_der("-----BEGIN PUBLIC KEY-----\r\nAAECAwQF\r\nBgc=\r\n-----END PUBLIC KEY-----\r\n", der, sizeof(der), length));
+    ASSERT_EQ(8u, length);
+    for (int i = 0; i < 8; i++) {
+        EXPECT_EQ(i, der[i]);
+    }
+
+    EXPECT_EQ(ESP_ERR_INVALID_SIZE, cert_pem_to_der("-----BEGIN A-----\nAAECAwQF\n-----END A-----\n", der, 5, length));
+    EXPECT_EQ(ESP_ERR_INVALID_ARG, cert_pem_to_der("AAECAwQF", der, sizeof(der), length));
+    EXPECT_EQ(ESP_ERR_INVALID_ARG, cert_pem_to_der("-----BEGIN A-----\nAAECAwQF\n", der, sizeof(der), length));
+    EXPECT_EQ(ESP_ERR_INVALID_ARG, cert_pem_to_der("-----BEGIN A-----\nAAE*AwQF\n-----END A-----\n", der, sizeof(der), length));
+    EXPECT_EQ(ESP_ERR_INVALID_ARG, cert_pem_to_der("-----BEGIN A-----\nAA==AwQF\n-----END A-----\n", der, sizeof(der), length));
+    EXPECT_EQ(ESP_ERR_INVALID_ARG, cert_pem_to_der("-----BEGIN A-----\n-----END A-----\n", der, sizeof(der), length));
+    EXPECT_EQ(ESP_ERR_INVALID_ARG, cert_pem_to_der(nullptr, der, sizeof(der), length));
+}
+
+//******************************************************************************
+/**
+ * @brief   The certificate and keys read back in place, a third smaller
+ *
+ */
+TEST(cert_image, round_trip)
+{
+    std::vector<uint8_t> certificate = make_der(862, 1);
+    std::vector<uint8_t> private_key = make_der(1191, 2);
+    std::string certificate_pem = make_pem("CERTIFICATE", certificate);
+    std::string private_key_pem = make_pem("RSA PRIVATE KEY", private_key);
+    const char* pem[e_cert_slot_count] = { certificate_pem.c_str(), private_key_pem.c_str(), nullptr };
+
+    std::vector<uint8_t> image(CertImage::get_size(pem));
+    size_t length = 0;
+    ASSERT_EQ(ESP_OK, CertImage::build(pem, image.data(), image.size(), length));
+    EXPECT_EQ(sizeof(cert_image_header_t) + certificate.size() + private_key.size(), length);
+
+    // The rest of the partition is erased flash.
+    image.resize(4096, 0xff);
+    CertImage reader(image.data(), image.size());
+    ASSERT_EQ(ESP_OK, reader.check());
+
+    const uint8_t* der = nullptr;
+    size_t der_length = 0;
+    ASSERT_EQ(ESP_OK, reader.get(e_cert_client_certificate, der, der_length));
+    EXPECT_EQ(certificate, std::vector<uint8_t>(der, der + der_length));
+    ASSERT_EQ(ESP_OK, reader.get(e_cert_private_key, der, der_length));
+    EXPECT_EQ(private_key, std::vector<uint8_t>(der, der + der_length));
+    EXPECT_EQ(ESP_ERR_NOT_FOUND, reader.get(e_cert_public_key, der, der_length));
+
+    size_t pem_length = certificate_pem.size() + 1 + private_key_pem.size() + 1;
+    EXPECT_EQ(pem_length, reader.get_pem_length());
+    EXPECT_LT(length * 4, pem_length * 3);
+
+    uint8_t small[64];
+    EXPECT_EQ(ESP_ERR_INVALID_SIZE, CertImage::build(pem, small, sizeof(small), length));
+}
+
+//******************************************************************************
+/**
+ * @brief   Erased, damaged and foreign partitions are refused
+ *
+ */
+TEST(cert_image, rejected)
+{
+    std::vector<uint8_t> erased(4096, 0xff);
+    EXPECT_EQ(ESP_ERR_NOT_FOUND, CertImage(erased.data(), erased.size()).check());
+    EXPECT_EQ(ESP_ERR_INVALID_SIZE, CertImage(erased.data(), 8).check());
+
+    std::string pem_text = make_pem("CERTIFICATE", make_der(300, 3));
+    const char* pem[e_cert_slot_count] = { pem_text.c_str(), nullptr, nullptr };
+    std::vector<uint8_t> image(CertImage::get_size(pem));
+    size_t length = 0;
+    ASSERT_EQ(ESP_OK, CertImage::build(pem, image.data(), image.size(), length));
+    image.resize(length);
+    ASSERT_EQ(ESP_OK, CertImage(image.data(), image.size()).check());
+
+    EXPECT_EQ(ESP_ERR_INVALID_SIZE, CertImage(image.data(), length - 1).check());
+
+    std::vector<uint8_t> corrupted = image;
+    corrupted[length - 10] ^= 0x01;
+    EXPECT_EQ(ESP_ERR_INVALID_CRC, CertImage(corrupted.data(), corrupted.size()).check());
+
+    corrupted = image;
+    corrupted[offsetof(cert_image_header_t, entries) + 4] ^= 0x01;
+    EXPECT_NE(ESP_OK, CertImage(corrupted.data(), corrupted.size()).check());
+
+    corrupted = image;
+    corrupted[offsetof(cert_image_header_t, version)] = 9;
+    EXPECT_EQ(ESP_ERR_INVALID_VERSION, CertImage(corrupted.data(), corrupted.size()).check());
+}
@@ -0,0 +1,102 @@
+//******************************************************************************
+/**
+ * @file command_table_tests.cpp
+ * @author pat laplante (plaplante@appliedlogix.com)
+ *
+ * @brief Unit testing for the udp command table
+ * @version 0.1
+ * @date 2024-02-28
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+
+#include <gtest/gtest.h>
+#include "App/CommandTable.h"
+
+#include <string.h>
+
+static const char* names[] = {
+    "get-chargepoint-config", "set-chargepoint-config", "unprovision-chargepoint",
+    "provision-aws", "get-info", "reboot", "set-led-debug-state", "refresh-proxy",
+    "get-latest-from-proxy", "factory-reset", "set-site-info", "set-led-length",
+    "set-animation", "get-command-stats",
+};
+
+//******************************************************************************
+/**
+ * @brief   Whole names in any case, index in the order added
+ *
+ */
+TEST(command_table, lookup)
+{
+    CommandTable table;
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        ASSERT_EQ((int) i, table.add(names[i]));
+    }
+    EXPECT_EQ(-1, table.add("get-info"));
+    EXPECT_EQ(-1, table.add("Get-Info"));
+    EXPECT_EQ(sizeof(names) / sizeof(names[0]), table.size());
+
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        EXPECT_EQ((int) i, table.find(names[i], strlen(names[i])));
+        EXPECT_STREQ(names[i], table.get_name(i));
+    }
+
+    // Any case, as the old strncasecmp did.
+    EXPECT_EQ(4, table.find("GET-INFO", 8));
+    EXPECT_EQ(4, table.find("Get-Info", 8));
+
+    // The old prefix match took these.
+    EXPECT_EQ(-1, table.find("get-info-please", 15));
+    EXPECT_EQ(-1, table.find("get-inf", 7));
+    EXPECT_EQ(-1, table.find("", 0));
+    EXPECT_EQ(-1, table.find(nullptr, 0));
+
+    // Not null terminated.
+    const char* datagram = "rebooting";
+    EXPECT_EQ(5, table.find(datagram, 6));
+}
+
+//******************************************************************************
+/**
+ * @brief   Calls, errors and time per command
+ *
+ */
+TEST(command_table, stats)
+{
+    CommandTable table;
+    int get_info = table.add("get-info");
+    int reboot = table.add("reboot");
+
+    table.record(get_info, 100, true);
+    table.record(get_info, 300, false);
+    table.record(-1, 1000, true);
+    table.record(7, 1000, true);
+
+    const command_stats_t& stats = table.get_stats(get_info);
+    EXPECT_EQ(2u, stats.calls);
+    EXPECT_EQ(1u, stats.errors);
+    EXPECT_EQ(400u, stats.total_us);
+    EXPECT_EQ(300u, stats.max_us);
+    EXPECT_EQ(0u, table.get_stats(reboot).calls);
+}
+
+//******************************************************************************
+/**
+ * @brief   A full table refuses more
+ *
+ */
+TEST(command_table, full)
+{
+    CommandTable table;
+    static char generated[COMMAND_TABLE_MAX_COMMANDS + 1][8];
+    for (int i = 0; i < COMMAND_TABLE_MAX_COMMANDS; i++) {
+        snprintf(generated[i], sizeof(generated[i]), "cmd-%d", i);
+        ASSERT_EQ(i, table.add(generated[i]));
+    }
+    EXPECT_EQ(-1, table.add("one-more"));
+    for (int i = 0; i < COMMAND_TABLE_MAX_COMMANDS; i++) {
+        EXPECT_EQ(i, table.find(generated[i], strlen(generated[i])));
+    }
+}
@@ -0,0 +1,178 @@
+//******************************************************************************
+/**
+ * @file config_blob_tests.cpp
+ * @author pat laplante (plaplante@appliedlogix.com)
+ *
+ * @brief Unit testing for the configuration blob
+ * @version 0.1
+ * @date 2024-03-06
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+
+#include <gtest/gtest.h>
+#include "Utils/ConfigBlob.h"
+
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+// The fields of the thing configuration, certificate and key included.
+static std::vector<uint8_t> write_thing(uint16_t version, const std::string& pem, const char* public_key) {
+    std::vector<uint8_t> blob(ConfigBlobWriter::get_size(4, pem.size() + 32));
+    ConfigBlobWriter writer(blob.data(), blob.size(), version);
+    writer.begin(4);
+    writer.str("thingName", "mn8-ab12cd34ef56");
+    writer.str("certificatePem", pem.c_str());
+    writer.str("publicKey", public_key);
+    writer.integer("l1_port_number", 2);
+
+    size_t length = 0;
+    EXPECT_EQ(ESP_OK, writer.finish(length));
+    blob.resize(length);
+    return blob;
+}
+
+//******************************************************************************
+/**
+ * @brief   What is written is read back, nil strings included
+ *
+ */
+TEST(config_blob, round_trip)
+{
+    EXPECT_EQ(0xcbf43926u, config_blob_crc32((const uint8_t*) "123456789", 9));
+
+    std::string pem(1200, 'C');
+    std::vector<uint8_t> blob = write_thing(1, pem, nullptr);
+    EXPECT_LT(blob.size(), pem.size() + 100);
+
+    ConfigBlobReader reader;
+    ASSERT_EQ(ESP_OK, reader.open(blob.data(), blob.size(), 1));
+    EXPECT_EQ(1, reader.get_version());
+
+    char* thing_name = nullptr;
+    char* certificate = nullptr;
+    char* public_key = strdup("stale");
+    uint8_t port = 0;
+    char field[CONFIG_BLOB_FIELD_MAX_LENGTH + 1];
+    int fields = 0;
+    while (reader.next_field(field, sizeof(field))) {
+        std::string name(field);
+        if (name == "thingName") reader.read_str(thing_name);
+        else if (name == "certificatePem") reader.read_str(certificate);
+        else if (name == "publicKey") reader.read_str(public_key);
+        else if (name == "l1_port_number") reader.read_u8(port);
+        fields++;
+    }
+    ASSERT_EQ(ESP_OK, reader.finish());
+    EXPECT_EQ(4, fields);
+    EXPECT_STREQ("mn8-ab12cd34ef56", thing_name);
+    EXPECT_EQ(pem, certificate);
+    EXPECT_EQ(nullptr, public_key);
+    EXPECT_EQ(2, port);
+    free(thing_name);
+    free(certificate);
+
+    // Read into fixed buffers, as the wifi credentials are.
+    char small[8];
+    char large[32];
+    ASSERT_EQ(ESP_OK, reader.open(blob.data(), blob.size(), 1));
+    while (reader.next_field(field, sizeof(field))) {
+        std::string name(field);
+        if (name == "thingName") reader.read_str(large, sizeof(large));
+        else if (name == "publicKey") reader.read_str(small, sizeof(small));
+        else reader.skip();
+    }
+    ASSERT_EQ(ESP_OK, reader.finish());
+    EXPECT_STREQ("mn8-ab12cd34ef56", large);
+    EXPECT_STREQ("", small);
+
+    ASSERT_EQ(ESP_OK, reader.open(blob.data(), blob.size(), 1));
+    while (reader.next_field(field, sizeof(field))) {
+        reader.read_str(small, sizeof(small));
+    }
+    EXPECT_EQ(ESP_ERR_INVALID_SIZE, reader.finish());
+}
+
+//******************************************************************************
+/**
+ * @brief   Truncated, corrupted and newer blobs are refused
+ *
+ */
+TEST(config_blob, rejected)
+{
+    std::vector<uint8_t> blob = write_thing(2, "pem", "key");
+    ConfigBlobReader reader;
+    EXPECT_EQ(ESP_OK, reader.open(blob.data(), blob.size(), 3));
+    EXPECT_EQ(ESP_ERR_INVALID_VERSION, reader.open(blob.data(), blob.size(), 1));
+
+    EXPECT_EQ(ESP_ERR_INVALID_SIZE, reader.open(nullptr, 0, 2));
+    EXPECT_EQ(ESP_ERR_INVALID_SIZE, reader.open(blob.data(), CONFIG_BLOB_HEADER_SIZE - 1, 2));
+    EXPECT_EQ(ESP_ERR_INVALID_SIZE, reader.open(blob.data(), blob.size() - 1, 2));
+
+    std::vector<uint8_t> corrupted = blob;
+    corrupted[CONFIG_BLOB_HEADER_SIZE + 3] ^= 0x10;
+    EXPECT_EQ(ESP_ERR_INVALID_CRC, reader.open(corrupted.data(), corrupted.size(), 2));
+
+    corrupted = blob;
+    corrupted[0] = 'X';
+    EXPECT_EQ(ESP_ERR_INVALID_VERSION, reader.open(corrupted.data(), corrupted.size(), 2));
+
+    // A failed open leaves nothing to read.
+    char field[CONFIG_BLOB_FIELD_MAX_LENGTH + 1];
+    EXPECT_FALSE(reader.next_field(field, sizeof(field)));
+    EXPECT_EQ(ESP_ERR_INVALID_VERSION, reader.finish());
+
+    // Too small a buffer is reported at the end.
+    uint8_t tiny[CONFIG_BLOB_HEADER_SIZE + 8];
+    ConfigBlobWriter writer(tiny, sizeof(tiny), 1);
+    writer.begin(1);
+    writer.str("thingName", "mn8-ab12cd34ef56");
+    size_t length = 0;
+    EXPECT_EQ(ESP_ERR_INVALID_SIZE, writer.finish(length));
+}
+
+//******************************************************************************
+/**
+ * @brief   A value of the wrong type, or fields left unread, fail the read
+ *
+ */
+TEST(config_blob, wrong_types)
+{
+    std::vector<uint8_t> blob = write_thing(1, "pem", "key");
+    ConfigBlobReader reader;
+    char field[CONFIG_BLOB_FIELD_MAX_LENGTH + 1];
+
+    bool enabled = false;
+    ASSERT_EQ(ESP_OK, reader.open(blob.data(), blob.size(), 1));
+    ASSERT_TRUE(reader.next_field(field, sizeof(field)));
+    reader.read_bool(enabled);
+    EXPECT_FALSE(reader.next_field(field, sizeof(field)));
+    EXPECT_EQ(ESP_ERR_INVALID_RESPONSE, reader.finish());
+
+    ASSERT_EQ(ESP_OK, reader.open(blob.data(), blob.size(), 1));
+    ASSERT_TRUE(reader.next_field(field, sizeof(field)));
+    reader.skip();
+    EXPECT_EQ(ESP_ERR_INVALID_RESPONSE, reader.finish());
+
+    // A port number that doesn't fit.
+    uint8_t buffer[64];
+    ConfigBlobWriter writer(buffer, sizeof(buffer), 1);
+    writer.begin(2);
+    writer.integer("ip", 0xc0a80101);
+    writer.integer("port", 300);
+    size_t length = 0;
+    ASSERT_EQ(ESP_OK, writer.finish(length));
+
+    uint32_t ip = 0;
+    uint8_t port = 0;
+    ASSERT_EQ(ESP_OK, reader.open(buffer, length, 1));
+    ASSERT_TRUE(reader.next_field(field, sizeof(field)));
+    reader.read_u32(ip);
+    ASSERT_TRUE(reader.next_field(field, sizeof(field)));
+    reader.read_u8(port);
+    EXPECT_EQ(ESP_ERR_INVALID_RESPONSE, reader.finish());
+    EXPECT_EQ(0xc0a80101u, ip);
+    EXPECT_EQ(0, port);
+}
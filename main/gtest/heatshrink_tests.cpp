@@ -0,0 +1,163 @@
+//******************************************************************************
+/**
+ * @file heatshrink_tests.cpp
+ * @author pat laplante (plaplante@appliedlogix.com)
+ *
+ * @brief Unit testing for the compressed firmware images
+ * @version 0.1
+ * @date 2024-02-29
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+
+#include <gtest/gtest.h>
+#include "Utils/HeatshrinkDecoder.h"
+#include "host/HeatshrinkEncoder.h"
+
+#include <random>
+#include <vector>
+
+// Too large for the stack, the window is 4 KB.
+static HeatshrinkDecoder decoder;
+
+//******************************************************************************
+/**
+ * @brief Feed the stream in random pieces, take the output in small ones.
+ */
+static std::vector<uint8_t> decode_all(const std::vector<uint8_t>& stream, std::mt19937& random, size_t out_size) {
+    std::vector<uint8_t> decoded;
+    std::vector<uint8_t> out(out_size);
+    size_t offset = 0;
+
+    while (true) {
+        size_t length = std::min(stream.size() - offset, (size_t)(random() % 300));
+        size_t consumed;
+        size_t produced = decoder.decode(stream.data() + offset, length, consumed, out.data(), out.size());
+        decoded.insert(decoded.end(), out.begin(), out.begin() + produced);
+        offset += consumed;
+        if (offset == stream.size() && produced == 0) {
+            break;
+        }
+    }
+    return decoded;
+}
+
+//******************************************************************************
+/**
+ * @brief   Literals and an overlapping back reference, bit by bit
+ *
+ */
+TEST(heatshrink, known_stream)
+{
+    // 1 'a', 1 'b', 1 'c', 0 index 2 count 2, 5 bits of padding
+    const uint8_t stream[] = { 0xB0, 0xD8, 0xAC, 0x62, 0x40 };
+
+    const char* text = "abcabc";
+    std::vector<uint8_t> encoded = heatshrink_encode((const uint8_t*) text, 6, 4, 3);
+    EXPECT_EQ(std::vector<uint8_t>(stream, stream + sizeof(stream)), encoded);
+
+    ASSERT_EQ(ESP_OK, decoder.reset(4, 3));
+    uint8_t out[16];
+    size_t consumed;
+    EXPECT_EQ(6u, decoder.decode(stream, sizeof(stream), consumed, out, sizeof(out)));
+    EXPECT_EQ(sizeof(stream), consumed);
+    EXPECT_EQ(0, memcmp(text, out, 6));
+    EXPECT_TRUE(decoder.is_finished());
+
+    // Run of one byte, the copy reads what it writes.
+    std::vector<uint8_t> run(100, 'x');
+    encoded = heatshrink_encode(run.data(), run.size(), 8, 4);
+    EXPECT_LT(encoded.size(), 20u);
+    ASSERT_EQ(ESP_OK, decoder.reset(8, 4));
+    std::mt19937 random(1);
+    EXPECT_EQ(run, decode_all(encoded, random, 7));
+    EXPECT_TRUE(decoder.is_finished());
+}
+
+//******************************************************************************
+/**
+ * @brief   Round trips over the window sizes, cut anywhere
+ *
+ */
+TEST(heatshrink, round_trip)
+{
+    std::mt19937 random(42);
+
+    // Something like code: repeated sequences with noise in between.
+    std::vector<uint8_t> data;
+    while (data.size() < 50000) {
+        if (data.size() > 64 && random() % 3 != 0) {
+            size_t back = 1 + random() % std::min(data.size(), (size_t) 6000);
+            size_t count = 2 + random() % 40;
+            for (size_t i = 0; i < count; i++) {
+                data.push_back(data[data.size() - back]);
+            }
+        } else {
+            data.push_back((uint8_t) random());
+        }
+    }
+
+    const uint8_t windows[][2] = { { 4, 3 }, { 8, 4 }, { 10, 5 }, { 12, 4 }, { 12, 11 } };
+    for (const auto& window : windows) {
+        std::vector<uint8_t> encoded = heatshrink_encode(data.data(), data.size(), window[0], window[1]);
+        if (window[0] >= 10) {
+            EXPECT_LT(encoded.size(), data.size() * 3 / 4) << (int) window[0];
+        }
+
+        for (size_t out_size : { (size_t) 1, (size_t) 37, (size_t) 2048 }) {
+            ASSERT_EQ(ESP_OK, decoder.reset(window[0], window[1]));
+            EXPECT_EQ(data, decode_all(encoded, random, out_size)) << (int) window[0] << "/" << (int) window[1] << " out " << out_size;
+            EXPECT_TRUE(decoder.is_finished());
+        }
+    }
+
+    // Random data grows by an eighth at most, empty stays empty.
+    std::vector<uint8_t> noise(4096);
+    for (auto& byte : noise) {
+        byte = (uint8_t) random();
+    }
+    EXPECT_LE(heatshrink_encode(noise.data(), noise.size(), 12, 4).size(), noise.size() * 9 / 8 + 1);
+    EXPECT_TRUE(heatshrink_encode(nullptr, 0, 12, 4).empty());
+}
+
+//******************************************************************************
+/**
+ * @brief   Header, truncation and window limits
+ *
+ */
+TEST(heatshrink, image_header)
+{
+    std::vector<uint8_t> data(3000, 0x5A);
+    std::vector<uint8_t> image = fw_image_compress(data.data(), data.size(), 12, 4);
+
+    fw_image_header_t header = {};
+    ASSERT_EQ(ESP_OK, fw_image_parse_header(image.data(), image.size(), &header));
+    EXPECT_EQ(12, header.window_bits);
+    EXPECT_EQ(4, header.lookahead_bits);
+    EXPECT_EQ(3000u, header.image_size);
+
+    EXPECT_EQ(ESP_ERR_INVALID_SIZE, fw_image_parse_header(image.data(), FW_IMAGE_HEADER_LENGTH - 1, &header));
+
+    // A plain ESP image.
+    const uint8_t raw[] = { 0xE9, 0x05, 0x02, 0x20, 0, 0, 0, 0, 0, 0, 0, 0 };
+    EXPECT_EQ(ESP_ERR_NOT_FOUND, fw_image_parse_header(raw, sizeof(raw), &header));
+    EXPECT_EQ(ESP_ERR_NOT_FOUND, fw_image_parse_header(image.data(), 2, &header));
+
+    std::vector<uint8_t> bad = image;
+    bad[4] = FW_IMAGE_VERSION + 1;
+    EXPECT_EQ(ESP_ERR_INVALID_VERSION, fw_image_parse_header(bad.data(), bad.size(), &header));
+
+    EXPECT_EQ(ESP_ERR_INVALID_ARG, decoder.reset(HEATSHRINK_MAX_WINDOW_BITS + 1, 4));
+    EXPECT_EQ(ESP_ERR_INVALID_ARG, decoder.reset(HEATSHRINK_MIN_WINDOW_BITS - 1, 3));
+    EXPECT_EQ(ESP_ERR_INVALID_ARG, decoder.reset(8, 8));
+    EXPECT_EQ(ESP_ERR_INVALID_ARG, decoder.reset(8, HEATSHRINK_MIN_LOOKAHEAD_BITS - 1));
+
+    // Cut in the middle of a literal.
+    const uint8_t stream[] = { 0xB0, 0xD8 };
+    ASSERT_EQ(ESP_OK, decoder.reset(4, 3));
+    uint8_t out[16];
+    size_t consumed;
+    EXPECT_EQ(1u, decoder.decode(stream, sizeof(stream), consumed, out, sizeof(out)));
+    EXPECT_FALSE(decoder.is_finished());
+}
@@ -0,0 +1,262 @@
+//******************************************************************************
+/**
+ * @file keystore_tests.cpp
+ * @author pat laplante (plaplante@appliedlogix.com)
+ *
+ * @brief Unit testing for the key store write cache
+ * @version 0.1
+ * @date 2024-03-05
+ *
+ * The nvs layer is a map, the calls that wear the flash are counted.
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+
+#include <gtest/gtest.h>
+#include "Utils/KeyStoreCache.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+class MockNvs : public KeyStoreBackend {
+public:
+    esp_err_t init(void) override { this->inits++; return ESP_OK; }
+    esp_err_t erase_all(void) override { this->values.clear(); this->erase_alls++; return ESP_OK; }
+
+    esp_err_t open(const char* name, nvs_handle_t& handle) override {
+        this->opens++;
+        handle = this->names.size() + 1;
+        this->names.push_back(name);
+        return ESP_OK;
+    }
+    void close(nvs_handle_t handle) override { this->closes++; }
+
+    esp_err_t get(nvs_handle_t handle, const char* key, keystore_type_t type, void* value, size_t& length) override {
+        auto it = this->values.find(this->make_key(handle, key));
+        if (it == this->values.end() || it->second.first != type) {
+            return ESP_ERR_NVS_NOT_FOUND;
+        }
+        if (value != nullptr) {
+            if (length < it->second.second.size()) {
+                return ESP_ERR_NVS_INVALID_LENGTH;
+            }
+            memcpy(value, it->second.second.data(), it->second.second.size());
+        }
+        length = it->second.second.size();
+        return ESP_OK;
+    }
+
+    esp_err_t set(nvs_handle_t handle, const char* key, keystore_type_t type, const void* value, size_t length) override {
+        this->sets++;
+        const uint8_t* bytes = (const uint8_t*) value;
+        this->values[this->make_key(handle, key)] = { type, std::vector<uint8_t>(bytes, bytes + length) };
+        return ESP_OK;
+    }
+
+    esp_err_t erase(nvs_handle_t handle, const char* key) override {
+        if (this->values.erase(this->make_key(handle, key)) == 0) {
+            return ESP_ERR_NVS_NOT_FOUND;
+        }
+        this->erases++;
+        return ESP_OK;
+    }
+
+    esp_err_t commit(nvs_handle_t handle) override { this->commits++; return ESP_OK; }
+
+    std::string make_key(nvs_handle_t handle, const char* key) { return this->names[handle - 1] + "/" + key; }
+
+    // The writes that reach the flash.
+    int wear(void) const { return this->sets + this->erases; }
+
+    std::vector<std::string> names;
+    std::map<std::string, std::pair<keystore_type_t, std::vector<uint8_t>>> values;
+    int inits = 0, opens = 0, closes = 0, sets = 0, erases = 0, commits = 0, erase_alls = 0;
+};
+
+static void set_str(KeyStoreCache& cache, int ns, const char* key, const std::string& value, uint32_t now_ms) {
+    ASSERT_EQ(ESP_OK, cache.set(ns, key, e_keystore_str, value.c_str(), value.size() + 1, now_ms));
+}
+
+static void set_u16(KeyStoreCache& cache, int ns, const char* key, uint16_t value, uint32_t now_ms) {
+    ASSERT_EQ(ESP_OK, cache.set(ns, key, e_keystore_u16, &value, sizeof(value), now_ms));
+}
+
+// What provision-aws and the wifi setup write, the way the configuration
+// classes do: each field saved, the whole config saved again at the end.
+static void provision(KeyStoreCache& cache, uint32_t now_ms) {
+    int thing, network, config;
+    ASSERT_EQ(ESP_OK, cache.open("thing", thing));
+    ASSERT_EQ(ESP_OK, cache.open("wifi", network));
+    ASSERT_EQ(ESP_OK, cache.open("config", config));
+
+    for (int pass = 0; pass < 2; pass++) {
+        set_str(cache, thing, "thing_name", "mn8-ab12cd34ef56", now_ms);
+        set_str(cache, thing, "endpoint", "a1b2c3d4e5f6g7-ats.iot.us-east-1.amazonaws.com", now_ms);
+        set_str(cache, thing, "certificate", std::string(1200, 'C'), now_ms);
+        set_str(cache, thing, "private_key", std::string(1600, 'K'), now_ms);
+
+        set_str(cache, network, "ssid", "charging-site", now_ms);
+        set_str(cache, network, "password", "s3cr3t-passw0rd", now_ms);
+        set_u16(cache, network, "mode", 1, now_ms);
+        set_u16(cache, network, "auth", 3, now_ms);
+        set_u16(cache, network, "dhcp", 1, now_ms);
+
+        set_u16(cache, config, "encoding", 1, now_ms);
+        set_u16(cache, config, "group_slot", 2, now_ms);
+    }
+}
+
+//******************************************************************************
+/**
+ * @brief   A provisioning is one commit per namespace, each key written once
+ *
+ */
+TEST(keystore_cache, provisioning)
+{
+    MockNvs nvs;
+    KeyStoreCache cache(nvs);
+
+    provision(cache, 0);
+    EXPECT_EQ(1, nvs.inits);
+    EXPECT_EQ(3, nvs.opens);
+    EXPECT_EQ(0, nvs.commits);
+    EXPECT_EQ(4, nvs.sets);             // the certificate and key, twice
+
+    EXPECT_EQ(ESP_OK, cache.flush());
+    EXPECT_EQ(3, nvs.commits);
+    EXPECT_EQ(4 + 9, nvs.wear());
+    EXPECT_EQ(0, cache.get_pending());
+    EXPECT_EQ(1u, cache.get_flushes());
+
+    // Written through KeyStore as it was, every set committed on its own
+    // in a namespace opened for it, that was 22 inits, opens, sets and
+    // commits.  Saving the same again only rewrites the long values.
+    provision(cache, 1000);
+    EXPECT_EQ(ESP_OK, cache.flush());
+    EXPECT_EQ(1, nvs.inits);
+    EXPECT_EQ(3, nvs.opens);
+    EXPECT_EQ(4 + 9 + 4, nvs.sets);
+    EXPECT_EQ(3 + 1, nvs.commits);
+
+    // Nothing written, nothing committed.
+    EXPECT_EQ(ESP_OK, cache.flush());
+    EXPECT_EQ(4, nvs.commits);
+}
+
+//******************************************************************************
+/**
+ * @brief   Reads see the writes not flushed yet, erases included
+ *
+ */
+TEST(keystore_cache, pending_reads)
+{
+    MockNvs nvs;
+    KeyStoreCache cache(nvs);
+    int ns;
+    ASSERT_EQ(ESP_OK, cache.open("config", ns));
+
+    set_u16(cache, ns, "group_slot", 7, 0);
+    ASSERT_EQ(ESP_OK, cache.flush());
+    set_u16(cache, ns, "group_slot", 9, 10);
+    set_str(cache, ns, "lan_key", "00112233", 10);
+
+    uint16_t slot = 0;
+    size_t length = sizeof(slot);
+    ASSERT_EQ(ESP_OK, cache.get(ns, "group_slot", e_keystore_u16, &slot, length));
+    EXPECT_EQ(9, slot);
+    uint8_t narrow;
+    length = sizeof(narrow);
+    EXPECT_EQ(ESP_ERR_NVS_NOT_FOUND, cache.get(ns, "group_slot", e_keystore_u8, &narrow, length));
+
+    length = 0;
+    ASSERT_EQ(ESP_OK, cache.get(ns, "lan_key", e_keystore_str, nullptr, length));
+    EXPECT_EQ(9u, length);
+    char hex[4];
+    length = sizeof(hex);
+    EXPECT_EQ(ESP_ERR_NVS_INVALID_LENGTH, cache.get(ns, "lan_key", e_keystore_str, hex, length));
+
+    ASSERT_EQ(ESP_OK, cache.erase(ns, "group_slot", 20));
+    length = sizeof(slot);
+    EXPECT_EQ(ESP_ERR_NVS_NOT_FOUND, cache.get(ns, "group_slot", e_keystore_u16, &slot, length));
+
+    ASSERT_EQ(ESP_OK, cache.flush());
+    EXPECT_EQ(1, nvs.erases);
+    EXPECT_EQ(0u, nvs.values.count("config/group_slot"));
+    EXPECT_EQ(1u, nvs.values.count("config/lan_key"));
+
+    // Erasing what isn't there is fine.
+    ASSERT_EQ(ESP_OK, cache.erase(ns, "group_slot", 30));
+    EXPECT_EQ(ESP_OK, cache.flush());
+    EXPECT_EQ(1, nvs.erases);
+}
+
+//******************************************************************************
+/**
+ * @brief   Flushed once the writes stop for the quiet period, or when full
+ *
+ */
+TEST(keystore_cache, quiet_period)
+{
+    MockNvs nvs;
+    KeyStoreCache cache(nvs);
+    int ns;
+    ASSERT_EQ(ESP_OK, cache.open("config", ns));
+
+    set_u16(cache, ns, "a", 1, 1000);
+    EXPECT_EQ(ESP_OK, cache.flush_if_quiet(1000 + KEYSTORE_CACHE_QUIET_MS - 100));
+    set_u16(cache, ns, "b", 2, 1000 + KEYSTORE_CACHE_QUIET_MS - 100);
+    EXPECT_EQ(ESP_OK, cache.flush_if_quiet(1000 + KEYSTORE_CACHE_QUIET_MS));
+    EXPECT_EQ(0, nvs.commits);
+    EXPECT_EQ(2, cache.get_pending());
+
+    EXPECT_EQ(ESP_OK, cache.flush_if_quiet(1000 + 2 * KEYSTORE_CACHE_QUIET_MS - 100));
+    EXPECT_EQ(1, nvs.commits);
+    EXPECT_EQ(2, nvs.sets);
+
+    char key[8];
+    for (int i = 0; i <= KEYSTORE_CACHE_MAX_PENDING; i++) {
+        snprintf(key, sizeof(key), "k%d", i);
+        set_u16(cache, ns, key, i, 5000);
+    }
+    EXPECT_EQ(2, nvs.commits);
+    EXPECT_EQ(2 + KEYSTORE_CACHE_MAX_PENDING, nvs.sets);
+    EXPECT_EQ(1, cache.get_pending());
+}
+
+//******************************************************************************
+/**
+ * @brief   Limits, and the factory reset dropping everything
+ *
+ */
+TEST(keystore_cache, erase_all)
+{
+    MockNvs nvs;
+    KeyStoreCache cache(nvs);
+    int ns;
+    EXPECT_EQ(ESP_ERR_INVALID_ARG, cache.open("a_namespace_too_long", ns));
+    ASSERT_EQ(ESP_OK, cache.open("config", ns));
+    uint16_t value = 1;
+    EXPECT_EQ(ESP_ERR_INVALID_ARG, cache.set(ns, "a_key_much_too_long", e_keystore_u16, &value, sizeof(value), 0));
+    EXPECT_EQ(ESP_ERR_INVALID_ARG, cache.set(ns + 1, "key", e_keystore_u16, &value, sizeof(value), 0));
+
+    char name[8];
+    for (int i = 1; i < KEYSTORE_CACHE_MAX_NAMESPACES; i++) {
+        snprintf(name, sizeof(name), "ns%d", i);
+        ASSERT_EQ(ESP_OK, cache.open(name, ns));
+    }
+    EXPECT_EQ(ESP_ERR_NO_MEM, cache.open("one_more", ns));
+
+    set_u16(cache, ns, "dropped", 1, 0);
+    ASSERT_EQ(ESP_OK, cache.erase_all());
+    EXPECT_EQ(0, cache.get_pending());
+    EXPECT_EQ(KEYSTORE_CACHE_MAX_NAMESPACES, nvs.closes);
+    EXPECT_EQ(1, nvs.erase_alls);
+
+    ASSERT_EQ(ESP_OK, cache.open("config", ns));
+    EXPECT_EQ(2, nvs.inits);
+    EXPECT_EQ(0, ns);
+    EXPECT_EQ(ESP_OK, cache.flush());
+    EXPECT_EQ(0, nvs.sets);
+}
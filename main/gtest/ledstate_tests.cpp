@@ -0,0 +1,641 @@
+//******************************************************************************
+/**
+ * @file ledstate_tests.cpp
+ * @author pat laplante (plaplante@appliedlogix.com)
+ *
+ * @brief Unit testing and benchmark for the ledstate parser
+ * @version 0.1
+ * @date 2024-02-07
+ *
+ * @copyright Copyright MN8 (c) 2024
+ *
+ * The benchmark runs the parser against the ArduinoJson path we used to have
+ * in MN8App when the ArduinoJson submodule is checked out.
+ */
+//******************************************************************************
+
+#include <string.h>
+#include <string>
+#include <chrono>
+
+#include <gtest/gtest.h>
+#include "App/MqttAgent/LedStateParser.h"
+#include "App/LedStateSequencer.h"
+
+#ifdef HAVE_ARDUINOJSON
+#include "ArduinoJson.h"
+#endif
+
+static const char* typical_payload =
+    "{\"night_mode\": false, "
+    "\"port0\": {\"state\": \"charging\", \"charge_percent\": 57}, "
+    "\"port1\": {\"state\": \"available\", \"charge_percent\": 0}}";
+
+//******************************************************************************
+/**
+ * @brief   String to enum and back
+ *
+ */
+TEST(led_state, strings)
+{
+    for (int i = e_station_available; i <= e_station_no_connection; i++) {
+        led_state_t state = (led_state_t) i;
+        const char* name = led_state_to_string(state);
+        EXPECT_EQ(state, led_state_from_string(name, strlen(name)));
+    }
+
+    EXPECT_EQ(e_station_charging, led_state_from_string("chargingXX", 8));
+    EXPECT_EQ(e_station_unknown, led_state_from_string("chargin", 7));
+    EXPECT_EQ(e_station_unknown, led_state_from_string("", 0));
+}
+
+//******************************************************************************
+/**
+ * @brief   Typical ledstate message
+ *
+ */
+TEST(ledstate_parser, typical)
+{
+    ledstate_message_t message;
+    ASSERT_EQ(ESP_OK, ledstate_parse(typical_payload, strlen(typical_payload), &message));
+
+    EXPECT_TRUE(message.has_night_mode);
+    EXPECT_FALSE(message.night_mode);
+    EXPECT_TRUE(message.port[0].has_state);
+    EXPECT_EQ(e_station_charging, message.port[0].state);
+    EXPECT_EQ(57, message.port[0].charge_percent);
+    EXPECT_TRUE(message.port[1].has_state);
+    EXPECT_EQ(e_station_available, message.port[1].state);
+    EXPECT_EQ(0, message.port[1].charge_percent);
+}
+
+//******************************************************************************
+/**
+ * @brief   Missing and unknown fields
+ *
+ */
+TEST(ledstate_parser, partial)
+{
+    const char* payload =
+        "{\"id\":\"a\\\"b\",\"extra\":[1,{\"x\":null},true],"
+        "\"port1\":{\"charge_percent\":12.9,\"state\":\"reserved\",\"more\":{}},"
+        "\"night_mode\":true}";
+
+    ledstate_message_t message;
+    ASSERT_EQ(ESP_OK, ledstate_parse(payload, strlen(payload), &message));
+
+    EXPECT_TRUE(message.has_night_mode);
+    EXPECT_TRUE(message.night_mode);
+    EXPECT_FALSE(message.port[0].has_state);
+    EXPECT_TRUE(message.port[1].has_state);
+    EXPECT_EQ(e_station_reserved, message.port[1].state);
+    EXPECT_EQ(12, message.port[1].charge_percent);
+
+    // Unknown state names are not applied, the other port still is.
+    payload = "{\"port0\":{\"state\":\"bogus\"},\"port1\":{\"state\":\"offline\"}}";
+    ASSERT_EQ(ESP_OK, ledstate_parse(payload, strlen(payload), &message));
+    EXPECT_FALSE(message.has_night_mode);
+    EXPECT_FALSE(message.port[0].has_state);
+    EXPECT_TRUE(message.port[1].has_state);
+    EXPECT_EQ(e_station_offline, message.port[1].state);
+}
+
+//******************************************************************************
+/**
+ * @brief   The payload does not need to be null terminated
+ *
+ */
+TEST(ledstate_parser, not_null_terminated)
+{
+    char buffer[128];
+    const char* payload = "{\"port0\":{\"state\":\"offline\"}}";
+    memset(buffer, '}', sizeof(buffer));
+    memcpy(buffer, payload, strlen(payload));
+
+    ledstate_message_t message;
+    ASSERT_EQ(ESP_OK, ledstate_parse(buffer, strlen(payload), &message));
+    EXPECT_EQ(e_station_offline, message.port[0].state);
+
+    // Cut in the middle of the message.
+    EXPECT_EQ(ESP_ERR_INVALID_ARG, ledstate_parse(buffer, strlen(payload) - 2, &message));
+}
+
+//******************************************************************************
+/**
+ * @brief   Malformed messages
+ *
+ */
+TEST(ledstate_parser, malformed)
+{
+    const char* payloads[] = {
+        "",
+        "[]",
+        "\"port0\"",
+        "{\"port0\"}",
+        "{\"port0\":{\"state\":\"charging\"}",
+        "{\"night_mode\":tru}",
+        "{\"port0\":{\"state\":\"charging\"},}",
+        "{\"a\":[[[[[[[[[[1]]]]]]]]]]}",
+    };
+
+    ledstate_message_t message;
+    for (const char* payload : payloads) {
+        EXPECT_EQ(ESP_ERR_INVALID_ARG, ledstate_parse(payload, strlen(payload), &message)) << payload;
+    }
+}
+
+//******************************************************************************
+/**
+ * @brief   Optional sequence number
+ *
+ */
+TEST(ledstate_parser, seq)
+{
+    const char* payload = "{\"seq\":4294967295,\"port0\":{\"state\":\"offline\"}}";
+    ledstate_message_t message;
+    ASSERT_EQ(ESP_OK, ledstate_parse(payload, strlen(payload), &message));
+    EXPECT_TRUE(message.has_seq);
+    EXPECT_EQ(4294967295u, message.seq);
+
+    payload = "{\"seq\":-1,\"port0\":{\"state\":\"offline\"}}";
+    ASSERT_EQ(ESP_OK, ledstate_parse(payload, strlen(payload), &message));
+    EXPECT_FALSE(message.has_seq);
+
+    ASSERT_EQ(ESP_OK, ledstate_parse(typical_payload, strlen(typical_payload), &message));
+    EXPECT_FALSE(message.has_seq);
+}
+
+static ledstate_message_t make_message(bool has_seq, uint32_t seq, led_state_t port0, int charge_percent) {
+    ledstate_message_t message = {};
+    message.has_seq = has_seq;
+    message.seq = seq;
+    message.port[0].has_state = true;
+    message.port[0].state = port0;
+    message.port[0].charge_percent = charge_percent;
+    message.port[1].state = e_station_unknown;
+    return message;
+}
+
+static ledstate_message_t make_lan_message(uint64_t session, uint32_t seq, led_state_t port0, int charge_percent) {
+    ledstate_message_t message = make_message(true, seq, port0, charge_percent);
+    message.has_session = true;
+    message.session = session;
+    return message;
+}
+
+//******************************************************************************
+/**
+ * @brief   Stale, duplicate and restart with sequence numbers
+ *
+ */
+TEST(ledstate_sequencer, seq)
+{
+    LedStateSequencer sequencer;
+    ledstate_message_t current = make_message(false, 0, e_station_available, 0);
+    ledstate_message_t message;
+
+    message = make_message(true, 10, e_station_charging, 20);
+    EXPECT_EQ(e_ledstate_apply, sequencer.check(message, current));
+    current = make_message(false, 0, e_station_charging, 20);
+
+    // Late delivery of an older state.
+    message = make_message(true, 9, e_station_available, 0);
+    EXPECT_EQ(e_ledstate_stale, sequencer.check(message, current));
+
+    // Re-published on the next poll.
+    message = make_message(true, 10, e_station_charging, 20);
+    EXPECT_EQ(e_ledstate_duplicate, sequencer.check(message, current));
+
+    // Same seq but the leds were overridden locally, apply again.
+    current = make_message(false, 0, e_station_no_connection, 0);
+    message = make_message(true, 10, e_station_charging, 20);
+    EXPECT_EQ(e_ledstate_apply, sequencer.check(message, current));
+    current = make_message(false, 0, e_station_charging, 20);
+
+    message = make_message(true, 11, e_station_charging, 30);
+    EXPECT_EQ(e_ledstate_apply, sequencer.check(message, current));
+    current = make_message(false, 0, e_station_charging, 30);
+
+    // Proxy restarted.
+    message = make_message(true, 0, e_station_available, 0);
+    EXPECT_EQ(e_ledstate_apply, sequencer.check(message, current));
+    current = make_message(false, 0, e_station_available, 0);
+
+    message = make_message(true, 5000, e_station_charging, 1);
+    EXPECT_EQ(e_ledstate_apply, sequencer.check(message, current));
+    message = make_message(true, 3, e_station_reserved, 0);
+    EXPECT_EQ(e_ledstate_apply, sequencer.check(message, current));
+    message = make_message(true, 2, e_station_offline, 0);
+    EXPECT_EQ(e_ledstate_stale, sequencer.check(message, current));
+
+    // Wrap around.
+    sequencer.reset();
+    message = make_message(true, 0xFFFFFFFE, e_station_charging, 1);
+    EXPECT_EQ(e_ledstate_apply, sequencer.check(message, current));
+    message = make_message(true, 1, e_station_charging, 2);
+    EXPECT_EQ(e_ledstate_apply, sequencer.check(message, current));
+    message = make_message(true, 0xFFFFFFFF, e_station_charging, 3);
+    EXPECT_EQ(e_ledstate_stale, sequencer.check(message, current));
+
+    const ledstate_counters_t& counters = sequencer.get_counters();
+    EXPECT_EQ(8u, counters.applied);
+    EXPECT_EQ(3u, counters.dropped_stale);
+    EXPECT_EQ(1u, counters.dropped_duplicate);
+}
+
+//******************************************************************************
+/**
+ * @brief   Without sequence numbers only unchanged ports are dropped
+ *
+ */
+TEST(ledstate_sequencer, unsequenced)
+{
+    LedStateSequencer sequencer;
+    ledstate_message_t current = make_message(false, 0, e_station_charging, 20);
+    current.port[1].state = e_station_available;
+
+    ledstate_message_t message = make_message(false, 0, e_station_charging, 20);
+    message.port[1].has_state = true;
+    message.port[1].state = e_station_reserved;
+    message.has_night_mode = true;
+    message.night_mode = false;
+
+    EXPECT_EQ(e_ledstate_apply, sequencer.check(message, current));
+    EXPECT_FALSE(message.port[0].has_state);
+    EXPECT_TRUE(message.port[1].has_state);
+    EXPECT_FALSE(message.has_night_mode);
+
+    current.port[1].state = e_station_reserved;
+    message = make_message(false, 0, e_station_charging, 20);
+    EXPECT_EQ(e_ledstate_duplicate, sequencer.check(message, current));
+
+    // Unsequenced messages are never stale.
+    message = make_message(true, 100, e_station_charging, 21);
+    EXPECT_EQ(e_ledstate_apply, sequencer.check(message, current));
+    message = make_message(false, 0, e_station_charging, 22);
+    EXPECT_EQ(e_ledstate_apply, sequencer.check(message, current));
+}
+
+//******************************************************************************
+/**
+ * @brief   Group and thing ledstates are numbered separately
+ *
+ */
+TEST(ledstate_sequencer, streams)
+{
+    LedStateSequencer sequencer;
+    ledstate_message_t current = make_message(false, 0, e_station_available, 0);
+
+    ledstate_message_t message = make_message(true, 500, e_station_charging, 10);
+    EXPECT_EQ(e_ledstate_apply, sequencer.check(message, current, e_ledstate_stream_thing));
+    current = make_message(false, 0, e_station_charging, 10);
+
+    // Way behind the thing seq, but the group has its own.
+    message = make_message(true, 3, e_station_charging, 20);
+    EXPECT_EQ(e_ledstate_apply, sequencer.check(message, current, e_ledstate_stream_group));
+    current = make_message(false, 0, e_station_charging, 20);
+
+    message = make_message(true, 2, e_station_reserved, 0);
+    EXPECT_EQ(e_ledstate_stale, sequencer.check(message, current, e_ledstate_stream_group));
+    message = make_message(true, 501, e_station_charging, 30);
+    EXPECT_EQ(e_ledstate_apply, sequencer.check(message, current));
+
+    EXPECT_EQ(3u, sequencer.get_counters().applied);
+    EXPECT_EQ(1u, sequencer.get_counters().dropped_stale);
+}
+
+//******************************************************************************
+/**
+ * @brief   The lan stream never restarts and never takes the same seq twice
+ *
+ */
+TEST(ledstate_sequencer, lan_strict)
+{
+    LedStateSequencer sequencer;
+    sequencer.start_lan_session(0x1234);
+    ledstate_message_t current = make_message(false, 0, e_station_available, 0);
+
+    ledstate_message_t message = make_lan_message(0x1234, 5000, e_station_charging, 10);
+    EXPECT_EQ(e_ledstate_apply, sequencer.check(message, current, e_ledstate_stream_lan));
+
+    // A replay of the same datagram after the leds moved on.
+    message = make_lan_message(0x1234, 5000, e_station_charging, 10);
+    EXPECT_EQ(e_ledstate_stale, sequencer.check(message, current, e_ledstate_stream_lan));
+
+    // Would be a proxy restart on mqtt.
+    message = make_lan_message(0x1234, 0, e_station_reserved, 0);
+    EXPECT_EQ(e_ledstate_stale, sequencer.check(message, current, e_ledstate_stream_lan));
+    message = make_lan_message(0x1234, 1, e_station_reserved, 0);
+    EXPECT_EQ(e_ledstate_stale, sequencer.check(message, current, e_ledstate_stream_lan));
+
+    // Forgetting the mqtt seqs keeps the lan one.
+    sequencer.reset();
+    message = make_lan_message(0x1234, 5000, e_station_reserved, 0);
+    EXPECT_EQ(e_ledstate_stale, sequencer.check(message, current, e_ledstate_stream_lan));
+
+    message = make_lan_message(0x1234, 5001, e_station_reserved, 0);
+    EXPECT_EQ(e_ledstate_apply, sequencer.check(message, current, e_ledstate_stream_lan));
+
+    // Without a session, or before one is started.
+    message = make_message(true, 5002, e_station_charging, 30);
+    EXPECT_EQ(e_ledstate_wrong_session, sequencer.check(message, current, e_ledstate_stream_lan));
+    LedStateSequencer closed;
+    message = make_lan_message(0, 1, e_station_charging, 30);
+    EXPECT_EQ(e_ledstate_wrong_session, closed.check(message, current, e_ledstate_stream_lan));
+}
+
+//******************************************************************************
+/**
+ * @brief   The datagrams captured before a reboot are refused after it
+ *
+ * The seq is only kept in ram, the session drawn at boot is what changes.
+ */
+TEST(ledstate_sequencer, lan_replay_after_reboot)
+{
+    ledstate_message_t current = make_message(false, 0, e_station_available, 0);
+    ledstate_message_t captured[3];
+
+    {
+        LedStateSequencer before_reboot;
+        before_reboot.start_lan_session(0x1111222233334444ull);
+        for (uint32_t seq = 1; seq <= 3; seq++) {
+            captured[seq - 1] = make_lan_message(0x1111222233334444ull, seq, e_station_charging, seq * 10);
+            ledstate_message_t message = captured[seq - 1];
+            EXPECT_EQ(e_ledstate_apply, before_reboot.check(message, current, e_ledstate_stream_lan));
+            current = make_message(false, 0, e_station_charging, seq * 10);
+        }
+    }
+
+    LedStateSequencer after_reboot;
+    after_reboot.start_lan_session(0x5555666677778888ull);
+    current = make_message(false, 0, e_station_available, 0);
+    for (ledstate_message_t message : captured) {
+        EXPECT_EQ(e_ledstate_wrong_session, after_reboot.check(message, current, e_ledstate_stream_lan));
+    }
+    EXPECT_EQ(3u, after_reboot.get_counters().dropped_stale);
+    EXPECT_EQ(0u, after_reboot.get_counters().applied);
+
+    // The gateway signs for the new session and carries on from its seq.
+    ledstate_message_t message = make_lan_message(0x5555666677778888ull, 4, e_station_reserved, 0);
+    EXPECT_EQ(e_ledstate_apply, after_reboot.check(message, current, e_ledstate_stream_lan));
+}
+
+//******************************************************************************
+/**
+ * @brief   A gateway that restarts its counter starts a new session
+ *
+ */
+TEST(ledstate_sequencer, lan_gateway_restart)
+{
+    LedStateSequencer sequencer;
+    sequencer.start_lan_session(0xaaaa);
+    ledstate_message_t current = make_message(false, 0, e_station_available, 0);
+
+    ledstate_message_t message = make_lan_message(0xaaaa, 900, e_station_charging, 10);
+    EXPECT_EQ(e_ledstate_apply, sequencer.check(message, current, e_ledstate_stream_lan));
+    current = make_message(false, 0, e_station_charging, 10);
+    ledstate_message_t captured = make_lan_message(0xaaaa, 901, e_station_charging, 90);
+
+    // Back to 1 in the same session, locked out.
+    message = make_lan_message(0xaaaa, 1, e_station_reserved, 0);
+    EXPECT_EQ(e_ledstate_stale, sequencer.check(message, current, e_ledstate_stream_lan));
+
+    sequencer.start_lan_session(0xbbbb);
+    EXPECT_EQ(0xbbbbu, sequencer.get_lan_session());
+    message = make_lan_message(0xbbbb, 1, e_station_reserved, 0);
+    EXPECT_EQ(e_ledstate_apply, sequencer.check(message, current, e_ledstate_stream_lan));
+    current = make_message(false, 0, e_station_reserved, 0);
+
+    // Newer than anything sent in the new session, but signed for the old one.
+    EXPECT_EQ(e_ledstate_wrong_session, sequencer.check(captured, current, e_ledstate_stream_lan));
+
+    message = make_lan_message(0xbbbb, 2, e_station_charging, 20);
+    EXPECT_EQ(e_ledstate_apply, sequencer.check(message, current, e_ledstate_stream_lan));
+}
+
+//******************************************************************************
+/**
+ * @brief   Ledstate command on the udp port, the envelope points at what is signed
+ *
+ */
+TEST(ledstate_parser, lan)
+{
+    const char* datagram =
+        "{\"command\": \"ledstate\", \"ledstate\": {\"seq\": 12, \"port1\": {\"state\": \"charging\"}}, \"hmac\": \"00ff\"}";
+    ledstate_lan_envelope_t envelope;
+    ledstate_message_t message;
+    ASSERT_EQ(ESP_OK, ledstate_parse_lan(datagram, strlen(datagram), &envelope, &message));
+    EXPECT_EQ("{\"seq\": 12, \"port1\": {\"state\": \"charging\"}}", std::string(envelope.ledstate, envelope.ledstate_length));
+    EXPECT_EQ("00ff", std::string(envelope.hmac, envelope.hmac_length));
+    EXPECT_TRUE(message.has_seq);
+    EXPECT_EQ(12u, message.seq);
+    EXPECT_FALSE(message.port[0].has_state);
+    EXPECT_EQ(e_station_charging, message.port[1].state);
+    EXPECT_FALSE(message.has_session);
+
+    const char* with_session =
+        "{\"command\": \"ledstate\", \"ledstate\": {\"session\": \"0123456789abcDEF\", \"seq\": 13}, \"hmac\": \"00ff\"}";
+    ASSERT_EQ(ESP_OK, ledstate_parse_lan(with_session, strlen(with_session), &envelope, &message));
+    EXPECT_TRUE(message.has_session);
+    EXPECT_EQ(0x0123456789abcdefull, message.session);
+    const char* bad_session = "{\"command\": \"ledstate\", \"ledstate\": {\"session\": \"0123\", \"seq\": 13}, \"hmac\": \"00ff\"}";
+    EXPECT_EQ(ESP_ERR_INVALID_ARG, ledstate_parse_lan(bad_session, strlen(bad_session), &envelope, &message));
+
+    // Other commands go the usual way, even when they aren't json.
+    const char* other = "{\"command\": \"get-info\"}";
+    EXPECT_EQ(ESP_ERR_NOT_FOUND, ledstate_parse_lan(other, strlen(other), &envelope, &message));
+    EXPECT_EQ(ESP_ERR_NOT_FOUND, ledstate_parse_lan("hello", 5, &envelope, &message));
+
+    const char* unsigned_datagram = "{\"command\": \"ledstate\", \"ledstate\": {\"seq\": 12}}";
+    EXPECT_EQ(ESP_ERR_INVALID_ARG, ledstate_parse_lan(unsigned_datagram, strlen(unsigned_datagram), &envelope, &message));
+    const char* truncated = "{\"command\": \"ledstate\", \"ledstate\": {\"seq\": 12, \"port1\": ";
+    EXPECT_EQ(ESP_ERR_INVALID_ARG, ledstate_parse_lan(truncated, strlen(truncated), &envelope, &message));
+}
+
+//******************************************************************************
+/**
+ * @brief   Group ledstate, only the part addressed to us is kept
+ *
+ */
+TEST(ledstate_parser, group)
+{
+    ledstate_address_t address = {};
+    address.thing_name = "a0b1c2d3e4f5";
+    address.slot = 2;
+    address.station_id[0] = "ST-1";
+    address.port_number[0] = 1;
+    address.station_id[1] = "ST-1";
+    address.port_number[1] = 2;
+
+    const char* by_slot =
+        "{\"seq\": 7, \"slots\": [{\"port0\": {\"state\": \"faulted\"}}, null, "
+        "{\"port0\": {\"state\": \"charging\", \"charge_percent\": 40}}, {\"port1\": {\"state\": \"offline\"}}]}";
+    ledstate_message_t message;
+    ASSERT_EQ(ESP_OK, ledstate_parse_group(by_slot, strlen(by_slot), address, &message));
+    EXPECT_TRUE(message.has_seq);
+    EXPECT_EQ(7u, message.seq);
+    EXPECT_FALSE(message.has_night_mode);
+    EXPECT_TRUE(message.port[0].has_state);
+    EXPECT_EQ(e_station_charging, message.port[0].state);
+    EXPECT_EQ(40, message.port[0].charge_percent);
+    EXPECT_FALSE(message.port[1].has_state);
+
+    const char* by_name =
+        "{\"things\": {\"000000000000\": {\"port0\": {\"state\": \"faulted\"}}, "
+        "\"a0b1c2d3e4f5\": {\"port1\": {\"state\": \"reserved\"}}}, "
+        "\"stations\": {\"ST-2\": {\"1\": {\"state\": \"faulted\"}}, \"ST-1\": {\"1\": {\"state\": \"available\"}, \"3\": {\"state\": \"faulted\"}}}}";
+    ASSERT_EQ(ESP_OK, ledstate_parse_group(by_name, strlen(by_name), address, &message));
+    EXPECT_FALSE(message.has_seq);
+    EXPECT_EQ(e_station_available, message.port[0].state);
+    EXPECT_EQ(e_station_reserved, message.port[1].state);
+
+    // Night mode is for everyone, the rest is for someone else.
+    const char* broadcast = "{\"night_mode\": true, \"slots\": [null, null, null, {\"port0\": {\"state\": \"faulted\"}}]}";
+    ASSERT_EQ(ESP_OK, ledstate_parse_group(broadcast, strlen(broadcast), address, &message));
+    EXPECT_TRUE(message.has_night_mode);
+    EXPECT_TRUE(message.night_mode);
+    EXPECT_FALSE(message.port[0].has_state);
+
+    const char* others = "{\"seq\": 8, \"slots\": [null, null, null], \"things\": {\"000000000000\": {}}}";
+    EXPECT_EQ(ESP_ERR_NOT_FOUND, ledstate_parse_group(others, strlen(others), address, &message));
+
+    address.slot = -1;
+    EXPECT_EQ(ESP_ERR_NOT_FOUND, ledstate_parse_group(by_slot, strlen(by_slot), address, &message));
+
+    const char* malformed = "{\"slots\": [null, {\"port0\": ]}";
+    EXPECT_EQ(ESP_ERR_INVALID_ARG, ledstate_parse_group(malformed, strlen(malformed), address, &message));
+}
+
+//******************************************************************************
+/**
+ * @brief   Merging a burst keeps the newest state of each port
+ *
+ */
+TEST(ledstate_merge, newest_per_port)
+{
+    ledstate_message_t pending = make_message(true, 1, e_station_charging, 20);
+    pending.port[1].has_state = true;
+    pending.port[1].state = e_station_available;
+
+    // Only port 0 and night mode in the newer message.
+    ledstate_message_t newer = make_message(true, 2, e_station_charging_complete, 0);
+    newer.has_night_mode = true;
+    newer.night_mode = true;
+    ledstate_merge(&pending, newer);
+
+    EXPECT_TRUE(pending.has_seq);
+    EXPECT_EQ(2u, pending.seq);
+    EXPECT_TRUE(pending.has_night_mode);
+    EXPECT_TRUE(pending.night_mode);
+    EXPECT_EQ(e_station_charging_complete, pending.port[0].state);
+    EXPECT_EQ(e_station_available, pending.port[1].state);
+
+    // A message without seq or night mode leaves them alone.
+    ledstate_message_t unsequenced = {};
+    unsequenced.port[1].has_state = true;
+    unsequenced.port[1].state = e_station_reserved;
+    ledstate_merge(&pending, unsequenced);
+
+    EXPECT_EQ(2u, pending.seq);
+    EXPECT_TRUE(pending.night_mode);
+    EXPECT_EQ(e_station_charging_complete, pending.port[0].state);
+    EXPECT_EQ(e_station_reserved, pending.port[1].state);
+}
+
+#ifdef HAVE_ARDUINOJSON
+//******************************************************************************
+/**
+ * @brief   What MN8App used to do for each ledstate.
+ */
+static char ack_payload[2048];
+
+static bool arduinojson_ledstate(const char* payload, size_t length, ledstate_message_t* message) {
+    StaticJsonDocument<512> doc;
+    if (deserializeJson(doc, payload, length)) {
+        return false;
+    }
+
+    JsonObject root = doc.as<JsonObject>();
+    if (root.isNull()) {
+        return false;
+    }
+
+    memset(message, 0, sizeof(ledstate_message_t));
+    if (root.containsKey("night_mode")) {
+        message->has_night_mode = true;
+        message->night_mode = root["night_mode"];
+    }
+
+    const char* ports[] = { "port0", "port1" };
+    for (int i = 0; i < LEDSTATE_PORT_COUNT; i++) {
+        if (root.containsKey(ports[i])) {
+            JsonObject port = root[ports[i]];
+            if (port.containsKey("state")) {
+                const char* state = port["state"];
+                message->port[i].state = led_state_from_string(state, strlen(state));
+                message->port[i].has_state = true;
+                message->port[i].charge_percent = port["charge_percent"];
+            }
+        }
+    }
+
+    memset(ack_payload, 0, sizeof(ack_payload));
+    memcpy(ack_payload, payload, length);
+    return true;
+}
+
+TEST(ledstate_parser, same_as_arduinojson)
+{
+    ledstate_message_t expected;
+    ledstate_message_t message;
+    ASSERT_TRUE(arduinojson_ledstate(typical_payload, strlen(typical_payload), &expected));
+    ASSERT_EQ(ESP_OK, ledstate_parse(typical_payload, strlen(typical_payload), &message));
+
+    EXPECT_EQ(expected.has_night_mode, message.has_night_mode);
+    EXPECT_EQ(expected.night_mode, message.night_mode);
+    for (int i = 0; i < LEDSTATE_PORT_COUNT; i++) {
+        EXPECT_EQ(expected.port[i].state, message.port[i].state);
+        EXPECT_EQ(expected.port[i].charge_percent, message.port[i].charge_percent);
+    }
+}
+#endif
+
+//******************************************************************************
+/**
+ * @brief   Time per message, printed for comparison, not checked.
+ *
+ */
+TEST(ledstate_parser, benchmark)
+{
+    const int iterations = 100000;
+    size_t length = strlen(typical_payload);
+    ledstate_message_t message;
+    int applied = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        if (ledstate_parse(typical_payload, length, &message) == ESP_OK) {
+            applied += message.port[0].charge_percent;
+        }
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    double parser_ns = std::chrono::duration<double, std::nano>(elapsed).count() / iterations;
+    EXPECT_EQ(iterations * 57, applied);
+    printf("ledstate_parse : %.0f ns/message\n", parser_ns);
+
+#ifdef HAVE_ARDUINOJSON
+    applied = 0;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        if (arduinojson_ledstate(typical_payload, length, &message)) {
+            applied += message.port[0].charge_percent;
+        }
+    }
+    elapsed = std::chrono::steady_clock::now() - start;
+    double arduinojson_ns = std::chrono::duration<double, std::nano>(elapsed).count() / iterations;
+    EXPECT_EQ(iterations * 57, applied);
+    printf("ArduinoJson    : %.0f ns/message (%.1fx)\n", arduinojson_ns, arduinojson_ns / parser_ns);
+#else
+    printf("ArduinoJson submodule not checked out, skipping the comparison\n");
+#endif
+}
@@ -0,0 +1,158 @@
+//******************************************************************************
+/**
+ * @file metrics_tests.cpp
+ * @author pat laplante (plaplante@appliedlogix.com)
+ *
+ * @brief Unit testing for the metrics text writer
+ * @version 0.1
+ * @date 2024-03-04
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+
+#include <gtest/gtest.h>
+#include "Utils/Metrics.h"
+
+#include <string>
+#include <vector>
+
+typedef struct {
+    std::string text;
+    std::vector<size_t> chunks;
+    int fail_after = -1;
+} sink_t;
+
+static esp_err_t flush_to_sink(const char* data, size_t length, void* context) {
+    sink_t* sink = (sink_t*) context;
+    if (sink->fail_after == 0) {
+        return ESP_FAIL;
+    }
+    sink->fail_after--;
+    sink->text.append(data, length);
+    sink->chunks.push_back(length);
+    return ESP_OK;
+}
+
+static const uint32_t bounds[] = { 10, 100, 1000 };
+
+static void write_all(MetricsWriter& writer, const MetricHistogram& histogram) {
+    writer.family("mn8_heap_free_bytes", "gauge", "Free heap.");
+    writer.sample("mn8_heap_free_bytes", nullptr, 81236);
+    writer.family("mn8_led_frames_total", "counter", "Frames per strip.");
+    writer.sample("mn8_led_frames_total", "strip=\"0\",result=\"rendered\"", 1523);
+    writer.sample("mn8_led_frames_total", "strip=\"1\",result=\"rendered\"", 5000000000ull);
+    writer.family("mn8_render_us", "histogram", "Render time.");
+    writer.histogram("mn8_render_us", "strip=\"0\"", histogram);
+    writer.histogram("mn8_render_us", "", histogram);
+}
+
+//******************************************************************************
+/**
+ * @brief   Counters, gauges and cumulative histogram buckets
+ *
+ */
+TEST(metrics, format)
+{
+    MetricHistogram histogram(bounds, 3);
+    histogram.observe(0);
+    histogram.observe(10);
+    histogram.observe(11);
+    histogram.observe(500);
+    histogram.observe(70000);
+    EXPECT_EQ(5u, histogram.get_count());
+    EXPECT_EQ(70521u, histogram.get_sum());
+    EXPECT_EQ(2u, histogram.get_bucket(0));
+    EXPECT_EQ(1u, histogram.get_bucket(3));
+
+    char buffer[1024];
+    sink_t sink;
+    MetricsWriter writer(buffer, sizeof(buffer), flush_to_sink, &sink);
+    write_all(writer, histogram);
+    ASSERT_EQ(ESP_OK, writer.finish());
+
+    EXPECT_EQ(
+        "# HELP mn8_heap_free_bytes Free heap.\n"
+        "# TYPE mn8_heap_free_bytes gauge\n"
+        "mn8_heap_free_bytes 81236\n"
+        "# HELP mn8_led_frames_total Frames per strip.\n"
+        "# TYPE mn8_led_frames_total counter\n"
+        "mn8_led_frames_total{strip=\"0\",result=\"rendered\"} 1523\n"
+        "mn8_led_frames_total{strip=\"1\",result=\"rendered\"} 5000000000\n"
+        "# HELP mn8_render_us Render time.\n"
+        "# TYPE mn8_render_us histogram\n"
+        "mn8_render_us_bucket{strip=\"0\",le=\"10\"} 2\n"
+        "mn8_render_us_bucket{strip=\"0\",le=\"100\"} 3\n"
+        "mn8_render_us_bucket{strip=\"0\",le=\"1000\"} 4\n"
+        "mn8_render_us_bucket{strip=\"0\",le=\"+Inf\"} 5\n"
+        "mn8_render_us_sum{strip=\"0\"} 70521\n"
+        "mn8_render_us_count{strip=\"0\"} 5\n"
+        "mn8_render_us_bucket{le=\"10\"} 2\n"
+        "mn8_render_us_bucket{le=\"100\"} 3\n"
+        "mn8_render_us_bucket{le=\"1000\"} 4\n"
+        "mn8_render_us_bucket{le=\"+Inf\"} 5\n"
+        "mn8_render_us_sum 70521\n"
+        "mn8_render_us_count 5\n",
+        sink.text);
+    EXPECT_EQ(1u, sink.chunks.size());
+    EXPECT_EQ(sink.text.size(), writer.get_total_length());
+}
+
+//******************************************************************************
+/**
+ * @brief   A small buffer sends the same text in whole lines
+ *
+ */
+TEST(metrics, chunks)
+{
+    MetricHistogram histogram(bounds, 3);
+    histogram.observe(42);
+
+    char large[4096];
+    sink_t expected;
+    MetricsWriter reference(large, sizeof(large), flush_to_sink, &expected);
+    write_all(reference, histogram);
+    ASSERT_EQ(ESP_OK, reference.finish());
+
+    char small[METRICS_LINE_MAX_LENGTH];
+    sink_t sink;
+    MetricsWriter writer(small, sizeof(small), flush_to_sink, &sink);
+    write_all(writer, histogram);
+    ASSERT_EQ(ESP_OK, writer.finish());
+
+    EXPECT_EQ(expected.text, sink.text);
+    EXPECT_GT(sink.chunks.size(), 5u);
+    size_t offset = 0;
+    for (size_t length : sink.chunks) {
+        EXPECT_LT(length, sizeof(small));
+        offset += length;
+        EXPECT_EQ('\n', sink.text[offset - 1]);
+    }
+}
+
+//******************************************************************************
+/**
+ * @brief   The first error sticks, a line longer than the buffer is one
+ *
+ */
+TEST(metrics, errors)
+{
+    char tiny[16];
+    sink_t sink;
+    MetricsWriter writer(tiny, sizeof(tiny), flush_to_sink, &sink);
+    writer.sample("ok", nullptr, 1);
+    writer.sample("much_too_long_for_the_buffer", nullptr, 1);
+    writer.sample("ok", nullptr, 2);
+    EXPECT_EQ(ESP_ERR_INVALID_SIZE, writer.finish());
+    EXPECT_EQ("ok 1\n", sink.text);
+
+    char buffer[64];
+    sink_t failing;
+    failing.fail_after = 1;
+    MetricsWriter closed(buffer, sizeof(buffer), flush_to_sink, &failing);
+    for (int i = 0; i < 20; i++) {
+        closed.sample("mn8_requests_total", nullptr, i);
+    }
+    EXPECT_EQ(ESP_FAIL, closed.finish());
+    EXPECT_EQ(1u, failing.chunks.size());
+}
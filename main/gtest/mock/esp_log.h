@@ -8,4 +8,5 @@
 
 #define ESP_LOGD(TAG, FMT, ...) printf (FMT"\n", ##__VA_ARGS__)
 #define ESP_LOGI(TAG, FMT, ...) printf (FMT"\n", ##__VA_ARGS__)
+#define ESP_LOGW(TAG, FMT, ...) printf (FMT"\n", ##__VA_ARGS__)
 #define ESP_LOGE(TAG, FMT, ...) printf (FMT"\n", ##__VA_ARGS__)
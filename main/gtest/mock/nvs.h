@@ -0,0 +1,11 @@
+#pragma once
+
+#include "esp_err.h"
+
+#include <stdint.h>
+
+typedef uint32_t nvs_handle_t;
+
+#define ESP_ERR_NVS_BASE            0x1100
+#define ESP_ERR_NVS_NOT_FOUND       (ESP_ERR_NVS_BASE + 0x02)
+#define ESP_ERR_NVS_INVALID_LENGTH  (ESP_ERR_NVS_BASE + 0x0c)
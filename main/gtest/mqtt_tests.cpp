@@ -0,0 +1,364 @@
+//******************************************************************************
+/**
+ * @file mqtt_tests.cpp
+ * @author pat laplante (plaplante@appliedlogix.com)
+ *
+ * @brief Unit testing for the mqtt topic table and router
+ * @version 0.1
+ * @date 2024-02-05
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+
+#include <string.h>
+
+#include <gtest/gtest.h>
+#include "App/MqttAgent/MqttTopics.h"
+#include "App/MqttAgent/AckCoalescer.h"
+#include "App/MqttAgent/IngressLimiter.h"
+#include "App/MqttAgent/EndpointCache.h"
+
+#define THING_NAME  "a0b1c2d3e4f5"
+#define MAC_ADDRESS "A0B1C2D3E4F5"
+#define GROUP_ID    "site-42"
+
+typedef struct {
+    int calls;
+    const char* payload;
+    size_t payload_length;
+    uint16_t packet_id;
+} handler_record_t;
+
+static void record_handler(const char* pPayload, size_t payloadLength, uint16_t packetIdentifier, void* context) {
+    handler_record_t* record = (handler_record_t*) context;
+    record->calls++;
+    record->payload = pPayload;
+    record->payload_length = payloadLength;
+    record->packet_id = packetIdentifier;
+}
+
+//******************************************************************************
+/**
+ * @brief   Topics are prefixed with the thing name or the mac address
+ *
+ */
+TEST(mqtt_topics, build)
+{
+    MqttTopics topics;
+    EXPECT_FALSE(topics.is_built());
+    ASSERT_EQ(ESP_OK, topics.build(THING_NAME, MAC_ADDRESS));
+    EXPECT_TRUE(topics.is_built());
+
+    EXPECT_STREQ(THING_NAME "/ledstate", topics.get(e_mqtt_topic_ledstate));
+    EXPECT_STREQ(THING_NAME "/set-config", topics.get(e_mqtt_topic_set_config));
+    EXPECT_STREQ(MAC_ADDRESS "/heartbeat", topics.get(e_mqtt_topic_heartbeat));
+    EXPECT_STREQ(MAC_ADDRESS "/ack_ledstate", topics.get(e_mqtt_topic_ack_ledstate));
+    EXPECT_STREQ(THING_NAME "/latest", topics.get(e_mqtt_topic_latest));
+    EXPECT_EQ(strlen(topics.get(e_mqtt_topic_pong)), topics.get_length(e_mqtt_topic_pong));
+
+    // Building again is a no-op, topics are read without locking.
+    EXPECT_EQ(ESP_OK, topics.build("other", "other"));
+    EXPECT_STREQ(THING_NAME "/ledstate", topics.get(e_mqtt_topic_ledstate));
+}
+
+//******************************************************************************
+/**
+ * @brief   Topic too long for the table
+ *
+ */
+TEST(mqtt_topics, build_overflow)
+{
+    char long_name[MQTT_TOPIC_MAX_LENGTH] = {0};
+    memset(long_name, 'x', sizeof(long_name) - 1);
+
+    MqttTopics topics;
+    EXPECT_EQ(ESP_ERR_INVALID_SIZE, topics.build(long_name, MAC_ADDRESS));
+    EXPECT_FALSE(topics.is_built());
+    EXPECT_EQ(ESP_ERR_INVALID_ARG, topics.build(nullptr, MAC_ADDRESS));
+}
+
+//******************************************************************************
+/**
+ * @brief   The group ledstate is prefixed with the group id, empty without one
+ *
+ */
+TEST(mqtt_topics, group)
+{
+    MqttTopics topics;
+    ASSERT_EQ(ESP_OK, topics.build(THING_NAME, MAC_ADDRESS, GROUP_ID));
+    EXPECT_STREQ(GROUP_ID "/ledstate", topics.get(e_mqtt_topic_group_ledstate));
+    EXPECT_EQ(e_mqtt_topic_group_ledstate, topics.lookup(GROUP_ID "/ledstate", 16));
+    EXPECT_EQ(e_mqtt_topic_ledstate, topics.lookup(THING_NAME "/ledstate", 21));
+
+    MqttTopics unprovisioned;
+    ASSERT_EQ(ESP_OK, unprovisioned.build(THING_NAME, MAC_ADDRESS, ""));
+    EXPECT_EQ(0, unprovisioned.get_length(e_mqtt_topic_group_ledstate));
+    EXPECT_EQ(e_mqtt_topic_unknown, unprovisioned.lookup("", 0));
+    EXPECT_EQ(e_mqtt_topic_unknown, unprovisioned.lookup(GROUP_ID "/ledstate", 16));
+}
+
+//******************************************************************************
+/**
+ * @brief   The group topic follows a chargepoint moved or unprovisioned
+ *
+ */
+TEST(mqtt_topics, set_group)
+{
+    MqttTopics topics;
+    ASSERT_EQ(ESP_OK, topics.build(THING_NAME, MAC_ADDRESS, ""));
+    EXPECT_EQ(0, topics.get_length(e_mqtt_topic_group_ledstate));
+
+    ASSERT_EQ(ESP_OK, topics.set_group(GROUP_ID));
+    EXPECT_EQ(e_mqtt_topic_group_ledstate, topics.lookup(GROUP_ID "/ledstate", 16));
+
+    ASSERT_EQ(ESP_OK, topics.set_group("moved-group"));
+    EXPECT_STREQ("moved-group/ledstate", topics.get(e_mqtt_topic_group_ledstate));
+    EXPECT_EQ(e_mqtt_topic_group_ledstate, topics.lookup("moved-group/ledstate", 20));
+    EXPECT_EQ(e_mqtt_topic_unknown, topics.lookup(GROUP_ID "/ledstate", 16));
+
+    char too_long[MQTT_TOPIC_MAX_LENGTH];
+    memset(too_long, 'g', sizeof(too_long) - 1);
+    too_long[sizeof(too_long) - 1] = '\0';
+    EXPECT_EQ(ESP_ERR_INVALID_SIZE, topics.set_group(too_long));
+    EXPECT_EQ(0, topics.get_length(e_mqtt_topic_group_ledstate));
+
+    ASSERT_EQ(ESP_OK, topics.set_group(nullptr));
+    EXPECT_EQ(0, topics.get_length(e_mqtt_topic_group_ledstate));
+    EXPECT_EQ(e_mqtt_topic_unknown, topics.lookup("moved-group/ledstate", 20));
+
+    // The thing topics are still routed.
+    for (int i = MQTT_TOPIC_FIRST_INBOUND; i < e_mqtt_topic_group_ledstate; i++) {
+        EXPECT_EQ((mqtt_topic_t) i, topics.lookup(topics.get((mqtt_topic_t) i), topics.get_length((mqtt_topic_t) i)));
+    }
+}
+
+//******************************************************************************
+/**
+ * @brief   Every inbound topic is found, outbound and foreign topics are not
+ *
+ */
+TEST(mqtt_topics, lookup)
+{
+    MqttTopics topics;
+    EXPECT_EQ(e_mqtt_topic_unknown, topics.lookup(THING_NAME "/ping", 17));
+    ASSERT_EQ(ESP_OK, topics.build(THING_NAME, MAC_ADDRESS, GROUP_ID));
+
+    for (int i = MQTT_TOPIC_FIRST_INBOUND; i <= MQTT_TOPIC_LAST_INBOUND; i++) {
+        mqtt_topic_t topic = (mqtt_topic_t) i;
+        EXPECT_EQ(topic, topics.lookup(topics.get(topic), topics.get_length(topic)));
+    }
+
+    EXPECT_EQ(e_mqtt_topic_unknown, topics.lookup(topics.get(e_mqtt_topic_heartbeat), topics.get_length(e_mqtt_topic_heartbeat)));
+    EXPECT_EQ(e_mqtt_topic_unknown, topics.lookup("000000000000/ping", 17));
+
+    // coreMQTT topics are not null terminated, only the length counts.
+    const char* topic = THING_NAME "/pingXXXX";
+    EXPECT_EQ(e_mqtt_topic_ping, topics.lookup(topic, 17));
+    EXPECT_EQ(e_mqtt_topic_unknown, topics.lookup(topic, 18));
+    EXPECT_EQ(e_mqtt_topic_unknown, topics.lookup(topic, 16));
+}
+
+//******************************************************************************
+/**
+ * @brief   Dispatch calls the handler registered for the topic
+ *
+ */
+TEST(mqtt_topics, dispatch)
+{
+    handler_record_t ledstate = {0};
+    handler_record_t reboot = {0};
+
+    MqttTopics topics;
+    EXPECT_EQ(ESP_OK, topics.register_handler(e_mqtt_topic_ledstate, record_handler, &ledstate));
+    EXPECT_EQ(ESP_OK, topics.register_handler(e_mqtt_topic_reboot, record_handler, &reboot));
+    EXPECT_EQ(ESP_ERR_INVALID_ARG, topics.register_handler(e_mqtt_topic_heartbeat, record_handler, &reboot));
+    ASSERT_EQ(ESP_OK, topics.build(THING_NAME, MAC_ADDRESS));
+
+    const char* payload = "{\"night_mode\":true}";
+    const char* name = topics.get(e_mqtt_topic_ledstate);
+    EXPECT_EQ(e_mqtt_topic_ledstate, topics.dispatch(name, strlen(name), payload, strlen(payload), 42));
+    EXPECT_EQ(1, ledstate.calls);
+    EXPECT_EQ(payload, ledstate.payload);
+    EXPECT_EQ(strlen(payload), ledstate.payload_length);
+    EXPECT_EQ(42, ledstate.packet_id);
+    EXPECT_EQ(0, reboot.calls);
+
+    // Known topic without a handler, unknown topic.
+    name = topics.get(e_mqtt_topic_ping);
+    EXPECT_EQ(e_mqtt_topic_ping, topics.dispatch(name, strlen(name), "", 0, 1));
+    EXPECT_EQ(e_mqtt_topic_unknown, topics.dispatch("foo/bar", 7, "", 0, 1));
+    EXPECT_EQ(1, ledstate.calls);
+    EXPECT_EQ(0, reboot.calls);
+}
+
+static ledstate_ack_t make_ack(uint32_t seq) {
+    ledstate_ack_t ack = {};
+    ack.has_seq = true;
+    ack.id = seq;
+    return ack;
+}
+
+//******************************************************************************
+/**
+ * @brief   A single ack goes out right away
+ *
+ */
+TEST(ack_coalescer, single)
+{
+    AckCoalescer coalescer(250);
+    ledstate_ack_t to_send;
+
+    ASSERT_TRUE(coalescer.add(make_ack(1), 1000, &to_send));
+    EXPECT_EQ(1u, to_send.id);
+    EXPECT_EQ(1, to_send.count);
+    EXPECT_FALSE(coalescer.poll(1100, &to_send));
+    EXPECT_FALSE(coalescer.poll(1300, &to_send));
+
+    // Window closed, the next one goes right away too.
+    ASSERT_TRUE(coalescer.add(make_ack(2), 2000, &to_send));
+    EXPECT_EQ(2u, to_send.id);
+    EXPECT_EQ(0u, coalescer.get_coalesced());
+}
+
+//******************************************************************************
+/**
+ * @brief   A burst is acked once at the end of the window with the newest id
+ *
+ */
+TEST(ack_coalescer, burst)
+{
+    AckCoalescer coalescer(250);
+    ledstate_ack_t to_send;
+
+    ASSERT_TRUE(coalescer.add(make_ack(1), 1000, &to_send));
+    EXPECT_FALSE(coalescer.add(make_ack(2), 1010, &to_send));
+    EXPECT_FALSE(coalescer.add(make_ack(3), 1020, &to_send));
+    EXPECT_FALSE(coalescer.add(make_ack(4), 1200, &to_send));
+    EXPECT_TRUE(coalescer.has_pending());
+
+    EXPECT_FALSE(coalescer.poll(1249, &to_send));
+    ASSERT_TRUE(coalescer.poll(1250, &to_send));
+    EXPECT_EQ(4u, to_send.id);
+    EXPECT_EQ(3, to_send.count);
+    EXPECT_EQ(2u, coalescer.get_coalesced());
+
+    // The burst goes on, still coalesced.
+    EXPECT_FALSE(coalescer.add(make_ack(5), 1260, &to_send));
+    ASSERT_TRUE(coalescer.poll(1500, &to_send));
+    EXPECT_EQ(5u, to_send.id);
+    EXPECT_EQ(1, to_send.count);
+    EXPECT_FALSE(coalescer.poll(1800, &to_send));
+}
+
+//******************************************************************************
+/**
+ * @brief   Late poll, the new ack supersedes the held one
+ *
+ */
+TEST(ack_coalescer, late_poll)
+{
+    AckCoalescer coalescer(250);
+    ledstate_ack_t to_send;
+
+    ASSERT_TRUE(coalescer.add(make_ack(1), 1000, &to_send));
+    EXPECT_FALSE(coalescer.add(make_ack(2), 1100, &to_send));
+    ASSERT_TRUE(coalescer.add(make_ack(3), 2000, &to_send));
+    EXPECT_EQ(3u, to_send.id);
+    EXPECT_EQ(2, to_send.count);
+    EXPECT_FALSE(coalescer.has_pending());
+
+    // Reset drops what is held.
+    EXPECT_FALSE(coalescer.add(make_ack(4), 2100, &to_send));
+    coalescer.reset();
+    EXPECT_FALSE(coalescer.poll(3000, &to_send));
+}
+
+//******************************************************************************
+/**
+ * @brief   A storm is cut down to the burst, then to the refill rate
+ *
+ */
+TEST(ingress_limiter, token_bucket)
+{
+    IngressLimiter limiter;
+    limiter.set_limit(e_mqtt_topic_ping, 3, 1000);
+
+    int admitted = 0;
+    for (int i = 0; i < 100; i++) {
+        admitted += limiter.admit(e_mqtt_topic_ping, 5000) ? 1 : 0;
+    }
+    EXPECT_EQ(3, admitted);
+    EXPECT_EQ(97u, limiter.get_throttled(e_mqtt_topic_ping));
+
+    // One token back per second, partial seconds are not lost.
+    EXPECT_FALSE(limiter.admit(e_mqtt_topic_ping, 5999));
+    EXPECT_TRUE(limiter.admit(e_mqtt_topic_ping, 6000));
+    EXPECT_FALSE(limiter.admit(e_mqtt_topic_ping, 6500));
+    EXPECT_TRUE(limiter.admit(e_mqtt_topic_ping, 7000));
+
+    // A long pause refills to the burst, no more.
+    admitted = 0;
+    for (int i = 0; i < 10; i++) {
+        admitted += limiter.admit(e_mqtt_topic_ping, 60000) ? 1 : 0;
+    }
+    EXPECT_EQ(3, admitted);
+}
+
+//******************************************************************************
+/**
+ * @brief   Each topic has its own bucket, ledstate is not limited
+ *
+ */
+TEST(ingress_limiter, per_topic)
+{
+    IngressLimiter limiter;
+
+    EXPECT_TRUE(limiter.admit(e_mqtt_topic_reboot, 1000));
+    EXPECT_FALSE(limiter.admit(e_mqtt_topic_reboot, 1001));
+    EXPECT_TRUE(limiter.admit(e_mqtt_topic_get_config, 1002));
+    EXPECT_EQ(1u, limiter.get_throttled(e_mqtt_topic_reboot));
+    EXPECT_EQ(0u, limiter.get_throttled(e_mqtt_topic_get_config));
+
+    for (int i = 0; i < 1000; i++) {
+        ASSERT_TRUE(limiter.admit(e_mqtt_topic_ledstate, 1000));
+    }
+    EXPECT_EQ(0u, limiter.get_throttled(e_mqtt_topic_ledstate));
+
+    // Outbound topics are never ours to limit.
+    EXPECT_TRUE(limiter.admit(e_mqtt_topic_heartbeat, 1000));
+    EXPECT_EQ(0u, limiter.get_throttled(e_mqtt_topic_heartbeat));
+}
+
+//******************************************************************************
+/**
+ * @brief   The address is used until the ttl runs out or it fails
+ *
+ */
+TEST(endpoint_cache, ttl_and_fallback)
+{
+    EndpointCache cache(1000);
+    char address[ENDPOINT_ADDRESS_MAX_LENGTH];
+
+    EXPECT_FALSE(cache.get(0, true, address, sizeof(address)));
+
+    cache.store("52.1.2.3", 5000);
+    ASSERT_TRUE(cache.get(5999, false, address, sizeof(address)));
+    EXPECT_STREQ("52.1.2.3", address);
+
+    // Expired, only good as a fallback.
+    EXPECT_FALSE(cache.get(6000, false, address, sizeof(address)));
+    EXPECT_TRUE(cache.get(6000, true, address, sizeof(address)));
+
+    // Fresh again, then a failed connection expires it right away.
+    cache.store("52.1.2.4", 7000);
+    EXPECT_TRUE(cache.get(7001, false, address, sizeof(address)));
+    cache.expire();
+    EXPECT_FALSE(cache.get(7002, false, address, sizeof(address)));
+    ASSERT_TRUE(cache.get(7002, true, address, sizeof(address)));
+    EXPECT_STREQ("52.1.2.4", address);
+
+    // Too small a buffer.
+    char small[4];
+    EXPECT_FALSE(cache.get(7002, true, small, sizeof(small)));
+}
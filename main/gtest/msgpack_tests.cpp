@@ -0,0 +1,149 @@
+//******************************************************************************
+/**
+ * @file msgpack_tests.cpp
+ * @author pat laplante (plaplante@appliedlogix.com)
+ *
+ * @brief Unit testing for the MessagePack reader/writer and ledstate parser
+ * @version 0.1
+ * @date 2024-02-09
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+
+#include <string.h>
+
+#include <gtest/gtest.h>
+#include "Utils/MsgPack.h"
+#include "App/MqttAgent/LedStateParser.h"
+
+//******************************************************************************
+/**
+ * @brief   Integers use the smallest encoding and read back
+ *
+ */
+TEST(msgpack, integers)
+{
+    const int64_t values[] = { 0, 1, 127, 128, 255, 256, 65535, 65536, 4294967296LL, -1, -32, -33, -128, -129, -32768, -32769, -2147483649LL };
+    const size_t sizes[] =   { 1, 1, 1,   2,   2,   3,   3,     5,     9,            1,  1,   2,   2,    3,    3,      5,      9 };
+
+    for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+        uint8_t buffer[16];
+        MsgPackWriter writer(buffer, sizeof(buffer));
+        writer.integer(values[i]);
+        ASSERT_TRUE(writer.ok());
+        EXPECT_EQ(sizes[i], writer.length()) << values[i];
+
+        int64_t value = 0;
+        MsgPackReader reader(buffer, writer.length());
+        EXPECT_TRUE(reader.read_int(&value));
+        EXPECT_EQ(values[i], value);
+        EXPECT_TRUE(reader.at_end());
+    }
+}
+
+//******************************************************************************
+/**
+ * @brief   Map of strings and bools, then skip over it
+ *
+ */
+TEST(msgpack, map)
+{
+    uint8_t buffer[128];
+    char long_string[40];
+    memset(long_string, 'a', sizeof(long_string));
+
+    MsgPackWriter writer(buffer, sizeof(buffer));
+    writer.map(3);
+    writer.str("a");
+    writer.boolean(true);
+    writer.str("long");
+    writer.str(long_string, sizeof(long_string));
+    writer.str("list");
+    writer.array(2);
+    writer.nil();
+    writer.integer(300);
+    ASSERT_TRUE(writer.ok());
+
+    uint32_t count;
+    const char* str;
+    size_t length;
+    bool flag;
+    MsgPackReader reader(buffer, writer.length());
+    ASSERT_TRUE(reader.read_map(&count));
+    EXPECT_EQ(3u, count);
+    ASSERT_TRUE(reader.read_str(&str, &length));
+    EXPECT_EQ(1u, length);
+    ASSERT_TRUE(reader.read_bool(&flag));
+    EXPECT_TRUE(flag);
+    ASSERT_TRUE(reader.read_str(&str, &length));
+    ASSERT_TRUE(reader.read_str(&str, &length));
+    EXPECT_EQ(sizeof(long_string), length);
+    EXPECT_EQ(0, memcmp(str, long_string, length));
+    EXPECT_TRUE(reader.skip());
+    EXPECT_TRUE(reader.skip());
+    EXPECT_TRUE(reader.at_end());
+
+    MsgPackReader whole(buffer, writer.length());
+    EXPECT_TRUE(whole.skip());
+    EXPECT_TRUE(whole.at_end());
+
+    // Truncated
+    MsgPackReader truncated(buffer, writer.length() - 1);
+    EXPECT_FALSE(truncated.skip());
+}
+
+//******************************************************************************
+/**
+ * @brief   Writer flags the overflow
+ *
+ */
+TEST(msgpack, overflow)
+{
+    uint8_t buffer[4];
+    MsgPackWriter writer(buffer, sizeof(buffer));
+    writer.str("hello");
+    EXPECT_FALSE(writer.ok());
+    EXPECT_EQ(sizeof(buffer), writer.length());
+}
+
+//******************************************************************************
+/**
+ * @brief   Same message as the json parser test, in MessagePack
+ *
+ */
+TEST(ledstate_parser, msgpack)
+{
+    uint8_t buffer[128];
+    MsgPackWriter writer(buffer, sizeof(buffer));
+    writer.map(4);
+    writer.str("night_mode");
+    writer.boolean(true);
+    writer.str("extra");
+    writer.array(2);
+    writer.integer(1);
+    writer.str("x");
+    writer.str("port0");
+    writer.map(2);
+    writer.str("state");
+    writer.str("charging");
+    writer.str("charge_percent");
+    writer.integer(57);
+    writer.str("port1");
+    writer.map(1);
+    writer.str("state");
+    writer.str("bogus");
+    ASSERT_TRUE(writer.ok());
+
+    ledstate_message_t message;
+    ASSERT_EQ(ESP_OK, ledstate_parse_msgpack(buffer, writer.length(), &message));
+    EXPECT_TRUE(message.has_night_mode);
+    EXPECT_TRUE(message.night_mode);
+    EXPECT_TRUE(message.port[0].has_state);
+    EXPECT_EQ(e_station_charging, message.port[0].state);
+    EXPECT_EQ(57, message.port[0].charge_percent);
+    EXPECT_FALSE(message.port[1].has_state);
+
+    EXPECT_EQ(ESP_ERR_INVALID_ARG, ledstate_parse_msgpack(buffer, writer.length() - 1, &message));
+    EXPECT_EQ(ESP_ERR_INVALID_ARG, ledstate_parse_msgpack(buffer + 1, writer.length() - 1, &message));
+}
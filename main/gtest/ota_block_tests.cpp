@@ -0,0 +1,412 @@
+//******************************************************************************
+/**
+ * @file ota_block_tests.cpp
+ * @author pat laplante (plaplante@appliedlogix.com)
+ *
+ * @brief Unit testing for the pull update block engine
+ * @version 0.1
+ * @date 2024-03-01
+ *
+ * The engine runs against a local http server standing in for the file
+ * server, through the host range source.  The store is in memory, a
+ * "reboot" is a new engine on the same store.
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+
+#include <gtest/gtest.h>
+#include "Utils/OtaBlockEngine.h"
+#include "host/HttpRangeSource.h"
+
+#include <arpa/inet.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+//******************************************************************************
+/**
+ * @brief The file server, one request per connection, with failures on
+ *        demand.
+ */
+class RangeServer {
+public:
+    explicit RangeServer(const std::vector<uint8_t>& image) : image(image) {
+        this->sock = socket(AF_INET, SOCK_STREAM, 0);
+        int reuse = 1;
+        setsockopt(this->sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+        struct sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        bind(this->sock, (struct sockaddr*) &address, sizeof(address));
+        listen(this->sock, 4);
+
+        socklen_t length = sizeof(address);
+        getsockname(this->sock, (struct sockaddr*) &address, &length);
+        this->port = ntohs(address.sin_port);
+
+        this->thread = std::thread([this]() { this->serve(); });
+    }
+
+    ~RangeServer(void) {
+        this->running = false;
+        this->thread.join();
+        close(this->sock);
+    }
+
+    std::string url(void) const { return "http://127.0.0.1:" + std::to_string(this->port) + "/led_strip.bin"; }
+
+    // Body bytes sent before the next response is cut, -1 for none.
+    std::atomic<int> cut_after{-1};
+    // Requests answered before the server only says 503, -1 for never.
+    std::atomic<int> up_for{-1};
+    std::atomic<bool> ignore_range{false};
+
+    std::atomic<int> requests{0};
+    std::atomic<size_t> bytes_served{0};
+
+private:
+    void serve(void) {
+        while (this->running) {
+            struct pollfd fd = { this->sock, POLLIN, 0 };
+            if (poll(&fd, 1, 20) <= 0) {
+                continue;
+            }
+            int client = accept(this->sock, nullptr, nullptr);
+            if (client >= 0) {
+                this->answer(client);
+                close(client);
+            }
+        }
+    }
+
+    void answer(int client) {
+        std::string request;
+        char buffer[512];
+        while (request.find("\r\n\r\n") == std::string::npos) {
+            ssize_t count = recv(client, buffer, sizeof(buffer), 0);
+            if (count <= 0) {
+                return;
+            }
+            request.append(buffer, count);
+        }
+        this->requests++;
+
+        if (this->up_for >= 0 && this->up_for-- == 0) {
+            this->up_for = 0;
+            this->send_all(client, "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\n\r\n");
+            return;
+        }
+
+        unsigned long first = 0;
+        unsigned long last = this->image.size() - 1;
+        size_t range = request.find("Range: bytes=");
+        bool partial = range != std::string::npos && !this->ignore_range &&
+            sscanf(request.c_str() + range, "Range: bytes=%lu-%lu", &first, &last) == 2;
+        last = std::min(last, (unsigned long) this->image.size() - 1);
+
+        char headers[256];
+        if (partial) {
+            snprintf(headers, sizeof(headers),
+                "HTTP/1.1 206 Partial Content\r\nContent-Range: bytes %lu-%lu/%zu\r\nContent-Length: %lu\r\n\r\n",
+                first, last, this->image.size(), last - first + 1);
+        } else {
+            snprintf(headers, sizeof(headers), "HTTP/1.1 200 OK\r\nContent-Length: %zu\r\n\r\n", this->image.size());
+        }
+        this->send_all(client, headers);
+
+        size_t length = last - first + 1;
+        int cut = this->cut_after.exchange(-1);
+        if (cut >= 0 && (size_t) cut < length) {
+            length = cut;
+        }
+        send(client, this->image.data() + first, length, MSG_NOSIGNAL);
+        this->bytes_served += length;
+    }
+
+    void send_all(int client, const std::string& text) {
+        send(client, text.c_str(), text.length(), MSG_NOSIGNAL);
+    }
+
+    const std::vector<uint8_t>& image;
+    int sock = -1;
+    uint16_t port = 0;
+    std::atomic<bool> running{true};
+    std::thread thread;
+};
+
+//******************************************************************************
+/**
+ * @brief The flash and the key store.
+ */
+class MemoryStore : public OtaBlockStore {
+public:
+    explicit MemoryStore(const std::vector<uint8_t>& expected) : expected(expected) {}
+
+    esp_err_t load_state(ota_job_state_t& state) override {
+        if (!this->has_state) {
+            return ESP_ERR_NOT_FOUND;
+        }
+        state = this->state;
+        return ESP_OK;
+    }
+
+    esp_err_t save_state(const ota_job_state_t& state) override {
+        this->state = state;
+        this->has_state = true;
+        this->saves++;
+        return ESP_OK;
+    }
+
+    esp_err_t clear_state(void) override {
+        this->has_state = false;
+        return ESP_OK;
+    }
+
+    uint32_t get_location(void) override {
+        return this->location;
+    }
+
+    esp_err_t prepare(const ota_job_t& job, bool resume) override {
+        if (job.size > this->capacity) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        if (!resume) {
+            this->flash.assign(this->capacity, 0xFF);
+        }
+        return ESP_OK;
+    }
+
+    esp_err_t write_block(uint32_t offset, const uint8_t* data, size_t length) override {
+        memcpy(this->flash.data() + offset, data, length);
+        this->writes++;
+        return ESP_OK;
+    }
+
+    esp_err_t finish(const ota_job_t& job) override {
+        this->finished = std::equal(this->expected.begin(), this->expected.end(), this->flash.begin());
+        return this->finished ? ESP_OK : ESP_ERR_INVALID_CRC;
+    }
+
+    const std::vector<uint8_t>& expected;
+    size_t capacity = 1 << 20;
+    uint32_t location = 0x110000;
+    std::vector<uint8_t> flash;
+    ota_job_state_t state = {};
+    bool has_state = false;
+    bool finished = false;
+    int saves = 0;
+    int writes = 0;
+};
+
+static std::vector<uint8_t> make_image(size_t size) {
+    std::mt19937 random(7);
+    std::vector<uint8_t> image(size);
+    for (auto& byte : image) {
+        byte = (uint8_t) random();
+    }
+    return image;
+}
+
+static ota_job_t make_job(const char* job_id, const std::string& url, size_t size) {
+    ota_job_t job = {};
+    snprintf(job.job_id, sizeof(job.job_id), "%s", job_id);
+    snprintf(job.url, sizeof(job.url), "%s", url.c_str());
+    job.size = (uint32_t) size;
+    job.sha256[0] = 0x5A;
+    return job;
+}
+
+// 40 blocks, the last one short.
+#define IMAGE_SIZE  (39 * OTA_BLOCK_SIZE + 123)
+
+//******************************************************************************
+/**
+ * @brief   The whole image in runs of OTA_BLOCK_RUN_LENGTH blocks
+ *
+ */
+TEST(ota_block_engine, download)
+{
+    std::vector<uint8_t> image = make_image(IMAGE_SIZE);
+    RangeServer server(image);
+    HttpRangeSource source;
+    MemoryStore store(image);
+    OtaBlockEngine engine(source, store);
+
+    ASSERT_EQ(ESP_OK, engine.open(make_job("job-1", server.url(), image.size())));
+    EXPECT_TRUE(engine.is_open());
+    EXPECT_TRUE(store.has_state);
+
+    EXPECT_EQ(ESP_OK, engine.run());
+    EXPECT_TRUE(store.finished);
+    EXPECT_FALSE(store.has_state);
+    EXPECT_FALSE(engine.is_open());
+
+    const ota_block_stats_t& stats = engine.get_stats();
+    EXPECT_EQ(40u, stats.block_count);
+    EXPECT_EQ(40u, stats.blocks_done);
+    EXPECT_EQ(40u, stats.blocks_fetched);
+    EXPECT_EQ(3u, stats.requests);
+    EXPECT_EQ(0u, stats.failed_requests);
+    EXPECT_EQ(image.size(), server.bytes_served.load());
+
+    // Closed once done.
+    EXPECT_EQ(ESP_ERR_INVALID_STATE, engine.run());
+}
+
+//******************************************************************************
+/**
+ * @brief   A connection cut in the middle of a run only costs the block
+ *          it was in
+ *
+ */
+TEST(ota_block_engine, dropped_connection)
+{
+    std::vector<uint8_t> image = make_image(IMAGE_SIZE);
+    RangeServer server(image);
+    HttpRangeSource source;
+    MemoryStore store(image);
+    OtaBlockEngine engine(source, store);
+
+    server.cut_after = 2 * OTA_BLOCK_SIZE + 1000;
+    ASSERT_EQ(ESP_OK, engine.open(make_job("job-1", server.url(), image.size())));
+    EXPECT_EQ(ESP_OK, engine.run());
+    EXPECT_TRUE(store.finished);
+
+    const ota_block_stats_t& stats = engine.get_stats();
+    EXPECT_EQ(40u, stats.blocks_fetched);
+    EXPECT_EQ(4u, stats.requests);
+    EXPECT_EQ(1u, stats.failed_requests);
+    EXPECT_EQ(image.size() + 1000, server.bytes_served.load());
+    EXPECT_EQ(40, store.writes);
+}
+
+//******************************************************************************
+/**
+ * @brief   The server goes away, the job is picked up after a reboot
+ *
+ */
+TEST(ota_block_engine, resume_after_reboot)
+{
+    std::vector<uint8_t> image = make_image(IMAGE_SIZE);
+    RangeServer server(image);
+    MemoryStore store(image);
+
+    {
+        HttpRangeSource source;
+        OtaBlockEngine engine(source, store);
+        server.up_for = 2;
+        ASSERT_EQ(ESP_OK, engine.open(make_job("job-1", server.url(), image.size())));
+        EXPECT_NE(ESP_OK, engine.run());
+        EXPECT_TRUE(engine.is_open());
+        EXPECT_EQ(32u, engine.get_stats().blocks_done);
+        EXPECT_EQ(2u + OTA_BLOCK_ATTEMPTS, engine.get_stats().requests);
+        EXPECT_TRUE(store.has_state);
+        EXPECT_FALSE(store.finished);
+    }
+
+    // Reboot, the server is back.
+    server.up_for = -1;
+    size_t served = server.bytes_served;
+
+    HttpRangeSource source;
+    OtaBlockEngine engine(source, store);
+    ASSERT_EQ(ESP_OK, engine.resume());
+    EXPECT_EQ(32u, engine.get_stats().blocks_resumed);
+    EXPECT_EQ(ESP_OK, engine.run());
+    EXPECT_TRUE(store.finished);
+    EXPECT_EQ(8u, engine.get_stats().blocks_fetched);
+    EXPECT_EQ(image.size() - 32 * OTA_BLOCK_SIZE, server.bytes_served - served);
+
+    // Nothing left to resume.
+    EXPECT_EQ(ESP_ERR_NOT_FOUND, engine.resume());
+}
+
+//******************************************************************************
+/**
+ * @brief   Which jobs are resumed, rejected, cancelled or fail at the end
+ *
+ */
+TEST(ota_block_engine, jobs)
+{
+    std::vector<uint8_t> image = make_image(IMAGE_SIZE);
+    RangeServer server(image);
+    HttpRangeSource source;
+    MemoryStore store(image);
+    OtaBlockEngine engine(source, store);
+
+    EXPECT_EQ(ESP_ERR_INVALID_ARG, engine.open(make_job("", server.url(), image.size())));
+    EXPECT_EQ(ESP_ERR_INVALID_ARG, engine.open(make_job("job-1", "", image.size())));
+    EXPECT_EQ(ESP_ERR_INVALID_SIZE, engine.open(make_job("job-1", server.url(), 0)));
+    EXPECT_EQ(ESP_ERR_INVALID_SIZE, engine.open(make_job("job-1", server.url(), OTA_BLOCK_MAX_COUNT * OTA_BLOCK_SIZE + 1)));
+    EXPECT_EQ(ESP_ERR_INVALID_SIZE, engine.open(make_job("job-1", server.url(), store.capacity + 1)));
+    EXPECT_FALSE(engine.is_open());
+
+    // Half way, then the same job with a fresh url resumes, another does not.
+    server.up_for = 1;
+    ASSERT_EQ(ESP_OK, engine.open(make_job("job-1", server.url(), image.size())));
+    EXPECT_NE(ESP_OK, engine.run());
+    EXPECT_EQ(16u, engine.get_stats().blocks_done);
+    server.up_for = -1;
+
+    {
+        OtaBlockEngine other(source, store);
+        ASSERT_EQ(ESP_OK, other.open(make_job("job-1", server.url() + "?signature=2", image.size())));
+        EXPECT_EQ(16u, other.get_stats().blocks_resumed);
+        EXPECT_STREQ((server.url() + "?signature=2").c_str(), store.state.job.url);
+
+        ota_job_t changed = make_job("job-1", server.url(), image.size());
+        changed.sha256[0] = 0;
+        ASSERT_EQ(ESP_OK, other.open(changed));
+        EXPECT_EQ(0u, other.get_stats().blocks_resumed);
+    }
+
+    // Saved for the other partition, an update was booted since.
+    {
+        OtaBlockEngine first(source, store);
+        server.up_for = 1;
+        ASSERT_EQ(ESP_OK, first.open(make_job("job-5", server.url(), image.size())));
+        EXPECT_NE(ESP_OK, first.run());
+        EXPECT_EQ(16u, first.get_stats().blocks_done);
+        server.up_for = -1;
+
+        store.location = 0x210000;
+        OtaBlockEngine other(source, store);
+        ASSERT_EQ(ESP_OK, other.open(make_job("job-5", server.url(), image.size())));
+        EXPECT_EQ(0u, other.get_stats().blocks_resumed);
+        EXPECT_EQ(0x210000u, store.state.location);
+        store.location = 0x110000;
+    }
+
+    // Cancelled between runs of blocks.
+    ASSERT_EQ(ESP_OK, engine.open(make_job("job-2", server.url(), image.size())));
+    EXPECT_EQ(0u, engine.get_stats().blocks_resumed);
+    engine.cancel();
+    EXPECT_EQ(ESP_ERR_INVALID_STATE, engine.run());
+    EXPECT_FALSE(engine.is_open());
+    EXPECT_FALSE(store.has_state);
+
+    // A server that ignores ranges.
+    server.ignore_range = true;
+    ASSERT_EQ(ESP_OK, engine.open(make_job("job-3", server.url(), image.size())));
+    EXPECT_EQ(ESP_ERR_NOT_SUPPORTED, engine.run());
+    EXPECT_EQ(0u, engine.get_stats().blocks_done);
+    server.ignore_range = false;
+
+    // Not the image expected, the job is dropped.
+    std::vector<uint8_t> other_image = make_image(IMAGE_SIZE);
+    other_image[100] ^= 1;
+    MemoryStore other_store(other_image);
+    OtaBlockEngine other(source, other_store);
+    ASSERT_EQ(ESP_OK, other.open(make_job("job-4", server.url(), image.size())));
+    EXPECT_EQ(ESP_ERR_INVALID_CRC, other.run());
+    EXPECT_FALSE(other.is_open());
+    EXPECT_FALSE(other_store.has_state);
+}
@@ -0,0 +1,165 @@
+//******************************************************************************
+/**
+ * @file outbound_tests.cpp
+ * @author pat laplante (plaplante@appliedlogix.com)
+ *
+ * @brief Unit testing for the outbound store and forward queue
+ * @version 0.1
+ * @date 2024-02-19
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include "App/MqttAgent/OutboundQueue.h"
+
+//******************************************************************************
+/**
+ * @brief   What MqttAgent does with the queue, without the broker.
+ *
+ * The link goes down and up, publishes are queued while down and replayed a
+ * few per loop once up, the link can drop in the middle of a replay.
+ */
+class FakeLink {
+public:
+    void publish(mqtt_topic_t topic, const std::string& payload) {
+        if (!this->up || !this->queue.empty()) {
+            this->queue.push(topic, payload.c_str(), payload.length());
+            return;
+        }
+        this->send(topic, payload.c_str(), payload.length());
+    }
+
+    void loop(int replay_per_loop) {
+        mqtt_topic_t topic;
+        const char* payload;
+        size_t length;
+        for (int i = 0; i < replay_per_loop && this->up; i++) {
+            if (!this->queue.peek(&topic, &payload, &length)) {
+                break;
+            }
+            this->send(topic, payload, length);
+            this->queue.pop();
+        }
+    }
+
+    void send(mqtt_topic_t topic, const char* payload, size_t length) {
+        this->sent.push_back(std::string(MqttTopics::get_suffix(topic)) + ":" + std::string(payload, length));
+    }
+
+    bool up = true;
+    OutboundQueue queue;
+    std::vector<std::string> sent;
+};
+
+//******************************************************************************
+/**
+ * @brief   Acks are all kept, heartbeats only the latest, pongs are dropped
+ *
+ */
+TEST(outbound_queue, policies)
+{
+    OutboundQueue queue;
+    EXPECT_EQ(ESP_OK, queue.push(e_mqtt_topic_heartbeat, "h1", 2));
+    EXPECT_EQ(ESP_OK, queue.push(e_mqtt_topic_ack_ledstate, "a1", 2));
+    EXPECT_EQ(ESP_ERR_NOT_SUPPORTED, queue.push(e_mqtt_topic_pong, "p1", 2));
+    EXPECT_EQ(ESP_OK, queue.push(e_mqtt_topic_ack_ledstate, "a2", 2));
+    EXPECT_EQ(ESP_OK, queue.push(e_mqtt_topic_heartbeat, "h2", 2));
+    EXPECT_EQ(3u, queue.size());
+
+    const char* expected[] = { "a1", "a2", "h2" };
+    for (const char* payload : expected) {
+        mqtt_topic_t topic;
+        const char* queued;
+        size_t length;
+        ASSERT_TRUE(queue.peek(&topic, &queued, &length));
+        EXPECT_EQ(std::string(payload), std::string(queued, length));
+        queue.pop();
+    }
+    EXPECT_TRUE(queue.empty());
+    EXPECT_EQ(0u, queue.get_dropped());
+}
+
+//******************************************************************************
+/**
+ * @brief   A full queue drops the oldest
+ *
+ */
+TEST(outbound_queue, full)
+{
+    OutboundQueue queue;
+    char payload[1000];
+    memset(payload, 'x', sizeof(payload));
+
+    int pushed = 0;
+    for (; pushed < 20; pushed++) {
+        snprintf(payload, sizeof(payload), "%02d", pushed);
+        payload[2] = 'x';
+        ASSERT_EQ(ESP_OK, queue.push(e_mqtt_topic_ack_ledstate, payload, sizeof(payload)));
+    }
+
+    size_t kept = OUTBOUND_QUEUE_SIZE / (sizeof(payload) + 4);
+    EXPECT_EQ(kept, queue.size());
+    EXPECT_EQ(20 - kept, queue.get_dropped());
+
+    mqtt_topic_t topic;
+    const char* queued;
+    size_t length;
+    ASSERT_TRUE(queue.peek(&topic, &queued, &length));
+    EXPECT_EQ(std::to_string(20 - kept), std::string(queued, 2));
+
+    static char too_big[OUTBOUND_QUEUE_SIZE];
+    EXPECT_EQ(ESP_ERR_INVALID_SIZE, queue.push(e_mqtt_topic_heartbeat, too_big, sizeof(too_big)));
+}
+
+//******************************************************************************
+/**
+ * @brief   Disconnect and reconnect cycles, everything kept arrives in order
+ *
+ */
+TEST(outbound_queue, reconnect_cycles)
+{
+    FakeLink link;
+
+    link.publish(e_mqtt_topic_ack_ledstate, "1");
+    link.up = false;
+    link.publish(e_mqtt_topic_ack_ledstate, "2");
+    link.publish(e_mqtt_topic_heartbeat, "hb-old");
+    link.publish(e_mqtt_topic_pong, "pong");
+    link.publish(e_mqtt_topic_ack_ledstate, "3");
+    link.publish(e_mqtt_topic_heartbeat, "hb-new");
+
+    // Back up, one entry per loop.  What is published meanwhile waits its turn.
+    link.up = true;
+    link.loop(1);
+    link.publish(e_mqtt_topic_ack_ledstate, "4");
+
+    // Down again in the middle of the replay.
+    link.up = false;
+    link.loop(1);
+    link.publish(e_mqtt_topic_ack_ledstate, "5");
+    link.up = true;
+    for (int i = 0; i < 10; i++) {
+        link.loop(2);
+    }
+
+    // Queue drained, publishes go straight out again.
+    link.publish(e_mqtt_topic_pong, "pong");
+
+    std::vector<std::string> expected = {
+        "ack_ledstate:1",
+        "ack_ledstate:2",
+        "ack_ledstate:3",
+        "heartbeat:hb-new",
+        "ack_ledstate:4",
+        "ack_ledstate:5",
+        "pong:pong",
+    };
+    EXPECT_EQ(expected, link.sent);
+    EXPECT_TRUE(link.queue.empty());
+}
@@ -0,0 +1,131 @@
+//******************************************************************************
+/**
+ * @file payload_tests.cpp
+ * @author pat laplante (plaplante@appliedlogix.com)
+ *
+ * @brief Unit testing for the payloads published by the thing
+ * @version 0.1
+ * @date 2024-02-22
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+
+#include <gtest/gtest.h>
+#include "App/MqttAgent/IotPayloads.h"
+#include "Utils/MsgPack.h"
+#include "rev.h"
+
+#include <string>
+
+//******************************************************************************
+/**
+ * @brief   The json heartbeat, throttled topics and events included
+ *
+ */
+TEST(iot_payload, heartbeat_json)
+{
+    ledstate_counters_t ledstate_counters = { 10, 1, 2, 3 };
+    ingress_counters_t ingress_counters = {};
+    ingress_counters.throttled[e_mqtt_topic_ping - MQTT_TOPIC_FIRST_INBOUND] = 4;
+    connection_stats_t connection_stats = { 2, 1, 850, true };
+
+    TelemetryRing telemetry;
+    telemetry_event_t event = {};
+    event.time_s = 12;
+    event.type = e_telemetry_state;
+    event.name = "connected";
+    telemetry.push(event);
+    event.time_s = 30;
+    event.type = e_telemetry_night_mode;
+    event.value = 1;
+    event.name = "night_mode";
+    telemetry.push(event);
+
+    heartbeat_info_t info = {};
+    info.current_state = "connected";
+    info.led1_state = "charging";
+    info.led2_state = "available";
+    info.night_mode = true;
+    info.has_night_sensor = false;
+    info.ledstate_counters = &ledstate_counters;
+    info.ingress_counters = &ingress_counters;
+    info.telemetry = &telemetry;
+    info.connection_stats = &connection_stats;
+
+    char buffer[1024];
+    size_t length = 0;
+    ASSERT_EQ(ESP_OK, iot_payload_heartbeat(e_payload_encoding_json, info, buffer, sizeof(buffer), &length));
+
+    std::string expected = std::string(R"({"version":")") + VERSION_STRING + R"(",)"
+        R"("current_state":"connected","led1_state":"charging","led2_state":"available","night_mode":true,"has_night_sensor":false,)"
+        R"("ledstate":{"applied":10,"stale":1,"duplicate":2,"coalesced":3},"throttled":{"ping":4},)"
+        R"("events":[{"t":12,"state":"connected"},{"t":30,"night_mode":true}],"events_dropped":0,)"
+        R"("tls":{"attempts":2,"dns":1,"handshake_ms":850,"resume_offered":true}})";
+    EXPECT_EQ(expected, std::string(buffer, length));
+
+    // Too small is reported, not truncated.
+    EXPECT_EQ(ESP_ERR_INVALID_SIZE, iot_payload_heartbeat(e_payload_encoding_json, info, buffer, 64, &length));
+
+    uint8_t packed[512];
+    ASSERT_EQ(ESP_OK, iot_payload_heartbeat(e_payload_encoding_msgpack, info, (char*) packed, sizeof(packed), &length));
+    MsgPackReader reader(packed, length);
+    uint32_t count = 0;
+    ASSERT_TRUE(reader.read_map(&count));
+    EXPECT_EQ(11u, count);
+}
+
+//******************************************************************************
+/**
+ * @brief   Compact acks carry the seq or the payload hash
+ *
+ */
+TEST(iot_payload, compact_ack)
+{
+    char buffer[64];
+    size_t length = 0;
+
+    ledstate_ack_t ack = {};
+    ack.has_seq = true;
+    ack.id = 42;
+    ack.count = 3;
+    ack.encoding = e_payload_encoding_json;
+    ASSERT_EQ(ESP_OK, iot_payload_compact_ack(ack, buffer, sizeof(buffer), &length));
+    EXPECT_EQ(R"({"seq":42,"count":3})", std::string(buffer, length));
+
+    ack.has_seq = false;
+    ack.id = 0xbeef;
+    ack.duplicate = true;
+    ASSERT_EQ(ESP_OK, iot_payload_compact_ack(ack, buffer, sizeof(buffer), &length));
+    EXPECT_EQ(R"({"hash":"0000beef","count":3,"dup":true})", std::string(buffer, length));
+
+    ack.has_seq = true;
+    ack.id = 9;
+    ack.count = 1;
+    ack.duplicate = false;
+    ack.group = true;
+    ASSERT_EQ(ESP_OK, iot_payload_compact_ack(ack, buffer, sizeof(buffer), &length));
+    EXPECT_EQ(R"({"seq":9,"count":1,"group":true})", std::string(buffer, length));
+
+    ASSERT_EQ(ESP_OK, iot_payload_duplicate_ack(7, e_payload_encoding_json, buffer, sizeof(buffer), &length));
+    EXPECT_EQ(R"({"seq":7,"dup":true})", std::string(buffer, length));
+}
+
+//******************************************************************************
+/**
+ * @brief   Station registration sent to the group proxy
+ *
+ */
+TEST(iot_payload, register_station)
+{
+    char buffer[512];
+    size_t length = 0;
+
+    ASSERT_EQ(ESP_OK, iot_payload_register_station(
+        "a1b2c3d4e5f6", "site-1", 1, "st-100", 2, "st-200", buffer, sizeof(buffer), &length));
+    EXPECT_EQ(
+        R"({"thing_id":"a1b2c3d4e5f6","group_id":"site-1","leds":[)"
+        R"({"port":1,"station":"st-100","led":0,"last_state":"unknown","last_charge":0},)"
+        R"({"port":2,"station":"st-200","led":1,"last_state":"unknown","last_charge":0}]})",
+        std::string(buffer, length));
+}
@@ -0,0 +1,373 @@
+//******************************************************************************
+/**
+ * @file pixelstream_tests.cpp
+ * @author pat laplante (plaplante@appliedlogix.com)
+ *
+ * @brief Unit testing for the pixel stream receiver
+ * @version 0.1
+ * @date 2024-02-26
+ *
+ * The replay tests play a recorded show and report the frames that were
+ * dropped.
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+
+#include <gtest/gtest.h>
+#include "LED/PixelStream.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#define LED_COUNT       (32)
+#define STRIP_BYTES     (LED_COUNT * 3)
+
+typedef std::vector<uint8_t> packet_t;
+
+static packet_t ddp_packet(uint8_t seq, bool push, uint32_t offset, const uint8_t* data, uint16_t length) {
+    packet_t packet = {
+        (uint8_t)(0x40 | (push ? 0x01 : 0x00)), seq, 0x01, 0x01,
+        (uint8_t)(offset >> 24), (uint8_t)(offset >> 16), (uint8_t)(offset >> 8), (uint8_t) offset,
+        (uint8_t)(length >> 8), (uint8_t) length,
+    };
+    packet.insert(packet.end(), data, data + length);
+    return packet;
+}
+
+static pixel_stream_result_t receive(PixelStream& stream, const packet_t& packet, uint32_t now_ms = 0) {
+    return stream.receive(packet.data(), packet.size(), now_ms);
+}
+
+//******************************************************************************
+/**
+ * @brief   RGB in, GRB out, strip 1 follows strip 0, shown on push
+ *
+ */
+TEST(pixel_stream, frame)
+{
+    PixelStream stream;
+    ASSERT_EQ(ESP_OK, stream.setup(2, LED_COUNT));
+    EXPECT_FALSE(stream.is_active(0));
+    EXPECT_EQ(nullptr, stream.take_frame(0));
+
+    // Last pixel of strip 0 and first one of strip 1.
+    const uint8_t rgb[] = { 0x10, 0x20, 0x30, 0x40, 0x50, 0x60 };
+    EXPECT_EQ(e_pixel_stream_data, receive(stream, ddp_packet(1, false, STRIP_BYTES - 3, rgb, 3)));
+    EXPECT_EQ(nullptr, stream.take_frame(0));
+    EXPECT_EQ(e_pixel_stream_frame, receive(stream, ddp_packet(2, true, STRIP_BYTES, rgb + 3, 3), 100));
+    EXPECT_TRUE(stream.is_active(100));
+
+    const uint8_t* strip0 = stream.take_frame(0);
+    ASSERT_NE(nullptr, strip0);
+    EXPECT_EQ(0x20, strip0[STRIP_BYTES - 3]);
+    EXPECT_EQ(0x10, strip0[STRIP_BYTES - 2]);
+    EXPECT_EQ(0x30, strip0[STRIP_BYTES - 1]);
+    EXPECT_EQ(nullptr, stream.take_frame(0));
+
+    const uint8_t* strip1 = stream.take_frame(1);
+    ASSERT_NE(nullptr, strip1);
+    EXPECT_EQ(0x50, strip1[0]);
+    EXPECT_EQ(0x40, strip1[1]);
+    EXPECT_EQ(0x60, strip1[2]);
+
+    // Only strip 1 changes, strip 0 has no new frame but keeps its pixels
+    // for the next one.
+    EXPECT_EQ(e_pixel_stream_frame, receive(stream, ddp_packet(3, true, STRIP_BYTES + 3, rgb, 3), 200));
+    EXPECT_EQ(nullptr, stream.take_frame(0));
+    strip1 = stream.take_frame(1);
+    ASSERT_NE(nullptr, strip1);
+    EXPECT_EQ(0x50, strip1[0]);
+    EXPECT_EQ(0x20, strip1[3]);
+
+    EXPECT_EQ(e_pixel_stream_frame, receive(stream, ddp_packet(4, true, 0, rgb, 3), 300));
+    strip0 = stream.take_frame(0);
+    ASSERT_NE(nullptr, strip0);
+    EXPECT_EQ(0x20, strip0[0]);
+    EXPECT_EQ(0x20, strip0[STRIP_BYTES - 3]);
+
+    // Back to the station state when the controller stops.
+    EXPECT_TRUE(stream.is_active(300 + PIXEL_STREAM_TIMEOUT_MS - 1));
+    EXPECT_FALSE(stream.is_active(300 + PIXEL_STREAM_TIMEOUT_MS));
+
+    EXPECT_EQ(4u, stream.get_counters().packets);
+    EXPECT_EQ(3u, stream.get_counters().frames);
+    EXPECT_EQ(0u, stream.get_counters().overrun);
+
+    // Strip 0 pushed twice before its LED task took a frame.
+    EXPECT_EQ(e_pixel_stream_frame, receive(stream, ddp_packet(5, true, 0, rgb, 3), 400));
+    EXPECT_EQ(e_pixel_stream_frame, receive(stream, ddp_packet(6, true, 0, rgb, 3), 400));
+    EXPECT_EQ(1u, stream.get_counters().suppressed[0]);
+    EXPECT_EQ(0u, stream.get_counters().suppressed[1]);
+}
+
+//******************************************************************************
+/**
+ * @brief   An offset off a pixel boundary still moves on to the next strip
+ *
+ */
+TEST(pixel_stream, unaligned_offset)
+{
+    PixelStream stream;
+    ASSERT_EQ(ESP_OK, stream.setup(2, LED_COUNT));
+
+    // Starts on the green of the last pixel of strip 0, ends on the red of
+    // the second pixel of strip 1.
+    const uint8_t rgb[] = { 0x20, 0x30, 0x40, 0x50, 0x60, 0x70 };
+    EXPECT_EQ(e_pixel_stream_frame, receive(stream, ddp_packet(1, true, STRIP_BYTES - 2, rgb, sizeof(rgb))));
+
+    const uint8_t* strip0 = stream.take_frame(0);
+    ASSERT_NE(nullptr, strip0);
+    EXPECT_EQ(0x20, strip0[STRIP_BYTES - 3]);
+    EXPECT_EQ(0x00, strip0[STRIP_BYTES - 2]);
+    EXPECT_EQ(0x30, strip0[STRIP_BYTES - 1]);
+
+    const uint8_t* strip1 = stream.take_frame(1);
+    ASSERT_NE(nullptr, strip1);
+    EXPECT_EQ(0x50, strip1[0]);
+    EXPECT_EQ(0x40, strip1[1]);
+    EXPECT_EQ(0x60, strip1[2]);
+    EXPECT_EQ(0x70, strip1[4]);
+
+    // Unaligned and cut at the end of the display.
+    std::vector<uint8_t> big(STRIP_BYTES + 10, 0xAA);
+    EXPECT_EQ(e_pixel_stream_frame, receive(stream, ddp_packet(2, true, STRIP_BYTES + 4, big.data(), big.size())));
+    strip1 = stream.take_frame(1);
+    ASSERT_NE(nullptr, strip1);
+    EXPECT_EQ(0x70, strip1[4]);
+    EXPECT_EQ(0xAA, strip1[3]);
+    EXPECT_EQ(0xAA, strip1[STRIP_BYTES - 1]);
+}
+
+//******************************************************************************
+/**
+ * @brief   Late and foreign packets are dropped, not shown
+ *
+ */
+TEST(pixel_stream, sequencing)
+{
+    PixelStream stream;
+    ASSERT_EQ(ESP_OK, stream.setup(1, LED_COUNT));
+
+    const uint8_t rgb[] = { 1, 2, 3 };
+    EXPECT_EQ(e_pixel_stream_data, receive(stream, ddp_packet(14, false, 0, rgb, 3)));
+    EXPECT_EQ(e_pixel_stream_late, receive(stream, ddp_packet(14, true, 0, rgb, 3)));
+    EXPECT_EQ(e_pixel_stream_late, receive(stream, ddp_packet(7, true, 0, rgb, 3)));
+
+    // Wraps around, 0 is not a seq.
+    EXPECT_EQ(e_pixel_stream_data, receive(stream, ddp_packet(15, false, 0, rgb, 3)));
+    EXPECT_EQ(e_pixel_stream_frame, receive(stream, ddp_packet(1, true, 0, rgb, 3)));
+    EXPECT_EQ(e_pixel_stream_late, receive(stream, ddp_packet(15, true, 0, rgb, 3)));
+
+    // Unnumbered packets are taken as they come.
+    EXPECT_EQ(e_pixel_stream_frame, receive(stream, ddp_packet(0, true, 0, rgb, 3)));
+    EXPECT_EQ(3u, stream.get_counters().late);
+
+    // A query, a short packet, a length past the end.
+    packet_t query = ddp_packet(2, false, 0, rgb, 0);
+    query[0] |= 0x02;
+    EXPECT_EQ(e_pixel_stream_ignored, receive(stream, query));
+    EXPECT_EQ(e_pixel_stream_invalid, stream.receive(query.data(), 9, 0));
+    packet_t truncated = ddp_packet(2, true, 0, rgb, 3);
+    truncated.pop_back();
+    EXPECT_EQ(e_pixel_stream_invalid, receive(stream, truncated));
+    EXPECT_EQ(2u, stream.get_counters().invalid);
+
+    // Past the end of the display is cut, not written.
+    std::vector<uint8_t> big(STRIP_BYTES + 30, 0xAA);
+    EXPECT_EQ(e_pixel_stream_frame, receive(stream, ddp_packet(3, true, 0, big.data(), big.size())));
+    EXPECT_EQ(e_pixel_stream_frame, receive(stream, ddp_packet(4, true, STRIP_BYTES * 4, rgb, 3)));
+    EXPECT_EQ(4u, stream.get_counters().frames);
+}
+
+typedef struct {
+    uint32_t time_ms;
+    packet_t packet;
+} recorded_packet_t;
+
+//******************************************************************************
+/**
+ * @brief   A recorded show, every frame a solid color numbered by the frame
+ *
+ * Two packets a frame, like a controller that splits the display per strip.
+ * Every reorder_every frame its push packet comes in after the first packet
+ * of the next frame, the way a wifi retry reorders them: that frame is late.
+ */
+static std::vector<recorded_packet_t> record_show(int frame_count, int fps, int reorder_every, int* reordered) {
+    std::vector<recorded_packet_t> recording;
+    uint8_t seq = 0;
+    auto next_seq = [&seq]() { seq = seq % 15 + 1; return seq; };
+
+    std::vector<uint8_t> pixels(STRIP_BYTES);
+    recorded_packet_t held;
+    *reordered = 0;
+    for (int frame = 0; frame < frame_count; frame++) {
+        uint32_t time_ms = (uint32_t)(frame * 1000 / fps);
+        std::fill(pixels.begin(), pixels.end(), (uint8_t) frame);
+        recorded_packet_t first = { time_ms, ddp_packet(next_seq(), false, 0, pixels.data(), STRIP_BYTES) };
+        recorded_packet_t push = { time_ms, ddp_packet(next_seq(), true, STRIP_BYTES, pixels.data(), STRIP_BYTES) };
+
+        recording.push_back(first);
+        if (!held.packet.empty()) {
+            recording.push_back(held);
+            held.packet.clear();
+        }
+        if (frame % reorder_every == reorder_every - 1 && frame != frame_count - 1) {
+            held = push;
+            (*reordered)++;
+        } else {
+            recording.push_back(push);
+        }
+    }
+    return recording;
+}
+
+//******************************************************************************
+/**
+ * @brief   Replay a recorded show, count the frames dropped
+ *
+ * The LED task is simulated: it takes a frame when it is done writing the
+ * previous one, about 12 ms for a strip write and its settle delay.  At
+ * 60 fps it keeps up, only the late frames are lost.  At 120 fps it shows
+ * the newest frame each time and the ones in between are dropped.
+ */
+TEST(pixel_stream, replay)
+{
+    const int refresh_ms = 12;
+    const int frame_count = 600;
+
+    for (int fps : { 60, 120 }) {
+        int reordered = 0;
+        std::vector<recorded_packet_t> recording = record_show(frame_count, fps, 25, &reordered);
+
+        PixelStream stream;
+        ASSERT_EQ(ESP_OK, stream.setup(2, LED_COUNT));
+
+        int shown = 0;
+        int last = -1;
+        uint32_t next_refresh_ms = 0;
+        auto led_task = [&](uint32_t now_ms) {
+            if (now_ms < next_refresh_ms) {
+                return;
+            }
+            // Both strips refresh together, like the two LED tasks woken
+            // up by the same frame.
+            const uint8_t* frame = stream.take_frame(0);
+            if (frame != nullptr) {
+                ASSERT_NE(nullptr, stream.take_frame(1));
+                EXPECT_NE(last, frame[0]);
+                last = frame[0];
+                shown++;
+                next_refresh_ms = now_ms + refresh_ms;
+            }
+        };
+
+        for (const recorded_packet_t& recorded : recording) {
+            led_task(recorded.time_ms);
+            stream.receive(recorded.packet.data(), recorded.packet.size(), recorded.time_ms);
+        }
+        led_task(UINT32_MAX);
+
+        const pixel_stream_counters_t& counters = stream.get_counters();
+        printf("pixel stream %3d fps : %lu frames, %lu late, %lu dropped, %d shown\n",
+            fps,
+            (unsigned long) counters.frames,
+            (unsigned long) counters.late,
+            (unsigned long) counters.overrun,
+            shown);
+
+        EXPECT_EQ((uint32_t) reordered, counters.late);
+        EXPECT_EQ((uint32_t)(frame_count - reordered), counters.frames);
+        EXPECT_EQ(counters.frames, shown + counters.overrun);
+        EXPECT_EQ(counters.overrun, counters.suppressed[0]);
+        EXPECT_EQ(counters.overrun, counters.suppressed[1]);
+        if (fps * refresh_ms < 1000) {
+            EXPECT_EQ(0u, counters.overrun);
+        } else {
+            EXPECT_NE(0u, counters.overrun);
+        }
+        EXPECT_EQ((uint8_t)(frame_count - 1), last);
+    }
+}
+
+//******************************************************************************
+/**
+ * @brief   Replay at full rate against an LED task in another thread
+ *
+ * No pacing at all, the receiver runs as fast as it can while the LED task
+ * takes frames.  Every frame it gets must be whole and newer than the
+ * previous one.
+ */
+TEST(pixel_stream, replay_full_rate)
+{
+    int reordered = 0;
+    std::vector<recorded_packet_t> recording = record_show(600, 60, 25, &reordered);
+
+    PixelStream stream;
+    ASSERT_EQ(ESP_OK, stream.setup(2, LED_COUNT));
+
+    std::atomic<bool> started(false);
+    std::atomic<bool> done(false);
+    int shown[2] = { 0, 0 };
+    int torn = 0;
+    int out_of_order = 0;
+
+    std::thread led_task([&]() {
+        int last[2] = { -1, -1 };
+        bool draining = true;
+        started = true;
+        while (draining) {
+            draining = !done.load();
+            for (int strip = 0; strip < 2; strip++) {
+                const uint8_t* frame = stream.take_frame(strip);
+                if (frame == nullptr) {
+                    continue;
+                }
+                for (int i = 1; i < STRIP_BYTES; i++) {
+                    if (frame[i] != frame[0]) {
+                        torn++;
+                        break;
+                    }
+                }
+                // Frame numbers are a byte, newer is less than half the
+                // range ahead.
+                uint8_t delta = (uint8_t)(frame[0] - last[strip]);
+                if (last[strip] >= 0 && (delta == 0 || delta >= 128)) {
+                    out_of_order++;
+                }
+                last[strip] = frame[0];
+                shown[strip]++;
+            }
+        }
+    });
+    while (!started) {
+        std::this_thread::yield();
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (const recorded_packet_t& recorded : recording) {
+        stream.receive(recorded.packet.data(), recorded.packet.size(), recorded.time_ms);
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    done = true;
+    led_task.join();
+
+    const pixel_stream_counters_t& counters = stream.get_counters();
+    double ns = std::chrono::duration<double, std::nano>(elapsed).count() / recording.size();
+    printf("pixel stream full rate : %.0f ns/packet, %lu frames, %lu dropped, shown %d/%d\n",
+        ns,
+        (unsigned long) counters.frames,
+        (unsigned long) counters.overrun,
+        shown[0], shown[1]);
+
+    EXPECT_EQ(recording.size(), counters.packets);
+    EXPECT_EQ((uint32_t) reordered, counters.late);
+    EXPECT_EQ(0, torn);
+    EXPECT_EQ(0, out_of_order);
+
+    // Every frame pushed was shown or replaced by a newer one.
+    EXPECT_EQ(counters.frames, shown[0] + counters.suppressed[0]);
+    EXPECT_EQ(counters.frames, shown[1] + counters.suppressed[1]);
+}
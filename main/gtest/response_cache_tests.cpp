@@ -0,0 +1,105 @@
+//******************************************************************************
+/**
+ * @file response_cache_tests.cpp
+ * @author pat laplante (plaplante@appliedlogix.com)
+ *
+ * @brief Unit testing for the udp response cache
+ * @version 0.1
+ * @date 2024-02-28
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+
+#include <gtest/gtest.h>
+#include "App/ResponseCache.h"
+#include "Utils/ConfigBlob.h"
+
+#include <string.h>
+
+static const char info[] = R"({"command":"get-info","status":"ok","mac_address":"AA:BB:CC:DD:EE:FF"})";
+
+//******************************************************************************
+/**
+ * @brief   Served until invalidated or the key changes
+ *
+ */
+TEST(response_cache, hit_and_invalidate)
+{
+    ResponseCache cache;
+    char out[256];
+    int out_len = sizeof(out);
+
+    EXPECT_FALSE(cache.get(0, 0, out, out_len));
+
+    cache.put(0, 0x0102, cache.get_generation(), info, strlen(info));
+    out_len = sizeof(out);
+    ASSERT_TRUE(cache.get(0, 0x0102, out, out_len));
+    EXPECT_EQ((int) strlen(info), out_len);
+    EXPECT_STREQ(info, out);
+
+    // Other slot, other key.
+    out_len = sizeof(out);
+    EXPECT_FALSE(cache.get(1, 0x0102, out, out_len));
+    EXPECT_FALSE(cache.get(0, 0x0201, out, out_len));
+
+    cache.invalidate();
+    EXPECT_FALSE(cache.get(0, 0x0102, out, out_len));
+    EXPECT_EQ(1u, cache.get_hits());
+    EXPECT_EQ(4u, cache.get_misses());
+}
+
+//******************************************************************************
+/**
+ * @brief   Any configuration saved, by any writer, is an invalidation
+ *
+ */
+TEST(response_cache, config_saved)
+{
+    ResponseCache cache;
+    char out[256];
+    int out_len = sizeof(out);
+
+    cache.put(1, 0, cache.get_generation(), info, strlen(info));
+    ASSERT_TRUE(cache.get(1, 0, out, out_len));
+
+    config_blob_changed();
+    out_len = sizeof(out);
+    EXPECT_FALSE(cache.get(1, 0, out, out_len));
+
+    // Built before the save, not served.
+    uint32_t generation = cache.get_generation();
+    config_blob_changed();
+    cache.put(1, 0, generation, info, strlen(info));
+    EXPECT_FALSE(cache.get(1, 0, out, out_len));
+}
+
+//******************************************************************************
+/**
+ * @brief   A response built across an invalidation is not served
+ *
+ */
+TEST(response_cache, stale_build)
+{
+    ResponseCache cache;
+    char out[256];
+    int out_len = sizeof(out);
+
+    uint32_t generation = cache.get_generation();
+    cache.invalidate();
+    cache.put(0, 0, generation, info, strlen(info));
+    EXPECT_FALSE(cache.get(0, 0, out, out_len));
+
+    cache.put(0, 0, cache.get_generation(), info, strlen(info));
+    EXPECT_TRUE(cache.get(0, 0, out, out_len));
+
+    // Does not fit the caller's buffer.
+    out_len = 8;
+    EXPECT_FALSE(cache.get(0, 0, out, out_len));
+
+    // Too big to keep.
+    static char big[RESPONSE_CACHE_SIZE + 1];
+    cache.put(0, 0, cache.get_generation(), big, sizeof(big));
+    out_len = sizeof(out);
+    EXPECT_FALSE(cache.get(0, 0, out, out_len));
+}
@@ -0,0 +1,116 @@
+//******************************************************************************
+/**
+ * @file scratch_arena_tests.cpp
+ * @author pat laplante (plaplante@appliedlogix.com)
+ *
+ * @brief Unit testing for the shared scratch arena
+ * @version 0.1
+ * @date 2024-02-28
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+
+#include <gtest/gtest.h>
+#include "Utils/ScratchArena.h"
+
+#include <string.h>
+
+//******************************************************************************
+/**
+ * @brief   Whole blocks, first fit, freed blocks are reused
+ *
+ */
+TEST(scratch_arena, lease_and_release)
+{
+    ScratchArena& arena = ScratchArena::instance();
+    ASSERT_EQ(0u, arena.get_leased());
+
+    char* rx = (char*) arena.lease(4096, 0);
+    char* small = (char*) arena.lease(1, 0);
+    char* doc = (char*) arena.lease(4097, 0);
+    ASSERT_NE(nullptr, rx);
+    ASSERT_NE(nullptr, small);
+    ASSERT_NE(nullptr, doc);
+    EXPECT_EQ(rx + 4096, small);
+    EXPECT_EQ(small + SCRATCH_ARENA_BLOCK_SIZE, doc);
+    EXPECT_EQ(4096u + SCRATCH_ARENA_BLOCK_SIZE + 4096u + SCRATCH_ARENA_BLOCK_SIZE, arena.get_leased());
+    memset(doc, 0xAA, 4097);
+
+    // The hole left by small only takes what fits.
+    arena.release(small);
+    EXPECT_EQ(small, arena.lease(SCRATCH_ARENA_BLOCK_SIZE, 0));
+    arena.release(small);
+    char* reply = (char*) arena.lease(SCRATCH_ARENA_BLOCK_SIZE + 1, 0);
+    EXPECT_EQ(doc + 4096 + SCRATCH_ARENA_BLOCK_SIZE, reply);
+
+    arena.release(rx);
+    arena.release(doc);
+    arena.release(reply);
+    EXPECT_EQ(0u, arena.get_leased());
+    EXPECT_GE(arena.get_peak(), 4096u + SCRATCH_ARENA_BLOCK_SIZE + 4096u + SCRATCH_ARENA_BLOCK_SIZE * 2);
+}
+
+//******************************************************************************
+/**
+ * @brief   No room fails, bad releases are ignored
+ *
+ */
+TEST(scratch_arena, full)
+{
+    ScratchArena& arena = ScratchArena::instance();
+    uint32_t failed = arena.get_failed();
+
+    void* all = arena.lease(SCRATCH_ARENA_SIZE, 0);
+    ASSERT_NE(nullptr, all);
+    EXPECT_EQ(nullptr, arena.lease(1, 0));
+    EXPECT_EQ(nullptr, arena.lease(0, 0));
+    EXPECT_EQ(failed + 2, arena.get_failed());
+
+    arena.release((uint8_t*) all + 1);
+    arena.release((uint8_t*) all + SCRATCH_ARENA_BLOCK_SIZE);
+    EXPECT_EQ((size_t) SCRATCH_ARENA_SIZE, arena.get_leased());
+    arena.release(all);
+
+    EXPECT_EQ(nullptr, arena.lease(SCRATCH_ARENA_SIZE + 1, 0));
+    EXPECT_EQ(0u, arena.get_leased());
+}
+
+//******************************************************************************
+/**
+ * @brief   Leases go back when they go out of scope, swap hands them over
+ *
+ */
+TEST(scratch_arena, lease_scope)
+{
+    ScratchArena& arena = ScratchArena::instance();
+
+    ScratchLease kept;
+    {
+        ScratchLease reply(1000, 0);
+        ASSERT_TRUE(reply.is_leased());
+        EXPECT_EQ(1000u, reply.size());
+        strcpy(reply.data(), "deferred");
+
+        ScratchLease other(100, 0);
+        EXPECT_EQ((size_t) 3 * SCRATCH_ARENA_BLOCK_SIZE, arena.get_leased());
+
+        kept.swap(reply);
+        EXPECT_FALSE(reply.is_leased());
+    }
+    EXPECT_EQ((size_t) 2 * SCRATCH_ARENA_BLOCK_SIZE, arena.get_leased());
+    EXPECT_STREQ("deferred", kept.data());
+
+    // A new lease replaces the old one.
+    kept.lease(10, 0);
+    EXPECT_EQ((size_t) SCRATCH_ARENA_BLOCK_SIZE, arena.get_leased());
+    kept.release();
+    EXPECT_EQ(0u, arena.get_leased());
+
+    ScratchJsonAllocator allocator;
+    void* pool = allocator.allocate(2048);
+    ASSERT_NE(nullptr, pool);
+    EXPECT_EQ(pool, allocator.reallocate(pool, 100));
+    allocator.deallocate(pool);
+    EXPECT_EQ(0u, arena.get_leased());
+}
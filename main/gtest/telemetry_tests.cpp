@@ -0,0 +1,75 @@
+//******************************************************************************
+/**
+ * @file telemetry_tests.cpp
+ * @author pat laplante (plaplante@appliedlogix.com)
+ *
+ * @brief Unit testing for the telemetry ring
+ * @version 0.1
+ * @date 2024-02-16
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+
+#include <gtest/gtest.h>
+#include "App/TelemetryRing.h"
+
+static telemetry_event_t make_event(uint32_t time_s) {
+    telemetry_event_t event = {};
+    event.time_s = time_s;
+    event.type = e_telemetry_night_mode;
+    event.value = time_s & 1;
+    event.name = "night_mode";
+    return event;
+}
+
+//******************************************************************************
+/**
+ * @brief   Events come back oldest first, flush is asked at the threshold
+ *
+ */
+TEST(telemetry_ring, push)
+{
+    TelemetryRing ring(4);
+    EXPECT_EQ(0u, ring.size());
+
+    EXPECT_FALSE(ring.push(make_event(1)));
+    EXPECT_FALSE(ring.push(make_event(2)));
+    EXPECT_FALSE(ring.push(make_event(3)));
+    EXPECT_TRUE(ring.push(make_event(4)));
+    EXPECT_TRUE(ring.should_flush());
+
+    ASSERT_EQ(4u, ring.size());
+    for (size_t i = 0; i < ring.size(); i++) {
+        EXPECT_EQ(i + 1, ring.at(i).time_s);
+    }
+
+    ring.clear();
+    EXPECT_EQ(0u, ring.size());
+    EXPECT_FALSE(ring.should_flush());
+    EXPECT_EQ(0u, ring.get_dropped());
+}
+
+//******************************************************************************
+/**
+ * @brief   A full ring overwrites the oldest events and counts them
+ *
+ */
+TEST(telemetry_ring, overflow)
+{
+    TelemetryRing ring;
+    for (uint32_t i = 0; i < TELEMETRY_RING_SIZE + 5; i++) {
+        ring.push(make_event(i));
+    }
+
+    ASSERT_EQ((size_t) TELEMETRY_RING_SIZE, ring.size());
+    EXPECT_EQ(5u, ring.get_dropped());
+    EXPECT_EQ(5u, ring.at(0).time_s);
+    EXPECT_EQ((uint32_t) TELEMETRY_RING_SIZE + 4, ring.at(TELEMETRY_RING_SIZE - 1).time_s);
+
+    // Dropped is kept across flushes, it is reported with every heartbeat.
+    ring.clear();
+    ring.push(make_event(100));
+    EXPECT_EQ(100u, ring.at(0).time_s);
+    EXPECT_EQ(5u, ring.get_dropped());
+}
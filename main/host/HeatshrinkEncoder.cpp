@@ -0,0 +1,141 @@
+//******************************************************************************
+/**
+ * @file HeatshrinkEncoder.cpp
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief Host side heatshrink encoder for the compressed firmware images
+ * @version 0.1
+ * @date 2024-02-29
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#include "HeatshrinkEncoder.h"
+
+#include "Utils/HeatshrinkDecoder.h"
+
+// Candidates looked at for each position, enough for firmware images.
+#define ENCODER_MAX_CHAIN   (256)
+
+namespace {
+
+class BitWriter {
+public:
+    explicit BitWriter(std::vector<uint8_t>& out) : out(out) {}
+
+    void put(uint32_t value, int count) {
+        for (int i = count - 1; i >= 0; i--) {
+            this->current = (uint8_t)((this->current << 1) | ((value >> i) & 1));
+            if (++this->bits == 8) {
+                this->out.push_back(this->current);
+                this->current = 0;
+                this->bits = 0;
+            }
+        }
+    }
+
+    // Zeros up to the next byte.
+    void flush(void) {
+        if (this->bits != 0) {
+            this->out.push_back((uint8_t)(this->current << (8 - this->bits)));
+            this->current = 0;
+            this->bits = 0;
+        }
+    }
+
+private:
+    std::vector<uint8_t>& out;
+    uint8_t current = 0;
+    int bits = 0;
+};
+
+}
+
+//******************************************************************************
+/**
+ * @brief Greedy LZSS over hash chains of the next two bytes.
+ */
+std::vector<uint8_t> heatshrink_encode(const uint8_t* data, size_t length, uint8_t window_bits, uint8_t lookahead_bits) {
+    std::vector<uint8_t> out;
+    BitWriter writer(out);
+
+    const size_t window = (size_t) 1 << window_bits;
+    const size_t max_count = (size_t) 1 << lookahead_bits;
+
+    // A back reference must be shorter than the literals it replaces.
+    const size_t min_count = (1 + window_bits + lookahead_bits) / 9 + 1;
+
+    std::vector<int32_t> head(1 << 16, -1);
+    std::vector<int32_t> previous(length, -1);
+
+    auto insert = [&](size_t position) {
+        if (position + 1 < length) {
+            uint16_t key = (uint16_t)(data[position] << 8 | data[position + 1]);
+            previous[position] = head[key];
+            head[key] = (int32_t) position;
+        }
+    };
+
+    size_t position = 0;
+    while (position < length) {
+        size_t best_count = 0;
+        size_t best_offset = 0;
+
+        if (position + 1 < length) {
+            uint16_t key = (uint16_t)(data[position] << 8 | data[position + 1]);
+            int32_t candidate = head[key];
+            for (int chain = 0; candidate >= 0 && chain < ENCODER_MAX_CHAIN; chain++) {
+                size_t offset = position - (size_t) candidate;
+                if (offset > window) {
+                    break;
+                }
+
+                size_t count = 0;
+                while (count < max_count && position + count < length && data[candidate + count] == data[position + count]) {
+                    count++;
+                }
+                if (count > best_count) {
+                    best_count = count;
+                    best_offset = offset;
+                    if (count == max_count) {
+                        break;
+                    }
+                }
+                candidate = previous[candidate];
+            }
+        }
+
+        if (best_count >= min_count) {
+            writer.put(0, 1);
+            writer.put((uint32_t)(best_offset - 1), window_bits);
+            writer.put((uint32_t)(best_count - 1), lookahead_bits);
+            for (size_t i = 0; i < best_count; i++) {
+                insert(position + i);
+            }
+            position += best_count;
+        } else {
+            writer.put(1, 1);
+            writer.put(data[position], 8);
+            insert(position);
+            position++;
+        }
+    }
+
+    writer.flush();
+    return out;
+}
+
+//******************************************************************************
+std::vector<uint8_t> fw_image_compress(const uint8_t* data, size_t length, uint8_t window_bits, uint8_t lookahead_bits) {
+    std::vector<uint8_t> image(FW_IMAGE_MAGIC, FW_IMAGE_MAGIC + FW_IMAGE_MAGIC_LENGTH);
+    image.push_back(FW_IMAGE_VERSION);
+    image.push_back(window_bits);
+    image.push_back(lookahead_bits);
+    image.push_back(0);
+    for (int i = 0; i < 4; i++) {
+        image.push_back((uint8_t)(length >> (8 * i)));
+    }
+
+    std::vector<uint8_t> stream = heatshrink_encode(data, length, window_bits, lookahead_bits);
+    image.insert(image.end(), stream.begin(), stream.end());
+    return image;
+}
@@ -0,0 +1,25 @@
+//******************************************************************************
+/**
+ * @file HeatshrinkEncoder.h
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief Host side heatshrink encoder for the compressed firmware images
+ * @version 0.1
+ * @date 2024-02-29
+ *
+ * Never runs on the device, it only has to produce what HeatshrinkDecoder
+ * reads.
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+std::vector<uint8_t> heatshrink_encode(const uint8_t* data, size_t length, uint8_t window_bits, uint8_t lookahead_bits);
+
+// The FW_IMAGE_MAGIC header followed by the heatshrink stream.
+std::vector<uint8_t> fw_image_compress(const uint8_t* data, size_t length, uint8_t window_bits, uint8_t lookahead_bits);
@@ -0,0 +1,153 @@
+//******************************************************************************
+/**
+ * @file HostClient.cpp
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief An mqtt client for the host tools
+ * @version 0.1
+ * @date 2024-02-22
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#include "HostClient.h"
+
+#include "App/MqttAgent/MqttConfig.h"
+
+#include "esp_log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char* TAG = "host_client";
+
+//******************************************************************************
+esp_err_t HostClient::connect(
+    const host_broker_t& broker,
+    const char* client_id,
+    uint16_t keep_alive_s,
+    EventCallback_t callback,
+    void* context,
+    const char* user_name
+) {
+    int recv_poll_ms = this->network_context.recv_poll_ms;
+    memset(&this->network_context, 0x00, sizeof(NetworkContext_t));
+    this->network_context.pcHostname = broker.host;
+    this->network_context.xPort = broker.port;
+    this->network_context.pcServerRootCA = broker.root_ca;
+    this->network_context.pcServerRootCASize = broker.root_ca != nullptr ? strlen(broker.root_ca) + 1 : 0;
+    this->network_context.pcClientCert = broker.client_cert;
+    this->network_context.pcClientCertSize = broker.client_cert != nullptr ? strlen(broker.client_cert) + 1 : 0;
+    this->network_context.pcClientKey = broker.client_key;
+    this->network_context.pcClientKeySize = broker.client_key != nullptr ? strlen(broker.client_key) + 1 : 0;
+
+    // Wait for the CONNACK instead of spinning on it.
+    this->network_context.recv_poll_ms = 1;
+
+    if (xTlsConnect(&this->network_context) != TLS_TRANSPORT_SUCCESS) {
+        ESP_LOGE(TAG, "Failed to connect to %s:%d", broker.host, broker.port);
+        return ESP_FAIL;
+    }
+    if (this->mqtt_context.initialize(&this->network_context, callback, context) != ESP_OK) {
+        xTlsDisconnect(&this->network_context);
+        return ESP_FAIL;
+    }
+
+    MQTTConnectInfo_t connect_info;
+    memset(&connect_info, 0x00, sizeof(MQTTConnectInfo_t));
+    connect_info.cleanSession = true;
+    connect_info.pClientIdentifier = client_id;
+    connect_info.clientIdentifierLength = (uint16_t) strlen(client_id);
+    connect_info.keepAliveSeconds = keep_alive_s;
+    if (user_name != nullptr) {
+        connect_info.pUserName = user_name;
+        connect_info.userNameLength = (uint16_t) strlen(user_name);
+    }
+
+    bool session_present = false;
+    MQTTStatus_t status = MQTT_Connect(this->get(), &connect_info, NULL, CONNACK_RECV_TIMEOUT_MS, &session_present);
+    this->network_context.recv_poll_ms = recv_poll_ms;
+    if (status != MQTTSuccess) {
+        ESP_LOGE(TAG, "MQTT_Connect failed for %s: %s", client_id, MQTT_Status_strerror(status));
+        xTlsDisconnect(&this->network_context);
+        return ESP_FAIL;
+    }
+
+    this->connected = true;
+    return ESP_OK;
+}
+
+//******************************************************************************
+/**
+ * @brief Close the connection.
+ *
+ * @param graceful  Send DISCONNECT first.  Without it the broker sees the
+ *                  socket drop, like a controller losing power.
+ */
+void HostClient::disconnect(bool graceful) {
+    if (graceful && this->connected) {
+        MQTT_Disconnect(this->get());
+    }
+    xTlsDisconnect(&this->network_context);
+    this->connected = false;
+}
+
+//******************************************************************************
+esp_err_t HostClient::subscribe(const char* topic, uint16_t topic_length, uint16_t* packet_id) {
+    MQTTSubscribeInfo_t subscription;
+    memset(&subscription, 0x00, sizeof(MQTTSubscribeInfo_t));
+    subscription.qos = MQTTQoS0;
+    subscription.pTopicFilter = topic;
+    subscription.topicFilterLength = topic_length;
+
+    *packet_id = MQTT_GetPacketId(this->get());
+    MQTTStatus_t status = MQTT_Subscribe(this->get(), &subscription, 1, *packet_id);
+    if (status != MQTTSuccess) {
+        ESP_LOGE(TAG, "MQTT_Subscribe failed: %s", MQTT_Status_strerror(status));
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+//******************************************************************************
+esp_err_t HostClient::publish(const char* topic, uint16_t topic_length, const void* payload, size_t payload_length) {
+    MQTTPublishInfo_t packet;
+    memset(&packet, 0x00, sizeof(MQTTPublishInfo_t));
+    packet.qos = MQTTQoS0;
+    packet.pTopicName = topic;
+    packet.topicNameLength = topic_length;
+    packet.pPayload = payload;
+    packet.payloadLength = payload_length;
+
+    MQTTStatus_t status = MQTT_Publish(this->get(), &packet, 0);
+    if (status != MQTTSuccess) {
+        ESP_LOGE(TAG, "MQTT_Publish failed: %s", MQTT_Status_strerror(status));
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+//******************************************************************************
+const char* HostClient::read_pem(const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (file == nullptr) {
+        ESP_LOGE(TAG, "Failed to open %s", path);
+        return nullptr;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    char* pem = length >= 0 ? (char*) malloc(length + 1) : nullptr;
+    if (pem == nullptr || fread(pem, 1, length, file) != (size_t) length) {
+        ESP_LOGE(TAG, "Failed to read %s", path);
+        free(pem);
+        fclose(file);
+        return nullptr;
+    }
+    pem[length] = '\0';
+
+    fclose(file);
+    return pem;
+}
@@ -0,0 +1,75 @@
+//******************************************************************************
+/**
+ * @file HostClient.h
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief An mqtt client for the host tools
+ * @version 0.1
+ * @date 2024-02-22
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#pragma once
+
+#include "Utils/NoCopy.h"
+#include "App/MqttAgent/MqttContext.h"
+
+#include "network_transport.h"
+
+#include "esp_err.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The certificates are PEM, see read_pem().
+typedef struct {
+    const char* host;
+    int port;
+    const char* root_ca;        // enables TLS
+    const char* client_cert;
+    const char* client_key;
+} host_broker_t;
+
+//******************************************************************************
+/**
+ * @brief MqttContext over the host transport.
+ *
+ * Connects the way MqttConnection does, minus the retries, and keeps the
+ * network context next to the mqtt context so many can live side by side.
+ */
+class HostClient : public NoCopy {
+public:
+    HostClient(void) = default;
+    ~HostClient(void) = default;
+
+public:
+    esp_err_t connect(
+        const host_broker_t& broker,
+        const char* client_id,
+        uint16_t keep_alive_s,
+        EventCallback_t callback,
+        void* context,
+        const char* user_name = nullptr
+    );
+    void disconnect(bool graceful = true);
+
+    esp_err_t subscribe(const char* topic, uint16_t topic_length, uint16_t* packet_id);
+    esp_err_t publish(const char* topic, uint16_t topic_length, const void* payload, size_t payload_length);
+
+    // How long recv waits for data, -1 returns at once.  Use -1 when the
+    // socket is polled by the caller.
+    inline void set_recv_poll_ms(int poll_ms) { this->network_context.recv_poll_ms = poll_ms; }
+
+    inline bool is_connected(void) const { return this->connected; }
+    inline int get_socket(void) const { return this->network_context.pxTls != nullptr ? this->network_context.pxTls->sockfd : -1; }
+    inline MQTTContext_t* get(void) { return this->mqtt_context.get_mqtt_context(); }
+
+    // The whole file, nul terminated, in heap until exit.  NULL if it can't
+    // be read.
+    static const char* read_pem(const char* path);
+
+private:
+    NetworkContext_t network_context = {};
+    MqttContext mqtt_context;
+    bool connected = false;
+};
@@ -0,0 +1,175 @@
+//******************************************************************************
+/**
+ * @file HttpRangeSource.cpp
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief Host OtaBlockSource, plain http range requests over a socket
+ * @version 0.1
+ * @date 2024-03-01
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#include "HttpRangeSource.h"
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+
+#define HTTP_RANGE_TIMEOUT_S    (5)
+
+//******************************************************************************
+/**
+ * @brief Split "http://host[:port]/path".
+ */
+static bool parse_url(const char* url, char* host, size_t host_size, char* port, size_t port_size, const char** path) {
+    const char* scheme = "http://";
+    if (strncmp(url, scheme, strlen(scheme)) != 0) {
+        return false;
+    }
+
+    const char* start = url + strlen(scheme);
+    const char* slash = strchr(start, '/');
+    *path = slash != nullptr ? slash : "/";
+    const char* end = slash != nullptr ? slash : start + strlen(start);
+    const char* colon = (const char*) memchr(start, ':', end - start);
+
+    const char* host_end = colon != nullptr ? colon : end;
+    if (host_end == start || (size_t)(host_end - start) >= host_size) {
+        return false;
+    }
+    snprintf(host, host_size, "%.*s", (int)(host_end - start), start);
+    snprintf(port, port_size, "%.*s", colon != nullptr ? (int)(end - colon - 1) : 2, colon != nullptr ? colon + 1 : "80");
+    return true;
+}
+
+//******************************************************************************
+esp_err_t HttpRangeSource::open(const ota_job_t& job, uint32_t offset, uint32_t length) {
+    char host[128];
+    char port[8];
+    const char* path;
+
+    this->close();
+    if (length == 0 || !parse_url(job.url, host, sizeof(host), port, sizeof(port), &path)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    struct addrinfo hints = {};
+    struct addrinfo* addresses = nullptr;
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, port, &hints, &addresses) != 0) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    this->sock = socket(addresses->ai_family, addresses->ai_socktype, addresses->ai_protocol);
+    struct timeval timeout = { HTTP_RANGE_TIMEOUT_S, 0 };
+    if (this->sock >= 0) {
+        setsockopt(this->sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    }
+    bool connected = this->sock >= 0 && connect(this->sock, addresses->ai_addr, addresses->ai_addrlen) == 0;
+    freeaddrinfo(addresses);
+    if (!connected) {
+        this->close();
+        return ESP_FAIL;
+    }
+
+    char request[OTA_URL_MAX_LENGTH + 256];
+    int request_length = snprintf(request, sizeof(request),
+        "GET %s HTTP/1.1\r\nHost: %s\r\nRange: bytes=%lu-%lu\r\nConnection: close\r\n\r\n",
+        path, host, (unsigned long) offset, (unsigned long)(offset + length - 1));
+    if (send(this->sock, request, request_length, MSG_NOSIGNAL) != request_length) {
+        this->close();
+        return ESP_FAIL;
+    }
+
+    esp_err_t ret = this->read_headers(offset, length);
+    if (ret != ESP_OK) {
+        this->close();
+    }
+    return ret;
+}
+
+//******************************************************************************
+/**
+ * @brief Wait for a 206 with the range asked for.
+ */
+esp_err_t HttpRangeSource::read_headers(uint32_t offset, uint32_t length) {
+    size_t received = 0;
+    char* end = nullptr;
+
+    while (end == nullptr) {
+        if (received == sizeof(this->pending) - 1) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        ssize_t count = recv(this->sock, this->pending + received, sizeof(this->pending) - 1 - received, 0);
+        if (count <= 0) {
+            return ESP_FAIL;
+        }
+        received += count;
+        this->pending[received] = '\0';
+        end = strstr(this->pending, "\r\n\r\n");
+    }
+
+    int status = 0;
+    if (sscanf(this->pending, "HTTP/1.%*d %d", &status) != 1 || status != 206) {
+        fprintf(stderr, "range request: status %d\n", status);
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    unsigned long first = 0;
+    unsigned long last = 0;
+    const char* range = strstr(this->pending, "Content-Range: bytes ");
+    if (range == nullptr || sscanf(range, "Content-Range: bytes %lu-%lu", &first, &last) != 2 ||
+        first != offset || last != offset + length - 1) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    this->pending_offset = end + 4 - this->pending;
+    this->pending_length = received;
+    this->remaining = length;
+    return ESP_OK;
+}
+
+//******************************************************************************
+esp_err_t HttpRangeSource::read(uint8_t* buffer, size_t length) {
+    if (this->sock < 0 || length > this->remaining) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    size_t done = 0;
+    if (this->pending_offset < this->pending_length) {
+        done = std::min(length, this->pending_length - this->pending_offset);
+        memcpy(buffer, this->pending + this->pending_offset, done);
+        this->pending_offset += done;
+    }
+
+    while (done < length) {
+        ssize_t count = recv(this->sock, buffer + done, length - done, 0);
+        if (count <= 0) {
+            return ESP_FAIL;
+        }
+        done += count;
+    }
+
+    this->remaining -= length;
+    return ESP_OK;
+}
+
+//******************************************************************************
+void HttpRangeSource::close(void) {
+    if (this->sock >= 0) {
+        ::close(this->sock);
+        this->sock = -1;
+    }
+    this->remaining = 0;
+    this->pending_length = 0;
+    this->pending_offset = 0;
+}
@@ -0,0 +1,40 @@
+//******************************************************************************
+/**
+ * @file HttpRangeSource.h
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief Host OtaBlockSource, plain http range requests over a socket
+ * @version 0.1
+ * @date 2024-03-01
+ *
+ * The device uses esp_http_client, see OtaPullUpdater.  This one lets the
+ * block engine run on Linux against a local file server.
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#pragma once
+
+#include "Utils/OtaBlockEngine.h"
+
+class HttpRangeSource : public OtaBlockSource {
+public:
+    HttpRangeSource(void) = default;
+    ~HttpRangeSource(void) override { this->close(); }
+
+public:
+    esp_err_t open(const ota_job_t& job, uint32_t offset, uint32_t length) override;
+    esp_err_t read(uint8_t* buffer, size_t length) override;
+    void close(void) override;
+
+private:
+    esp_err_t read_headers(uint32_t offset, uint32_t length);
+
+private:
+    int sock = -1;
+    uint32_t remaining = 0;
+
+    // Body bytes that came with the headers.
+    char pending[1024];
+    size_t pending_length = 0;
+    size_t pending_offset = 0;
+};
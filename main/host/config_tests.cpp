@@ -0,0 +1,192 @@
+//******************************************************************************
+/**
+ * @file config_tests.cpp
+ * @author pat laplante (plaplante@appliedlogix.com)
+ *
+ * @brief Unit testing for the configuration blobs and the keys of older
+ *        firmware, over the host nvs
+ * @version 0.1
+ * @date 2024-03-06
+ *
+ * @copyright Copyright MN8 (c) 2024
+ *
+ * Older firmware only reads and writes one key per field.  What it changed
+ * while it ran must win over the blob once this firmware is back.  The host
+ * has no certificate partition, like a device updated over the air.
+ */
+//******************************************************************************
+
+#include <gtest/gtest.h>
+
+#include "App/Configuration/ThingConfig.h"
+#include "App/Configuration/ChargePointConfig.h"
+#include "Utils/ConfigBlob.h"
+#include "Utils/KeyStore.h"
+
+#include "esp_log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <string>
+
+// Older firmware saving a key of its own.
+static void set_legacy_key(const char* section, const char* key, const char* value) {
+    KeyStore store;
+    ASSERT_EQ(ESP_OK, store.openKeyStore(section, e_rw));
+    ASSERT_EQ(ESP_OK, store.setKeyValue(key, value));
+}
+
+static size_t get_blob_length(const char* section) {
+    KeyStore store;
+    uint8_t* blob = nullptr;
+    size_t length = 0;
+    if (store.openKeyStore(section, e_ro) != ESP_OK || store.getKeyBlobAlloc(CONFIG_BLOB_KEY, blob, length) != ESP_OK) {
+        return 0;
+    }
+    free(blob);
+    return length;
+}
+
+//******************************************************************************
+/**
+ * @brief   A mapping changed by older firmware is taken and saved again
+ *
+ */
+TEST(ConfigTest, ChargePointKeysChangedByOlderFirmware) {
+    {
+        ChargePointConfig config;
+        config.set_chargepoint_info("group-a", "station-1", 1, nullptr, 0);
+        ASSERT_EQ(ESP_OK, config.save());
+    }
+
+    // Same as the blob, a station not set included: nothing is saved.
+    {
+        uint32_t generation = config_blob_generation();
+        ChargePointConfig config;
+        ASSERT_EQ(ESP_OK, config.load());
+        EXPECT_STREQ("group-a", config.get_group_id());
+        EXPECT_EQ(generation, config_blob_generation());
+    }
+
+    set_legacy_key("chargepoint", "group_id", "group-b");
+    {
+        ChargePointConfig config;
+        ASSERT_EQ(ESP_OK, config.load());
+        EXPECT_STREQ("group-b", config.get_group_id());
+        uint8_t port = 0;
+        EXPECT_STREQ("station-1", config.get_led_1_station_id(port));
+        EXPECT_EQ(1, port);
+    }
+
+    // The blob was written again, it holds without the keys.
+    {
+        KeyStore store;
+        ASSERT_EQ(ESP_OK, store.openKeyStore("chargepoint", e_rw));
+        ASSERT_EQ(ESP_OK, store.eraseKey("group_id"));
+    }
+    {
+        ChargePointConfig config;
+        ASSERT_EQ(ESP_OK, config.load());
+        EXPECT_STREQ("group-b", config.get_group_id());
+    }
+}
+
+//******************************************************************************
+/**
+ * @brief   A thing provisioned again by older firmware is taken, certificate
+ *          included
+ *
+ */
+TEST(ConfigTest, ThingKeysChangedByOlderFirmware) {
+    {
+        ThingConfig config;
+        config.set_thing_name("thing-a");
+        config.set_certificate_arn("arn-a");
+        config.set_certificate_id("id-a");
+        config.set_certificate_pem("pem-a");
+        config.set_private_key("key-a");
+        config.set_public_key("public-a");
+        config.set_endpoint_address("endpoint");
+        ASSERT_EQ(ESP_OK, config.save());
+    }
+
+    set_legacy_key("iot", "certificateId", "id-b");
+    set_legacy_key("iot", "certificatePem", "pem-b");
+    {
+        ThingConfig config;
+        ASSERT_EQ(ESP_OK, config.load());
+        EXPECT_STREQ("thing-a", config.get_thing_name());
+        EXPECT_STREQ("id-b", config.get_certificate_id());
+        EXPECT_STREQ("pem-b", config.get_certificate_pem());
+    }
+}
+
+//******************************************************************************
+/**
+ * @brief   Without a certificate partition the certificate and keys are only
+ *          in the keys, a blob saved with them is written again without
+ *
+ */
+TEST(ConfigTest, ThingCertificatesOnlyInTheKeys) {
+    const std::string pem(1500, 'c');
+    {
+        ThingConfig config;
+        config.set_thing_name("thing-c");
+        config.set_certificate_arn("arn-c");
+        config.set_certificate_id("id-c");
+        config.set_certificate_pem(pem.c_str());
+        config.set_private_key("key-c");
+        config.set_public_key("public-c");
+        config.set_endpoint_address("endpoint");
+        ASSERT_EQ(ESP_OK, config.save());
+    }
+    EXPECT_GT(200u, get_blob_length("iot"));
+
+    {
+        ThingConfig config;
+        ASSERT_EQ(ESP_OK, config.load());
+        EXPECT_STREQ("thing-c", config.get_thing_name());
+        EXPECT_EQ(pem, config.get_certificate_pem());
+        EXPECT_STREQ("key-c", config.get_private_key());
+        EXPECT_STREQ("public-c", config.get_public_key());
+    }
+
+    // Saved with them, same keys.
+    {
+        uint8_t blob[2048];
+        size_t length = 0;
+        ConfigBlobWriter writer(blob, sizeof(blob), 1);
+        writer.begin(7);
+        writer.str("thingName", "thing-c");
+        writer.str("certificateArn", "arn-c");
+        writer.str("certificateId", "id-c");
+        writer.str("certificatePem", pem.c_str());
+        writer.str("privateKey", "key-c");
+        writer.str("publicKey", "public-c");
+        writer.str("endpointAddress", "endpoint");
+        ASSERT_EQ(ESP_OK, writer.finish(length));
+
+        KeyStore store;
+        ASSERT_EQ(ESP_OK, store.openKeyStore("iot", e_rw));
+        ASSERT_EQ(ESP_OK, store.setKeyBlob(CONFIG_BLOB_KEY, blob, length));
+    }
+    {
+        ThingConfig config;
+        ASSERT_EQ(ESP_OK, config.load());
+        EXPECT_EQ(pem, config.get_certificate_pem());
+    }
+    EXPECT_GT(200u, get_blob_length("iot"));
+}
+
+//******************************************************************************
+// The key store flush task never returns.
+int main(int argc, char** argv) {
+    testing::InitGoogleTest(&argc, argv);
+    host_log_level = ESP_LOG_NONE;
+
+    int ret = RUN_ALL_TESTS();
+    fflush(stdout);
+    _exit(ret);
+}
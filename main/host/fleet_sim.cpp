@@ -0,0 +1,546 @@
+//******************************************************************************
+/**
+ * @file fleet_sim.cpp
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief Many virtual controllers against one broker, to size proxy and broker
+ * @version 0.1
+ * @date 2024-02-22
+ *
+ * @copyright Copyright MN8 (c) 2024
+ *
+ * Every virtual controller runs the firmware over the host shim: its own
+ * MqttAgent and IotHeartbeat tasks, MqttConnection, IotThing and the
+ * LedStateInbox with its LedStateSequencer.  Only MN8App is replaced, by
+ * what it does on the mqtt events:
+ *
+ *  - a heartbeat as soon as it is connected, as the state machine asks for
+ *    when entering the connected state
+ *  - a register_station on the first connection, as the console does when
+ *    the station is provisioned
+ *
+ * and the LED tasks by what the apply callback was last asked to show.
+ *
+ * A proxy client answers "latest" with a ledstate, publishes ledstate to
+ * random controllers at a fixed rate and listens for acks and heartbeats.
+ *
+ * A power event shuts every controller socket down without DISCONNECT, the
+ * mqtt agents see the broker go away and all reconnect at once.
+ */
+//******************************************************************************
+
+#include "HostClient.h"
+
+#include "App/MqttAgent/MqttAgent.h"
+#include "App/MqttAgent/MqttConfig.h"
+#include "App/MqttAgent/MqttTopics.h"
+#include "App/MqttAgent/IotThing.h"
+#include "App/IotHeartbeat.h"
+#include "App/LedStateInbox.h"
+#include "App/LedStateSequencer.h"
+#include "App/Configuration/ThingConfig.h"
+#include "App/Configuration/ChargePointConfig.h"
+#include "Utils/FuseMacAddress.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_event.h"
+#include "esp_netif.h"
+#include "esp_mac.h"
+#include "esp_tls.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+static const char* TAG = "fleet";
+
+#define SIM_GROUP_SIZE              (50)        // controllers per proxy group
+#define SIM_MAX_SEQ                 (1 << 20)
+#define SIM_MAX_POWER_EVENTS        (64)
+#define SIM_FDS_PER_CONTROLLER      (2)         // the socket, and slack for the reconnects
+
+typedef struct {
+    host_broker_t broker;
+    int controllers;
+    int duration_s;
+    int heartbeat_min;
+    double ledstate_rate;
+    int power_events;
+} sim_options_t;
+
+//******************************************************************************
+// Samples from the mqtt tasks, merged at the end.
+//******************************************************************************
+typedef struct {
+    int cycle;
+    int64_t latency_us;                     // power event -> connected, subscribed and "latest" sent
+    uint32_t handshake_ms;                  // tcp connect and tls handshake, from MqttConnection
+} sim_sample_t;
+
+static std::mutex stats_mutex;
+static std::vector<sim_sample_t> samples;
+static std::atomic<uint32_t> disconnects(0);
+static std::atomic<uint32_t> applies(0);
+
+// Cold start is cycle 0, then one per power event.
+static std::atomic<int> power_cycle(0);
+static int64_t cycle_start_us[SIM_MAX_POWER_EVENTS + 1];
+
+//******************************************************************************
+static int64_t now_us(void) {
+    return esp_timer_get_time();
+}
+
+//******************************************************************************
+// The fuse mac address of a controller, its thing name as well.
+static void get_sim_mac_address(int index, uint8_t* mac) {
+    mac[0] = 0x5a;
+    mac[1] = 0x00;
+    mac[2] = (uint8_t)(index >> 24);
+    mac[3] = (uint8_t)(index >> 16);
+    mac[4] = (uint8_t)(index >> 8);
+    mac[5] = (uint8_t) index;
+}
+
+//******************************************************************************
+/**
+ * @brief One station controller.
+ */
+class SimController : public NoCopy {
+public:
+    SimController(void) = default;
+    ~SimController(void) = default;
+
+public:
+    esp_err_t start(int index, const sim_options_t& options) {
+        // The tasks created below get this mac address, the thing name is
+        // the fuse mac address.
+        uint8_t mac[6];
+        get_sim_mac_address(index, mac);
+        host_set_mac_address(mac);
+        get_fuse_mac_address_string(this->thing_name);
+
+        char group_id[24];
+        char station_id[2][24];
+        snprintf(group_id, sizeof(group_id), "sim-group-%d", index / SIM_GROUP_SIZE);
+        snprintf(station_id[0], sizeof(station_id[0]), "sim-%d-1", index);
+        snprintf(station_id[1], sizeof(station_id[1]), "sim-%d-2", index);
+
+        this->thing_config.set_thing_name(this->thing_name);
+        this->thing_config.set_endpoint_address(options.broker.host);
+        this->thing_config.set_certificate_pem(options.broker.client_cert);
+        this->thing_config.set_private_key(options.broker.client_key);
+        this->charge_point_config.set_chargepoint_info(group_id, station_id[0], 1, station_id[1], 2);
+
+        this->mqtt_agent.setup(&this->thing_config, &this->charge_point_config);
+        this->iot_thing.setup(&this->thing_config, &this->mqtt_agent);
+        if (this->ledstate_inbox.setup(&this->sequencer, &this->iot_thing, sGet_requested, sApply, this) != ESP_OK) {
+            return ESP_FAIL;
+        }
+        this->ledstate_inbox.register_handlers(this->mqtt_agent);
+        this->mqtt_agent.register_event_callback(sOn_mqtt_event, this);
+
+        this->iot_heartbeat.setup(&this->mqtt_agent, &this->iot_thing, &this->sequencer, sGet_heartbeat_status, this);
+        this->iot_heartbeat.set_heartbeat_frequency(options.heartbeat_min);
+
+        this->mqtt_agent.start();
+        this->iot_heartbeat.start();
+        return ESP_OK;
+    }
+
+    inline uint32_t get_coalesced(void) { return this->sequencer.get_counters().coalesced; }
+
+private:
+    static ledstate_message_t sGet_requested(void* context) { return ((SimController*) context)->get_shown(); }
+    static void sApply(const ledstate_message_t& message, void* context) { ((SimController*) context)->apply(message); }
+    static void sGet_heartbeat_status(heartbeat_status_t* status, void* context) {
+        ((SimController*) context)->get_heartbeat_status(status);
+    }
+    static void sOn_mqtt_event(MqttAgent::event_t event, void* context) { ((SimController*) context)->on_mqtt_event(event); }
+
+    //**************************************************************************
+    // From the mqtt task.
+    void on_mqtt_event(MqttAgent::event_t event) {
+        if (event != MqttAgent::e_mqtt_agent_connected) {
+            this->connected = false;
+            disconnects++;
+            return;
+        }
+        this->connected = true;
+
+        int cycle = power_cycle;
+        {
+            std::lock_guard<std::mutex> lock(stats_mutex);
+            samples.push_back({ cycle, now_us() - cycle_start_us[cycle], this->mqtt_agent.get_connection_stats().last_handshake_ms });
+        }
+
+        if (!this->registered) {
+            this->registered = this->iot_thing.register_cp_station(&this->charge_point_config) == ESP_OK;
+        }
+        this->iot_heartbeat.request_heartbeat();
+    }
+
+    //**************************************************************************
+    ledstate_message_t get_shown(void) {
+        std::lock_guard<std::mutex> lock(this->shown_mutex);
+        return this->shown;
+    }
+
+    // The LED tasks, called from the mqtt task with the ledstate lock held.
+    void apply(const ledstate_message_t& message) {
+        std::lock_guard<std::mutex> lock(this->shown_mutex);
+        ledstate_merge(&this->shown, message);
+        this->shown.has_seq = false;
+        applies++;
+    }
+
+    // From the heartbeat task.
+    void get_heartbeat_status(heartbeat_status_t* status) {
+        ledstate_message_t shown = this->get_shown();
+        status->current_state = this->connected ? "connected" : "connecting";
+        status->led1_state = led_state_to_string(shown.port[0].state);
+        status->led2_state = led_state_to_string(shown.port[1].state);
+        status->night_mode = shown.night_mode;
+        status->has_night_sensor = false;
+    }
+
+private:
+    char thing_name[13] = {0};
+    bool registered = false;
+    std::atomic<bool> connected{false};
+
+    ThingConfig thing_config;
+    ChargePointConfig charge_point_config;
+    MqttAgent mqtt_agent;
+    IotThing iot_thing;
+    IotHeartbeat iot_heartbeat;
+    LedStateSequencer sequencer;
+    LedStateInbox ledstate_inbox;
+
+    std::mutex shown_mutex;
+    ledstate_message_t shown = {};
+};
+
+//******************************************************************************
+/**
+ * @brief The proxy: answers "latest", pushes ledstate, listens for acks.
+ */
+class SimProxy : public NoCopy {
+public:
+    SimProxy(void) : sent_us(SIM_MAX_SEQ, 0) {}
+    ~SimProxy(void) = default;
+
+public:
+    esp_err_t start(const sim_options_t& options) {
+        this->options = &options;
+        this->client.set_recv_poll_ms(1);
+        if (this->client.connect(options.broker, "mn8-sim-proxy", MQTT_KEEP_ALIVE_INTERVAL_SECONDS, &SimProxy::sOn_mqtt_event, this) != ESP_OK) {
+            return ESP_FAIL;
+        }
+
+        const char* filters[] = { "+/latest", "+/ack_ledstate", "+/heartbeat", "+/register_station" };
+        for (const char* filter : filters) {
+            uint16_t packet_id;
+            if (this->client.subscribe(filter, (uint16_t) strlen(filter), &packet_id) != ESP_OK) {
+                return ESP_FAIL;
+            }
+        }
+        return ESP_OK;
+    }
+
+    void run(int64_t until_us) {
+        int64_t period_us = this->options->ledstate_rate > 0 ? (int64_t)(1000000.0 / this->options->ledstate_rate) : 0;
+        int64_t next_us = now_us();
+
+        while (now_us() < until_us) {
+            if (MQTT_ProcessLoop(this->client.get()) != MQTTSuccess) {
+                ESP_LOGE(TAG, "Proxy lost the broker");
+                return;
+            }
+            if (period_us > 0 && now_us() >= next_us) {
+                next_us += period_us;
+                uint8_t mac[6];
+                get_sim_mac_address(rand() % this->options->controllers, mac);
+                char thing_name[13];
+                snprintf(thing_name, sizeof(thing_name), "%02X%02X%02X%02X%02X%02X",
+                         mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+                this->send_ledstate(thing_name, 12);
+            }
+        }
+    }
+
+    inline int get_socket(void) const { return this->client.get_socket(); }
+    void stop(void) { this->client.disconnect(); }
+
+    void report(double duration_s) {
+        printf("proxy     : ledstate sent %u  acks %zu  latest %u  registrations %u\n",
+               this->seq, this->ack_rtt_us.size(), this->latest, this->registrations);
+        printf("heartbeats: received %u (%.1f/s), peak %u in one second\n",
+               this->heartbeats, this->heartbeats / duration_s, this->heartbeat_peak);
+        print_percentiles("ack rtt   ", this->ack_rtt_us);
+    }
+
+    static void print_percentiles(const char* name, std::vector<int64_t>& values) {
+        if (values.empty()) {
+            printf("%s: no samples\n", name);
+            return;
+        }
+        std::sort(values.begin(), values.end());
+        auto at = [&values](double p) { return values[(size_t)(p * (values.size() - 1))] / 1000.0; };
+        printf("%s: p50 %8.2f ms  p90 %8.2f ms  p99 %8.2f ms  max %8.2f ms  (%zu)\n",
+               name, at(0.50), at(0.90), at(0.99), values.back() / 1000.0, values.size());
+    }
+
+private:
+    void send_ledstate(const char* thing_name, int length) {
+        if (this->seq + 1 >= SIM_MAX_SEQ) {
+            return;
+        }
+        uint32_t seq = ++this->seq;
+
+        char topic[MQTT_TOPIC_MAX_LENGTH];
+        snprintf(topic, sizeof(topic), "%.*s/%s", length, thing_name, MqttTopics::get_suffix(e_mqtt_topic_ledstate));
+
+        char payload[128];
+        int payload_length = snprintf(payload, sizeof(payload),
+            "{\"seq\":%u,\"port0\":{\"state\":\"%s\",\"charge_percent\":%u},\"port1\":{\"state\":\"available\"}}",
+            seq, (seq & 1) ? "charging" : "available", seq % 101);
+
+        this->sent_us[seq] = now_us();
+        this->client.publish(topic, (uint16_t) strlen(topic), payload, (size_t) payload_length);
+    }
+
+    static void sOn_mqtt_event(
+        struct MQTTContext* context,
+        struct MQTTPacketInfo* packet_info,
+        struct MQTTDeserializedInfo* deserialized_info,
+        void* user
+    ) {
+        ((SimProxy*) user)->on_mqtt_event(packet_info, deserialized_info);
+    }
+
+    void on_mqtt_event(MQTTPacketInfo_t* packet_info, MQTTDeserializedInfo_t* deserialized_info) {
+        if ((packet_info->type & 0xF0U) != MQTT_PACKET_TYPE_PUBLISH) {
+            return;
+        }
+
+        MQTTPublishInfo_t* publish = deserialized_info->pPublishInfo;
+        const char* name = publish->pTopicName;
+        uint16_t name_length = publish->topicNameLength;
+        const char* slash = (const char*) memchr(name, '/', name_length);
+        if (slash == nullptr) {
+            return;
+        }
+        int prefix_length = (int)(slash - name);
+        const char* suffix = slash + 1;
+        size_t suffix_length = name_length - prefix_length - 1;
+
+        auto is = [&](const char* expected) {
+            return suffix_length == strlen(expected) && memcmp(suffix, expected, suffix_length) == 0;
+        };
+
+        if (is("latest")) {
+            // "latest" is prefixed with the thing name.
+            this->latest++;
+            this->send_ledstate(name, prefix_length);
+        } else if (is("ack_ledstate")) {
+            // {"seq":N,"count":C}, compact acks cover every seq up to N.
+            char payload[128];
+            size_t length = std::min(publish->payloadLength, sizeof(payload) - 1);
+            memcpy(payload, publish->pPayload, length);
+            payload[length] = '\0';
+
+            unsigned int seq;
+            const char* field = strstr(payload, "\"seq\":");
+            if (field != nullptr && sscanf(field, "\"seq\":%u", &seq) == 1 && seq < SIM_MAX_SEQ && this->sent_us[seq] != 0) {
+                this->ack_rtt_us.push_back(now_us() - this->sent_us[seq]);
+            }
+        } else if (is("heartbeat")) {
+            int64_t second = now_us() / 1000000;
+            if (second != this->heartbeat_second) {
+                this->heartbeat_second = second;
+                this->heartbeat_in_second = 0;
+            }
+            this->heartbeats++;
+            this->heartbeat_peak = std::max(this->heartbeat_peak, ++this->heartbeat_in_second);
+        } else if (is("register_station")) {
+            this->registrations++;
+        }
+    }
+
+private:
+    const sim_options_t* options = nullptr;
+    HostClient client;
+    uint32_t seq = 0;
+    std::vector<int64_t> sent_us;
+    std::vector<int64_t> ack_rtt_us;
+    uint32_t latest = 0;
+    uint32_t registrations = 0;
+    uint32_t heartbeats = 0;
+    uint32_t heartbeat_peak = 0;
+    uint32_t heartbeat_in_second = 0;
+    int64_t heartbeat_second = 0;
+};
+
+//******************************************************************************
+static void report_storms(const sim_options_t& options, int cycles) {
+    std::lock_guard<std::mutex> lock(stats_mutex);
+    for (int cycle = 0; cycle < cycles; cycle++) {
+        std::vector<int64_t> connected;
+        std::vector<int64_t> handshake;
+        for (const sim_sample_t& sample : samples) {
+            if (sample.cycle == cycle) {
+                connected.push_back(sample.latency_us);
+                handshake.push_back(sample.handshake_ms * 1000LL);
+            }
+        }
+
+        printf("%s %d: %zu/%d connected", cycle == 0 ? "cold start" : "power event", cycle, connected.size(), options.controllers);
+        if ((int) connected.size() >= options.controllers) {
+            double storm_s = *std::max_element(connected.begin(), connected.end()) / 1000000.0;
+            printf(" and subscribed in %.2f s\n", storm_s);
+        } else {
+            printf(", not all before the next event or the end of the run\n");
+        }
+        SimProxy::print_percentiles("  connected", connected);
+        SimProxy::print_percentiles("  handshake", handshake);
+    }
+}
+
+//******************************************************************************
+static void usage(const char* name) {
+    printf("usage: %s [options]\n"
+           "  -H host        broker host (127.0.0.1)\n"
+           "  -p port        broker port (1883)\n"
+           "  -n count       virtual controllers (200)\n"
+           "  -d seconds     run time after the cold start (60)\n"
+           "  -b minutes     heartbeat interval, as set_config heartbeat_frequency (5)\n"
+           "  -r rate        ledstate per second from the proxy (20)\n"
+           "  -P count       power events, spread over the run (1)\n"
+           "  -C file        root CA, enables TLS\n"
+           "  -c file        client certificate\n"
+           "  -k file        client key\n"
+           "  -v             verbose logs\n", name);
+}
+
+//******************************************************************************
+int main(int argc, char** argv) {
+    sim_options_t options = {};
+    options.broker.host = "127.0.0.1";
+    options.broker.port = 1883;
+    options.controllers = 200;
+    options.duration_s = 60;
+    options.heartbeat_min = HEARTBEAT_FREQUENCY_MINUTES;
+    options.ledstate_rate = 20;
+    options.power_events = 1;
+    host_log_level = ESP_LOG_NONE;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "H:p:n:d:b:r:P:C:c:k:vh")) != -1) {
+        switch (opt) {
+            case 'H': options.broker.host = optarg; break;
+            case 'p': options.broker.port = atoi(optarg); break;
+            case 'n': options.controllers = atoi(optarg); break;
+            case 'd': options.duration_s = atoi(optarg); break;
+            case 'b': options.heartbeat_min = atoi(optarg); break;
+            case 'r': options.ledstate_rate = atof(optarg); break;
+            case 'P': options.power_events = atoi(optarg); break;
+            case 'C': options.broker.root_ca = HostClient::read_pem(optarg); break;
+            case 'c': options.broker.client_cert = HostClient::read_pem(optarg); break;
+            case 'k': options.broker.client_key = HostClient::read_pem(optarg); break;
+            case 'v': host_log_level = ESP_LOG_WARN; break;
+            default: usage(argv[0]); return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (options.controllers <= 0 || options.duration_s <= 0 || options.heartbeat_min <= 0 ||
+        options.power_events < 0 || options.power_events > SIM_MAX_POWER_EVENTS) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    // One socket per controller.
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < (rlim_t) options.controllers * SIM_FDS_PER_CONTROLLER + 64) {
+        printf("open file limit %lu is too low for %d controllers, raise it with ulimit -n\n",
+               (unsigned long) limit.rlim_cur, options.controllers);
+        return 1;
+    }
+
+    // A write to a socket dropped by a power event.
+    signal(SIGPIPE, SIG_IGN);
+
+    printf("broker %s:%d%s  %d controllers  %d s  heartbeat %d min  ledstate %.1f/s  %d power event(s)\n",
+           options.broker.host, options.broker.port, options.broker.root_ca ? " (tls)" : "",
+           options.controllers, options.duration_s, options.heartbeat_min,
+           options.ledstate_rate, options.power_events);
+
+    // Where MqttConnection connects to AWS.
+    host_tls_options.port = options.broker.port;
+    host_tls_options.plain = options.broker.root_ca == nullptr;
+    host_tls_options.root_ca = options.broker.root_ca;
+
+    SimProxy proxy;
+    if (proxy.start(options) != ESP_OK) {
+        ESP_LOGE(TAG, "Proxy failed to connect");
+        fflush(stdout);
+        _exit(1);
+    }
+
+    // The agent tasks never return, the controllers live until _exit.
+    std::vector<SimController*> controllers;
+    for (int i = 0; i < options.controllers; i++) {
+        SimController* controller = new SimController();
+        if (controller->start(i, options) != ESP_OK) {
+            ESP_LOGE(TAG, "Controller %d failed to start", i);
+            fflush(stdout);
+            _exit(1);
+        }
+        controllers.push_back(controller);
+    }
+
+    // What the network connection agent does once it has an address, every
+    // mqtt agent gets it.
+    cycle_start_us[0] = now_us();
+    esp_event_post(IP_EVENT, IP_EVENT_STA_GOT_IP, nullptr, 0, portMAX_DELAY);
+
+    // Power events are evenly spaced, the last segment is left to settle.
+    int64_t start_us = now_us();
+    int64_t segment_us = (int64_t) options.duration_s * 1000000 / (options.power_events + 1);
+    for (int event = 1; event <= options.power_events; event++) {
+        proxy.run(start_us + segment_us * event);
+        cycle_start_us[event] = now_us();
+        power_cycle = event;
+        host_tls_drop_all(proxy.get_socket());
+    }
+    proxy.run(start_us + (int64_t) options.duration_s * 1000000);
+    proxy.stop();
+
+    uint32_t coalesced = 0;
+    for (SimController* controller : controllers) {
+        coalesced += controller->get_coalesced();
+    }
+
+    printf("\n");
+    report_storms(options, options.power_events + 1);
+    printf("controllers: disconnects %u  ledstate applied %u  coalesced %u\n",
+           (uint32_t) disconnects, (uint32_t) applies, coalesced);
+    proxy.report(options.duration_s);
+
+    fflush(stdout);
+    _exit(0);
+}
@@ -0,0 +1,154 @@
+//******************************************************************************
+/**
+ * @file fw_compress.cpp
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief Compress a firmware image for the /update endpoint
+ * @version 0.1
+ * @date 2024-02-29
+ *
+ * @copyright Copyright MN8 (c) 2024
+ *
+ * Writes the FW_IMAGE_MAGIC header and the heatshrink stream, then decodes it
+ * back with the firmware decoder and the same buffer sizes as FwUpdater before
+ * reporting the sizes.  The sha256 to send in X-Image-SHA256 is the one of
+ * the output file.
+ */
+//******************************************************************************
+
+#include "HeatshrinkEncoder.h"
+
+#include "Utils/HeatshrinkDecoder.h"
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+// Same as FW_UPDATER_DECODE_BUFFER_SIZE and the ota pipeline chunks.
+#define VERIFY_OUTPUT_SIZE  (2048)
+#define VERIFY_INPUT_SIZE   (4096)
+
+static bool read_file(const char* path, std::vector<uint8_t>& data) {
+    FILE* file = fopen(path, "rb");
+    if (file == nullptr) {
+        perror(path);
+        return false;
+    }
+
+    uint8_t buffer[4096];
+    size_t length;
+    while ((length = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        data.insert(data.end(), buffer, buffer + length);
+    }
+    fclose(file);
+    return true;
+}
+
+static bool write_file(const char* path, const std::vector<uint8_t>& data) {
+    FILE* file = fopen(path, "wb");
+    if (file == nullptr) {
+        perror(path);
+        return false;
+    }
+
+    bool ok = fwrite(data.data(), 1, data.size(), file) == data.size();
+    ok = fclose(file) == 0 && ok;
+    if (!ok) {
+        fprintf(stderr, "%s: write failed\n", path);
+    }
+    return ok;
+}
+
+//******************************************************************************
+/**
+ * @brief Decode the image the way the device does and compare.
+ */
+static bool verify(const std::vector<uint8_t>& image, const std::vector<uint8_t>& original) {
+    fw_image_header_t header;
+    if (fw_image_parse_header(image.data(), image.size(), &header) != ESP_OK || header.image_size != original.size()) {
+        return false;
+    }
+
+    static HeatshrinkDecoder decoder;
+    if (decoder.reset(header.window_bits, header.lookahead_bits) != ESP_OK) {
+        return false;
+    }
+
+    std::vector<uint8_t> decoded;
+    uint8_t out[VERIFY_OUTPUT_SIZE];
+    size_t offset = FW_IMAGE_HEADER_LENGTH;
+    while (offset < image.size()) {
+        size_t length = std::min((size_t) VERIFY_INPUT_SIZE, image.size() - offset);
+        size_t used = 0;
+        while (used < length) {
+            size_t consumed;
+            size_t produced = decoder.decode(image.data() + offset + used, length - used, consumed, out, sizeof(out));
+            decoded.insert(decoded.end(), out, out + produced);
+            used += consumed;
+            if (decoded.size() > original.size()) {
+                return false;
+            }
+        }
+        offset += length;
+    }
+
+    // Flush a back reference cut by the last output buffer.
+    size_t consumed;
+    size_t produced;
+    while ((produced = decoder.decode(nullptr, 0, consumed, out, sizeof(out))) > 0) {
+        decoded.insert(decoded.end(), out, out + produced);
+    }
+
+    return decoder.is_finished() && decoded == original;
+}
+
+static void usage(const char* name) {
+    printf("usage: %s [options] input.bin output.bin\n"
+           "  -w bits        window, %d to %d (%d)\n"
+           "  -l bits        lookahead, %d to window - 1 (4)\n",
+           name,
+           HEATSHRINK_MIN_WINDOW_BITS, HEATSHRINK_MAX_WINDOW_BITS, HEATSHRINK_MAX_WINDOW_BITS,
+           HEATSHRINK_MIN_LOOKAHEAD_BITS);
+}
+
+int main(int argc, char** argv) {
+    int window_bits = HEATSHRINK_MAX_WINDOW_BITS;
+    int lookahead_bits = 4;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "w:l:h")) != -1) {
+        switch (opt) {
+            case 'w': window_bits = atoi(optarg); break;
+            case 'l': lookahead_bits = atoi(optarg); break;
+            default: usage(argv[0]); return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (argc - optind != 2 ||
+        window_bits < HEATSHRINK_MIN_WINDOW_BITS || window_bits > HEATSHRINK_MAX_WINDOW_BITS ||
+        lookahead_bits < HEATSHRINK_MIN_LOOKAHEAD_BITS || lookahead_bits >= window_bits) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    std::vector<uint8_t> original;
+    if (!read_file(argv[optind], original)) {
+        return 1;
+    }
+
+    std::vector<uint8_t> image = fw_image_compress(original.data(), original.size(), (uint8_t) window_bits, (uint8_t) lookahead_bits);
+    if (!verify(image, original)) {
+        fprintf(stderr, "decoded image does not match the input\n");
+        return 1;
+    }
+    if (!write_file(argv[optind + 1], image)) {
+        return 1;
+    }
+
+    printf("%zu -> %zu bytes (%.1f%%), window %d, lookahead %d, device needs %d bytes of window\n",
+        original.size(), image.size(), original.empty() ? 0.0 : 100.0 * image.size() / original.size(),
+        window_bits, lookahead_bits, 1 << window_bits);
+    return 0;
+}
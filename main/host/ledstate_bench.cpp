@@ -0,0 +1,501 @@
+//******************************************************************************
+/**
+ * @file ledstate_bench.cpp
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief End to end ledstate latency against a local broker
+ * @version 0.1
+ * @date 2024-02-21
+ *
+ * @copyright Copyright MN8 (c) 2024
+ *
+ * A publisher plays the proxy and sends ledstate at a fixed rate.  The device
+ * side is the firmware itself: MqttAgent and its task, MqttConnection,
+ * IotThing and the LedStateInbox, over the host shim.  Only the LED tasks are
+ * replaced, by what the apply callback was last asked to show.
+ *
+ * For every message we report publish -> applied and publish -> ack, the ack
+ * as the proxy receives it.  Coalesced messages count as applied when the
+ * newer state they were folded into reaches the leds, and as acked with the
+ * compact ack that covers them.
+ */
+//******************************************************************************
+
+#include "App/MqttAgent/MqttAgent.h"
+#include "App/MqttAgent/IotThing.h"
+#include "App/LedStateInbox.h"
+#include "App/LedStateSequencer.h"
+#include "App/Configuration/ThingConfig.h"
+#include "App/Configuration/ChargePointConfig.h"
+
+#include "HostClient.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_event.h"
+#include "esp_netif.h"
+#include "esp_mac.h"
+#include "esp_tls.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static const char* TAG = "bench";
+
+#define BENCH_THING_NAME        "bench-thing"
+#define BENCH_KEEP_ALIVE_S      (60)
+#define BENCH_CONNECT_MS        (30000)
+#define BENCH_DRAIN_TIMEOUT_MS  (3000)
+
+static const uint8_t bench_mac[6] = { 0x02, 0x00, 0x00, 0x00, 0xbe, 0x01 };
+
+typedef struct {
+    host_broker_t broker;
+    int count;
+} bench_options_t;
+
+//******************************************************************************
+static int64_t thread_cpu_us(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return (int64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+//******************************************************************************
+/**
+ * @brief What happened to each seq, filled in by the device and the proxy.
+ *
+ * Indexed by seq, seq 0 is never sent, it means the proxy restarted.
+ */
+class BenchRecord : public NoCopy {
+public:
+    BenchRecord(int count) : sent_us(count + 1, -1), applied_us(count + 1, -1), acked_us(count + 1, -1) {}
+
+    void sent(uint32_t seq) {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->sent_us[seq] = esp_timer_get_time();
+    }
+
+    // Every seq up to this one reached the leds, or the broker with an ack.
+    void applied(uint32_t seq) { this->mark(this->applied_us, seq); }
+    void acked(uint32_t seq) { this->mark(this->acked_us, seq); }
+
+    bool done(uint32_t last) {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        return this->applied_us[last] >= 0 && this->acked_us[last] >= 0;
+    }
+
+    int progress(void) {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        return this->marks;
+    }
+
+    void report(double rate, uint32_t first, uint32_t last) {
+        std::vector<int64_t> to_applied;
+        std::vector<int64_t> to_acked;
+
+        std::lock_guard<std::mutex> lock(this->mutex);
+        for (uint32_t seq = first; seq <= last; seq++) {
+            if (this->sent_us[seq] < 0) {
+                continue;
+            }
+            if (this->applied_us[seq] >= 0) {
+                to_applied.push_back(this->applied_us[seq] - this->sent_us[seq]);
+            }
+            if (this->acked_us[seq] >= 0) {
+                to_acked.push_back(this->acked_us[seq] - this->sent_us[seq]);
+            }
+        }
+        std::sort(to_applied.begin(), to_applied.end());
+        std::sort(to_acked.begin(), to_acked.end());
+
+        printf("rate %8.1f/s  sent %6u  applied %6zu  acked %6zu\n",
+               rate, last - first + 1, to_applied.size(), to_acked.size());
+        print_percentiles("  publish->applied", to_applied);
+        print_percentiles("  publish->ack    ", to_acked);
+    }
+
+private:
+    void mark(std::vector<int64_t>& at_us, uint32_t seq) {
+        int64_t now = esp_timer_get_time();
+        std::lock_guard<std::mutex> lock(this->mutex);
+        for (uint32_t i = std::min<uint32_t>(seq, at_us.size() - 1); i > 0 && at_us[i] < 0; i--) {
+            if (this->sent_us[i] >= 0) {
+                at_us[i] = now;
+            }
+        }
+        this->marks++;
+    }
+
+    static void print_percentiles(const char* name, const std::vector<int64_t>& values) {
+        if (values.empty()) {
+            printf("%s  no samples\n", name);
+            return;
+        }
+        auto at = [&values](double p) { return values[(size_t)(p * (values.size() - 1))] / 1000.0; };
+        printf("%s  p50 %8.2f ms  p90 %8.2f ms  p99 %8.2f ms  max %8.2f ms\n",
+               name, at(0.50), at(0.90), at(0.99), values.back() / 1000.0);
+    }
+
+private:
+    std::mutex mutex;
+    std::vector<int64_t> sent_us;
+    std::vector<int64_t> applied_us;
+    std::vector<int64_t> acked_us;
+    int marks = 0;
+};
+
+//******************************************************************************
+/**
+ * @brief The device, set up the way MN8App does for the ledstate path.
+ */
+class BenchDevice : public NoCopy {
+public:
+    BenchDevice(BenchRecord& record) : record(record) {}
+
+public:
+    esp_err_t start(const bench_options_t& options) {
+        host_set_mac_address(bench_mac);
+
+        this->thing_config.set_thing_name(BENCH_THING_NAME);
+        this->thing_config.set_endpoint_address(options.broker.host);
+        this->thing_config.set_certificate_pem(options.broker.client_cert);
+        this->thing_config.set_private_key(options.broker.client_key);
+
+        this->mqtt_agent.setup(&this->thing_config, &this->charge_point_config);
+        this->iot_thing.setup(&this->thing_config, &this->mqtt_agent);
+        if (this->ledstate_inbox.setup(&this->sequencer, &this->iot_thing, sGet_requested, sApply, this) != ESP_OK) {
+            return ESP_FAIL;
+        }
+        this->ledstate_inbox.register_handlers(this->mqtt_agent);
+        this->mqtt_agent.register_event_callback(sOn_mqtt_event, this);
+        this->mqtt_agent.start();
+
+        // What the network connection agent does once it has an address.
+        esp_event_post(IP_EVENT, IP_EVENT_STA_GOT_IP, nullptr, 0, portMAX_DELAY);
+
+        // The agent waits a few seconds around the connect, as on the device.
+        int64_t deadline = esp_timer_get_time() + BENCH_CONNECT_MS * 1000LL;
+        while (!this->connected && esp_timer_get_time() < deadline) {
+            vTaskDelay(10 / portTICK_PERIOD_MS);
+        }
+        return this->connected ? ESP_OK : ESP_ERR_TIMEOUT;
+    }
+
+    void report(void) {
+        const ledstate_counters_t& counters = this->sequencer.get_counters();
+        int applies = this->applies;
+        printf("device  applies %d  coalesced %u  acks coalesced %u  throttled %u  cpu %.1f us/apply\n",
+               applies, counters.coalesced, this->iot_thing.get_acks_coalesced(),
+               this->mqtt_agent.get_ingress_limiter().get_throttled(e_mqtt_topic_ledstate),
+               applies > 1 ? (double)(this->last_apply_cpu_us - this->first_apply_cpu_us) / (applies - 1) : 0.0);
+    }
+
+private:
+    static ledstate_message_t sGet_requested(void* context) { return ((BenchDevice*) context)->shown; }
+    static void sApply(const ledstate_message_t& message, void* context) { ((BenchDevice*) context)->apply(message); }
+    static void sOn_mqtt_event(MqttAgent::event_t event, void* context) {
+        ((BenchDevice*) context)->connected = event == MqttAgent::e_mqtt_agent_connected;
+    }
+
+    // The LED tasks, called from the mqtt task with the ledstate lock held.
+    void apply(const ledstate_message_t& message) {
+        ledstate_merge(&this->shown, message);
+        this->shown.has_seq = false;
+        if (message.has_seq) {
+            this->record.applied(message.seq);
+        }
+
+        this->last_apply_cpu_us = thread_cpu_us();
+        if (this->applies++ == 0) {
+            this->first_apply_cpu_us = this->last_apply_cpu_us;
+        }
+    }
+
+private:
+    BenchRecord& record;
+
+    ThingConfig thing_config;
+    ChargePointConfig charge_point_config;
+    MqttAgent mqtt_agent;
+    IotThing iot_thing;
+    LedStateSequencer sequencer;
+    LedStateInbox ledstate_inbox;
+
+    ledstate_message_t shown = {};
+    std::atomic<bool> connected{false};
+    std::atomic<int> applies{0};
+    int64_t first_apply_cpu_us = 0;
+    int64_t last_apply_cpu_us = 0;
+};
+
+//******************************************************************************
+/**
+ * @brief The proxy side, the acks it receives.
+ */
+class BenchAckListener : public NoCopy {
+public:
+    BenchAckListener(BenchRecord& record) : record(record) {}
+    ~BenchAckListener(void) { this->stop(); }
+
+    esp_err_t start(const bench_options_t& options, const char* topic) {
+        this->client.set_recv_poll_ms(1);
+        if (this->client.connect(options.broker, "mn8-bench-acks", BENCH_KEEP_ALIVE_S, sOn_mqtt_event, this) != ESP_OK) {
+            return ESP_FAIL;
+        }
+
+        uint16_t packet_id;
+        if (this->client.subscribe(topic, (uint16_t) strlen(topic), &packet_id) != ESP_OK) {
+            return ESP_FAIL;
+        }
+
+        this->thread = std::thread([this] {
+            while (!this->stopping) {
+                MQTT_ProcessLoop(this->client.get());
+            }
+        });
+
+        int64_t deadline = esp_timer_get_time() + BENCH_CONNECT_MS * 1000LL;
+        while (!this->subscribed && esp_timer_get_time() < deadline) {
+            vTaskDelay(10 / portTICK_PERIOD_MS);
+        }
+        return this->subscribed ? ESP_OK : ESP_ERR_TIMEOUT;
+    }
+
+    void stop(void) {
+        if (!this->thread.joinable()) {
+            return;
+        }
+        this->stopping = true;
+        this->thread.join();
+        this->client.disconnect();
+    }
+
+private:
+    static void sOn_mqtt_event(
+        struct MQTTContext* context,
+        struct MQTTPacketInfo* packet_info,
+        struct MQTTDeserializedInfo* deserialized_info,
+        void* user
+    ) {
+        ((BenchAckListener*) user)->on_mqtt_event(packet_info, deserialized_info);
+    }
+
+    void on_mqtt_event(MQTTPacketInfo_t* packet_info, MQTTDeserializedInfo_t* deserialized_info) {
+        if ((packet_info->type & 0xF0U) == MQTT_PACKET_TYPE_SUBACK) {
+            this->subscribed = true;
+            return;
+        }
+        if ((packet_info->type & 0xF0U) != MQTT_PACKET_TYPE_PUBLISH) {
+            return;
+        }
+
+        // {"seq":N,"count":C}, compact acks cover every seq up to N.
+        MQTTPublishInfo_t* publish = deserialized_info->pPublishInfo;
+        char payload[128];
+        size_t length = std::min(publish->payloadLength, sizeof(payload) - 1);
+        memcpy(payload, publish->pPayload, length);
+        payload[length] = '\0';
+
+        unsigned int seq;
+        const char* field = strstr(payload, "\"seq\":");
+        if (field != nullptr && sscanf(field, "\"seq\":%u", &seq) == 1) {
+            this->record.acked(seq);
+        }
+    }
+
+private:
+    BenchRecord& record;
+    HostClient client;
+    std::thread thread;
+    std::atomic<bool> subscribed{false};
+    std::atomic<bool> stopping{false};
+};
+
+//******************************************************************************
+/**
+ * @brief The proxy, publishes ledstate at a fixed rate.
+ *
+ * Port 0 alternates between charging and available so no message is a
+ * duplicate of the one before it.
+ */
+static esp_err_t publish_ledstate(HostClient& client, double rate, uint32_t first, uint32_t last, BenchRecord& record, const char* topic) {
+    int64_t period_us = (int64_t)(1000000.0 / rate);
+    int64_t next_us = esp_timer_get_time();
+    int64_t last_loop_us = next_us;
+    char payload[128];
+
+    for (uint32_t seq = first; seq <= last; seq++) {
+        int64_t now = esp_timer_get_time();
+        if (next_us > now) {
+            struct timespec delay = { (time_t)((next_us - now) / 1000000), (long)((next_us - now) % 1000000) * 1000 };
+            nanosleep(&delay, NULL);
+        }
+        next_us += period_us;
+
+        int length = snprintf(payload, sizeof(payload),
+            "{\"seq\":%u,\"port0\":{\"state\":\"%s\",\"charge_percent\":%u},\"port1\":{\"state\":\"available\"}}",
+            seq, (seq & 1) ? "charging" : "available", seq % 101);
+
+        record.sent(seq);
+        if (client.publish(topic, (uint16_t) strlen(topic), payload, (size_t) length) != ESP_OK) {
+            ESP_LOGE(TAG, "MQTT_Publish failed at seq %u", seq);
+            return ESP_FAIL;
+        }
+
+        // Keep the connection alive on long runs.
+        if (esp_timer_get_time() - last_loop_us > 1000000) {
+            MQTT_ProcessLoop(client.get());
+            last_loop_us = esp_timer_get_time();
+        }
+    }
+    return ESP_OK;
+}
+
+//******************************************************************************
+// Until the last seq is applied and acked, or nothing moved for a while.
+static void wait_drained(BenchRecord& record, uint32_t first, uint32_t last) {
+    int progress = record.progress();
+    int64_t idle_since = esp_timer_get_time();
+
+    while (!record.done(last)) {
+        vTaskDelay(10 / portTICK_PERIOD_MS);
+
+        int64_t now = esp_timer_get_time();
+        if (record.progress() != progress) {
+            progress = record.progress();
+            idle_since = now;
+        } else if (now - idle_since > BENCH_DRAIN_TIMEOUT_MS * 1000LL) {
+            break;
+        }
+    }
+}
+
+//******************************************************************************
+static void usage(const char* name) {
+    printf("usage: %s [options]\n"
+           "  -H host        broker host (127.0.0.1)\n"
+           "  -p port        broker port (1883)\n"
+           "  -r rates       comma separated publish rates per second (10,50,200)\n"
+           "  -n count       messages per rate (500)\n"
+           "  -C file        root CA, enables TLS\n"
+           "  -c file        client certificate\n"
+           "  -k file        client key\n"
+           "  -v             verbose logs\n", name);
+}
+
+//******************************************************************************
+static int run(const bench_options_t& options, const std::vector<double>& rates) {
+    // Where MqttConnection connects to AWS.
+    host_tls_options.port = options.broker.port;
+    host_tls_options.plain = options.broker.root_ca == nullptr;
+    host_tls_options.root_ca = options.broker.root_ca;
+
+    BenchRecord record(options.count * (int) rates.size());
+
+    // Same topics as the device builds, from the thing name and the mac.
+    char mac_address[13];
+    snprintf(mac_address, sizeof(mac_address), "%02X%02X%02X%02X%02X%02X",
+             bench_mac[0], bench_mac[1], bench_mac[2], bench_mac[3], bench_mac[4], bench_mac[5]);
+    MqttTopics topics;
+    topics.build(BENCH_THING_NAME, mac_address);
+
+    BenchAckListener acks(record);
+    if (acks.start(options, topics.get(e_mqtt_topic_ack_ledstate)) != ESP_OK) {
+        ESP_LOGE(TAG, "Proxy failed to subscribe to the acks");
+        return 1;
+    }
+
+    BenchDevice device(record);
+    if (device.start(options) != ESP_OK) {
+        ESP_LOGE(TAG, "Device failed to connect");
+        return 1;
+    }
+
+    HostClient proxy;
+    if (proxy.connect(options.broker, "mn8-bench-proxy", BENCH_KEEP_ALIVE_S, nullptr, nullptr) != ESP_OK) {
+        return 1;
+    }
+
+    // The seq carries on from one rate to the next, the sequencer would drop
+    // a restart from 1 as stale.
+    int failures = 0;
+    uint32_t first = 1;
+    for (double rate : rates) {
+        uint32_t last = first + options.count - 1;
+        if (publish_ledstate(proxy, rate, first, last, record, topics.get(e_mqtt_topic_ledstate)) != ESP_OK) {
+            failures++;
+        }
+        wait_drained(record, first, last);
+        record.report(rate, first, last);
+        first = last + 1;
+    }
+    device.report();
+
+    proxy.disconnect();
+    acks.stop();
+    return failures == 0 ? 0 : 1;
+}
+
+//******************************************************************************
+int main(int argc, char** argv) {
+    bench_options_t options = {};
+    options.broker.host = "127.0.0.1";
+    options.broker.port = 1883;
+    options.count = 500;
+    const char* rates_option = "10,50,200";
+    host_log_level = ESP_LOG_ERROR;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "H:p:r:n:C:c:k:vh")) != -1) {
+        switch (opt) {
+            case 'H': options.broker.host = optarg; break;
+            case 'p': options.broker.port = atoi(optarg); break;
+            case 'r': rates_option = optarg; break;
+            case 'n': options.count = atoi(optarg); break;
+            case 'C': options.broker.root_ca = HostClient::read_pem(optarg); break;
+            case 'c': options.broker.client_cert = HostClient::read_pem(optarg); break;
+            case 'k': options.broker.client_key = HostClient::read_pem(optarg); break;
+            case 'v': host_log_level = ESP_LOG_DEBUG; break;
+            default: usage(argv[0]); return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    std::vector<double> rates;
+    for (const char* p = rates_option; *p != '\0';) {
+        double rate = strtod(p, (char**) &p);
+        if (rate <= 0) {
+            usage(argv[0]);
+            return 1;
+        }
+        rates.push_back(rate);
+        if (*p == ',') {
+            p++;
+        }
+    }
+    if (options.count <= 0 || rates.empty()) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    printf("broker %s:%d%s  loop delay %d ms  %d messages per rate\n",
+           options.broker.host, options.broker.port, options.broker.root_ca ? " (tls)" : "",
+           MQTT_AGENT_LOOP_DELAY_MS, options.count);
+
+    int ret = run(options, rates);
+
+    // The mqtt agent task never returns, don't wait for it.
+    fflush(stdout);
+    _exit(ret);
+}
@@ -0,0 +1,458 @@
+//******************************************************************************
+/**
+ * @file mqtt_agent_tests.cpp
+ * @author pat laplante (plaplante@appliedlogix.com)
+ *
+ * @brief Unit testing for the mqtt loop of the MqttAgent, over the host shim
+ * @version 0.1
+ * @date 2024-02-21
+ *
+ * @copyright Copyright MN8 (c) 2024
+ *
+ * The MqttAgent, IotThing and LedStateInbox of the firmware run against a
+ * broker in the test, which writes a burst of ledstates in one go.
+ */
+//******************************************************************************
+
+#include <gtest/gtest.h>
+
+#include "App/MqttAgent/MqttAgent.h"
+#include "App/MqttAgent/MqttTopics.h"
+#include "App/MqttAgent/IotThing.h"
+#include "App/LedStateInbox.h"
+#include "App/LedStateSequencer.h"
+#include "App/Configuration/ThingConfig.h"
+#include "App/Configuration/ChargePointConfig.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_event.h"
+#include "esp_netif.h"
+#include "esp_mac.h"
+#include "esp_tls.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define THING_NAME      "test-thing"
+#define CONNECT_MS      (30000)
+
+static const uint8_t test_mac[6] = { 0x02, 0x00, 0x00, 0x00, 0x7e, 0x01 };
+
+//******************************************************************************
+/**
+ * @brief Enough of a broker for one device: CONNACK, SUBACK, PINGRESP.
+ *
+ * Once the device asks for the latest state, it is subscribed, bursts go
+ * out from then on.  The device reconnects after a drop.  The subscribes
+ * and unsubscribes are kept, "+topic" and "-topic".
+ */
+class TestBroker {
+public:
+    esp_err_t start(void) {
+        this->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+        struct sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t length = sizeof(address);
+        if (bind(this->listen_fd, (struct sockaddr*) &address, length) != 0 ||
+            listen(this->listen_fd, 1) != 0 ||
+            getsockname(this->listen_fd, (struct sockaddr*) &address, &length) != 0) {
+            return ESP_FAIL;
+        }
+        this->port = ntohs(address.sin_port);
+
+        std::thread([this] { this->serve(); }).detach();
+        return ESP_OK;
+    }
+
+    inline uint16_t get_port(void) const { return this->port; }
+    inline bool is_ready(void) const { return this->ready; }
+
+    bool has_subscription(const std::string& subscription) {
+        std::lock_guard<std::mutex> lock(this->write_mutex);
+        for (const std::string& seen : this->subscriptions) {
+            if (seen == subscription) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void drop_client(void) {
+        this->ready = false;
+        shutdown(this->client_fd, SHUT_RDWR);
+    }
+
+    // All the publishes in a single write, they reach the device together.
+    void send_burst(const char* topic, const std::vector<std::string>& payloads) {
+        std::vector<uint8_t> burst;
+        for (const std::string& payload : payloads) {
+            size_t topic_length = strlen(topic);
+            size_t remaining = 2 + topic_length + payload.size();
+            burst.push_back(0x30);
+            do {
+                uint8_t byte = remaining % 128;
+                remaining /= 128;
+                burst.push_back(remaining > 0 ? byte | 0x80 : byte);
+            } while (remaining > 0);
+            burst.push_back((uint8_t)(topic_length >> 8));
+            burst.push_back((uint8_t)(topic_length & 0xff));
+            burst.insert(burst.end(), topic, topic + topic_length);
+            burst.insert(burst.end(), payload.begin(), payload.end());
+        }
+        this->write_all(burst.data(), burst.size());
+    }
+
+private:
+    void serve(void) {
+        while (true) {
+            int fd = accept(this->listen_fd, nullptr, nullptr);
+            if (fd < 0) {
+                return;
+            }
+            this->client_fd = fd;
+            this->serve_client();
+            close(fd);
+        }
+    }
+
+    void serve_client(void) {
+        uint8_t header;
+        std::vector<uint8_t> body;
+        while (this->read_packet(header, body)) {
+            switch (header & 0xf0) {
+                case 0x10: {
+                    const uint8_t connack[] = { 0x20, 0x02, 0x00, 0x00 };
+                    this->write_all(connack, sizeof(connack));
+                    break;
+                }
+                case 0x80: {
+                    this->add_subscription('+', body);
+                    const uint8_t suback[] = { 0x90, 0x03, body[0], body[1], 0x00 };
+                    this->write_all(suback, sizeof(suback));
+                    break;
+                }
+                case 0xa0: {
+                    this->add_subscription('-', body);
+                    const uint8_t unsuback[] = { 0xb0, 0x02, body[0], body[1] };
+                    this->write_all(unsuback, sizeof(unsuback));
+                    break;
+                }
+                case 0x30: {
+                    size_t topic_length = (body[0] << 8) | body[1];
+                    std::string topic((const char*) &body[2], topic_length);
+                    if (topic.size() >= 7 && topic.compare(topic.size() - 7, 7, "/latest") == 0) {
+                        this->ready = true;
+                    }
+                    break;
+                }
+                case 0xc0: {
+                    const uint8_t pingresp[] = { 0xd0, 0x00 };
+                    this->write_all(pingresp, sizeof(pingresp));
+                    break;
+                }
+                default:
+                    break;
+            }
+        }
+    }
+
+    // One topic filter per packet, after the packet id.
+    void add_subscription(char kind, const std::vector<uint8_t>& body) {
+        size_t topic_length = (body[2] << 8) | body[3];
+        std::lock_guard<std::mutex> lock(this->write_mutex);
+        this->subscriptions.push_back(kind + std::string((const char*) &body[4], topic_length));
+    }
+
+    bool read_packet(uint8_t& header, std::vector<uint8_t>& body) {
+        if (!this->read_all(&header, 1)) {
+            return false;
+        }
+        size_t remaining = 0;
+        size_t multiplier = 1;
+        uint8_t byte;
+        do {
+            if (!this->read_all(&byte, 1)) {
+                return false;
+            }
+            remaining += (byte & 0x7f) * multiplier;
+            multiplier *= 128;
+        } while (byte & 0x80);
+
+        body.resize(remaining);
+        return remaining == 0 || this->read_all(body.data(), remaining);
+    }
+
+    bool read_all(uint8_t* data, size_t length) {
+        while (length > 0) {
+            ssize_t got = recv(this->client_fd, data, length, 0);
+            if (got <= 0) {
+                return false;
+            }
+            data += got;
+            length -= got;
+        }
+        return true;
+    }
+
+    void write_all(const uint8_t* data, size_t length) {
+        std::lock_guard<std::mutex> lock(this->write_mutex);
+        while (length > 0) {
+            ssize_t sent = send(this->client_fd, data, length, MSG_NOSIGNAL);
+            if (sent <= 0) {
+                return;
+            }
+            data += sent;
+            length -= sent;
+        }
+    }
+
+private:
+    int listen_fd = -1;
+    int client_fd = -1;
+    uint16_t port = 0;
+    std::atomic<bool> ready{false};
+    std::mutex write_mutex;
+    std::vector<std::string> subscriptions;
+};
+
+//******************************************************************************
+/**
+ * @brief The device, with the LED tasks replaced by a count of the applies.
+ */
+class TestDevice {
+public:
+    esp_err_t start(uint16_t port) {
+        host_set_mac_address(test_mac);
+        host_tls_options.port = port;
+        host_tls_options.plain = true;
+
+        this->thing_config.set_thing_name(THING_NAME);
+        this->thing_config.set_endpoint_address("127.0.0.1");
+
+        this->mqtt_agent.setup(&this->thing_config, &this->charge_point_config);
+        this->iot_thing.setup(&this->thing_config, &this->mqtt_agent);
+        if (this->ledstate_inbox.setup(&this->sequencer, &this->iot_thing, sGet_requested, sApply, this) != ESP_OK) {
+            return ESP_FAIL;
+        }
+        this->ledstate_inbox.register_handlers(this->mqtt_agent);
+        this->mqtt_agent.register_event_callback(sOn_mqtt_event, this);
+        this->mqtt_agent.start();
+
+        esp_event_post(IP_EVENT, IP_EVENT_STA_GOT_IP, nullptr, 0, portMAX_DELAY);
+
+        int64_t deadline = esp_timer_get_time() + CONNECT_MS * 1000LL;
+        while (!this->connected && esp_timer_get_time() < deadline) {
+            vTaskDelay(10 / portTICK_PERIOD_MS);
+        }
+        return this->connected ? ESP_OK : ESP_ERR_TIMEOUT;
+    }
+
+    // Until the ledstate with this seq reached the leds.
+    bool wait_applied(uint32_t seq) {
+        int64_t deadline = esp_timer_get_time() + CONNECT_MS * 1000LL;
+        while (this->last_seq != seq && esp_timer_get_time() < deadline) {
+            vTaskDelay(10 / portTICK_PERIOD_MS);
+        }
+        // A few more passes of the mqtt loop, nothing else should come.
+        vTaskDelay(3 * MQTT_AGENT_LOOP_DELAY_MS / portTICK_PERIOD_MS + 100 / portTICK_PERIOD_MS);
+        return this->last_seq == seq;
+    }
+
+    ledstate_message_t get_shown(void) {
+        std::lock_guard<std::mutex> lock(this->shown_mutex);
+        return this->shown;
+    }
+
+    inline bool is_connected(void) const { return this->connected; }
+
+    // Provisioned, moved or unprovisioned (nullptr) while connected.
+    void set_group(const char* group_id) {
+        if (group_id == nullptr) {
+            this->charge_point_config.reset();
+        } else {
+            this->charge_point_config.set_chargepoint_info(group_id, "station-1", 1, "station-2", 1);
+            this->charge_point_config.save();
+        }
+    }
+    inline int get_applies(void) const { return this->applies; }
+    inline uint32_t get_coalesced(void) { return this->sequencer.get_counters().coalesced; }
+
+private:
+    static ledstate_message_t sGet_requested(void* context) { return ((TestDevice*) context)->get_shown(); }
+    static void sApply(const ledstate_message_t& message, void* context) { ((TestDevice*) context)->apply(message); }
+    static void sOn_mqtt_event(MqttAgent::event_t event, void* context) {
+        ((TestDevice*) context)->connected = event == MqttAgent::e_mqtt_agent_connected;
+    }
+
+    void apply(const ledstate_message_t& message) {
+        std::lock_guard<std::mutex> lock(this->shown_mutex);
+        ledstate_merge(&this->shown, message);
+        this->shown.has_seq = false;
+        this->applies++;
+        if (message.has_seq) {
+            this->last_seq = message.seq;
+        }
+    }
+
+private:
+    ThingConfig thing_config;
+    ChargePointConfig charge_point_config;
+    MqttAgent mqtt_agent;
+    IotThing iot_thing;
+    LedStateSequencer sequencer;
+    LedStateInbox ledstate_inbox;
+
+    std::mutex shown_mutex;
+    ledstate_message_t shown = {};
+    std::atomic<bool> connected{false};
+    std::atomic<int> applies{0};
+    std::atomic<uint32_t> last_seq{0};
+};
+
+//******************************************************************************
+// The agent task never returns, the broker and the device live until _exit.
+class MqttAgentTest : public ::testing::Test {
+protected:
+    static void SetUpTestSuite(void) {
+        broker = new TestBroker();
+        device = new TestDevice();
+        ASSERT_EQ(ESP_OK, broker->start());
+        ASSERT_EQ(ESP_OK, device->start(broker->get_port()));
+
+        int64_t deadline = esp_timer_get_time() + CONNECT_MS * 1000LL;
+        while (!broker->is_ready() && esp_timer_get_time() < deadline) {
+            vTaskDelay(10 / portTICK_PERIOD_MS);
+        }
+        ASSERT_TRUE(broker->is_ready());
+
+        char mac_address[13];
+        snprintf(mac_address, sizeof(mac_address), "%02X%02X%02X%02X%02X%02X",
+                 test_mac[0], test_mac[1], test_mac[2], test_mac[3], test_mac[4], test_mac[5]);
+        topics.build(THING_NAME, mac_address);
+    }
+
+    // Port 0 alternates so no message is a duplicate of the one before.
+    static void send_burst(uint32_t first, uint32_t last) {
+        std::vector<std::string> payloads;
+        char payload[128];
+        for (uint32_t seq = first; seq <= last; seq++) {
+            snprintf(payload, sizeof(payload),
+                "{\"seq\":%u,\"port0\":{\"state\":\"%s\",\"charge_percent\":%u},\"port1\":{\"state\":\"available\"}}",
+                seq, (seq & 1) ? "charging" : "available", seq % 100);
+            payloads.push_back(payload);
+        }
+        broker->send_burst(topics.get(e_mqtt_topic_ledstate), payloads);
+    }
+
+    static TestBroker* broker;
+    static TestDevice* device;
+    static MqttTopics topics;
+};
+
+TestBroker* MqttAgentTest::broker = nullptr;
+TestDevice* MqttAgentTest::device = nullptr;
+MqttTopics MqttAgentTest::topics;
+
+//******************************************************************************
+TEST_F(MqttAgentTest, BurstIsAppliedOnce) {
+    const uint32_t count = 8;
+    int applies = device->get_applies();
+    uint32_t coalesced = device->get_coalesced();
+
+    send_burst(1, count);
+    ASSERT_TRUE(device->wait_applied(count));
+
+    EXPECT_EQ(applies + 1, device->get_applies());
+    EXPECT_EQ(coalesced + count - 1, device->get_coalesced());
+
+    ledstate_message_t shown = device->get_shown();
+    EXPECT_EQ(led_state_from_string("available", 9), shown.port[0].state);
+    EXPECT_EQ((int) count % 100, shown.port[0].charge_percent);
+}
+
+//******************************************************************************
+TEST_F(MqttAgentTest, BurstOverTheDrainBoundTakesAnotherPass) {
+    const uint32_t first = 100;
+    const uint32_t last = first + MQTT_AGENT_DRAIN_MAX_PACKETS + 3;
+    int applies = device->get_applies();
+
+    send_burst(first, last);
+    ASSERT_TRUE(device->wait_applied(last));
+
+    EXPECT_EQ(applies + 2, device->get_applies());
+    EXPECT_EQ((int) last % 100, device->get_shown().port[0].charge_percent);
+}
+
+//******************************************************************************
+/**
+ * @brief The group topic follows the chargepoint config without a reboot.
+ */
+TEST_F(MqttAgentTest, GroupTopicFollowsTheChargepointConfig) {
+    auto wait_for = [](const char* subscription) {
+        int64_t deadline = esp_timer_get_time() + CONNECT_MS * 1000LL;
+        while (!broker->has_subscription(subscription) && esp_timer_get_time() < deadline) {
+            vTaskDelay(10 / portTICK_PERIOD_MS);
+        }
+        return broker->has_subscription(subscription);
+    };
+
+    device->set_group("group-a");
+    EXPECT_TRUE(wait_for("+group-a/ledstate"));
+
+    device->set_group("group-b");
+    EXPECT_TRUE(wait_for("-group-a/ledstate"));
+    EXPECT_TRUE(wait_for("+group-b/ledstate"));
+
+    device->set_group(nullptr);
+    EXPECT_TRUE(wait_for("-group-b/ledstate"));
+}
+
+//******************************************************************************
+/**
+ * @brief A proxy that restarted from 1 while the device was away is taken.
+ *
+ * Without the reset on the connection its seqs would be stale until they
+ * pass the last one applied.
+ */
+TEST_F(MqttAgentTest, ProxyRestartIsTakenAfterReconnect) {
+    send_burst(500, 500);
+    ASSERT_TRUE(device->wait_applied(500));
+
+    broker->drop_client();
+    int64_t deadline = esp_timer_get_time() + CONNECT_MS * 1000LL;
+    while (device->is_connected() && esp_timer_get_time() < deadline) {
+        vTaskDelay(10 / portTICK_PERIOD_MS);
+    }
+    while (!broker->is_ready() && esp_timer_get_time() < deadline) {
+        vTaskDelay(10 / portTICK_PERIOD_MS);
+    }
+    ASSERT_TRUE(broker->is_ready());
+
+    send_burst(1, 1);
+    ASSERT_TRUE(device->wait_applied(1));
+    EXPECT_EQ(1, device->get_shown().port[0].charge_percent);
+}
+
+//******************************************************************************
+int main(int argc, char** argv) {
+    testing::InitGoogleTest(&argc, argv);
+    host_log_level = ESP_LOG_NONE;
+
+    int ret = RUN_ALL_TESTS();
+    fflush(stdout);
+    _exit(ret);
+}
@@ -0,0 +1,25 @@
+//******************************************************************************
+/**
+ * @file esp_check.h
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief Host shim, ESP_GOTO_ON_ERROR
+ * @version 0.1
+ * @date 2024-02-21
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#pragma once
+
+#include "esp_err.h"
+#include "esp_log.h"
+
+#define ESP_GOTO_ON_ERROR(x, goto_tag, log_tag, format, ...) do { \
+        esp_err_t err_rc_ = (x); \
+        if (err_rc_ != ESP_OK) { \
+            ESP_LOGE(log_tag, "%s(%d): " format, __FUNCTION__, __LINE__, ##__VA_ARGS__); \
+            ret = err_rc_; \
+            goto goto_tag; \
+        } \
+    } while (0)
+
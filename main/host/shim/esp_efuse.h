@@ -0,0 +1,15 @@
+//******************************************************************************
+/**
+ * @file esp_efuse.h
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief Host shim, see esp_mac.h
+ * @version 0.1
+ * @date 2024-02-21
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#pragma once
+
+#include "esp_log.h"
+#include "esp_mac.h"
@@ -0,0 +1,14 @@
+//******************************************************************************
+/**
+ * @file esp_efuse_table.h
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief Host shim, see esp_mac.h
+ * @version 0.1
+ * @date 2024-02-21
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#pragma once
+
+#include "esp_mac.h"
@@ -0,0 +1,14 @@
+//******************************************************************************
+/**
+ * @file esp_eth.h
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief Host shim, ethernet
+ * @version 0.1
+ * @date 2024-02-21
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#pragma once
+
+#include "esp_eth_com.h"
@@ -0,0 +1,31 @@
+//******************************************************************************
+/**
+ * @file esp_eth_com.h
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief Host shim, ethernet events
+ * @version 0.1
+ * @date 2024-02-21
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#pragma once
+
+#include "esp_event.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+ESP_EVENT_DECLARE_BASE(ETH_EVENT);
+
+typedef enum {
+    ETHERNET_EVENT_START,
+    ETHERNET_EVENT_STOP,
+    ETHERNET_EVENT_CONNECTED,
+    ETHERNET_EVENT_DISCONNECTED,
+} eth_event_t;
+
+#ifdef __cplusplus
+}
+#endif
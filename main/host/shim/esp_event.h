@@ -0,0 +1,37 @@
+//******************************************************************************
+/**
+ * @file esp_event.h
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief Host shim, event handlers registered and posted in process
+ * @version 0.1
+ * @date 2024-02-21
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#pragma once
+
+#include "esp_err.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef const char* esp_event_base_t;
+typedef void (*esp_event_handler_t)(void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data);
+
+#define ESP_EVENT_ANY_ID                (-1)
+#define ESP_EVENT_DECLARE_BASE(id)      extern esp_event_base_t const id
+
+// Handlers are called from the task that posts, there is no event loop task.
+// Every handler registered for the event gets it, one per device when the
+// tools run many.
+esp_err_t esp_event_handler_register(esp_event_base_t event_base, int32_t event_id, esp_event_handler_t event_handler, void* event_handler_arg);
+esp_err_t esp_event_post(esp_event_base_t event_base, int32_t event_id, const void* event_data, size_t event_data_size, uint32_t ticks_to_wait);
+
+#ifdef __cplusplus
+}
+#endif
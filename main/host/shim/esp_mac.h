@@ -0,0 +1,30 @@
+//******************************************************************************
+/**
+ * @file esp_mac.h
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief Host shim, the fuse mac of the device a thread plays
+ * @version 0.1
+ * @date 2024-02-21
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#pragma once
+
+#include "esp_err.h"
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+esp_err_t esp_efuse_mac_get_default(uint8_t* mac);
+
+// The tools run many devices in one process.  The mac is per thread, a task
+// gets the one of the thread that created it; all zero until set.
+void host_set_mac_address(const uint8_t mac[6]);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,41 @@
+//******************************************************************************
+/**
+ * @file esp_netif.h
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief Host shim, ip addresses and events
+ * @version 0.1
+ * @date 2024-02-21
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#pragma once
+
+#include "esp_event.h"
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+ESP_EVENT_DECLARE_BASE(IP_EVENT);
+
+typedef struct {
+    uint32_t addr;
+} esp_ip4_addr_t;
+
+typedef enum {
+    IP_EVENT_STA_GOT_IP,
+    IP_EVENT_STA_LOST_IP,
+    IP_EVENT_AP_STAIPASSIGNED,
+    IP_EVENT_GOT_IP6,
+    IP_EVENT_ETH_GOT_IP,
+    IP_EVENT_ETH_LOST_IP,
+    IP_EVENT_PPP_GOT_IP,
+    IP_EVENT_PPP_LOST_IP,
+} ip_event_t;
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,145 @@
+//******************************************************************************
+/**
+ * @file esp_posix.cpp
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief Host shim, esp_timer, esp_log, events, mac and partitions
+ * @version 0.1
+ * @date 2024-02-21
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "esp_event.h"
+#include "esp_eth.h"
+#include "esp_wifi.h"
+#include "esp_netif.h"
+#include "esp_mac.h"
+#include "esp_system.h"
+#include "esp_partition.h"
+#include "nvs.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <mutex>
+#include <vector>
+
+esp_event_base_t const ETH_EVENT = "ETH_EVENT";
+esp_event_base_t const WIFI_EVENT = "WIFI_EVENT";
+esp_event_base_t const IP_EVENT = "IP_EVENT";
+
+struct event_handler_t {
+    esp_event_base_t base;
+    int32_t id;
+    esp_event_handler_t handler;
+    void* arg;
+};
+
+static std::mutex event_handlers_mutex;
+static std::vector<event_handler_t> event_handlers;
+
+static thread_local uint8_t mac_address[6] = {};
+
+esp_log_level_t host_log_level = ESP_LOG_WARN;
+
+//******************************************************************************
+int64_t esp_timer_get_time(void) {
+    static int64_t start_us = -1;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int64_t now_us = (int64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+    if (start_us < 0) {
+        start_us = now_us;
+    }
+    return now_us - start_us;
+}
+
+//******************************************************************************
+const char* esp_err_to_name(esp_err_t code) {
+    switch (code) {
+        case ESP_OK: return "ESP_OK";
+        case ESP_FAIL: return "ESP_FAIL";
+        case ESP_ERR_NO_MEM: return "ESP_ERR_NO_MEM";
+        case ESP_ERR_INVALID_ARG: return "ESP_ERR_INVALID_ARG";
+        case ESP_ERR_INVALID_STATE: return "ESP_ERR_INVALID_STATE";
+        case ESP_ERR_INVALID_SIZE: return "ESP_ERR_INVALID_SIZE";
+        case ESP_ERR_NOT_FOUND: return "ESP_ERR_NOT_FOUND";
+        case ESP_ERR_NOT_SUPPORTED: return "ESP_ERR_NOT_SUPPORTED";
+        case ESP_ERR_TIMEOUT: return "ESP_ERR_TIMEOUT";
+        case ESP_ERR_INVALID_RESPONSE: return "ESP_ERR_INVALID_RESPONSE";
+        case ESP_ERR_INVALID_CRC: return "ESP_ERR_INVALID_CRC";
+        case ESP_ERR_INVALID_VERSION: return "ESP_ERR_INVALID_VERSION";
+        case ESP_ERR_NVS_NOT_FOUND: return "ESP_ERR_NVS_NOT_FOUND";
+        case ESP_ERR_NVS_INVALID_LENGTH: return "ESP_ERR_NVS_INVALID_LENGTH";
+        default: return "UNKNOWN ERROR";
+    }
+}
+
+//******************************************************************************
+esp_err_t esp_event_handler_register(esp_event_base_t event_base, int32_t event_id, esp_event_handler_t event_handler, void* event_handler_arg) {
+    std::lock_guard<std::mutex> lock(event_handlers_mutex);
+    event_handlers.push_back({ event_base, event_id, event_handler, event_handler_arg });
+    return ESP_OK;
+}
+
+//******************************************************************************
+esp_err_t esp_event_post(esp_event_base_t event_base, int32_t event_id, const void* event_data, size_t event_data_size, uint32_t ticks_to_wait) {
+    // Copied, a handler may register another one.
+    std::vector<event_handler_t> handlers;
+    {
+        std::lock_guard<std::mutex> lock(event_handlers_mutex);
+        handlers = event_handlers;
+    }
+
+    for (const event_handler_t& handler : handlers) {
+        if (strcmp(handler.base, event_base) == 0 && (handler.id == ESP_EVENT_ANY_ID || handler.id == event_id)) {
+            handler.handler(handler.arg, event_base, event_id, (void*) event_data);
+        }
+    }
+    return ESP_OK;
+}
+
+//******************************************************************************
+esp_err_t esp_efuse_mac_get_default(uint8_t* mac) {
+    memcpy(mac, mac_address, sizeof(mac_address));
+    return ESP_OK;
+}
+
+//******************************************************************************
+void host_set_mac_address(const uint8_t mac[6]) {
+    memcpy(mac_address, mac, sizeof(mac_address));
+}
+
+//******************************************************************************
+esp_err_t esp_register_shutdown_handler(shutdown_handler_t handle) {
+    return atexit(handle) == 0 ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+//******************************************************************************
+const esp_partition_t* esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype, const char* label) {
+    return nullptr;
+}
+
+//******************************************************************************
+esp_err_t esp_partition_mmap(const esp_partition_t* partition, size_t offset, size_t size, esp_partition_mmap_memory_t memory, const void** out_ptr, esp_partition_mmap_handle_t* out_handle) {
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+//******************************************************************************
+void esp_partition_munmap(esp_partition_mmap_handle_t handle) {
+}
+
+//******************************************************************************
+esp_err_t esp_partition_erase_range(const esp_partition_t* partition, size_t offset, size_t size) {
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+//******************************************************************************
+esp_err_t esp_partition_write(const esp_partition_t* partition, size_t dst_offset, const void* src, size_t size) {
+    return ESP_ERR_NOT_SUPPORTED;
+}
@@ -0,0 +1,27 @@
+//******************************************************************************
+/**
+ * @file esp_system.h
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief Host shim, shutdown handlers
+ * @version 0.1
+ * @date 2024-02-21
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#pragma once
+
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef void (*shutdown_handler_t)(void);
+
+// Run at exit.
+esp_err_t esp_register_shutdown_handler(shutdown_handler_t handle);
+
+#ifdef __cplusplus
+}
+#endif
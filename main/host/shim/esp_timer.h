@@ -0,0 +1,27 @@
+//******************************************************************************
+/**
+ * @file esp_timer.h
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief Host shim, esp_timer_get_time on the monotonic clock
+ * @version 0.1
+ * @date 2024-02-21
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#pragma once
+
+#include "esp_err.h"
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Microseconds since the process started.
+int64_t esp_timer_get_time(void);
+
+#ifdef __cplusplus
+}
+#endif
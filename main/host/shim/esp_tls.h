@@ -0,0 +1,65 @@
+//******************************************************************************
+/**
+ * @file esp_tls.h
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief Host shim, esp-tls over a TCP socket, optionally OpenSSL
+ * @version 0.1
+ * @date 2024-02-21
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct esp_tls {
+    int sockfd;
+    void* ssl;                          // SSL*, only with HOST_USE_OPENSSL
+} esp_tls_t;
+
+// The fields MqttConnection sets.  The certificates are PEM buffers, the
+// DER of the certificate partition only exists on a device.
+typedef struct esp_tls_cfg {
+    const char** alpn_protos;
+    const unsigned char* cacert_buf;
+    unsigned int cacert_bytes;
+    const unsigned char* clientcert_buf;
+    unsigned int clientcert_bytes;
+    const unsigned char* clientkey_buf;
+    unsigned int clientkey_bytes;
+    int timeout_ms;
+    const char* common_name;
+} esp_tls_cfg_t;
+
+// What the host does where the device connects to AWS.  Set before the
+// first connection, applies to every connection.
+typedef struct {
+    bool plain;                         // TCP only, for a local broker without TLS
+    const char* root_ca;                // PEM, replaces the root CA of the configuration
+    int port;                           // replaces the port, 0 keeps it
+} host_tls_options_t;
+
+extern host_tls_options_t host_tls_options;
+
+esp_tls_t* esp_tls_init(void);
+
+// 1 once connected, -1 on error.  Blocking, timeout_ms is ignored.
+int esp_tls_conn_new_sync(const char* hostname, int hostlen, int port, const esp_tls_cfg_t* cfg, esp_tls_t* tls);
+
+// Closes the connection and frees tls.
+int esp_tls_conn_destroy(esp_tls_t* tls);
+
+// Shuts down every open connection but keep_sockfd (-1 for none), without
+// closing them, the owners see the peer go away on their next read.  A
+// power event for the host tools.
+void host_tls_drop_all(int keep_sockfd);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,303 @@
+//******************************************************************************
+/**
+ * @file esp_tls_posix.cpp
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief Host shim, esp-tls over a TCP socket, optionally OpenSSL
+ * @version 0.1
+ * @date 2024-02-21
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#include "esp_tls.h"
+#include "esp_log.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <map>
+#include <mutex>
+#include <new>
+#include <set>
+#include <tuple>
+
+#ifdef HOST_USE_OPENSSL
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <openssl/pem.h>
+#endif
+
+static const char* TAG = "esp_tls";
+
+host_tls_options_t host_tls_options = {};
+
+// Open sockets, for host_tls_drop_all().
+static std::mutex sockets_mutex;
+static std::set<int> open_sockets;
+
+//******************************************************************************
+static int open_socket(const char* host, int port) {
+    char service[8];
+    snprintf(service, sizeof(service), "%d", port);
+
+    struct addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    struct addrinfo* result = nullptr;
+    if (getaddrinfo(host, service, &hints, &result) != 0) {
+        ESP_LOGE(TAG, "Failed to resolve %s", host);
+        return -1;
+    }
+
+    int fd = -1;
+    for (struct addrinfo* ai = result; ai != nullptr; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+            break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(result);
+
+    if (fd >= 0) {
+        // Small publishes, latency is what we measure.
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    return fd;
+}
+
+#ifdef HOST_USE_OPENSSL
+//******************************************************************************
+static bool load_root_ca(SSL_CTX* ssl_ctx, const unsigned char* pem) {
+    BIO* bio = BIO_new_mem_buf(pem, -1);
+    X509_STORE* store = SSL_CTX_get_cert_store(ssl_ctx);
+    int count = 0;
+
+    X509* cert;
+    while ((cert = PEM_read_bio_X509(bio, NULL, NULL, NULL)) != nullptr) {
+        X509_STORE_add_cert(store, cert);
+        X509_free(cert);
+        count++;
+    }
+
+    ERR_clear_error();
+    BIO_free(bio);
+    return count > 0;
+}
+
+//******************************************************************************
+static bool load_client_certificate(SSL_CTX* ssl_ctx, const unsigned char* cert_pem, const unsigned char* key_pem) {
+    BIO* bio = BIO_new_mem_buf(cert_pem, -1);
+    X509* cert = PEM_read_bio_X509(bio, NULL, NULL, NULL);
+    BIO_free(bio);
+
+    bio = BIO_new_mem_buf(key_pem, -1);
+    EVP_PKEY* key = PEM_read_bio_PrivateKey(bio, NULL, NULL, NULL);
+    BIO_free(bio);
+
+    bool loaded = cert != nullptr && key != nullptr &&
+        SSL_CTX_use_certificate(ssl_ctx, cert) == 1 &&
+        SSL_CTX_use_PrivateKey(ssl_ctx, key) == 1;
+
+    X509_free(cert);
+    EVP_PKEY_free(key);
+    return loaded;
+}
+
+//******************************************************************************
+static SSL_CTX* create_ssl_ctx(const unsigned char* root_ca, const esp_tls_cfg_t* cfg) {
+    SSL_CTX* ssl_ctx = SSL_CTX_new(TLS_client_method());
+    if (ssl_ctx == nullptr) {
+        return nullptr;
+    }
+    if (!load_root_ca(ssl_ctx, root_ca)) {
+        ESP_LOGE(TAG, "Failed to load the root CA");
+        SSL_CTX_free(ssl_ctx);
+        return nullptr;
+    }
+    if (cfg->clientcert_buf != nullptr && cfg->clientkey_buf != nullptr &&
+        !load_client_certificate(ssl_ctx, cfg->clientcert_buf, cfg->clientkey_buf)) {
+        ESP_LOGE(TAG, "Failed to load the client certificate, only PEM is supported");
+        SSL_CTX_free(ssl_ctx);
+        return nullptr;
+    }
+    SSL_CTX_set_verify(ssl_ctx, SSL_VERIFY_PEER, NULL);
+    return ssl_ctx;
+}
+
+//******************************************************************************
+/**
+ * @brief One context per set of credentials.
+ *
+ * The fleet simulator connects thousands of devices with the same buffers,
+ * the PEM is parsed once.  Kept until exit.
+ */
+static SSL_CTX* get_ssl_ctx(const unsigned char* root_ca, const esp_tls_cfg_t* cfg) {
+    static std::mutex mutex;
+    static std::map<std::tuple<const void*, const void*, const void*>, SSL_CTX*> contexts;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto key = std::make_tuple((const void*) root_ca, (const void*) cfg->clientcert_buf, (const void*) cfg->clientkey_buf);
+    auto found = contexts.find(key);
+    if (found != contexts.end()) {
+        return found->second;
+    }
+
+    SSL_CTX* ssl_ctx = create_ssl_ctx(root_ca, cfg);
+    if (ssl_ctx != nullptr) {
+        contexts[key] = ssl_ctx;
+    }
+    return ssl_ctx;
+}
+
+//******************************************************************************
+static int tls_handshake(esp_tls_t* tls, const unsigned char* root_ca, const esp_tls_cfg_t* cfg) {
+    SSL_CTX* ssl_ctx = get_ssl_ctx(root_ca, cfg);
+    if (ssl_ctx == nullptr) {
+        return -1;
+    }
+
+    SSL* ssl = SSL_new(ssl_ctx);
+    if (ssl == nullptr) {
+        return -1;
+    }
+    SSL_set_fd(ssl, tls->sockfd);
+
+    // The certificate is checked against the endpoint name, not against the
+    // address we connected to.
+    const char* name = cfg->common_name;
+    if (name != nullptr) {
+        struct in6_addr address;
+        if (inet_pton(AF_INET, name, &address) != 1 && inet_pton(AF_INET6, name, &address) != 1) {
+            SSL_set_tlsext_host_name(ssl, name);
+        }
+        SSL_set1_host(ssl, name);
+    }
+
+    if (cfg->alpn_protos != nullptr) {
+        unsigned char protos[64];
+        size_t length = 0;
+        for (const char** proto = cfg->alpn_protos; *proto != nullptr; proto++) {
+            size_t proto_length = strlen(*proto);
+            if (length + 1 + proto_length > sizeof(protos)) {
+                break;
+            }
+            protos[length++] = (unsigned char) proto_length;
+            memcpy(&protos[length], *proto, proto_length);
+            length += proto_length;
+        }
+        SSL_set_alpn_protos(ssl, protos, (unsigned int) length);
+    }
+
+    if (SSL_connect(ssl) != 1) {
+        ESP_LOGE(TAG, "TLS handshake with %s failed", name != nullptr ? name : "broker");
+        SSL_free(ssl);
+        return -1;
+    }
+
+    tls->ssl = ssl;
+    return 1;
+}
+#endif
+
+//******************************************************************************
+esp_tls_t* esp_tls_init(void) {
+    esp_tls_t* tls = new (std::nothrow) esp_tls_t;
+    if (tls != nullptr) {
+        tls->sockfd = -1;
+        tls->ssl = nullptr;
+    }
+    return tls;
+}
+
+//******************************************************************************
+static void close_socket(esp_tls_t* tls) {
+    if (tls->sockfd < 0) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(sockets_mutex);
+    open_sockets.erase(tls->sockfd);
+    close(tls->sockfd);
+    tls->sockfd = -1;
+}
+
+//******************************************************************************
+int esp_tls_conn_new_sync(const char* hostname, int hostlen, int port, const esp_tls_cfg_t* cfg, esp_tls_t* tls) {
+    char host[256];
+    if (hostname == nullptr || hostlen <= 0 || hostlen >= (int) sizeof(host) || tls == nullptr) {
+        return -1;
+    }
+    memcpy(host, hostname, hostlen);
+    host[hostlen] = '\0';
+
+    if (host_tls_options.port != 0) {
+        port = host_tls_options.port;
+    }
+
+    tls->sockfd = open_socket(host, port);
+    if (tls->sockfd < 0) {
+        ESP_LOGE(TAG, "Failed to connect to %s:%d", host, port);
+        return -1;
+    }
+    {
+        std::lock_guard<std::mutex> lock(sockets_mutex);
+        open_sockets.insert(tls->sockfd);
+    }
+
+    const unsigned char* root_ca = host_tls_options.root_ca != nullptr ? (const unsigned char*) host_tls_options.root_ca : cfg->cacert_buf;
+    if (host_tls_options.plain || root_ca == nullptr) {
+        return 1;
+    }
+
+#ifdef HOST_USE_OPENSSL
+    if (tls_handshake(tls, root_ca, cfg) == 1) {
+        return 1;
+    }
+#else
+    ESP_LOGE(TAG, "Built without OpenSSL, only plain connections");
+#endif
+
+    close_socket(tls);
+    return -1;
+}
+
+//******************************************************************************
+int esp_tls_conn_destroy(esp_tls_t* tls) {
+    if (tls == nullptr) {
+        return -1;
+    }
+
+#ifdef HOST_USE_OPENSSL
+    if (tls->ssl != nullptr) {
+        SSL_shutdown((SSL*) tls->ssl);
+        SSL_free((SSL*) tls->ssl);
+    }
+#endif
+    close_socket(tls);
+    delete tls;
+    return 0;
+}
+
+//******************************************************************************
+void host_tls_drop_all(int keep_sockfd) {
+    std::lock_guard<std::mutex> lock(sockets_mutex);
+    for (int sockfd : open_sockets) {
+        if (sockfd != keep_sockfd) {
+            shutdown(sockfd, SHUT_RDWR);
+        }
+    }
+}
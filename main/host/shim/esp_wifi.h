@@ -0,0 +1,15 @@
+//******************************************************************************
+/**
+ * @file esp_wifi.h
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief Host shim, wifi
+ * @version 0.1
+ * @date 2024-02-21
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#pragma once
+
+#include "esp_wifi_types.h"
+#include "esp_netif.h"
@@ -0,0 +1,34 @@
+//******************************************************************************
+/**
+ * @file FreeRTOS.h
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief Host shim, the bits of FreeRTOS the mqtt code uses
+ * @version 0.1
+ * @date 2024-02-21
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "esp_timer.h"
+
+typedef int32_t BaseType_t;
+typedef uint32_t UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdFALSE                 ((BaseType_t) 0)
+#define pdTRUE                  ((BaseType_t) 1)
+#define pdPASS                  pdTRUE
+#define pdFAIL                  pdFALSE
+#define errQUEUE_FULL           ((BaseType_t) 0)
+
+// One tick is one millisecond.
+#define portTICK_PERIOD_MS      ((TickType_t) 1)
+#define portMAX_DELAY           ((TickType_t) 0xffffffffUL)
+#define pdMS_TO_TICKS(ms)       ((TickType_t)(ms))
+
+#define tskKERNEL_VERSION_NUMBER "host"
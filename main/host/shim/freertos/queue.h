@@ -0,0 +1,30 @@
+//******************************************************************************
+/**
+ * @file queue.h
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief Host shim, FreeRTOS queues over pthread
+ * @version 0.1
+ * @date 2024-02-21
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct host_queue* QueueHandle_t;
+
+// Items are copied in and out, as on FreeRTOS.
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size);
+BaseType_t xQueueSend(QueueHandle_t queue, const void* item, TickType_t ticks);
+BaseType_t xQueueReceive(QueueHandle_t queue, void* item, TickType_t ticks);
+
+#ifdef __cplusplus
+}
+#endif
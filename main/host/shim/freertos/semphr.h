@@ -0,0 +1,35 @@
+//******************************************************************************
+/**
+ * @file semphr.h
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief Host shim, mutexes on top of pthread
+ * @version 0.1
+ * @date 2024-02-21
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct host_semaphore* SemaphoreHandle_t;
+
+// Same size as a pthread mutex is plenty, the static buffer is only storage.
+typedef struct {
+    uint8_t storage[64];
+} StaticSemaphore_t;
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void);
+SemaphoreHandle_t xSemaphoreCreateMutexStatic(StaticSemaphore_t* buffer);
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,64 @@
+//******************************************************************************
+/**
+ * @file task.h
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief Host shim, tasks on pthreads, delays and ticks
+ * @version 0.1
+ * @date 2024-02-21
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct host_task* TaskHandle_t;
+typedef void (*TaskFunction_t)(void* parameters);
+
+void vTaskDelay(TickType_t ticks);
+TickType_t xTaskGetTickCount(void);
+
+// One thread per task, the priority and the core are ignored.  The stack is
+// at least HOST_TASK_MIN_STACK_SIZE, the C library takes more than newlib.
+#define HOST_TASK_MIN_STACK_SIZE    (256 * 1024)
+
+BaseType_t xTaskCreatePinnedToCore(
+    TaskFunction_t function,
+    const char* name,
+    uint32_t stack_size,
+    void* parameters,
+    UBaseType_t priority,
+    TaskHandle_t* created_task,
+    BaseType_t core_id
+);
+BaseType_t xTaskCreate(
+    TaskFunction_t function,
+    const char* name,
+    uint32_t stack_size,
+    void* parameters,
+    UBaseType_t priority,
+    TaskHandle_t* created_task
+);
+
+// Only a task deleting itself, with NULL.
+void vTaskDelete(TaskHandle_t task);
+
+// Not supported, a warning is logged.
+void vTaskSuspend(TaskHandle_t task);
+void vTaskResume(TaskHandle_t task);
+
+// Any thread has a handle, created on first use for the ones not started
+// as a task.
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+uint32_t ulTaskNotifyTake(BaseType_t clear_count_on_exit, TickType_t ticks);
+
+#ifdef __cplusplus
+}
+#endif
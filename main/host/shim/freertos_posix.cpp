@@ -0,0 +1,412 @@
+//******************************************************************************
+/**
+ * @file freertos_posix.cpp
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief Host shim, FreeRTOS tasks, mutexes and event groups over pthread
+ * @version 0.1
+ * @date 2024-02-21
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "freertos/queue.h"
+#include "freertos/event_groups.h"
+
+#include "esp_log.h"
+#include "esp_mac.h"
+
+#include <pthread.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <new>
+
+static const char* TAG = "freertos";
+
+struct host_semaphore {
+    pthread_mutex_t mutex;
+};
+
+struct host_task {
+    TaskFunction_t function;
+    void* parameters;
+    uint8_t mac[6];                     // of the device, see esp_mac.h
+
+    pthread_mutex_t mutex;
+    pthread_cond_t notified;
+    uint32_t notifications;
+};
+
+struct host_queue {
+    pthread_mutex_t mutex;
+    pthread_cond_t changed;
+    UBaseType_t length;
+    UBaseType_t item_size;
+    UBaseType_t head;
+    UBaseType_t count;
+    uint8_t* items;
+};
+
+struct host_event_group {
+    pthread_mutex_t mutex;
+    pthread_cond_t changed;
+    EventBits_t bits;
+};
+
+static thread_local host_task* current_task = nullptr;
+
+static_assert(sizeof(host_semaphore) <= sizeof(StaticSemaphore_t), "StaticSemaphore_t too small");
+
+//******************************************************************************
+void vTaskDelay(TickType_t ticks) {
+    struct timespec delay;
+    delay.tv_sec = ticks / 1000;
+    delay.tv_nsec = (long)(ticks % 1000) * 1000000L;
+    while (nanosleep(&delay, &delay) != 0 && errno == EINTR) {
+    }
+}
+
+//******************************************************************************
+TickType_t xTaskGetTickCount(void) {
+    return (TickType_t)(esp_timer_get_time() / 1000);
+}
+
+//******************************************************************************
+// The deadline of a timed wait, ticks from now.
+static struct timespec deadline_in(TickType_t ticks) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += ticks / 1000;
+    deadline.tv_nsec += (long)(ticks % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    return deadline;
+}
+
+//******************************************************************************
+static host_task* create_task_record(TaskFunction_t function, void* parameters) {
+    host_task* task = new (std::nothrow) host_task;
+    if (task == nullptr) {
+        return nullptr;
+    }
+    task->function = function;
+    task->parameters = parameters;
+    esp_efuse_mac_get_default(task->mac);
+    pthread_mutex_init(&task->mutex, NULL);
+    pthread_cond_init(&task->notified, NULL);
+    task->notifications = 0;
+    return task;
+}
+
+//******************************************************************************
+static void* run_task(void* argument) {
+    current_task = (host_task*) argument;
+    host_set_mac_address(current_task->mac);
+    current_task->function(current_task->parameters);
+    return nullptr;
+}
+
+//******************************************************************************
+BaseType_t xTaskCreatePinnedToCore(
+    TaskFunction_t function,
+    const char* name,
+    uint32_t stack_size,
+    void* parameters,
+    UBaseType_t priority,
+    TaskHandle_t* created_task,
+    BaseType_t core_id
+) {
+    host_task* task = create_task_record(function, parameters);
+    if (task == nullptr) {
+        return pdFAIL;
+    }
+
+    pthread_attr_t attributes;
+    pthread_attr_init(&attributes);
+    pthread_attr_setstacksize(&attributes, stack_size > HOST_TASK_MIN_STACK_SIZE ? stack_size : HOST_TASK_MIN_STACK_SIZE);
+    pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED);
+
+    // Set before the task runs, it may use it right away.
+    if (created_task != nullptr) {
+        *created_task = task;
+    }
+
+    pthread_t thread;
+    int error = pthread_create(&thread, &attributes, run_task, task);
+    pthread_attr_destroy(&attributes);
+    if (error != 0) {
+        ESP_LOGE(TAG, "Failed to start %s (%s)", name, strerror(error));
+        if (created_task != nullptr) {
+            *created_task = nullptr;
+        }
+        delete task;
+        return pdFAIL;
+    }
+
+    char thread_name[16];
+    snprintf(thread_name, sizeof(thread_name), "%s", name);
+    pthread_setname_np(thread, thread_name);
+    return pdPASS;
+}
+
+//******************************************************************************
+BaseType_t xTaskCreate(
+    TaskFunction_t function,
+    const char* name,
+    uint32_t stack_size,
+    void* parameters,
+    UBaseType_t priority,
+    TaskHandle_t* created_task
+) {
+    return xTaskCreatePinnedToCore(function, name, stack_size, parameters, priority, created_task, 0);
+}
+
+//******************************************************************************
+void vTaskDelete(TaskHandle_t task) {
+    if (task != nullptr && task != current_task) {
+        ESP_LOGE(TAG, "A task can only delete itself");
+        return;
+    }
+    pthread_exit(nullptr);
+}
+
+//******************************************************************************
+void vTaskSuspend(TaskHandle_t task) {
+    ESP_LOGW(TAG, "vTaskSuspend is not supported");
+}
+
+//******************************************************************************
+void vTaskResume(TaskHandle_t task) {
+    ESP_LOGW(TAG, "vTaskResume is not supported");
+}
+
+//******************************************************************************
+TaskHandle_t xTaskGetCurrentTaskHandle(void) {
+    if (current_task == nullptr) {
+        current_task = create_task_record(nullptr, nullptr);
+    }
+    return current_task;
+}
+
+//******************************************************************************
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+    pthread_mutex_lock(&task->mutex);
+    task->notifications++;
+    pthread_cond_signal(&task->notified);
+    pthread_mutex_unlock(&task->mutex);
+    return pdPASS;
+}
+
+//******************************************************************************
+uint32_t ulTaskNotifyTake(BaseType_t clear_count_on_exit, TickType_t ticks) {
+    host_task* task = xTaskGetCurrentTaskHandle();
+    struct timespec deadline = deadline_in(ticks);
+
+    pthread_mutex_lock(&task->mutex);
+    while (task->notifications == 0) {
+        int error = ticks == portMAX_DELAY
+            ? pthread_cond_wait(&task->notified, &task->mutex)
+            : pthread_cond_timedwait(&task->notified, &task->mutex, &deadline);
+        if (error == ETIMEDOUT) {
+            break;
+        }
+    }
+
+    uint32_t notifications = task->notifications;
+    if (notifications > 0) {
+        task->notifications = clear_count_on_exit ? 0 : notifications - 1;
+    }
+    pthread_mutex_unlock(&task->mutex);
+    return notifications;
+}
+
+//******************************************************************************
+// A FreeRTOS mutex only goes back from the task holding it, giving it again
+// fails; MqttAgent relies on that when a handler published.
+static void init_mutex(host_semaphore* semaphore) {
+    pthread_mutexattr_t attributes;
+    pthread_mutexattr_init(&attributes);
+    pthread_mutexattr_settype(&attributes, PTHREAD_MUTEX_ERRORCHECK);
+    pthread_mutex_init(&semaphore->mutex, &attributes);
+    pthread_mutexattr_destroy(&attributes);
+}
+
+//******************************************************************************
+SemaphoreHandle_t xSemaphoreCreateMutex(void) {
+    host_semaphore* semaphore = new (std::nothrow) host_semaphore;
+    if (semaphore != nullptr) {
+        init_mutex(semaphore);
+    }
+    return semaphore;
+}
+
+//******************************************************************************
+SemaphoreHandle_t xSemaphoreCreateMutexStatic(StaticSemaphore_t* buffer) {
+    host_semaphore* semaphore = new (buffer->storage) host_semaphore;
+    init_mutex(semaphore);
+    return semaphore;
+}
+
+//******************************************************************************
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks) {
+    if (ticks == portMAX_DELAY) {
+        return pthread_mutex_lock(&semaphore->mutex) == 0 ? pdTRUE : pdFALSE;
+    }
+
+    struct timespec deadline = deadline_in(ticks);
+    return pthread_mutex_timedlock(&semaphore->mutex, &deadline) == 0 ? pdTRUE : pdFALSE;
+}
+
+//******************************************************************************
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore) {
+    return pthread_mutex_unlock(&semaphore->mutex) == 0 ? pdTRUE : pdFALSE;
+}
+
+//******************************************************************************
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size) {
+    host_queue* queue = new (std::nothrow) host_queue;
+    if (queue == nullptr) {
+        return nullptr;
+    }
+
+    queue->items = new (std::nothrow) uint8_t[length * item_size];
+    if (queue->items == nullptr) {
+        delete queue;
+        return nullptr;
+    }
+    pthread_mutex_init(&queue->mutex, NULL);
+    pthread_cond_init(&queue->changed, NULL);
+    queue->length = length;
+    queue->item_size = item_size;
+    queue->head = 0;
+    queue->count = 0;
+    return queue;
+}
+
+//******************************************************************************
+// With the queue mutex held, false once the wait timed out.
+static bool wait_queue(host_queue* queue, TickType_t ticks, const struct timespec& deadline) {
+    if (ticks == 0) {
+        return false;
+    }
+    int error = ticks == portMAX_DELAY
+        ? pthread_cond_wait(&queue->changed, &queue->mutex)
+        : pthread_cond_timedwait(&queue->changed, &queue->mutex, &deadline);
+    return error != ETIMEDOUT;
+}
+
+//******************************************************************************
+BaseType_t xQueueSend(QueueHandle_t queue, const void* item, TickType_t ticks) {
+    struct timespec deadline = deadline_in(ticks);
+
+    pthread_mutex_lock(&queue->mutex);
+    while (queue->count == queue->length) {
+        if (!wait_queue(queue, ticks, deadline)) {
+            pthread_mutex_unlock(&queue->mutex);
+            return errQUEUE_FULL;
+        }
+    }
+
+    UBaseType_t tail = (queue->head + queue->count) % queue->length;
+    memcpy(queue->items + tail * queue->item_size, item, queue->item_size);
+    queue->count++;
+    pthread_cond_broadcast(&queue->changed);
+    pthread_mutex_unlock(&queue->mutex);
+    return pdPASS;
+}
+
+//******************************************************************************
+BaseType_t xQueueReceive(QueueHandle_t queue, void* item, TickType_t ticks) {
+    struct timespec deadline = deadline_in(ticks);
+
+    pthread_mutex_lock(&queue->mutex);
+    while (queue->count == 0) {
+        if (!wait_queue(queue, ticks, deadline)) {
+            pthread_mutex_unlock(&queue->mutex);
+            return pdFALSE;
+        }
+    }
+
+    memcpy(item, queue->items + queue->head * queue->item_size, queue->item_size);
+    queue->head = (queue->head + 1) % queue->length;
+    queue->count--;
+    pthread_cond_broadcast(&queue->changed);
+    pthread_mutex_unlock(&queue->mutex);
+    return pdPASS;
+}
+
+//******************************************************************************
+EventGroupHandle_t xEventGroupCreate(void) {
+    host_event_group* event_group = new (std::nothrow) host_event_group;
+    if (event_group != nullptr) {
+        pthread_mutex_init(&event_group->mutex, NULL);
+        pthread_cond_init(&event_group->changed, NULL);
+        event_group->bits = 0;
+    }
+    return event_group;
+}
+
+//******************************************************************************
+EventBits_t xEventGroupWaitBits(
+    EventGroupHandle_t event_group,
+    EventBits_t bits_to_wait_for,
+    BaseType_t clear_on_exit,
+    BaseType_t wait_for_all_bits,
+    TickType_t ticks_to_wait
+) {
+    struct timespec deadline = deadline_in(ticks_to_wait);
+
+    pthread_mutex_lock(&event_group->mutex);
+    while (true) {
+        EventBits_t set = event_group->bits & bits_to_wait_for;
+        if (wait_for_all_bits ? set == bits_to_wait_for : set != 0) {
+            break;
+        }
+        int error = ticks_to_wait == portMAX_DELAY
+            ? pthread_cond_wait(&event_group->changed, &event_group->mutex)
+            : pthread_cond_timedwait(&event_group->changed, &event_group->mutex, &deadline);
+        if (error == ETIMEDOUT) {
+            break;
+        }
+    }
+
+    EventBits_t bits = event_group->bits;
+    if (clear_on_exit) {
+        event_group->bits &= ~bits_to_wait_for;
+    }
+    pthread_mutex_unlock(&event_group->mutex);
+    return bits;
+}
+
+//******************************************************************************
+EventBits_t xEventGroupSetBits(EventGroupHandle_t event_group, EventBits_t bits_to_set) {
+    pthread_mutex_lock(&event_group->mutex);
+    event_group->bits |= bits_to_set;
+    EventBits_t bits = event_group->bits;
+    pthread_cond_broadcast(&event_group->changed);
+    pthread_mutex_unlock(&event_group->mutex);
+    return bits;
+}
+
+//******************************************************************************
+EventBits_t xEventGroupClearBits(EventGroupHandle_t event_group, EventBits_t bits_to_clear) {
+    pthread_mutex_lock(&event_group->mutex);
+    EventBits_t bits = event_group->bits;
+    event_group->bits &= ~bits_to_clear;
+    pthread_mutex_unlock(&event_group->mutex);
+    return bits;
+}
+
+//******************************************************************************
+EventBits_t xEventGroupGetBits(EventGroupHandle_t event_group) {
+    pthread_mutex_lock(&event_group->mutex);
+    EventBits_t bits = event_group->bits;
+    pthread_mutex_unlock(&event_group->mutex);
+    return bits;
+}
@@ -0,0 +1,14 @@
+//******************************************************************************
+/**
+ * @file netdb.h
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief Host shim, lwip netdb on POSIX
+ * @version 0.1
+ * @date 2024-02-21
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#pragma once
+
+#include <netdb.h>
@@ -0,0 +1,15 @@
+//******************************************************************************
+/**
+ * @file sockets.h
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief Host shim, lwip sockets on POSIX
+ * @version 0.1
+ * @date 2024-02-21
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#pragma once
+
+#include <sys/socket.h>
+#include <netinet/in.h>
@@ -0,0 +1,68 @@
+//******************************************************************************
+/**
+ * @file network_transport.h
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief Host shim, the esp-aws-iot transport API over esp_tls
+ * @version 0.1
+ * @date 2024-02-21
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#pragma once
+
+#include "transport_interface.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "esp_log.h"
+#include "esp_tls.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum TlsTransportStatus {
+    TLS_TRANSPORT_SUCCESS = 0,
+    TLS_TRANSPORT_INVALID_PARAMETER,
+    TLS_TRANSPORT_INSUFFICIENT_MEMORY,
+    TLS_TRANSPORT_INVALID_CREDENTIALS,
+    TLS_TRANSPORT_HANDSHAKE_FAILED,
+    TLS_TRANSPORT_INTERNAL_ERROR,
+    TLS_TRANSPORT_CONNECT_FAILURE
+} TlsTransportStatus_t;
+
+// The esp-aws-iot context, MqttConnection fills it in as on the device.
+// pcServerRootCA NULL makes xTlsConnect open a plain TCP connection.
+struct NetworkContext {
+    const char* pcHostname;
+    int xPort;
+    esp_tls_t* pxTls;
+    SemaphoreHandle_t xTlsContextSemaphore;
+    const char* pcServerRootCA;
+    uint32_t pcServerRootCASize;
+    const char* pcClientCert;
+    uint32_t pcClientCertSize;
+    const char* pcClientKey;
+    uint32_t pcClientKeySize;
+    const char** pAlpnProtos;
+
+    // Host only, how long recv waits for data.  0 is the 10 ms select of the
+    // esp-aws-iot transport, -1 returns at once for a caller polling the
+    // socket itself.
+    int recv_poll_ms;
+};
+
+TlsTransportStatus_t xTlsConnect(NetworkContext_t* pxNetworkContext);
+TlsTransportStatus_t xTlsDisconnect(NetworkContext_t* pxNetworkContext);
+int32_t espTlsTransportSend(NetworkContext_t* pxNetworkContext, const void* pvData, size_t uxDataLen);
+int32_t espTlsTransportRecv(NetworkContext_t* pxNetworkContext, void* pvData, size_t uxDataLen);
+
+#ifdef __cplusplus
+}
+#endif
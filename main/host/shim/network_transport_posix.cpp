@@ -0,0 +1,135 @@
+//******************************************************************************
+/**
+ * @file network_transport_posix.cpp
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief Host shim, coreMQTT transport over esp_tls
+ * @version 0.1
+ * @date 2024-02-21
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#include "network_transport.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <poll.h>
+#include <errno.h>
+#include <string.h>
+
+#ifdef HOST_USE_OPENSSL
+#include <openssl/ssl.h>
+#endif
+
+// Same wait as the select in espTlsTransportRecv of esp-aws-iot.
+#define TRANSPORT_RECV_WAIT_MS  (10)
+
+//******************************************************************************
+TlsTransportStatus_t xTlsConnect(NetworkContext_t* ctx) {
+    if (ctx == nullptr || ctx->pcHostname == nullptr) {
+        return TLS_TRANSPORT_INVALID_PARAMETER;
+    }
+
+    esp_tls_cfg_t cfg = {};
+    cfg.cacert_buf = (const unsigned char*) ctx->pcServerRootCA;
+    cfg.cacert_bytes = ctx->pcServerRootCASize;
+    cfg.clientcert_buf = (const unsigned char*) ctx->pcClientCert;
+    cfg.clientcert_bytes = ctx->pcClientCertSize;
+    cfg.clientkey_buf = (const unsigned char*) ctx->pcClientKey;
+    cfg.clientkey_bytes = ctx->pcClientKeySize;
+    cfg.alpn_protos = ctx->pAlpnProtos;
+    cfg.common_name = ctx->pcHostname;
+
+    esp_tls_t* tls = esp_tls_init();
+    if (tls == nullptr) {
+        return TLS_TRANSPORT_INSUFFICIENT_MEMORY;
+    }
+    if (esp_tls_conn_new_sync(ctx->pcHostname, (int) strlen(ctx->pcHostname), ctx->xPort, &cfg, tls) <= 0) {
+        esp_tls_conn_destroy(tls);
+        ctx->pxTls = nullptr;
+        return TLS_TRANSPORT_CONNECT_FAILURE;
+    }
+
+    ctx->pxTls = tls;
+    return TLS_TRANSPORT_SUCCESS;
+}
+
+//******************************************************************************
+TlsTransportStatus_t xTlsDisconnect(NetworkContext_t* ctx) {
+    if (ctx == nullptr) {
+        return TLS_TRANSPORT_INVALID_PARAMETER;
+    }
+
+    if (ctx->pxTls != nullptr) {
+        esp_tls_conn_destroy(ctx->pxTls);
+        ctx->pxTls = nullptr;
+    }
+    return TLS_TRANSPORT_SUCCESS;
+}
+
+//******************************************************************************
+int32_t espTlsTransportSend(NetworkContext_t* ctx, const void* data, size_t length) {
+    esp_tls_t* tls = ctx->pxTls;
+    if (tls == nullptr) {
+        return -1;
+    }
+
+#ifdef HOST_USE_OPENSSL
+    if (tls->ssl != nullptr) {
+        int sent = SSL_write((SSL*) tls->ssl, data, (int) length);
+        return sent > 0 ? sent : -1;
+    }
+#endif
+    ssize_t sent = send(tls->sockfd, data, length, MSG_NOSIGNAL);
+    if (sent < 0) {
+        return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+    }
+    return (int32_t) sent;
+}
+
+//******************************************************************************
+int32_t espTlsTransportRecv(NetworkContext_t* ctx, void* data, size_t length) {
+    esp_tls_t* tls = ctx->pxTls;
+    if (tls == nullptr) {
+        return -1;
+    }
+
+#ifdef HOST_USE_OPENSSL
+    SSL* ssl = (SSL*) tls->ssl;
+    if (ssl != nullptr && SSL_pending(ssl) > 0) {
+        int got = SSL_read(ssl, data, (int) length);
+        return got > 0 ? got : -1;
+    }
+#endif
+
+    // coreMQTT polls recv and expects 0 when nothing is there.
+    int wait_ms = ctx->recv_poll_ms == 0 ? TRANSPORT_RECV_WAIT_MS : (ctx->recv_poll_ms < 0 ? 0 : ctx->recv_poll_ms);
+    struct pollfd fd = { tls->sockfd, POLLIN, 0 };
+    int ready = poll(&fd, 1, wait_ms);
+    if (ready == 0) {
+        return 0;
+    }
+    if (ready < 0 || (fd.revents & (POLLERR | POLLHUP)) != 0) {
+        return -1;
+    }
+
+#ifdef HOST_USE_OPENSSL
+    if (ssl != nullptr) {
+        int got = SSL_read(ssl, data, (int) length);
+        if (got > 0) {
+            return got;
+        }
+        int error = SSL_get_error(ssl, got);
+        return (error == SSL_ERROR_WANT_READ || error == SSL_ERROR_WANT_WRITE) ? 0 : -1;
+    }
+#endif
+
+    ssize_t got = recv(tls->sockfd, data, length, 0);
+    if (got == 0) {
+        return -1;                      // peer closed
+    }
+    if (got < 0) {
+        return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+    }
+    return (int32_t) got;
+}
@@ -0,0 +1,25 @@
+//******************************************************************************
+/**
+ * @file nvs_flash.h
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief Host shim, nvs in memory
+ * @version 0.1
+ * @date 2024-02-21
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#pragma once
+
+#include "nvs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+esp_err_t nvs_flash_init_partition(const char* partition_label);
+esp_err_t nvs_flash_erase_partition(const char* part_name);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,189 @@
+//******************************************************************************
+/**
+ * @file nvs_posix.cpp
+ * @author pat laplante (plaplante@appliedlogix.com)
+ * @brief Host shim, nvs in memory
+ * @version 0.1
+ * @date 2024-02-21
+ *
+ * @copyright Copyright MN8 (c) 2024
+ */
+//******************************************************************************
+#include "nvs.h"
+#include "nvs_flash.h"
+
+#include <string.h>
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+typedef enum {
+    e_nvs_u8,
+    e_nvs_u16,
+    e_nvs_u32,
+    e_nvs_str,
+    e_nvs_blob,
+} nvs_type_t;
+
+struct nvs_entry_t {
+    nvs_type_t type;
+    std::vector<uint8_t> value;
+};
+
+static std::mutex nvs_mutex;
+static std::vector<std::string> namespaces;     // handle - 1
+static std::map<std::pair<std::string, std::string>, nvs_entry_t> entries;
+
+//******************************************************************************
+// With the mutex held.
+static const std::string* get_namespace(nvs_handle_t handle) {
+    if (handle == 0 || handle > namespaces.size()) {
+        return nullptr;
+    }
+    return &namespaces[handle - 1];
+}
+
+//******************************************************************************
+static esp_err_t set_value(nvs_handle_t handle, const char* key, nvs_type_t type, const void* value, size_t length) {
+    std::lock_guard<std::mutex> lock(nvs_mutex);
+    const std::string* name = get_namespace(handle);
+    if (name == nullptr) {
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+
+    nvs_entry_t& entry = entries[std::make_pair(*name, std::string(key))];
+    entry.type = type;
+    entry.value.assign((const uint8_t*) value, (const uint8_t*) value + length);
+    return ESP_OK;
+}
+
+//******************************************************************************
+// A NULL out_value only reads the length, as nvs_get_blob does.
+static esp_err_t get_value(nvs_handle_t handle, const char* key, nvs_type_t type, void* out_value, size_t* length) {
+    std::lock_guard<std::mutex> lock(nvs_mutex);
+    const std::string* name = get_namespace(handle);
+    if (name == nullptr) {
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+
+    auto found = entries.find(std::make_pair(*name, std::string(key)));
+    if (found == entries.end()) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    if (found->second.type != type) {
+        return ESP_ERR_NVS_TYPE_MISMATCH;
+    }
+
+    const std::vector<uint8_t>& value = found->second.value;
+    if (out_value == nullptr) {
+        *length = value.size();
+        return ESP_OK;
+    }
+    if (*length < value.size()) {
+        return ESP_ERR_NVS_INVALID_LENGTH;
+    }
+    memcpy(out_value, value.data(), value.size());
+    *length = value.size();
+    return ESP_OK;
+}
+
+//******************************************************************************
+esp_err_t nvs_flash_init_partition(const char* partition_label) {
+    return ESP_OK;
+}
+
+//******************************************************************************
+esp_err_t nvs_flash_erase_partition(const char* part_name) {
+    std::lock_guard<std::mutex> lock(nvs_mutex);
+    entries.clear();
+    return ESP_OK;
+}
+
+//******************************************************************************
+esp_err_t nvs_open_from_partition(const char* part_name, const char* namespace_name, nvs_open_mode_t open_mode, nvs_handle_t* out_handle) {
+    std::lock_guard<std::mutex> lock(nvs_mutex);
+    for (size_t i = 0; i < namespaces.size(); i++) {
+        if (namespaces[i] == namespace_name) {
+            *out_handle = (nvs_handle_t) (i + 1);
+            return ESP_OK;
+        }
+    }
+    namespaces.push_back(namespace_name);
+    *out_handle = (nvs_handle_t) namespaces.size();
+    return ESP_OK;
+}
+
+//******************************************************************************
+void nvs_close(nvs_handle_t handle) {
+    // The handle stays valid, there is one per namespace.
+}
+
+//******************************************************************************
+esp_err_t nvs_get_u8(nvs_handle_t handle, const char* key, uint8_t* out_value) {
+    size_t length = sizeof(*out_value);
+    return get_value(handle, key, e_nvs_u8, out_value, &length);
+}
+
+//******************************************************************************
+esp_err_t nvs_get_u16(nvs_handle_t handle, const char* key, uint16_t* out_value) {
+    size_t length = sizeof(*out_value);
+    return get_value(handle, key, e_nvs_u16, out_value, &length);
+}
+
+//******************************************************************************
+esp_err_t nvs_get_u32(nvs_handle_t handle, const char* key, uint32_t* out_value) {
+    size_t length = sizeof(*out_value);
+    return get_value(handle, key, e_nvs_u32, out_value, &length);
+}
+
+//******************************************************************************
+esp_err_t nvs_get_str(nvs_handle_t handle, const char* key, char* out_value, size_t* length) {
+    return get_value(handle, key, e_nvs_str, out_value, length);
+}
+
+//******************************************************************************
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char* key, void* out_value, size_t* length) {
+    return get_value(handle, key, e_nvs_blob, out_value, length);
+}
+
+//******************************************************************************
+esp_err_t nvs_set_u8(nvs_handle_t handle, const char* key, uint8_t value) {
+    return set_value(handle, key, e_nvs_u8, &value, sizeof(value));
+}
+
+//******************************************************************************
+esp_err_t nvs_set_u16(nvs_handle_t handle, const char* key, uint16_t value) {
+    return set_value(handle, key, e_nvs_u16, &value, sizeof(value));
+}
+
+//******************************************************************************
+esp_err_t nvs_set_u32(nvs_handle_t handle, const char* key, uint32_t value) {
+    return set_value(handle, key, e_nvs_u32, &value, sizeof(value));
+}
+
+//******************************************************************************
+esp_err_t nvs_set_str(nvs_handle_t handle, const char* key, const char* value) {
+    return set_value(handle, key, e_nvs_str, value, strlen(value) + 1);
+}
+
+//******************************************************************************
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char* key, const void* value, size_t length) {
+    return set_value(handle, key, e_nvs_blob, value, length);
+}
+
+//******************************************************************************
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char* key) {
+    std::lock_guard<std::mutex> lock(nvs_mutex);
+    const std::string* name = get_namespace(handle);
+    if (name == nullptr) {
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+    return entries.erase(std::make_pair(*name, std::string(key))) > 0 ? ESP_OK : ESP_ERR_NVS_NOT_FOUND;
+}
+
+//******************************************************************************
+esp_err_t nvs_commit(nvs_handle_t handle) {
+    return ESP_OK;
+}
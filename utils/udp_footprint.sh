@@ -0,0 +1,61 @@
+#!/usr/bin/env bash
+
+# Static RAM and stack of the udp server, from a firmware build and a device.
+#
+#   utils/udp_footprint.sh [--compare <rev>] [device ip]
+#
+# Run from the root of the repo after idf.py build.  The static RAM comes from
+# the map file, per object file.  With a device ip the stack high-water mark
+# and the scratch arena peak are read with get-command-stats, after the device
+# served a few requests.
+#
+# With --compare the same sizes are given for <rev>, built in a worktree next
+# to this one.  For the numbers before the scratch arena, compare with the
+# commit before it (the memory entry is missing there, the stack is then only
+# known from the task watchdog).
+
+objects="udp_server|ScratchArena|iot_provisioning"
+port=23269
+
+compare=""
+if [[ "$1" == "--compare" ]]; then
+    compare="$2"
+    shift 2
+    [[ -n "$compare" ]] || { echo "--compare needs a revision"; exit 1; }
+fi
+
+[[ -f build/project_description.json ]] || { echo "No firmware build, run idf.py build first"; exit 1; }
+
+sizes() {
+    echo "== main component"
+    idf.py -C "$1" size-components | grep -E "Archive File|libmain.a"
+
+    echo "== udp server objects"
+    idf.py -C "$1" size-files | grep -E "Object File|$objects"
+}
+
+echo "==== $(git rev-parse --short HEAD)"
+sizes .
+
+if [[ -n "$compare" ]]; then
+    rev=$(git rev-parse --short "$compare") || exit 1
+    tree="${TMPDIR:-/tmp}/footprint-$rev"
+    if [[ ! -d "$tree" ]]; then
+        git worktree add --detach "$tree" "$rev" || exit 1
+        git -C "$tree" submodule update --init --recursive || exit 1
+    fi
+    idf.py -C "$tree" build > "$tree/build.log" || { echo "Build of $rev failed, see $tree/build.log"; exit 1; }
+
+    echo "==== $rev"
+    sizes "$tree"
+fi
+
+if [[ -n "$1" ]]; then
+    echo "== get-command-stats from $1"
+    echo '{"command":"get-command-stats"}' | nc -u -w 2 "$1" $port | python3 -c '
+import json, sys
+memory = json.loads(sys.stdin.readline())["response"]["memory"]
+for key, value in memory.items():
+    print("%-16s %d" % (key, value))
+'
+fi